@@ -0,0 +1,140 @@
+#!/usr/bin/perl -w
+# This file is part of Hubbub.
+# Licensed under the MIT License,
+#                http://www.opensource.org/licenses/mit-license.php
+# Copyright 2026 The NetSurf Project.
+
+use strict;
+
+use constant DOCTYPES_FILE => 'build/Doctypes';
+use constant DOCTYPES_INC  => 'src/treebuilder/doctypes.inc';
+
+# Flags recorded at the node where an identifier ends, one per kind
+my %kinds = (
+   prefix  => 1,
+   exact   => 2,
+   limited => 4,
+   system  => 8,
+);
+
+open(INFILE, "<", DOCTYPES_FILE) || die "Unable to open " . DOCTYPES_FILE;
+
+my @doctypes;
+
+while (my $line = <INFILE>) {
+   last unless (defined $line);
+   next if ($line =~ /^#/);
+   chomp $line;
+   next if ($line eq '');
+   my ($kind, $id) = split /\t+/, $line, 2;
+   die "Unknown kind of doctype: $kind" unless defined($kinds{$kind});
+   push @doctypes, [ $kinds{$kind}, $id ];
+}
+
+close(INFILE);
+
+my $output = <<'EOH';
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 The NetSurf Project.
+ *
+ * Note: This file is automatically generated by make-doctypes.pl
+ *
+ * Do not edit this file, changes will be overwritten during build.
+ */
+
+#define DOCTYPE_PREFIX 1
+#define DOCTYPE_EXACT 2
+#define DOCTYPE_LIMITED 4
+#define DOCTYPE_SYSTEM 8
+
+
+EOH
+
+# Build a trie of the identifiers, with ASCII letters in lower case. Each
+# node is a hash of child nodes keyed on character, plus the flags of the
+# identifiers ending at that node.
+
+my $trie = { children => {}, flags => 0 };
+
+foreach my $doctype (@doctypes) {
+   my ($flag, $id) = @$doctype;
+   my $node = $trie;
+
+   $id =~ tr/A-Z/a-z/;
+
+   foreach my $c (split //, $id) {
+      $node->{children}{$c} = { children => {}, flags => 0 }
+            unless defined($node->{children}{$c});
+      $node = $node->{children}{$c};
+   }
+
+   $node->{flags} |= $flag;
+}
+
+# Number the nodes breadth first, so that the children of every node are
+# contiguous and sorted by character, as in the entity trie
+
+my @nodelist = ( $trie );
+$trie->{label} = 0;
+
+for (my $i = 0; $i < scalar(@nodelist); $i++) {
+   my $node = $nodelist[$i];
+   my @keys = sort keys %{$node->{children}};
+
+   $node->{first} = scalar(@nodelist);
+   $node->{count} = scalar(@keys);
+
+   foreach my $c (@keys) {
+      my $child = $node->{children}{$c};
+      $child->{label} = ord($c);
+      push @nodelist, $child;
+   }
+}
+
+die "Too many doctype nodes" if (scalar(@nodelist) > 65535);
+
+# Serialise the trie to the output string, as parallel arrays
+
+sub emit_array {
+   my ($type, $name, $field) = @_;
+   my $out = "static const $type $name\[] = {\n";
+   my $line = "";
+
+   foreach my $node (@nodelist) {
+      my $item = "$node->{$field}, ";
+      if (length($line) + length($item) > 72) {
+         $line =~ s/ $//;
+         $out .= "\t$line\n";
+         $line = "";
+      }
+      $line .= $item;
+   }
+   $line =~ s/ $//;
+   $out .= "\t$line\n" if ($line ne "");
+   $out .= "};\n\n";
+
+   return $out;
+}
+
+$output .= emit_array("uint8_t", "doctype_label", "label");
+$output .= emit_array("uint16_t", "doctype_first", "first");
+$output .= emit_array("uint8_t", "doctype_count", "count");
+$output .= emit_array("uint8_t", "doctype_flags", "flags");
+
+# Write file out
+
+if (open(EXISTING, "<", DOCTYPES_INC)) {
+   local $/ = undef();
+   my $now = <EXISTING>;
+   undef($output) if ($output eq $now);
+   close(EXISTING);
+}
+
+if (defined($output)) {
+   open(OUTF, ">", DOCTYPES_INC);
+   print OUTF $output;
+   close(OUTF);
+}
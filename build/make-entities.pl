@@ -42,85 +42,75 @@ my $output = <<'EOH';
 
 EOH
 
-# Build a Trie of the entities
+# Build a trie of the entities. Each node is a hash of child nodes keyed
+# on character, plus the code of the entity ending at that node, if any.
 
-my $heapindex = 0;
+my $trie = { children => {} };
 
-my @nodelist;
-
-sub insert_node {
-   my ($parent, $key, $code) = @_;
-   my ($pivot, $tail);
-
-   if (length($key) == 0) {
-      $pivot = ''; $tail = '';
-   } elsif (length($key) == 1) {
-      $pivot = $key; $tail = '';
-   } else {
-      $pivot = substr($key, 0, 1);
-      $tail = substr($key, 1);
-   }
+foreach my $key (keys %entities) {
+   my $node = $trie;
 
-   unless (defined($parent)) {
-      $parent = { pivot => $pivot, heapindex => $heapindex };
-      push @nodelist, $parent;
-      $heapindex++;
+   foreach my $c (split //, $key) {
+      $node->{children}{$c} = { children => {} }
+            unless defined($node->{children}{$c});
+      $node = $node->{children}{$c};
    }
 
-   if ($pivot lt $parent->{pivot}) {
-      $parent->{lt} = insert_node($parent->{lt}, $key, $code);
-   } elsif ($pivot eq $parent->{pivot}) {
-      if ($pivot eq '') {
-         $parent->{value} = $code;
-      } elsif (substr($tail, 0, 1) eq '') {
-         $parent->{value} = $code;
-         $parent->{eq} = insert_node($parent->{eq}, $tail, $code);
-      } else {
-         $parent->{eq} = insert_node($parent->{eq}, $tail, $code);
-      }
-   } else {
-      $parent->{gt} = insert_node($parent->{gt}, $key, $code);
-   }
-   return $parent;
+   $node->{value} = $entities{$key};
 }
 
-my $trie;
-
-foreach my $key (keys %entities) {
-   $trie = insert_node($trie, $key, $entities{$key});
-}
+# Number the nodes breadth first, so that the children of every node are
+# contiguous and sorted by character. A search step then only needs to
+# scan a short run of adjacent labels.
 
-# Serialise the Trie to the output string
+my @nodelist = ( $trie );
+$trie->{label} = 0;
 
-$output .= "static hubbub_entity_node dict[] = {\n";
+for (my $i = 0; $i < scalar(@nodelist); $i++) {
+   my $node = $nodelist[$i];
+   my @keys = sort keys %{$node->{children}};
 
-foreach my $node (@nodelist) {
-   my $split = $node->{pivot};
-   my $lt = $node->{lt};
-   my $eq = $node->{eq};
-   my $gt = $node->{gt};
-   my $value = $node->{value};
+   $node->{first} = scalar(@nodelist);
+   $node->{count} = scalar(@keys);
 
-   $lt = $lt->{heapindex} if defined($lt);
-   $lt = "-1" unless defined($lt);
+   foreach my $c (@keys) {
+      my $child = $node->{children}{$c};
+      $child->{label} = ord($c);
+      push @nodelist, $child;
+   }
+}
 
-   $eq = $eq->{heapindex} if defined($eq);
-   $eq = "-1" unless defined($eq);
+die "Too many entity nodes" if (scalar(@nodelist) > 65535);
 
-   $gt = $gt->{heapindex} if defined($gt);
-   $gt = "-1" unless defined($gt);
+# Serialise the trie to the output string, as parallel arrays
 
-   $split = ord($split) if ($split ne '');
-   $split = 0 if ($split eq '');
+sub emit_array {
+   my ($type, $name, $field, $default) = @_;
+   my $out = "static const $type $name\[] = {\n";
+   my $line = "";
 
-   $value = "0" unless defined($value);
+   foreach my $node (@nodelist) {
+      my $value = $node->{$field};
+      $value = $default unless defined($value);
+      my $item = "$value, ";
+      if (length($line) + length($item) > 72) {
+         $line =~ s/ $//;
+         $out .= "\t$line\n";
+         $line = "";
+      }
+      $line .= $item;
+   }
+   $line =~ s/ $//;
+   $out .= "\t$line\n" if ($line ne "");
+   $out .= "};\n\n";
 
-   $output .= "\t{ $split, $lt, $eq, $gt, $value },\n";
+   return $out;
 }
 
-$output .= "};\n\n";
-
-$output .= "static int32_t dict_root = " . $trie->{heapindex} . ";\n";
+$output .= emit_array("uint8_t", "entity_label", "label", 0);
+$output .= emit_array("uint16_t", "entity_first", "first", 0);
+$output .= emit_array("uint8_t", "entity_count", "count", 0);
+$output .= emit_array("uint32_t", "entity_value", "value", 0);
 
 # Write file out
 
@@ -7,7 +7,6 @@
  * Copyright 2008 John-Mark Bell <jmb@netsurf-browser.org>
  */
 
-#define _GNU_SOURCE /* for strndup */
 #include <assert.h>
 #include <stdbool.h>
 #include <string.h>
@@ -76,7 +75,7 @@ static struct {
 	{ "xmlns", "http://www.w3.org/2000/xmlns/" }
 };
 
-static inline char *c_string_from_hubbub_string(context *ctx, 
+static inline const xmlChar *dict_name_from_hubbub_string(context *ctx,
 		const hubbub_string *str);
 static void create_namespaces(context *ctx, xmlNode *root);
 static hubbub_error create_comment(void *ctx, const hubbub_string *data, 
@@ -105,6 +104,8 @@ static hubbub_error add_attributes(void *ctx, void *node,
 		const hubbub_attribute *attributes, uint32_t n_attributes);
 static hubbub_error set_quirks_mode(void *ctx, hubbub_quirks_mode mode);
 static hubbub_error change_encoding(void *ctx, const char *charset);
+static hubbub_error append_text_to(void *ctx, void *parent,
+		const hubbub_string *data, bool *result);
 
 /* Prototype tree handler struct */
 static hubbub_tree_handler tree_handler = {
@@ -125,7 +126,10 @@ static hubbub_tree_handler tree_handler = {
 	add_attributes,
 	set_quirks_mode,
 	change_encoding,
-	NULL
+	NULL,
+	NULL,
+	0,
+	append_text_to
 };
 
 /******************************************************************************
@@ -296,6 +300,17 @@ error_code create_context(const char *charset, context **ctx)
 	/* Reference count of zero */
 	c->document->_private = (void *) 0;
 
+	/* Give the document a dictionary, so that each distinct element and
+	 * attribute name is stored once, and shared by every node using it.
+	 * It is freed with the document. */
+	c->document->dict = xmlDictCreate();
+	if (c->document->dict == NULL) {
+		xmlFreeDoc(c->document);
+		hubbub_parser_destroy(c->parser);
+		free(c);
+		return NOMEM;
+	}
+
 	for (i = 0; 
 		i < sizeof(c->namespaces) / sizeof(c->namespaces[0]); i++) {
 		c->namespaces[i] = NULL;
@@ -387,19 +402,23 @@ error_code parse_completed(context *c)
  ******************************************************************************/
 
 /**
- * Convert a hubbub string to a C string
+ * Intern a hubbub string in the document's dictionary
  *
  * \param ctx  Our context
- * \param str  The string to convert
- * \return Pointer to C string, must be freed
+ * \param str  The string to intern
+ * \return Pointer to the dictionary's copy of the string, or NULL on
+ *         memory exhaustion
  *
- * This is a simple utility routine, as libXML expects data to be C strings.
- * If we were implementing our own tree, we might store hubbub-style strings
- * instead (with the associated memory saving)
+ * The string is copied into the dictionary only the first time it is seen,
+ * and is owned by the dictionary, so must not be freed. libXML recognises
+ * names which come from the document's dictionary, and uses them in place
+ * rather than copying them again.
  */
-char *c_string_from_hubbub_string(context *ctx, const hubbub_string *str)
+const xmlChar *dict_name_from_hubbub_string(context *ctx,
+		const hubbub_string *str)
 {
-	return strndup((const char *) str->ptr, (int) str->len);
+	return xmlDictLookup(ctx->document->dict, BAD_CAST str->ptr,
+			(int) str->len);
 }
 
 /**
@@ -446,24 +465,22 @@ void create_namespaces(context *ctx, xmlNode *root)
 hubbub_error create_comment(void *ctx, const hubbub_string *data, void **result)
 {
 	context *c = (context *) ctx;
-	char *content;
 	xmlNodePtr n;
 
-	content = c_string_from_hubbub_string(c, data);
-	if (content == NULL)
+	/* The body is not terminated, so set it separately, by length */
+	n = xmlNewDocComment(c->document, NULL);
+	if (n == NULL)
 		return HUBBUB_NOMEM;
 
-	n = xmlNewDocComment(c->document, BAD_CAST content);
-	if (n == NULL) {
-		free(content);
+	n->content = xmlStrndup(BAD_CAST data->ptr, (int) data->len);
+	if (n->content == NULL) {
+		xmlFreeNode(n);
 		return HUBBUB_NOMEM;
 	}
 	/* We use the _private field of libXML's xmlNode struct for the 
 	 * reference count. */
 	n->_private = (void *) (uintptr_t) 1;
 
-	free(content);
-
 	*result = (void *) n;
 
 	return HUBBUB_OK;
@@ -482,39 +499,30 @@ hubbub_error create_comment(void *ctx, const hubbub_string *data, void **result)
 hubbub_error create_doctype(void *ctx, const hubbub_doctype *doctype, void **result)
 {
 	context *c = (context *) ctx;
-	char *name, *public = NULL, *system = NULL;
+	const xmlChar *name;
 	xmlDtdPtr n;
 
-	name = c_string_from_hubbub_string(c, &doctype->name);
+	name = dict_name_from_hubbub_string(c, &doctype->name);
 	if (name == NULL)
 		return HUBBUB_NOMEM;
 
-	/* May not have public ID */
-	if (!doctype->public_missing) {
-		public = c_string_from_hubbub_string(c, &doctype->public_id);
-		if (public == NULL) {
-			free(name);
-			return HUBBUB_NOMEM;
-		}
-	}
-
-	/* May not have system ID */
-	if (!doctype->system_missing) {
-		system = c_string_from_hubbub_string(c, &doctype->system_id);
-		if (system == NULL) {
-			free(public);
-			free(name);
-			return HUBBUB_NOMEM;
-		}
-	}
+	n = xmlNewDtd(c->document, name, NULL, NULL);
+	if (n == NULL)
+		return HUBBUB_NOMEM;
 
-	n = xmlNewDtd(c->document, BAD_CAST name, 
-			BAD_CAST (public ? public : ""),
-			BAD_CAST (system ? system : ""));
-	if (n == NULL) {
-		free(system);
-		free(public);
-		free(name);
+	/* The identifiers are not terminated, so are copied in by length.
+	 * Either may be missing, in which case it is empty. */
+	n->ExternalID = xmlStrndup(doctype->public_missing ? BAD_CAST "" :
+			BAD_CAST doctype->public_id.ptr,
+			doctype->public_missing ? 0 :
+			(int) doctype->public_id.len);
+	n->SystemID = xmlStrndup(doctype->system_missing ? BAD_CAST "" :
+			BAD_CAST doctype->system_id.ptr,
+			doctype->system_missing ? 0 :
+			(int) doctype->system_id.len);
+	if (n->ExternalID == NULL || n->SystemID == NULL) {
+		xmlUnlinkNode((xmlNodePtr) n);
+		xmlFreeDtd(n);
 		return HUBBUB_NOMEM;
 	}
 	/* Again, reference count must be 1 */
@@ -522,10 +530,6 @@ hubbub_error create_doctype(void *ctx, const hubbub_doctype *doctype, void **res
 
 	*result = (void *) n;
 
-	free(system);
-	free(public);
-	free(name);
-
 	return HUBBUB_OK;
 }
 
@@ -542,18 +546,22 @@ hubbub_error create_doctype(void *ctx, const hubbub_doctype *doctype, void **res
 hubbub_error create_element(void *ctx, const hubbub_tag *tag, void **result)
 {
 	context *c = (context *) ctx;
-	char *name;
+	const xmlChar *name;
 	xmlNodePtr n;
 
-	name = c_string_from_hubbub_string(c, &tag->name);
+	name = dict_name_from_hubbub_string(c, &tag->name);
 	if (name == NULL)
 		return HUBBUB_NOMEM;
 
+	/* The name comes from the document's dictionary, so the node may
+	 * "eat" it: it is used as is, and is never freed with the node */
 	if (c->namespaces[0] != NULL) {
-		n = xmlNewDocNode(c->document, c->namespaces[tag->ns - 1], 
-				BAD_CAST name, NULL);
+		n = xmlNewDocNodeEatName(c->document,
+				c->namespaces[tag->ns - 1],
+				(xmlChar *) name, NULL);
 	} else {
-		n = xmlNewDocNode(c->document, NULL, BAD_CAST name, NULL);
+		n = xmlNewDocNodeEatName(c->document, NULL,
+				(xmlChar *) name, NULL);
 
 		/* We're creating the root node of the document. Therefore,
 		 * create the namespaces and set this node's namespace */
@@ -563,10 +571,8 @@ hubbub_error create_element(void *ctx, const hubbub_tag *tag, void **result)
 			xmlSetNs(n, c->namespaces[tag->ns - 1]);
 		}
 	}
-	if (n == NULL) {
-		free(name);
+	if (n == NULL)
 		return HUBBUB_NOMEM;
-	}
 	/* Reference count must be 1 */
 	n->_private = (void *) (uintptr_t) 1;
 
@@ -574,14 +580,11 @@ hubbub_error create_element(void *ctx, const hubbub_tag *tag, void **result)
 	if (tag->n_attributes > 0 && add_attributes(ctx, (void *) n, 
 			tag->attributes, tag->n_attributes) != 0) {
 		xmlFreeNode(n);
-		free(name);
 		return HUBBUB_NOMEM;
 	}
 
 	*result = (void *) n;
 
-	free(name);
-
 	return HUBBUB_OK;
 }
 
@@ -706,15 +709,12 @@ hubbub_error append_child(void *ctx, void *parent, void *child, void **result)
 
 	if (chld->type == XML_TEXT_NODE && p->last != NULL && 
 			p->last->type == XML_TEXT_NODE) {
-		/* Need to clone the child, as libxml will free it if it 
-		 * merges the content with a pre-existing text node. */
-		chld = xmlCopyNode(chld, 0);
-		if (chld == NULL)
-			return HUBBUB_NOMEM;
+		/* Extend the existing text node in place. libxml would
+		 * free the child if it merged it, and the child remains
+		 * ours to release. */
+		xmlNodeAddContent(p->last, chld->content);
 
-		*result = xmlAddChild(p, chld);
-
-		assert(*result != (void *) chld);
+		*result = p->last;
 	} else {
 		*result = xmlAddChild(p, chld);
 	}
@@ -749,14 +749,10 @@ hubbub_error insert_before(void *ctx, void *parent, void *child, void *ref_child
 
 	if (chld->type == XML_TEXT_NODE && ref->prev != NULL && 
 			ref->prev->type == XML_TEXT_NODE) {
-		/* Clone text node, as it'll be freed by libxml */
-		chld = xmlCopyNode(chld, 0);
-		if (chld == NULL)
-			return HUBBUB_NOMEM;
+		/* Extend the preceding text node in place, as above */
+		xmlNodeAddContent(ref->prev, chld->content);
 
-		*result = xmlAddNextSibling(ref->prev, chld);
-
-		assert(*result != (void *) chld);
+		*result = ref->prev;
 	} else {
 		*result = xmlAddPrevSibling(ref, chld);
 	}
@@ -935,35 +931,38 @@ hubbub_error add_attributes(void *ctx, void *node,
 	uint32_t attr;
 
 	for (attr = 0; attr < n_attributes; attr++) {
+		const hubbub_string *value = &attributes[attr].value;
+		xmlNsPtr ns = NULL;
+		const xmlChar *name;
 		xmlAttr *prop;
-		char *name, *value;
+		xmlNode *text;
 
-		name = c_string_from_hubbub_string(c, &attributes[attr].name);
+		name = dict_name_from_hubbub_string(c, &attributes[attr].name);
 		if (name == NULL)
 			return HUBBUB_NOMEM;
 
-		value = c_string_from_hubbub_string(c, &attributes[attr].value);
-		if (value == NULL) {
-			free(name);
+		if (attributes[attr].ns != HUBBUB_NS_NULL && 
+				c->namespaces[0] != NULL)
+			ns = c->namespaces[attributes[attr].ns - 1];
+
+		/* As for elements, the property takes the interned name. Its
+		 * value is not terminated, so is added afterwards, as the
+		 * text node libxml would otherwise make from a copy. */
+		prop = xmlNewNsPropEatName(n, ns, (xmlChar *) name, NULL);
+		if (prop == NULL)
 			return HUBBUB_NOMEM;
-		}
 
-		if (attributes[attr].ns != HUBBUB_NS_NULL && 
-				c->namespaces[0] != NULL) {
-			prop = xmlNewNsProp(n, 
-					c->namespaces[attributes[attr].ns - 1],
-					BAD_CAST name, BAD_CAST value);
-		} else {
-			prop = xmlNewProp(n, BAD_CAST name, BAD_CAST value);
-		}
-		if (prop == NULL) {
-			free(value);
-			free(name);
+		text = xmlNewDocTextLen(c->document, BAD_CAST value->ptr,
+				(int) value->len);
+		if (text == NULL)
 			return HUBBUB_NOMEM;
-		}
 
-		free(value);
-		free(name);
+		text->parent = (xmlNode *) prop;
+		prop->children = prop->last = text;
+
+		/* With the value given up front, libxml records IDs itself */
+		if (xmlIsID(c->document, n, prop) == 1)
+			xmlAddID(NULL, c->document, text->content, prop);
 	}
 
 	return HUBBUB_OK;
@@ -1033,3 +1032,34 @@ hubbub_error change_encoding(void *ctx, const char *charset)
 	return (charset == name) ? HUBBUB_OK : HUBBUB_ENCODINGCHANGE;
 }
 
+/**
+ * Append text to a node's last child, if that is a text node
+ *
+ * \param ctx     Our context
+ * \param parent  The node whose last child to extend
+ * \param data    Text to append
+ * \param result  Location to receive whether the text was appended
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * This saves creating a text node for each run of characters only to merge
+ * it into the last, and frees us from reading a terminated copy of it.
+ */
+hubbub_error append_text_to(void *ctx, void *parent,
+		const hubbub_string *data, bool *result)
+{
+	xmlNode *p = (xmlNode *) parent;
+
+	UNUSED(ctx);
+
+	*result = false;
+
+	if (p->last == NULL || p->last->type != XML_TEXT_NODE)
+		return HUBBUB_OK;
+
+	xmlNodeAddContentLen(p->last, BAD_CAST data->ptr, (int) data->len);
+
+	*result = true;
+
+	return HUBBUB_OK;
+}
+
@@ -0,0 +1,46 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 The NetSurf Project.
+ */
+
+#ifndef hubbub_atom_h_
+#define hubbub_atom_h_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include <hubbub/types.h>
+
+/**
+ * Find the atom for an element name
+ *
+ * \param name  Pointer to name (need not be NUL-terminated)
+ * \param len   Length, in bytes, of name
+ * \return The atom for the name, or HUBBUB_ATOM_UNKNOWN if it has none
+ *
+ * Names are matched case-insensitively.
+ */
+hubbub_atom hubbub_atom_from_name(const uint8_t *name, size_t len);
+
+/**
+ * Find the element name for an atom
+ *
+ * \param atom  The atom to consider
+ * \return Pointer to lower case, NUL-terminated name,
+ *         or NULL if \p atom is HUBBUB_ATOM_UNKNOWN or out of range
+ */
+const char *hubbub_atom_to_name(hubbub_atom atom);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -0,0 +1,50 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 The NetSurf Project.
+ */
+
+#ifndef hubbub_charset_h_
+#define hubbub_charset_h_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+
+#include <hubbub/errors.h>
+#include <hubbub/types.h>
+
+/**
+ * Determine the character encoding of a document, as a parser would
+ *
+ * A byte order mark takes precedence, followed by the charset parameter of
+ * the document's Content-Type, then a meta charset within the first
+ * \a window bytes, then a guess from the bytes of the document itself, and
+ * finally the default (Windows-1252). No parser need be created, so this
+ * is cheap enough to run on every document fetched.
+ *
+ * \param data          The start of the document
+ * \param len           Length, in bytes, of data
+ * \param content_type  Value of the Content-Type header, or NULL if none
+ * \param window        Bytes to search for a meta charset, or 0 for the
+ *                      parser's default
+ * \param fix_enc       Fix up a Content-Type charset which is frequently
+ *                      misused, as hubbub_parser_create() does
+ * \param charset       Pointer to location to receive charset name
+ *                      (constant; do not free)
+ * \param source        Pointer to location to receive charset source
+ * \return HUBBUB_OK on success, HUBBUB_BADPARM on bad parameters
+ */
+hubbub_error hubbub_charset_sniff(const uint8_t *data, size_t len,
+		const char *content_type, size_t window, bool fix_enc,
+		const char **charset, hubbub_charset_source *source);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,143 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 The NetSurf Project.
+ */
+
+#ifndef hubbub_dom_h_
+#define hubbub_dom_h_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include <hubbub/errors.h>
+#include <hubbub/functypes.h>
+#include <hubbub/parser.h>
+#include <hubbub/tree.h>
+#include <hubbub/types.h>
+
+/**
+ * Index of a node within an arena DOM
+ *
+ * The document node is always at index HUBBUB_DOM_DOCUMENT. Links which
+ * lead nowhere hold HUBBUB_DOM_NONE.
+ */
+typedef uint32_t hubbub_dom_index;
+
+#define HUBBUB_DOM_DOCUMENT	((hubbub_dom_index) 0)
+#define HUBBUB_DOM_NONE		((hubbub_dom_index) UINT32_MAX)
+
+/**
+ * Type of an arena DOM node
+ */
+typedef enum hubbub_dom_node_type {
+	HUBBUB_DOM_NODE_DOCUMENT,
+	HUBBUB_DOM_NODE_DOCTYPE,
+	HUBBUB_DOM_NODE_ELEMENT,
+	HUBBUB_DOM_NODE_TEXT,
+	HUBBUB_DOM_NODE_COMMENT
+} hubbub_dom_node_type;
+
+/**
+ * A string held in the string pool of an arena DOM
+ */
+typedef struct hubbub_dom_string {
+	uint32_t off;		/**< Offset of data in pool */
+	uint32_t len;		/**< Byte length of string */
+} hubbub_dom_string;
+
+/**
+ * An attribute of an arena DOM element
+ */
+typedef struct hubbub_dom_attribute {
+	hubbub_ns ns;			/**< Attribute namespace */
+	hubbub_dom_string name;		/**< Attribute name */
+	hubbub_dom_string value;	/**< Attribute value */
+} hubbub_dom_attribute;
+
+/**
+ * An arena DOM node
+ */
+typedef struct hubbub_dom_node {
+	hubbub_dom_node_type type;	/**< Type of node */
+
+	hubbub_dom_index parent;	/**< Parent node */
+	hubbub_dom_index first_child;	/**< First child node */
+	hubbub_dom_index last_child;	/**< Last child node */
+	hubbub_dom_index prev;		/**< Previous sibling */
+	hubbub_dom_index next;		/**< Next sibling */
+
+	/** Element or doctype name, or text or comment content */
+	hubbub_dom_string data;
+
+	union {
+		struct {
+			hubbub_ns ns;		/**< Element namespace */
+			hubbub_atom atom;	/**< Atom for element name */
+			uint32_t attributes;	/**< First attribute */
+			uint32_t n_attributes;	/**< Attribute count */
+			hubbub_dom_index form;	/**< Associated form */
+		} element;
+
+		struct {
+			hubbub_dom_string public_id;	/**< Public id */
+			hubbub_dom_string system_id;	/**< System id */
+			bool public_missing;	/**< No public id given */
+			bool system_missing;	/**< No system id given */
+			bool force_quirks;	/**< Doctype forces quirks */
+		} doctype;
+	} u;
+} hubbub_dom_node;
+
+typedef struct hubbub_dom hubbub_dom;
+
+/* Create an arena DOM */
+hubbub_error hubbub_dom_create(hubbub_allocator_fn alloc, void *pw,
+		hubbub_dom **dom);
+
+/* Destroy an arena DOM */
+hubbub_error hubbub_dom_destroy(hubbub_dom *dom);
+
+/* Empty an arena DOM so that it may hold another document */
+hubbub_error hubbub_dom_reset(hubbub_dom *dom);
+
+/* Make an arena DOM hold a copy of the document held by another */
+hubbub_error hubbub_dom_copy(hubbub_dom *dom, const hubbub_dom *from);
+
+/* Have a parser build its tree in an arena DOM */
+hubbub_error hubbub_dom_attach(hubbub_dom *dom, hubbub_parser *parser);
+
+/* Retrieve the tree handler which builds an arena DOM */
+hubbub_tree_handler *hubbub_dom_get_tree_handler(hubbub_dom *dom,
+		void **document);
+
+/* Retrieve the number of nodes held by an arena DOM */
+uint32_t hubbub_dom_count(const hubbub_dom *dom);
+
+/* Retrieve a node of an arena DOM */
+const hubbub_dom_node *hubbub_dom_get_node(const hubbub_dom *dom,
+		hubbub_dom_index index);
+
+/* Retrieve the attributes of an element in an arena DOM */
+const hubbub_dom_attribute *hubbub_dom_get_attributes(const hubbub_dom *dom,
+		const hubbub_dom_node *node);
+
+/* Retrieve the data of a string held by an arena DOM */
+const uint8_t *hubbub_dom_get_string(const hubbub_dom *dom,
+		hubbub_dom_string str);
+
+/* Retrieve the quirks mode of the document held by an arena DOM */
+hubbub_quirks_mode hubbub_dom_quirks_mode(const hubbub_dom *dom);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -20,6 +20,7 @@ typedef enum hubbub_error {
 	HUBBUB_REPROCESS	= 1,
 	HUBBUB_ENCODINGCHANGE	= 2,
 	HUBBUB_PAUSED		= 3, /**< tokenisation is paused */
+	HUBBUB_YIELDED		= 4, /**< work budget is exhausted */
 
 	HUBBUB_NOMEM            = 5,
 	HUBBUB_BADPARM          = 6,
@@ -28,7 +29,9 @@ typedef enum hubbub_error {
 	HUBBUB_NEEDDATA         = 9,
 	HUBBUB_BADENCODING      = 10,
 
-	HUBBUB_UNKNOWN		= 11
+	HUBBUB_UNKNOWN		= 11,
+
+	HUBBUB_STOPPED		= 12 /**< parsing has ended early */
 } hubbub_error;
 
 /* Convert a hubbub error value to a string */
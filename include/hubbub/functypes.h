@@ -19,6 +19,20 @@ extern "C"
 
 #include <hubbub/types.h>
 
+/**
+ * Type of allocation function for hubbub
+ *
+ * The semantics of this function are the same as for realloc(), except
+ * that a \p len of zero must free \p ptr and return NULL. Freeing a NULL
+ * \p ptr must be harmless.
+ *
+ * \param ptr  Pointer to object to reallocate, or NULL for a new allocation
+ * \param len  Required length in bytes, or 0 to free \p ptr
+ * \param pw   Pointer to client data
+ * \return Pointer to allocated object, or NULL on failure (or free)
+ */
+typedef void *(*hubbub_allocator_fn)(void *ptr, size_t len, void *pw);
+
 /**
  * Type of token handling function
  *
@@ -29,6 +43,26 @@ extern "C"
 typedef hubbub_error (*hubbub_token_handler)(
 		const hubbub_token *token, void *pw);
 
+/**
+ * Type of batched token handling function
+ *
+ * The tokens, and all of the strings they refer to, remain valid until
+ * the function returns.
+ *
+ * A batch ends after any start tag whose content is not read as PCDATA
+ * (see hubbub_parser_content_model_for), so the function may set the
+ * content model for the last token of a batch, as a token handler may for
+ * its token. For earlier tokens it is too late, as the tokens after them
+ * have already been read.
+ *
+ * \param tokens    Array of tokens to handle, in document order
+ * \param n_tokens  Number of entries in \p tokens
+ * \param pw        Pointer to client data
+ * \return HUBBUB_OK on success, appropriate error otherwise.
+ */
+typedef hubbub_error (*hubbub_token_batch_handler)(
+		const hubbub_token *tokens, size_t n_tokens, void *pw);
+
 /**
  * Type of parse error handling function
  *
@@ -40,6 +74,18 @@ typedef hubbub_error (*hubbub_token_handler)(
 typedef void (*hubbub_error_handler)(uint32_t line, uint32_t col,
 		const char *message, void *pw);
 
+/**
+ * Type of trace handling function
+ *
+ * This is called as each event happens, so may take a timestamp itself,
+ * with whatever clock suits the client.
+ *
+ * \param event  The event traced, valid until the function returns
+ * \param pw     Pointer to client data
+ */
+typedef void (*hubbub_trace_handler)(const hubbub_trace_event *event,
+		void *pw);
+
 #ifdef __cplusplus
 }
 #endif
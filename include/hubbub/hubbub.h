@@ -13,6 +13,7 @@ extern "C"
 {
 #endif
 
+#include <hubbub/atom.h>
 #include <hubbub/errors.h>
 #include <hubbub/functypes.h>
 #include <hubbub/types.h>
@@ -23,6 +23,8 @@ extern "C"
 
 typedef struct hubbub_parser hubbub_parser;
 
+typedef struct hubbub_checkpoint hubbub_checkpoint;
+
 /**
  * Hubbub parser option types
  */
@@ -33,7 +35,23 @@ typedef enum hubbub_parser_opttype {
 	HUBBUB_PARSER_TREE_HANDLER,
 	HUBBUB_PARSER_DOCUMENT_NODE,
 	HUBBUB_PARSER_ENABLE_SCRIPTING,
-	HUBBUB_PARSER_PAUSE
+	HUBBUB_PARSER_PAUSE,
+	HUBBUB_PARSER_TOKEN_BATCH_HANDLER,
+	HUBBUB_PARSER_COALESCE_CHARACTERS,
+	HUBBUB_PARSER_AA_CLONE_LIMIT,
+	HUBBUB_PARSER_MAX_DEPTH,
+	HUBBUB_PARSER_BORROW_INPUT,
+	HUBBUB_PARSER_CHANGE_ENCODING_IN_PLACE,
+	HUBBUB_PARSER_TEXT_LIMIT,
+	HUBBUB_PARSER_WORK_BUDGET,
+	HUBBUB_PARSER_STOP_AT_BODY,
+	HUBBUB_PARSER_BUFFER_SIZES,
+	HUBBUB_PARSER_COUNT_TREE_CALLS,
+	HUBBUB_PARSER_TRACE_HANDLER,
+	HUBBUB_PARSER_MEASURE_TIME,
+	HUBBUB_PARSER_MEMORY_LIMIT,
+	HUBBUB_PARSER_KEEP_DUPLICATE_ATTRIBUTES,
+	HUBBUB_PARSER_ATTRIBUTE_FILTER
 } hubbub_parser_opttype;
 
 /**
@@ -61,14 +79,112 @@ typedef union hubbub_parser_optparams {
 	bool enable_scripting;		/**< Whether to enable scripting */
 
 	bool pause_parse;		/**< Pause parsing */
+
+	struct {
+		hubbub_token_batch_handler handler;
+		void *pw;
+	} token_batch_handler;		/**< Batched token handling callback */
+
+	bool coalesce_characters;	/**< Merge adjacent character tokens */
+
+	uint32_t aa_clone_limit;	/**< Adoption agency clones allowed
+					 * per document, or 0 for no limit */
+
+	uint32_t max_depth;		/**< Maximum element nesting depth,
+					 * or 0 for no limit */
+
+	bool borrow_input;		/**< Read UTF-8 input in place; the
+					 * client keeps each chunk alive
+					 * until reset or destruction */
+
+	bool change_encoding_in_place;	/**< Switch to an encoding requested
+					 * by the document without a restart,
+					 * where that cannot alter the
+					 * result */
+
+	uint32_t text_limit;		/**< Bytes of text or comment data
+					 * after which to emit what is held,
+					 * or 0 to emit each run whole; the
+					 * tree builder still holds each
+					 * comment whole */
+
+	uint32_t work_budget;		/**< Bytes of input to read per call
+					 * before yielding, or 0 for no
+					 * limit */
+
+	bool stop_at_body;		/**< End the parse, returning
+					 * HUBBUB_STOPPED, once the head is
+					 * complete */
+
+	hubbub_buffer_sizes buffer_sizes;	/**< Room to make in buffers
+						 * now, and keep across
+						 * resets */
+
+	bool count_tree_calls;		/**< Count the calls made to the tree
+					 * handler, for the parse
+					 * statistics */
+
+	struct {
+		hubbub_trace_handler handler;
+		void *pw;
+	} trace_handler;		/**< Trace handling callback, or NULL
+					 * to trace nothing */
+
+	bool measure_time;		/**< Measure the time spent in each
+					 * part of the parser, for the parse
+					 * statistics */
+
+	size_t memory_limit;		/**< Most bytes of memory the parser
+					 * may hold, or 0 for no limit */
+
+	bool keep_duplicate_attributes;	/**< Emit every attribute of a tag,
+					 * rather than the first of each
+					 * name; only without a tree */
+
+	struct {
+		const char *const *names;	/**< Names, in lower case,
+						 * or NULL to emit all */
+		uint32_t n_names;		/**< Number of names */
+	} attribute_filter;		/**< The only attributes to emit,
+					 * besides those the tree builder
+					 * reads itself */
 } hubbub_parser_optparams;
 
 /* Create a hubbub parser */
 hubbub_error hubbub_parser_create(const char *enc, bool fix_enc,
 		hubbub_parser **parser);
+/* Create a hubbub parser which uses a client-supplied allocator */
+hubbub_error hubbub_parser_create_with_allocator(const char *enc,
+		bool fix_enc, hubbub_allocator_fn alloc, void *pw,
+		hubbub_parser **parser);
+/* Create a hubbub parser which only tokenises */
+hubbub_error hubbub_parser_create_for_tokens(const char *enc, bool fix_enc,
+		hubbub_allocator_fn alloc, void *pw, hubbub_parser **parser);
 /* Destroy a hubbub parser */
 hubbub_error hubbub_parser_destroy(hubbub_parser *parser);
 
+/* Reset a hubbub parser for a new document */
+hubbub_error hubbub_parser_reset(hubbub_parser *parser, const char *enc,
+		bool fix_enc);
+
+/* Start parsing a fragment, as the content of an element */
+hubbub_error hubbub_parser_begin_fragment(hubbub_parser *parser,
+		const hubbub_string *context);
+
+/* Record the state of a parser, so that parsing may resume from it */
+hubbub_error hubbub_parser_checkpoint(hubbub_parser *parser,
+		hubbub_checkpoint **checkpoint);
+
+/* Reset a parser, and resume parsing from a recorded state */
+hubbub_error hubbub_parser_restore(hubbub_parser *parser,
+		const hubbub_checkpoint *checkpoint);
+
+/* Read the offset in the input at which a state was recorded */
+size_t hubbub_checkpoint_read_offset(const hubbub_checkpoint *checkpoint);
+
+/* Destroy a recorded parser state */
+void hubbub_checkpoint_destroy(hubbub_checkpoint *checkpoint);
+
 /* Configure a hubbub parser */
 hubbub_error hubbub_parser_setopt(hubbub_parser *parser,
 		hubbub_parser_opttype type,
@@ -98,10 +214,40 @@ hubbub_error hubbub_parser_insert_chunk(hubbub_parser *parser,
 /* Inform the parser that the last chunk of data has been parsed */
 hubbub_error hubbub_parser_completed(hubbub_parser *parser);
 
+/* Continue parsing after the work budget ran out */
+hubbub_error hubbub_parser_resume(hubbub_parser *parser);
+
 /* Read the document charset */
 const char *hubbub_parser_read_charset(hubbub_parser *parser,
 		hubbub_charset_source *source);
 
+/* Read the adoption agency counts for the current document */
+hubbub_error hubbub_parser_read_aa_counts(hubbub_parser *parser,
+		hubbub_aa_counts *counts);
+
+/* Read the most room the parser's buffers have needed */
+hubbub_error hubbub_parser_read_buffer_sizes(hubbub_parser *parser,
+		hubbub_buffer_sizes *sizes);
+
+/* Read the statistics for the current document */
+hubbub_error hubbub_parser_read_stats(hubbub_parser *parser,
+		hubbub_parser_stats *stats);
+
+/* Read the name of an insertion mode */
+const char *hubbub_parser_mode_name(uint32_t mode);
+
+/* Find the content model a treebuilder selects after a start tag */
+hubbub_content_model hubbub_parser_content_model_for(const hubbub_tag *tag,
+		bool scripting);
+
+/* Read the memory held by a parser */
+hubbub_error hubbub_parser_read_memory_usage(hubbub_parser *parser,
+		hubbub_memory_usage *usage);
+
+/* Find where a string lies in the input a parser borrows */
+hubbub_error hubbub_parser_source_offset(hubbub_parser *parser,
+		const hubbub_string *str, size_t *offset);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,66 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 The NetSurf Project.
+ */
+
+#ifndef hubbub_speculate_h_
+#define hubbub_speculate_h_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include <hubbub/errors.h>
+#include <hubbub/functypes.h>
+#include <hubbub/parser.h>
+
+/**
+ * Speculative tokenisation of part of a document
+ *
+ * A large document may be split (see hubbub_speculation_split), and each
+ * part after the first tokenised on its own, in parallel with the parsing
+ * of those before it. The parts are then parsed in order, each with
+ * hubbub_parser_parse_speculation in place of hubbub_parser_parse_chunk.
+ * The tokens read ahead are used for as long as the parser would have
+ * read the same ones, which is checked as they are used; the rest of the
+ * part is parsed as usual.
+ *
+ * A speculation is used by one thread at a time, which need not be the
+ * one parsing the document.
+ */
+typedef struct hubbub_speculation hubbub_speculation;
+
+/* Create a speculation */
+hubbub_error hubbub_speculation_create(hubbub_allocator_fn alloc, void *pw,
+		hubbub_speculation **spec);
+
+/* Destroy a speculation */
+hubbub_error hubbub_speculation_destroy(hubbub_speculation *spec);
+
+/* Find a point at which a document may be split for speculation */
+size_t hubbub_speculation_split(const uint8_t *data, size_t len,
+		size_t offset);
+
+/* Tokenise part of a document ahead of the parser */
+hubbub_error hubbub_speculation_run(hubbub_speculation *spec,
+		const uint8_t *data, size_t len);
+
+/* Read the number of bytes of input covered by a speculation's tokens */
+size_t hubbub_speculation_read_length(const hubbub_speculation *spec);
+
+/* Parse the part of a document which a speculation was made from */
+hubbub_error hubbub_parser_parse_speculation(hubbub_parser *parser,
+		const hubbub_speculation *spec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -267,6 +267,34 @@ typedef hubbub_error (*hubbub_tree_encoding_change)(void *ctx,
  */
 typedef hubbub_error (*hubbub_tree_complete_script)(void *ctx, void *script);
 
+/**
+ * Append text to a node's last child, if that is a text node
+ *
+ * \param ctx     Client's context
+ * \param parent  The node whose last child to extend
+ * \param data    Text to append
+ * \param result  Pointer to location to receive whether text was appended
+ * \return HUBBUB_OK on success, appropriate error otherwise.
+ *
+ * If the last child of parent is not a text node, *result is set to false
+ * and nothing is changed; the treebuilder then creates a text node and
+ * appends it, as it would were this callback absent.
+ *
+ * No reference counts are changed.
+ */
+typedef hubbub_error (*hubbub_tree_append_text_to)(void *ctx,
+		void *parent,
+		const hubbub_string *data,
+		bool *result);
+
+/**
+ * Tree handler capability flags
+ */
+/** The client does not count references to its nodes. The ref_node and
+ * unref_node callbacks are never called, and may be NULL. Nodes which the
+ * treebuilder would have released remain owned by the client. */
+#define HUBBUB_TREE_NO_REFCOUNT		(1u << 0)
+
 /**
  * Hubbub tree handler
  */
@@ -290,6 +318,9 @@ typedef struct hubbub_tree_handler {
 	hubbub_tree_encoding_change encoding_change;	/**< Change encoding */
 	hubbub_tree_complete_script complete_script;	/**< Script Complete */
 	void *ctx;					/**< Context pointer */
+	uint32_t flags;				/**< HUBBUB_TREE_* flags */
+	hubbub_tree_append_text_to append_text_to;	/**< Extend text, or
+							 * NULL */
 } hubbub_tree_handler;
 
 #ifdef __cplusplus
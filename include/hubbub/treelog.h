@@ -0,0 +1,135 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 The NetSurf Project.
+ */
+
+#ifndef hubbub_treelog_h_
+#define hubbub_treelog_h_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include <hubbub/errors.h>
+#include <hubbub/functypes.h>
+#include <hubbub/parser.h>
+#include <hubbub/types.h>
+
+/**
+ * Identifier of a node in a tree command log
+ *
+ * The document is HUBBUB_TREELOG_DOCUMENT. Other nodes are numbered from
+ * one, in the order they are created, so that a client may keep its nodes
+ * in an array indexed by identifier. Some numbers may never be used.
+ */
+typedef uint32_t hubbub_treelog_node;
+
+#define HUBBUB_TREELOG_DOCUMENT	((hubbub_treelog_node) 0)
+
+/**
+ * Tree construction operation
+ *
+ * Each operation is applied as the corresponding tree handler callback
+ * would be; see <hubbub/tree.h>.
+ */
+typedef enum hubbub_treelog_op {
+	/** Create node from data.string */
+	HUBBUB_TREELOG_CREATE_COMMENT,
+	/** Create node from data.doctype */
+	HUBBUB_TREELOG_CREATE_DOCTYPE,
+	/** Create node from data.tag */
+	HUBBUB_TREELOG_CREATE_ELEMENT,
+	/** Create node from data.string */
+	HUBBUB_TREELOG_CREATE_TEXT,
+	/** Append node to parent */
+	HUBBUB_TREELOG_APPEND_CHILD,
+	/** Insert node into parent, before other */
+	HUBBUB_TREELOG_INSERT_BEFORE,
+	/** Append data.string to the text of node */
+	HUBBUB_TREELOG_APPEND_TEXT,
+	/** Append the text of other, which is never inserted, to node */
+	HUBBUB_TREELOG_MERGE_TEXT,
+	/** Remove node from parent */
+	HUBBUB_TREELOG_REMOVE_CHILD,
+	/** Create node as a shallow copy of other */
+	HUBBUB_TREELOG_CLONE_NODE,
+	/** Move the children of node to the end of parent */
+	HUBBUB_TREELOG_REPARENT_CHILDREN,
+	/** Associate node with form other */
+	HUBBUB_TREELOG_FORM_ASSOCIATE,
+	/** Add those of data.tag's attributes which node lacks */
+	HUBBUB_TREELOG_ADD_ATTRIBUTES,
+	/** Note data.quirks_mode of the document */
+	HUBBUB_TREELOG_SET_QUIRKS_MODE,
+	/** Charset data.string is needed */
+	HUBBUB_TREELOG_ENCODING_CHANGE,
+	/** Complete processing of script node */
+	HUBBUB_TREELOG_COMPLETE_SCRIPT
+} hubbub_treelog_op;
+
+/**
+ * Tree construction command
+ */
+typedef struct hubbub_treelog_command {
+	hubbub_treelog_op op;		/**< Operation to perform */
+
+	hubbub_treelog_node node;	/**< Node operated upon */
+	hubbub_treelog_node parent;	/**< Parent node, if any */
+	hubbub_treelog_node other;	/**< Other node, if any */
+
+	union {
+		hubbub_string string;
+		hubbub_doctype doctype;
+		hubbub_tag tag;
+		hubbub_quirks_mode quirks_mode;
+	} data;				/**< Operation-specific data */
+} hubbub_treelog_command;
+
+/**
+ * Type of tree command handling function
+ *
+ * The commands, and all of the strings they refer to, remain valid until
+ * the function returns.
+ *
+ * \param commands    Array of commands to apply, in order
+ * \param n_commands  Number of entries in \p commands
+ * \param pw          Pointer to client data
+ * \return HUBBUB_OK on success, appropriate error otherwise.
+ *
+ * If the last command is HUBBUB_TREELOG_ENCODING_CHANGE, the result is
+ * treated as that of the encoding_change tree handler callback.
+ */
+typedef hubbub_error (*hubbub_treelog_handler)(
+		const hubbub_treelog_command *commands, size_t n_commands,
+		void *pw);
+
+typedef struct hubbub_treelog hubbub_treelog;
+
+/* Create a tree command log */
+hubbub_error hubbub_treelog_create(hubbub_allocator_fn alloc, void *pw,
+		hubbub_treelog_handler handler, void *handler_pw,
+		hubbub_treelog **log);
+
+/* Destroy a tree command log */
+hubbub_error hubbub_treelog_destroy(hubbub_treelog *log);
+
+/* Have a parser record its tree construction in a command log */
+hubbub_error hubbub_treelog_attach(hubbub_treelog *log,
+		hubbub_parser *parser);
+
+/* Deliver the commands held by a tree command log */
+hubbub_error hubbub_treelog_flush(hubbub_treelog *log);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -102,12 +102,29 @@ typedef struct hubbub_doctype {
 	bool force_quirks;		/**< Doctype force-quirks flag */
 } hubbub_doctype;
 
+/**
+ * Interned element name
+ *
+ * Every element name the parser knows about has an atom, which is the same
+ * whatever the case of the name. All other names have the atom
+ * HUBBUB_ATOM_UNKNOWN. The values of other atoms are not fixed; use
+ * hubbub_atom_from_name() and hubbub_atom_to_name() to map between atoms
+ * and names.
+ */
+typedef uint32_t hubbub_atom;
+
+/**
+ * Atom of element names the parser has no special knowledge of
+ */
+#define HUBBUB_ATOM_UNKNOWN ((hubbub_atom) 0)
+
 /**
  * Data for a tag
  */
 typedef struct hubbub_tag {
 	hubbub_ns ns;			/**< Tag namespace */
 	hubbub_string name;		/**< Tag name */
+	hubbub_atom atom;		/**< Interned tag name */
 	uint32_t n_attributes;		/**< Count of attributes */
 	hubbub_attribute *attributes;	/**< Array of attribute data */
 	bool self_closing;		/**< Whether the tag can have children */
@@ -130,6 +147,136 @@ typedef struct hubbub_token {
 	} data;				/**< Type-specific data */
 } hubbub_token;
 
+/**
+ * Work done by the adoption agency algorithm while building a document
+ */
+typedef struct hubbub_aa_counts {
+	uint32_t runs;			/**< End tags it handled */
+	uint32_t iterations;		/**< Passes of its outer loop */
+	uint32_t clones;		/**< Nodes it cloned */
+	bool limited;			/**< Whether the clone limit was hit */
+} hubbub_aa_counts;
+
+/**
+ * Room for the parser to hold in its buffers
+ */
+typedef struct hubbub_buffer_sizes {
+	uint32_t text;			/**< Bytes of token text, such as tag
+					 * names, attributes and comments */
+	uint32_t depth;			/**< Elements open at once */
+} hubbub_buffer_sizes;
+
+/**
+ * Memory held by a parser
+ */
+typedef struct hubbub_memory_usage {
+	size_t current;			/**< Bytes held now */
+	size_t peak;			/**< Most bytes held at once while
+					 * parsing the current document */
+	size_t limit;			/**< Most bytes which may be held, or
+					 * 0 for no limit */
+	uint32_t allocations;		/**< Blocks obtained or resized while
+					 * parsing the current document */
+} hubbub_memory_usage;
+
+/**
+ * Tree handler callbacks, as counted in parse statistics
+ */
+typedef enum hubbub_tree_call {
+	HUBBUB_TREE_CREATE_COMMENT,
+	HUBBUB_TREE_CREATE_DOCTYPE,
+	HUBBUB_TREE_CREATE_ELEMENT,
+	HUBBUB_TREE_CREATE_TEXT,
+	HUBBUB_TREE_REF_NODE,
+	HUBBUB_TREE_UNREF_NODE,
+	HUBBUB_TREE_APPEND_CHILD,
+	HUBBUB_TREE_INSERT_BEFORE,
+	HUBBUB_TREE_REMOVE_CHILD,
+	HUBBUB_TREE_CLONE_NODE,
+	HUBBUB_TREE_REPARENT_CHILDREN,
+	HUBBUB_TREE_GET_PARENT,
+	HUBBUB_TREE_HAS_CHILDREN,
+	HUBBUB_TREE_FORM_ASSOCIATE,
+	HUBBUB_TREE_ADD_ATTRIBUTES,
+	HUBBUB_TREE_SET_QUIRKS_MODE,
+	HUBBUB_TREE_ENCODING_CHANGE,
+	HUBBUB_TREE_COMPLETE_SCRIPT,
+	HUBBUB_TREE_APPEND_TEXT_TO,
+
+	HUBBUB_TREE_N_CALLS
+} hubbub_tree_call;
+
+/** Number of tree builder insertion modes */
+#define HUBBUB_INSERTION_MODES 22
+
+/**
+ * Work done in parsing a document
+ */
+typedef struct hubbub_parser_stats {
+	uint64_t bytes;			/**< Bytes of UTF-8 consumed */
+	uint32_t tokens[HUBBUB_TOKEN_EOF + 1];	/**< Tokens emitted, by
+						 * hubbub_token_type */
+	uint32_t attributes;		/**< Attributes on tags emitted */
+	uint32_t attributes_dropped;	/**< Attributes not emitted, being
+					 * filtered out */
+	uint32_t char_refs;		/**< Character references resolved */
+
+	uint32_t max_depth;		/**< Most elements open at once */
+	uint32_t formatting_high;	/**< Most entries in the list of
+					 * active formatting elements */
+	hubbub_aa_counts aa;		/**< Adoption agency work done */
+	uint32_t reprocessed;		/**< Times a token was handed on to
+					 * another insertion mode */
+
+	uint32_t encoding_changes;	/**< Encodings changed without a
+					 * restart */
+	uint32_t restarts;		/**< Times the document was begun
+					 * again in another encoding */
+
+	uint32_t tree_calls[HUBBUB_TREE_N_CALLS];	/**< Tree handler
+							 * calls made, by
+							 * hubbub_tree_call,
+							 * if counted */
+
+	uint64_t parse_ns;		/**< Nanoseconds spent parsing, if
+					 * measured */
+	uint64_t tokeniser_ns;		/**< Of which, in the tokeniser and
+					 * any token handler */
+	uint64_t tree_ns;		/**< Of which, in tree handler
+					 * callbacks */
+	uint64_t mode_ns[HUBBUB_INSERTION_MODES];	/**< Of which, by the
+							 * tree builder in
+							 * each insertion
+							 * mode */
+} hubbub_parser_stats;
+
+/**
+ * Type of an event traced while parsing
+ */
+typedef enum hubbub_trace_type {
+	HUBBUB_TRACE_STATE,		/**< Tokeniser entered a state */
+	HUBBUB_TRACE_TOKEN,		/**< Tokeniser emitted a token */
+	HUBBUB_TRACE_MODE,		/**< Treebuilder handled a token in an
+					 * insertion mode */
+	HUBBUB_TRACE_TREE_CALL		/**< Treebuilder called the tree
+					 * handler */
+} hubbub_trace_type;
+
+/**
+ * Event traced while parsing
+ */
+typedef struct hubbub_trace_event {
+	hubbub_trace_type type;		/**< Type of event */
+	uint32_t value;			/**< Tokeniser state or insertion mode
+					 * (as numbered internally), or the
+					 * hubbub_token_type or
+					 * hubbub_tree_call */
+	const char *name;		/**< Name of \a value, such as
+					 * "TAG_NAME" or "IN_BODY" */
+	size_t offset;			/**< Bytes of UTF-8 input which the
+					 * tokeniser has reached */
+} hubbub_trace_event;
+
 #ifdef __cplusplus
 }
 #endif
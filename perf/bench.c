@@ -0,0 +1,733 @@
+/*
+ * Benchmark the parser over a corpus of representative pages
+ *
+ * Each page is parsed in up to three modes: tokenising only, building a
+ * tree through tree handlers which do nothing, and building an arena DOM.
+ * Every case runs in a child process of its own, so that its peak resident
+ * set is its own, and is parsed a number of times to warm up before the
+ * runs which are timed.
+ *
+ * The corpus is made up of generated pages, each leaning on one part of
+ * the parser, along with any files named on the command line.
+ */
+
+#define _GNU_SOURCE
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include <hubbub/hubbub.h>
+#include <hubbub/dom.h>
+#include <hubbub/parser.h>
+#include <hubbub/tree.h>
+
+/** Most timed runs which may be asked for */
+#define MAX_RUNS 1000
+
+#define UNUSED(x) ((void) (x))
+
+typedef enum mode {
+	MODE_TOKENS,		/**< Tokeniser only */
+	MODE_TREE,		/**< Tree builder, with null tree handlers */
+	MODE_DOM,		/**< Tree builder, with the arena DOM */
+	N_MODES
+} mode;
+
+static const char *const mode_names[N_MODES] = { "tokens", "tree", "dom" };
+
+typedef struct page {
+	const char *name;
+	uint8_t *data;
+	size_t len;
+} page;
+
+/** What a case reports to the parent */
+typedef struct result {
+	double best;		/**< Fastest run, in seconds */
+	double median;		/**< Median run, in seconds */
+	uint64_t tokens;	/**< Tokens in the page */
+	uint64_t allocs;	/**< Allocations per parse */
+	uint64_t bytes;		/**< Bytes allocated per parse */
+	bool failed;
+} result;
+
+/* Counts kept by the allocator given to the parser and the DOM */
+static uint64_t n_allocs, n_bytes;
+
+static uint64_t n_tokens;
+
+/*----------------------------------------------------------------------------
+ * Generated pages
+ *--------------------------------------------------------------------------*/
+
+typedef struct buf {
+	uint8_t *data;
+	size_t len;
+	size_t alloc;
+} buf;
+
+static void buf_printf(buf *b, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	for (;;) {
+		va_start(ap, fmt);
+		n = vsnprintf((char *) b->data + b->len, b->alloc - b->len,
+				fmt, ap);
+		va_end(ap);
+
+		if (n >= 0 && (size_t) n < b->alloc - b->len)
+			break;
+
+		b->alloc = b->alloc * 2 + n + 1;
+		b->data = realloc(b->data, b->alloc);
+		if (b->data == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+	}
+
+	b->len += n;
+}
+
+static const char *const words[] = {
+	"the", "parser", "reads", "each", "chunk", "of", "input", "and",
+	"builds", "a", "tree", "from", "tokens", "it", "emits", "while",
+	"text", "runs", "between", "tags", "in", "most", "pages"
+};
+
+#define N_WORDS (sizeof(words) / sizeof(words[0]))
+
+/* Prose, with a little inline markup */
+static void make_text(buf *b, size_t i)
+{
+	size_t w;
+
+	buf_printf(b, "<p>");
+	for (w = 0; w < 80; w++) {
+		const char *word = words[(i * 7 + w * 3) % N_WORDS];
+
+		if (w % 23 == 5)
+			buf_printf(b, "<b>%s</b> ", word);
+		else if (w % 31 == 9)
+			buf_printf(b, "<a href=\"/%zu\">%s</a> ", w, word);
+		else
+			buf_printf(b, "%s ", word);
+	}
+	buf_printf(b, "</p>\n");
+}
+
+/* Elements carrying many attributes, in each style of quoting */
+static void make_attrs(buf *b, size_t i)
+{
+	buf_printf(b, "<div id=\"item-%zu\" class=\"card card-%zu wide\" "
+			"data-index=%zu data-name='%s' style=\"color: red; "
+			"margin: 0 auto\" aria-label=\"Item %zu\" hidden>",
+			i, i % 13, i, words[i % N_WORDS], i);
+	buf_printf(b, "<input type=checkbox name=\"c%zu\" value='%zu' "
+			"checked disabled><img src=\"/img/%zu.png\" alt=\"\" "
+			"width=16 height=16 loading=lazy></div>\n", i, i, i);
+}
+
+/* Rows of cells, some left open, as table tags often are */
+static void make_tables(buf *b, size_t i)
+{
+	size_t c;
+
+	if (i % 50 == 0) {
+		if (i != 0)
+			buf_printf(b, "</table>\n");
+		buf_printf(b, "<table><caption>Table %zu</caption>"
+				"<colgroup><col><col></colgroup>\n", i / 50);
+	}
+
+	buf_printf(b, "<tr>");
+	for (c = 0; c < 8; c++) {
+		if (c % 3 == 0)
+			buf_printf(b, "<td>%zu", i * 8 + c);
+		else
+			buf_printf(b, "<td class=n>%s</td>",
+					words[(i + c) % N_WORDS]);
+	}
+	buf_printf(b, "\n");
+}
+
+/* Scripts and style sheets, with markup-like text inside */
+static void make_scripts(buf *b, size_t i)
+{
+	buf_printf(b, "<script>\nvar n%zu = 0;\n"
+			"for (var i = 0; i < %zu; i++) {\n"
+			"  if (i < n%zu && \"</div>\".length > 2)\n"
+			"    document.title = '<b>' + i + '</b>';\n"
+			"}\n<!-- not a comment -->\n</script>\n", i, i, i);
+	buf_printf(b, "<style>\n.c%zu > p { content: \"<p>\"; }\n"
+			"</style>\n<noscript><p>%s</p></noscript>\n",
+			i, words[i % N_WORDS]);
+}
+
+/* Text thick with character references */
+static void make_entities(buf *b, size_t i)
+{
+	buf_printf(b, "<p title=\"&quot;%zu&quot; &amp; more\">"
+			"&lt;tag&gt; &amp; &nbsp;&copy;&reg;&trade; "
+			"&eacute;&egrave;&agrave;&ccedil; &#%zu; &#x%zx; "
+			"&hellip;&mdash;&ndash; &notin &amp &fakeref; "
+			"&alpha;&beta;&gamma; &#128; &#x2603;</p>\n",
+			i, 0x41 + i % 26, 0x3B1 + i % 20);
+}
+
+/* Misnested markup, for the adoption agency and foster parenting */
+static void make_misnested(buf *b, size_t i)
+{
+	buf_printf(b, "<p><b>bold <i>both</b> italic</i> plain\n");
+	buf_printf(b, "<div><a href=#%zu>link <div>block</a> after</div>"
+			"</div>\n", i);
+	buf_printf(b, "<table><tr><td>cell</td>stray text<b>"
+			"fostered</b></tr></table>\n");
+	buf_printf(b, "<font><p>para</font> end</p><li>one<li>two\n");
+}
+
+static const struct {
+	const char *name;
+	void (*make)(buf *b, size_t i);
+} generators[] = {
+	{ "text", make_text },
+	{ "attrs", make_attrs },
+	{ "tables", make_tables },
+	{ "scripts", make_scripts },
+	{ "entities", make_entities },
+	{ "misnested", make_misnested }
+};
+
+#define N_GENERATORS (sizeof(generators) / sizeof(generators[0]))
+
+static void make_page(page *p, size_t g, size_t size)
+{
+	buf b = { NULL, 0, 0 };
+	size_t i;
+
+	buf_printf(&b, "<!DOCTYPE html>\n<html><head><meta charset=utf-8>"
+			"<title>%s</title></head><body>\n",
+			generators[g].name);
+
+	for (i = 0; b.len < size; i++)
+		generators[g].make(&b, i);
+
+	buf_printf(&b, "</body></html>\n");
+
+	p->name = generators[g].name;
+	p->data = b.data;
+	p->len = b.len;
+}
+
+static bool map_page(const char *path, page *p)
+{
+	struct stat info;
+	void *data;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0) {
+		fprintf(stderr, "Unable to read %s\n", path);
+		if (fd >= 0)
+			close(fd);
+		return false;
+	}
+
+	data = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "Unable to map %s\n", path);
+		return false;
+	}
+
+	p->name = strrchr(path, '/') != NULL ? strrchr(path, '/') + 1 : path;
+	p->data = data;
+	p->len = info.st_size;
+
+	return true;
+}
+
+/*----------------------------------------------------------------------------
+ * Handlers
+ *--------------------------------------------------------------------------*/
+
+static void *counting_alloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	if (len == 0) {
+		free(ptr);
+		return NULL;
+	}
+
+	n_allocs++;
+	n_bytes += len;
+
+	return realloc(ptr, len);
+}
+
+/* As the tree builder would, switch content model after some tags */
+static hubbub_error token_handler(const hubbub_token *token, void *pw)
+{
+	hubbub_parser *parser = pw;
+	hubbub_parser_optparams params;
+	const hubbub_tag *tag = &token->data.tag;
+
+	n_tokens++;
+
+	if (token->type != HUBBUB_TOKEN_START_TAG)
+		return HUBBUB_OK;
+
+	params.content_model.model =
+			hubbub_parser_content_model_for(tag, false);
+	if (params.content_model.model == HUBBUB_CONTENT_MODEL_PCDATA)
+		return HUBBUB_OK;
+
+	return hubbub_parser_setopt(parser, HUBBUB_PARSER_CONTENT_MODEL,
+			&params);
+}
+
+static hubbub_error null_node(void *ctx, void **result)
+{
+	UNUSED(ctx);
+
+	*result = (void *) 1;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error null_comment(void *ctx, const hubbub_string *data,
+		void **result)
+{
+	UNUSED(data);
+
+	return null_node(ctx, result);
+}
+
+static hubbub_error null_doctype(void *ctx, const hubbub_doctype *doctype,
+		void **result)
+{
+	UNUSED(doctype);
+
+	return null_node(ctx, result);
+}
+
+static hubbub_error null_element(void *ctx, const hubbub_tag *tag,
+		void **result)
+{
+	UNUSED(tag);
+
+	return null_node(ctx, result);
+}
+
+static hubbub_error null_text(void *ctx, const hubbub_string *data,
+		void **result)
+{
+	UNUSED(data);
+
+	return null_node(ctx, result);
+}
+
+static hubbub_error null_append(void *ctx, void *parent, void *child,
+		void **result)
+{
+	UNUSED(ctx);
+	UNUSED(parent);
+
+	*result = child;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error null_insert(void *ctx, void *parent, void *child,
+		void *ref_child, void **result)
+{
+	UNUSED(ref_child);
+
+	return null_append(ctx, parent, child, result);
+}
+
+static hubbub_error null_clone(void *ctx, void *node, bool deep,
+		void **result)
+{
+	UNUSED(node);
+	UNUSED(deep);
+
+	return null_node(ctx, result);
+}
+
+static hubbub_error null_reparent(void *ctx, void *node, void *new_parent)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+	UNUSED(new_parent);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error null_parent(void *ctx, void *node, bool element_only,
+		void **result)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+	UNUSED(element_only);
+
+	*result = NULL;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error null_has_children(void *ctx, void *node, bool *result)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+
+	*result = false;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error null_form(void *ctx, void *form, void *node)
+{
+	UNUSED(ctx);
+	UNUSED(form);
+	UNUSED(node);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error null_attributes(void *ctx, void *node,
+		const hubbub_attribute *attributes, uint32_t n_attributes)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+	UNUSED(attributes);
+	UNUSED(n_attributes);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error null_quirks(void *ctx, hubbub_quirks_mode mode)
+{
+	UNUSED(ctx);
+	UNUSED(mode);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error null_encoding(void *ctx, const char *encname)
+{
+	UNUSED(ctx);
+	UNUSED(encname);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_tree_handler null_handler = {
+	null_comment,
+	null_doctype,
+	null_element,
+	null_text,
+	NULL,
+	NULL,
+	null_append,
+	null_insert,
+	null_append,
+	null_clone,
+	null_reparent,
+	null_parent,
+	null_has_children,
+	null_form,
+	null_attributes,
+	null_quirks,
+	null_encoding,
+	NULL,
+	NULL,
+	HUBBUB_TREE_NO_REFCOUNT,
+	NULL
+};
+
+/*----------------------------------------------------------------------------
+ * Running a case
+ *--------------------------------------------------------------------------*/
+
+static hubbub_error parse_page(const page *p, mode m, hubbub_dom *dom)
+{
+	hubbub_parser_optparams params;
+	hubbub_parser *parser;
+	hubbub_error error;
+
+	if (m == MODE_TOKENS)
+		error = hubbub_parser_create_for_tokens("UTF-8", false,
+				counting_alloc, NULL, &parser);
+	else
+		error = hubbub_parser_create_with_allocator("UTF-8", false,
+				counting_alloc, NULL, &parser);
+	if (error != HUBBUB_OK)
+		return error;
+
+	switch (m) {
+	case MODE_TOKENS:
+		params.token_handler.handler = token_handler;
+		params.token_handler.pw = parser;
+		error = hubbub_parser_setopt(parser,
+				HUBBUB_PARSER_TOKEN_HANDLER, &params);
+		break;
+	case MODE_TREE:
+		params.tree_handler = &null_handler;
+		error = hubbub_parser_setopt(parser,
+				HUBBUB_PARSER_TREE_HANDLER, &params);
+		if (error != HUBBUB_OK)
+			break;
+
+		params.document_node = (void *) 1;
+		error = hubbub_parser_setopt(parser,
+				HUBBUB_PARSER_DOCUMENT_NODE, &params);
+		break;
+	case MODE_DOM:
+		error = hubbub_dom_reset(dom);
+		if (error == HUBBUB_OK)
+			error = hubbub_dom_attach(dom, parser);
+		break;
+	default:
+		error = HUBBUB_BADPARM;
+	}
+
+	if (error == HUBBUB_OK)
+		error = hubbub_parser_parse_chunk(parser, p->data, p->len);
+	if (error == HUBBUB_OK)
+		error = hubbub_parser_completed(parser);
+
+	hubbub_parser_destroy(parser);
+
+	return error;
+}
+
+static int compare_times(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return (x > y) - (x < y);
+}
+
+static double seconds(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Benchmark one page in one mode
+ *
+ * The DOM, when used, is kept from one run to the next, as a client
+ * parsing many pages would keep it.
+ */
+static void run_case(const page *p, mode m, size_t warmup, size_t runs,
+		result *r)
+{
+	static double times[MAX_RUNS];
+	hubbub_dom *dom = NULL;
+	size_t i;
+
+	memset(r, 0, sizeof(*r));
+
+	if (m == MODE_DOM && hubbub_dom_create(counting_alloc, NULL,
+			&dom) != HUBBUB_OK) {
+		r->failed = true;
+		return;
+	}
+
+	/* The tokens mode counts the page's tokens on its first run */
+	n_tokens = 0;
+	if (parse_page(p, MODE_TOKENS, NULL) != HUBBUB_OK) {
+		r->failed = true;
+		return;
+	}
+	r->tokens = n_tokens;
+
+	for (i = 0; i < warmup; i++) {
+		if (parse_page(p, m, dom) != HUBBUB_OK) {
+			r->failed = true;
+			return;
+		}
+	}
+
+	n_allocs = n_bytes = 0;
+
+	for (i = 0; i < runs; i++) {
+		double start = seconds();
+
+		if (parse_page(p, m, dom) != HUBBUB_OK) {
+			r->failed = true;
+			return;
+		}
+
+		times[i] = seconds() - start;
+	}
+
+	qsort(times, runs, sizeof(double), compare_times);
+
+	r->best = times[0];
+	r->median = times[runs / 2];
+	r->allocs = n_allocs / runs;
+	r->bytes = n_bytes / runs;
+
+	if (dom != NULL)
+		hubbub_dom_destroy(dom);
+}
+
+/* Run a case in a child, so that its peak resident set is its own */
+static bool fork_case(const page *p, mode m, size_t warmup, size_t runs,
+		result *r, long *peak_kb)
+{
+	struct rusage usage;
+	int fds[2], status;
+	pid_t pid;
+
+	if (pipe(fds) != 0)
+		return false;
+
+	pid = fork();
+	if (pid < 0)
+		return false;
+
+	if (pid == 0) {
+		close(fds[0]);
+		run_case(p, m, warmup, runs, r);
+		if (write(fds[1], r, sizeof(*r)) != sizeof(*r))
+			_exit(1);
+		_exit(0);
+	}
+
+	close(fds[1]);
+	if (read(fds[0], r, sizeof(*r)) != sizeof(*r))
+		r->failed = true;
+	close(fds[0]);
+
+	if (wait4(pid, &status, 0, &usage) != pid || !WIFEXITED(status) ||
+			WEXITSTATUS(status) != 0)
+		r->failed = true;
+
+	*peak_kb = usage.ru_maxrss;
+
+	return true;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-m tokens|tree|dom] [-s page KiB] [-w warmup] "
+			"[-r runs] [<filename> ...]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	size_t size = 1024 * 1024, warmup = 2, runs = 10;
+	size_t n_pages, i;
+	bool modes[N_MODES] = { true, true, true };
+	bool failed = false;
+	page *pages;
+	int opt, m;
+
+	while ((opt = getopt(argc, argv, "m:s:w:r:")) != -1) {
+		switch (opt) {
+		case 'm':
+			for (m = 0; m < N_MODES; m++)
+				modes[m] = strcmp(optarg, mode_names[m]) == 0;
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 10) * 1024;
+			break;
+		case 'w':
+			warmup = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			runs = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (size == 0 || runs == 0 || runs > MAX_RUNS ||
+			(!modes[MODE_TOKENS] && !modes[MODE_TREE] &&
+			!modes[MODE_DOM])) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	n_pages = N_GENERATORS + (argc - optind);
+	pages = calloc(n_pages, sizeof(page));
+	if (pages == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	for (i = 0; i < N_GENERATORS; i++)
+		make_page(&pages[i], i, size);
+
+	for (i = N_GENERATORS; i < n_pages; i++) {
+		if (map_page(argv[optind + i - N_GENERATORS], &pages[i]) ==
+				false)
+			return 1;
+	}
+
+	printf("%zu warmup and %zu timed runs of each; allocations are "
+			"those made through\nthe parser's and DOM's allocator "
+			"(not libparserutils')\n\n", warmup, runs);
+	printf("%-12s %-6s %7s %7s %7s %7s %8s %9s %9s\n", "page",
+			"mode", "KiB", "MB/s", "best", "Mtok/s", "allocs",
+			"alloc KiB", "peak KiB");
+
+	for (i = 0; i < n_pages; i++) {
+		const page *p = &pages[i];
+
+		for (m = 0; m < N_MODES; m++) {
+			long peak_kb = 0;
+			result r;
+
+			if (modes[m] == false)
+				continue;
+
+			if (fork_case(p, m, warmup, runs, &r,
+					&peak_kb) == false || r.failed) {
+				printf("%-12.12s %-6s failed\n", p->name,
+						mode_names[m]);
+				failed = true;
+				continue;
+			}
+
+			printf("%-12.12s %-6s %7zu %7.1f %7.1f %7.2f "
+					"%8" PRIu64 " %9" PRIu64 " %9ld\n",
+					p->name, mode_names[m], p->len / 1024,
+					p->len / r.median / 1e6,
+					p->len / r.best / 1e6,
+					r.tokens / r.median / 1e6,
+					r.allocs, r.bytes / 1024, peak_kb);
+		}
+	}
+
+	for (i = 0; i < N_GENERATORS; i++)
+		free(pages[i].data);
+	free(pages);
+
+	return failed ? 1 : 0;
+}
@@ -4,8 +4,15 @@
 #     make -C perf -f example.mk
 #     time ./perf/libxml2 ~/Downloads/html5.html
 #     time ./perf/hubbub  ~/Downloads/html5.html
+#     ./perf/parallel -j 8 -r 100 ~/Downloads/*.html
+#     ./perf/speculate -j 4 -r 10 ~/Downloads/html5.html
+#     ./perf/pipeline -r 10 ~/Downloads/html5.html
+#     ./perf/bench -r 20 ~/Downloads/*.html
+#     ./perf/micro > before.json
+#     ./perf/replay -r 20 ~/Downloads/*.html > before.json
+#     ./perf/write -n 10000 -r 10
 
-all: libxml2 hubbub
+all: libxml2 hubbub parallel speculate pipeline bench micro replay write
 
 CC = gcc
 CFLAGS = -W -Wall --std=c99
@@ -23,7 +30,57 @@ hubbub: CFLAGS += `pkg-config --cflags libparserutils libhubbub`
 hubbub: $(HUBBUB_OBJS)
 	gcc -o hubbub $(HUBBUB_OBJS) `pkg-config --libs libhubbub libparserutils`
 
+BENCH_OBJS = bench.o
+bench: bench.c
+bench: CFLAGS += `pkg-config --cflags libparserutils libhubbub`
+bench: $(BENCH_OBJS)
+	gcc -o bench $(BENCH_OBJS) `pkg-config --libs libhubbub libparserutils`
+
+# This reaches into the library, so needs the source tree's headers too
+MICRO_OBJS = micro.o
+micro: micro.c
+micro: CFLAGS += -I../src -I../include `pkg-config --cflags libparserutils libhubbub`
+micro: $(MICRO_OBJS)
+	gcc -o micro $(MICRO_OBJS) `pkg-config --libs libhubbub libparserutils`
+
+REPLAY_OBJS = replay.o
+replay: replay.c
+replay: CFLAGS += `pkg-config --cflags libparserutils libhubbub`
+replay: $(REPLAY_OBJS)
+	gcc -o replay $(REPLAY_OBJS) `pkg-config --libs libhubbub libparserutils`
+
+PARALLEL_OBJS = parallel.o
+parallel: parallel.c
+parallel: CFLAGS += -pthread `pkg-config --cflags libparserutils libhubbub`
+parallel: $(PARALLEL_OBJS)
+	gcc -pthread -o parallel $(PARALLEL_OBJS) `pkg-config --libs libhubbub libparserutils`
+
+SPECULATE_OBJS = speculate.o
+speculate: speculate.c
+speculate: CFLAGS += -pthread `pkg-config --cflags libparserutils libhubbub`
+speculate: $(SPECULATE_OBJS)
+	gcc -pthread -o speculate $(SPECULATE_OBJS) `pkg-config --libs libhubbub libparserutils`
+
+PIPELINE_OBJS = pipeline.o
+pipeline: pipeline.c
+pipeline: CFLAGS += -pthread `pkg-config --cflags libparserutils libhubbub`
+pipeline: $(PIPELINE_OBJS)
+	gcc -pthread -o pipeline $(PIPELINE_OBJS) `pkg-config --libs libhubbub libparserutils`
+
+WRITE_OBJS = write.o
+write: write.c
+write: CFLAGS += `pkg-config --cflags libparserutils libhubbub`
+write: $(WRITE_OBJS)
+	gcc -o write $(WRITE_OBJS) `pkg-config --libs libhubbub libparserutils`
+
 .PHONY: clean
 clean:
 	$(RM) hubbub  $(HUBBUB_OBJS)
+	$(RM) bench $(BENCH_OBJS)
+	$(RM) micro $(MICRO_OBJS)
+	$(RM) replay $(REPLAY_OBJS)
+	$(RM) parallel $(PARALLEL_OBJS)
+	$(RM) speculate $(SPECULATE_OBJS)
+	$(RM) pipeline $(PIPELINE_OBJS)
+	$(RM) write $(WRITE_OBJS)
 	$(RM) libxml2 $(LIBXML2_OBJS)
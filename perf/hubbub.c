@@ -111,11 +111,16 @@ static hubbub_tree_handler tree_handler = {
 	set_quirks_mode,
 	change_encoding,
 	NULL,
+	NULL,
+	0,
 	NULL
 };
 
 
 
+/* Size of the pieces in which the document is fed to the parser */
+#define CHUNK_SIZE 65536
+
 int main(int argc, char **argv)
 {
 	hubbub_parser *parser;
@@ -124,6 +129,7 @@ int main(int argc, char **argv)
 	struct stat info;
 	int fd;
 	uint8_t *file;
+	off_t off;
 
 	if (argc != 2) {
 		printf("Usage: %s <filename>\n", argv[0]);
@@ -140,12 +146,31 @@ int main(int argc, char **argv)
 	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_DOCUMENT_NODE,
 			&params) == HUBBUB_OK);
 
+	/* The file stays mapped for the parser's lifetime */
+	params.borrow_input = true;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_BORROW_INPUT,
+			&params) == HUBBUB_OK);
+
 	stat(argv[1], &info);
 	fd = open(argv[1], 0);
 	file = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
 
-	assert(hubbub_parser_parse_chunk(parser, file, info.st_size)
-			== HUBBUB_OK);
+	/* Feed the file as it would arrive, without holding long runs */
+	params.text_limit = CHUNK_SIZE;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TEXT_LIMIT,
+			&params) == HUBBUB_OK);
+
+	for (off = 0; off < info.st_size; off += CHUNK_SIZE) {
+		size_t len = info.st_size - off;
+
+		if (len > CHUNK_SIZE)
+			len = CHUNK_SIZE;
+
+		assert(hubbub_parser_parse_chunk(parser, file + off, len)
+				== HUBBUB_OK);
+	}
+
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
 
 	return HUBBUB_OK;
 }
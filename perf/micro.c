@@ -0,0 +1,504 @@
+/*
+ * Microbenchmarks for the tokeniser's states and the entity dictionary
+ *
+ * Each benchmark drives the tokeniser directly over a synthetic input made
+ * of one construct repeated, so that a regression in one path of the state
+ * machine shows up on its own, rather than being lost in the throughput of
+ * a whole document. The entity dictionary is also searched directly.
+ *
+ * Results are printed one JSON object per line, for scripts to compare:
+ *
+ *   {"name": "attr/dq", "unit": "byte", "units": 262144, "tokens": 3449,
+ *    "runs": 412, "ns_per_unit": 1.234, "mb_per_s": 810.4}
+ *
+ * This uses the library's internal interfaces, so is built against the
+ * source tree rather than the installed headers.
+ */
+
+#define _GNU_SOURCE
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <parserutils/input/inputstream.h>
+
+#include <hubbub/hubbub.h>
+
+#include "tokeniser/entities.h"
+#include "tokeniser/tokeniser.h"
+
+#define UNUSED(x) ((void) (x))
+
+typedef struct buf {
+	uint8_t *data;
+	size_t len;
+	size_t alloc;
+} buf;
+
+typedef struct bench {
+	const char *name;
+	void (*make)(buf *b, size_t i);		/**< Construct to repeat */
+	hubbub_content_model model;		/**< Model to start in */
+	bool copied;				/**< Read through the stream */
+} bench;
+
+static uint64_t n_tokens;
+
+/* Stream the tokeniser reads from, replaced for each run */
+static parserutils_inputstream *stream;
+
+static double min_time = 0.2;
+static size_t repeats = 5;
+
+static void buf_printf(buf *b, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	for (;;) {
+		va_start(ap, fmt);
+		n = vsnprintf((char *) b->data + b->len, b->alloc - b->len,
+				fmt, ap);
+		va_end(ap);
+
+		if (n >= 0 && (size_t) n < b->alloc - b->len)
+			break;
+
+		b->alloc = b->alloc * 2 + n + 1;
+		b->data = realloc(b->data, b->alloc);
+		if (b->data == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+	}
+
+	b->len += n;
+}
+
+/*----------------------------------------------------------------------------
+ * Inputs
+ *--------------------------------------------------------------------------*/
+
+static void make_text(buf *b, size_t i)
+{
+	UNUSED(i);
+
+	buf_printf(b, "the quick brown fox jumps over the lazy dog and "
+			"runs off into the trees\n");
+}
+
+static void make_crlf(buf *b, size_t i)
+{
+	UNUSED(i);
+
+	buf_printf(b, "a short line of text\r\n");
+}
+
+static void make_rawtext(buf *b, size_t i)
+{
+	buf_printf(b, "if (a%zu < b && c > d) { e = '</p>'; }\n", i % 10);
+}
+
+static void make_tags(buf *b, size_t i)
+{
+	static const char *const names[] = {
+		"div", "span", "p", "li", "blockquote", "td"
+	};
+	const char *name = names[i % 6];
+
+	buf_printf(b, "<%s></%s>", name, name);
+}
+
+static void make_attr_dq(buf *b, size_t i)
+{
+	buf_printf(b, "<a href=\"https://example.com/path/to/page/%zu"
+			"?query=value&amp;more=values\">", i);
+}
+
+static void make_attr_sq(buf *b, size_t i)
+{
+	buf_printf(b, "<a href='https://example.com/path/to/page/%zu"
+			"?query=value&amp;more=values'>", i);
+}
+
+static void make_attr_uq(buf *b, size_t i)
+{
+	buf_printf(b, "<a href=https://example.com/path/to/page/%zu"
+			"/and/some/more/path/segments>", i);
+}
+
+static void make_attr_refs(buf *b, size_t i)
+{
+	UNUSED(i);
+
+	buf_printf(b, "<a title=\"&quot;quoted&quot; &amp; &lt;escaped&gt; "
+			"&copy; &#169;\">");
+}
+
+static void make_attrs(buf *b, size_t n)
+{
+	size_t i;
+
+	buf_printf(b, "<div");
+	for (i = 0; i < n; i++)
+		buf_printf(b, " data-a%zu=\"%zu\"", i, i);
+	buf_printf(b, ">");
+}
+
+static void make_attrs_1(buf *b, size_t i)
+{
+	UNUSED(i);
+
+	make_attrs(b, 1);
+}
+
+static void make_attrs_8(buf *b, size_t i)
+{
+	UNUSED(i);
+
+	make_attrs(b, 8);
+}
+
+static void make_attrs_32(buf *b, size_t i)
+{
+	UNUSED(i);
+
+	make_attrs(b, 32);
+}
+
+static void make_refs_common(buf *b, size_t i)
+{
+	UNUSED(i);
+
+	buf_printf(b, "a &amp; b &lt; c &gt; d &quot;e&quot; f&nbsp;g ");
+}
+
+static void make_refs_long(buf *b, size_t i)
+{
+	UNUSED(i);
+
+	buf_printf(b, "&CounterClockwiseContourIntegral; &NotPrecedesEqual; "
+			"&eacute;&Agrave;&hellip;&mdash; &notin &copy ");
+}
+
+static void make_refs_unknown(buf *b, size_t i)
+{
+	UNUSED(i);
+
+	buf_printf(b, "&zzzz; &amq; &notavalidname; &x; ");
+}
+
+static void make_refs_numeric(buf *b, size_t i)
+{
+	buf_printf(b, "&#%zu; &#x%zx; &#128; ", 0x41 + i % 26,
+			0x2600 + i % 256);
+}
+
+static void make_comment(buf *b, size_t i)
+{
+	buf_printf(b, "<!-- comment number %zu, with some - dashes -->", i);
+}
+
+static void make_doctype(buf *b, size_t i)
+{
+	UNUSED(i);
+
+	buf_printf(b, "<!DOCTYPE html PUBLIC \"-//W3C//DTD XHTML 1.0 "
+			"Strict//EN\" \"http://www.w3.org/TR/xhtml1/DTD/"
+			"xhtml1-strict.dtd\">");
+}
+
+static const bench benches[] = {
+	{ "data/text", make_text, HUBBUB_CONTENT_MODEL_PCDATA, false },
+	{ "data/text-copied", make_text, HUBBUB_CONTENT_MODEL_PCDATA, true },
+	{ "data/crlf", make_crlf, HUBBUB_CONTENT_MODEL_PCDATA, false },
+	{ "rawtext/script", make_rawtext, HUBBUB_CONTENT_MODEL_CDATA, false },
+	{ "tag/names", make_tags, HUBBUB_CONTENT_MODEL_PCDATA, false },
+	{ "tag/attrs-1", make_attrs_1, HUBBUB_CONTENT_MODEL_PCDATA, false },
+	{ "tag/attrs-8", make_attrs_8, HUBBUB_CONTENT_MODEL_PCDATA, false },
+	{ "tag/attrs-32", make_attrs_32, HUBBUB_CONTENT_MODEL_PCDATA, false },
+	{ "attr/dq", make_attr_dq, HUBBUB_CONTENT_MODEL_PCDATA, false },
+	{ "attr/sq", make_attr_sq, HUBBUB_CONTENT_MODEL_PCDATA, false },
+	{ "attr/uq", make_attr_uq, HUBBUB_CONTENT_MODEL_PCDATA, false },
+	{ "attr/refs", make_attr_refs, HUBBUB_CONTENT_MODEL_PCDATA, false },
+	{ "ref/common", make_refs_common, HUBBUB_CONTENT_MODEL_PCDATA, false },
+	{ "ref/long", make_refs_long, HUBBUB_CONTENT_MODEL_PCDATA, false },
+	{ "ref/unknown", make_refs_unknown, HUBBUB_CONTENT_MODEL_PCDATA,
+			false },
+	{ "ref/numeric", make_refs_numeric, HUBBUB_CONTENT_MODEL_PCDATA,
+			false },
+	{ "comment", make_comment, HUBBUB_CONTENT_MODEL_PCDATA, false },
+	{ "doctype", make_doctype, HUBBUB_CONTENT_MODEL_PCDATA, false }
+};
+
+#define N_BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+/* Names searched for in the entity dictionary benchmark */
+static const char *const entity_names[] = {
+	"amp;", "lt;", "gt;", "quot;", "nbsp;", "copy;", "eacute;",
+	"hellip;", "mdash;", "CounterClockwiseContourIntegral;",
+	"NotPrecedesEqual;", "notin", "zzzz;", "amq;"
+};
+
+#define N_ENTITY_NAMES (sizeof(entity_names) / sizeof(entity_names[0]))
+
+/*----------------------------------------------------------------------------
+ * Running
+ *--------------------------------------------------------------------------*/
+
+static double seconds(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static hubbub_error token_handler(const hubbub_token *token, void *pw)
+{
+	UNUSED(token);
+	UNUSED(pw);
+
+	n_tokens++;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error tokenise(hubbub_tokeniser *tok, const bench *bch,
+		const buf *input)
+{
+	hubbub_tokeniser_optparams params;
+	parserutils_inputstream *fresh;
+	hubbub_error error;
+
+	/* An input stream cannot be rewound, so each run needs a new one */
+	if (parserutils_inputstream_create("UTF-8", HUBBUB_CHARSET_CONFIDENT,
+			NULL, &fresh) != PARSERUTILS_OK)
+		return HUBBUB_NOMEM;
+
+	error = hubbub_tokeniser_reset(tok, fresh);
+	if (error != HUBBUB_OK) {
+		parserutils_inputstream_destroy(fresh);
+		return error;
+	}
+
+	parserutils_inputstream_destroy(stream);
+	stream = fresh;
+
+	if (error == HUBBUB_OK) {
+		params.content_model.model = bch->model;
+		error = hubbub_tokeniser_setopt(tok,
+				HUBBUB_TOKENISER_CONTENT_MODEL, &params);
+	}
+
+	if (error == HUBBUB_OK && bch->copied) {
+		if (parserutils_inputstream_append(stream, input->data,
+				input->len) != PARSERUTILS_OK ||
+				parserutils_inputstream_append(stream,
+				NULL, 0) != PARSERUTILS_OK)
+			error = HUBBUB_NOMEM;
+	} else if (error == HUBBUB_OK) {
+		error = hubbub_tokeniser_borrow_chunk(tok, input->data,
+				input->len);
+		if (error == HUBBUB_OK)
+			error = hubbub_tokeniser_borrow_chunk(tok, NULL, 0);
+	}
+
+	if (error == HUBBUB_OK)
+		error = hubbub_tokeniser_run(tok);
+
+	return error;
+}
+
+static void report(const char *name, const char *unit, size_t units,
+		uint64_t tokens, size_t runs, double best)
+{
+	double ns = best * 1e9 / units;
+
+	printf("{\"name\": \"%s\", \"unit\": \"%s\", \"units\": %zu, "
+			"\"tokens\": %" PRIu64 ", \"runs\": %zu, "
+			"\"ns_per_unit\": %.3f", name, unit, units, tokens,
+			runs, ns);
+	if (strcmp(unit, "byte") == 0)
+		printf(", \"mb_per_s\": %.1f", 1e3 / ns);
+	printf("}\n");
+	fflush(stdout);
+}
+
+/**
+ * Time one tokeniser benchmark
+ *
+ * The input is tokenised repeatedly for at least min_time, and that
+ * repeated a few times; the best repetition is reported.
+ */
+static bool run_bench(hubbub_tokeniser *tok, const bench *bch, size_t size)
+{
+	buf input = { NULL, 0, 0 };
+	double best = 0;
+	uint64_t tokens;
+	size_t runs = 0, i, r;
+
+	for (i = 0; input.len < size; i++)
+		bch->make(&input, i);
+
+	n_tokens = 0;
+	if (tokenise(tok, bch, &input) != HUBBUB_OK) {
+		printf("{\"name\": \"%s\", \"error\": true}\n", bch->name);
+		free(input.data);
+		return false;
+	}
+	tokens = n_tokens;
+
+	for (r = 0; r < repeats; r++) {
+		double start = seconds(), elapsed;
+		size_t n = 0;
+
+		do {
+			tokenise(tok, bch, &input);
+			n++;
+			elapsed = seconds() - start;
+		} while (elapsed < min_time);
+
+		if (r == 0 || elapsed / n < best)
+			best = elapsed / n;
+		runs += n;
+	}
+
+	report(bch->name, "byte", input.len, tokens, runs, best);
+
+	free(input.data);
+
+	return true;
+}
+
+/* Time searches of the entity dictionary, one character at a time */
+static void run_entity_search(void)
+{
+	double best = 0;
+	size_t runs = 0, r, i;
+	uint32_t sink = 0;
+
+	for (r = 0; r < repeats; r++) {
+		double start = seconds(), elapsed;
+		size_t n = 0;
+
+		do {
+			for (i = 0; i < N_ENTITY_NAMES; i++) {
+				const char *c = entity_names[i];
+				int32_t context = -1;
+				uint32_t result = 0;
+
+				while (*c != '\0' &&
+						hubbub_entities_search_step(
+						(uint8_t) *c, &result,
+						&context) != HUBBUB_INVALID)
+					c++;
+
+				sink += result;
+			}
+			n++;
+			elapsed = seconds() - start;
+		} while (elapsed < min_time);
+
+		if (r == 0 || elapsed / n < best)
+			best = elapsed / n;
+		runs += n;
+	}
+
+	/* Keep the searches from being optimised away */
+	if (sink == 0)
+		fprintf(stderr, "No entities found\n");
+
+	report("entity/search", "lookup", N_ENTITY_NAMES, 0, runs, best);
+}
+
+static void usage(const char *name)
+{
+	size_t i;
+
+	printf("Usage: %s [-s input KiB] [-t seconds] [-r repeats] "
+			"[name ...]\n\nBenchmarks:\n", name);
+	for (i = 0; i < N_BENCHES; i++)
+		printf("  %s\n", benches[i].name);
+	printf("  entity/search\n\nA name selects each benchmark whose "
+			"name begins with it.\n");
+}
+
+static bool selected(const char *name, int argc, char **argv)
+{
+	int i;
+
+	if (optind == argc)
+		return true;
+
+	for (i = optind; i < argc; i++) {
+		if (strncmp(name, argv[i], strlen(argv[i])) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+int main(int argc, char **argv)
+{
+	hubbub_tokeniser_optparams params;
+	hubbub_tokeniser *tok;
+	size_t size = 256 * 1024, i;
+	bool failed = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:t:r:")) != -1) {
+		switch (opt) {
+		case 's':
+			size = strtoul(optarg, NULL, 10) * 1024;
+			break;
+		case 't':
+			min_time = strtod(optarg, NULL);
+			break;
+		case 'r':
+			repeats = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (size == 0 || repeats == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (parserutils_inputstream_create("UTF-8", HUBBUB_CHARSET_CONFIDENT,
+			NULL, &stream) != PARSERUTILS_OK ||
+			hubbub_tokeniser_create(stream, NULL, NULL,
+			&tok) != HUBBUB_OK) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	params.token_handler.handler = token_handler;
+	params.token_handler.pw = NULL;
+	hubbub_tokeniser_setopt(tok, HUBBUB_TOKENISER_TOKEN_HANDLER, &params);
+
+	for (i = 0; i < N_BENCHES; i++) {
+		if (selected(benches[i].name, argc, argv) &&
+				run_bench(tok, &benches[i], size) == false)
+			failed = true;
+	}
+
+	if (selected("entity/search", argc, argv))
+		run_entity_search();
+
+	hubbub_tokeniser_destroy(tok);
+	parserutils_inputstream_destroy(stream);
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,299 @@
+/*
+ * Parse many documents at once, on a pool of threads
+ *
+ * Each worker keeps a single parser and arena DOM for its whole life,
+ * resetting both between documents, so that once warmed up it parses
+ * without going to the system allocator. Documents are handed out in
+ * contiguous runs, one per worker; a worker which runs out takes the
+ * latter half of the run of another.
+ */
+
+#define _GNU_SOURCE
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/fcntl.h>
+#include <sys/mman.h>
+
+#include <hubbub/hubbub.h>
+#include <hubbub/dom.h>
+#include <hubbub/parser.h>
+
+/** Most workers which may be asked for */
+#define MAX_WORKERS 256
+
+typedef struct document {
+	const uint8_t *data;
+	size_t len;
+} document;
+
+typedef struct worker {
+	pthread_t thread;
+	size_t id;
+
+	pthread_mutex_t lock;	/**< Protects next and end */
+	size_t next;		/**< First job yet to be taken */
+	size_t end;		/**< Job after the last one held */
+
+	size_t parsed;		/**< Documents parsed */
+	size_t stolen;		/**< Jobs taken from other workers */
+	size_t bytes;		/**< Bytes of input parsed */
+	uint64_t nodes;		/**< Nodes built */
+	hubbub_error error;	/**< First failure, if any */
+} worker;
+
+static document *documents;
+static size_t n_documents;
+
+static worker *workers;
+static size_t n_workers;
+
+/**
+ * Take the next job for a worker, stealing if it has none left
+ *
+ * \param self  The worker
+ * \param job   Pointer to location to receive job index
+ * \return true if a job was found, false once all the work is taken
+ *
+ * No more than one lock is ever held at once.
+ */
+static bool take_job(worker *self, size_t *job)
+{
+	size_t i, first, end;
+
+	pthread_mutex_lock(&self->lock);
+	if (self->next < self->end) {
+		*job = self->next++;
+		pthread_mutex_unlock(&self->lock);
+		return true;
+	}
+	pthread_mutex_unlock(&self->lock);
+
+	for (i = 1; i < n_workers; i++) {
+		worker *victim = &workers[(self->id + i) % n_workers];
+
+		pthread_mutex_lock(&victim->lock);
+		end = victim->end;
+		first = end - (end - victim->next) / 2;
+		if (first == end && victim->next < end)
+			first = victim->next;
+		victim->end = first;
+		pthread_mutex_unlock(&victim->lock);
+
+		if (first == end)
+			continue;
+
+		self->stolen += end - first;
+
+		pthread_mutex_lock(&self->lock);
+		self->next = first + 1;
+		self->end = end;
+		pthread_mutex_unlock(&self->lock);
+
+		*job = first;
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * Parse a document, reusing a worker's parser and DOM
+ */
+static hubbub_error parse_document(hubbub_parser *parser, hubbub_dom *dom,
+		const document *doc)
+{
+	hubbub_error error;
+
+	error = hubbub_parser_reset(parser, NULL, false);
+	if (error != HUBBUB_OK)
+		return error;
+
+	/* The reset parser holds no nodes, so the DOM may follow */
+	error = hubbub_dom_reset(dom);
+	if (error != HUBBUB_OK)
+		return error;
+
+	error = hubbub_dom_attach(dom, parser);
+	if (error != HUBBUB_OK)
+		return error;
+
+	error = hubbub_parser_parse_chunk(parser, doc->data, doc->len);
+	if (error != HUBBUB_OK)
+		return error;
+
+	return hubbub_parser_completed(parser);
+}
+
+static void *run_worker(void *arg)
+{
+	worker *self = arg;
+	hubbub_parser_optparams params;
+	hubbub_parser *parser = NULL;
+	hubbub_dom *dom = NULL;
+	size_t job;
+
+	self->error = hubbub_parser_create(NULL, false, &parser);
+	if (self->error != HUBBUB_OK)
+		return NULL;
+
+	/* The documents stay mapped until every worker is done */
+	params.borrow_input = true;
+	self->error = hubbub_parser_setopt(parser,
+			HUBBUB_PARSER_BORROW_INPUT, &params);
+	if (self->error == HUBBUB_OK)
+		self->error = hubbub_dom_create(NULL, NULL, &dom);
+
+	while (self->error == HUBBUB_OK && take_job(self, &job)) {
+		const document *doc = &documents[job % n_documents];
+
+		self->error = parse_document(parser, dom, doc);
+
+		self->parsed++;
+		self->bytes += doc->len;
+		self->nodes += hubbub_dom_count(dom);
+	}
+
+	hubbub_parser_destroy(parser);
+	if (dom != NULL)
+		hubbub_dom_destroy(dom);
+
+	return NULL;
+}
+
+static bool map_document(const char *path, document *doc)
+{
+	struct stat info;
+	void *data;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0) {
+		fprintf(stderr, "Unable to read %s\n", path);
+		if (fd >= 0)
+			close(fd);
+		return false;
+	}
+
+	data = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "Unable to map %s\n", path);
+		return false;
+	}
+
+	doc->data = data;
+	doc->len = info.st_size;
+
+	return true;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-j threads] [-r repeat] <filename> ...\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	struct timespec start, stop;
+	size_t repeat = 1, n_jobs, parsed = 0, bytes = 0, i;
+	uint64_t nodes = 0;
+	double elapsed;
+	long cpus;
+	int opt;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	n_workers = cpus > 0 ? (size_t) cpus : 1;
+
+	while ((opt = getopt(argc, argv, "j:r:")) != -1) {
+		switch (opt) {
+		case 'j':
+			n_workers = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			repeat = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind == argc || n_workers == 0 || n_workers > MAX_WORKERS ||
+			repeat == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	n_documents = argc - optind;
+	documents = calloc(n_documents, sizeof(document));
+	workers = calloc(n_workers, sizeof(worker));
+	if (documents == NULL || workers == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	for (i = 0; i < n_documents; i++) {
+		if (map_document(argv[optind + i], &documents[i]) == false)
+			return 1;
+	}
+
+	/* Every worker starts with an even share of the jobs */
+	n_jobs = n_documents * repeat;
+	for (i = 0; i < n_workers; i++) {
+		workers[i].id = i;
+		workers[i].next = n_jobs * i / n_workers;
+		workers[i].end = n_jobs * (i + 1) / n_workers;
+		pthread_mutex_init(&workers[i].lock, NULL);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < n_workers; i++) {
+		if (pthread_create(&workers[i].thread, NULL, run_worker,
+				&workers[i]) != 0) {
+			fprintf(stderr, "Unable to start worker %zu\n", i);
+			return 1;
+		}
+	}
+
+	for (i = 0; i < n_workers; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+
+	elapsed = (stop.tv_sec - start.tv_sec) +
+			(stop.tv_nsec - start.tv_nsec) / 1e9;
+
+	for (i = 0; i < n_workers; i++) {
+		const worker *w = &workers[i];
+
+		printf("worker %zu: %zu documents (%zu stolen), "
+				"%" PRIu64 " nodes\n",
+				i, w->parsed, w->stolen, w->nodes);
+
+		if (w->error != HUBBUB_OK) {
+			fprintf(stderr, "worker %zu failed: %s\n", i,
+					hubbub_error_to_string(w->error));
+			return 1;
+		}
+
+		parsed += w->parsed;
+		bytes += w->bytes;
+		nodes += w->nodes;
+	}
+
+	printf("%zu documents, %zu bytes, %" PRIu64 " nodes on %zu threads "
+			"in %.3fs: %.1f MB/s\n", parsed, bytes, nodes,
+			n_workers, elapsed, bytes / elapsed / 1e6);
+
+	return 0;
+}
@@ -0,0 +1,300 @@
+/*
+ * Parse one document with the tokeniser and tree builder on two threads
+ *
+ * The document is cut into small parts. One thread tokenises them in turn,
+ * each into a speculation taken from a ring, and passes them on through the
+ * ring; the main thread parses each part as it arrives, using the tokens
+ * read ahead. Where the tree builder changes what the tokeniser would have
+ * done, such as in foreign content, the parser finds the tokens do not fit
+ * and reads the rest of that part itself. The time taken is compared with
+ * that to parse the document as usual.
+ */
+
+#define _GNU_SOURCE
+
+#include <inttypes.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/fcntl.h>
+#include <sys/mman.h>
+
+#include <hubbub/hubbub.h>
+#include <hubbub/dom.h>
+#include <hubbub/parser.h>
+#include <hubbub/speculate.h>
+
+/** Most slots which the ring may be given */
+#define MAX_SLOTS 256
+
+typedef struct slot {
+	hubbub_speculation *spec;
+	hubbub_error error;	/**< Result of tokenising ahead */
+} slot;
+
+/**
+ * Ring of speculations, with one producer and one consumer
+ *
+ * Each index only ever grows, and is written by one side alone; the slots
+ * between tail and head belong to the consumer, the others to the producer.
+ */
+typedef struct ring {
+	slot slots[MAX_SLOTS];
+	size_t n_slots;
+
+	size_t head;		/**< Parts tokenised, written by producer */
+	size_t tail;		/**< Parts parsed, written by consumer */
+} ring;
+
+static ring queue;
+
+static const uint8_t *data;
+static size_t data_len;
+static size_t part_size = 64 * 1024;
+
+static size_t *splits;		/**< End of each part */
+static size_t n_splits;
+
+static void *run_tokeniser(void *arg)
+{
+	size_t i, start = 0;
+
+	(void) arg;
+
+	for (i = 0; i < n_splits; i++) {
+		slot *s = &queue.slots[i % queue.n_slots];
+
+		/* Wait for the consumer to hand the slot back */
+		while (i - __atomic_load_n(&queue.tail, __ATOMIC_ACQUIRE) >=
+				queue.n_slots)
+			sched_yield();
+
+		s->error = hubbub_speculation_run(s->spec, data + start,
+				splits[i] - start);
+		start = splits[i];
+
+		__atomic_store_n(&queue.head, i + 1, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+static hubbub_parser *setup_parser(hubbub_dom *dom)
+{
+	hubbub_parser_optparams params;
+	hubbub_parser *parser;
+
+	if (hubbub_parser_create("UTF-8", false, &parser) != HUBBUB_OK)
+		return NULL;
+
+	/* Tokens read ahead are only used for input read in place */
+	params.borrow_input = true;
+	if (hubbub_parser_setopt(parser, HUBBUB_PARSER_BORROW_INPUT,
+			&params) != HUBBUB_OK ||
+			hubbub_dom_reset(dom) != HUBBUB_OK ||
+			hubbub_dom_attach(dom, parser) != HUBBUB_OK) {
+		hubbub_parser_destroy(parser);
+		return NULL;
+	}
+
+	return parser;
+}
+
+static hubbub_error parse_serially(hubbub_dom *dom)
+{
+	hubbub_parser *parser = setup_parser(dom);
+	hubbub_error error;
+
+	if (parser == NULL)
+		return HUBBUB_NOMEM;
+
+	error = hubbub_parser_parse_chunk(parser, data, data_len);
+	if (error == HUBBUB_OK)
+		error = hubbub_parser_completed(parser);
+
+	hubbub_parser_destroy(parser);
+
+	return error;
+}
+
+static hubbub_error parse_pipelined(hubbub_dom *dom, size_t *ahead)
+{
+	hubbub_parser *parser = setup_parser(dom);
+	hubbub_error error = HUBBUB_OK;
+	pthread_t thread;
+	size_t i;
+
+	if (parser == NULL)
+		return HUBBUB_NOMEM;
+
+	queue.head = 0;
+	queue.tail = 0;
+
+	if (pthread_create(&thread, NULL, run_tokeniser, NULL) != 0) {
+		fprintf(stderr, "Unable to start tokeniser thread\n");
+		exit(1);
+	}
+
+	for (i = 0; i < n_splits; i++) {
+		slot *s = &queue.slots[i % queue.n_slots];
+
+		while (__atomic_load_n(&queue.head, __ATOMIC_ACQUIRE) <= i)
+			sched_yield();
+
+		/* Keep handing slots back, so that the producer finishes */
+		if (error == HUBBUB_OK)
+			error = s->error;
+		if (error == HUBBUB_OK)
+			error = hubbub_parser_parse_speculation(parser,
+					s->spec);
+
+		*ahead += hubbub_speculation_read_length(s->spec);
+
+		__atomic_store_n(&queue.tail, i + 1, __ATOMIC_RELEASE);
+	}
+
+	pthread_join(thread, NULL);
+
+	if (error == HUBBUB_OK)
+		error = hubbub_parser_completed(parser);
+
+	hubbub_parser_destroy(parser);
+
+	return error;
+}
+
+static double seconds_since(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) +
+			(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-q slots] [-s part KiB] [-r repeat] <filename>\n",
+			name);
+}
+
+int main(int argc, char **argv)
+{
+	struct timespec start;
+	size_t repeat = 1, ahead = 0, offset, i;
+	uint64_t serial_nodes, pipelined_nodes;
+	double serial, pipelined;
+	hubbub_error error = HUBBUB_OK;
+	struct stat info;
+	hubbub_dom *dom;
+	int fd, opt;
+
+	queue.n_slots = 8;
+
+	while ((opt = getopt(argc, argv, "q:s:r:")) != -1) {
+		switch (opt) {
+		case 'q':
+			queue.n_slots = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			part_size = strtoul(optarg, NULL, 10) * 1024;
+			break;
+		case 'r':
+			repeat = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc - 1 || queue.n_slots == 0 ||
+			queue.n_slots > MAX_SLOTS || part_size == 0 ||
+			repeat == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd = open(argv[optind], O_RDONLY);
+	if (fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0) {
+		fprintf(stderr, "Unable to read %s\n", argv[optind]);
+		return 1;
+	}
+
+	data = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "Unable to map %s\n", argv[optind]);
+		return 1;
+	}
+	data_len = info.st_size;
+
+	/* Cut the document into parts of at least part_size bytes */
+	splits = malloc((data_len / part_size + 1) * sizeof(size_t));
+	if (splits == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	for (offset = 0; offset < data_len; offset = splits[n_splits++]) {
+		if (data_len - offset <= part_size)
+			splits[n_splits] = data_len;
+		else
+			splits[n_splits] = hubbub_speculation_split(data,
+					data_len, offset + part_size - 1);
+	}
+
+	for (i = 0; i < queue.n_slots; i++) {
+		if (hubbub_speculation_create(NULL, NULL,
+				&queue.slots[i].spec) != HUBBUB_OK) {
+			fprintf(stderr, "Out of memory\n");
+			return 1;
+		}
+	}
+
+	if (hubbub_dom_create(NULL, NULL, &dom) != HUBBUB_OK) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < repeat && error == HUBBUB_OK; i++)
+		error = parse_serially(dom);
+	serial = seconds_since(&start);
+	serial_nodes = hubbub_dom_count(dom);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < repeat && error == HUBBUB_OK; i++)
+		error = parse_pipelined(dom, &ahead);
+	pipelined = seconds_since(&start);
+	pipelined_nodes = hubbub_dom_count(dom);
+
+	if (error != HUBBUB_OK) {
+		fprintf(stderr, "Parsing failed: %s\n",
+				hubbub_error_to_string(error));
+		return 1;
+	}
+
+	printf("%zu parts through %zu slots, %.1f%% tokenised ahead\n",
+			n_splits, queue.n_slots,
+			100.0 * ahead / repeat / data_len);
+	printf("serial:    %.3fs, %" PRIu64 " nodes\n", serial / repeat,
+			serial_nodes);
+	printf("pipelined: %.3fs, %" PRIu64 " nodes\n", pipelined / repeat,
+			pipelined_nodes);
+
+	for (i = 0; i < queue.n_slots; i++)
+		hubbub_speculation_destroy(queue.slots[i].spec);
+	hubbub_dom_destroy(dom);
+	free(splits);
+
+	return 0;
+}
@@ -0,0 +1,1110 @@
+/*
+ * Record the tokens and tree construction of documents, and replay each
+ *
+ * Each document is parsed once into an arena DOM, recording every call made
+ * to the DOM's tree handler, and tokenised once into a speculation, which
+ * records its tokens.  The stages are then timed apart:
+ *
+ *   parse    the whole parser, building the arena DOM
+ *   tree     the tree builder alone, replaying the recorded tokens, with
+ *            tree handlers which do nothing
+ *   handler  the arena DOM alone, replaying the recorded calls
+ *
+ * so that a change to one stage may be measured on real pages without the
+ * others' noise.  As with micro.c, each result is printed as a JSON object
+ * on a line of its own, for runs before and after a change to be compared.
+ */
+
+#define _GNU_SOURCE
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/fcntl.h>
+#include <sys/mman.h>
+
+#include <hubbub/hubbub.h>
+#include <hubbub/dom.h>
+#include <hubbub/parser.h>
+#include <hubbub/speculate.h>
+#include <hubbub/tree.h>
+
+/** Bytes in each block of recorded strings */
+#define POOL_BLOCK (64 * 1024)
+
+#define UNUSED(x) ((void) (x))
+
+/** A call made to a tree handler, with nodes numbered as first seen */
+typedef struct call {
+	hubbub_tree_call type;
+
+	uint32_t node;		/**< Node called upon, or child placed */
+	uint32_t parent;	/**< Parent, if any */
+	uint32_t other;		/**< Reference child, form or new parent */
+	uint32_t result;	/**< Node returned, if any */
+	bool flag;		/**< Whether deep, or element only */
+
+	union {
+		hubbub_string string;
+		hubbub_doctype doctype;
+		hubbub_tag tag;
+		hubbub_quirks_mode quirks_mode;
+		const char *encname;
+	} data;
+} call;
+
+/** Block of memory holding recorded strings */
+typedef struct pool_block {
+	struct pool_block *next;
+	size_t used;
+	size_t size;
+} pool_block;
+
+/** Calls recorded from one parse */
+typedef struct recording {
+	hubbub_tree_handler handler;	/**< Handler which records */
+	hubbub_tree_handler *client;	/**< Handler recorded */
+
+	call *calls;
+	size_t n_calls, calls_alloc;
+
+	void **keys;			/**< Nodes seen, by hash */
+	uint32_t *ids;			/**< Their numbers */
+	size_t map_alloc;		/**< Slots in each (power of two) */
+	uint32_t n_nodes;		/**< Nodes numbered, including none */
+
+	pool_block *pool;		/**< Strings of the calls */
+} recording;
+
+static recording rec;
+
+static void *xalloc(void *ptr, size_t len)
+{
+	ptr = realloc(ptr, len);
+	if (ptr == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+
+	return ptr;
+}
+
+/*----------------------------------------------------------------------------
+ * Recording
+ *--------------------------------------------------------------------------*/
+
+static const uint8_t *keep(const uint8_t *data, size_t len)
+{
+	pool_block *b = rec.pool;
+	uint8_t *copy;
+
+	if (len == 0)
+		return NULL;
+
+	if (b == NULL || b->size - b->used < len) {
+		size_t size = len > POOL_BLOCK ? len : POOL_BLOCK;
+
+		b = xalloc(NULL, sizeof(pool_block) + size);
+		b->next = rec.pool;
+		b->used = 0;
+		b->size = size;
+		rec.pool = b;
+	}
+
+	copy = (uint8_t *) (b + 1) + b->used;
+	memcpy(copy, data, len);
+	b->used += len;
+
+	return copy;
+}
+
+static void keep_string(hubbub_string *s)
+{
+	s->ptr = keep(s->ptr, s->len);
+}
+
+static void keep_tag(hubbub_tag *tag)
+{
+	hubbub_attribute *attrs = NULL;
+	uint32_t i;
+
+	keep_string(&tag->name);
+
+	if (tag->n_attributes == 0) {
+		tag->attributes = NULL;
+		return;
+	}
+
+	/* Attributes are kept in the pool too, so must stay aligned */
+	while (rec.pool == NULL || rec.pool->used % sizeof(void *) != 0)
+		keep((const uint8_t *) "", 1);
+
+	attrs = (hubbub_attribute *) keep((const uint8_t *) tag->attributes,
+			tag->n_attributes * sizeof(hubbub_attribute));
+
+	for (i = 0; i < tag->n_attributes; i++) {
+		keep_string(&attrs[i].name);
+		keep_string(&attrs[i].value);
+	}
+
+	tag->attributes = attrs;
+}
+
+static uint32_t node_id(void *node)
+{
+	size_t i, mask;
+
+	if (node == NULL)
+		return 0;
+
+	if (rec.n_nodes * 2 >= rec.map_alloc) {
+		void **keys = rec.keys;
+		uint32_t *ids = rec.ids;
+		size_t old = rec.map_alloc, j;
+
+		rec.map_alloc = old == 0 ? 1024 : old * 2;
+		rec.keys = calloc(rec.map_alloc, sizeof(void *));
+		rec.ids = calloc(rec.map_alloc, sizeof(uint32_t));
+		if (rec.keys == NULL || rec.ids == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+
+		for (j = 0; j < old; j++) {
+			if (keys[j] == NULL)
+				continue;
+
+			mask = rec.map_alloc - 1;
+			for (i = ((uintptr_t) keys[j] * 2654435761u) & mask;
+					rec.keys[i] != NULL;
+					i = (i + 1) & mask)
+				;
+			rec.keys[i] = keys[j];
+			rec.ids[i] = ids[j];
+		}
+
+		free(keys);
+		free(ids);
+	}
+
+	mask = rec.map_alloc - 1;
+	for (i = ((uintptr_t) node * 2654435761u) & mask; rec.keys[i] != NULL;
+			i = (i + 1) & mask) {
+		if (rec.keys[i] == node)
+			return rec.ids[i];
+	}
+
+	rec.keys[i] = node;
+	rec.ids[i] = rec.n_nodes++;
+
+	return rec.ids[i];
+}
+
+static call *record(hubbub_tree_call type)
+{
+	call *c;
+
+	if (rec.n_calls == rec.calls_alloc) {
+		rec.calls_alloc = rec.calls_alloc == 0 ? 4096 :
+				rec.calls_alloc * 2;
+		rec.calls = xalloc(rec.calls, rec.calls_alloc * sizeof(call));
+	}
+
+	c = &rec.calls[rec.n_calls++];
+	memset(c, 0, sizeof(call));
+	c->type = type;
+
+	return c;
+}
+
+static hubbub_error rec_create_comment(void *ctx, const hubbub_string *data,
+		void **result)
+{
+	call *c = record(HUBBUB_TREE_CREATE_COMMENT);
+	hubbub_error error;
+
+	UNUSED(ctx);
+
+	c->data.string = *data;
+	keep_string(&c->data.string);
+
+	error = rec.client->create_comment(rec.client->ctx, data, result);
+	if (error == HUBBUB_OK)
+		c->result = node_id(*result);
+
+	return error;
+}
+
+static hubbub_error rec_create_doctype(void *ctx,
+		const hubbub_doctype *doctype, void **result)
+{
+	call *c = record(HUBBUB_TREE_CREATE_DOCTYPE);
+	hubbub_error error;
+
+	UNUSED(ctx);
+
+	c->data.doctype = *doctype;
+	keep_string(&c->data.doctype.name);
+	keep_string(&c->data.doctype.public_id);
+	keep_string(&c->data.doctype.system_id);
+
+	error = rec.client->create_doctype(rec.client->ctx, doctype, result);
+	if (error == HUBBUB_OK)
+		c->result = node_id(*result);
+
+	return error;
+}
+
+static hubbub_error rec_create_element(void *ctx, const hubbub_tag *tag,
+		void **result)
+{
+	call *c = record(HUBBUB_TREE_CREATE_ELEMENT);
+	hubbub_error error;
+
+	UNUSED(ctx);
+
+	c->data.tag = *tag;
+	keep_tag(&c->data.tag);
+
+	error = rec.client->create_element(rec.client->ctx, tag, result);
+	if (error == HUBBUB_OK)
+		c->result = node_id(*result);
+
+	return error;
+}
+
+static hubbub_error rec_create_text(void *ctx, const hubbub_string *data,
+		void **result)
+{
+	call *c = record(HUBBUB_TREE_CREATE_TEXT);
+	hubbub_error error;
+
+	UNUSED(ctx);
+
+	c->data.string = *data;
+	keep_string(&c->data.string);
+
+	error = rec.client->create_text(rec.client->ctx, data, result);
+	if (error == HUBBUB_OK)
+		c->result = node_id(*result);
+
+	return error;
+}
+
+static hubbub_error rec_ref_node(void *ctx, void *node)
+{
+	call *c = record(HUBBUB_TREE_REF_NODE);
+
+	UNUSED(ctx);
+
+	c->node = node_id(node);
+
+	return rec.client->ref_node(rec.client->ctx, node);
+}
+
+static hubbub_error rec_unref_node(void *ctx, void *node)
+{
+	call *c = record(HUBBUB_TREE_UNREF_NODE);
+
+	UNUSED(ctx);
+
+	c->node = node_id(node);
+
+	return rec.client->unref_node(rec.client->ctx, node);
+}
+
+static hubbub_error rec_append_child(void *ctx, void *parent, void *child,
+		void **result)
+{
+	call *c = record(HUBBUB_TREE_APPEND_CHILD);
+	hubbub_error error;
+
+	UNUSED(ctx);
+
+	c->parent = node_id(parent);
+	c->node = node_id(child);
+
+	error = rec.client->append_child(rec.client->ctx, parent, child,
+			result);
+	if (error == HUBBUB_OK)
+		c->result = node_id(*result);
+
+	return error;
+}
+
+static hubbub_error rec_insert_before(void *ctx, void *parent, void *child,
+		void *ref_child, void **result)
+{
+	call *c = record(HUBBUB_TREE_INSERT_BEFORE);
+	hubbub_error error;
+
+	UNUSED(ctx);
+
+	c->parent = node_id(parent);
+	c->node = node_id(child);
+	c->other = node_id(ref_child);
+
+	error = rec.client->insert_before(rec.client->ctx, parent, child,
+			ref_child, result);
+	if (error == HUBBUB_OK)
+		c->result = node_id(*result);
+
+	return error;
+}
+
+static hubbub_error rec_remove_child(void *ctx, void *parent, void *child,
+		void **result)
+{
+	call *c = record(HUBBUB_TREE_REMOVE_CHILD);
+	hubbub_error error;
+
+	UNUSED(ctx);
+
+	c->parent = node_id(parent);
+	c->node = node_id(child);
+
+	error = rec.client->remove_child(rec.client->ctx, parent, child,
+			result);
+	if (error == HUBBUB_OK)
+		c->result = node_id(*result);
+
+	return error;
+}
+
+static hubbub_error rec_clone_node(void *ctx, void *node, bool deep,
+		void **result)
+{
+	call *c = record(HUBBUB_TREE_CLONE_NODE);
+	hubbub_error error;
+
+	UNUSED(ctx);
+
+	c->node = node_id(node);
+	c->flag = deep;
+
+	error = rec.client->clone_node(rec.client->ctx, node, deep, result);
+	if (error == HUBBUB_OK)
+		c->result = node_id(*result);
+
+	return error;
+}
+
+static hubbub_error rec_reparent_children(void *ctx, void *node,
+		void *new_parent)
+{
+	call *c = record(HUBBUB_TREE_REPARENT_CHILDREN);
+
+	UNUSED(ctx);
+
+	c->node = node_id(node);
+	c->other = node_id(new_parent);
+
+	return rec.client->reparent_children(rec.client->ctx, node,
+			new_parent);
+}
+
+static hubbub_error rec_get_parent(void *ctx, void *node, bool element_only,
+		void **result)
+{
+	call *c = record(HUBBUB_TREE_GET_PARENT);
+	hubbub_error error;
+
+	UNUSED(ctx);
+
+	c->node = node_id(node);
+	c->flag = element_only;
+
+	error = rec.client->get_parent(rec.client->ctx, node, element_only,
+			result);
+	if (error == HUBBUB_OK)
+		c->result = node_id(*result);
+
+	return error;
+}
+
+static hubbub_error rec_has_children(void *ctx, void *node, bool *result)
+{
+	call *c = record(HUBBUB_TREE_HAS_CHILDREN);
+
+	UNUSED(ctx);
+
+	c->node = node_id(node);
+
+	return rec.client->has_children(rec.client->ctx, node, result);
+}
+
+static hubbub_error rec_form_associate(void *ctx, void *form, void *node)
+{
+	call *c = record(HUBBUB_TREE_FORM_ASSOCIATE);
+
+	UNUSED(ctx);
+
+	c->other = node_id(form);
+	c->node = node_id(node);
+
+	return rec.client->form_associate(rec.client->ctx, form, node);
+}
+
+static hubbub_error rec_add_attributes(void *ctx, void *node,
+		const hubbub_attribute *attributes, uint32_t n_attributes)
+{
+	call *c = record(HUBBUB_TREE_ADD_ATTRIBUTES);
+
+	UNUSED(ctx);
+
+	c->node = node_id(node);
+	c->data.tag.attributes = (hubbub_attribute *) attributes;
+	c->data.tag.n_attributes = n_attributes;
+	keep_tag(&c->data.tag);
+
+	return rec.client->add_attributes(rec.client->ctx, node, attributes,
+			n_attributes);
+}
+
+static hubbub_error rec_set_quirks_mode(void *ctx, hubbub_quirks_mode mode)
+{
+	call *c = record(HUBBUB_TREE_SET_QUIRKS_MODE);
+
+	UNUSED(ctx);
+
+	c->data.quirks_mode = mode;
+
+	return rec.client->set_quirks_mode(rec.client->ctx, mode);
+}
+
+static hubbub_error rec_encoding_change(void *ctx, const char *encname)
+{
+	UNUSED(ctx);
+
+	/* Not replayed: the parse has been asked to restart */
+	return rec.client->encoding_change(rec.client->ctx, encname);
+}
+
+static hubbub_error rec_complete_script(void *ctx, void *script)
+{
+	call *c = record(HUBBUB_TREE_COMPLETE_SCRIPT);
+
+	UNUSED(ctx);
+
+	c->node = node_id(script);
+
+	return rec.client->complete_script(rec.client->ctx, script);
+}
+
+static hubbub_error rec_append_text_to(void *ctx, void *parent,
+		const hubbub_string *data, bool *result)
+{
+	call *c = record(HUBBUB_TREE_APPEND_TEXT_TO);
+
+	UNUSED(ctx);
+
+	c->parent = node_id(parent);
+	c->data.string = *data;
+	keep_string(&c->data.string);
+
+	return rec.client->append_text_to(rec.client->ctx, parent, data,
+			result);
+}
+
+/* Record the calls made to a handler, whose optional ones are mirrored */
+static void start_recording(hubbub_tree_handler *client, void *document)
+{
+	hubbub_tree_handler *h = &rec.handler;
+	pool_block *b, *next;
+
+	for (b = rec.pool; b != NULL; b = next) {
+		next = b->next;
+		free(b);
+	}
+	rec.pool = NULL;
+
+	rec.client = client;
+	rec.n_calls = 0;
+	if (rec.map_alloc != 0)
+		memset(rec.keys, 0, rec.map_alloc * sizeof(void *));
+	rec.n_nodes = 1;
+
+	/* The document is node 1 */
+	node_id(document);
+
+	h->create_comment = rec_create_comment;
+	h->create_doctype = rec_create_doctype;
+	h->create_element = rec_create_element;
+	h->create_text = rec_create_text;
+	h->ref_node = client->ref_node != NULL ? rec_ref_node : NULL;
+	h->unref_node = client->unref_node != NULL ? rec_unref_node : NULL;
+	h->append_child = rec_append_child;
+	h->insert_before = rec_insert_before;
+	h->remove_child = rec_remove_child;
+	h->clone_node = rec_clone_node;
+	h->reparent_children = rec_reparent_children;
+	h->get_parent = rec_get_parent;
+	h->has_children = rec_has_children;
+	h->form_associate = rec_form_associate;
+	h->add_attributes = rec_add_attributes;
+	h->set_quirks_mode = rec_set_quirks_mode;
+	h->encoding_change = client->encoding_change != NULL ?
+			rec_encoding_change : NULL;
+	h->complete_script = client->complete_script != NULL ?
+			rec_complete_script : NULL;
+	h->ctx = NULL;
+	h->flags = client->flags;
+	h->append_text_to = client->append_text_to != NULL ?
+			rec_append_text_to : NULL;
+}
+
+/*----------------------------------------------------------------------------
+ * Replaying
+ *--------------------------------------------------------------------------*/
+
+/* Make the recorded calls to a handler, with its own nodes */
+static hubbub_error replay_calls(hubbub_tree_handler *h, void *document,
+		void **nodes)
+{
+	void *ctx = h->ctx;
+	hubbub_error error = HUBBUB_OK;
+	size_t i;
+
+	nodes[0] = NULL;
+	nodes[1] = document;
+
+	for (i = 0; i < rec.n_calls && error == HUBBUB_OK; i++) {
+		const call *c = &rec.calls[i];
+		void *result = NULL;
+		bool flag;
+
+		switch (c->type) {
+		case HUBBUB_TREE_CREATE_COMMENT:
+			error = h->create_comment(ctx, &c->data.string,
+					&result);
+			break;
+		case HUBBUB_TREE_CREATE_DOCTYPE:
+			error = h->create_doctype(ctx, &c->data.doctype,
+					&result);
+			break;
+		case HUBBUB_TREE_CREATE_ELEMENT:
+			error = h->create_element(ctx, &c->data.tag, &result);
+			break;
+		case HUBBUB_TREE_CREATE_TEXT:
+			error = h->create_text(ctx, &c->data.string, &result);
+			break;
+		case HUBBUB_TREE_REF_NODE:
+			error = h->ref_node(ctx, nodes[c->node]);
+			break;
+		case HUBBUB_TREE_UNREF_NODE:
+			error = h->unref_node(ctx, nodes[c->node]);
+			break;
+		case HUBBUB_TREE_APPEND_CHILD:
+			error = h->append_child(ctx, nodes[c->parent],
+					nodes[c->node], &result);
+			break;
+		case HUBBUB_TREE_INSERT_BEFORE:
+			error = h->insert_before(ctx, nodes[c->parent],
+					nodes[c->node], nodes[c->other],
+					&result);
+			break;
+		case HUBBUB_TREE_REMOVE_CHILD:
+			error = h->remove_child(ctx, nodes[c->parent],
+					nodes[c->node], &result);
+			break;
+		case HUBBUB_TREE_CLONE_NODE:
+			error = h->clone_node(ctx, nodes[c->node], c->flag,
+					&result);
+			break;
+		case HUBBUB_TREE_REPARENT_CHILDREN:
+			error = h->reparent_children(ctx, nodes[c->node],
+					nodes[c->other]);
+			break;
+		case HUBBUB_TREE_GET_PARENT:
+			error = h->get_parent(ctx, nodes[c->node], c->flag,
+					&result);
+			break;
+		case HUBBUB_TREE_HAS_CHILDREN:
+			error = h->has_children(ctx, nodes[c->node], &flag);
+			break;
+		case HUBBUB_TREE_FORM_ASSOCIATE:
+			error = h->form_associate(ctx, nodes[c->other],
+					nodes[c->node]);
+			break;
+		case HUBBUB_TREE_ADD_ATTRIBUTES:
+			error = h->add_attributes(ctx, nodes[c->node],
+					c->data.tag.attributes,
+					c->data.tag.n_attributes);
+			break;
+		case HUBBUB_TREE_SET_QUIRKS_MODE:
+			error = h->set_quirks_mode(ctx, c->data.quirks_mode);
+			break;
+		case HUBBUB_TREE_COMPLETE_SCRIPT:
+			error = h->complete_script(ctx, nodes[c->node]);
+			break;
+		case HUBBUB_TREE_APPEND_TEXT_TO:
+			error = h->append_text_to(ctx, nodes[c->parent],
+					&c->data.string, &flag);
+			break;
+		default:
+			error = HUBBUB_BADPARM;
+		}
+
+		if (c->result != 0)
+			nodes[c->result] = result;
+	}
+
+	return error;
+}
+
+static hubbub_error null_node(void *ctx, void **result)
+{
+	UNUSED(ctx);
+
+	*result = (void *) 1;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error null_comment(void *ctx, const hubbub_string *data,
+		void **result)
+{
+	UNUSED(data);
+
+	return null_node(ctx, result);
+}
+
+static hubbub_error null_doctype(void *ctx, const hubbub_doctype *doctype,
+		void **result)
+{
+	UNUSED(doctype);
+
+	return null_node(ctx, result);
+}
+
+static hubbub_error null_element(void *ctx, const hubbub_tag *tag,
+		void **result)
+{
+	UNUSED(tag);
+
+	return null_node(ctx, result);
+}
+
+static hubbub_error null_text(void *ctx, const hubbub_string *data,
+		void **result)
+{
+	UNUSED(data);
+
+	return null_node(ctx, result);
+}
+
+static hubbub_error null_append(void *ctx, void *parent, void *child,
+		void **result)
+{
+	UNUSED(ctx);
+	UNUSED(parent);
+
+	*result = child;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error null_insert(void *ctx, void *parent, void *child,
+		void *ref_child, void **result)
+{
+	UNUSED(ref_child);
+
+	return null_append(ctx, parent, child, result);
+}
+
+static hubbub_error null_clone(void *ctx, void *node, bool deep,
+		void **result)
+{
+	UNUSED(node);
+	UNUSED(deep);
+
+	return null_node(ctx, result);
+}
+
+static hubbub_error null_reparent(void *ctx, void *node, void *new_parent)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+	UNUSED(new_parent);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error null_parent(void *ctx, void *node, bool element_only,
+		void **result)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+	UNUSED(element_only);
+
+	*result = NULL;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error null_has_children(void *ctx, void *node, bool *result)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+
+	*result = false;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error null_form(void *ctx, void *form, void *node)
+{
+	UNUSED(ctx);
+	UNUSED(form);
+	UNUSED(node);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error null_attributes(void *ctx, void *node,
+		const hubbub_attribute *attributes, uint32_t n_attributes)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+	UNUSED(attributes);
+	UNUSED(n_attributes);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error null_quirks(void *ctx, hubbub_quirks_mode mode)
+{
+	UNUSED(ctx);
+	UNUSED(mode);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_tree_handler null_handler = {
+	null_comment,
+	null_doctype,
+	null_element,
+	null_text,
+	NULL,
+	NULL,
+	null_append,
+	null_insert,
+	null_append,
+	null_clone,
+	null_reparent,
+	null_parent,
+	null_has_children,
+	null_form,
+	null_attributes,
+	null_quirks,
+	NULL,
+	NULL,
+	NULL,
+	HUBBUB_TREE_NO_REFCOUNT,
+	NULL
+};
+
+/*----------------------------------------------------------------------------
+ * Running the stages
+ *--------------------------------------------------------------------------*/
+
+typedef struct page {
+	const char *name;
+	const uint8_t *data;
+	size_t len;
+	size_t start;			/**< Offset of the first '<' */
+	hubbub_speculation *spec;	/**< Its tokens, from \a start */
+	uint32_t nodes;			/**< Nodes in its DOM */
+} page;
+
+static hubbub_parser *setup_parser(hubbub_tree_handler *handler,
+		void *document)
+{
+	hubbub_parser_optparams params;
+	hubbub_parser *parser;
+
+	if (hubbub_parser_create("UTF-8", false, &parser) != HUBBUB_OK)
+		return NULL;
+
+	/* Tokens read ahead are only used for input read in place */
+	params.borrow_input = true;
+	if (hubbub_parser_setopt(parser, HUBBUB_PARSER_BORROW_INPUT,
+			&params) != HUBBUB_OK) {
+		hubbub_parser_destroy(parser);
+		return NULL;
+	}
+
+	params.tree_handler = handler;
+	if (hubbub_parser_setopt(parser, HUBBUB_PARSER_TREE_HANDLER,
+			&params) != HUBBUB_OK) {
+		hubbub_parser_destroy(parser);
+		return NULL;
+	}
+
+	params.document_node = document;
+	if (hubbub_parser_setopt(parser, HUBBUB_PARSER_DOCUMENT_NODE,
+			&params) != HUBBUB_OK) {
+		hubbub_parser_destroy(parser);
+		return NULL;
+	}
+
+	return parser;
+}
+
+static hubbub_error parse(const page *p, hubbub_tree_handler *handler,
+		void *document, bool replay)
+{
+	hubbub_parser *parser = setup_parser(handler, document);
+	hubbub_error error;
+
+	if (parser == NULL)
+		return HUBBUB_NOMEM;
+
+	if (replay) {
+		/* Speculations begin with a tag, so any text before the
+		 * first is parsed as usual */
+		error = HUBBUB_OK;
+		if (p->start > 0)
+			error = hubbub_parser_parse_chunk(parser, p->data,
+					p->start);
+		if (error == HUBBUB_OK)
+			error = hubbub_parser_parse_speculation(parser,
+					p->spec);
+	} else {
+		error = hubbub_parser_parse_chunk(parser, p->data, p->len);
+	}
+	if (error == HUBBUB_OK)
+		error = hubbub_parser_completed(parser);
+
+	hubbub_parser_destroy(parser);
+
+	return error;
+}
+
+/* Parse once, recording the tokens and the calls to the DOM */
+static bool record_page(page *p, hubbub_dom *dom)
+{
+	hubbub_tree_handler *handler;
+	const uint8_t *lt;
+	void *document;
+
+	lt = memchr(p->data, '<', p->len);
+	p->start = lt != NULL ? (size_t) (lt - p->data) : p->len;
+
+	if (hubbub_speculation_create(NULL, NULL, &p->spec) != HUBBUB_OK ||
+			hubbub_speculation_run(p->spec, p->data + p->start,
+					p->len - p->start) != HUBBUB_OK)
+		return false;
+
+	if (hubbub_dom_reset(dom) != HUBBUB_OK)
+		return false;
+
+	handler = hubbub_dom_get_tree_handler(dom, &document);
+	start_recording(handler, document);
+
+	if (parse(p, &rec.handler, document, false) != HUBBUB_OK)
+		return false;
+
+	p->nodes = hubbub_dom_count(dom);
+
+	return true;
+}
+
+static double seconds(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+typedef enum stage {
+	STAGE_PARSE,
+	STAGE_TREE,
+	STAGE_HANDLER,
+	N_STAGES
+} stage;
+
+static const char *const stage_names[N_STAGES] = {
+	"parse", "tree", "handler"
+};
+
+static hubbub_error run_stage(const page *p, stage s, hubbub_dom *dom,
+		void **nodes)
+{
+	hubbub_tree_handler *handler;
+	hubbub_error error;
+	void *document;
+
+	switch (s) {
+	case STAGE_PARSE:
+		error = hubbub_dom_reset(dom);
+		if (error != HUBBUB_OK)
+			return error;
+
+		handler = hubbub_dom_get_tree_handler(dom, &document);
+		return parse(p, handler, document, false);
+	case STAGE_TREE:
+		return parse(p, &null_handler, (void *) 1, true);
+	case STAGE_HANDLER:
+		error = hubbub_dom_reset(dom);
+		if (error != HUBBUB_OK)
+			return error;
+
+		handler = hubbub_dom_get_tree_handler(dom, &document);
+		error = replay_calls(handler, document, nodes);
+		if (error == HUBBUB_OK && hubbub_dom_count(dom) != p->nodes)
+			error = HUBBUB_UNKNOWN;
+		return error;
+	default:
+		return HUBBUB_BADPARM;
+	}
+}
+
+/* Time a stage, reporting the best of several runs */
+static bool time_stage(const page *p, stage s, hubbub_dom *dom,
+		size_t runs)
+{
+	void **nodes;
+	double best = 0;
+	size_t i;
+
+	nodes = xalloc(NULL, rec.n_nodes * sizeof(void *));
+
+	for (i = 0; i <= runs; i++) {
+		double start = seconds(), elapsed;
+
+		if (run_stage(p, s, dom, nodes) != HUBBUB_OK) {
+			printf("{\"name\": \"%s/%s\", \"error\": true}\n",
+					p->name, stage_names[s]);
+			free(nodes);
+			return false;
+		}
+
+		/* The first run warms up */
+		elapsed = seconds() - start;
+		if (i == 1 || (i > 1 && elapsed < best))
+			best = elapsed;
+	}
+
+	free(nodes);
+
+	printf("{\"name\": \"%s/%s\", \"bytes\": %zu, \"calls\": %zu, "
+			"\"replayed\": %zu, \"runs\": %zu, \"ms\": %.3f, "
+			"\"mb_per_s\": %.1f}\n", p->name, stage_names[s],
+			p->len, rec.n_calls,
+			hubbub_speculation_read_length(p->spec), runs,
+			best * 1e3, p->len / best / 1e6);
+	fflush(stdout);
+
+	return true;
+}
+
+static bool map_page(const char *path, page *p)
+{
+	struct stat info;
+	void *data;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0) {
+		fprintf(stderr, "Unable to read %s\n", path);
+		if (fd >= 0)
+			close(fd);
+		return false;
+	}
+
+	data = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "Unable to map %s\n", path);
+		return false;
+	}
+
+	p->name = strrchr(path, '/') != NULL ? strrchr(path, '/') + 1 : path;
+	p->data = data;
+	p->len = info.st_size;
+	p->spec = NULL;
+
+	return true;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-s parse|tree|handler] [-r runs] <filename> ...\n"
+			"\nEach file is parsed once to record its tokens and "
+			"the calls made to the\narena DOM; the stages are "
+			"then timed apart.  \"replayed\" is the number\nof "
+			"bytes whose tokens the tree stage replays.\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	bool stages[N_STAGES] = { true, true, true };
+	bool failed = false;
+	size_t runs = 10;
+	hubbub_dom *dom;
+	int opt, i, s;
+
+	while ((opt = getopt(argc, argv, "s:r:")) != -1) {
+		switch (opt) {
+		case 's':
+			for (s = 0; s < N_STAGES; s++) {
+				stages[s] = strcmp(optarg,
+						stage_names[s]) == 0;
+			}
+			break;
+		case 'r':
+			runs = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind == argc || runs == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (hubbub_dom_create(NULL, NULL, &dom) != HUBBUB_OK) {
+		fprintf(stderr, "Unable to create DOM\n");
+		return 1;
+	}
+
+	for (i = optind; i < argc; i++) {
+		page p;
+
+		if (map_page(argv[i], &p) == false)
+			return 1;
+
+		if (record_page(&p, dom) == false) {
+			printf("{\"name\": \"%s\", \"error\": true}\n",
+					p.name);
+			failed = true;
+		} else {
+			for (s = 0; s < N_STAGES; s++) {
+				if (stages[s] && time_stage(&p, s, dom,
+						runs) == false)
+					failed = true;
+			}
+		}
+
+		if (p.spec != NULL)
+			hubbub_speculation_destroy(p.spec);
+		munmap((void *) p.data, p.len);
+	}
+
+	hubbub_dom_destroy(dom);
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,257 @@
+/*
+ * Parse one large document, tokenising parts of it ahead on other threads
+ *
+ * The document is split into parts of about the same size. While the first
+ * is parsed, each of the others is tokenised on a thread of its own; the
+ * parts are then parsed in order, using the tokens read ahead. The time
+ * taken is compared with that to parse the document as usual.
+ */
+
+#define _GNU_SOURCE
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/fcntl.h>
+#include <sys/mman.h>
+
+#include <hubbub/hubbub.h>
+#include <hubbub/dom.h>
+#include <hubbub/parser.h>
+#include <hubbub/speculate.h>
+
+/** Most parts which may be asked for */
+#define MAX_PARTS 256
+
+typedef struct part {
+	pthread_t thread;
+	hubbub_speculation *spec;
+
+	const uint8_t *data;
+	size_t len;
+	hubbub_error error;	/**< Result of tokenising ahead */
+} part;
+
+static part parts[MAX_PARTS];
+static size_t n_parts;
+
+static void *run_part(void *arg)
+{
+	part *p = arg;
+
+	p->error = hubbub_speculation_run(p->spec, p->data, p->len);
+
+	return NULL;
+}
+
+static hubbub_parser *setup_parser(hubbub_dom *dom)
+{
+	hubbub_parser_optparams params;
+	hubbub_parser *parser;
+
+	if (hubbub_parser_create("UTF-8", false, &parser) != HUBBUB_OK)
+		return NULL;
+
+	/* Tokens read ahead are only used for input read in place */
+	params.borrow_input = true;
+	if (hubbub_parser_setopt(parser, HUBBUB_PARSER_BORROW_INPUT,
+			&params) != HUBBUB_OK ||
+			hubbub_dom_reset(dom) != HUBBUB_OK ||
+			hubbub_dom_attach(dom, parser) != HUBBUB_OK) {
+		hubbub_parser_destroy(parser);
+		return NULL;
+	}
+
+	return parser;
+}
+
+static hubbub_error parse_serially(hubbub_dom *dom, const uint8_t *data,
+		size_t len)
+{
+	hubbub_parser *parser = setup_parser(dom);
+	hubbub_error error;
+
+	if (parser == NULL)
+		return HUBBUB_NOMEM;
+
+	error = hubbub_parser_parse_chunk(parser, data, len);
+	if (error == HUBBUB_OK)
+		error = hubbub_parser_completed(parser);
+
+	hubbub_parser_destroy(parser);
+
+	return error;
+}
+
+static hubbub_error parse_speculatively(hubbub_dom *dom, size_t *ahead)
+{
+	hubbub_parser *parser = setup_parser(dom);
+	hubbub_error error;
+	size_t i;
+
+	if (parser == NULL)
+		return HUBBUB_NOMEM;
+
+	for (i = 1; i < n_parts; i++) {
+		if (pthread_create(&parts[i].thread, NULL, run_part,
+				&parts[i]) != 0) {
+			fprintf(stderr, "Unable to start thread %zu\n", i);
+			exit(1);
+		}
+	}
+
+	error = hubbub_parser_parse_chunk(parser, parts[0].data,
+			parts[0].len);
+
+	for (i = 1; i < n_parts; i++) {
+		pthread_join(parts[i].thread, NULL);
+
+		if (error == HUBBUB_OK)
+			error = parts[i].error;
+		if (error == HUBBUB_OK)
+			error = hubbub_parser_parse_speculation(parser,
+					parts[i].spec);
+
+		*ahead += hubbub_speculation_read_length(parts[i].spec);
+	}
+
+	if (error == HUBBUB_OK)
+		error = hubbub_parser_completed(parser);
+
+	hubbub_parser_destroy(parser);
+
+	return error;
+}
+
+static double seconds_since(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) +
+			(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-j parts] [-r repeat] <filename>\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	struct timespec start;
+	size_t repeat = 1, ahead = 0, offset, i;
+	uint64_t serial_nodes, speculative_nodes;
+	double serial, speculative;
+	const uint8_t *data;
+	hubbub_error error = HUBBUB_OK;
+	struct stat info;
+	hubbub_dom *dom;
+	long cpus;
+	int fd, opt;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	n_parts = cpus > 0 ? (size_t) cpus : 1;
+
+	while ((opt = getopt(argc, argv, "j:r:")) != -1) {
+		switch (opt) {
+		case 'j':
+			n_parts = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			repeat = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc - 1 || n_parts == 0 || n_parts > MAX_PARTS ||
+			repeat == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd = open(argv[optind], O_RDONLY);
+	if (fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0) {
+		fprintf(stderr, "Unable to read %s\n", argv[optind]);
+		return 1;
+	}
+
+	data = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "Unable to map %s\n", argv[optind]);
+		return 1;
+	}
+
+	/* Split the document into parts of about the same size */
+	for (i = 0, offset = 0; i < n_parts && offset < (size_t) info.st_size;
+			i++) {
+		size_t end = (size_t) info.st_size * (i + 1) / n_parts;
+
+		if (end > offset && i + 1 < n_parts)
+			end = hubbub_speculation_split(data, info.st_size,
+					end - 1);
+		else if (i + 1 < n_parts)
+			end = hubbub_speculation_split(data, info.st_size,
+					offset);
+
+		parts[i].data = data + offset;
+		parts[i].len = end - offset;
+
+		if (hubbub_speculation_create(NULL, NULL,
+				&parts[i].spec) != HUBBUB_OK) {
+			fprintf(stderr, "Out of memory\n");
+			return 1;
+		}
+
+		offset = end;
+	}
+	n_parts = i;
+
+	if (hubbub_dom_create(NULL, NULL, &dom) != HUBBUB_OK) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < repeat && error == HUBBUB_OK; i++)
+		error = parse_serially(dom, data, info.st_size);
+	serial = seconds_since(&start);
+	serial_nodes = hubbub_dom_count(dom);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < repeat && error == HUBBUB_OK; i++)
+		error = parse_speculatively(dom, &ahead);
+	speculative = seconds_since(&start);
+	speculative_nodes = hubbub_dom_count(dom);
+
+	if (error != HUBBUB_OK) {
+		fprintf(stderr, "Parsing failed: %s\n",
+				hubbub_error_to_string(error));
+		return 1;
+	}
+
+	printf("%zu parts, %.1f%% tokenised ahead\n", n_parts,
+			100.0 * ahead / repeat / info.st_size);
+	printf("serial:      %.3fs, %" PRIu64 " nodes\n", serial / repeat,
+			serial_nodes);
+	printf("speculative: %.3fs, %" PRIu64 " nodes\n",
+			speculative / repeat, speculative_nodes);
+
+	for (i = 0; i < n_parts; i++)
+		hubbub_speculation_destroy(parts[i].spec);
+	hubbub_dom_destroy(dom);
+
+	return 0;
+}
@@ -0,0 +1,205 @@
+/*
+ * Parse a page whose scripts each write a little markup into it
+ *
+ * The page holds a number of small scripts, and as each ends, the parser is
+ * given a short string to insert, as document.write() would. The time to
+ * parse it so is compared with that to parse the same bytes, with the
+ * strings already in place, as one chunk. Only the tokeniser runs, with a
+ * token handler which selects the content model of each element, so that
+ * the difference is the cost of the insertions.
+ */
+
+#define _GNU_SOURCE
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <hubbub/hubbub.h>
+#include <hubbub/parser.h>
+
+#define SLEN(s) (sizeof((s)) - 1)
+
+static const char paragraph[] =
+		"<p>Some text of the article, with <b>markup</b> in it."
+		"<script>w()</script>\n";
+static const char markup[] = "<a href=\"/ad\">An advert</a>";
+
+typedef struct page {
+	hubbub_parser *parser;
+	bool write;		/**< Whether scripts write their markup */
+	size_t writes;		/**< Writes made */
+} page;
+
+static hubbub_error token_handler(const hubbub_token *token, void *pw)
+{
+	hubbub_parser_optparams params;
+	page *p = pw;
+
+	if (token->type == HUBBUB_TOKEN_START_TAG) {
+		params.content_model.model = hubbub_parser_content_model_for(
+				&token->data.tag, true);
+		return hubbub_parser_setopt(p->parser,
+				HUBBUB_PARSER_CONTENT_MODEL, &params);
+	}
+
+	if (token->type == HUBBUB_TOKEN_END_TAG && p->write &&
+			token->data.tag.name.len == SLEN("script") &&
+			memcmp(token->data.tag.name.ptr, "script",
+					SLEN("script")) == 0) {
+		p->writes++;
+		return hubbub_parser_insert_chunk(p->parser,
+				(const uint8_t *) markup, SLEN(markup));
+	}
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error parse(page *p, const uint8_t *data, size_t len,
+		bool borrow)
+{
+	hubbub_parser_optparams params;
+	hubbub_error error;
+
+	error = hubbub_parser_create_for_tokens("UTF-8", false, NULL, NULL,
+			&p->parser);
+	if (error != HUBBUB_OK)
+		return error;
+
+	params.token_handler.handler = token_handler;
+	params.token_handler.pw = p;
+	error = hubbub_parser_setopt(p->parser, HUBBUB_PARSER_TOKEN_HANDLER,
+			&params);
+
+	if (error == HUBBUB_OK) {
+		params.borrow_input = borrow;
+		error = hubbub_parser_setopt(p->parser,
+				HUBBUB_PARSER_BORROW_INPUT, &params);
+	}
+
+	if (error == HUBBUB_OK)
+		error = hubbub_parser_parse_chunk(p->parser, data, len);
+
+	if (error == HUBBUB_OK)
+		error = hubbub_parser_completed(p->parser);
+
+	hubbub_parser_destroy(p->parser);
+
+	return error;
+}
+
+static double seconds_since(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) +
+			(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static uint8_t *make_page(size_t n, bool written, size_t *len)
+{
+	size_t size = n * (SLEN(paragraph) + (written ? SLEN(markup) : 0));
+	uint8_t *data = malloc(size), *pos = data;
+	size_t i;
+
+	if (data == NULL)
+		return NULL;
+
+	for (i = 0; i < n; i++) {
+		memcpy(pos, paragraph, SLEN(paragraph));
+		pos += SLEN(paragraph);
+
+		/* The written markup follows the script's end tag */
+		if (written) {
+			memmove(pos - 1, markup, SLEN(markup));
+			pos += SLEN(markup) - 1;
+			*pos++ = '\n';
+		}
+	}
+
+	*len = size;
+
+	return data;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-n writes] [-r repeat] [-b]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	size_t n = 10000, repeat = 10, plain_len, written_len, i;
+	struct timespec start;
+	uint8_t *plain, *written;
+	double one, inserted;
+	hubbub_error error = HUBBUB_OK;
+	bool borrow = false;
+	page p;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:r:b")) != -1) {
+		switch (opt) {
+		case 'n':
+			n = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			repeat = strtoul(optarg, NULL, 10);
+			break;
+		case 'b':
+			borrow = true;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc || n == 0 || repeat == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	plain = make_page(n, false, &plain_len);
+	written = make_page(n, true, &written_len);
+	if (plain == NULL || written == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	p.write = false;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < repeat && error == HUBBUB_OK; i++)
+		error = parse(&p, written, written_len, borrow);
+	one = seconds_since(&start) / repeat;
+
+	p.write = true;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < repeat && error == HUBBUB_OK; i++) {
+		p.writes = 0;
+		error = parse(&p, plain, plain_len, borrow);
+	}
+	inserted = seconds_since(&start) / repeat;
+
+	if (error != HUBBUB_OK) {
+		fprintf(stderr, "Parsing failed: %s\n",
+				hubbub_error_to_string(error));
+		return 1;
+	}
+
+	printf("%zu bytes, %zu of them written %zu bytes at a time\n",
+			written_len, p.writes * SLEN(markup), SLEN(markup));
+	printf("one chunk: %.3fms\n", one * 1e3);
+	printf("written:   %.3fms (%.2fx)\n", inserted * 1e3,
+			inserted / one);
+
+	free(plain);
+	free(written);
+
+	return 0;
+}
@@ -8,18 +8,23 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <string.h>
-#include <strings.h>
 
 #include <parserutils/charset/mibenum.h>
 
+#include <hubbub/charset.h>
 #include <hubbub/types.h>
 
 #include "utils/utils.h"
+#include "utils/string.h"
 
 #include "detect.h"
 
 static uint16_t hubbub_charset_read_bom(const uint8_t *data, size_t len);
-static uint16_t hubbub_charset_scan_meta(const uint8_t *data, size_t len);
+static uint16_t hubbub_charset_from_meta(const uint8_t *data, size_t len,
+		size_t window);
+static uint16_t hubbub_charset_from_content(const uint8_t *data,
+		size_t len);
+static uint16_t hubbub_charset_default(void);
 static uint16_t hubbub_charset_parse_attributes(const uint8_t **pos,
 		const uint8_t *end);
 static bool hubbub_charset_get_attribute(const uint8_t **data,
@@ -92,51 +97,168 @@ parserutils_error hubbub_charset_extract(const uint8_t *data, size_t len,
 
 	/* No BOM was found, so we must look for a meta charset within
 	 * the document itself. */
-	charset = hubbub_charset_scan_meta(data, len);
+	charset = hubbub_charset_from_meta(data, len,
+			HUBBUB_CHARSET_PRESCAN_WINDOW);
 	if (charset != 0) {
-		/* Fix charsets according to HTML5,
-		 * section 8.2.2.2. Character encoding requirements */
-		hubbub_charset_fix_charset(&charset);
-
-		/* If we've encountered a meta charset for a non-ASCII-
-		 * compatible encoding, don't trust it.
-		 *
-		 * Firstly, it should have been sent with a BOM (and thus
-		 * detected above).
-		 *
-		 * Secondly, we've just used an ASCII-only parser to
-		 * extract the encoding from the document. Therefore,
-		 * the document plainly isn't what the meta charset
-		 * claims it is.
-		 *
-		 * What we do in this case is to ignore the meta charset's
-		 * claims and leave the charset determination to the
-		 * autodetection routines (or the fallback case if they
-		 * fail).
-		 */
-		if (charset != parserutils_charset_mibenum_from_name(
-					"UTF-32", SLEN("UTF-32")) &&
-			charset != parserutils_charset_mibenum_from_name(
-					"UTF-32LE", SLEN("UTF-32LE")) &&
-			charset != parserutils_charset_mibenum_from_name(
-					"UTF-32BE", SLEN("UTF-32BE"))) {
-
-			*mibenum = charset;
-			*source = HUBBUB_CHARSET_TENTATIVE;
-
-			return PARSERUTILS_OK;
-		}
+		*mibenum = charset;
+		*source = HUBBUB_CHARSET_TENTATIVE;
+
+		return PARSERUTILS_OK;
 	}
 
 	/* No charset was specified within the document, attempt to
 	 * autodetect the encoding from the data that we have available. */
+	charset = hubbub_charset_from_content(data, len);
+	if (charset != 0) {
+		*mibenum = charset;
+		*source = HUBBUB_CHARSET_TENTATIVE;
 
-	/** \todo Charset autodetection */
+		return PARSERUTILS_OK;
+	}
 
 	/* We failed to autodetect a charset, so use the default fallback */
 default_encoding:
 
 	/* 7. */
+	*mibenum = hubbub_charset_default();
+	*source = HUBBUB_CHARSET_TENTATIVE;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Determine the character encoding of a document, as a parser would
+ *
+ * \param data          The start of the document
+ * \param len           Length, in bytes, of data
+ * \param content_type  Value of the Content-Type header, or NULL if none
+ * \param window        Bytes to search for a meta charset, or 0 for the
+ *                      parser's default
+ * \param fix_enc       Fix up a Content-Type charset which is frequently
+ *                      misused
+ * \param charset       Pointer to location to receive charset name
+ * \param source        Pointer to location to receive charset source
+ * \return HUBBUB_OK on success, HUBBUB_BADPARM on bad parameters
+ */
+hubbub_error hubbub_charset_sniff(const uint8_t *data, size_t len,
+		const char *content_type, size_t window, bool fix_enc,
+		const char **charset, hubbub_charset_source *source)
+{
+	uint16_t mibenum;
+
+	if ((data == NULL && len > 0) || charset == NULL || source == NULL)
+		return HUBBUB_BADPARM;
+
+	if (window == 0)
+		window = HUBBUB_CHARSET_PRESCAN_WINDOW;
+
+	*source = HUBBUB_CHARSET_CONFIDENT;
+
+	mibenum = hubbub_charset_read_bom(data, len);
+
+	if (mibenum == 0 && content_type != NULL) {
+		mibenum = hubbub_charset_parse_content(
+				(const uint8_t *) content_type,
+				strlen(content_type));
+		if (mibenum != 0 && fix_enc)
+			hubbub_charset_fix_charset(&mibenum);
+	}
+
+	if (mibenum == 0) {
+		*source = HUBBUB_CHARSET_TENTATIVE;
+
+		mibenum = hubbub_charset_from_meta(data, len, window);
+		if (mibenum == 0)
+			mibenum = hubbub_charset_from_content(data, len);
+		if (mibenum == 0)
+			mibenum = hubbub_charset_default();
+	}
+
+	*charset = parserutils_charset_mibenum_to_name(mibenum);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Find the encoding given by a document's meta charset, if it is usable
+ *
+ * \param data    Pointer to buffer containing data
+ * \param len     Length of buffer
+ * \param window  Number of bytes at the start of the buffer to examine
+ * \return MIB enum representing encoding, or 0 if none usable was found
+ */
+uint16_t hubbub_charset_from_meta(const uint8_t *data, size_t len,
+		size_t window)
+{
+	uint16_t charset;
+
+	/* We need at least 3 bytes of data */
+	if (len < 3)
+		return 0;
+
+	charset = hubbub_charset_scan_meta(data, len, window);
+	if (charset == 0)
+		return 0;
+
+	/* Fix charsets according to HTML5,
+	 * section 8.2.2.2. Character encoding requirements */
+	hubbub_charset_fix_charset(&charset);
+
+	/* If we've encountered a meta charset for a non-ASCII-
+	 * compatible encoding, don't trust it.
+	 *
+	 * Firstly, it should have been sent with a BOM (and thus
+	 * detected above).
+	 *
+	 * Secondly, we've just used an ASCII-only parser to
+	 * extract the encoding from the document. Therefore,
+	 * the document plainly isn't what the meta charset
+	 * claims it is.
+	 *
+	 * What we do in this case is to ignore the meta charset's
+	 * claims and leave the charset determination to the
+	 * autodetection routines (or the fallback case if they
+	 * fail).
+	 */
+	if (charset == parserutils_charset_mibenum_from_name(
+				"UTF-32", SLEN("UTF-32")) ||
+			charset == parserutils_charset_mibenum_from_name(
+				"UTF-32LE", SLEN("UTF-32LE")) ||
+			charset == parserutils_charset_mibenum_from_name(
+				"UTF-32BE", SLEN("UTF-32BE")))
+		return 0;
+
+	return charset;
+}
+
+/**
+ * Guess the encoding of a document which declares none
+ *
+ * \param data  Pointer to buffer containing data
+ * \param len   Length of buffer
+ * \return MIB enum representing encoding, or 0 if no guess was made
+ */
+uint16_t hubbub_charset_from_content(const uint8_t *data, size_t len)
+{
+	uint16_t charset;
+
+	charset = hubbub_charset_guess(data, len, HUBBUB_CHARSET_GUESS_WINDOW);
+	if (charset == 0)
+		return 0;
+
+	hubbub_charset_fix_charset(&charset);
+
+	return charset;
+}
+
+/**
+ * Find the encoding used when nothing else is known about a document
+ *
+ * \return MIB enum of the default encoding
+ */
+uint16_t hubbub_charset_default(void)
+{
+	uint16_t charset;
 
 	charset = parserutils_charset_mibenum_from_name("Windows-1252",
 			SLEN("Windows-1252"));
@@ -144,10 +266,7 @@ default_encoding:
 		charset = parserutils_charset_mibenum_from_name("ISO-8859-1",
 				SLEN("ISO-8859-1"));
 
-	*mibenum = charset;
-	*source = HUBBUB_CHARSET_TENTATIVE;
-
-	return PARSERUTILS_OK;
+	return charset;
 }
 
 
@@ -182,32 +301,77 @@ uint16_t hubbub_charset_read_bom(const uint8_t *data, size_t len)
 	return 0;
 }
 
-#define PEEK(a)								\
-	(pos < end - SLEN(a) && 					\
-		strncasecmp((const char *) pos, a, SLEN(a)) == 0)
-
-#define ADVANCE(a)							\
-	while (pos < end - SLEN(a)) {					\
-		if (PEEK(a))						\
-			break;						\
-		pos++;							\
-	}								\
-									\
-	if (pos == end - SLEN(a))					\
-		return 0;
-
 #define ISSPACE(a)							\
 	(a == 0x09 || a == 0x0a || a == 0x0c ||				\
 			a == 0x0d || a == 0x20 || a == 0x2f)
 
+/**
+ * Find the first occurrence of a string in a buffer
+ *
+ * A match must be followed by at least one further byte.
+ *
+ * \param pos  Pointer to start of buffer
+ * \param end  Pointer to end of buffer
+ * \param s    String to find (containing no letters)
+ * \param n    Length of string
+ * \return Pointer to match, or NULL if none
+ */
+static inline const uint8_t *hubbub_charset_find(const uint8_t *pos,
+		const uint8_t *end, const char *s, size_t n)
+{
+	while ((size_t) (end - pos) > n) {
+		pos = memchr(pos, s[0], end - pos - n);
+		if (pos == NULL)
+			return NULL;
+
+		if (memcmp(pos, s, n) == 0)
+			return pos;
+
+		pos++;
+	}
+
+	return NULL;
+}
+
+/**
+ * Skip to the next occurrence of a string
+ *
+ * \param pos  Pointer to pointer to current location (updated on exit)
+ * \param end  Pointer to end of buffer
+ * \param s    String to find (containing no letters)
+ * \param n    Length of string
+ * \return False if the end of the buffer was reached, true otherwise
+ */
+static inline bool hubbub_charset_advance(const uint8_t **pos,
+		const uint8_t *end, const char *s, size_t n)
+{
+	const uint8_t *found = hubbub_charset_find(*pos, end, s, n);
+
+	if (found != NULL) {
+		*pos = found;
+		return true;
+	}
+
+	/* Too close to the end to search at all; carry on from here */
+	return (size_t) (end - *pos) < n;
+}
+
+#define ISALPHA(a)							\
+	(0x41 <= ((a) & ~0x20) && ((a) & ~0x20) <= 0x5A)
+
 /**
  * Search for a meta charset within a buffer of data
  *
- * \param data  Pointer to buffer containing data
- * \param len   Length of buffer
+ * Only markup can affect the result, so the scan jumps from one '<' to
+ * the next with memchr(), and inspects only the bytes which follow each.
+ *
+ * \param data    Pointer to buffer containing data
+ * \param len     Length of buffer
+ * \param window  Number of bytes at the start of the buffer to examine
  * \return MIB enum representing encoding, or 0 if none found
  */
-uint16_t hubbub_charset_scan_meta(const uint8_t *data, size_t len)
+uint16_t hubbub_charset_scan_meta(const uint8_t *data, size_t len,
+		size_t window)
 {
 	const uint8_t *pos = data;
 	const uint8_t *end;
@@ -216,20 +380,36 @@ uint16_t hubbub_charset_scan_meta(const uint8_t *data, size_t len)
 	if (data == NULL)
 		return 0;
 
-	end = pos + min(512, len);
+	end = pos + min(window, len);
 
 	/* 1. */
 	while (pos < end) {
+		size_t left;
+
+		/* e - skip anything which isn't markup */
+		pos = memchr(pos, '<', end - pos);
+		if (pos == NULL)
+			return 0;
+
+		left = end - pos;
+
 		/* a */
-		if (PEEK("<!--")) {
+		if (left > SLEN("<!--") && pos[1] == '!' &&
+				pos[2] == '-' && pos[3] == '-') {
 			pos += SLEN("<!--");
-			ADVANCE("-->");
+			if (hubbub_charset_advance(&pos, end, "-->",
+					SLEN("-->")) == false)
+				return 0;
 		/* b */
-		} else if (PEEK("<meta")) {
-			if (pos + SLEN("<meta") >= end - 1)
+		} else if (left > SLEN("<meta") &&
+				(pos[1] | 0x20) == 'm' &&
+				(pos[2] | 0x20) == 'e' &&
+				(pos[3] | 0x20) == 't' &&
+				(pos[4] | 0x20) == 'a') {
+			if (left <= SLEN("<meta") + 1)
 				return 0;
 
-			if (ISSPACE(*(pos + SLEN("<meta")))) {
+			if (ISSPACE(pos[SLEN("<meta")])) {
 				/* 1 */
 				pos += SLEN("<meta");
 
@@ -242,13 +422,8 @@ uint16_t hubbub_charset_scan_meta(const uint8_t *data, size_t len)
 					return 0;
 			}
 		/* c */
-		} else if ((PEEK("</") && (pos < end - 3 &&
-				(0x41 <= (*(pos + 2) & ~ 0x20) &&
-				(*(pos + 2) & ~ 0x20) <= 0x5A))) ||
-				(pos < end - 2 && *pos == '<' &&
-				(0x41 <= (*(pos + 1) & ~ 0x20) &&
-				(*(pos + 1) & ~ 0x20) <= 0x5A))) {
-
+		} else if ((left > 3 && pos[1] == '/' && ISALPHA(pos[2])) ||
+				(left > 2 && ISALPHA(pos[1]))) {
 			/* skip '<' */
 			pos++;
 
@@ -276,13 +451,14 @@ uint16_t hubbub_charset_scan_meta(const uint8_t *data, size_t len)
 			} else
 				continue;
 		/* d */
-		} else if (PEEK("<!") || PEEK("</") || PEEK("<?")) {
+		} else if (left > 2 && (pos[1] == '!' || pos[1] == '/' ||
+				pos[1] == '?')) {
 			pos++;
-			ADVANCE(">");
+			if (hubbub_charset_advance(&pos, end, ">",
+					SLEN(">")) == false)
+				return 0;
 		}
 
-		/* e - do nothing */
-
 		/* 2 */
 		pos++;
 	}
@@ -290,6 +466,8 @@ uint16_t hubbub_charset_scan_meta(const uint8_t *data, size_t len)
 	return 0;
 }
 
+#undef ISALPHA
+
 /**
  * Parse attributes on a meta tag
  *
@@ -314,9 +492,9 @@ uint16_t hubbub_charset_parse_attributes(const uint8_t **pos,
 		/* 3 done by default */
 
 		/* 4 */
-		if (namelen == SLEN("charset") && valuelen > 0 &&
-				strncasecmp((const char *) name, "charset",
-					SLEN("charset")) == 0) {
+		if (valuelen > 0 && hubbub_string_match_ci(name,
+				namelen, (const uint8_t *) "charset",
+				SLEN("charset"))) {
 			/* strip value */
 			while (ISSPACE(*value)) {
 				value++;
@@ -329,9 +507,9 @@ uint16_t hubbub_charset_parse_attributes(const uint8_t **pos,
 			mibenum = parserutils_charset_mibenum_from_name(
 					(const char *) value, valuelen);
 		/* 5 */
-		} else if (namelen == SLEN("content") && valuelen > 0 &&
-				strncasecmp((const char *) name, "content",
-					SLEN("content")) == 0) {
+		} else if (valuelen > 0 && hubbub_string_match_ci(name,
+				namelen, (const uint8_t *) "content",
+				SLEN("content"))) {
 			mibenum = hubbub_charset_parse_content(value,
 					valuelen);
 		}
@@ -416,8 +594,8 @@ uint16_t hubbub_charset_parse_content(const uint8_t *value,
 
 	/* 3 */
 	if (value < end - SLEN("charset") &&
-			strncasecmp((const char *) value,
-					"charset", SLEN("charset")) != 0)
+			!hubbub_string_match_ci(value, SLEN("charset"),
+				(const uint8_t *) "charset", SLEN("charset")))
 		return 0;
 
 	value += SLEN("charset");
@@ -558,7 +736,7 @@ bool hubbub_charset_get_attribute(const uint8_t **data, const uint8_t *end,
 			return true;
 		}
 
-		/* d is handled by strncasecmp in _parse_attributes */
+		/* d is handled by _parse_attributes */
 
 		/* e */
 		(*namelen)++;
@@ -619,7 +797,7 @@ bool hubbub_charset_get_attribute(const uint8_t **data, const uint8_t *end,
 				return true;
 			}
 
-			/* 4 is handled by strncasecmp */
+			/* 4 is handled by hubbub_string_match_ci */
 
 			/* 5 */
 			(*valuelen)++;
@@ -639,7 +817,7 @@ bool hubbub_charset_get_attribute(const uint8_t **data, const uint8_t *end,
 		return true;
 	}
 
-	/* c is handled by strncasecmp */
+	/* c is handled by hubbub_string_match_ci */
 
 	/* d */
 	*value = pos;
@@ -652,7 +830,7 @@ bool hubbub_charset_get_attribute(const uint8_t **data, const uint8_t *end,
 			return true;
 		}
 
-		/* b is handled by strncasecmp */
+		/* b is handled by hubbub_string_match_ci */
 
 		/* c */
 		(*valuelen)++;
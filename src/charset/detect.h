@@ -12,10 +12,33 @@
 
 #include <parserutils/errors.h>
 
+/**
+ * Number of bytes at the start of a document searched for a meta charset.
+ * The spec permits up to 1024.
+ */
+#ifndef HUBBUB_CHARSET_PRESCAN_WINDOW
+#define HUBBUB_CHARSET_PRESCAN_WINDOW 512
+#endif
+
+/**
+ * Number of bytes at the start of a document from which its encoding is
+ * guessed, when it declares none.
+ */
+#ifndef HUBBUB_CHARSET_GUESS_WINDOW
+#define HUBBUB_CHARSET_GUESS_WINDOW 4096
+#endif
+
 /* Extract a charset from a chunk of data */
 parserutils_error hubbub_charset_extract(const uint8_t *data, size_t len,
 		uint16_t *mibenum, uint32_t *source);
 
+/* Search for a meta charset within a chunk of data */
+uint16_t hubbub_charset_scan_meta(const uint8_t *data, size_t len,
+		size_t window);
+
+/* Guess the charset of a chunk of data from its content */
+uint16_t hubbub_charset_guess(const uint8_t *data, size_t len, size_t window);
+
 /* Parse a Content-Type string for an encoding */
 uint16_t hubbub_charset_parse_content(const uint8_t *value,
                 uint32_t valuelen);
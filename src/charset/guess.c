@@ -0,0 +1,345 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 The NetSurf Project.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <parserutils/charset/mibenum.h>
+
+#include "utils/utf8.h"
+#include "utils/utils.h"
+
+#include "detect.h"
+
+/**
+ * Frequent characters of each language, as sorted code units
+ *
+ * Each table holds, in a candidate encoding, the characters which make up
+ * a large share of running text in the language that encoding is used
+ * for: kana and common kanji for Japanese, the most common hanzi for
+ * Chinese and the most common syllables for Korean. Text in any other
+ * encoding decodes to characters which rarely appear here.
+ */
+static const uint16_t guess_shift_jis[] = {
+	0x8141, 0x8142, 0x815b, 0x8175, 0x8176, 0x82a0, 0x82a2, 0x82a4,
+	0x82a6, 0x82a8, 0x82a9, 0x82aa, 0x82ab, 0x82ad, 0x82af, 0x82b1,
+	0x82b3, 0x82b5, 0x82b7, 0x82b9, 0x82bb, 0x82bd, 0x82be, 0x82bf,
+	0x82c1, 0x82c2, 0x82c4, 0x82c5, 0x82c6, 0x82c7, 0x82c8, 0x82c9,
+	0x82cc, 0x82cd, 0x82ce, 0x82d0, 0x82d3, 0x82d9, 0x82dc, 0x82dd,
+	0x82de, 0x82df, 0x82e0, 0x82e2, 0x82e4, 0x82e6, 0x82e7, 0x82e8,
+	0x82e9, 0x82ea, 0x82eb, 0x82ed, 0x82f0, 0x82f1, 0x8341, 0x8343,
+	0x834a, 0x834e, 0x8352, 0x8356, 0x8357, 0x8358, 0x835e, 0x8362,
+	0x8365, 0x8367, 0x8368, 0x8374, 0x8376, 0x837d, 0x8381, 0x8389,
+	0x838a, 0x838b, 0x838c, 0x838d, 0x8393, 0x88ea, 0x89ba, 0x89ef,
+	0x8a77, 0x8ad4, 0x8b43, 0x8bc6, 0x8c8e, 0x8ca9, 0x8ce3, 0x8d73,
+	0x8d82, 0x8d87, 0x8d91, 0x8da1, 0x8e71, 0x8e96, 0x8e9e, 0x8ea9,
+	0x8ec0, 0x8ed0, 0x8ed2, 0x8ee8, 0x8f6f, 0x8fe3, 0x8fea, 0x9056,
+	0x906c, 0x90b6, 0x914f, 0x91e5, 0x926e, 0x9286, 0x92b7, 0x9396,
+	0x93af, 0x93fa, 0x944e, 0x94ad, 0x9594, 0x95aa, 0x95fb, 0x967b
+};
+
+static const uint16_t guess_euc_jp[] = {
+	0xa1a2, 0xa1a3, 0xa1bc, 0xa1d6, 0xa1d7, 0xa4a2, 0xa4a4, 0xa4a6,
+	0xa4a8, 0xa4aa, 0xa4ab, 0xa4ac, 0xa4ad, 0xa4af, 0xa4b1, 0xa4b3,
+	0xa4b5, 0xa4b7, 0xa4b9, 0xa4bb, 0xa4bd, 0xa4bf, 0xa4c0, 0xa4c1,
+	0xa4c3, 0xa4c4, 0xa4c6, 0xa4c7, 0xa4c8, 0xa4c9, 0xa4ca, 0xa4cb,
+	0xa4ce, 0xa4cf, 0xa4d0, 0xa4d2, 0xa4d5, 0xa4db, 0xa4de, 0xa4df,
+	0xa4e0, 0xa4e1, 0xa4e2, 0xa4e4, 0xa4e6, 0xa4e8, 0xa4e9, 0xa4ea,
+	0xa4eb, 0xa4ec, 0xa4ed, 0xa4ef, 0xa4f2, 0xa4f3, 0xa5a2, 0xa5a4,
+	0xa5ab, 0xa5af, 0xa5b3, 0xa5b7, 0xa5b8, 0xa5b9, 0xa5bf, 0xa5c3,
+	0xa5c6, 0xa5c8, 0xa5c9, 0xa5d5, 0xa5d7, 0xa5de, 0xa5e1, 0xa5e9,
+	0xa5ea, 0xa5eb, 0xa5ec, 0xa5ed, 0xa5f3, 0xb0ec, 0xb2bc, 0xb2f1,
+	0xb3d8, 0xb4d6, 0xb5a4, 0xb6c8, 0xb7ee, 0xb8ab, 0xb8e5, 0xb9d4,
+	0xb9e2, 0xb9e7, 0xb9f1, 0xbaa3, 0xbbd2, 0xbbf6, 0xbbfe, 0xbcab,
+	0xbcc2, 0xbcd2, 0xbcd4, 0xbcea, 0xbdd0, 0xbee5, 0xbeec, 0xbfb7,
+	0xbfcd, 0xc0b8, 0xc1b0, 0xc2e7, 0xc3cf, 0xc3e6, 0xc4b9, 0xc5f6,
+	0xc6b1, 0xc6fc, 0xc7af, 0xc8af, 0xc9f4, 0xcaac, 0xcafd, 0xcbdc
+};
+
+static const uint16_t guess_gbk[] = {
+	0xa1a2, 0xa1a3, 0xa1b0, 0xa1b1, 0xa3ac, 0xb0ae, 0xb0d1, 0xb1bb,
+	0xb2bb, 0xb3a3, 0xb3a4, 0xb3c9, 0xb3f6, 0xb4cb, 0xb4ce, 0xb4d3,
+	0xb4f3, 0xb5ab, 0xb5b1, 0xb5bd, 0xb5c0, 0xb5c3, 0xb5c4, 0xb5d8,
+	0xb5da, 0xb6af, 0xb6bc, 0xb6d4, 0xb6e0, 0xb6f8, 0xb6f9, 0xb7a2,
+	0xb7a8, 0xb7bd, 0xb7d6, 0xb8d0, 0xb8df, 0xb8f6, 0xb8f8, 0xb9fa,
+	0xb9fd, 0xbac3, 0xbacd, 0xbadc, 0xbaf3, 0xbbb0, 0xbbb9, 0xbbd8,
+	0xbbe1, 0xbbee, 0xbcba, 0xbcd2, 0xbce4, 0xbdf8, 0xbead, 0xbecd,
+	0xbfaa, 0xbfb4, 0xbfc9, 0xc0b4, 0xc0cf, 0xc0ef, 0xc1bd, 0xc1cb,
+	0xc3b4, 0xc3bb, 0xc3c0, 0xc3c7, 0xc3e6, 0xc3fb, 0xc4dc, 0xc5ae,
+	0xc6da, 0xc6e4, 0xc6f0, 0xc7b0, 0xc7d7, 0xc7e9, 0xc8a5, 0xc8bb,
+	0xc8cb, 0xc8d5, 0xc8e7, 0xc9cf, 0xc9ed, 0xcab1, 0xcab2, 0xcab9,
+	0xcac0, 0xcac2, 0xcac7, 0xcad6, 0xcbb5, 0xcbf9, 0xcbfb, 0xcbfc,
+	0xccec, 0xcdac, 0xcdb7, 0xceaa, 0xcebb, 0xced2, 0xcede, 0xcfc2,
+	0xcfd6, 0xcfeb, 0xd0a1, 0xd0a9, 0xd0c4, 0xd0d0, 0xd1a7, 0xd1f9,
+	0xd2aa, 0xd2b2, 0xd2bb, 0xd2d1, 0xd2d4, 0xd2e2, 0xd2f2, 0xd3c3,
+	0xd3d0, 0xd3d6, 0xd3da, 0xd3eb, 0xd4da, 0xd5df, 0xd5e2, 0xd5fd,
+	0xd6aa, 0xd6ae, 0xd6bb, 0xd6d0, 0xd6d6, 0xd7d4, 0xd7dc, 0xd7ee,
+	0xd7f7
+};
+
+static const uint16_t guess_big5[] = {
+	0xa141, 0xa142, 0xa143, 0xa440, 0xa446, 0xa448, 0xa453, 0xa455,
+	0xa457, 0xa45d, 0xa46a, 0xa46b, 0xa470, 0xa476, 0xa477, 0xa4a3,
+	0xa4a4, 0xa4a7, 0xa4b0, 0xa4c0, 0xa4d1, 0xa4df, 0xa4e2, 0xa4e8,
+	0xa4e9, 0xa540, 0xa548, 0xa54c, 0xa558, 0xa568, 0xa569, 0xa575,
+	0xa5a6, 0xa5bf, 0xa5ce, 0xa650, 0xa657, 0xa65d, 0xa65e, 0xa661,
+	0xa662, 0xa668, 0xa66e, 0xa670, 0xa6a8, 0xa6b3, 0xa6b8, 0xa6b9,
+	0xa6d1, 0xa6d3, 0xa6db, 0xa6e6, 0xa6ec, 0xa6fd, 0xa740, 0xa7da,
+	0xa7e2, 0xa853, 0xa8ad, 0xa8c6, 0xa8c7, 0xa8cf, 0xa8d3, 0xa8e0,
+	0xa8e2, 0xa8e4, 0xa8ec, 0xa94d, 0xa9d2, 0xa9f3, 0xaa6b, 0xaaba,
+	0xaabe, 0xaacc, 0xaaf8, 0xab65, 0xabdc, 0xabe1, 0xac4f, 0xaca1,
+	0xacb0, 0xacdd, 0xacfc, 0xad6e, 0xadb1, 0xadcc, 0xadd3, 0xae61,
+	0xaec9, 0xafe0, 0xb05f, 0xb0aa, 0xb0ca, 0xb0ea, 0xb160, 0xb16f,
+	0xb171, 0xb1a1, 0xb27b, 0xb2c4, 0xb351, 0xb36f, 0xb3a3, 0xb3cc,
+	0xb44e, 0xb4c1, 0xb54c, 0xb54d, 0xb56f, 0xb5b9, 0xb669, 0xb67d,
+	0xb6a1, 0xb74e, 0xb750, 0xb751, 0xb752, 0xb77c, 0xb7ed, 0xb867,
+	0xb8cc, 0xb8dc, 0xb944, 0xb94c, 0xb9ef, 0xbad8, 0xbb50, 0xbba1,
+	0xbbf2, 0xbccb, 0xbec7, 0xbfcb, 0xc059, 0xc160, 0xc1d9
+};
+
+static const uint16_t guess_uhc[] = {
+	0xb0a1, 0xb0a2, 0xb0cd, 0xb0d4, 0xb0e6, 0xb0ed, 0xb0fa, 0xb1b8,
+	0xb1b9, 0xb1d7, 0xb1e2, 0xb1ee, 0xb3aa, 0xb3bb, 0xb4c2, 0xb4cf,
+	0xb4d9, 0xb4eb, 0xb5b5, 0xb5bf, 0xb5c8, 0xb5e9, 0xb6f3, 0xb7ce,
+	0xb8a6, 0xb8ae, 0xb8b8, 0xb8e9, 0xb9ae, 0xbab8, 0xbace, 0xbbe7,
+	0xbbf3, 0xbcad, 0xbcf6, 0xbdc0, 0xbdc3, 0xbec6, 0xbeee, 0xbef8,
+	0xbfa1, 0xbfa9, 0xbfe4, 0xbfec, 0xbff8, 0xc0b8, 0xc0bb, 0xc0c7,
+	0xc0cc, 0xc0ce, 0xc0cf, 0xc0d6, 0xc0da, 0xc0e5, 0xc0fb, 0xc0fc,
+	0xc1a4, 0xc1a6, 0xc1d6, 0xc1f6, 0xc7cf, 0xc7d1, 0xc7d2, 0xc7d8,
+	0xc7df, 0xc8ad
+};
+
+/** Multibyte encodings considered by the guesser */
+typedef enum guess_encoding {
+	GUESS_SHIFT_JIS,
+	GUESS_EUC_JP,
+	GUESS_GBK,
+	GUESS_BIG5,
+	GUESS_UHC
+} guess_encoding;
+
+/** Statistical model of a multibyte encoding */
+typedef struct guess_model {
+	guess_encoding encoding;	/**< Encoding type */
+	const char *name;		/**< Canonical name of encoding */
+	const uint16_t *frequent;	/**< Frequent characters */
+	size_t n_frequent;		/**< Number of frequent characters */
+} guess_model;
+
+/** Models, in order of preference when equally likely */
+static const guess_model guess_models[] = {
+	{ GUESS_SHIFT_JIS, "Shift_JIS",
+			guess_shift_jis, N_ELEMENTS(guess_shift_jis) },
+	{ GUESS_EUC_JP, "EUC-JP", guess_euc_jp, N_ELEMENTS(guess_euc_jp) },
+	{ GUESS_GBK, "GBK", guess_gbk, N_ELEMENTS(guess_gbk) },
+	{ GUESS_BIG5, "Big5", guess_big5, N_ELEMENTS(guess_big5) },
+	{ GUESS_UHC, "EUC-KR", guess_uhc, N_ELEMENTS(guess_uhc) }
+};
+
+/** Fewest non-ASCII characters on which a guess will be made */
+#define GUESS_MIN_CHARS 4
+
+/** Lowest share, in percent, of frequent characters for a guess */
+#define GUESS_MIN_SCORE 30
+
+/**
+ * Decode the length of a non-ASCII character in a multibyte encoding
+ *
+ * \param encoding  Encoding to decode
+ * \param data      Pointer to the character's first byte
+ * \param len       Bytes available at \p data
+ * \param code      Pointer to location to receive the character's code
+ *                  unit pair, or 0 if it has none
+ * \return Length of the character, 0 if the data is invalid in the
+ *         encoding, or \p len + 1 if the character is truncated
+ */
+static size_t guess_decode(guess_encoding encoding, const uint8_t *data,
+		size_t len, uint16_t *code)
+{
+	uint8_t lead = data[0], trail;
+	bool valid = false;
+
+	*code = 0;
+
+	switch (encoding) {
+	case GUESS_SHIFT_JIS:
+		/* Half-width katakana */
+		if (0xA1 <= lead && lead <= 0xDF)
+			return 1;
+		if ((lead < 0x81 || 0x9F < lead) &&
+				(lead < 0xE0 || 0xFC < lead))
+			return 0;
+		break;
+	case GUESS_EUC_JP:
+		/* Half-width katakana, and JIS X 0212 */
+		if (lead == 0x8E || lead == 0x8F) {
+			if (len < 2)
+				return len + 1;
+			if (data[1] < 0xA1 || 0xFE < data[1])
+				return 0;
+			if (lead == 0x8E)
+				return 2;
+			if (len < 3)
+				return len + 1;
+			return (0xA1 <= data[2] && data[2] <= 0xFE) ? 3 : 0;
+		}
+		if (lead < 0xA1 || 0xFE < lead)
+			return 0;
+		break;
+	case GUESS_GBK:
+	case GUESS_BIG5:
+	case GUESS_UHC:
+		if (lead < 0x81 || 0xFE < lead)
+			return 0;
+		break;
+	}
+
+	if (len < 2)
+		return len + 1;
+
+	trail = data[1];
+
+	switch (encoding) {
+	case GUESS_SHIFT_JIS:
+		valid = (0x40 <= trail && trail <= 0xFC && trail != 0x7F);
+		break;
+	case GUESS_EUC_JP:
+		valid = (0xA1 <= trail && trail <= 0xFE);
+		break;
+	case GUESS_GBK:
+		valid = (0x40 <= trail && trail <= 0xFE && trail != 0x7F);
+		break;
+	case GUESS_BIG5:
+		valid = (0x40 <= trail && trail <= 0x7E) ||
+				(0xA1 <= trail && trail <= 0xFE);
+		break;
+	case GUESS_UHC:
+		valid = (0x41 <= trail && trail <= 0x5A) ||
+				(0x61 <= trail && trail <= 0x7A) ||
+				(0x81 <= trail && trail <= 0xFE);
+		break;
+	}
+
+	if (valid == false)
+		return 0;
+
+	*code = (lead << 8) | trail;
+
+	return 2;
+}
+
+/**
+ * Comparator for bsearch over a frequent character table
+ */
+static int guess_compare(const void *a, const void *b)
+{
+	return (int) *((const uint16_t *) a) - (int) *((const uint16_t *) b);
+}
+
+/**
+ * Score data against a model of a multibyte encoding
+ *
+ * \param model  The model to score against
+ * \param data   Data to score
+ * \param len    Length, in bytes, of data
+ * \return Share, in percent, of the data's non-ASCII characters which are
+ *         frequent in the model, or -1 if the data is invalid in the
+ *         model's encoding or has too few non-ASCII characters
+ */
+static int guess_score(const guess_model *model, const uint8_t *data,
+		size_t len)
+{
+	size_t off = 0, n_chars = 0, n_frequent = 0;
+
+	while (off < len) {
+		uint16_t code;
+		size_t clen;
+
+		if (data[off] < 0x80) {
+			off++;
+			continue;
+		}
+
+		clen = guess_decode(model->encoding, data + off, len - off,
+				&code);
+		if (clen == 0)
+			return -1;
+
+		/* The data may end part way through a character */
+		if (clen > len - off)
+			break;
+
+		n_chars++;
+		if (code != 0 && bsearch(&code, model->frequent,
+				model->n_frequent, sizeof(uint16_t),
+				guess_compare) != NULL)
+			n_frequent++;
+
+		off += clen;
+	}
+
+	if (n_chars < GUESS_MIN_CHARS)
+		return -1;
+
+	return (int) (n_frequent * 100 / n_chars);
+}
+
+/**
+ * Guess the encoding of data from its content alone
+ *
+ * Data which is valid UTF-8 and not plain ASCII is taken to be UTF-8, as
+ * text in legacy encodings almost never is. Otherwise, the data is
+ * scored against each multibyte encoding, by the share of its characters
+ * which are frequent in the language the encoding serves; the best score
+ * wins, if it is convincing. Anything else is left to the default.
+ *
+ * \param data    Pointer to buffer containing data
+ * \param len     Length of buffer
+ * \param window  Number of bytes at the start of the buffer to examine
+ * \return MIB enum representing encoding, or 0 if no guess was made
+ */
+uint16_t hubbub_charset_guess(const uint8_t *data, size_t len, size_t window)
+{
+	const guess_model *best = NULL;
+	int best_score = GUESS_MIN_SCORE - 1;
+	bool truncated;
+	size_t ascii, i;
+
+	len = min(len, window);
+
+	for (ascii = 0; ascii < len; ascii++) {
+		if (data[ascii] >= 0x80)
+			break;
+	}
+
+	/* Plain ASCII gives nothing to go on */
+	if (ascii == len)
+		return 0;
+
+	if (hubbub_utf8_valid_length(data + ascii, len - ascii,
+			&truncated) == len - ascii || truncated) {
+		return parserutils_charset_mibenum_from_name("UTF-8",
+				SLEN("UTF-8"));
+	}
+
+	for (i = 0; i < N_ELEMENTS(guess_models); i++) {
+		int score = guess_score(&guess_models[i], data + ascii,
+				len - ascii);
+
+		if (score > best_score) {
+			best = &guess_models[i];
+			best_score = score;
+		}
+	}
+
+	if (best == NULL)
+		return 0;
+
+	return parserutils_charset_mibenum_from_name(best->name,
+			strlen(best->name));
+}
@@ -0,0 +1,1088 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 The NetSurf Project.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include <hubbub/dom.h>
+
+#include "utils/utils.h"
+
+/* Initial capacities of the node, attribute and string arrays */
+#define DOM_NODES 64
+#define DOM_ATTRIBUTES 64
+#define DOM_POOL 4096
+
+/* Nodes are handed to the treebuilder as their index plus one, so that
+ * no node is ever NULL */
+#define DOM_HANDLE(i) ((void *) (uintptr_t) ((i) + 1))
+#define DOM_INDEX(h) ((hubbub_dom_index) ((uintptr_t) (h) - 1))
+
+/**
+ * Arena DOM object
+ *
+ * Every node, attribute and string of the document lives in one of three
+ * growable arrays, and nodes refer to each other by index. Nothing is
+ * released until the DOM is reset or destroyed, so reference counting is
+ * unnecessary and the ref/unref callbacks do nothing.
+ */
+struct hubbub_dom {
+	hubbub_dom_node *nodes;		/**< Node array */
+	uint32_t n_nodes;		/**< Number of nodes in use */
+	uint32_t nodes_alloc;		/**< Capacity of node array */
+
+	hubbub_dom_attribute *attrs;	/**< Attribute array */
+	uint32_t n_attrs;		/**< Number of attributes in use */
+	uint32_t attrs_alloc;		/**< Capacity of attribute array */
+
+	uint8_t *pool;			/**< String pool */
+	uint32_t pool_len;		/**< Bytes of pool in use */
+	uint32_t pool_alloc;		/**< Capacity of string pool */
+
+	hubbub_quirks_mode quirks;	/**< Quirks mode of document */
+
+	hubbub_tree_handler tree_handler;	/**< Handler for parser */
+
+	hubbub_allocator_fn alloc;	/**< Memory (de)allocation function */
+	void *pw;			/**< Client data for \a alloc */
+};
+
+static hubbub_error dom_create_comment(void *ctx, const hubbub_string *data,
+		void **result);
+static hubbub_error dom_create_doctype(void *ctx,
+		const hubbub_doctype *doctype, void **result);
+static hubbub_error dom_create_element(void *ctx, const hubbub_tag *tag,
+		void **result);
+static hubbub_error dom_create_text(void *ctx, const hubbub_string *data,
+		void **result);
+static hubbub_error dom_append_child(void *ctx, void *parent, void *child,
+		void **result);
+static hubbub_error dom_insert_before(void *ctx, void *parent, void *child,
+		void *ref_child, void **result);
+static hubbub_error dom_remove_child(void *ctx, void *parent, void *child,
+		void **result);
+static hubbub_error dom_clone_node(void *ctx, void *node, bool deep,
+		void **result);
+static hubbub_error dom_reparent_children(void *ctx, void *node,
+		void *new_parent);
+static hubbub_error dom_get_parent(void *ctx, void *node, bool element_only,
+		void **result);
+static hubbub_error dom_has_children(void *ctx, void *node, bool *result);
+static hubbub_error dom_form_associate(void *ctx, void *form, void *node);
+static hubbub_error dom_add_attributes(void *ctx, void *node,
+		const hubbub_attribute *attributes, uint32_t n_attributes);
+static hubbub_error dom_set_quirks_mode(void *ctx, hubbub_quirks_mode mode);
+static hubbub_error dom_encoding_change(void *ctx, const char *encname);
+static hubbub_error dom_complete_script(void *ctx, void *script);
+static hubbub_error dom_append_text_to(void *ctx, void *parent,
+		const hubbub_string *data, bool *result);
+static hubbub_error dom_grow(hubbub_dom *dom, void **array, uint32_t *size,
+		uint32_t need, size_t item);
+
+/**
+ * Create an arena DOM
+ *
+ * \param alloc  Memory (de)allocation function, or NULL for the default
+ * \param pw     Pointer to client-specific private data (may be NULL)
+ * \param dom    Pointer to location to receive DOM instance
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_NOMEM on memory exhaustion
+ */
+hubbub_error hubbub_dom_create(hubbub_allocator_fn alloc, void *pw,
+		hubbub_dom **dom)
+{
+	hubbub_dom *d;
+
+	if (dom == NULL)
+		return HUBBUB_BADPARM;
+
+	if (alloc == NULL)
+		alloc = hubbub_default_alloc;
+
+	d = alloc(NULL, sizeof(hubbub_dom), pw);
+	if (d == NULL)
+		return HUBBUB_NOMEM;
+
+	memset(d, 0, sizeof(hubbub_dom));
+
+	d->alloc = alloc;
+	d->pw = pw;
+
+	d->nodes = alloc(NULL, DOM_NODES * sizeof(hubbub_dom_node), pw);
+	d->attrs = alloc(NULL, DOM_ATTRIBUTES * sizeof(hubbub_dom_attribute),
+			pw);
+	d->pool = alloc(NULL, DOM_POOL, pw);
+	if (d->nodes == NULL || d->attrs == NULL || d->pool == NULL) {
+		hubbub_dom_destroy(d);
+		return HUBBUB_NOMEM;
+	}
+
+	d->nodes_alloc = DOM_NODES;
+	d->attrs_alloc = DOM_ATTRIBUTES;
+	d->pool_alloc = DOM_POOL;
+
+	d->tree_handler.create_comment = dom_create_comment;
+	d->tree_handler.create_doctype = dom_create_doctype;
+	d->tree_handler.create_element = dom_create_element;
+	d->tree_handler.create_text = dom_create_text;
+	d->tree_handler.ref_node = NULL;
+	d->tree_handler.unref_node = NULL;
+	d->tree_handler.append_child = dom_append_child;
+	d->tree_handler.insert_before = dom_insert_before;
+	d->tree_handler.remove_child = dom_remove_child;
+	d->tree_handler.clone_node = dom_clone_node;
+	d->tree_handler.reparent_children = dom_reparent_children;
+	d->tree_handler.get_parent = dom_get_parent;
+	d->tree_handler.has_children = dom_has_children;
+	d->tree_handler.form_associate = dom_form_associate;
+	d->tree_handler.add_attributes = dom_add_attributes;
+	d->tree_handler.set_quirks_mode = dom_set_quirks_mode;
+	d->tree_handler.encoding_change = dom_encoding_change;
+	d->tree_handler.complete_script = dom_complete_script;
+	d->tree_handler.ctx = d;
+	d->tree_handler.flags = HUBBUB_TREE_NO_REFCOUNT;
+	d->tree_handler.append_text_to = dom_append_text_to;
+
+	hubbub_dom_reset(d);
+
+	*dom = d;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Destroy an arena DOM
+ *
+ * \param dom  The DOM instance to destroy
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_dom_destroy(hubbub_dom *dom)
+{
+	if (dom == NULL)
+		return HUBBUB_BADPARM;
+
+	if (dom->pool != NULL)
+		dom->alloc(dom->pool, 0, dom->pw);
+	if (dom->attrs != NULL)
+		dom->alloc(dom->attrs, 0, dom->pw);
+	if (dom->nodes != NULL)
+		dom->alloc(dom->nodes, 0, dom->pw);
+
+	dom->alloc(dom, 0, dom->pw);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Empty an arena DOM so that it may hold another document
+ *
+ * \param dom  The DOM instance to reset
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * The memory held by the DOM is kept, so that a client parsing many
+ * documents in turn need not allocate afresh for each. Any parser attached
+ * to the DOM must have been destroyed first.
+ */
+hubbub_error hubbub_dom_reset(hubbub_dom *dom)
+{
+	hubbub_dom_node *doc;
+
+	if (dom == NULL)
+		return HUBBUB_BADPARM;
+
+	dom->n_nodes = 1;
+	dom->n_attrs = 0;
+	dom->pool_len = 0;
+	dom->quirks = HUBBUB_QUIRKS_MODE_NONE;
+
+	doc = &dom->nodes[HUBBUB_DOM_DOCUMENT];
+	memset(doc, 0, sizeof(hubbub_dom_node));
+	doc->type = HUBBUB_DOM_NODE_DOCUMENT;
+	doc->parent = doc->first_child = doc->last_child =
+			doc->prev = doc->next = HUBBUB_DOM_NONE;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Make an arena DOM hold a copy of the document held by another
+ *
+ * \param dom   The DOM instance to copy into
+ * \param from  The DOM instance to copy
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * Each node of the copy has the index of the node it copies, so that a
+ * parser whose state was recorded while building \p from may be restored
+ * to build the rest of the document in \p dom; see hubbub_parser_restore.
+ * Any parser attached to \p dom must have been destroyed or reset first.
+ */
+hubbub_error hubbub_dom_copy(hubbub_dom *dom, const hubbub_dom *from)
+{
+	hubbub_error error;
+
+	if (dom == NULL || from == NULL)
+		return HUBBUB_BADPARM;
+
+	error = dom_grow(dom, (void **) (void *) &dom->nodes,
+			&dom->nodes_alloc, from->n_nodes,
+			sizeof(hubbub_dom_node));
+	if (error == HUBBUB_OK) {
+		error = dom_grow(dom, (void **) (void *) &dom->attrs,
+				&dom->attrs_alloc, from->n_attrs,
+				sizeof(hubbub_dom_attribute));
+	}
+	if (error == HUBBUB_OK) {
+		error = dom_grow(dom, (void **) (void *) &dom->pool,
+				&dom->pool_alloc, from->pool_len, 1);
+	}
+	if (error != HUBBUB_OK)
+		return error;
+
+	memcpy(dom->nodes, from->nodes,
+			from->n_nodes * sizeof(hubbub_dom_node));
+	if (from->n_attrs != 0) {
+		memcpy(dom->attrs, from->attrs,
+				from->n_attrs * sizeof(hubbub_dom_attribute));
+	}
+	if (from->pool_len != 0)
+		memcpy(dom->pool, from->pool, from->pool_len);
+
+	dom->n_nodes = from->n_nodes;
+	dom->n_attrs = from->n_attrs;
+	dom->pool_len = from->pool_len;
+	dom->quirks = from->quirks;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Have a parser build its tree in an arena DOM
+ *
+ * \param dom     The DOM instance to build into
+ * \param parser  The parser to configure
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * This sets the parser's tree handler and document node. The parser must
+ * be destroyed or reset before the DOM is reset or destroyed, and attached
+ * again after a reset, which releases the document node.
+ */
+hubbub_error hubbub_dom_attach(hubbub_dom *dom, hubbub_parser *parser)
+{
+	hubbub_parser_optparams params;
+	hubbub_error error;
+
+	if (dom == NULL || parser == NULL)
+		return HUBBUB_BADPARM;
+
+	params.tree_handler = &dom->tree_handler;
+	error = hubbub_parser_setopt(parser, HUBBUB_PARSER_TREE_HANDLER,
+			&params);
+	if (error != HUBBUB_OK)
+		return error;
+
+	params.document_node = DOM_HANDLE(HUBBUB_DOM_DOCUMENT);
+	return hubbub_parser_setopt(parser, HUBBUB_PARSER_DOCUMENT_NODE,
+			&params);
+}
+
+/**
+ * Retrieve the tree handler which builds an arena DOM
+ *
+ * This lets a client make the calls a parser would, for instance to
+ * replay those recorded from an earlier parse, without a parser.
+ *
+ * \param dom       The DOM instance
+ * \param document  Pointer to location to receive the document node
+ * \return The DOM's tree handler, valid until the DOM is destroyed
+ */
+hubbub_tree_handler *hubbub_dom_get_tree_handler(hubbub_dom *dom,
+		void **document)
+{
+	*document = DOM_HANDLE(HUBBUB_DOM_DOCUMENT);
+
+	return &dom->tree_handler;
+}
+
+/**
+ * Retrieve the number of nodes held by an arena DOM
+ *
+ * \param dom  The DOM instance to inspect
+ * \return The number of nodes, including the document and any nodes which
+ *         were removed from the tree
+ */
+uint32_t hubbub_dom_count(const hubbub_dom *dom)
+{
+	return dom->n_nodes;
+}
+
+/**
+ * Retrieve a node of an arena DOM
+ *
+ * \param dom    The DOM instance to inspect
+ * \param index  Index of the node
+ * \return Pointer to the node, or NULL if there is none at \p index
+ *
+ * The node is valid until the DOM is next modified.
+ */
+const hubbub_dom_node *hubbub_dom_get_node(const hubbub_dom *dom,
+		hubbub_dom_index index)
+{
+	if (index >= dom->n_nodes)
+		return NULL;
+
+	return &dom->nodes[index];
+}
+
+/**
+ * Retrieve the attributes of an element in an arena DOM
+ *
+ * \param dom   The DOM instance to inspect
+ * \param node  The element to inspect
+ * \return Pointer to an array of node->u.element.n_attributes attributes,
+ *         or NULL if \p node is not an element, or has no attributes
+ *
+ * The array is valid until the DOM is next modified.
+ */
+const hubbub_dom_attribute *hubbub_dom_get_attributes(const hubbub_dom *dom,
+		const hubbub_dom_node *node)
+{
+	if (node->type != HUBBUB_DOM_NODE_ELEMENT ||
+			node->u.element.n_attributes == 0)
+		return NULL;
+
+	return &dom->attrs[node->u.element.attributes];
+}
+
+/**
+ * Retrieve the data of a string held by an arena DOM
+ *
+ * \param dom  The DOM instance to inspect
+ * \param str  The string to retrieve
+ * \return Pointer to str.len bytes of data (not NUL-terminated)
+ *
+ * The data is valid until the DOM is next modified.
+ */
+const uint8_t *hubbub_dom_get_string(const hubbub_dom *dom,
+		hubbub_dom_string str)
+{
+	return dom->pool + str.off;
+}
+
+/**
+ * Retrieve the quirks mode of the document held by an arena DOM
+ *
+ * \param dom  The DOM instance to inspect
+ * \return The quirks mode
+ */
+hubbub_quirks_mode hubbub_dom_quirks_mode(const hubbub_dom *dom)
+{
+	return dom->quirks;
+}
+
+/******************************************************************************
+ * Storage                                                                    *
+ ******************************************************************************/
+
+/**
+ * Ensure that an array has room for a number of items
+ *
+ * \param dom    The DOM instance
+ * \param array  Pointer to the array, updated if it moves
+ * \param size   Pointer to the capacity of the array, in items
+ * \param need   Number of items required
+ * \param item   Size of an item, in bytes
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ */
+static hubbub_error dom_grow(hubbub_dom *dom, void **array, uint32_t *size,
+		uint32_t need, size_t item)
+{
+	uint32_t n = *size;
+	void *grown;
+
+	if (need <= n)
+		return HUBBUB_OK;
+
+	while (n < need)
+		n = (n > UINT32_MAX / 2) ? need : n * 2;
+
+	if (n > SIZE_MAX / item)
+		return HUBBUB_NOMEM;
+
+	grown = dom->alloc(*array, n * item, dom->pw);
+	if (grown == NULL)
+		return HUBBUB_NOMEM;
+
+	*array = grown;
+	*size = n;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Copy a string into the string pool
+ *
+ * \param dom     The DOM instance
+ * \param data    The data to copy (must not lie within the pool)
+ * \param len     Byte length of data
+ * \param result  Pointer to location to receive pooled string
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ */
+static hubbub_error dom_add_string(hubbub_dom *dom, const uint8_t *data,
+		size_t len, hubbub_dom_string *result)
+{
+	hubbub_error error;
+
+	if (len > UINT32_MAX - dom->pool_len)
+		return HUBBUB_NOMEM;
+
+	error = dom_grow(dom, (void **) (void *) &dom->pool, &dom->pool_alloc,
+			dom->pool_len + (uint32_t) len, 1);
+	if (error != HUBBUB_OK)
+		return error;
+
+	if (len > 0)
+		memcpy(dom->pool + dom->pool_len, data, len);
+
+	result->off = dom->pool_len;
+	result->len = (uint32_t) len;
+
+	dom->pool_len += (uint32_t) len;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Add a node, unattached and with no data
+ *
+ * \param dom     The DOM instance
+ * \param type    Type of the node
+ * \param result  Pointer to location to receive index of node
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ */
+static hubbub_error dom_add_node(hubbub_dom *dom, hubbub_dom_node_type type,
+		hubbub_dom_index *result)
+{
+	hubbub_dom_node *node;
+	hubbub_error error;
+
+	if (dom->n_nodes == HUBBUB_DOM_NONE)
+		return HUBBUB_NOMEM;
+
+	error = dom_grow(dom, (void **) (void *) &dom->nodes,
+			&dom->nodes_alloc, dom->n_nodes + 1,
+			sizeof(hubbub_dom_node));
+	if (error != HUBBUB_OK)
+		return error;
+
+	node = &dom->nodes[dom->n_nodes];
+	memset(node, 0, sizeof(hubbub_dom_node));
+	node->type = type;
+	node->parent = node->first_child = node->last_child =
+			node->prev = node->next = HUBBUB_DOM_NONE;
+
+	*result = dom->n_nodes++;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Add a node holding a string
+ *
+ * \param dom     The DOM instance
+ * \param type    Type of the node
+ * \param data    The node's data
+ * \param result  Pointer to location to receive index of node
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ */
+static hubbub_error dom_add_data_node(hubbub_dom *dom,
+		hubbub_dom_node_type type, const hubbub_string *data,
+		hubbub_dom_index *result)
+{
+	hubbub_dom_string str;
+	hubbub_error error;
+
+	error = dom_add_string(dom, data->ptr, data->len, &str);
+	if (error != HUBBUB_OK)
+		return error;
+
+	error = dom_add_node(dom, type, result);
+	if (error != HUBBUB_OK)
+		return error;
+
+	dom->nodes[*result].data = str;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Append the data of one text node to that of another
+ *
+ * \param dom  The DOM instance
+ * \param dst  Index of the node to append to
+ * \param src  Index of the node whose data to append
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ *
+ * Adjacent text is usually created in turn, so that the two strings are
+ * already contiguous in the pool and nothing need be copied.
+ */
+static hubbub_error dom_join_text(hubbub_dom *dom, hubbub_dom_index dst,
+		hubbub_dom_index src)
+{
+	hubbub_dom_string to = dom->nodes[dst].data;
+	hubbub_dom_string from = dom->nodes[src].data;
+	uint32_t off;
+	hubbub_error error;
+
+	if (to.off + to.len != from.off) {
+		/* Unless the destination ends the pool, move it there */
+		off = (to.off + to.len == dom->pool_len) ? to.off
+				: dom->pool_len;
+
+		if (to.len + from.len > UINT32_MAX - off)
+			return HUBBUB_NOMEM;
+
+		error = dom_grow(dom, (void **) (void *) &dom->pool,
+				&dom->pool_alloc,
+				off + to.len + from.len, 1);
+		if (error != HUBBUB_OK)
+			return error;
+
+		if (off != to.off)
+			memcpy(dom->pool + off, dom->pool + to.off, to.len);
+		memcpy(dom->pool + off + to.len, dom->pool + from.off,
+				from.len);
+
+		to.off = off;
+		dom->pool_len = off + to.len + from.len;
+	}
+
+	to.len += from.len;
+	dom->nodes[dst].data = to;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Append a string to the data of a text node
+ *
+ * \param dom   The DOM instance
+ * \param dst   Index of the node to append to
+ * \param data  The string to append
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ */
+static hubbub_error dom_extend_text(hubbub_dom *dom, hubbub_dom_index dst,
+		const hubbub_string *data)
+{
+	hubbub_dom_string to = dom->nodes[dst].data;
+	uint32_t off;
+	hubbub_error error;
+
+	/* Unless the destination ends the pool, move it there */
+	off = (to.off + to.len == dom->pool_len) ? to.off : dom->pool_len;
+
+	if (to.len > UINT32_MAX - off ||
+			data->len > UINT32_MAX - off - to.len)
+		return HUBBUB_NOMEM;
+
+	error = dom_grow(dom, (void **) (void *) &dom->pool, &dom->pool_alloc,
+			off + to.len + (uint32_t) data->len, 1);
+	if (error != HUBBUB_OK)
+		return error;
+
+	if (off != to.off)
+		memcpy(dom->pool + off, dom->pool + to.off, to.len);
+	if (data->len > 0)
+		memcpy(dom->pool + off + to.len, data->ptr, data->len);
+
+	to.off = off;
+	to.len += (uint32_t) data->len;
+	dom->pool_len = off + to.len;
+	dom->nodes[dst].data = to;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Detach a node from its parent, if it has one
+ *
+ * \param dom    The DOM instance
+ * \param index  Index of the node to detach
+ */
+static void dom_unlink(hubbub_dom *dom, hubbub_dom_index index)
+{
+	hubbub_dom_node *node = &dom->nodes[index];
+	hubbub_dom_node *parent;
+
+	if (node->parent == HUBBUB_DOM_NONE)
+		return;
+
+	parent = &dom->nodes[node->parent];
+
+	if (node->prev != HUBBUB_DOM_NONE)
+		dom->nodes[node->prev].next = node->next;
+	else
+		parent->first_child = node->next;
+
+	if (node->next != HUBBUB_DOM_NONE)
+		dom->nodes[node->next].prev = node->prev;
+	else
+		parent->last_child = node->prev;
+
+	node->parent = node->prev = node->next = HUBBUB_DOM_NONE;
+}
+
+/**
+ * Insert a detached node into a parent's child list
+ *
+ * \param dom     The DOM instance
+ * \param parent  Index of the parent
+ * \param index   Index of the node to insert
+ * \param before  Index of the child to insert before, or HUBBUB_DOM_NONE
+ *                to append
+ */
+static void dom_link(hubbub_dom *dom, hubbub_dom_index parent,
+		hubbub_dom_index index, hubbub_dom_index before)
+{
+	hubbub_dom_node *p = &dom->nodes[parent];
+	hubbub_dom_node *node = &dom->nodes[index];
+
+	node->parent = parent;
+	node->next = before;
+
+	if (before == HUBBUB_DOM_NONE) {
+		node->prev = p->last_child;
+		p->last_child = index;
+	} else {
+		node->prev = dom->nodes[before].prev;
+		dom->nodes[before].prev = index;
+	}
+
+	if (node->prev != HUBBUB_DOM_NONE)
+		dom->nodes[node->prev].next = index;
+	else
+		p->first_child = index;
+}
+
+/**
+ * Copy a node, and optionally its descendants
+ *
+ * \param dom     The DOM instance
+ * \param index   Index of the node to copy
+ * \param deep    Whether to copy descendants
+ * \param result  Pointer to location to receive index of copy
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ *
+ * Pooled strings and attributes are never written once created, so the
+ * copy shares them with the original.
+ */
+static hubbub_error dom_clone(hubbub_dom *dom, hubbub_dom_index index,
+		bool deep, hubbub_dom_index *result)
+{
+	hubbub_dom_index copy, child, child_copy;
+	hubbub_dom_node *node;
+	hubbub_error error;
+
+	error = dom_add_node(dom, dom->nodes[index].type, &copy);
+	if (error != HUBBUB_OK)
+		return error;
+
+	node = &dom->nodes[copy];
+	*node = dom->nodes[index];
+	node->parent = node->first_child = node->last_child =
+			node->prev = node->next = HUBBUB_DOM_NONE;
+	if (node->type == HUBBUB_DOM_NODE_ELEMENT)
+		node->u.element.form = HUBBUB_DOM_NONE;
+
+	if (deep) {
+		for (child = dom->nodes[index].first_child;
+				child != HUBBUB_DOM_NONE;
+				child = dom->nodes[child].next) {
+			error = dom_clone(dom, child, true, &child_copy);
+			if (error != HUBBUB_OK)
+				return error;
+
+			dom_link(dom, copy, child_copy, HUBBUB_DOM_NONE);
+		}
+	}
+
+	*result = copy;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Determine whether an element has an attribute
+ *
+ * \param dom   The DOM instance
+ * \param node  The element to inspect
+ * \param attr  The attribute to look for
+ * \return True if the element has an attribute of the same name
+ */
+static bool dom_has_attribute(hubbub_dom *dom, const hubbub_dom_node *node,
+		const hubbub_attribute *attr)
+{
+	const hubbub_dom_attribute *a;
+	uint32_t i;
+
+	a = &dom->attrs[node->u.element.attributes];
+
+	for (i = 0; i < node->u.element.n_attributes; i++) {
+		if (a[i].ns == attr->ns && a[i].name.len == attr->name.len &&
+				memcmp(dom->pool + a[i].name.off,
+					attr->name.ptr, attr->name.len) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+/******************************************************************************
+ * Tree handler callbacks                                                     *
+ ******************************************************************************/
+
+static hubbub_error dom_create_comment(void *ctx, const hubbub_string *data,
+		void **result)
+{
+	hubbub_dom_index index;
+	hubbub_error error;
+
+	error = dom_add_data_node((hubbub_dom *) ctx, HUBBUB_DOM_NODE_COMMENT,
+			data, &index);
+	if (error != HUBBUB_OK)
+		return error;
+
+	*result = DOM_HANDLE(index);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error dom_create_doctype(void *ctx,
+		const hubbub_doctype *doctype, void **result)
+{
+	hubbub_dom *dom = (hubbub_dom *) ctx;
+	hubbub_dom_string public_id = { 0, 0 }, system_id = { 0, 0 };
+	hubbub_dom_index index;
+	hubbub_dom_node *node;
+	hubbub_error error;
+
+	if (!doctype->public_missing) {
+		error = dom_add_string(dom, doctype->public_id.ptr,
+				doctype->public_id.len, &public_id);
+		if (error != HUBBUB_OK)
+			return error;
+	}
+
+	if (!doctype->system_missing) {
+		error = dom_add_string(dom, doctype->system_id.ptr,
+				doctype->system_id.len, &system_id);
+		if (error != HUBBUB_OK)
+			return error;
+	}
+
+	error = dom_add_data_node(dom, HUBBUB_DOM_NODE_DOCTYPE,
+			&doctype->name, &index);
+	if (error != HUBBUB_OK)
+		return error;
+
+	node = &dom->nodes[index];
+	node->u.doctype.public_id = public_id;
+	node->u.doctype.system_id = system_id;
+	node->u.doctype.public_missing = doctype->public_missing;
+	node->u.doctype.system_missing = doctype->system_missing;
+	node->u.doctype.force_quirks = doctype->force_quirks;
+
+	*result = DOM_HANDLE(index);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error dom_create_element(void *ctx, const hubbub_tag *tag,
+		void **result)
+{
+	hubbub_dom *dom = (hubbub_dom *) ctx;
+	hubbub_dom_attribute *attr;
+	hubbub_dom_index index;
+	hubbub_dom_node *node;
+	uint32_t first = dom->n_attrs, i;
+	hubbub_error error;
+
+	if (tag->n_attributes > UINT32_MAX - first)
+		return HUBBUB_NOMEM;
+
+	error = dom_grow(dom, (void **) (void *) &dom->attrs,
+			&dom->attrs_alloc, first + tag->n_attributes,
+			sizeof(hubbub_dom_attribute));
+	if (error != HUBBUB_OK)
+		return error;
+
+	for (i = 0; i < tag->n_attributes; i++) {
+		attr = &dom->attrs[first + i];
+		attr->ns = tag->attributes[i].ns;
+
+		error = dom_add_string(dom, tag->attributes[i].name.ptr,
+				tag->attributes[i].name.len, &attr->name);
+		if (error != HUBBUB_OK)
+			return error;
+
+		error = dom_add_string(dom, tag->attributes[i].value.ptr,
+				tag->attributes[i].value.len, &attr->value);
+		if (error != HUBBUB_OK)
+			return error;
+	}
+
+	error = dom_add_data_node(dom, HUBBUB_DOM_NODE_ELEMENT, &tag->name,
+			&index);
+	if (error != HUBBUB_OK)
+		return error;
+
+	dom->n_attrs += tag->n_attributes;
+
+	node = &dom->nodes[index];
+	node->u.element.ns = tag->ns;
+	node->u.element.atom = tag->atom;
+	node->u.element.attributes = first;
+	node->u.element.n_attributes = tag->n_attributes;
+	node->u.element.form = HUBBUB_DOM_NONE;
+
+	*result = DOM_HANDLE(index);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error dom_create_text(void *ctx, const hubbub_string *data,
+		void **result)
+{
+	hubbub_dom_index index;
+	hubbub_error error;
+
+	error = dom_add_data_node((hubbub_dom *) ctx, HUBBUB_DOM_NODE_TEXT,
+			data, &index);
+	if (error != HUBBUB_OK)
+		return error;
+
+	*result = DOM_HANDLE(index);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error dom_append_child(void *ctx, void *parent, void *child,
+		void **result)
+{
+	return dom_insert_before(ctx, parent, child, NULL, result);
+}
+
+static hubbub_error dom_insert_before(void *ctx, void *parent, void *child,
+		void *ref_child, void **result)
+{
+	hubbub_dom *dom = (hubbub_dom *) ctx;
+	hubbub_dom_index p = DOM_INDEX(parent), c = DOM_INDEX(child);
+	hubbub_dom_index before = HUBBUB_DOM_NONE, prev;
+	hubbub_error error;
+
+	if (ref_child != NULL) {
+		before = DOM_INDEX(ref_child);
+		prev = dom->nodes[before].prev;
+	} else {
+		prev = dom->nodes[p].last_child;
+	}
+
+	/* Text is coalesced with any text which would precede it */
+	if (dom->nodes[c].type == HUBBUB_DOM_NODE_TEXT &&
+			prev != HUBBUB_DOM_NONE &&
+			dom->nodes[prev].type == HUBBUB_DOM_NODE_TEXT) {
+		error = dom_join_text(dom, prev, c);
+		if (error != HUBBUB_OK)
+			return error;
+
+		*result = DOM_HANDLE(prev);
+
+		return HUBBUB_OK;
+	}
+
+	dom_unlink(dom, c);
+	dom_link(dom, p, c, before);
+
+	*result = child;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error dom_remove_child(void *ctx, void *parent, void *child,
+		void **result)
+{
+	UNUSED(parent);
+
+	dom_unlink((hubbub_dom *) ctx, DOM_INDEX(child));
+
+	*result = child;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error dom_clone_node(void *ctx, void *node, bool deep,
+		void **result)
+{
+	hubbub_dom_index index;
+	hubbub_error error;
+
+	error = dom_clone((hubbub_dom *) ctx, DOM_INDEX(node), deep, &index);
+	if (error != HUBBUB_OK)
+		return error;
+
+	*result = DOM_HANDLE(index);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error dom_reparent_children(void *ctx, void *node,
+		void *new_parent)
+{
+	hubbub_dom *dom = (hubbub_dom *) ctx;
+	hubbub_dom_index from = DOM_INDEX(node), to = DOM_INDEX(new_parent);
+	hubbub_dom_index child;
+
+	while ((child = dom->nodes[from].first_child) != HUBBUB_DOM_NONE) {
+		dom_unlink(dom, child);
+		dom_link(dom, to, child, HUBBUB_DOM_NONE);
+	}
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error dom_get_parent(void *ctx, void *node, bool element_only,
+		void **result)
+{
+	hubbub_dom *dom = (hubbub_dom *) ctx;
+	hubbub_dom_index parent = dom->nodes[DOM_INDEX(node)].parent;
+
+	if (parent == HUBBUB_DOM_NONE || (element_only &&
+			dom->nodes[parent].type != HUBBUB_DOM_NODE_ELEMENT))
+		*result = NULL;
+	else
+		*result = DOM_HANDLE(parent);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error dom_has_children(void *ctx, void *node, bool *result)
+{
+	hubbub_dom *dom = (hubbub_dom *) ctx;
+
+	*result = dom->nodes[DOM_INDEX(node)].first_child != HUBBUB_DOM_NONE;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error dom_form_associate(void *ctx, void *form, void *node)
+{
+	hubbub_dom *dom = (hubbub_dom *) ctx;
+	hubbub_dom_node *n = &dom->nodes[DOM_INDEX(node)];
+
+	if (n->type == HUBBUB_DOM_NODE_ELEMENT)
+		n->u.element.form = DOM_INDEX(form);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error dom_add_attributes(void *ctx, void *node,
+		const hubbub_attribute *attributes, uint32_t n_attributes)
+{
+	hubbub_dom *dom = (hubbub_dom *) ctx;
+	hubbub_dom_index index = DOM_INDEX(node);
+	hubbub_dom_attribute *attr;
+	uint32_t first, count, i;
+	hubbub_error error;
+
+	first = dom->nodes[index].u.element.attributes;
+	count = dom->nodes[index].u.element.n_attributes;
+
+	if (count > UINT32_MAX - n_attributes ||
+			count + n_attributes > UINT32_MAX - dom->n_attrs)
+		return HUBBUB_NOMEM;
+
+	error = dom_grow(dom, (void **) (void *) &dom->attrs,
+			&dom->attrs_alloc,
+			dom->n_attrs + count + n_attributes,
+			sizeof(hubbub_dom_attribute));
+	if (error != HUBBUB_OK)
+		return error;
+
+	/* Unless the element's attributes end the array, move them there,
+	 * so that new ones may follow them */
+	if (first + count != dom->n_attrs) {
+		memcpy(dom->attrs + dom->n_attrs, dom->attrs + first,
+				count * sizeof(hubbub_dom_attribute));
+		first = dom->n_attrs;
+		dom->n_attrs += count;
+		dom->nodes[index].u.element.attributes = first;
+	}
+
+	/* Attributes the element already has are left alone */
+	for (i = 0; i < n_attributes; i++) {
+		if (dom_has_attribute(dom, &dom->nodes[index], &attributes[i]))
+			continue;
+
+		attr = &dom->attrs[dom->n_attrs];
+		attr->ns = attributes[i].ns;
+
+		error = dom_add_string(dom, attributes[i].name.ptr,
+				attributes[i].name.len, &attr->name);
+		if (error != HUBBUB_OK)
+			return error;
+
+		error = dom_add_string(dom, attributes[i].value.ptr,
+				attributes[i].value.len, &attr->value);
+		if (error != HUBBUB_OK)
+			return error;
+
+		dom->n_attrs++;
+		dom->nodes[index].u.element.n_attributes++;
+	}
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error dom_set_quirks_mode(void *ctx, hubbub_quirks_mode mode)
+{
+	((hubbub_dom *) ctx)->quirks = mode;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error dom_encoding_change(void *ctx, const char *encname)
+{
+	UNUSED(ctx);
+	UNUSED(encname);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error dom_complete_script(void *ctx, void *script)
+{
+	UNUSED(ctx);
+	UNUSED(script);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error dom_append_text_to(void *ctx, void *parent,
+		const hubbub_string *data, bool *result)
+{
+	hubbub_dom *dom = (hubbub_dom *) ctx;
+	hubbub_dom_index last = dom->nodes[DOM_INDEX(parent)].last_child;
+
+	*result = false;
+
+	if (last == HUBBUB_DOM_NONE ||
+			dom->nodes[last].type != HUBBUB_DOM_NODE_TEXT)
+		return HUBBUB_OK;
+
+	*result = true;
+
+	return dom_extend_text(dom, last, data);
+}
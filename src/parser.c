@@ -14,9 +14,14 @@
 #include <hubbub/parser.h>
 
 #include "charset/detect.h"
+#include "tokeniser/batch.h"
+#include "tokeniser/speculate.h"
 #include "tokeniser/tokeniser.h"
+#include "treebuilder/element-type.h"
 #include "treebuilder/treebuilder.h"
+#include "utils/account.h"
 #include "utils/parserutilserror.h"
+#include "utils/utils.h"
 
 /**
  * Hubbub parser object
@@ -25,8 +30,111 @@ struct hubbub_parser {
 	parserutils_inputstream *stream;	/**< Input stream instance */
 	hubbub_tokeniser *tok;		/**< Tokeniser instance */
 	hubbub_treebuilder *tb;		/**< Treebuilder instance */
+	hubbub_token_batch *batch;	/**< Token batch, or NULL */
+
+	bool borrow_input;		/**< Whether the client lends input */
+	bool borrowing;			/**< Whether input is read in place */
+	bool had_data;			/**< Whether any input has arrived */
+
+	bool change_in_place;		/**< Whether to change encoding
+					 * without a restart, if possible */
+	bool inserted;			/**< Whether data has been inserted */
+	size_t raw_len;			/**< Bytes of input received */
+	size_t raw_invariant;		/**< Length of the initial run of
+					 * input bytes which are the same
+					 * in any ASCII-compatible encoding */
+	uint32_t raw_seen[4];		/**< Bytes present in that run */
+	uint8_t raw_tail[3];		/**< Last bytes of input received */
+	size_t raw_tail_len;		/**< Length of \a raw_tail */
+
+	uint32_t encoding_changes;	/**< Encodings changed in place */
+	uint32_t restarts;		/**< Restarts in another encoding */
+	bool restarting;		/**< Whether parsing last stopped for
+					 * a restart in another encoding */
+
+	hubbub_allocator_fn alloc;	/**< Memory (de)allocation function */
+	void *pw;			/**< Client data for \a alloc */
+	hubbub_account account;		/**< Memory held by the parser's
+					 * components, obtained from
+					 * \a alloc */
+};
+
+/**
+ * Recorded state of a parser
+ *
+ * The name of the input charset follows the structure, in the same
+ * allocation.
+ */
+struct hubbub_checkpoint {
+	hubbub_tokeniser_snapshot tok;	/**< Tokeniser state */
+	hubbub_treebuilder_snapshot *tb;	/**< Treebuilder state, or
+						 * NULL if no tree is built */
+
+	bool inserted;			/**< Whether data has been inserted */
+	size_t raw_len;			/**< Bytes of input received */
+	size_t raw_invariant;		/**< Length of the initial run of
+					 * input bytes which are the same
+					 * in any ASCII-compatible encoding */
+	uint32_t raw_seen[4];		/**< Bytes present in that run */
+
+	hubbub_allocator_fn alloc;	/**< Memory (de)allocation function */
+	void *pw;			/**< Client data for \a alloc */
 };
 
+static hubbub_error parser_create(const char *enc, bool fix_enc,
+		hubbub_allocator_fn alloc, void *pw, bool build_tree,
+		hubbub_parser **parser);
+static hubbub_error parser_flush_batch(hubbub_parser *parser,
+		hubbub_error error);
+static hubbub_error parser_parse(hubbub_parser *parser, const uint8_t *data,
+		size_t len, const hubbub_speculation *spec);
+static bool parser_stream_is_utf8(hubbub_parser *parser);
+static void parser_track_input(hubbub_parser *parser, const uint8_t *data,
+		size_t len);
+static bool parser_input_is_whole(hubbub_parser *parser,
+		const char *charset);
+static bool parser_reads_bytewise(const char *enc);
+static hubbub_error parser_change_encoding(hubbub_parser *parser,
+		const uint8_t *data, size_t len);
+static hubbub_error parser_check_memory(hubbub_parser *parser);
+static hubbub_error parser_set_attribute_filter(hubbub_parser *parser,
+		const char *const *names, uint32_t n_names);
+
+/**
+ * Create the input stream for a document
+ *
+ * \param enc      Source document encoding, or NULL to autodetect
+ * \param fix_enc  Permit fixing up of encoding if it's frequently misused
+ * \param stream   Pointer to location to receive input stream
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static hubbub_error parser_create_stream(const char *enc, bool fix_enc,
+		parserutils_inputstream **stream)
+{
+	parserutils_error perror;
+
+	/* If we have an encoding and we're permitted to fix up likely broken
+	 * ones, then attempt to do so. */
+	if (enc != NULL && fix_enc == true) {
+		uint16_t mibenum = parserutils_charset_mibenum_from_name(enc,
+				strlen(enc));
+
+		if (mibenum != 0) {
+			hubbub_charset_fix_charset(&mibenum);
+
+			enc = parserutils_charset_mibenum_to_name(mibenum);
+		}
+	}
+
+	perror = parserutils_inputstream_create(enc,
+		enc != NULL ? HUBBUB_CHARSET_CONFIDENT : HUBBUB_CHARSET_UNKNOWN,
+		hubbub_charset_extract, stream);
+	if (perror != PARSERUTILS_OK)
+		return hubbub_error_from_parserutils_error(perror);
+
+	return HUBBUB_OK;
+}
+
 /**
  * Create a hubbub parser
  *
@@ -41,50 +149,141 @@ struct hubbub_parser {
 hubbub_error hubbub_parser_create(const char *enc, bool fix_enc,
 		hubbub_parser **parser)
 {
-	parserutils_error perror;
+	return hubbub_parser_create_with_allocator(enc, fix_enc,
+			NULL, NULL, parser);
+}
+
+/**
+ * Create a hubbub parser which uses a client-supplied allocator
+ *
+ * All of the memory owned by the parser, its tokeniser and its treebuilder
+ * is obtained from \p alloc. This permits a client parsing many small
+ * documents to hand out memory from a per-document arena, releasing it in
+ * one go once the parser has been destroyed. The input stream and its
+ * buffers are owned by libparserutils and are not affected, although the
+ * memory they hold is counted (see hubbub_parser_read_memory_usage).
+ *
+ * \param enc      Source document encoding, or NULL to autodetect
+ * \param fix_enc  Permit fixing up of encoding if it's frequently misused
+ * \param alloc    Memory (de)allocation function, or NULL for the default
+ * \param pw       Pointer to client-specific private data (may be NULL)
+ * \param parser   Pointer to location to receive parser instance
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_NOMEM on memory exhaustion,
+ *         HUBBUB_BADENCODING if \p enc is unsupported
+ */
+hubbub_error hubbub_parser_create_with_allocator(const char *enc,
+		bool fix_enc, hubbub_allocator_fn alloc, void *pw,
+		hubbub_parser **parser)
+{
+	return parser_create(enc, fix_enc, alloc, pw, true, parser);
+}
+
+/**
+ * Create a hubbub parser which only tokenises
+ *
+ * The parser has no treebuilder, and so never allocates one, or hands it
+ * tokens: they go straight from the tokeniser to the handler the client
+ * sets with HUBBUB_PARSER_TOKEN_HANDLER or HUBBUB_PARSER_TOKEN_BATCH_HANDLER.
+ * The tree options (HUBBUB_PARSER_TREE_HANDLER and the like) are ignored,
+ * and nothing switches the content model after a start tag, so the handler
+ * must do so wherever the client wants the tokens a tree would see; see
+ * hubbub_parser_content_model_for. Such a parser may also be asked, with
+ * HUBBUB_PARSER_KEEP_DUPLICATE_ATTRIBUTES, to leave tags' attributes as
+ * written.
+ *
+ * This is equivalent to creating a parser and then setting a token handler,
+ * without building a treebuilder only to destroy it.
+ *
+ * \param enc      Source document encoding, or NULL to autodetect
+ * \param fix_enc  Permit fixing up of encoding if it's frequently misused
+ * \param alloc    Memory (de)allocation function, or NULL for the default
+ * \param pw       Pointer to client-specific private data (may be NULL)
+ * \param parser   Pointer to location to receive parser instance
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_NOMEM on memory exhaustion,
+ *         HUBBUB_BADENCODING if \p enc is unsupported
+ */
+hubbub_error hubbub_parser_create_for_tokens(const char *enc, bool fix_enc,
+		hubbub_allocator_fn alloc, void *pw, hubbub_parser **parser)
+{
+	return parser_create(enc, fix_enc, alloc, pw, false, parser);
+}
+
+/**
+ * Create a hubbub parser, with or without a treebuilder
+ *
+ * \param enc         Source document encoding, or NULL to autodetect
+ * \param fix_enc     Permit fixing up of encoding if it's frequently misused
+ * \param alloc       Memory (de)allocation function, or NULL for the default
+ * \param pw          Pointer to client-specific private data (may be NULL)
+ * \param build_tree  Whether to create a treebuilder
+ * \param parser      Pointer to location to receive parser instance
+ * \return As for hubbub_parser_create_with_allocator
+ */
+hubbub_error parser_create(const char *enc, bool fix_enc,
+		hubbub_allocator_fn alloc, void *pw, bool build_tree,
+		hubbub_parser **parser)
+{
 	hubbub_error error;
 	hubbub_parser *p;
 
 	if (parser == NULL)
 		return HUBBUB_BADPARM;
 
-	p = malloc(sizeof(hubbub_parser));
+	if (alloc == NULL)
+		alloc = hubbub_default_alloc;
+
+	p = alloc(NULL, sizeof(hubbub_parser), pw);
 	if (p == NULL)
 		return HUBBUB_NOMEM;
 
-	/* If we have an encoding and we're permitted to fix up likely broken
-	 * ones, then attempt to do so. */
-	if (enc != NULL && fix_enc == true) {
-		uint16_t mibenum = parserutils_charset_mibenum_from_name(enc,
-				strlen(enc));
+	p->batch = NULL;
 
-		if (mibenum != 0) {
-			hubbub_charset_fix_charset(&mibenum);
+	p->borrow_input = false;
+	p->borrowing = false;
+	p->had_data = false;
 
-			enc = parserutils_charset_mibenum_to_name(mibenum);
-		}
-	}
+	p->change_in_place = false;
+	p->inserted = false;
+	p->raw_len = 0;
+	p->raw_invariant = 0;
+	memset(p->raw_seen, 0, sizeof(p->raw_seen));
+	p->raw_tail_len = 0;
 
-	perror = parserutils_inputstream_create(enc,
-		enc != NULL ? HUBBUB_CHARSET_CONFIDENT : HUBBUB_CHARSET_UNKNOWN,
-		hubbub_charset_extract, &p->stream);
-	if (perror != PARSERUTILS_OK) {
-		free(p);
-		return hubbub_error_from_parserutils_error(perror);
+	p->encoding_changes = 0;
+	p->restarts = 0;
+	p->restarting = false;
+
+	p->alloc = alloc;
+	p->pw = pw;
+	hubbub_account_init(&p->account, alloc, pw);
+
+	error = parser_create_stream(enc, fix_enc, &p->stream);
+	if (error != HUBBUB_OK) {
+		alloc(p, 0, pw);
+		return error;
 	}
 
-	error = hubbub_tokeniser_create(p->stream, &p->tok);
+	error = hubbub_tokeniser_create(p->stream, hubbub_account_alloc,
+			&p->account, &p->tok);
 	if (error != HUBBUB_OK) {
 		parserutils_inputstream_destroy(p->stream);
-		free(p);
+		alloc(p, 0, pw);
 		return error;
 	}
 
-	error = hubbub_treebuilder_create(p->tok, &p->tb);
+	p->tb = NULL;
+
+	if (build_tree)
+		error = hubbub_treebuilder_create(p->tok,
+				hubbub_account_alloc, &p->account, &p->tb);
 	if (error != HUBBUB_OK) {
 		hubbub_tokeniser_destroy(p->tok);
 		parserutils_inputstream_destroy(p->stream);
-		free(p);
+		alloc(p, 0, pw);
 		return error;
 	}
 
@@ -108,13 +307,301 @@ hubbub_error hubbub_parser_destroy(hubbub_parser *parser)
 
 	hubbub_tokeniser_destroy(parser->tok);
 
+	if (parser->batch != NULL)
+		hubbub_token_batch_destroy(parser->batch);
+
+	parserutils_inputstream_destroy(parser->stream);
+
+	parser->alloc(parser, 0, parser->pw);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Reset a hubbub parser, ready to parse a new document
+ *
+ * The tokeniser and treebuilder discard all state relating to the previous
+ * document but keep their buffers and stacks, so a parser reused for a
+ * stream of similar documents soon stops allocating. Registered handlers
+ * and options are preserved. When a tree is being built, the nodes held by
+ * the parser are released, including the document node: a new one must be
+ * supplied with HUBBUB_PARSER_DOCUMENT_NODE before parsing resumes.
+ *
+ * \param parser   Parser instance to reset
+ * \param enc      Source document encoding, or NULL to autodetect
+ * \param fix_enc  Permit fixing up of encoding if it's frequently misused
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_NOMEM on memory exhaustion,
+ *         HUBBUB_BADENCODING if \p enc is unsupported
+ */
+hubbub_error hubbub_parser_reset(hubbub_parser *parser, const char *enc,
+		bool fix_enc)
+{
+	parserutils_inputstream *stream;
+	hubbub_error error;
+
+	if (parser == NULL)
+		return HUBBUB_BADPARM;
+
+	/* libparserutils cannot rewind an input stream, so replace it. This
+	 * is done first, so that failure leaves the parser untouched. */
+	error = parser_create_stream(enc, fix_enc, &stream);
+	if (error != HUBBUB_OK)
+		return error;
+
+	error = hubbub_tokeniser_reset(parser->tok, stream);
+	if (error != HUBBUB_OK) {
+		parserutils_inputstream_destroy(stream);
+		return error;
+	}
+
 	parserutils_inputstream_destroy(parser->stream);
+	parser->stream = stream;
+
+	if (parser->batch != NULL)
+		hubbub_token_batch_discard(parser->batch);
+
+	/* The new document may not be in UTF-8 */
+	parser->borrowing = parser->borrow_input &&
+			parser_stream_is_utf8(parser);
+	parser->had_data = false;
+
+	parser->inserted = false;
+	parser->raw_len = 0;
+	parser->raw_invariant = 0;
+	memset(parser->raw_seen, 0, sizeof(parser->raw_seen));
+	parser->raw_tail_len = 0;
+
+	/* A document begun again in another encoding is still counted as
+	 * the same one */
+	parser->encoding_changes = 0;
+	parser->restarts = parser->restarting ? parser->restarts + 1 : 0;
+	parser->restarting = false;
+
+	if (parser->tb != NULL) {
+		error = hubbub_treebuilder_reset(parser->tb);
+		if (error != HUBBUB_OK)
+			return error;
+	}
+
+	/* The peak of the new document starts from what is kept */
+	parser_check_memory(parser);
+	hubbub_account_begin(&parser->account);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Start parsing a fragment, as the content of an element
+ *
+ * This is for parsing such things as the value assigned to an element's
+ * innerHTML. Once the document node has been set, and before any data is
+ * given to the parser, an html element is appended to the document node,
+ * to hold the fragment's nodes, and the parser is set up as the HTML
+ * fragment parsing algorithm requires for the context element: the
+ * insertion mode and the content model are selected from it, so that the
+ * modes which build the skeleton of a document are never entered. The
+ * data then parsed becomes the content of the html element.
+ *
+ * A parser, reset between fragments, may be kept for the next one, so
+ * that each costs no more than its own content; see hubbub_parser_reset.
+ *
+ * \param parser   Parser instance to use
+ * \param context  Name of the context element, in the HTML namespace
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_INVALID if the parser builds no tree, has no document
+ *                        node, or has been given data,
+ *         appropriate error if the tree handler fails
+ */
+hubbub_error hubbub_parser_begin_fragment(hubbub_parser *parser,
+		const hubbub_string *context)
+{
+	if (parser == NULL || context == NULL)
+		return HUBBUB_BADPARM;
+
+	if (parser->tb == NULL || parser->had_data)
+		return HUBBUB_INVALID;
+
+	return hubbub_treebuilder_begin_fragment(parser->tb, context);
+}
+
+/**
+ * Record the state of a parser, so that parsing may later resume from it
+ *
+ * This is for such things as parsing many documents which begin with the
+ * same template, or parsing ahead and rolling back. A state may be
+ * recorded between calls, once the parser has read all the input it has
+ * been given and has emitted every token in it, but not after
+ * hubbub_parser_completed; it is not possible part way through a token,
+ * or when the input ends part way through a character. Whether it does
+ * is known for UTF-8 and for encodings of one byte per character; in any
+ * other encoding, there is no state to record unless input is borrowed.
+ *
+ * The state refers to the client's nodes, which it references until it
+ * is destroyed, but does not include the tree: see hubbub_parser_restore.
+ *
+ * \param parser      Parser instance
+ * \param checkpoint  Pointer to location to receive the state
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_INVALID if the parser is part way through a token or
+ *                        a character, or has input it has not yet read,
+ *         HUBBUB_NOMEM on memory exhaustion
+ */
+hubbub_error hubbub_parser_checkpoint(hubbub_parser *parser,
+		hubbub_checkpoint **checkpoint)
+{
+	hubbub_checkpoint *cp;
+	hubbub_error error;
+	const char *charset;
+	uint32_t source;
+	size_t len;
+
+	if (parser == NULL || checkpoint == NULL)
+		return HUBBUB_BADPARM;
+
+	charset = parserutils_inputstream_read_charset(parser->stream,
+			&source);
+	if (charset == NULL)
+		return HUBBUB_INVALID;
+
+	/* The part of a character which ends the input waits in the input
+	 * stream, and would be lost on resuming after it */
+	if (parser_input_is_whole(parser, charset) == false)
+		return HUBBUB_INVALID;
+
+	len = strlen(charset) + 1;
+
+	cp = parser->alloc(NULL, sizeof(hubbub_checkpoint) + len, parser->pw);
+	if (cp == NULL)
+		return HUBBUB_NOMEM;
+
+	error = hubbub_tokeniser_checkpoint(parser->tok, &cp->tok);
+	if (error != HUBBUB_OK) {
+		parser->alloc(cp, 0, parser->pw);
+		return error;
+	}
+
+	cp->tb = NULL;
+	if (parser->tb != NULL) {
+		error = hubbub_treebuilder_checkpoint(parser->tb,
+				parser->alloc, parser->pw, &cp->tb);
+		if (error != HUBBUB_OK) {
+			parser->alloc(cp, 0, parser->pw);
+			return error;
+		}
+	}
+
+	memcpy(cp + 1, charset, len);
+
+	cp->inserted = parser->inserted;
+	cp->raw_len = parser->raw_len;
+	cp->raw_invariant = parser->raw_invariant;
+	memcpy(cp->raw_seen, parser->raw_seen, sizeof(cp->raw_seen));
+
+	cp->alloc = parser->alloc;
+	cp->pw = parser->pw;
 
-	free(parser);
+	*checkpoint = cp;
 
 	return HUBBUB_OK;
 }
 
+/**
+ * Reset a parser, and resume parsing from a recorded state
+ *
+ * The parser need not be the one which recorded the state, but must be
+ * of the same kind: both build a tree, or neither does. One which builds
+ * a tree must first have been given a tree handler for a tree in which
+ * the node handles recorded, the document node's included, refer to the
+ * nodes they did, such as a copy of the tree which was built; see
+ * hubbub_dom_copy. The parser then continues with the input which
+ * followed that already parsed, from hubbub_checkpoint_read_offset on.
+ *
+ * Options and handlers are the parser's own. The input is read in the
+ * charset it was being read in, in which the parser is then confident.
+ * Statistics of the tokeniser's work count from the restore, while those
+ * of the tree builder, whose limits apply to the whole document, include
+ * the work recorded.
+ *
+ * \param parser      Parser instance
+ * \param checkpoint  State to restore
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_INVALID if the parser is of another kind, or has no tree
+ *                        handler when one is needed,
+ *         HUBBUB_NOMEM on memory exhaustion
+ */
+hubbub_error hubbub_parser_restore(hubbub_parser *parser,
+		const hubbub_checkpoint *checkpoint)
+{
+	hubbub_error error;
+
+	if (parser == NULL || checkpoint == NULL)
+		return HUBBUB_BADPARM;
+
+	if ((parser->tb == NULL) != (checkpoint->tb == NULL))
+		return HUBBUB_INVALID;
+
+	error = hubbub_parser_reset(parser, (const char *) (checkpoint + 1),
+			false);
+	if (error != HUBBUB_OK)
+		return error;
+
+	error = hubbub_tokeniser_restore(parser->tok, &checkpoint->tok);
+	if (error != HUBBUB_OK)
+		return error;
+
+	if (parser->tb != NULL) {
+		error = hubbub_treebuilder_restore(parser->tb,
+				checkpoint->tb);
+		if (error != HUBBUB_OK)
+			return error;
+	}
+
+	parser->had_data = true;
+	parser->inserted = checkpoint->inserted;
+	parser->raw_len = checkpoint->raw_len;
+	parser->raw_invariant = checkpoint->raw_invariant;
+	memcpy(parser->raw_seen, checkpoint->raw_seen,
+			sizeof(parser->raw_seen));
+	/* The input recorded ended with a whole character */
+	parser->raw_tail_len = 0;
+
+	return parser_check_memory(parser);
+}
+
+/**
+ * Read the offset in the input at which a recorded state was recorded
+ *
+ * \param checkpoint  Recorded state
+ * \return Bytes of input given to the parser, which a parser restored to
+ *         the state is not to be given again
+ */
+size_t hubbub_checkpoint_read_offset(const hubbub_checkpoint *checkpoint)
+{
+	assert(checkpoint != NULL);
+
+	return checkpoint->raw_len;
+}
+
+/**
+ * Destroy a recorded parser state
+ *
+ * \param checkpoint  The state to destroy
+ */
+void hubbub_checkpoint_destroy(hubbub_checkpoint *checkpoint)
+{
+	if (checkpoint == NULL)
+		return;
+
+	hubbub_treebuilder_snapshot_destroy(checkpoint->tb);
+
+	checkpoint->alloc(checkpoint, 0, checkpoint->pw);
+}
+
 /**
  * Configure a hubbub parser
  *
@@ -127,6 +614,7 @@ hubbub_error hubbub_parser_setopt(hubbub_parser *parser,
 		hubbub_parser_opttype type,
 		hubbub_parser_optparams *params)
 {
+	hubbub_tokeniser_optparams tokparams;
 	hubbub_error result = HUBBUB_OK;
 
 	if (parser == NULL || params == NULL)
@@ -140,11 +628,41 @@ hubbub_error hubbub_parser_setopt(hubbub_parser *parser,
 			hubbub_treebuilder_destroy(parser->tb);
 			parser->tb = NULL;
 		}
+		if (parser->batch != NULL) {
+			/* Deliver anything batched before switching */
+			result = hubbub_token_batch_flush(parser->batch);
+			if (result != HUBBUB_OK)
+				break;
+		}
 		result = hubbub_tokeniser_setopt(parser->tok,
 				HUBBUB_TOKENISER_TOKEN_HANDLER,
 				(hubbub_tokeniser_optparams *) params);
 		break;
 
+	case HUBBUB_PARSER_TOKEN_BATCH_HANDLER:
+		if (parser->tb != NULL) {
+			/* As for a token handler, the default treebuilder
+			 * is no longer wanted */
+			hubbub_treebuilder_destroy(parser->tb);
+			parser->tb = NULL;
+		}
+		if (parser->batch == NULL) {
+			result = hubbub_token_batch_create(
+					hubbub_account_alloc,
+					&parser->account, &parser->batch);
+			if (result != HUBBUB_OK)
+				break;
+		}
+		hubbub_token_batch_set_handler(parser->batch,
+				params->token_batch_handler.handler,
+				params->token_batch_handler.pw);
+
+		tokparams.token_handler.handler = hubbub_token_batch_append;
+		tokparams.token_handler.pw = parser->batch;
+		result = hubbub_tokeniser_setopt(parser->tok,
+				HUBBUB_TOKENISER_TOKEN_HANDLER, &tokparams);
+		break;
+
 	case HUBBUB_PARSER_ERROR_HANDLER:
 		/* The error handler does not cascade, so tell both the
 		 * treebuilder (if extant) and the tokeniser. */
@@ -170,6 +688,14 @@ hubbub_error hubbub_parser_setopt(hubbub_parser *parser,
 		result = hubbub_tokeniser_setopt(parser->tok,
 				HUBBUB_TOKENISER_PAUSE,
 				(hubbub_tokeniser_optparams *) params);
+		/* Unpausing runs the tokeniser */
+		result = parser_flush_batch(parser, result);
+		break;
+
+	case HUBBUB_PARSER_COALESCE_CHARACTERS:
+		result = hubbub_tokeniser_setopt(parser->tok,
+				HUBBUB_TOKENISER_COALESCE_CHARACTERS,
+				(hubbub_tokeniser_optparams *) params);
 		break;
 
 	case HUBBUB_PARSER_TREE_HANDLER:
@@ -196,24 +722,496 @@ hubbub_error hubbub_parser_setopt(hubbub_parser *parser,
 		}
 		break;
 
-	default:
-		result = HUBBUB_INVALID;
-	}
+	case HUBBUB_PARSER_AA_CLONE_LIMIT:
+		if (parser->tb != NULL) {
+			result = hubbub_treebuilder_setopt(parser->tb,
+					HUBBUB_TREEBUILDER_AA_CLONE_LIMIT,
+					(hubbub_treebuilder_optparams *) params);
+		}
+		break;
 
-	return result;
-}
+	case HUBBUB_PARSER_BORROW_INPUT:
+		/* Input can only be borrowed from the start of a document
+		 * which is known to be UTF-8 */
+		if (parser->had_data) {
+			result = HUBBUB_INVALID;
+		} else {
+			parser->borrow_input = params->borrow_input;
+			parser->borrowing = parser->borrow_input &&
+					parser_stream_is_utf8(parser);
+		}
+		break;
 
-/**
- * Insert a chunk of data into a hubbub parser input stream
- *
- * Inserts the given data into the input stream ready for parsing but
- * does not cause any additional processing of the input. This is
- * useful to allow hubbub callbacks to add computed data to the input.
- * 
- * \param parser  Parser instance to use
- * \param data    Data to parse (encoded in UTF-8)
- * \param len     Length, in bytes, of data
- * \return HUBBUB_OK on success, appropriate error otherwise
+	case HUBBUB_PARSER_CHANGE_ENCODING_IN_PLACE:
+		/* The input must be tracked from the start of a document */
+		if (parser->had_data)
+			result = HUBBUB_INVALID;
+		else
+			parser->change_in_place =
+					params->change_encoding_in_place;
+		break;
+
+	case HUBBUB_PARSER_STOP_AT_BODY:
+		if (parser->tb != NULL) {
+			result = hubbub_treebuilder_setopt(parser->tb,
+					HUBBUB_TREEBUILDER_STOP_AT_BODY,
+					(hubbub_treebuilder_optparams *) params);
+		}
+		break;
+
+	case HUBBUB_PARSER_WORK_BUDGET:
+		result = hubbub_tokeniser_setopt(parser->tok,
+				HUBBUB_TOKENISER_WORK_BUDGET,
+				(hubbub_tokeniser_optparams *) params);
+		break;
+
+	case HUBBUB_PARSER_TEXT_LIMIT:
+		result = hubbub_tokeniser_setopt(parser->tok,
+				HUBBUB_TOKENISER_TEXT_LIMIT,
+				(hubbub_tokeniser_optparams *) params);
+		break;
+
+	case HUBBUB_PARSER_MAX_DEPTH:
+		if (parser->tb != NULL) {
+			result = hubbub_treebuilder_setopt(parser->tb,
+					HUBBUB_TREEBUILDER_MAX_DEPTH,
+					(hubbub_treebuilder_optparams *) params);
+		}
+		break;
+
+	case HUBBUB_PARSER_COUNT_TREE_CALLS:
+		if (parser->tb != NULL) {
+			result = hubbub_treebuilder_setopt(parser->tb,
+					HUBBUB_TREEBUILDER_COUNT_CALLS,
+					(hubbub_treebuilder_optparams *) params);
+		}
+		break;
+
+	case HUBBUB_PARSER_TRACE_HANDLER:
+		result = hubbub_tokeniser_setopt(parser->tok,
+				HUBBUB_TOKENISER_TRACE_HANDLER,
+				(hubbub_tokeniser_optparams *) params);
+		if (result == HUBBUB_OK && parser->tb != NULL) {
+			result = hubbub_treebuilder_setopt(parser->tb,
+					HUBBUB_TREEBUILDER_TRACE_HANDLER,
+					(hubbub_treebuilder_optparams *) params);
+		}
+		break;
+
+	case HUBBUB_PARSER_MEASURE_TIME:
+		result = hubbub_tokeniser_setopt(parser->tok,
+				HUBBUB_TOKENISER_MEASURE_TIME,
+				(hubbub_tokeniser_optparams *) params);
+		if (result == HUBBUB_OK && parser->tb != NULL) {
+			result = hubbub_treebuilder_setopt(parser->tb,
+					HUBBUB_TREEBUILDER_MEASURE_TIME,
+					(hubbub_treebuilder_optparams *) params);
+		}
+		break;
+
+	case HUBBUB_PARSER_KEEP_DUPLICATE_ATTRIBUTES:
+		/* The treebuilder relies on attribute names being unique */
+		if (parser->tb != NULL) {
+			result = HUBBUB_INVALID;
+		} else {
+			tokparams.keep_duplicates =
+					params->keep_duplicate_attributes;
+			result = hubbub_tokeniser_setopt(parser->tok,
+					HUBBUB_TOKENISER_KEEP_DUPLICATES,
+					&tokparams);
+		}
+		break;
+
+	case HUBBUB_PARSER_ATTRIBUTE_FILTER:
+		result = parser_set_attribute_filter(parser,
+				params->attribute_filter.names,
+				params->attribute_filter.n_names);
+		break;
+
+	case HUBBUB_PARSER_MEMORY_LIMIT:
+		parser->account.limit = params->memory_limit;
+		break;
+
+	case HUBBUB_PARSER_BUFFER_SIZES:
+		tokparams.buffer_size = params->buffer_sizes.text;
+		result = hubbub_tokeniser_setopt(parser->tok,
+				HUBBUB_TOKENISER_BUFFER_SIZE, &tokparams);
+		if (result == HUBBUB_OK && parser->tb != NULL) {
+			hubbub_treebuilder_optparams tbparams;
+
+			tbparams.stack_reserve = params->buffer_sizes.depth;
+			result = hubbub_treebuilder_setopt(parser->tb,
+					HUBBUB_TREEBUILDER_STACK_RESERVE,
+					&tbparams);
+		}
+		break;
+
+	default:
+		result = HUBBUB_INVALID;
+	}
+
+	return result;
+}
+
+/**
+ * Determine whether a parser's input is known to be UTF-8
+ *
+ * \param parser  Parser instance
+ * \return True if the document's encoding is UTF-8 and will not change
+ */
+bool parser_stream_is_utf8(hubbub_parser *parser)
+{
+	const char *name;
+	uint32_t source;
+
+	name = parserutils_inputstream_read_charset(parser->stream, &source);
+	if (name == NULL || source != HUBBUB_CHARSET_CONFIDENT)
+		return false;
+
+	return parserutils_charset_mibenum_from_name(name, strlen(name)) ==
+			parserutils_charset_mibenum_from_name("UTF-8",
+					SLEN("UTF-8"));
+}
+
+/**
+ * Determine whether a byte may be read as the same character in any
+ * ASCII-compatible encoding
+ */
+#define PARSER_INVARIANT(c)						\
+	((c) == '\t' || (c) == '\n' || (c) == '\f' || (c) == '\r' ||		\
+			(0x20 <= (c) && (c) < 0x7F))
+
+/**
+ * Have the tokeniser emit only the attributes named, and any the tree
+ * builder reads
+ *
+ * \param parser   Parser instance
+ * \param names    Names of attributes to emit, or NULL to emit all
+ * \param n_names  Number of names
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error parser_set_attribute_filter(hubbub_parser *parser,
+		const char *const *names, uint32_t n_names)
+{
+	hubbub_tokeniser_optparams tokparams;
+	const char *const *tree_names;
+	const char **all;
+	uint32_t n_tree;
+	hubbub_error error;
+
+	tokparams.attribute_filter.names = names;
+	tokparams.attribute_filter.n_names = n_names;
+
+	if (names == NULL || parser->tb == NULL) {
+		return hubbub_tokeniser_setopt(parser->tok,
+				HUBBUB_TOKENISER_ATTRIBUTE_FILTER, &tokparams);
+	}
+
+	tree_names = hubbub_treebuilder_read_attribute_names(&n_tree);
+
+	all = parser->alloc(NULL, (n_names + n_tree) * sizeof(const char *),
+			parser->pw);
+	if (all == NULL)
+		return HUBBUB_NOMEM;
+
+	memcpy(all, names, n_names * sizeof(const char *));
+	memcpy(all + n_names, tree_names, n_tree * sizeof(const char *));
+
+	tokparams.attribute_filter.names = all;
+	tokparams.attribute_filter.n_names = n_names + n_tree;
+	error = hubbub_tokeniser_setopt(parser->tok,
+			HUBBUB_TOKENISER_ATTRIBUTE_FILTER, &tokparams);
+
+	parser->alloc(all, 0, parser->pw);
+
+	return error;
+}
+
+/**
+ * Note the input given to a parser, for a later change of encoding
+ *
+ * \param parser  Parser instance
+ * \param data    Data which has been received
+ * \param len     Length, in bytes, of data
+ */
+void parser_track_input(hubbub_parser *parser, const uint8_t *data,
+		size_t len)
+{
+	size_t i;
+
+	/* Only the initial run matters, so stop looking once it ends */
+	if (parser->raw_invariant == parser->raw_len) {
+		for (i = 0; i < len && PARSER_INVARIANT(data[i]); i++) {
+			parser->raw_seen[data[i] >> 5] |=
+					1u << (data[i] & 0x1F);
+		}
+
+		parser->raw_invariant += i;
+	}
+}
+
+/**
+ * Determine whether an encoding reads some bytes as the same characters
+ * as UTF-8 does
+ *
+ * \param enc    Name of encoding
+ * \param data   Bytes to read, each being a character by itself in UTF-8
+ * \param len    Length, in bytes, of data
+ * \return True if \p enc reads \p data unchanged
+ */
+static bool parser_reads_unchanged(const char *enc, const uint8_t *data,
+		size_t len)
+{
+	parserutils_inputstream *stream;
+	parserutils_error perror;
+	const uint8_t *ptr;
+	size_t i, clen;
+	bool same = true;
+
+	perror = parserutils_inputstream_create(enc,
+			HUBBUB_CHARSET_CONFIDENT, NULL, &stream);
+	if (perror != PARSERUTILS_OK)
+		return false;
+
+	perror = parserutils_inputstream_append(stream, data, len);
+	if (perror == PARSERUTILS_OK)
+		perror = parserutils_inputstream_append(stream, NULL, 0);
+	if (perror != PARSERUTILS_OK)
+		same = false;
+
+	for (i = 0; same && i < len; i++) {
+		perror = parserutils_inputstream_peek(stream, i, &ptr, &clen);
+		if (perror != PARSERUTILS_OK || clen != 1 || *ptr != data[i])
+			same = false;
+	}
+
+	parserutils_inputstream_destroy(stream);
+
+	return same;
+}
+
+/**
+ * Determine whether the input given to a parser ends with a whole
+ * character
+ *
+ * \param parser   Parser instance
+ * \param charset  Name of the charset the input is read in
+ * \return True if the input is known to end with a whole character
+ */
+bool parser_input_is_whole(hubbub_parser *parser, const char *charset)
+{
+	uint16_t mibenum = parserutils_charset_mibenum_from_name(charset,
+			strlen(charset));
+	size_t i;
+
+	/* Borrowed input is read in place, so the tokeniser knows */
+	if (parser->borrowing || parser->raw_tail_len == 0)
+		return true;
+
+	if (mibenum != parserutils_charset_mibenum_from_name("UTF-8",
+			SLEN("UTF-8")))
+		return parser_reads_bytewise(charset);
+
+	/* Find the last byte which begins a character, and check that all
+	 * the bytes it calls for follow it */
+	for (i = parser->raw_tail_len; i > 0; i--) {
+		uint8_t c = parser->raw_tail[i - 1];
+		size_t need = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : 2;
+
+		if ((c & 0xC0) == 0x80)
+			continue;
+
+		return c < 0xC0 || parser->raw_tail_len - (i - 1) >= need;
+	}
+
+	return true;
+}
+
+/**
+ * Determine whether an encoding reads each byte as a character by itself
+ *
+ * \param enc  Name of encoding
+ * \return True if every byte of \p enc is a whole character
+ */
+bool parser_reads_bytewise(const char *enc)
+{
+	parserutils_inputstream *stream;
+	parserutils_error perror;
+	const uint8_t *ptr;
+	uint8_t data[0x80];
+	size_t i, offset = 0, clen = 0;
+
+	perror = parserutils_inputstream_create(enc,
+			HUBBUB_CHARSET_CONFIDENT, NULL, &stream);
+	if (perror != PARSERUTILS_OK)
+		return false;
+
+	/* Encodings compatible with ASCII differ only in the high bytes */
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = 0x80 + i;
+
+	/* Without the end of the input, only whole characters are read */
+	perror = parserutils_inputstream_append(stream, data, sizeof(data));
+
+	for (i = 0; perror == PARSERUTILS_OK && i < sizeof(data); i++) {
+		perror = parserutils_inputstream_peek(stream, offset, &ptr,
+				&clen);
+		offset += clen;
+	}
+
+	parserutils_inputstream_destroy(stream);
+
+	return perror == PARSERUTILS_OK;
+}
+
+/**
+ * Change to the encoding requested by a document without starting again
+ *
+ * This is possible if all input consumed so far consists of bytes which
+ * both the current and the requested encodings read as the same
+ * characters, so that decoding the input again would give the same
+ * result. The rest of the input is then decoded afresh, in the requested
+ * encoding, from the point which the tokeniser has reached.
+ *
+ * \param parser  Parser instance
+ * \param data    The chunk of data being parsed
+ * \param len     Length, in bytes, of data
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_INVALID if the input consumed may read differently, or
+ *                        the rest of the input is no longer to hand,
+ *         appropriate error otherwise
+ */
+hubbub_error parser_change_encoding(hubbub_parser *parser,
+		const uint8_t *data, size_t len)
+{
+	parserutils_inputstream *stream;
+	parserutils_error perror;
+	hubbub_error error;
+	const char *name, *current;
+	uint32_t source;
+	uint8_t seen[128];
+	size_t offset, start, n_seen = 0;
+	unsigned int c;
+
+	if (parser->tb == NULL || parser->inserted || parser->borrowing)
+		return HUBBUB_INVALID;
+
+	name = hubbub_treebuilder_read_requested_charset(parser->tb);
+	current = parserutils_inputstream_read_charset(parser->stream,
+			&source);
+	if (name == NULL || current == NULL ||
+			source != HUBBUB_CHARSET_TENTATIVE)
+		return HUBBUB_INVALID;
+
+	/* What has been consumed must lie within the invariant run, so that
+	 * it is as long as the input it came from, and the rest must all be
+	 * in the current chunk */
+	offset = hubbub_tokeniser_read_offset(parser->tok);
+	start = parser->raw_len - len;
+	if (offset > parser->raw_invariant || offset < start)
+		return HUBBUB_INVALID;
+
+	for (c = 0; c < N_ELEMENTS(seen); c++) {
+		if (parser->raw_seen[c >> 5] & (1u << (c & 0x1F)))
+			seen[n_seen++] = (uint8_t) c;
+	}
+
+	if (parser_reads_unchanged(current, seen, n_seen) == false ||
+			parser_reads_unchanged(name, seen, n_seen) == false)
+		return HUBBUB_INVALID;
+
+	error = parser_create_stream(name, false, &stream);
+	if (error != HUBBUB_OK)
+		return error;
+
+	perror = parserutils_inputstream_append(stream, data + offset - start,
+			parser->raw_len - offset);
+	if (perror != PARSERUTILS_OK) {
+		parserutils_inputstream_destroy(stream);
+		return hubbub_error_from_parserutils_error(perror);
+	}
+
+	error = hubbub_tokeniser_switch_input(parser->tok, stream);
+	if (error != HUBBUB_OK) {
+		parserutils_inputstream_destroy(stream);
+		return error;
+	}
+
+	parserutils_inputstream_destroy(parser->stream);
+	parser->stream = stream;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Deliver any tokens left in the parser's token batch
+ *
+ * Batches are flushed whenever control returns to the client, so that no
+ * token is held back for longer than one call.
+ *
+ * \param parser  Parser instance
+ * \param error   Result of running the tokeniser
+ * \return \p error if it is not HUBBUB_OK, otherwise the result of delivery
+ */
+static hubbub_error parser_flush_batch(hubbub_parser *parser,
+		hubbub_error error)
+{
+	hubbub_error result;
+
+	if (parser->batch == NULL)
+		return error;
+
+	/* Tokens emitted before a pause or yield are still delivered */
+	if (error != HUBBUB_OK && error != HUBBUB_PAUSED &&
+			error != HUBBUB_YIELDED && error != HUBBUB_STOPPED)
+		return error;
+
+	result = hubbub_token_batch_flush(parser->batch);
+	if (result == HUBBUB_PAUSED && error == HUBBUB_OK) {
+		hubbub_tokeniser_optparams params;
+
+		params.pause_parse = true;
+		hubbub_tokeniser_setopt(parser->tok,
+				HUBBUB_TOKENISER_PAUSE, &params);
+	}
+
+	return (error != HUBBUB_OK) ? error : result;
+}
+
+/**
+ * Count the memory held in libparserutils buffers against the parser
+ *
+ * These grow without the parser's knowledge, so are counted after each
+ * run of the tokeniser, failing the parse if they take it over its limit.
+ *
+ * \param parser  Parser instance
+ * \return HUBBUB_OK if the parser is within its memory limit,
+ *         HUBBUB_NOMEM if it is over it
+ */
+hubbub_error parser_check_memory(hubbub_parser *parser)
+{
+	size_t external = hubbub_tokeniser_read_buffer_memory(parser->tok);
+
+	if (parser->tb != NULL)
+		external += hubbub_treebuilder_read_buffer_memory(parser->tb);
+
+	return hubbub_account_external(&parser->account, external);
+}
+
+/**
+ * Insert a chunk of data into a hubbub parser input stream
+ *
+ * Inserts the given data into the input stream ready for parsing but
+ * does not cause any additional processing of the input. This is
+ * useful to allow hubbub callbacks to add computed data to the input.
+ * Data inserted by any number of calls before the next token is read
+ * as one, in place, so writing in small pieces costs little more than
+ * parsing the same data in one chunk.
+ * 
+ * \param parser  Parser instance to use
+ * \param data    Data to parse (encoded in UTF-8)
+ * \param len     Length, in bytes, of data
+ * \return HUBBUB_OK on success, appropriate error otherwise
  */
 hubbub_error hubbub_parser_insert_chunk(hubbub_parser *parser,
 		const uint8_t *data, size_t len)
@@ -221,31 +1219,140 @@ hubbub_error hubbub_parser_insert_chunk(hubbub_parser *parser,
 	if (parser == NULL || data == NULL)
 		return HUBBUB_BADPARM;
 
+	/* Inserted data has no place in the raw input */
+	parser->inserted = true;
+
 	return hubbub_tokeniser_insert_chunk(parser->tok, data, len);
 }
 
 /**
  * Pass a chunk of data to a hubbub parser for parsing
  *
+ * If the parser borrows its input (see HUBBUB_PARSER_BORROW_INPUT), the
+ * data must remain valid until the parser is reset or destroyed, and is
+ * read in place if each chunk directly follows the previous one in memory.
+ * The client may then find which strings it is passed point into the data
+ * with hubbub_parser_source_offset().
+ *
+ * If the document requests a change of encoding, and the client's encoding
+ * change handler asks for parsing to stop, HUBBUB_ENCODINGCHANGE is
+ * returned and the client should start again in the new encoding. With
+ * HUBBUB_PARSER_CHANGE_ENCODING_IN_PLACE, the parser instead continues in
+ * the new encoding whenever all the input it has consumed reads the same
+ * in both, as is the case when that input is ASCII.
+ *
+ * If a work budget is set (see HUBBUB_PARSER_WORK_BUDGET), HUBBUB_YIELDED
+ * is returned once that much input has been read. The remaining input is
+ * kept, and parsing continues from where it stopped on the next call to
+ * this function, hubbub_parser_completed or hubbub_parser_resume.
+ *
+ * With HUBBUB_PARSER_STOP_AT_BODY, HUBBUB_STOPPED is returned once the
+ * head is complete, and by any later call. The tree then holds the whole
+ * head, followed by an empty body or frameset element; the rest of the
+ * input is not parsed.
+ *
  * \param parser  Parser instance to use
  * \param data    Data to parse (encoded in the input charset)
  * \param len     Length, in bytes, of data
- * \return HUBBUB_OK on success, appropriate error otherwise
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_YIELDED if the work budget ran out,
+ *         HUBBUB_STOPPED if parsing has ended early,
+ *         appropriate error otherwise
  */
 hubbub_error hubbub_parser_parse_chunk(hubbub_parser *parser,
 		const uint8_t *data, size_t len)
+{
+	if (parser == NULL || data == NULL)
+		return HUBBUB_BADPARM;
+
+	return parser_parse(parser, data, len, NULL);
+}
+
+/**
+ * Parse the part of a document which a speculation was made from
+ *
+ * This behaves as hubbub_parser_parse_chunk would for the same input,
+ * save that the tokens of the speculation (see <hubbub/speculate.h>) are
+ * used while they are the ones the parser would read. This is the case
+ * only if the parser reads its input in place (see
+ * HUBBUB_PARSER_BORROW_INPUT), is between tokens at the start of the
+ * part, and has no text limit or work budget. Otherwise, the part is
+ * tokenised as usual.
+ *
+ * \param parser  Parser instance to use
+ * \param spec    Speculation made from the next part of the document
+ * \return As for hubbub_parser_parse_chunk
+ */
+hubbub_error hubbub_parser_parse_speculation(hubbub_parser *parser,
+		const hubbub_speculation *spec)
+{
+	const uint8_t *data;
+	size_t len;
+
+	if (parser == NULL || spec == NULL)
+		return HUBBUB_BADPARM;
+
+	data = hubbub_speculation_read_input(spec, &len);
+	if (data == NULL)
+		return HUBBUB_BADPARM;
+
+	return parser_parse(parser, data, len, spec);
+}
+
+/**
+ * Parse a chunk of data, perhaps using tokens read ahead
+ *
+ * \param parser  Parser instance to use
+ * \param data    Data to parse (encoded in the input charset)
+ * \param len     Length, in bytes, of data
+ * \param spec    Speculation made from the data, or NULL
+ * \return As for hubbub_parser_parse_chunk
+ */
+hubbub_error parser_parse(hubbub_parser *parser, const uint8_t *data,
+		size_t len, const hubbub_speculation *spec)
 {
 	parserutils_error perror;
 	hubbub_error error;
 
-	if (parser == NULL || data == NULL)
-		return HUBBUB_BADPARM;
+	parser->had_data = true;
 
-	perror = parserutils_inputstream_append(parser->stream, data, len);
-	if (perror != PARSERUTILS_OK)
-		return hubbub_error_from_parserutils_error(perror);
+	if (parser->change_in_place)
+		parser_track_input(parser, data, len);
 
-	error = hubbub_tokeniser_run(parser->tok);
+	parser->raw_len += len;
+
+	/* Keep the bytes which may hold the start of the last character */
+	if (len >= sizeof(parser->raw_tail)) {
+		memcpy(parser->raw_tail, data + len - sizeof(parser->raw_tail),
+				sizeof(parser->raw_tail));
+		parser->raw_tail_len = sizeof(parser->raw_tail);
+	} else {
+		size_t keep = min(parser->raw_tail_len,
+				sizeof(parser->raw_tail) - len);
+
+		memmove(parser->raw_tail,
+				parser->raw_tail + parser->raw_tail_len - keep,
+				keep);
+		memcpy(parser->raw_tail + keep, data, len);
+		parser->raw_tail_len = keep + len;
+	}
+
+	if (parser->borrowing) {
+		error = hubbub_tokeniser_borrow_chunk(parser->tok, data, len);
+		if (error != HUBBUB_OK)
+			return error;
+	} else {
+		perror = parserutils_inputstream_append(parser->stream,
+				data, len);
+		if (perror != PARSERUTILS_OK)
+			return hubbub_error_from_parserutils_error(perror);
+	}
+
+	/* Tokens read ahead are only used as they match the input */
+	if (spec != NULL)
+		error = hubbub_speculation_replay(spec, parser->tok);
+	else
+		error = hubbub_tokeniser_run(parser->tok);
 	if (error == HUBBUB_BADENCODING) {
 		/* Ok, we autodetected an encoding that we don't actually
 		 * support. We've not actually processed any data at this
@@ -264,17 +1371,31 @@ hubbub_error hubbub_parser_parse_chunk(hubbub_parser *parser,
 		error = hubbub_tokeniser_run(parser->tok);
 	}
 
+	/* Continue in the requested encoding, rather than have the client
+	 * start again, if the document so far reads the same in either */
+	while (error == HUBBUB_ENCODINGCHANGE && parser->change_in_place &&
+			parser_change_encoding(parser, data, len) ==
+					HUBBUB_OK) {
+		parser->encoding_changes++;
+		error = hubbub_tokeniser_run(parser->tok);
+	}
+
+	error = parser_flush_batch(parser, error);
+	parser->restarting = (error == HUBBUB_ENCODINGCHANGE);
 	if (error != HUBBUB_OK)
 		return error;
 
-	return HUBBUB_OK;
+	return parser_check_memory(parser);
 }
 
 /**
  * Inform the parser that the last chunk of data has been parsed
  *
  * \param parser  Parser to inform
- * \return HUBBUB_OK on success, appropriate error otherwise
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_YIELDED if the work budget ran out, in which case the
+ *                        rest is parsed by hubbub_parser_resume,
+ *         appropriate error otherwise
  */
 hubbub_error hubbub_parser_completed(hubbub_parser *parser)
 {
@@ -284,15 +1405,55 @@ hubbub_error hubbub_parser_completed(hubbub_parser *parser)
 	if (parser == NULL)
 		return HUBBUB_BADPARM;
 
-	perror = parserutils_inputstream_append(parser->stream, NULL, 0);
-	if (perror != PARSERUTILS_OK)
-		return hubbub_error_from_parserutils_error(perror);
+	parser->had_data = true;
+
+	if (parser->borrowing) {
+		error = hubbub_tokeniser_borrow_chunk(parser->tok, NULL, 0);
+		if (error != HUBBUB_OK)
+			return error;
+	} else {
+		perror = parserutils_inputstream_append(parser->stream,
+				NULL, 0);
+		if (perror != PARSERUTILS_OK)
+			return hubbub_error_from_parserutils_error(perror);
+	}
 
 	error = hubbub_tokeniser_run(parser->tok);
+	error = parser_flush_batch(parser, error);
+	parser->restarting = (error == HUBBUB_ENCODINGCHANGE);
 	if (error != HUBBUB_OK)
 		return error;
 
-	return HUBBUB_OK;
+	return parser_check_memory(parser);
+}
+
+/**
+ * Continue parsing after the work budget ran out
+ *
+ * Parses what remains of the input passed so far, within a new budget.
+ * Unlike hubbub_parser_parse_chunk, this does not change the encoding
+ * in place, as the chunk which would be decoded afresh is gone; the
+ * client is asked to start again instead.
+ *
+ * \param parser  Parser instance to use
+ * \return HUBBUB_OK once the input passed so far is parsed,
+ *         HUBBUB_YIELDED if the work budget ran out again,
+ *         appropriate error otherwise
+ */
+hubbub_error hubbub_parser_resume(hubbub_parser *parser)
+{
+	hubbub_error error;
+
+	if (parser == NULL)
+		return HUBBUB_BADPARM;
+
+	error = hubbub_tokeniser_run(parser->tok);
+	error = parser_flush_batch(parser, error);
+	parser->restarting = (error == HUBBUB_ENCODINGCHANGE);
+	if (error != HUBBUB_OK)
+		return error;
+
+	return parser_check_memory(parser);
 }
 
 /**
@@ -318,3 +1479,219 @@ const char *hubbub_parser_read_charset(hubbub_parser *parser,
 	return name;
 }
 
+/**
+ * Read the adoption agency counts for the current document
+ *
+ * These record how much work misnested formatting markup has cost, and
+ * whether the clone limit cut any of it short.
+ *
+ * \param parser  Parser instance to query
+ * \param counts  Pointer to location to receive counts
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_parser_read_aa_counts(hubbub_parser *parser,
+		hubbub_aa_counts *counts)
+{
+	if (parser == NULL || counts == NULL || parser->tb == NULL)
+		return HUBBUB_BADPARM;
+
+	return hubbub_treebuilder_read_aa_counts(parser->tb, counts);
+}
+
+/**
+ * Read the most room the parser's buffers have needed
+ *
+ * This covers every document parsed since the parser was created, so that
+ * a client which reuses parsers may learn what to ask for with
+ * HUBBUB_PARSER_BUFFER_SIZES when creating more. The depth is 0 if the
+ * parser builds no tree.
+ *
+ * \param parser  Parser instance to query
+ * \param sizes   Pointer to location to receive sizes
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_parser_read_buffer_sizes(hubbub_parser *parser,
+		hubbub_buffer_sizes *sizes)
+{
+	size_t text;
+
+	if (parser == NULL || sizes == NULL)
+		return HUBBUB_BADPARM;
+
+	text = hubbub_tokeniser_read_buffer_size(parser->tok);
+	sizes->text = text > UINT32_MAX ? UINT32_MAX : (uint32_t) text;
+	sizes->depth = parser->tb != NULL ?
+			hubbub_treebuilder_read_max_depth(parser->tb) : 0;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Read the statistics for the current document
+ *
+ * These count the work done on the document since the parser was created
+ * or last reset, for clients which gather figures on the documents that
+ * are costly to parse. Keeping them costs little; only the counts of tree
+ * handler calls must be asked for, with HUBBUB_PARSER_COUNT_TREE_CALLS,
+ * and the times, with HUBBUB_PARSER_MEASURE_TIME; they are otherwise 0.
+ * The time spent parsing is divided between the tokeniser, each insertion
+ * mode of the tree builder and the tree handler; a mode which handles a
+ * token by the rules of another, as tables do in foster parenting, is
+ * charged for it. If the client resets the parser to begin a
+ * document again in the encoding it asked for, as HUBBUB_ENCODINGCHANGE
+ * requests, the count of restarts is carried over; the other counts cover
+ * only the last attempt.
+ *
+ * \param parser  Parser instance to query
+ * \param stats   Pointer to location to receive statistics
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_parser_read_stats(hubbub_parser *parser,
+		hubbub_parser_stats *stats)
+{
+	uint64_t spent;
+	size_t i;
+
+	if (parser == NULL || stats == NULL)
+		return HUBBUB_BADPARM;
+
+	memset(stats, 0, sizeof(hubbub_parser_stats));
+
+	hubbub_tokeniser_read_stats(parser->tok, stats);
+
+	if (parser->tb != NULL)
+		hubbub_treebuilder_read_stats(parser->tb, stats);
+
+	/* The tokeniser's share is whatever the tree builder did not use */
+	spent = stats->tree_ns;
+	for (i = 0; i < HUBBUB_INSERTION_MODES; i++)
+		spent += stats->mode_ns[i];
+	stats->tokeniser_ns = stats->parse_ns > spent ?
+			stats->parse_ns - spent : 0;
+
+	stats->encoding_changes = parser->encoding_changes;
+	stats->restarts = parser->restarts;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Read the name of an insertion mode
+ *
+ * \param mode  Insertion mode, as numbered in trace events and in the
+ *              parse statistics
+ * \return Name of the mode (constant), or NULL if there is no such mode
+ */
+const char *hubbub_parser_mode_name(uint32_t mode)
+{
+	return hubbub_treebuilder_mode_name(mode);
+}
+
+/**
+ * Find the content model a treebuilder selects after a start tag
+ *
+ * A parser without a treebuilder leaves the content model as it is after
+ * start tags. Its token handler may pass each start tag here, and set the
+ * result with HUBBUB_PARSER_CONTENT_MODEL, in order to read text as the
+ * treebuilder does, unless it knows better (for example, that the element
+ * is not in the HTML namespace). The content model returns to PCDATA after
+ * the end tag matching the start tag without further ado.
+ *
+ * \param tag        A start tag, as emitted by the tokeniser
+ * \param scripting  Whether scripting is enabled, as that changes how the
+ *                   content of noscript elements is read
+ * \return The content model to read the element's content in
+ */
+hubbub_content_model hubbub_parser_content_model_for(const hubbub_tag *tag,
+		bool scripting)
+{
+	switch (element_type_from_atom(tag->atom)) {
+	case TEXTAREA:
+	case TITLE:
+		return HUBBUB_CONTENT_MODEL_RCDATA;
+	case NOSCRIPT:
+		if (scripting == false)
+			return HUBBUB_CONTENT_MODEL_PCDATA;
+		/* Fall through */
+	case IFRAME:
+	case NOEMBED:
+	case NOFRAMES:
+	case SCRIPT:
+	case STYLE:
+	case XMP:
+		return HUBBUB_CONTENT_MODEL_CDATA;
+	case PLAINTEXT:
+		return HUBBUB_CONTENT_MODEL_PLAINTEXT;
+	default:
+		return HUBBUB_CONTENT_MODEL_PCDATA;
+	}
+}
+
+/**
+ * Read the memory held by a parser
+ *
+ * This counts the memory held by the parser's tokeniser and treebuilder,
+ * and in the libparserutils buffers they use, but not the parser object
+ * itself or the input stream's private buffer of raw input. The peak and
+ * the count of allocations cover the current document; the memory kept
+ * across a reset is counted in the peak of the next.
+ *
+ * With HUBBUB_PARSER_MEMORY_LIMIT, any allocation which would take the
+ * parser over its limit fails, and the parse with it, with HUBBUB_NOMEM.
+ * The libparserutils buffers are counted after each chunk of input is
+ * parsed, so may take the parser over its limit by about that much.
+ *
+ * \param parser  Parser instance to query
+ * \param usage   Pointer to location to receive memory usage
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_parser_read_memory_usage(hubbub_parser *parser,
+		hubbub_memory_usage *usage)
+{
+	if (parser == NULL || usage == NULL)
+		return HUBBUB_BADPARM;
+
+	/* Being over the limit is reported by the parse, not here */
+	parser_check_memory(parser);
+
+	usage->current = parser->account.held + parser->account.external;
+	usage->peak = parser->account.peak;
+	usage->limit = parser->account.limit;
+	usage->allocations = parser->account.allocations;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Find where a string lies in the input a parser borrows
+ *
+ * When the parser reads its input in place (see HUBBUB_PARSER_BORROW_INPUT),
+ * the strings it passes to the client for spans of the input which need no
+ * change, such as most attribute values and runs of text, point into that
+ * input. Such a string remains valid for as long as the input does, so the
+ * client may keep its offset and length in place of a copy, and read it
+ * from the input when it is needed. Any other string is held by the parser,
+ * and, as usual, is valid only until the callback which received it
+ * returns.
+ *
+ * The offset is from the start of the first chunk of the document, so
+ * counts any byte order mark.
+ *
+ * \param parser  Parser instance
+ * \param str     String passed to the client by the parser
+ * \param offset  Pointer to location to receive offset of the string
+ * \return HUBBUB_OK if the string lies in the borrowed input,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_INVALID if the string is held by the parser
+ */
+hubbub_error hubbub_parser_source_offset(hubbub_parser *parser,
+		const hubbub_string *str, size_t *offset)
+{
+	if (parser == NULL || str == NULL || offset == NULL)
+		return HUBBUB_BADPARM;
+
+	if (hubbub_tokeniser_source_offset(parser->tok, str, offset) == false)
+		return HUBBUB_INVALID;
+
+	return HUBBUB_OK;
+}
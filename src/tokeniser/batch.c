@@ -0,0 +1,392 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 The NetSurf Project.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <hubbub/parser.h>
+
+#include "tokeniser/batch.h"
+#include "utils/utils.h"
+
+/** Number of tokens to collect before calling the handler */
+#define BATCH_TOKENS 64
+
+/** Granularity with which string storage is grown */
+#define BATCH_DATA_CHUNK 4096
+
+/**
+ * Token batch
+ *
+ * The tokeniser's strings only live until its token handler returns, so
+ * each token is copied in. Until the batch is delivered, the string
+ * pointers of the copies hold offsets into \a data and the attribute
+ * pointers hold indices into \a attrs, as either array may move as it
+ * grows. They are turned back into pointers immediately before delivery.
+ */
+struct hubbub_token_batch {
+	hubbub_token tokens[BATCH_TOKENS];	/**< Collected tokens */
+	uint32_t n_tokens;		/**< Number of collected tokens */
+
+	hubbub_attribute *attrs;	/**< Attributes of collected tags */
+	uint32_t n_attrs;		/**< Number of attributes in use */
+	uint32_t attr_alloc;		/**< Number of attributes allocated */
+
+	uint8_t *data;			/**< String data of collected tokens */
+	size_t data_len;		/**< Bytes of string data in use */
+	size_t data_alloc;		/**< Bytes of string data allocated */
+
+	hubbub_token_batch_handler handler;	/**< Batch handler */
+	void *handler_pw;			/**< Batch handler data */
+
+	hubbub_allocator_fn alloc;	/**< Memory (de)allocation function */
+	void *alloc_pw;			/**< Client private data */
+};
+
+static hubbub_error batch_copy_string(hubbub_token_batch *batch,
+		hubbub_string *str);
+static hubbub_error batch_copy_attributes(hubbub_token_batch *batch,
+		hubbub_tag *tag);
+static void batch_fix_string(hubbub_token_batch *batch, hubbub_string *str);
+
+/**
+ * Create a token batch
+ *
+ * \param alloc  Memory (de)allocation function
+ * \param pw     Pointer to client-specific private data (may be NULL)
+ * \param batch  Pointer to location to receive batch instance
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_NOMEM on memory exhaustion
+ */
+hubbub_error hubbub_token_batch_create(hubbub_allocator_fn alloc, void *pw,
+		hubbub_token_batch **batch)
+{
+	hubbub_token_batch *b;
+
+	if (alloc == NULL || batch == NULL)
+		return HUBBUB_BADPARM;
+
+	b = alloc(NULL, sizeof(hubbub_token_batch), pw);
+	if (b == NULL)
+		return HUBBUB_NOMEM;
+
+	b->n_tokens = 0;
+
+	b->attrs = NULL;
+	b->n_attrs = 0;
+	b->attr_alloc = 0;
+
+	b->data = NULL;
+	b->data_len = 0;
+	b->data_alloc = 0;
+
+	b->handler = NULL;
+	b->handler_pw = NULL;
+
+	b->alloc = alloc;
+	b->alloc_pw = pw;
+
+	*batch = b;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Destroy a token batch
+ *
+ * Any tokens which have not been delivered are lost.
+ *
+ * \param batch  The batch instance to destroy
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_token_batch_destroy(hubbub_token_batch *batch)
+{
+	if (batch == NULL)
+		return HUBBUB_BADPARM;
+
+	if (batch->attrs != NULL)
+		batch->alloc(batch->attrs, 0, batch->alloc_pw);
+
+	if (batch->data != NULL)
+		batch->alloc(batch->data, 0, batch->alloc_pw);
+
+	batch->alloc(batch, 0, batch->alloc_pw);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Set the handler to which a batch delivers its tokens
+ *
+ * \param batch    The batch instance to configure
+ * \param handler  Batch handler, or NULL to drop tokens
+ * \param pw       Pointer to client data for \p handler
+ */
+void hubbub_token_batch_set_handler(hubbub_token_batch *batch,
+		hubbub_token_batch_handler handler, void *pw)
+{
+	assert(batch != NULL);
+
+	batch->handler = handler;
+	batch->handler_pw = pw;
+}
+
+/**
+ * Token handler adding a copy of a token to a batch
+ *
+ * The batch is delivered once it is full, once it holds the EOF token, or
+ * after a start tag which the treebuilder would follow with a change of
+ * content model.
+ *
+ * \param token  The token to add
+ * \param pw     The batch instance to add to
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_token_batch_append(const hubbub_token *token, void *pw)
+{
+	hubbub_token_batch *batch = (hubbub_token_batch *) pw;
+	hubbub_token *copy;
+	hubbub_error error = HUBBUB_OK;
+
+	assert(batch->n_tokens < BATCH_TOKENS);
+
+	copy = &batch->tokens[batch->n_tokens];
+	*copy = *token;
+
+	switch (copy->type) {
+	case HUBBUB_TOKEN_DOCTYPE:
+		error = batch_copy_string(batch, &copy->data.doctype.name);
+		if (error == HUBBUB_OK)
+			error = batch_copy_string(batch,
+					&copy->data.doctype.public_id);
+		if (error == HUBBUB_OK)
+			error = batch_copy_string(batch,
+					&copy->data.doctype.system_id);
+		break;
+	case HUBBUB_TOKEN_START_TAG:
+	case HUBBUB_TOKEN_END_TAG:
+		error = batch_copy_string(batch, &copy->data.tag.name);
+		if (error == HUBBUB_OK)
+			error = batch_copy_attributes(batch, &copy->data.tag);
+		break;
+	case HUBBUB_TOKEN_COMMENT:
+		error = batch_copy_string(batch, &copy->data.comment);
+		break;
+	case HUBBUB_TOKEN_CHARACTER:
+		error = batch_copy_string(batch, &copy->data.character);
+		break;
+	case HUBBUB_TOKEN_EOF:
+		break;
+	}
+
+	if (error != HUBBUB_OK)
+		return error;
+
+	batch->n_tokens++;
+
+	if (batch->n_tokens == BATCH_TOKENS || token->type == HUBBUB_TOKEN_EOF)
+		return hubbub_token_batch_flush(batch);
+
+	/* The handler may switch the content model after a start tag, as
+	 * the treebuilder would, which must happen before the tokeniser
+	 * reads on. Scripting only adds noscript, so is assumed. */
+	if (token->type == HUBBUB_TOKEN_START_TAG &&
+			hubbub_parser_content_model_for(&token->data.tag,
+			true) != HUBBUB_CONTENT_MODEL_PCDATA)
+		return hubbub_token_batch_flush(batch);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Deliver the tokens held by a batch
+ *
+ * The batch is emptied whatever the handler returns.
+ *
+ * \param batch  The batch instance to deliver
+ * \return HUBBUB_OK on success, or the handler's result
+ */
+hubbub_error hubbub_token_batch_flush(hubbub_token_batch *batch)
+{
+	hubbub_error error = HUBBUB_OK;
+	uint32_t i, j;
+
+	assert(batch != NULL);
+
+	if (batch->n_tokens == 0)
+		return HUBBUB_OK;
+
+	for (i = 0; i < batch->n_tokens; i++) {
+		hubbub_token *token = &batch->tokens[i];
+
+		switch (token->type) {
+		case HUBBUB_TOKEN_DOCTYPE:
+		{
+			hubbub_doctype *doctype = &token->data.doctype;
+
+			batch_fix_string(batch, &doctype->name);
+			batch_fix_string(batch, &doctype->public_id);
+			batch_fix_string(batch, &doctype->system_id);
+		}
+			break;
+		case HUBBUB_TOKEN_START_TAG:
+		case HUBBUB_TOKEN_END_TAG:
+			batch_fix_string(batch, &token->data.tag.name);
+
+			if (token->data.tag.n_attributes == 0)
+				break;
+
+			token->data.tag.attributes = batch->attrs +
+				(uintptr_t) token->data.tag.attributes;
+
+			for (j = 0; j < token->data.tag.n_attributes; j++) {
+				hubbub_attribute *attr =
+						&token->data.tag.attributes[j];
+
+				batch_fix_string(batch, &attr->name);
+				batch_fix_string(batch, &attr->value);
+			}
+			break;
+		case HUBBUB_TOKEN_COMMENT:
+			batch_fix_string(batch, &token->data.comment);
+			break;
+		case HUBBUB_TOKEN_CHARACTER:
+			batch_fix_string(batch, &token->data.character);
+			break;
+		case HUBBUB_TOKEN_EOF:
+			break;
+		}
+	}
+
+	if (batch->handler != NULL) {
+		error = batch->handler(batch->tokens, batch->n_tokens,
+				batch->handler_pw);
+	}
+
+	hubbub_token_batch_discard(batch);
+
+	return error;
+}
+
+/**
+ * Drop the tokens held by a batch, without delivering them
+ *
+ * \param batch  The batch instance to empty
+ */
+void hubbub_token_batch_discard(hubbub_token_batch *batch)
+{
+	assert(batch != NULL);
+
+	batch->n_tokens = 0;
+	batch->n_attrs = 0;
+	batch->data_len = 0;
+}
+
+/**
+ * Copy a string into a batch's string storage
+ *
+ * \param batch  The batch instance
+ * \param str    String to copy; updated to hold its offset in the storage
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ */
+hubbub_error batch_copy_string(hubbub_token_batch *batch, hubbub_string *str)
+{
+	if (batch->data_len + str->len > batch->data_alloc) {
+		size_t alloc = batch->data_len + str->len + BATCH_DATA_CHUNK;
+		uint8_t *data;
+
+		alloc -= alloc % BATCH_DATA_CHUNK;
+
+		data = batch->alloc(batch->data, alloc, batch->alloc_pw);
+		if (data == NULL)
+			return HUBBUB_NOMEM;
+
+		batch->data = data;
+		batch->data_alloc = alloc;
+	}
+
+	if (str->len > 0)
+		memcpy(batch->data + batch->data_len, str->ptr, str->len);
+
+	str->ptr = (const uint8_t *) (uintptr_t) batch->data_len;
+	batch->data_len += str->len;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Copy the attributes of a tag into a batch
+ *
+ * \param batch  The batch instance
+ * \param tag    Tag whose attributes to copy; updated to hold the index
+ *               of its first attribute in the batch
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ */
+hubbub_error batch_copy_attributes(hubbub_token_batch *batch,
+		hubbub_tag *tag)
+{
+	hubbub_attribute *attrs;
+	hubbub_error error;
+	uint32_t i;
+
+	if (tag->n_attributes == 0) {
+		tag->attributes = NULL;
+		return HUBBUB_OK;
+	}
+
+	if (batch->n_attrs + tag->n_attributes > batch->attr_alloc) {
+		uint32_t alloc = max(batch->attr_alloc, BATCH_TOKENS);
+
+		while (alloc < batch->n_attrs + tag->n_attributes)
+			alloc *= 2;
+
+		attrs = batch->alloc(batch->attrs,
+				alloc * sizeof(hubbub_attribute),
+				batch->alloc_pw);
+		if (attrs == NULL)
+			return HUBBUB_NOMEM;
+
+		batch->attrs = attrs;
+		batch->attr_alloc = alloc;
+	}
+
+	attrs = batch->attrs + batch->n_attrs;
+	memcpy(attrs, tag->attributes,
+			tag->n_attributes * sizeof(hubbub_attribute));
+
+	for (i = 0; i < tag->n_attributes; i++) {
+		error = batch_copy_string(batch, &attrs[i].name);
+		if (error != HUBBUB_OK)
+			return error;
+
+		error = batch_copy_string(batch, &attrs[i].value);
+		if (error != HUBBUB_OK)
+			return error;
+	}
+
+	tag->attributes = (hubbub_attribute *) (uintptr_t) batch->n_attrs;
+	batch->n_attrs += tag->n_attributes;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Turn a string's storage offset back into a pointer
+ *
+ * \param batch  The batch instance
+ * \param str    String to fix up
+ */
+void batch_fix_string(hubbub_token_batch *batch, hubbub_string *str)
+{
+	/* Nothing has been stored if the storage was never allocated */
+	if (batch->data != NULL)
+		str->ptr = batch->data + (uintptr_t) str->ptr;
+	else
+		str->ptr = NULL;
+}
@@ -0,0 +1,38 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 The NetSurf Project.
+ */
+
+#ifndef hubbub_tokeniser_batch_h_
+#define hubbub_tokeniser_batch_h_
+
+#include <inttypes.h>
+
+#include <hubbub/errors.h>
+#include <hubbub/functypes.h>
+#include <hubbub/types.h>
+
+typedef struct hubbub_token_batch hubbub_token_batch;
+
+/* Create a token batch */
+hubbub_error hubbub_token_batch_create(hubbub_allocator_fn alloc, void *pw,
+		hubbub_token_batch **batch);
+/* Destroy a token batch */
+hubbub_error hubbub_token_batch_destroy(hubbub_token_batch *batch);
+
+/* Set the handler to which a batch delivers its tokens */
+void hubbub_token_batch_set_handler(hubbub_token_batch *batch,
+		hubbub_token_batch_handler handler, void *pw);
+
+/* Token handler adding a copy of a token to a batch */
+hubbub_error hubbub_token_batch_append(const hubbub_token *token, void *pw);
+
+/* Deliver the tokens held by a batch */
+hubbub_error hubbub_token_batch_flush(hubbub_token_batch *batch);
+
+/* Drop the tokens held by a batch, without delivering them */
+void hubbub_token_batch_discard(hubbub_token_batch *batch);
+
+#endif
@@ -8,20 +8,16 @@
 #include "utils/utils.h"
 #include "tokeniser/entities.h"
 
-/** Node in our entity tree */
-typedef struct hubbub_entity_node {
-        /* Do not reorder this without fixing make-entities.pl */
-	uint8_t split;	/**< Data to split on */
-	int32_t lt;	/**< Subtree for data less than split */
-	int32_t eq;	/**< Subtree for data equal to split */
-	int32_t gt;	/**< Subtree for data greater than split */
-	uint32_t value;	/**< Data for this node */
-} hubbub_entity_node;
-
+/* The entity dictionary is a trie, stored as four parallel arrays indexed
+ * by node number. Node 0 is the root. The children of each node are
+ * numbered contiguously, starting at entity_first[node], and there are
+ * entity_count[node] of them, in ascending order of entity_label[]. A
+ * node's entity_value[] is the codepoint of the entity ending there, or 0
+ * if there is none. */
 #include "entities.inc"
 
 /**
- * Step-wise search for a key in our entity tree
+ * Step-wise search for a key in our entity trie
  *
  * \param c        Character to look for
  * \param result   Pointer to location for result
@@ -30,57 +26,44 @@ typedef struct hubbub_entity_node {
  *         HUBBUB_NEEDDATA if more steps are required
  *         HUBBUB_INVALID if nothing matches
  *
- * The value pointed to by \p context must be NULL for the first call.
+ * The value pointed to by \p context must be -1 for the first call.
  * Thereafter, pass in the same value as returned by the previous call.
  * The context is opaque to the caller and should not be inspected.
  *
- * The location pointed to by \p result will be set to NULL unless a match
- * is found.
+ * The location pointed to by \p result is only written if a match is found.
  */
-static hubbub_error hubbub_entity_tree_search_step(uint8_t c,
+static hubbub_error hubbub_entity_trie_search_step(uint8_t c,
 		uint32_t *result, int32_t *context)
 {
-	bool match = false;
+	const uint8_t *label, *end;
 	int32_t p;
 
 	if (result == NULL || context == NULL)
 		return HUBBUB_BADPARM;
 
-	if (*context == -1) {
-		p = dict_root;
-	} else {
-		p = *context;
-	}
+	p = (*context == -1) ? 0 : *context;
 
-	while (p != -1) {
-		if (c < dict[p].split) {
-			p = dict[p].lt;
-		} else if (c == dict[p].split) {
-			if (dict[p].split == '\0') {
-				match = true;
-				p = -1;
-			} else if (dict[p].eq != -1 && dict[dict[p].eq].split == '\0') {
-				match = true;
-				*result = dict[dict[p].eq].value;
-				p = dict[p].eq;
-			} else if (dict[p].value != 0) {
-				match = true;
-				*result = dict[p].value;
-				p = dict[p].eq;
-			} else {
-				p = dict[p].eq;
-			}
+	/* Scan the (sorted) labels of this node's children */
+	label = entity_label + entity_first[p];
+	end = label + entity_count[p];
 
-			break;
-		} else {
-			p = dict[p].gt;
-		}
+	while (label < end && *label < c)
+		label++;
+
+	if (label == end || *label != c) {
+		*context = -1;
+		return HUBBUB_INVALID;
 	}
 
+	p = label - entity_label;
 	*context = p;
 
-	return (match) ? HUBBUB_OK :
-			(p == -1) ? HUBBUB_INVALID : HUBBUB_NEEDDATA;
+	if (entity_value[p] != 0) {
+		*result = entity_value[p];
+		return HUBBUB_OK;
+	}
+
+	return HUBBUB_NEEDDATA;
 }
 
 /**
@@ -108,5 +91,5 @@ hubbub_error hubbub_entities_search_step(uint8_t c, uint32_t *result,
 
         *result = 0xFFFD;
         
-	return hubbub_entity_tree_search_step(c, result, context);
+	return hubbub_entity_trie_search_step(c, result, context);
 }
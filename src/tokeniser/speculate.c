@@ -0,0 +1,672 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 The NetSurf Project.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <parserutils/input/inputstream.h>
+
+#include <hubbub/parser.h>
+#include <hubbub/speculate.h>
+
+#include "charset/detect.h"
+#include "tokeniser/speculate.h"
+#include "tokeniser/tokeniser.h"
+#include "treebuilder/element-type.h"
+#include "utils/parserutilserror.h"
+#include "utils/utf8.h"
+#include "utils/utils.h"
+
+/** Number of tokens for which space is first allocated */
+#define SPECULATION_TOKENS 256
+
+/** Granularity with which string storage is grown */
+#define SPECULATION_DATA_CHUNK 4096
+
+/**
+ * Speculation
+ *
+ * Tokens are copied in as they are read, as the tokeniser's strings only
+ * live until its token handler returns. Until the input has been read,
+ * the string pointers of the copies hold offsets into \a data and the
+ * attribute pointers hold indices into \a attrs, as either array may move
+ * as it grows.
+ *
+ * Adjacent character tokens are merged. Only tokens up to the end of the
+ * last tag, comment or DOCTYPE are kept, so that the parser may continue
+ * from the end of any of them in the data state.
+ */
+struct hubbub_speculation {
+	parserutils_inputstream *stream;	/**< Input stream, which the
+						 * tokeniser needs but never
+						 * reads */
+	hubbub_tokeniser *tok;		/**< Tokeniser reading ahead */
+
+	const uint8_t *input;		/**< Input last tokenised, or NULL */
+	size_t input_len;		/**< Length, in bytes, of input */
+	size_t end;			/**< End of the last token kept */
+	hubbub_content_model model;	/**< Content model which the parser
+					 * is expected to select */
+	bool in_text;			/**< Whether the last token is text,
+					 * which may yet be continued */
+
+	hubbub_replay_token *tokens;	/**< Tokens read so far */
+	size_t n_tokens;		/**< Number of tokens read */
+	size_t n_kept;			/**< Number of those to be kept */
+	size_t token_alloc;		/**< Number of tokens allocated */
+
+	hubbub_attribute *attrs;	/**< Attributes of tags read */
+	size_t n_attrs;			/**< Number of attributes in use */
+	size_t attr_alloc;		/**< Number of attributes allocated */
+
+	uint8_t *data;			/**< String data of tokens read */
+	size_t data_len;		/**< Bytes of string data in use */
+	size_t data_alloc;		/**< Bytes of string data allocated */
+
+	hubbub_allocator_fn alloc;	/**< Memory (de)allocation function */
+	void *alloc_pw;			/**< Client private data */
+};
+
+static hubbub_error speculation_handle_token(const hubbub_token *token,
+		void *pw);
+static hubbub_error speculation_add_text(hubbub_speculation *spec,
+		const hubbub_string *text);
+static hubbub_error speculation_add_token(hubbub_speculation *spec,
+		const hubbub_token *token, hubbub_replay_token **added);
+static hubbub_content_model speculation_predict(const hubbub_tag *tag);
+static hubbub_error speculation_copy_string(hubbub_speculation *spec,
+		hubbub_string *str);
+static hubbub_error speculation_copy_attributes(hubbub_speculation *spec,
+		hubbub_tag *tag);
+static void speculation_fix_tokens(hubbub_speculation *spec);
+static void speculation_fix_string(hubbub_speculation *spec,
+		hubbub_string *str);
+
+/**
+ * Create a speculation
+ *
+ * \param alloc  Memory (de)allocation function, or NULL for the default
+ * \param pw     Pointer to client-specific private data (may be NULL)
+ * \param spec   Pointer to location to receive speculation instance
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_NOMEM on memory exhaustion
+ */
+hubbub_error hubbub_speculation_create(hubbub_allocator_fn alloc, void *pw,
+		hubbub_speculation **spec)
+{
+	hubbub_tokeniser_optparams params;
+	parserutils_error perror;
+	hubbub_speculation *s;
+	hubbub_error error;
+
+	if (spec == NULL)
+		return HUBBUB_BADPARM;
+
+	if (alloc == NULL)
+		alloc = hubbub_default_alloc;
+
+	s = alloc(NULL, sizeof(hubbub_speculation), pw);
+	if (s == NULL)
+		return HUBBUB_NOMEM;
+
+	memset(s, 0, sizeof(hubbub_speculation));
+
+	s->alloc = alloc;
+	s->alloc_pw = pw;
+
+	/* Only borrowed UTF-8 is ever tokenised */
+	perror = parserutils_inputstream_create("UTF-8",
+			HUBBUB_CHARSET_CONFIDENT, hubbub_charset_extract,
+			&s->stream);
+	if (perror != PARSERUTILS_OK) {
+		alloc(s, 0, pw);
+		return hubbub_error_from_parserutils_error(perror);
+	}
+
+	error = hubbub_tokeniser_create(s->stream, alloc, pw, &s->tok);
+	if (error != HUBBUB_OK) {
+		parserutils_inputstream_destroy(s->stream);
+		alloc(s, 0, pw);
+		return error;
+	}
+
+	params.token_handler.handler = speculation_handle_token;
+	params.token_handler.pw = s;
+	hubbub_tokeniser_setopt(s->tok, HUBBUB_TOKENISER_TOKEN_HANDLER,
+			&params);
+
+	*spec = s;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Destroy a speculation
+ *
+ * \param spec  The speculation instance to destroy
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_speculation_destroy(hubbub_speculation *spec)
+{
+	if (spec == NULL)
+		return HUBBUB_BADPARM;
+
+	hubbub_tokeniser_destroy(spec->tok);
+	parserutils_inputstream_destroy(spec->stream);
+
+	if (spec->tokens != NULL)
+		spec->alloc(spec->tokens, 0, spec->alloc_pw);
+
+	if (spec->attrs != NULL)
+		spec->alloc(spec->attrs, 0, spec->alloc_pw);
+
+	if (spec->data != NULL)
+		spec->alloc(spec->data, 0, spec->alloc_pw);
+
+	spec->alloc(spec, 0, spec->alloc_pw);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Find a point at which a document may be split for speculation
+ *
+ * A part should begin with a tag which directly follows another, as these
+ * are rarely within a script, style sheet, comment or attribute value.
+ * Should a part begin within one nonetheless, its speculation is found
+ * not to match when it is parsed, and costs only the time taken to make.
+ *
+ * \param data    The document
+ * \param len     Length, in bytes, of \p data
+ * \param offset  Offset from which to look
+ * \return Offset of the first '<' after \p offset which directly follows
+ *         a '>', or \p len if there is none
+ */
+size_t hubbub_speculation_split(const uint8_t *data, size_t len,
+		size_t offset)
+{
+	const uint8_t *lt;
+
+	if (data == NULL)
+		return len;
+
+	for (offset++; offset < len; offset = lt - data + 1) {
+		lt = memchr(data + offset, '<', len - offset);
+		if (lt == NULL)
+			break;
+
+		if (lt[-1] == '>')
+			return lt - data;
+	}
+
+	return len;
+}
+
+/**
+ * Tokenise part of a document ahead of the parser
+ *
+ * The part is tokenised as if it began in the data state, with the PCDATA
+ * content model. After each start tag, the content model selected is that
+ * which the treebuilder would select for an HTML element of that name.
+ *
+ * The part must be in UTF-8, and remain valid until it has been parsed.
+ * Nothing is read unless it begins with a '<' and is valid UTF-8, save
+ * perhaps for a truncated character at the end; its speculation will
+ * have no effect.
+ *
+ * \param spec  The speculation instance to use
+ * \param data  Part of a document
+ * \param len   Length, in bytes, of \p data
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_speculation_run(hubbub_speculation *spec,
+		const uint8_t *data, size_t len)
+{
+	hubbub_error error;
+	bool truncated;
+
+	if (spec == NULL || data == NULL)
+		return HUBBUB_BADPARM;
+
+	spec->input = data;
+	spec->input_len = len;
+	spec->end = 0;
+	spec->model = HUBBUB_CONTENT_MODEL_PCDATA;
+	spec->in_text = false;
+
+	spec->n_tokens = 0;
+	spec->n_kept = 0;
+	spec->n_attrs = 0;
+	spec->data_len = 0;
+
+	if (len == 0 || data[0] != '<')
+		return HUBBUB_OK;
+
+	/* The parser would move such input out of place */
+	if (hubbub_utf8_valid_length(data, len, &truncated) < len &&
+			truncated == false)
+		return HUBBUB_OK;
+
+	error = hubbub_tokeniser_reset(spec->tok, spec->stream);
+	if (error == HUBBUB_OK)
+		error = hubbub_tokeniser_borrow_chunk(spec->tok, data, len);
+
+	/* The token handler stops at any token it cannot place */
+	if (error == HUBBUB_OK)
+		error = hubbub_tokeniser_run(spec->tok);
+
+	if (error != HUBBUB_OK && error != HUBBUB_STOPPED) {
+		spec->n_tokens = 0;
+		spec->end = 0;
+		return error;
+	}
+
+	spec->n_tokens = spec->n_kept;
+	speculation_fix_tokens(spec);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Read the number of bytes of input covered by a speculation's tokens
+ *
+ * \param spec  The speculation instance
+ * \return Length, in bytes, of the input which has been tokenised ahead
+ */
+size_t hubbub_speculation_read_length(const hubbub_speculation *spec)
+{
+	assert(spec != NULL);
+
+	return spec->end;
+}
+
+/**
+ * Read the input from which a speculation was made
+ *
+ * \param spec  The speculation instance
+ * \param len   Pointer to location to receive length, in bytes, of input
+ * \return Pointer to the input, or NULL if nothing has been tokenised
+ */
+const uint8_t *hubbub_speculation_read_input(const hubbub_speculation *spec,
+		size_t *len)
+{
+	assert(spec != NULL);
+
+	*len = spec->input_len;
+
+	return spec->input;
+}
+
+/**
+ * Have a tokeniser emit the tokens of a speculation
+ *
+ * \param spec       The speculation instance
+ * \param tokeniser  Tokeniser which has been given the speculation's input
+ * \return As for hubbub_tokeniser_replay
+ */
+hubbub_error hubbub_speculation_replay(const hubbub_speculation *spec,
+		hubbub_tokeniser *tokeniser)
+{
+	assert(spec != NULL);
+
+	return hubbub_tokeniser_replay(tokeniser, spec->input, spec->tokens,
+			spec->n_tokens);
+}
+
+/**
+ * Token handler for reading ahead
+ *
+ * \param token  The token read
+ * \param pw     The speculation instance
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_STOPPED if the token cannot be placed in the input,
+ *         appropriate error otherwise
+ */
+hubbub_error speculation_handle_token(const hubbub_token *token, void *pw)
+{
+	hubbub_speculation *spec = (hubbub_speculation *) pw;
+	hubbub_replay_token *added;
+	hubbub_error error;
+	size_t start;
+
+	if (token->type == HUBBUB_TOKEN_CHARACTER)
+		return speculation_add_text(spec, &token->data.character);
+
+	if (token->type == HUBBUB_TOKEN_EOF)
+		return HUBBUB_OK;
+
+	/* Tags begin at the current position, but the opening markup of
+	 * comments and DOCTYPEs has been consumed by now */
+	start = hubbub_tokeniser_read_offset(spec->tok);
+	if (start >= spec->input_len)
+		return HUBBUB_STOPPED;
+
+	while (start > spec->end && spec->input[start] != '<')
+		start--;
+
+	if (spec->input[start] != '<')
+		return HUBBUB_STOPPED;
+
+	/* Preceding text ends where this token begins */
+	if (spec->in_text) {
+		spec->tokens[spec->n_tokens - 1].end = start;
+		spec->in_text = false;
+	}
+
+	error = speculation_add_token(spec, token, &added);
+	if (error != HUBBUB_OK)
+		return error;
+
+	added->end = hubbub_tokeniser_read_token_end(spec->tok);
+
+	spec->end = added->end;
+	spec->n_kept = spec->n_tokens;
+
+	if (token->type == HUBBUB_TOKEN_START_TAG) {
+		spec->model = speculation_predict(&token->data.tag);
+
+		if (spec->model != HUBBUB_CONTENT_MODEL_PCDATA) {
+			hubbub_tokeniser_optparams params;
+
+			params.content_model.model = spec->model;
+			hubbub_tokeniser_setopt(spec->tok,
+					HUBBUB_TOKENISER_CONTENT_MODEL,
+					&params);
+		}
+	} else if (token->type == HUBBUB_TOKEN_END_TAG) {
+		/* As the tokeniser itself does */
+		spec->model = HUBBUB_CONTENT_MODEL_PCDATA;
+	}
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Add text to a speculation, continuing any text which precedes it
+ *
+ * \param spec  The speculation instance
+ * \param text  Text read
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ */
+hubbub_error speculation_add_text(hubbub_speculation *spec,
+		const hubbub_string *text)
+{
+	hubbub_string copy = *text;
+	hubbub_replay_token *added;
+	hubbub_token token;
+	hubbub_error error;
+
+	/* The text's copy directly follows that of the text before it */
+	if (spec->in_text) {
+		error = speculation_copy_string(spec, &copy);
+		if (error == HUBBUB_OK) {
+			spec->tokens[spec->n_tokens - 1].token.data.character
+					.len += copy.len;
+		}
+
+		return error;
+	}
+
+	token.type = HUBBUB_TOKEN_CHARACTER;
+	token.data.character = *text;
+
+	error = speculation_add_token(spec, &token, &added);
+	if (error == HUBBUB_OK)
+		spec->in_text = true;
+
+	return error;
+}
+
+/**
+ * Add a copy of a token to a speculation
+ *
+ * \param spec   The speculation instance
+ * \param token  The token to add
+ * \param added  Pointer to location to receive the copy
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ */
+hubbub_error speculation_add_token(hubbub_speculation *spec,
+		const hubbub_token *token, hubbub_replay_token **added)
+{
+	hubbub_replay_token *copy;
+	hubbub_error error = HUBBUB_OK;
+
+	if (spec->n_tokens == spec->token_alloc) {
+		size_t alloc = max(spec->token_alloc * 2, SPECULATION_TOKENS);
+		hubbub_replay_token *tokens;
+
+		tokens = spec->alloc(spec->tokens,
+				alloc * sizeof(hubbub_replay_token),
+				spec->alloc_pw);
+		if (tokens == NULL)
+			return HUBBUB_NOMEM;
+
+		spec->tokens = tokens;
+		spec->token_alloc = alloc;
+	}
+
+	copy = &spec->tokens[spec->n_tokens];
+	copy->token = *token;
+	copy->end = 0;
+	copy->model = spec->model;
+
+	switch (copy->token.type) {
+	case HUBBUB_TOKEN_DOCTYPE:
+	{
+		hubbub_doctype *doctype = &copy->token.data.doctype;
+
+		error = speculation_copy_string(spec, &doctype->name);
+		if (error == HUBBUB_OK)
+			error = speculation_copy_string(spec,
+					&doctype->public_id);
+		if (error == HUBBUB_OK)
+			error = speculation_copy_string(spec,
+					&doctype->system_id);
+	}
+		break;
+	case HUBBUB_TOKEN_START_TAG:
+	case HUBBUB_TOKEN_END_TAG:
+		error = speculation_copy_string(spec,
+				&copy->token.data.tag.name);
+		if (error == HUBBUB_OK)
+			error = speculation_copy_attributes(spec,
+					&copy->token.data.tag);
+		break;
+	case HUBBUB_TOKEN_COMMENT:
+		error = speculation_copy_string(spec,
+				&copy->token.data.comment);
+		break;
+	case HUBBUB_TOKEN_CHARACTER:
+		error = speculation_copy_string(spec,
+				&copy->token.data.character);
+		break;
+	case HUBBUB_TOKEN_EOF:
+		break;
+	}
+
+	if (error != HUBBUB_OK)
+		return error;
+
+	spec->n_tokens++;
+	*added = copy;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Predict the content model which will follow a start tag
+ *
+ * \param tag  The start tag
+ * \return The content model which the treebuilder selects for such an
+ *         element in the HTML namespace
+ */
+hubbub_content_model speculation_predict(const hubbub_tag *tag)
+{
+	/* Including noscript, which depends on scripting */
+	return hubbub_parser_content_model_for(tag, false);
+}
+
+/**
+ * Copy a string into a speculation's string storage
+ *
+ * \param spec  The speculation instance
+ * \param str   String to copy; updated to hold its offset in the storage
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ */
+hubbub_error speculation_copy_string(hubbub_speculation *spec,
+		hubbub_string *str)
+{
+	if (spec->data_len + str->len > spec->data_alloc) {
+		size_t alloc = max(spec->data_alloc * 2,
+				spec->data_len + str->len +
+				SPECULATION_DATA_CHUNK);
+		uint8_t *data;
+
+		alloc -= alloc % SPECULATION_DATA_CHUNK;
+
+		data = spec->alloc(spec->data, alloc, spec->alloc_pw);
+		if (data == NULL)
+			return HUBBUB_NOMEM;
+
+		spec->data = data;
+		spec->data_alloc = alloc;
+	}
+
+	if (str->len > 0)
+		memcpy(spec->data + spec->data_len, str->ptr, str->len);
+
+	str->ptr = (const uint8_t *) (uintptr_t) spec->data_len;
+	spec->data_len += str->len;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Copy the attributes of a tag into a speculation
+ *
+ * \param spec  The speculation instance
+ * \param tag   Tag whose attributes to copy; updated to hold the index of
+ *              its first attribute in the speculation
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ */
+hubbub_error speculation_copy_attributes(hubbub_speculation *spec,
+		hubbub_tag *tag)
+{
+	hubbub_attribute *attrs;
+	hubbub_error error;
+	uint32_t i;
+
+	if (tag->n_attributes == 0) {
+		tag->attributes = NULL;
+		return HUBBUB_OK;
+	}
+
+	if (spec->n_attrs + tag->n_attributes > spec->attr_alloc) {
+		size_t alloc = max(spec->attr_alloc, SPECULATION_TOKENS);
+
+		while (alloc < spec->n_attrs + tag->n_attributes)
+			alloc *= 2;
+
+		attrs = spec->alloc(spec->attrs,
+				alloc * sizeof(hubbub_attribute),
+				spec->alloc_pw);
+		if (attrs == NULL)
+			return HUBBUB_NOMEM;
+
+		spec->attrs = attrs;
+		spec->attr_alloc = alloc;
+	}
+
+	attrs = spec->attrs + spec->n_attrs;
+	memcpy(attrs, tag->attributes,
+			tag->n_attributes * sizeof(hubbub_attribute));
+
+	for (i = 0; i < tag->n_attributes; i++) {
+		error = speculation_copy_string(spec, &attrs[i].name);
+		if (error != HUBBUB_OK)
+			return error;
+
+		error = speculation_copy_string(spec, &attrs[i].value);
+		if (error != HUBBUB_OK)
+			return error;
+	}
+
+	tag->attributes = (hubbub_attribute *) (uintptr_t) spec->n_attrs;
+	spec->n_attrs += tag->n_attributes;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Turn the storage offsets of a speculation's tokens back into pointers
+ *
+ * \param spec  The speculation instance
+ */
+void speculation_fix_tokens(hubbub_speculation *spec)
+{
+	size_t i;
+	uint32_t j;
+
+	for (i = 0; i < spec->n_tokens; i++) {
+		hubbub_token *token = &spec->tokens[i].token;
+
+		switch (token->type) {
+		case HUBBUB_TOKEN_DOCTYPE:
+		{
+			hubbub_doctype *doctype = &token->data.doctype;
+
+			speculation_fix_string(spec, &doctype->name);
+			speculation_fix_string(spec, &doctype->public_id);
+			speculation_fix_string(spec, &doctype->system_id);
+		}
+			break;
+		case HUBBUB_TOKEN_START_TAG:
+		case HUBBUB_TOKEN_END_TAG:
+			speculation_fix_string(spec, &token->data.tag.name);
+
+			if (token->data.tag.n_attributes == 0)
+				break;
+
+			token->data.tag.attributes = spec->attrs +
+				(uintptr_t) token->data.tag.attributes;
+
+			for (j = 0; j < token->data.tag.n_attributes; j++) {
+				hubbub_attribute *attr =
+						&token->data.tag.attributes[j];
+
+				speculation_fix_string(spec, &attr->name);
+				speculation_fix_string(spec, &attr->value);
+			}
+			break;
+		case HUBBUB_TOKEN_COMMENT:
+			speculation_fix_string(spec, &token->data.comment);
+			break;
+		case HUBBUB_TOKEN_CHARACTER:
+			speculation_fix_string(spec, &token->data.character);
+			break;
+		case HUBBUB_TOKEN_EOF:
+			break;
+		}
+	}
+}
+
+/**
+ * Turn a string's storage offset back into a pointer
+ *
+ * \param spec  The speculation instance
+ * \param str   String to fix up
+ */
+void speculation_fix_string(hubbub_speculation *spec, hubbub_string *str)
+{
+	/* Nothing has been stored if the storage was never allocated */
+	if (spec->data != NULL)
+		str->ptr = spec->data + (uintptr_t) str->ptr;
+	else
+		str->ptr = NULL;
+}
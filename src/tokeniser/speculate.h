@@ -0,0 +1,27 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 The NetSurf Project.
+ */
+
+#ifndef hubbub_tokeniser_speculate_h_
+#define hubbub_tokeniser_speculate_h_
+
+#include <inttypes.h>
+
+#include <hubbub/errors.h>
+#include <hubbub/speculate.h>
+
+#include "tokeniser/tokeniser.h"
+
+/* Read the input from which a speculation was made */
+const uint8_t *hubbub_speculation_read_input(const hubbub_speculation *spec,
+		size_t *len);
+
+/* Have a tokeniser emit the tokens of a speculation */
+hubbub_error hubbub_speculation_replay(const hubbub_speculation *spec,
+		hubbub_tokeniser *tokeniser);
+
+#endif
+
@@ -11,11 +11,32 @@
 
 #include <stdio.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Direct-threaded dispatch needs GCC's labels as values extension */
+#if defined(__GNUC__) && !defined(HUBBUB_NO_THREADED_DISPATCH)
+#define HUBBUB_TOKENISER_THREADED 1
+#endif
+
+/* The data state is specialised by inlining one body into a handler for
+ * each content model; GCC is told to, rather than left to judge the cost */
+#ifdef __GNUC__
+#define HUBBUB_ALWAYS_INLINE __attribute__((always_inline)) inline
+#else
+#define HUBBUB_ALWAYS_INLINE inline
+#endif
+
 #include <parserutils/charset/utf8.h>
 
+#include "utils/clock.h"
 #include "utils/parserutilserror.h"
+#include "utils/string.h"
+#include "utils/utf8.h"
 #include "utils/utils.h"
 
+#include "hubbub/atom.h"
 #include "hubbub/errors.h"
 #include "tokeniser/entities.h"
 #include "tokeniser/tokeniser.h"
@@ -93,6 +114,121 @@ typedef enum hubbub_tokeniser_state {
 	STATE_NAMED_ENTITY
 } hubbub_tokeniser_state;
 
+/** Names of the tokeniser states, for tracing */
+static const char *const state_names[] = {
+	[STATE_DATA] = "DATA",
+	[STATE_CHARACTER_REFERENCE_DATA] = "CHARACTER_REFERENCE_DATA",
+	[STATE_TAG_OPEN] = "TAG_OPEN",
+	[STATE_CLOSE_TAG_OPEN] = "CLOSE_TAG_OPEN",
+	[STATE_TAG_NAME] = "TAG_NAME",
+	[STATE_BEFORE_ATTRIBUTE_NAME] = "BEFORE_ATTRIBUTE_NAME",
+	[STATE_ATTRIBUTE_NAME] = "ATTRIBUTE_NAME",
+	[STATE_AFTER_ATTRIBUTE_NAME] = "AFTER_ATTRIBUTE_NAME",
+	[STATE_BEFORE_ATTRIBUTE_VALUE] = "BEFORE_ATTRIBUTE_VALUE",
+	[STATE_ATTRIBUTE_VALUE_DQ] = "ATTRIBUTE_VALUE_DQ",
+	[STATE_ATTRIBUTE_VALUE_SQ] = "ATTRIBUTE_VALUE_SQ",
+	[STATE_ATTRIBUTE_VALUE_UQ] = "ATTRIBUTE_VALUE_UQ",
+	[STATE_CHARACTER_REFERENCE_IN_ATTRIBUTE_VALUE] =
+			"CHARACTER_REFERENCE_IN_ATTRIBUTE_VALUE",
+	[STATE_AFTER_ATTRIBUTE_VALUE_Q] = "AFTER_ATTRIBUTE_VALUE_Q",
+	[STATE_SELF_CLOSING_START_TAG] = "SELF_CLOSING_START_TAG",
+	[STATE_BOGUS_COMMENT] = "BOGUS_COMMENT",
+	[STATE_MARKUP_DECLARATION_OPEN] = "MARKUP_DECLARATION_OPEN",
+	[STATE_MATCH_COMMENT] = "MATCH_COMMENT",
+	[STATE_COMMENT_START] = "COMMENT_START",
+	[STATE_COMMENT_START_DASH] = "COMMENT_START_DASH",
+	[STATE_COMMENT] = "COMMENT",
+	[STATE_COMMENT_END_DASH] = "COMMENT_END_DASH",
+	[STATE_COMMENT_END] = "COMMENT_END",
+	[STATE_MATCH_DOCTYPE] = "MATCH_DOCTYPE",
+	[STATE_DOCTYPE] = "DOCTYPE",
+	[STATE_BEFORE_DOCTYPE_NAME] = "BEFORE_DOCTYPE_NAME",
+	[STATE_DOCTYPE_NAME] = "DOCTYPE_NAME",
+	[STATE_AFTER_DOCTYPE_NAME] = "AFTER_DOCTYPE_NAME",
+	[STATE_MATCH_PUBLIC] = "MATCH_PUBLIC",
+	[STATE_BEFORE_DOCTYPE_PUBLIC] = "BEFORE_DOCTYPE_PUBLIC",
+	[STATE_DOCTYPE_PUBLIC_DQ] = "DOCTYPE_PUBLIC_DQ",
+	[STATE_DOCTYPE_PUBLIC_SQ] = "DOCTYPE_PUBLIC_SQ",
+	[STATE_AFTER_DOCTYPE_PUBLIC] = "AFTER_DOCTYPE_PUBLIC",
+	[STATE_MATCH_SYSTEM] = "MATCH_SYSTEM",
+	[STATE_BEFORE_DOCTYPE_SYSTEM] = "BEFORE_DOCTYPE_SYSTEM",
+	[STATE_DOCTYPE_SYSTEM_DQ] = "DOCTYPE_SYSTEM_DQ",
+	[STATE_DOCTYPE_SYSTEM_SQ] = "DOCTYPE_SYSTEM_SQ",
+	[STATE_AFTER_DOCTYPE_SYSTEM] = "AFTER_DOCTYPE_SYSTEM",
+	[STATE_BOGUS_DOCTYPE] = "BOGUS_DOCTYPE",
+	[STATE_MATCH_CDATA] = "MATCH_CDATA",
+	[STATE_CDATA_BLOCK] = "CDATA_BLOCK",
+	[STATE_NUMBERED_ENTITY] = "NUMBERED_ENTITY",
+	[STATE_NAMED_ENTITY] = "NAMED_ENTITY"
+};
+
+/** Names of the token types, for tracing */
+static const char *const token_names[] = {
+	[HUBBUB_TOKEN_DOCTYPE] = "DOCTYPE",
+	[HUBBUB_TOKEN_START_TAG] = "START_TAG",
+	[HUBBUB_TOKEN_END_TAG] = "END_TAG",
+	[HUBBUB_TOKEN_COMMENT] = "COMMENT",
+	[HUBBUB_TOKEN_CHARACTER] = "CHARACTER",
+	[HUBBUB_TOKEN_EOF] = "EOF"
+};
+
+/**
+ * Location of a string of the current tag
+ *
+ * Strings which are verbatim copies of the input are not copied into the
+ * tokeniser's buffer; instead, their location in the input is recorded and
+ * the emitted token refers to the input data directly.
+ */
+typedef struct hubbub_tokeniser_span {
+	size_t offset;			/**< Offset of string from the
+					 * current input position */
+	bool direct;			/**< Whether the string is a span
+					 * of the input, rather than held
+					 * in the buffer */
+	bool skip;			/**< Whether the string is dropped,
+					 * so its data need not be kept */
+} hubbub_tokeniser_span;
+
+/**
+ * Locations of the name and value of an attribute of the current tag
+ */
+typedef struct hubbub_tokeniser_attr_span {
+	hubbub_tokeniser_span name;	/**< Location of attribute name */
+	hubbub_tokeniser_span value;	/**< Location of attribute value */
+	bool filtered;			/**< Whether the attribute filter has
+					 * been consulted, in which case the
+					 * value is skipped if it is not
+					 * wanted */
+} hubbub_tokeniser_attr_span;
+
+/**
+ * Slot in the table used to find duplicate attributes
+ */
+typedef struct hubbub_tokeniser_attr_slot {
+	uint32_t stamp;			/**< Tag for which slot is in use */
+	uint32_t index;			/**< Index of attribute in slot */
+} hubbub_tokeniser_attr_slot;
+
+/**
+ * Slot in the table of attribute names to emit
+ */
+typedef struct hubbub_tokeniser_filter_slot {
+	uint32_t offset;		/**< Offset of name in the names */
+	uint32_t len;			/**< Length of name, or 0 if the slot
+					 * is free */
+} hubbub_tokeniser_filter_slot;
+
+/**
+ * Set of the names of the attributes to emit
+ *
+ * The names are found in an open addressing hash table, and are held
+ * after it, in the same allocation.
+ */
+typedef struct hubbub_tokeniser_attr_filter {
+	uint32_t mask;			/**< Number of slots, less one */
+	hubbub_tokeniser_filter_slot slots[];	/**< Hash table */
+} hubbub_tokeniser_attr_filter;
+
 /**
  * Context for tokeniser
  */
@@ -103,6 +239,22 @@ typedef struct hubbub_tokeniser_context {
 
 	hubbub_token_type current_tag_type;	/**< Type of current_tag */
 	hubbub_tag current_tag;			/**< Current tag */
+	hubbub_tokeniser_span current_tag_name;	/**< Location of current
+						 * tag's name */
+	hubbub_tokeniser_attr_span *current_attr_spans;	/**< Locations of
+							 * current tag's
+							 * attributes */
+	uint32_t attr_alloc;			/**< Number of attribute slots
+						 * allocated (high-water mark,
+						 * kept across tags) */
+	hubbub_tokeniser_attr_slot *attr_table;	/**< Hash table of
+						 * attribute names, with twice
+						 * attr_alloc slots */
+	uint32_t attr_stamp;			/**< Stamp of live slots in
+						 * attr_table */
+	bool values_skipped;			/**< Whether the values of any
+						 * of the current tag's
+						 * attributes were dropped */
 	hubbub_doctype current_doctype;		/**< Current doctype */
 	hubbub_tokeniser_state prev_state;	/**< Previous state */
 
@@ -149,16 +301,26 @@ typedef struct hubbub_tokeniser_context {
 							 * called from */
 	} match_entity;				/**< Entity matching state */
 
-	struct {
-		uint32_t line;			/**< Current line of input */
-		uint32_t col;			/**< Current character in
-						 * line */
-	} position;				/**< Position in source data */
-
 	uint32_t allowed_char;			/**< Used for quote matching */
 
 } hubbub_tokeniser_context;
 
+/**
+ * Input read in place, rather than from the input stream
+ */
+typedef struct hubbub_tokeniser_borrowed {
+	const uint8_t *start;	/**< Start of the first chunk, ahead of any
+				 * byte order mark, or NULL */
+	const uint8_t *end;	/**< End of the data read in place */
+	const uint8_t *data;	/**< UTF-8 data, or NULL */
+	size_t len;		/**< Bytes of data supplied */
+	size_t valid;		/**< Bytes of data checked as valid */
+	size_t cursor;		/**< Offset of current input position */
+	bool eof;		/**< Whether all data has been supplied */
+	bool done;		/**< Whether input has moved to the
+				 * input stream */
+} hubbub_tokeniser_borrowed;
+
 /**
  * Tokeniser data structure
  */
@@ -169,21 +331,82 @@ struct hubbub_tokeniser {
 	bool escape_flag;		/**< Escape flag **/
 	bool process_cdata_section;	/**< Whether to process CDATA sections*/
 	bool paused; /**< flag for if parsing is currently paused */
+	bool stopped; /**< flag for if parsing has ended early */
 
 	parserutils_inputstream *input;	/**< Input stream */
+	size_t consumed;		/**< Bytes of input consumed */
 	parserutils_buffer *buffer;	/**< Input buffer */
+
+	hubbub_tokeniser_borrowed borrowed;	/**< Input read in place */
+
 	parserutils_buffer *insert_buf; /**< Stream insertion buffer */
 
+	struct {
+		parserutils_buffer *buf;	/**< Data being read */
+		bool active;			/**< Whether it is read in
+						 * place of the input */
+		hubbub_tokeniser_borrowed saved;	/**< Client's borrowed
+							 * input, read after
+							 * it */
+	} inserted;			/**< Inserted data read in place */
+
+	bool coalesce_chars;		/**< Whether to merge adjacent
+					 * character tokens */
+	bool keep_duplicates;		/**< Whether to emit duplicate
+					 * attributes */
+	hubbub_tokeniser_attr_filter *attr_filter;	/**< Names of the
+							 * attributes to
+							 * emit, or NULL */
+	parserutils_buffer *chars_buf;	/**< Held character data */
+
+	uint32_t text_limit;		/**< Bytes of text or comment held
+					 * before it is emitted in pieces,
+					 * or 0 for no limit */
+
+	uint32_t work_budget;		/**< Bytes of input read per run
+					 * before yielding, or 0 for no
+					 * limit */
+	size_t yield_at;		/**< Input position at which the
+					 * current run yields */
+
 	hubbub_tokeniser_context context;	/**< Tokeniser context */
 
+	struct {
+		uint32_t tokens[HUBBUB_TOKEN_EOF + 1];	/**< Tokens emitted,
+							 * by type */
+		uint32_t attributes;	/**< Attributes on tags emitted */
+		uint32_t attributes_dropped;	/**< Attributes not emitted,
+						 * being filtered out */
+		uint32_t char_refs;	/**< Character references resolved */
+		uint64_t run_ns;	/**< Time spent in runs, if measured */
+	} counts;			/**< Work done on the document */
+
+	bool measure_time;		/**< Whether to time runs */
+	uint64_t run_start;		/**< Clock reading as the current run
+					 * began */
+
 	hubbub_token_handler token_handler;	/**< Token handling callback */
 	void *token_pw;				/**< Token handler data */
 
 	hubbub_error_handler error_handler;	/**< Error handling callback */
 	void *error_pw;				/**< Error handler data */
+
+	hubbub_trace_handler trace_handler;	/**< Trace handling callback */
+	void *trace_pw;				/**< Trace handler data */
+
+	hubbub_allocator_fn alloc;	/**< Memory (de)allocation function */
+	void *alloc_pw;			/**< Client private data */
 };
 
 static hubbub_error hubbub_tokeniser_handle_data(hubbub_tokeniser *tokeniser);
+static hubbub_error hubbub_tokeniser_handle_data_pcdata(
+		hubbub_tokeniser *tokeniser);
+static hubbub_error hubbub_tokeniser_handle_data_rcdata(
+		hubbub_tokeniser *tokeniser);
+static hubbub_error hubbub_tokeniser_handle_data_cdata(
+		hubbub_tokeniser *tokeniser);
+static hubbub_error hubbub_tokeniser_handle_data_plaintext(
+		hubbub_tokeniser *tokeniser);
 static hubbub_error hubbub_tokeniser_handle_character_reference_data(
 		hubbub_tokeniser *tokeniser);
 static hubbub_error hubbub_tokeniser_handle_tag_open(
@@ -267,22 +490,188 @@ static inline hubbub_error emit_character_token(hubbub_tokeniser *tokeniser,
 		const hubbub_string *chars);
 static inline hubbub_error emit_current_chars(hubbub_tokeniser *tokeniser);
 static inline hubbub_error emit_current_tag(hubbub_tokeniser *tokeniser);
+static void save_start_tag_name(hubbub_tokeniser *tokeniser,
+		const hubbub_string *name);
 static inline hubbub_error emit_current_comment(hubbub_tokeniser *tokeniser);
 static inline hubbub_error emit_current_doctype(hubbub_tokeniser *tokeniser,
 		bool force_quirks);
 static hubbub_error hubbub_tokeniser_emit_token(hubbub_tokeniser *tokeniser,
 		const hubbub_token *token);
+static hubbub_error hubbub_tokeniser_hold_chars(hubbub_tokeniser *tokeniser,
+		const hubbub_string *chars);
+static hubbub_error hubbub_tokeniser_flush_chars(hubbub_tokeniser *tokeniser);
+static void hubbub_tokeniser_trace(hubbub_tokeniser *tokeniser,
+		hubbub_trace_type type, uint32_t value, const char *name);
+static hubbub_error hubbub_tokeniser_reserve(hubbub_tokeniser *tokeniser,
+		size_t size);
+static inline uint32_t hubbub_tokeniser_hash_name(const uint8_t *name,
+		size_t len);
+static hubbub_error hubbub_tokeniser_set_attr_filter(
+		hubbub_tokeniser *tokeniser, const char *const *names,
+		uint32_t n_names);
+static bool hubbub_tokeniser_attr_wanted(
+		const hubbub_tokeniser_attr_filter *filter,
+		const uint8_t *name, size_t len);
+static void hubbub_tokeniser_filter_attribute(hubbub_tokeniser *tokeniser);
+static uint32_t hubbub_tokeniser_remove_filtered(
+		hubbub_tokeniser *tokeniser, hubbub_attribute *attrs,
+		uint32_t n_attributes);
+static hubbub_error hubbub_tokeniser_unborrow(hubbub_tokeniser *tokeniser);
+static hubbub_error hubbub_tokeniser_read_inserted(
+		hubbub_tokeniser *tokeniser);
+static parserutils_error hubbub_tokeniser_end_inserted(
+		hubbub_tokeniser *tokeniser);
+static parserutils_error hubbub_tokeniser_peek_past_inserted(
+		hubbub_tokeniser *tokeniser, size_t offset,
+		const uint8_t **ptr, size_t *length);
+static hubbub_error hubbub_tokeniser_run_states(hubbub_tokeniser *tokeniser);
+static hubbub_error hubbub_tokeniser_end_run(hubbub_tokeniser *tokeniser,
+		hubbub_error cont);
+static bool hubbub_tokeniser_may_replay(hubbub_tokeniser *tokeniser,
+		const uint8_t *ptr, size_t len, hubbub_content_model model);
+static hubbub_error hubbub_tokeniser_replay_token(
+		hubbub_tokeniser *tokeniser, const hubbub_token *token,
+		size_t len);
+
+/**
+ * Peek at a character of input
+ *
+ * Borrowed and inserted input is read in place; anything else comes from
+ * the input stream. Either way, data at successive offsets is contiguous.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param offset     Offset from current input position
+ * \param ptr        Pointer to location to receive pointer to character
+ * \param length     Pointer to location to receive character's length
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_NEEDDATA if more input is required,
+ *         PARSERUTILS_EOF if there is no more input,
+ *         appropriate error otherwise
+ */
+static inline parserutils_error hubbub_tokeniser_peek(
+		hubbub_tokeniser *tokeniser, size_t offset,
+		const uint8_t **ptr, size_t *length)
+{
+	const uint8_t *data = tokeniser->borrowed.data;
+	size_t off;
+	uint8_t c;
+
+	if (data == NULL) {
+		return parserutils_inputstream_peek(tokeniser->input,
+				offset, ptr, length);
+	}
+
+	off = offset + tokeniser->borrowed.cursor;
+	if (off >= tokeniser->borrowed.valid) {
+		if (tokeniser->inserted.active) {
+			return hubbub_tokeniser_peek_past_inserted(tokeniser,
+					offset, ptr, length);
+		}
+
+		return tokeniser->borrowed.eof ? PARSERUTILS_EOF
+				: PARSERUTILS_NEEDDATA;
+	}
+
+	/* The data has been validated, so the lead byte is trustworthy */
+	c = data[off];
+	*ptr = data + off;
+	*length = c < 0x80 ? 1 : c < 0xE0 ? 2 : c < 0xF0 ? 3 : 4;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Advance the current input position
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param bytes      Number of bytes to advance by
+ */
+static inline void hubbub_tokeniser_advance(hubbub_tokeniser *tokeniser,
+		size_t bytes)
+{
+	tokeniser->consumed += bytes;
+
+	if (tokeniser->borrowed.data != NULL)
+		tokeniser->borrowed.cursor += bytes;
+	else
+		parserutils_inputstream_advance(tokeniser->input, bytes);
+}
+
+/**
+ * Determine whether the current run has read all the input it may
+ *
+ * Input is counted from the current position, including any pending
+ * characters, so that a long run of text or a tag uses up the budget
+ * as it is read rather than once it is emitted.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return True if the tokeniser should yield, false otherwise
+ */
+static inline bool hubbub_tokeniser_budget_spent(hubbub_tokeniser *tokeniser)
+{
+	return tokeniser->work_budget != 0 && tokeniser->consumed +
+			tokeniser->context.pending >= tokeniser->yield_at;
+}
+
+/**
+ * Find the input that is available from a given offset
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param off        Offset from current input position
+ * \param avail      Pointer to location to receive number of bytes
+ *                   available from \p off
+ * \return Pointer to input at \p off
+ */
+static inline const uint8_t *hubbub_tokeniser_window(
+		hubbub_tokeniser *tokeniser, size_t off, size_t *avail)
+{
+	const parserutils_inputstream *input = tokeniser->input;
+	const uint8_t *data = tokeniser->borrowed.data;
+	size_t len;
+
+	if (data != NULL) {
+		off += tokeniser->borrowed.cursor;
+		len = tokeniser->borrowed.valid;
+	} else {
+		data = input->utf8->data;
+		off += input->cursor;
+		len = input->utf8->length;
+	}
+
+	*avail = off < len ? len - off : 0;
+
+	return data + off;
+}
+
+/**
+ * Find the record of the input the client has lent the tokeniser
+ *
+ * While inserted data is read, this is set aside until it has all been
+ * read.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return Pointer to the record
+ */
+static inline hubbub_tokeniser_borrowed *hubbub_tokeniser_client_input(
+		hubbub_tokeniser *tokeniser)
+{
+	return tokeniser->inserted.active ? &tokeniser->inserted.saved
+			: &tokeniser->borrowed;
+}
 
 /**
  * Create a hubbub tokeniser
  *
  * \param input      Input stream instance
+ * \param alloc      Memory (de)allocation function, or NULL for the default
+ * \param pw         Pointer to client-specific private data (may be NULL)
  * \param tokeniser  Pointer to location to receive tokeniser instance
  * \return HUBBUB_OK on success,
  *         HUBBUB_BADPARM on bad parameters,
  *         HUBBUB_NOMEM on memory exhaustion
  */
 hubbub_error hubbub_tokeniser_create(parserutils_inputstream *input,
+		hubbub_allocator_fn alloc, void *pw,
 		hubbub_tokeniser **tokeniser)
 {
 	parserutils_error perror;
@@ -291,23 +680,56 @@ hubbub_error hubbub_tokeniser_create(parserutils_inputstream *input,
 	if (input == NULL || tokeniser == NULL)
 		return HUBBUB_BADPARM;
 
-	tok = malloc(sizeof(hubbub_tokeniser));
+	if (alloc == NULL)
+		alloc = hubbub_default_alloc;
+
+	tok = alloc(NULL, sizeof(hubbub_tokeniser), pw);
 	if (tok == NULL)
 		return HUBBUB_NOMEM;
 
 	perror = parserutils_buffer_create(&tok->buffer);
 	if (perror != PARSERUTILS_OK) {
-		free(tok);
+		alloc(tok, 0, pw);
 		return hubbub_error_from_parserutils_error(perror);
 	}
 
 	perror = parserutils_buffer_create(&tok->insert_buf);
 	if (perror != PARSERUTILS_OK) {
 		parserutils_buffer_destroy(tok->buffer);
-		free(tok);
+		alloc(tok, 0, pw);
+		return hubbub_error_from_parserutils_error(perror);
+	}
+
+	perror = parserutils_buffer_create(&tok->inserted.buf);
+	if (perror != PARSERUTILS_OK) {
+		parserutils_buffer_destroy(tok->insert_buf);
+		parserutils_buffer_destroy(tok->buffer);
+		alloc(tok, 0, pw);
+		return hubbub_error_from_parserutils_error(perror);
+	}
+
+	perror = parserutils_buffer_create(&tok->chars_buf);
+	if (perror != PARSERUTILS_OK) {
+		parserutils_buffer_destroy(tok->inserted.buf);
+		parserutils_buffer_destroy(tok->insert_buf);
+		parserutils_buffer_destroy(tok->buffer);
+		alloc(tok, 0, pw);
 		return hubbub_error_from_parserutils_error(perror);
 	}
 
+	tok->coalesce_chars = false;
+	tok->keep_duplicates = false;
+	tok->attr_filter = NULL;
+	tok->text_limit = 0;
+	tok->work_budget = 0;
+	tok->yield_at = 0;
+
+	memset(&tok->borrowed, 0, sizeof(tok->borrowed));
+	tok->inserted.active = false;
+
+	tok->alloc = alloc;
+	tok->alloc_pw = pw;
+
 	tok->state = STATE_DATA;
 	tok->content_model = HUBBUB_CONTENT_MODEL_PCDATA;
 
@@ -315,8 +737,12 @@ hubbub_error hubbub_tokeniser_create(parserutils_inputstream *input,
 	tok->process_cdata_section = false;
 
 	tok->paused = false;
+	tok->stopped = false;
 
 	tok->input = input;
+	tok->consumed = 0;
+	memset(&tok->counts, 0, sizeof(tok->counts));
+	tok->measure_time = false;
 
 	tok->token_handler = NULL;
 	tok->token_pw = NULL;
@@ -324,6 +750,9 @@ hubbub_error hubbub_tokeniser_create(parserutils_inputstream *input,
 	tok->error_handler = NULL;
 	tok->error_pw = NULL;
 
+	tok->trace_handler = NULL;
+	tok->trace_pw = NULL;
+
 	memset(&tok->context, 0, sizeof(hubbub_tokeniser_context));
 
 	*tokeniser = tok;
@@ -343,14 +772,102 @@ hubbub_error hubbub_tokeniser_destroy(hubbub_tokeniser *tokeniser)
 		return HUBBUB_BADPARM;
 
 	if (tokeniser->context.current_tag.attributes != NULL) {
-		free(tokeniser->context.current_tag.attributes);
+		tokeniser->alloc(tokeniser->context.current_tag.attributes,
+				0, tokeniser->alloc_pw);
+	}
+
+	if (tokeniser->context.current_attr_spans != NULL) {
+		tokeniser->alloc(tokeniser->context.current_attr_spans,
+				0, tokeniser->alloc_pw);
+	}
+
+	if (tokeniser->context.attr_table != NULL) {
+		tokeniser->alloc(tokeniser->context.attr_table,
+				0, tokeniser->alloc_pw);
+	}
+
+	if (tokeniser->attr_filter != NULL) {
+		tokeniser->alloc(tokeniser->attr_filter,
+				0, tokeniser->alloc_pw);
 	}
 
+	parserutils_buffer_destroy(tokeniser->chars_buf);
+
+	parserutils_buffer_destroy(tokeniser->inserted.buf);
+
 	parserutils_buffer_destroy(tokeniser->insert_buf);
 
 	parserutils_buffer_destroy(tokeniser->buffer);
 
-	free(tokeniser);
+	tokeniser->alloc(tokeniser, 0, tokeniser->alloc_pw);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Reset a hubbub tokeniser, ready to process a new document
+ *
+ * All state relating to the previous document is discarded, while the
+ * buffers and the attribute arrays keep their capacity. Callbacks remain
+ * registered.
+ *
+ * \param tokeniser  The tokeniser instance to reset
+ * \param input      Input stream for the new document
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_tokeniser_reset(hubbub_tokeniser *tokeniser,
+		parserutils_inputstream *input)
+{
+	hubbub_tokeniser_context *ctx;
+	hubbub_attribute *attributes;
+	hubbub_tokeniser_attr_span *spans;
+	hubbub_tokeniser_attr_slot *table;
+	uint32_t alloc, stamp;
+
+	if (tokeniser == NULL || input == NULL)
+		return HUBBUB_BADPARM;
+
+	ctx = &tokeniser->context;
+
+	parserutils_buffer_discard(tokeniser->buffer, 0,
+			tokeniser->buffer->length);
+	parserutils_buffer_discard(tokeniser->insert_buf, 0,
+			tokeniser->insert_buf->length);
+	parserutils_buffer_discard(tokeniser->inserted.buf, 0,
+			tokeniser->inserted.buf->length);
+	parserutils_buffer_discard(tokeniser->chars_buf, 0,
+			tokeniser->chars_buf->length);
+
+	tokeniser->state = STATE_DATA;
+	tokeniser->content_model = HUBBUB_CONTENT_MODEL_PCDATA;
+
+	tokeniser->escape_flag = false;
+	tokeniser->process_cdata_section = false;
+
+	tokeniser->paused = false;
+	tokeniser->stopped = false;
+
+	tokeniser->input = input;
+	tokeniser->consumed = 0;
+	memset(&tokeniser->borrowed, 0, sizeof(tokeniser->borrowed));
+	tokeniser->inserted.active = false;
+	memset(&tokeniser->counts, 0, sizeof(tokeniser->counts));
+
+	/* Keep the attribute storage; the table's stamp must survive too,
+	 * or stale slots would appear live */
+	attributes = ctx->current_tag.attributes;
+	spans = ctx->current_attr_spans;
+	alloc = ctx->attr_alloc;
+	table = ctx->attr_table;
+	stamp = ctx->attr_stamp;
+
+	memset(ctx, 0, sizeof(hubbub_tokeniser_context));
+
+	ctx->current_tag.attributes = attributes;
+	ctx->current_attr_spans = spans;
+	ctx->attr_alloc = alloc;
+	ctx->attr_table = table;
+	ctx->attr_stamp = stamp;
 
 	return HUBBUB_OK;
 }
@@ -381,12 +898,47 @@ hubbub_error hubbub_tokeniser_setopt(hubbub_tokeniser *tokeniser,
 		tokeniser->error_handler = params->error_handler.handler;
 		tokeniser->error_pw = params->error_handler.pw;
 		break;
+	case HUBBUB_TOKENISER_TRACE_HANDLER:
+		tokeniser->trace_handler = params->trace_handler.handler;
+		tokeniser->trace_pw = params->trace_handler.pw;
+		break;
+	case HUBBUB_TOKENISER_MEASURE_TIME:
+		tokeniser->measure_time = params->measure_time;
+		break;
 	case HUBBUB_TOKENISER_CONTENT_MODEL:
 		tokeniser->content_model = params->content_model.model;
+		/* The escape flag only has meaning in RCDATA and CDATA, and
+		 * the data state relies on it being clear in the others */
+		if (tokeniser->content_model == HUBBUB_CONTENT_MODEL_PCDATA ||
+				tokeniser->content_model ==
+					HUBBUB_CONTENT_MODEL_PLAINTEXT)
+			tokeniser->escape_flag = false;
 		break;
 	case HUBBUB_TOKENISER_PROCESS_CDATA:
 		tokeniser->process_cdata_section = params->process_cdata;
 		break;
+	case HUBBUB_TOKENISER_COALESCE_CHARACTERS:
+		if (params->coalesce_characters == false)
+			err = hubbub_tokeniser_flush_chars(tokeniser);
+		tokeniser->coalesce_chars = params->coalesce_characters;
+		break;
+	case HUBBUB_TOKENISER_KEEP_DUPLICATES:
+		tokeniser->keep_duplicates = params->keep_duplicates;
+		break;
+	case HUBBUB_TOKENISER_ATTRIBUTE_FILTER:
+		err = hubbub_tokeniser_set_attr_filter(tokeniser,
+				params->attribute_filter.names,
+				params->attribute_filter.n_names);
+		break;
+	case HUBBUB_TOKENISER_TEXT_LIMIT:
+		tokeniser->text_limit = params->text_limit;
+		break;
+	case HUBBUB_TOKENISER_WORK_BUDGET:
+		tokeniser->work_budget = params->work_budget;
+		break;
+	case HUBBUB_TOKENISER_BUFFER_SIZE:
+		err = hubbub_tokeniser_reserve(tokeniser, params->buffer_size);
+		break;
 	case HUBBUB_TOKENISER_PAUSE:
 		if (params->pause_parse == true) {
 			tokeniser->paused = true;
@@ -397,21 +949,15 @@ hubbub_error hubbub_tokeniser_setopt(hubbub_tokeniser *tokeniser,
 				 * akin to document.write() happen while
 				 * we were paused, then the insert_buf will
 				 * have some content.
-				 * In this case, we need to prepend it to
-				 * the input buffer before we resume parsing,
-				 * discarding the insert_buf as we go.
+				 * In this case, it must be read before the
+				 * rest of the input when we resume parsing.
 				 */
-				if (tokeniser->insert_buf->length > 0) {
-					parserutils_inputstream_insert(
-						tokeniser->input,
-						tokeniser->insert_buf->data,
-						tokeniser->insert_buf->length);
-					parserutils_buffer_discard(
-						tokeniser->insert_buf, 0,
-						tokeniser->insert_buf->length);
-				}
+				if (tokeniser->insert_buf->length > 0)
+					err = hubbub_tokeniser_read_inserted(
+							tokeniser);
 
-				err = hubbub_tokeniser_run(tokeniser);
+				if (err == HUBBUB_OK)
+					err = hubbub_tokeniser_run(tokeniser);
 			}
 		}
 	}
@@ -419,11 +965,156 @@ hubbub_error hubbub_tokeniser_setopt(hubbub_tokeniser *tokeniser,
 	return err;
 }
 
+/**
+ * Make room for token text ahead of need
+ *
+ * \param tokeniser  The tokeniser instance
+ * \param size       Bytes of token text to make room for
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_tokeniser_reserve(hubbub_tokeniser *tokeniser,
+		size_t size)
+{
+	parserutils_buffer *buffer = tokeniser->buffer;
+	parserutils_error perror;
+
+	/* libparserutils buffers only grow by doubling */
+	while (buffer->allocated < size) {
+		perror = parserutils_buffer_grow(buffer);
+		if (perror != PARSERUTILS_OK)
+			return hubbub_error_from_parserutils_error(perror);
+	}
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Hash the name of an attribute
+ *
+ * \param name  Pointer to name
+ * \param len   Length, in bytes, of name
+ * \return FNV-1a hash of the name
+ */
+uint32_t hubbub_tokeniser_hash_name(const uint8_t *name, size_t len)
+{
+	uint32_t hash = 0x811c9dc5;
+	size_t k;
+
+	for (k = 0; k < len; k++) {
+		hash ^= name[k];
+		hash *= 0x01000193;
+	}
+
+	return hash;
+}
+
+/**
+ * Set the names of the only attributes to emit
+ *
+ * The names are copied, so need not outlive the call. Since attribute
+ * names are folded to lower case as they are read, only names in lower
+ * case ever match.
+ *
+ * \param tokeniser  The tokeniser instance
+ * \param names      Names of attributes to emit, or NULL to emit all
+ * \param n_names    Number of names
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ */
+hubbub_error hubbub_tokeniser_set_attr_filter(hubbub_tokeniser *tokeniser,
+		const char *const *names, uint32_t n_names)
+{
+	hubbub_tokeniser_attr_filter *filter = NULL;
+	uint32_t size = 2, i;
+	size_t bytes = 0;
+	uint8_t *pool;
+
+	if (names != NULL) {
+		/* Keep the table at most half full */
+		while (size < 2 * n_names)
+			size *= 2;
+
+		for (i = 0; i < n_names; i++)
+			bytes += strlen(names[i]);
+
+		filter = tokeniser->alloc(NULL,
+				sizeof(hubbub_tokeniser_attr_filter) +
+				size * sizeof(hubbub_tokeniser_filter_slot) +
+				bytes, tokeniser->alloc_pw);
+		if (filter == NULL)
+			return HUBBUB_NOMEM;
+
+		filter->mask = size - 1;
+		memset(filter->slots, 0,
+				size * sizeof(hubbub_tokeniser_filter_slot));
+		pool = (uint8_t *) (filter->slots + size);
+		bytes = 0;
+
+		for (i = 0; i < n_names; i++) {
+			const uint8_t *name = (const uint8_t *) names[i];
+			size_t len = strlen(names[i]);
+			uint32_t hash;
+
+			if (len == 0 || hubbub_tokeniser_attr_wanted(filter,
+					name, len))
+				continue;
+
+			hash = hubbub_tokeniser_hash_name(name, len) &
+					filter->mask;
+			while (filter->slots[hash].len != 0)
+				hash = (hash + 1) & filter->mask;
+
+			memcpy(pool + bytes, name, len);
+			filter->slots[hash].offset = bytes;
+			filter->slots[hash].len = len;
+			bytes += len;
+		}
+	}
+
+	if (tokeniser->attr_filter != NULL) {
+		tokeniser->alloc(tokeniser->attr_filter,
+				0, tokeniser->alloc_pw);
+	}
+
+	tokeniser->attr_filter = filter;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Determine whether an attribute filter passes a name
+ *
+ * \param filter  The filter to consult
+ * \param name    Pointer to name
+ * \param len     Length, in bytes, of name
+ * \return True if the name is one of the filter's
+ */
+bool hubbub_tokeniser_attr_wanted(const hubbub_tokeniser_attr_filter *filter,
+		const uint8_t *name, size_t len)
+{
+	const uint8_t *pool = (const uint8_t *)
+			(filter->slots + filter->mask + 1);
+	uint32_t hash;
+
+	for (hash = hubbub_tokeniser_hash_name(name, len) & filter->mask;
+			filter->slots[hash].len != 0;
+			hash = (hash + 1) & filter->mask) {
+		if (filter->slots[hash].len == len &&
+				memcmp(pool + filter->slots[hash].offset,
+					name, len) == 0)
+			return true;
+	}
+
+	return false;
+}
+
 /**
  * Insert a chunk of data into the input stream.
  *
  * Inserts the given data into the input stream ready for parsing but
- * does not cause any additional processing of the input.
+ * does not cause any additional processing of the input. The data is
+ * held until the current token has been emitted, or the tokeniser is
+ * unpaused, so that any number of insertions in between are read as one,
+ * ahead of the rest of the input.
  *
  * \param tokeniser  Tokeniser instance
  * \param data       Data to insert (UTF-8 encoded)
@@ -446,60 +1137,749 @@ hubbub_error hubbub_tokeniser_insert_chunk(hubbub_tokeniser *tokeniser,
 }
 
 /**
- * Process remaining data in the input stream
+ * Supply a chunk of UTF-8 input to be read in place
  *
- * \param tokeniser  The tokeniser instance to invoke
+ * The client must keep the data alive until the tokeniser is reset or
+ * destroyed. Each chunk must directly follow the previous one in memory;
+ * together, they form one buffer which is filled progressively. Input
+ * that cannot be read in place (a chunk which does not follow on, or
+ * invalid UTF-8) is moved to the input stream, and all input after that
+ * is copied there as usual. So is the rest of the input when a token
+ * begins in inserted data and ends after it.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param data       Data to supply, or NULL at the end of the input
+ * \param len        Length, in bytes, of data
  * \return HUBBUB_OK on success, appropriate error otherwise
  */
-hubbub_error hubbub_tokeniser_run(hubbub_tokeniser *tokeniser)
+hubbub_error hubbub_tokeniser_borrow_chunk(hubbub_tokeniser *tokeniser,
+		const uint8_t *data, size_t len)
 {
-	hubbub_error cont = HUBBUB_OK;
+	hubbub_tokeniser_borrowed *b;
+	parserutils_error perror;
+	bool truncated;
+	size_t valid;
 
 	if (tokeniser == NULL)
 		return HUBBUB_BADPARM;
 
-	if (tokeniser->paused == true)
-		return HUBBUB_PAUSED;
+	b = hubbub_tokeniser_client_input(tokeniser);
 
-#if 0
-#define state(x) \
-		case x: \
-			printf( #x "\n");
-#else
-#define state(x) \
-		case x:
-#endif
+	if (b->done) {
+		perror = parserutils_inputstream_append(tokeniser->input,
+				data, len);
+		return hubbub_error_from_parserutils_error(perror);
+	}
 
-	while (cont == HUBBUB_OK) {
-		switch (tokeniser->state) {
-		state(STATE_DATA)
-			cont = hubbub_tokeniser_handle_data(tokeniser);
-			break;
-		state(STATE_CHARACTER_REFERENCE_DATA)
-			cont = hubbub_tokeniser_handle_character_reference_data(
-					tokeniser);
-			break;
-		state(STATE_TAG_OPEN)
-			cont = hubbub_tokeniser_handle_tag_open(tokeniser);
-			break;
-		state(STATE_CLOSE_TAG_OPEN)
-			cont = hubbub_tokeniser_handle_close_tag_open(
-					tokeniser);
-			break;
-		state(STATE_TAG_NAME)
-			cont = hubbub_tokeniser_handle_tag_name(tokeniser);
-			break;
-		state(STATE_BEFORE_ATTRIBUTE_NAME)
-			cont = hubbub_tokeniser_handle_before_attribute_name(
-					tokeniser);
-			break;
-		state(STATE_ATTRIBUTE_NAME)
-			cont = hubbub_tokeniser_handle_attribute_name(
-					tokeniser);
-			break;
-		state(STATE_AFTER_ATTRIBUTE_NAME)
-			cont = hubbub_tokeniser_handle_after_attribute_name(
-					tokeniser);
+	if (data == NULL) {
+		b->eof = true;
+
+		/* A character cut short by the end of input is invalid */
+		if (b->data == NULL || b->valid < b->len)
+			return hubbub_tokeniser_unborrow(tokeniser);
+
+		return HUBBUB_OK;
+	}
+
+	if (b->data == NULL) {
+		b->start = data;
+
+		/* Skip any byte order mark */
+		if (len >= 3 && data[0] == 0xEF && data[1] == 0xBB &&
+				data[2] == 0xBF) {
+			data += 3;
+			len -= 3;
+		}
+
+		b->data = data;
+	} else if (data != b->data + b->len) {
+		hubbub_error error = hubbub_tokeniser_unborrow(tokeniser);
+		if (error != HUBBUB_OK)
+			return error;
+
+		perror = parserutils_inputstream_append(tokeniser->input,
+				data, len);
+		return hubbub_error_from_parserutils_error(perror);
+	}
+
+	b->len += len;
+	b->end = b->data + b->len;
+
+	valid = hubbub_utf8_valid_length(b->data + b->valid,
+			b->len - b->valid, &truncated);
+	b->valid += valid;
+
+	if (b->valid < b->len && truncated == false)
+		return hubbub_tokeniser_unborrow(tokeniser);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Move any borrowed input which has yet to be consumed to the input stream
+ *
+ * Afterwards, the tokeniser reads only from the input stream. Data is
+ * moved from the current input position, so offsets from it are
+ * unaffected.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_tokeniser_unborrow(hubbub_tokeniser *tokeniser)
+{
+	hubbub_tokeniser_borrowed *b;
+	parserutils_error perror = PARSERUTILS_OK;
+	size_t cursor;
+
+	b = hubbub_tokeniser_client_input(tokeniser);
+	cursor = b->cursor;
+
+	if (b->done)
+		return HUBBUB_OK;
+
+	if (b->data != NULL && cursor < b->len) {
+		perror = parserutils_inputstream_append(tokeniser->input,
+				b->data + cursor, b->len - cursor);
+	}
+
+	if (perror == PARSERUTILS_OK && b->eof) {
+		perror = parserutils_inputstream_append(tokeniser->input,
+				NULL, 0);
+	}
+
+	b->data = NULL;
+	b->done = true;
+
+	return hubbub_error_from_parserutils_error(perror);
+}
+
+/**
+ * Read the data inserted since the last token next, ahead of the input
+ *
+ * Inserted data is read in place, as borrowed input is, rather than being
+ * copied into the input stream in front of the input it holds, so the rest
+ * of the input is left where it is. Data inserted while earlier insertions
+ * are read goes before what remains of them. Data which is not valid UTF-8
+ * is put in the input stream, as it always used to be.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_tokeniser_read_inserted(hubbub_tokeniser *tokeniser)
+{
+	parserutils_buffer *pending = tokeniser->insert_buf;
+	parserutils_buffer *reading = tokeniser->inserted.buf;
+	hubbub_tokeniser_borrowed *b = &tokeniser->borrowed;
+	parserutils_error perror = PARSERUTILS_OK;
+	hubbub_error error;
+	bool truncated;
+
+	if (hubbub_utf8_valid_length(pending->data, pending->length,
+			&truncated) < pending->length) {
+		if (tokeniser->inserted.active)
+			perror = hubbub_tokeniser_end_inserted(tokeniser);
+
+		if (perror != PARSERUTILS_OK)
+			return hubbub_error_from_parserutils_error(perror);
+
+		error = hubbub_tokeniser_unborrow(tokeniser);
+		if (error != HUBBUB_OK)
+			return error;
+
+		perror = parserutils_inputstream_insert(tokeniser->input,
+				pending->data, pending->length);
+		parserutils_buffer_discard(pending, 0, pending->length);
+
+		return hubbub_error_from_parserutils_error(perror);
+	}
+
+	if (tokeniser->inserted.active) {
+		/* What remains of the earlier insertions follows */
+		if (b->cursor < reading->length) {
+			perror = parserutils_buffer_append(pending,
+					reading->data + b->cursor,
+					reading->length - b->cursor);
+			if (perror != PARSERUTILS_OK)
+				return hubbub_error_from_parserutils_error(
+						perror);
+		}
+
+		parserutils_buffer_discard(reading, 0, reading->length);
+	} else {
+		tokeniser->inserted.saved = *b;
+		tokeniser->inserted.active = true;
+	}
+
+	/* Swap the buffers, so that the data need not be copied again */
+	tokeniser->inserted.buf = pending;
+	tokeniser->insert_buf = reading;
+
+	b->data = pending->data;
+	b->len = b->valid = pending->length;
+	b->cursor = 0;
+	b->eof = false;
+	b->done = false;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Return to the input which follows inserted data
+ *
+ * Any of the inserted data which remains, being part of a token which does
+ * not end in it, is put in the input stream ahead of the rest of the input,
+ * so that offsets from the current input position are unaffected.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ */
+parserutils_error hubbub_tokeniser_end_inserted(hubbub_tokeniser *tokeniser)
+{
+	parserutils_buffer *reading = tokeniser->inserted.buf;
+	size_t cursor = tokeniser->borrowed.cursor;
+	parserutils_error perror = PARSERUTILS_OK;
+
+	tokeniser->borrowed = tokeniser->inserted.saved;
+	tokeniser->inserted.active = false;
+
+	if (cursor < reading->length) {
+		if (hubbub_tokeniser_unborrow(tokeniser) != HUBBUB_OK)
+			perror = PARSERUTILS_NOMEM;
+
+		if (perror == PARSERUTILS_OK) {
+			perror = parserutils_inputstream_insert(
+					tokeniser->input,
+					reading->data + cursor,
+					reading->length - cursor);
+		}
+	}
+
+	if (reading->length > 0)
+		parserutils_buffer_discard(reading, 0, reading->length);
+
+	return perror;
+}
+
+/**
+ * Peek past the end of inserted data, into the input which follows it
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param offset     Offset from current input position
+ * \param ptr        Pointer to location to receive pointer to character
+ * \param length     Pointer to location to receive character's length
+ * \return As for hubbub_tokeniser_peek()
+ */
+parserutils_error hubbub_tokeniser_peek_past_inserted(
+		hubbub_tokeniser *tokeniser, size_t offset,
+		const uint8_t **ptr, size_t *length)
+{
+	parserutils_error perror = hubbub_tokeniser_end_inserted(tokeniser);
+
+	if (perror != PARSERUTILS_OK)
+		return perror;
+
+	return hubbub_tokeniser_peek(tokeniser, offset, ptr, length);
+}
+
+/**
+ * Read the number of bytes of input which a tokeniser has consumed
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return Bytes of UTF-8 consumed since the start of the document,
+ *         including any inserted data
+ */
+size_t hubbub_tokeniser_read_offset(hubbub_tokeniser *tokeniser)
+{
+	assert(tokeniser != NULL);
+
+	return tokeniser->consumed;
+}
+
+/**
+ * Find where a string lies in the input the client has lent a tokeniser
+ *
+ * Bytes of the client's input are never changed, so a string which lies
+ * wholly within it is exactly the input at that offset. Strings held by
+ * the tokeniser, such as those with character references decoded, do not.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param str        String to locate
+ * \param offset     Pointer to location to receive the offset of the string
+ *                   from the start of the client's first chunk
+ * \return true if the string lies in the client's input, false otherwise
+ */
+bool hubbub_tokeniser_source_offset(hubbub_tokeniser *tokeniser,
+		const hubbub_string *str, size_t *offset)
+{
+	const hubbub_tokeniser_borrowed *b;
+	uintptr_t ptr, start, end;
+
+	assert(tokeniser != NULL);
+
+	/* The record is kept once the input has moved to the input stream,
+	 * as the strings already read from it remain valid */
+	b = hubbub_tokeniser_client_input(tokeniser);
+	if (b->start == NULL || str->ptr == NULL)
+		return false;
+
+	ptr = (uintptr_t) str->ptr;
+	start = (uintptr_t) b->start;
+	end = (uintptr_t) b->end;
+
+	if (ptr < start || ptr > end || end - ptr < str->len)
+		return false;
+
+	*offset = ptr - start;
+
+	return true;
+}
+
+/**
+ * Read the work a tokeniser has done on the current document
+ *
+ * This fills in the counts of bytes, tokens, attributes and character
+ * references in \p stats, and the time spent in runs if measured (see
+ * HUBBUB_TOKENISER_MEASURE_TIME), leaving its other members untouched.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param stats      Pointer to statistics to fill in
+ */
+void hubbub_tokeniser_read_stats(hubbub_tokeniser *tokeniser,
+		hubbub_parser_stats *stats)
+{
+	assert(tokeniser != NULL);
+	assert(stats != NULL);
+
+	stats->bytes = tokeniser->consumed;
+	memcpy(stats->tokens, tokeniser->counts.tokens,
+			sizeof(stats->tokens));
+	stats->attributes = tokeniser->counts.attributes;
+	stats->attributes_dropped = tokeniser->counts.attributes_dropped;
+	stats->char_refs = tokeniser->counts.char_refs;
+	stats->parse_ns = tokeniser->counts.run_ns;
+}
+
+/**
+ * Read the room the tokeniser holds for token text
+ *
+ * The buffer is never shrunk, so this is also the most the current
+ * document, or any before it since the tokeniser was created, has needed.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return Bytes allocated for token text
+ */
+size_t hubbub_tokeniser_read_buffer_size(hubbub_tokeniser *tokeniser)
+{
+	assert(tokeniser != NULL);
+
+	return tokeniser->buffer->allocated;
+}
+
+/**
+ * Read the memory held in the tokeniser's libparserutils buffers
+ *
+ * This covers the buffers for token text, inserted data and characters,
+ * and the decoded data in the input stream. The stream's buffer of raw
+ * input is private to libparserutils, so cannot be counted.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return Bytes allocated
+ */
+size_t hubbub_tokeniser_read_buffer_memory(hubbub_tokeniser *tokeniser)
+{
+	size_t total;
+
+	assert(tokeniser != NULL);
+
+	total = tokeniser->buffer->allocated +
+			tokeniser->insert_buf->allocated +
+			tokeniser->inserted.buf->allocated +
+			tokeniser->chars_buf->allocated;
+
+	if (tokeniser->input->utf8 != NULL)
+		total += tokeniser->input->utf8->allocated;
+
+	return total;
+}
+
+/**
+ * Read the offset of the end of the token being emitted
+ *
+ * Within the token handler, this is the number of bytes of input which
+ * will have been consumed once the token has been handled. It is not
+ * meaningful elsewhere.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return Bytes of UTF-8 read by the end of the token
+ */
+size_t hubbub_tokeniser_read_token_end(hubbub_tokeniser *tokeniser)
+{
+	assert(tokeniser != NULL);
+
+	return tokeniser->consumed + tokeniser->context.pending;
+}
+
+/**
+ * Determine whether a comment token is to be continued
+ *
+ * With a text limit, a long comment is emitted as consecutive comment
+ * tokens. While one is being handled, this reports whether it is a piece
+ * of a comment which continues in the next.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return True if the tokeniser is within a comment
+ */
+bool hubbub_tokeniser_in_comment(hubbub_tokeniser *tokeniser)
+{
+	assert(tokeniser != NULL);
+
+	return tokeniser->state >= STATE_COMMENT_START &&
+			tokeniser->state <= STATE_COMMENT_END;
+}
+
+/**
+ * Continue tokenising from a different input stream
+ *
+ * This is only possible between tokens, when the tokeniser holds nothing
+ * read from the current stream. The new stream's input is read from its
+ * current position, as if it directly followed what has been consumed.
+ * The caller remains responsible for destroying the old stream.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param input      Input stream to read from
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_INVALID if the tokeniser is part way through a token or
+ *                        is reading borrowed input
+ */
+hubbub_error hubbub_tokeniser_switch_input(hubbub_tokeniser *tokeniser,
+		parserutils_inputstream *input)
+{
+	if (tokeniser == NULL || input == NULL)
+		return HUBBUB_BADPARM;
+
+	if (tokeniser->state != STATE_DATA ||
+			tokeniser->context.pending != 0 ||
+			tokeniser->buffer->length != 0 ||
+			tokeniser->insert_buf->length != 0 ||
+			tokeniser->chars_buf->length != 0 ||
+			tokeniser->borrowed.data != NULL)
+		return HUBBUB_INVALID;
+
+	tokeniser->input = input;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Record the state of a tokeniser between tokens
+ *
+ * This is only possible once the tokeniser has read all the input it has
+ * been given, and emitted every token in it, so that what it would do
+ * with further input depends on nothing but the state recorded.
+ *
+ * \param tokeniser   Tokeniser instance
+ * \param checkpoint  Pointer to location to receive the state
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_INVALID if the tokeniser is part way through a token, or
+ *                        has input left to read
+ */
+hubbub_error hubbub_tokeniser_checkpoint(hubbub_tokeniser *tokeniser,
+		hubbub_tokeniser_snapshot *checkpoint)
+{
+	const uint8_t *cptr;
+	size_t len;
+
+	if (tokeniser == NULL || checkpoint == NULL)
+		return HUBBUB_BADPARM;
+
+	if (tokeniser->state != STATE_DATA ||
+			tokeniser->paused || tokeniser->stopped ||
+			tokeniser->context.pending != 0 ||
+			tokeniser->buffer->length != 0 ||
+			tokeniser->insert_buf->length != 0 ||
+			tokeniser->chars_buf->length != 0)
+		return HUBBUB_INVALID;
+
+	/* Peeking also reaches the end of any inserted data, and decodes
+	 * whatever input the stream holds */
+	if (hubbub_tokeniser_peek(tokeniser, 0, &cptr, &len) !=
+			PARSERUTILS_NEEDDATA ||
+			tokeniser->borrowed.cursor !=
+					tokeniser->borrowed.len)
+		return HUBBUB_INVALID;
+
+	checkpoint->content_model = tokeniser->content_model;
+	checkpoint->escape_flag = tokeniser->escape_flag;
+	checkpoint->process_cdata = tokeniser->process_cdata_section;
+	memcpy(checkpoint->last_start_tag_name,
+			tokeniser->context.last_start_tag_name,
+			sizeof(checkpoint->last_start_tag_name));
+	checkpoint->last_start_tag_len = tokeniser->context.last_start_tag_len;
+	checkpoint->consumed = tokeniser->consumed;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Return a freshly reset tokeniser to a recorded state
+ *
+ * The tokeniser's input then continues from the point at which the state
+ * was recorded. Options are the tokeniser's own, and its statistics count
+ * only the work done after the restore.
+ *
+ * \param tokeniser   Tokeniser instance
+ * \param checkpoint  State to restore
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_INVALID if the tokeniser has consumed input since reset
+ */
+hubbub_error hubbub_tokeniser_restore(hubbub_tokeniser *tokeniser,
+		const hubbub_tokeniser_snapshot *checkpoint)
+{
+	if (tokeniser == NULL || checkpoint == NULL)
+		return HUBBUB_BADPARM;
+
+	if (tokeniser->consumed != 0 || tokeniser->state != STATE_DATA)
+		return HUBBUB_INVALID;
+
+	tokeniser->content_model = checkpoint->content_model;
+	tokeniser->escape_flag = checkpoint->escape_flag;
+	tokeniser->process_cdata_section = checkpoint->process_cdata;
+	memcpy(tokeniser->context.last_start_tag_name,
+			checkpoint->last_start_tag_name,
+			sizeof(tokeniser->context.last_start_tag_name));
+	tokeniser->context.last_start_tag_len = checkpoint->last_start_tag_len;
+	tokeniser->consumed = checkpoint->consumed;
+
+	return HUBBUB_OK;
+}
+
+#ifdef HUBBUB_TOKENISER_THREADED
+/**
+ * Run the tokeniser's state machine, using direct-threaded dispatch
+ *
+ * Rather than each handler returning to one switch, each is followed by
+ * its own indirect jump to the handler for the next state. Those jumps are
+ * predicted independently, so common sequences of states (data, tag open,
+ * tag name, ...) are predicted well.
+ *
+ * \param tokeniser  The tokeniser instance to run
+ * \return Result of the last handler run, which is never HUBBUB_OK
+ */
+static hubbub_error hubbub_tokeniser_run_threaded(hubbub_tokeniser *tokeniser)
+{
+#define LABEL(x) __extension__ &&x
+	static void *const dispatch[] = {
+		[STATE_DATA] = LABEL(data),
+		[STATE_CHARACTER_REFERENCE_DATA] =
+				LABEL(character_reference_data),
+		[STATE_TAG_OPEN] = LABEL(tag_open),
+		[STATE_CLOSE_TAG_OPEN] = LABEL(close_tag_open),
+		[STATE_TAG_NAME] = LABEL(tag_name),
+		[STATE_BEFORE_ATTRIBUTE_NAME] = LABEL(before_attribute_name),
+		[STATE_ATTRIBUTE_NAME] = LABEL(attribute_name),
+		[STATE_AFTER_ATTRIBUTE_NAME] = LABEL(after_attribute_name),
+		[STATE_BEFORE_ATTRIBUTE_VALUE] = LABEL(before_attribute_value),
+		[STATE_ATTRIBUTE_VALUE_DQ] = LABEL(attribute_value_dq),
+		[STATE_ATTRIBUTE_VALUE_SQ] = LABEL(attribute_value_sq),
+		[STATE_ATTRIBUTE_VALUE_UQ] = LABEL(attribute_value_uq),
+		[STATE_CHARACTER_REFERENCE_IN_ATTRIBUTE_VALUE] =
+				LABEL(character_reference_in_attribute_value),
+		[STATE_AFTER_ATTRIBUTE_VALUE_Q] =
+				LABEL(after_attribute_value_q),
+		[STATE_SELF_CLOSING_START_TAG] = LABEL(self_closing_start_tag),
+		[STATE_BOGUS_COMMENT] = LABEL(bogus_comment),
+		[STATE_MARKUP_DECLARATION_OPEN] =
+				LABEL(markup_declaration_open),
+		[STATE_MATCH_COMMENT] = LABEL(match_comment),
+		[STATE_COMMENT_START] = LABEL(comment),
+		[STATE_COMMENT_START_DASH] = LABEL(comment),
+		[STATE_COMMENT] = LABEL(comment),
+		[STATE_COMMENT_END_DASH] = LABEL(comment),
+		[STATE_COMMENT_END] = LABEL(comment),
+		[STATE_MATCH_DOCTYPE] = LABEL(match_doctype),
+		[STATE_DOCTYPE] = LABEL(doctype),
+		[STATE_BEFORE_DOCTYPE_NAME] = LABEL(before_doctype_name),
+		[STATE_DOCTYPE_NAME] = LABEL(doctype_name),
+		[STATE_AFTER_DOCTYPE_NAME] = LABEL(after_doctype_name),
+		[STATE_MATCH_PUBLIC] = LABEL(match_public),
+		[STATE_BEFORE_DOCTYPE_PUBLIC] = LABEL(before_doctype_public),
+		[STATE_DOCTYPE_PUBLIC_DQ] = LABEL(doctype_public_dq),
+		[STATE_DOCTYPE_PUBLIC_SQ] = LABEL(doctype_public_sq),
+		[STATE_AFTER_DOCTYPE_PUBLIC] = LABEL(after_doctype_public),
+		[STATE_MATCH_SYSTEM] = LABEL(match_system),
+		[STATE_BEFORE_DOCTYPE_SYSTEM] = LABEL(before_doctype_system),
+		[STATE_DOCTYPE_SYSTEM_DQ] = LABEL(doctype_system_dq),
+		[STATE_DOCTYPE_SYSTEM_SQ] = LABEL(doctype_system_sq),
+		[STATE_AFTER_DOCTYPE_SYSTEM] = LABEL(after_doctype_system),
+		[STATE_BOGUS_DOCTYPE] = LABEL(bogus_doctype),
+		[STATE_MATCH_CDATA] = LABEL(match_cdata),
+		[STATE_CDATA_BLOCK] = LABEL(cdata_block),
+		[STATE_NUMBERED_ENTITY] = LABEL(numbered_entity),
+		[STATE_NAMED_ENTITY] = LABEL(named_entity)
+	};
+#undef LABEL
+	hubbub_error cont;
+
+#define DISPATCH() \
+	__extension__ ({ goto *dispatch[tokeniser->state]; })
+
+#define HANDLER(x) \
+	x: \
+		cont = hubbub_tokeniser_handle_##x(tokeniser); \
+		if (cont != HUBBUB_OK) \
+			return cont; \
+		if (tokeniser->stopped) \
+			return HUBBUB_STOPPED; \
+		if (hubbub_tokeniser_budget_spent(tokeniser)) \
+			return HUBBUB_YIELDED; \
+		DISPATCH();
+
+	DISPATCH();
+
+	HANDLER(data)
+	HANDLER(character_reference_data)
+	HANDLER(tag_open)
+	HANDLER(close_tag_open)
+	HANDLER(tag_name)
+	HANDLER(before_attribute_name)
+	HANDLER(attribute_name)
+	HANDLER(after_attribute_name)
+	HANDLER(before_attribute_value)
+	HANDLER(attribute_value_dq)
+	HANDLER(attribute_value_sq)
+	HANDLER(attribute_value_uq)
+	HANDLER(character_reference_in_attribute_value)
+	HANDLER(after_attribute_value_q)
+	HANDLER(self_closing_start_tag)
+	HANDLER(bogus_comment)
+	HANDLER(markup_declaration_open)
+	HANDLER(match_comment)
+	HANDLER(comment)
+	HANDLER(match_doctype)
+	HANDLER(doctype)
+	HANDLER(before_doctype_name)
+	HANDLER(doctype_name)
+	HANDLER(after_doctype_name)
+	HANDLER(match_public)
+	HANDLER(before_doctype_public)
+	HANDLER(doctype_public_dq)
+	HANDLER(doctype_public_sq)
+	HANDLER(after_doctype_public)
+	HANDLER(match_system)
+	HANDLER(before_doctype_system)
+	HANDLER(doctype_system_dq)
+	HANDLER(doctype_system_sq)
+	HANDLER(after_doctype_system)
+	HANDLER(bogus_doctype)
+	HANDLER(match_cdata)
+	HANDLER(cdata_block)
+	HANDLER(numbered_entity)
+	HANDLER(named_entity)
+
+#undef HANDLER
+#undef DISPATCH
+}
+#endif
+
+/**
+ * Process remaining data in the input stream
+ *
+ * If a work budget is set, the tokeniser yields once it has read that much
+ * input, between states or part way through a run of text. Its state is
+ * kept, so calling this again resumes where it left off.
+ *
+ * A token handler may end the parse by returning HUBBUB_STOPPED, after
+ * which no more input is read.
+ *
+ * \param tokeniser  The tokeniser instance to invoke
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_YIELDED if the work budget ran out,
+ *         HUBBUB_STOPPED if the token handler ended the parse,
+ *         appropriate error otherwise
+ */
+hubbub_error hubbub_tokeniser_run(hubbub_tokeniser *tokeniser)
+{
+	if (tokeniser == NULL)
+		return HUBBUB_BADPARM;
+
+	if (tokeniser->stopped == true)
+		return HUBBUB_STOPPED;
+
+	if (tokeniser->paused == true)
+		return HUBBUB_PAUSED;
+
+	if (tokeniser->measure_time)
+		tokeniser->run_start = hubbub_clock_ns();
+
+	return hubbub_tokeniser_end_run(tokeniser,
+			hubbub_tokeniser_run_states(tokeniser));
+}
+
+/**
+ * Run the tokeniser's state machine until a handler stops it
+ *
+ * Each state entered is traced, if a trace handler is set.
+ *
+ * \param tokeniser  The tokeniser instance to run
+ * \return Result of the last handler run, which is never HUBBUB_OK
+ */
+hubbub_error hubbub_tokeniser_run_states(hubbub_tokeniser *tokeniser)
+{
+	hubbub_error cont = HUBBUB_OK;
+	int traced = -1;
+
+	tokeniser->yield_at = tokeniser->consumed +
+			tokeniser->context.pending + tokeniser->work_budget;
+
+#ifdef HUBBUB_TOKENISER_THREADED
+	/* Only the loop below stops between states to trace them */
+	if (tokeniser->trace_handler == NULL)
+		return hubbub_tokeniser_run_threaded(tokeniser);
+#endif
+
+#define state(x) \
+		case x:
+
+	while (cont == HUBBUB_OK) {
+		if (tokeniser->trace_handler != NULL &&
+				(int) tokeniser->state != traced) {
+			traced = tokeniser->state;
+			hubbub_tokeniser_trace(tokeniser, HUBBUB_TRACE_STATE,
+					traced, state_names[traced]);
+		}
+
+		switch (tokeniser->state) {
+		state(STATE_DATA)
+			cont = hubbub_tokeniser_handle_data(tokeniser);
+			break;
+		state(STATE_CHARACTER_REFERENCE_DATA)
+			cont = hubbub_tokeniser_handle_character_reference_data(
+					tokeniser);
+			break;
+		state(STATE_TAG_OPEN)
+			cont = hubbub_tokeniser_handle_tag_open(tokeniser);
+			break;
+		state(STATE_CLOSE_TAG_OPEN)
+			cont = hubbub_tokeniser_handle_close_tag_open(
+					tokeniser);
+			break;
+		state(STATE_TAG_NAME)
+			cont = hubbub_tokeniser_handle_tag_name(tokeniser);
+			break;
+		state(STATE_BEFORE_ATTRIBUTE_NAME)
+			cont = hubbub_tokeniser_handle_before_attribute_name(
+					tokeniser);
+			break;
+		state(STATE_ATTRIBUTE_NAME)
+			cont = hubbub_tokeniser_handle_attribute_name(
+					tokeniser);
+			break;
+		state(STATE_AFTER_ATTRIBUTE_NAME)
+			cont = hubbub_tokeniser_handle_after_attribute_name(
+					tokeniser);
 			break;
 		state(STATE_BEFORE_ATTRIBUTE_VALUE)
 			cont = hubbub_tokeniser_handle_before_attribute_value(
@@ -628,10 +2008,184 @@ hubbub_error hubbub_tokeniser_run(hubbub_tokeniser *tokeniser)
 			cont = hubbub_tokeniser_handle_named_entity(
 					tokeniser);
 			break;
-		}
+		}
+
+		/* The handler may have ignored the result of emitting a
+		 * token which ended the parse */
+		if (cont == HUBBUB_OK && tokeniser->stopped)
+			cont = HUBBUB_STOPPED;
+		else if (cont == HUBBUB_OK &&
+				hubbub_tokeniser_budget_spent(tokeniser))
+			cont = HUBBUB_YIELDED;
+	}
+
+#undef state
+
+	return cont;
+}
+
+/**
+ * Finish a run of the tokeniser, before control returns to the client
+ *
+ * \param tokeniser  The tokeniser instance
+ * \param cont       Result of the run
+ * \return The result to report to the client
+ */
+hubbub_error hubbub_tokeniser_end_run(hubbub_tokeniser *tokeniser,
+		hubbub_error cont)
+{
+	/* Don't hold characters back once control returns to the client */
+	if (tokeniser->chars_buf->length > 0) {
+		hubbub_error err = hubbub_tokeniser_flush_chars(tokeniser);
+
+		if (cont == HUBBUB_NEEDDATA || cont == HUBBUB_OK ||
+				(cont == HUBBUB_YIELDED && err != HUBBUB_OK))
+			cont = err;
+	}
+
+	/* The parse may have ended as the tokeniser ran out of input */
+	if (tokeniser->stopped &&
+			(cont == HUBBUB_NEEDDATA || cont == HUBBUB_OK))
+		cont = HUBBUB_STOPPED;
+
+	if (tokeniser->measure_time) {
+		tokeniser->counts.run_ns +=
+				hubbub_clock_ns() - tokeniser->run_start;
+	}
+
+	return (cont == HUBBUB_NEEDDATA) ? HUBBUB_OK : cont;
+}
+
+/**
+ * Emit tokens which were read ahead of the tokeniser
+ *
+ * The tokens must have been read, beginning in the data state, from the
+ * borrowed input at \p data. Each is emitted in turn, provided that the
+ * tokeniser is then between tokens in the content model in which the
+ * token was read, at the token's position in that input. The tokeniser
+ * then reads the rest of the input itself, from wherever replaying ends.
+ * The whole is a single run: a token handler which pauses the tokeniser
+ * has the same effect as it would were the tokens read as usual.
+ *
+ * Character tokens are replayed as read, so may merge what the tokeniser
+ * would have emitted as several. Parse errors within the replayed tokens
+ * are not reported.
+ *
+ * \param tokeniser  The tokeniser instance to invoke
+ * \param data       Input from which the tokens were read
+ * \param tokens     Array of tokens, in input order
+ * \param n_tokens   Number of entries in \p tokens
+ * \return As for hubbub_tokeniser_run
+ */
+hubbub_error hubbub_tokeniser_replay(hubbub_tokeniser *tokeniser,
+		const uint8_t *data, const hubbub_replay_token *tokens,
+		size_t n_tokens)
+{
+	hubbub_error err;
+	size_t offset = 0, i;
+
+	if (tokeniser == NULL || data == NULL ||
+			(tokens == NULL && n_tokens > 0))
+		return HUBBUB_BADPARM;
+
+	if (tokeniser->stopped == true)
+		return HUBBUB_STOPPED;
+
+	if (tokeniser->paused == true)
+		return HUBBUB_PAUSED;
+
+	if (tokeniser->measure_time)
+		tokeniser->run_start = hubbub_clock_ns();
+
+	for (i = 0; i < n_tokens; i++) {
+		const hubbub_replay_token *replay = &tokens[i];
+
+		if (hubbub_tokeniser_may_replay(tokeniser, data + offset,
+				replay->end - offset, replay->model) == false)
+			break;
+
+		err = hubbub_tokeniser_replay_token(tokeniser, &replay->token,
+				replay->end - offset);
+		if (err != HUBBUB_OK)
+			return hubbub_tokeniser_end_run(tokeniser, err);
+
+		offset = replay->end;
 	}
 
-	return (cont == HUBBUB_NEEDDATA) ? HUBBUB_OK : cont;
+	return hubbub_tokeniser_end_run(tokeniser,
+			hubbub_tokeniser_run_states(tokeniser));
+}
+
+/**
+ * Determine whether a token read ahead may be emitted in place of reading
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param ptr        Pointer to the input at which the token begins
+ * \param len        Length, in bytes, of the token's input
+ * \param model      Content model in which the token was read
+ * \return True if the tokeniser would read the same token, false otherwise
+ */
+bool hubbub_tokeniser_may_replay(hubbub_tokeniser *tokeniser,
+		const uint8_t *ptr, size_t len, hubbub_content_model model)
+{
+	/* Text limits and work budgets split tokens which were read whole,
+	 * and tags read ahead have every attribute */
+	if (tokeniser->text_limit != 0 || tokeniser->work_budget != 0 ||
+			tokeniser->attr_filter != NULL ||
+			tokeniser->process_cdata_section ||
+			tokeniser->stopped)
+		return false;
+
+	if (tokeniser->state != STATE_DATA ||
+			tokeniser->content_model != model ||
+			tokeniser->escape_flag ||
+			tokeniser->context.pending != 0 ||
+			tokeniser->buffer->length != 0 ||
+			tokeniser->insert_buf->length != 0)
+		return false;
+
+	/* Inserted data moves the input out of place, so is caught here */
+	return tokeniser->borrowed.data != NULL &&
+			tokeniser->borrowed.data +
+					tokeniser->borrowed.cursor == ptr &&
+			tokeniser->borrowed.valid -
+					tokeniser->borrowed.cursor >= len;
+}
+
+/**
+ * Emit a token read ahead, as if the tokeniser had just read it
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param token      Token to emit
+ * \param len        Length, in bytes, of the token's input
+ * \return Result of emitting the token, as seen by the state handler
+ *         which would have emitted it
+ */
+hubbub_error hubbub_tokeniser_replay_token(hubbub_tokeniser *tokeniser,
+		const hubbub_token *token, size_t len)
+{
+	hubbub_error err;
+
+	if (token->type == HUBBUB_TOKEN_START_TAG)
+		save_start_tag_name(tokeniser, &token->data.tag.name);
+
+	/* Emission advances over the pending input */
+	tokeniser->context.pending = len;
+
+	err = hubbub_tokeniser_emit_token(tokeniser, token);
+
+	if (token->type == HUBBUB_TOKEN_END_TAG)
+		tokeniser->content_model = HUBBUB_CONTENT_MODEL_PCDATA;
+
+	/* Text is emitted part way through the data state, which carries
+	 * on whatever the token handler returns */
+	if (token->type == HUBBUB_TOKEN_CHARACTER)
+		err = HUBBUB_OK;
+
+	if (err == HUBBUB_OK && tokeniser->stopped)
+		err = HUBBUB_STOPPED;
+
+	return err;
 }
 
 
@@ -663,49 +2217,623 @@ hubbub_error hubbub_tokeniser_run(hubbub_tokeniser *tokeniser)
 		(str).len += (length); \
 	} while (0)
 
-#define COLLECT_MS(str, cptr, length) \
-	do { \
-		parserutils_error perror; \
-		perror = parserutils_buffer_append(tokeniser->buffer, \
-				(uint8_t *) (cptr), (length)); \
-		if (perror != PARSERUTILS_OK) \
-			return hubbub_error_from_parserutils_error(perror); \
-		(str).len += (length); \
-	} while (0)
+#define COLLECT_MS(str, cptr, length) \
+	do { \
+		parserutils_error perror; \
+		perror = parserutils_buffer_append(tokeniser->buffer, \
+				(uint8_t *) (cptr), (length)); \
+		if (perror != PARSERUTILS_OK) \
+			return hubbub_error_from_parserutils_error(perror); \
+		(str).len += (length); \
+	} while (0)
+
+/**
+ * Initial number of attribute slots to allocate
+ */
+#define ATTRIBUTE_CHUNK 8
+
+/**
+ * Ensure there is space for another attribute on the current tag
+ *
+ * The attribute array, its spans and the duplicate detection table are
+ * kept across tags, so they only grow when a tag has more attributes than
+ * any before it.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ */
+static hubbub_error hubbub_tokeniser_grow_attributes(
+		hubbub_tokeniser *tokeniser)
+{
+	hubbub_tag *ctag = &tokeniser->context.current_tag;
+	hubbub_tokeniser_attr_span *spans;
+	hubbub_tokeniser_attr_slot *table;
+	hubbub_attribute *attr;
+	uint32_t alloc = tokeniser->context.attr_alloc;
+
+	if (ctag->n_attributes < alloc)
+		return HUBBUB_OK;
+
+	alloc = (alloc == 0) ? ATTRIBUTE_CHUNK : alloc * 2;
+
+	attr = tokeniser->alloc(ctag->attributes,
+			alloc * sizeof(hubbub_attribute), tokeniser->alloc_pw);
+	if (attr == NULL)
+		return HUBBUB_NOMEM;
+
+	ctag->attributes = attr;
+
+	spans = tokeniser->alloc(tokeniser->context.current_attr_spans,
+			alloc * sizeof(hubbub_tokeniser_attr_span),
+			tokeniser->alloc_pw);
+	if (spans == NULL)
+		return HUBBUB_NOMEM;
+
+	tokeniser->context.current_attr_spans = spans;
+
+	table = tokeniser->alloc(tokeniser->context.attr_table,
+			2 * alloc * sizeof(hubbub_tokeniser_attr_slot),
+			tokeniser->alloc_pw);
+	if (table == NULL)
+		return HUBBUB_NOMEM;
+
+	memset(table, 0, 2 * alloc * sizeof(hubbub_tokeniser_attr_slot));
+	tokeniser->context.attr_table = table;
+	tokeniser->context.attr_stamp = 0;
+
+	/* Only record the new size once all arrays have it */
+	tokeniser->context.attr_alloc = alloc;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Append data to a string of the current tag
+ *
+ * While the data collected for a string is a contiguous span of the input,
+ * only the span's location is recorded. As soon as anything else (a case-
+ * folded character, a replacement character, an entity expansion, or a
+ * character that does not immediately follow the span) is collected, the
+ * span is copied into the buffer and collection continues there.
+ *
+ * As the buffer holds strings in the order they are collected, this must
+ * only be called for the most recently started string of the current tag.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param str        String to append to
+ * \param span       Location of string
+ * \param cptr       Pointer to data to append
+ * \param length     Length, in bytes, of data
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static inline hubbub_error hubbub_tokeniser_collect_span(
+		hubbub_tokeniser *tokeniser, hubbub_string *str,
+		hubbub_tokeniser_span *span, const uint8_t *cptr,
+		size_t length)
+{
+	size_t avail;
+	const uint8_t *pos;
+	parserutils_error perror;
+
+	/* Only the length of a string that is dropped matters */
+	if (span->skip) {
+		str->len += length;
+		return HUBBUB_OK;
+	}
+
+	pos = hubbub_tokeniser_window(tokeniser, 0, &avail);
+
+	if (str->len == 0) {
+		span->offset = tokeniser->context.pending;
+		span->direct = (cptr == pos + span->offset);
+	}
+
+	if (span->direct) {
+		if (cptr == pos + span->offset + str->len) {
+			str->len += length;
+			return HUBBUB_OK;
+		}
+
+		/* No longer a span of the input; move it to the buffer */
+		perror = parserutils_buffer_append(tokeniser->buffer,
+				pos + span->offset, str->len);
+		if (perror != PARSERUTILS_OK)
+			return hubbub_error_from_parserutils_error(perror);
+
+		span->direct = false;
+	}
+
+	perror = parserutils_buffer_append(tokeniser->buffer, cptr, length);
+	if (perror != PARSERUTILS_OK)
+		return hubbub_error_from_parserutils_error(perror);
+
+	str->len += length;
+
+	return HUBBUB_OK;
+}
+
+#define START_SPAN(str, span, cptr, length) \
+	do { \
+		(str).len = 0; \
+		COLLECT_SPAN(str, span, cptr, length); \
+	} while (0)
+
+#define COLLECT_SPAN(str, span, cptr, length) \
+	do { \
+		hubbub_error herror; \
+		herror = hubbub_tokeniser_collect_span(tokeniser, &(str), \
+				&(span), (const uint8_t *) (cptr), (length)); \
+		if (herror != HUBBUB_OK) \
+			return herror; \
+	} while (0)
+
+/**
+ * Append a run of a name to a string of the current tag, in lower case
+ *
+ * A run with no capital letters is collected as it is, so that a name
+ * written in lower case stays a span of the input. Otherwise, the string
+ * moves to the buffer at the first capital, and the rest of the run is
+ * copied there and folded in one pass.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param str        String to append to
+ * \param span       Location of string
+ * \param cptr       Pointer to run, in the input
+ * \param length     Length, in bytes, of run
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static inline hubbub_error hubbub_tokeniser_collect_folded(
+		hubbub_tokeniser *tokeniser, hubbub_string *str,
+		hubbub_tokeniser_span *span, const uint8_t *cptr,
+		size_t length)
+{
+	parserutils_buffer *buffer = tokeniser->buffer;
+	size_t upper = hubbub_string_find_upper(cptr, length);
+	parserutils_error perror;
+	hubbub_error error;
+	const uint8_t *pos;
+	size_t avail;
+
+	if (upper == length || span->skip) {
+		return hubbub_tokeniser_collect_span(tokeniser, str, span,
+				cptr, length);
+	}
+
+	if (upper > 0) {
+		error = hubbub_tokeniser_collect_span(tokeniser, str, span,
+				cptr, upper);
+		if (error != HUBBUB_OK)
+			return error;
+	}
+
+	if (str->len == 0) {
+		span->direct = false;
+	} else if (span->direct) {
+		pos = hubbub_tokeniser_window(tokeniser, 0, &avail);
+
+		perror = parserutils_buffer_append(buffer,
+				pos + span->offset, str->len);
+		if (perror != PARSERUTILS_OK)
+			return hubbub_error_from_parserutils_error(perror);
+
+		span->direct = false;
+	}
+
+	perror = parserutils_buffer_append(buffer, cptr + upper,
+			length - upper);
+	if (perror != PARSERUTILS_OK)
+		return hubbub_error_from_parserutils_error(perror);
+
+	hubbub_string_lower(buffer->data + buffer->length - (length - upper),
+			length - upper);
+
+	str->len += length - upper;
+
+	return HUBBUB_OK;
+}
+
+#define COLLECT_FOLDED(str, span, cptr, length) \
+	do { \
+		hubbub_error herror; \
+		herror = hubbub_tokeniser_collect_folded(tokeniser, &(str), \
+				&(span), (cptr), (length)); \
+		if (herror != HUBBUB_OK) \
+			return herror; \
+	} while (0)
+
+
+/**
+ * Characters which end a run in the various states that scan in bulk
+ */
+static const uint8_t attribute_value_dq_specials[] = { '"', '&', '\0', '\r' };
+static const uint8_t attribute_value_sq_specials[] = { '\'', '&', '\0', '\r' };
+static const uint8_t attribute_value_uq_specials[] = {
+	'\t', '\n', '\f', ' ', '\r', '&', '>', '\0'
+};
+static const uint8_t bogus_comment_specials[] = { '>', '\0', '\r' };
+static const uint8_t comment_specials[] = { '-', '\0', '\r' };
+static const uint8_t cdata_block_specials[] = { ']', '\0', '\r' };
+static const uint8_t pcdata_specials[] = { '&', '<', '\0', '\r' };
+static const uint8_t plaintext_specials[] = { '\0', '\r' };
+
+/**
+ * Maximum number of characters in a set passed to hubbub_tokeniser_scan()
+ */
+#define SCAN_MAX_SPECIALS 8
+
+/**
+ * Find the first byte in a block of UTF-8 text which is one of a set of
+ * ASCII characters.
+ *
+ * \param data  Pointer to start of text
+ * \param len   Length, in bytes, of text
+ * \param set   Characters to search for
+ * \param n     Number of characters in set (at most SCAN_MAX_SPECIALS)
+ * \return Offset of first matching byte, or len if there is none
+ */
+static size_t hubbub_tokeniser_find_special(const uint8_t *data, size_t len,
+		const uint8_t *set, size_t n)
+{
+	uint64_t mask[2] = { 0, 0 };
+	size_t i, off = 0;
+
+	assert(n > 0 && n <= SCAN_MAX_SPECIALS);
+
+	for (i = 0; i < n; i++) {
+		assert(set[i] < 0x80);
+		mask[set[i] >> 6] |= ((uint64_t) 1) << (set[i] & 63);
+	}
+
+#ifdef __SSE2__
+	if (len >= 16) {
+		__m128i needle[SCAN_MAX_SPECIALS];
+
+		for (i = 0; i < n; i++)
+			needle[i] = _mm_set1_epi8((char) set[i]);
+
+		/* Skip whole blocks with no special bytes in them; the
+		 * block containing the first special byte is left for the
+		 * scalar loop to pin down */
+		while (len - off >= 16) {
+			__m128i block = _mm_loadu_si128(
+					(const __m128i *) (const void *)
+					(data + off));
+			__m128i hit = _mm_cmpeq_epi8(block, needle[0]);
+
+			for (i = 1; i < n; i++) {
+				hit = _mm_or_si128(hit,
+					_mm_cmpeq_epi8(block, needle[i]));
+			}
+
+			if (_mm_movemask_epi8(hit) != 0)
+				break;
+
+			off += 16;
+		}
+	}
+#endif
+
+	while (off < len) {
+		const uint8_t c = data[off];
+
+		if (c < 0x80 && (mask[c >> 6] & (((uint64_t) 1) << (c & 63))))
+			break;
+
+		off++;
+	}
+
+	return off;
+}
+
+/**
+ * Characters which end a tag or attribute name; all are below 64, so each
+ * set is a mask of those bits
+ */
+#define NAME_END_BIT(c) (((uint64_t) 1) << (c))
+#define TAG_NAME_ENDS (NAME_END_BIT('\t') | NAME_END_BIT('\n') | \
+		NAME_END_BIT('\f') | NAME_END_BIT(' ') | NAME_END_BIT('\r') | \
+		NAME_END_BIT('/') | NAME_END_BIT('>') | NAME_END_BIT('\0'))
+#define ATTRIBUTE_NAME_ENDS (TAG_NAME_ENDS | NAME_END_BIT('='))
+
+/**
+ * Find the length of the run of a name at a given offset from the current
+ * position in the input stream
+ *
+ * Names are short, so this is a byte loop over a fixed set, rather than
+ * the block search hubbub_tokeniser_scan() makes. As all the characters
+ * which end a name are ASCII, the run never splits a character.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param off        Offset from current input position at which to start
+ * \param ends       Mask of the characters which end the name
+ * \return Length, in bytes, of the run
+ */
+static inline size_t hubbub_tokeniser_scan_name(hubbub_tokeniser *tokeniser,
+		size_t off, uint64_t ends)
+{
+	size_t avail, pos = 0;
+	const uint8_t *data = hubbub_tokeniser_window(tokeniser, off, &avail);
+
+	while (pos < avail && (data[pos] >= 64 ||
+			(ends & NAME_END_BIT(data[pos])) == 0))
+		pos++;
+
+	return pos;
+}
+
+/**
+ * Find the length of the run of whitespace at a given offset from the
+ * current position in the input stream
+ *
+ * Between attributes, carriage returns are passed over as any other
+ * whitespace is, so the run takes them in too. It ends at the end of the
+ * data currently held by the input stream.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param off        Offset from current input position at which to start
+ * \return Length, in bytes, of the run
+ */
+static inline size_t hubbub_tokeniser_scan_space(hubbub_tokeniser *tokeniser,
+		size_t off)
+{
+	size_t avail, pos;
+	const uint8_t *data = hubbub_tokeniser_window(tokeniser, off, &avail);
+
+	pos = hubbub_string_space_span(data, avail);
+	while (pos < avail && data[pos] == '\r')
+		pos += 1 + hubbub_string_space_span(data + pos + 1,
+				avail - pos - 1);
+
+	return pos;
+}
+
+/**
+ * Find the length of the run of ordinary characters at a given offset
+ * from the current position in the input stream.
+ *
+ * The run ends at the first byte in the special set or at the end of the
+ * UTF-8 data currently held by the input stream, whichever comes first.
+ * As all special characters are ASCII, the run never splits a character.
+ * The run is contiguous with any data previously returned by
+ * hubbub_tokeniser_peek() for the same offset.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param off        Offset from current input position at which to start
+ * \param set        Characters which end the run
+ * \param n          Number of characters in set
+ * \return Length, in bytes, of the run
+ */
+static inline size_t hubbub_tokeniser_scan(hubbub_tokeniser *tokeniser,
+		size_t off, const uint8_t *set, size_t n)
+{
+	size_t avail;
+	const uint8_t *data = hubbub_tokeniser_window(tokeniser, off, &avail);
+
+	if (avail == 0)
+		return 0;
+
+	return hubbub_tokeniser_find_special(data, avail, set, n);
+}
+
+/**
+ * Determine the set of characters the data state must examine individually
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param set        Pointer to array of SCAN_MAX_SPECIALS entries to fill
+ * \return Number of characters in set
+ */
+static inline size_t hubbub_tokeniser_data_specials(
+		hubbub_tokeniser *tokeniser, uint8_t *set)
+{
+	hubbub_content_model model = tokeniser->content_model;
+	bool escape = tokeniser->escape_flag;
+	size_t n = 0;
+
+	set[n++] = '\0';
+	set[n++] = '\r';
+
+	if ((model == HUBBUB_CONTENT_MODEL_PCDATA ||
+			model == HUBBUB_CONTENT_MODEL_RCDATA) &&
+			escape == false)
+		set[n++] = '&';
+
+	if (model == HUBBUB_CONTENT_MODEL_PCDATA)
+		set[n++] = '<';
+
+	if (model == HUBBUB_CONTENT_MODEL_RCDATA ||
+			model == HUBBUB_CONTENT_MODEL_CDATA) {
+		if (escape == false) {
+			set[n++] = '-';
+			set[n++] = '<';
+		} else {
+			set[n++] = '>';
+		}
+	}
+
+	return n;
+}
+
+/**
+ * Determine whether a '<' in RCDATA or CDATA may begin the end of its element
+ *
+ * This mirrors the checks made by the close tag open state, answering
+ * true wherever the input held is too short to tell.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param data       Pointer to the '<'
+ * \param len        Length, in bytes, of the input held from \p data
+ * \return True if the tag open state must examine the '<', false otherwise
+ */
+static inline bool hubbub_tokeniser_raw_end_tag(hubbub_tokeniser *tokeniser,
+		const uint8_t *data, size_t len)
+{
+	const uint8_t *name = tokeniser->context.last_start_tag_name;
+	size_t name_len = tokeniser->context.last_start_tag_len, i;
+	uint8_t c;
+
+	if (len < 2)
+		return true;
+
+	if (data[1] != '/')
+		return false;
+
+	if (name_len == 0)
+		return true;
+
+	for (i = 0; i < name_len; i++) {
+		if (2 + i == len)
+			return true;
+
+		if ((name[i] & ~0x20) != (data[2 + i] & ~0x20))
+			return false;
+	}
+
+	if (2 + name_len == len)
+		return true;
+
+	c = data[2 + name_len];
+
+	return c == '\t' || c == '\n' || c == '\f' || c == ' ' ||
+			c == '>' || c == '/';
+}
+
+/**
+ * Find the length of the run of RCDATA or CDATA text at a given offset
+ *
+ * Raw text, such as an inline script, is full of '<', '-' and '>'
+ * characters, few of which begin the element's end tag or open or close
+ * an escape. Those which do not are skipped here, along with the ordinary
+ * characters around them, rather than each ending the run; the escape flag
+ * is updated as the run passes over "<!--" and "-->". The run ends at the
+ * first character which the data state must examine itself, or at the end
+ * of the input held, whichever comes first.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param off        Offset from current input position at which to start
+ * \return Length, in bytes, of the run
+ */
+static size_t hubbub_tokeniser_scan_raw(hubbub_tokeniser *tokeniser,
+		size_t off)
+{
+	uint8_t set[SCAN_MAX_SPECIALS];
+	size_t avail, pos = off;
+	const uint8_t *data = hubbub_tokeniser_window(tokeniser, 0, &avail);
+	size_t n = hubbub_tokeniser_data_specials(tokeniser, set);
+
+	while (pos < avail) {
+		pos += hubbub_tokeniser_find_special(data + pos, avail - pos,
+				set, n);
+		if (pos == avail)
+			break;
+
+		/* The look-back matches that of the data state, which sees
+		 * the same input at the same offsets */
+		if (data[pos] == '-' && tokeniser->escape_flag == false) {
+			if (pos >= 3 && memcmp(data + pos - 3, "<!--",
+					SLEN("<!--")) == 0) {
+				tokeniser->escape_flag = true;
+				n = hubbub_tokeniser_data_specials(tokeniser,
+						set);
+			}
+		} else if (data[pos] == '>' && tokeniser->escape_flag) {
+			if (pos >= 2 && memcmp(data + pos - 2, "-->",
+					SLEN("-->")) == 0) {
+				tokeniser->escape_flag = false;
+				n = hubbub_tokeniser_data_specials(tokeniser,
+						set);
+			}
+		} else if (data[pos] != '<' || tokeniser->escape_flag ||
+				hubbub_tokeniser_raw_end_tag(tokeniser,
+						data + pos, avail - pos)) {
+			break;
+		}
+
+		pos++;
+	}
+
+	return pos - off;
+}
+
+/**
+ * Emit pending characters early, if there are more than the text limit
+ *
+ * This lets the input they occupy be released, however long the text.
+ * Nothing is emitted while the last few characters may be the start of
+ * "<!--" or "-->", as recognising those looks back into pending input.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param model      Content model the characters are read in
+ */
+static inline void hubbub_tokeniser_limit_chars(hubbub_tokeniser *tokeniser,
+		const hubbub_content_model model)
+{
+	size_t pending = tokeniser->context.pending, avail, i;
+	const uint8_t *tail;
+
+	if (tokeniser->text_limit == 0 ||
+			pending < max(tokeniser->text_limit, 3))
+		return;
+
+	if (model == HUBBUB_CONTENT_MODEL_RCDATA ||
+			model == HUBBUB_CONTENT_MODEL_CDATA) {
+		tail = hubbub_tokeniser_window(tokeniser, pending - 3,
+				&avail);
+
+		for (i = 0; i < 3; i++) {
+			if (tail[i] == '<' || tail[i] == '!' || tail[i] == '-')
+				return;
+		}
+	}
 
+	emit_current_chars(tokeniser);
+}
 
-/* this should always be called with an empty "chars" buffer */
-hubbub_error hubbub_tokeniser_handle_data(hubbub_tokeniser *tokeniser)
+/**
+ * Run the data state in one content model
+ *
+ * Each content model has a handler of its own, into which this is inlined
+ * with \p model a constant, so that the tests of it are resolved as the
+ * handler is compiled. While the content model is PCDATA or PLAINTEXT, the
+ * escape flag is clear, so is not tested either. The content model may only
+ * change while a token is emitted, after which the handler returns, for the
+ * state machine to run the handler for the new one.
+ *
+ * This should always be called with an empty "chars" buffer.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param model      Content model to read data in
+ * \return As for the other state handlers
+ */
+static HUBBUB_ALWAYS_INLINE hubbub_error hubbub_tokeniser_data_in(
+		hubbub_tokeniser *tokeniser, const hubbub_content_model model)
 {
+	const bool refs = (model == HUBBUB_CONTENT_MODEL_PCDATA ||
+			model == HUBBUB_CONTENT_MODEL_RCDATA);
+	const bool raw = (model == HUBBUB_CONTENT_MODEL_RCDATA ||
+			model == HUBBUB_CONTENT_MODEL_CDATA);
 	parserutils_error error;
 	hubbub_token token;
 	const uint8_t *cptr;
 	size_t len;
 
-	while ((error = parserutils_inputstream_peek(tokeniser->input,
+	while ((error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len)) ==
 					PARSERUTILS_OK) {
 		const uint8_t c = *cptr;
 
-		if (c == '&' &&
-				(tokeniser->content_model == HUBBUB_CONTENT_MODEL_PCDATA ||
-				tokeniser->content_model == HUBBUB_CONTENT_MODEL_RCDATA) &&
-				tokeniser->escape_flag == false) {
+		if (c == '&' && refs && (raw == false ||
+				tokeniser->escape_flag == false)) {
 			tokeniser->state =
 					STATE_CHARACTER_REFERENCE_DATA;
 			/* Don't eat the '&'; it'll be handled by entity
 			 * consumption */
 			break;
-		} else if (c == '-' &&
+		} else if (c == '-' && raw &&
 				tokeniser->escape_flag == false &&
-				(tokeniser->content_model ==
-						HUBBUB_CONTENT_MODEL_RCDATA ||
-				tokeniser->content_model ==
-						HUBBUB_CONTENT_MODEL_CDATA) &&
 				tokeniser->context.pending >= 3) {
 			size_t ignore;
-			error = parserutils_inputstream_peek(
-					tokeniser->input,
+			error = hubbub_tokeniser_peek(
+					tokeniser,
 					tokeniser->context.pending - 3,
 					&cptr,
 					&ignore);
@@ -718,13 +2846,8 @@ hubbub_error hubbub_tokeniser_handle_data(hubbub_tokeniser *tokeniser)
 			}
 
 			tokeniser->context.pending += len;
-		} else if (c == '<' && (tokeniser->content_model ==
-						HUBBUB_CONTENT_MODEL_PCDATA ||
-					((tokeniser->content_model ==
-						HUBBUB_CONTENT_MODEL_RCDATA ||
-					tokeniser->content_model ==
-						HUBBUB_CONTENT_MODEL_CDATA) &&
-				tokeniser->escape_flag == false))) {
+		} else if (c == '<' && (model == HUBBUB_CONTENT_MODEL_PCDATA ||
+				(raw && tokeniser->escape_flag == false))) {
 			if (tokeniser->context.pending > 0) {
 				/* Emit any pending characters */
 				emit_current_chars(tokeniser);
@@ -734,25 +2857,23 @@ hubbub_error hubbub_tokeniser_handle_data(hubbub_tokeniser *tokeniser)
 			tokeniser->context.pending = len;
 			tokeniser->state = STATE_TAG_OPEN;
 			break;
-		} else if (c == '>' && tokeniser->escape_flag == true &&
-				(tokeniser->content_model ==
-						HUBBUB_CONTENT_MODEL_RCDATA ||
-				tokeniser->content_model ==
-						HUBBUB_CONTENT_MODEL_CDATA)) {
-			/* no need to check that there are enough characters,
-			 * since you can only run into this if the flag is
-			 * true in the first place, which requires four
-			 * characters. */
-			error = parserutils_inputstream_peek(
-					tokeniser->input,
-					tokeniser->context.pending - 2,
-					&cptr,
-					&len);
-
-			assert(error == PARSERUTILS_OK);
-
-			if (strncmp((char *) cptr, "-->", SLEN("-->")) == 0) {
-				tokeniser->escape_flag = false;
+		} else if (c == '>' && raw && tokeniser->escape_flag == true) {
+			/* Pending characters may have been emitted since
+			 * the flag was set, in which case they were not
+			 * "--" */
+			if (tokeniser->context.pending >= 2) {
+				error = hubbub_tokeniser_peek(
+						tokeniser,
+						tokeniser->context.pending - 2,
+						&cptr,
+						&len);
+
+				assert(error == PARSERUTILS_OK);
+
+				if (strncmp((char *) cptr, "-->",
+						SLEN("-->")) == 0) {
+					tokeniser->escape_flag = false;
+				}
 			}
 
 			tokeniser->context.pending += len;
@@ -766,10 +2887,13 @@ hubbub_error hubbub_tokeniser_handle_data(hubbub_tokeniser *tokeniser)
 			emit_character_token(tokeniser, &u_fffd_str);
 
 			/* Advance past NUL */
-			parserutils_inputstream_advance(tokeniser->input, 1);
+			hubbub_tokeniser_advance(tokeniser, 1);
+
+			if (tokeniser->content_model != model)
+				break;
 		} else if (c == '\r') {
-			error = parserutils_inputstream_peek(
-					tokeniser->input,
+			error = hubbub_tokeniser_peek(
+					tokeniser,
 					tokeniser->context.pending + len,
 					&cptr,
 					&len);
@@ -790,10 +2914,42 @@ hubbub_error hubbub_tokeniser_handle_data(hubbub_tokeniser *tokeniser)
 			}
 
 			/* Advance over */
-			parserutils_inputstream_advance(tokeniser->input, 1);
+			hubbub_tokeniser_advance(tokeniser, 1);
+
+			if (tokeniser->content_model != model) {
+				error = PARSERUTILS_OK;
+				break;
+			}
 		} else {
-			/* Just collect into buffer */
+			/* Just collect into buffer, along with any run of
+			 * ordinary characters that follows */
 			tokeniser->context.pending += len;
+
+			if (raw) {
+				tokeniser->context.pending +=
+						hubbub_tokeniser_scan_raw(
+						tokeniser,
+						tokeniser->context.pending);
+			} else if (model == HUBBUB_CONTENT_MODEL_PCDATA) {
+				tokeniser->context.pending +=
+					hubbub_tokeniser_scan(tokeniser,
+					tokeniser->context.pending,
+					pcdata_specials,
+					N_ELEMENTS(pcdata_specials));
+			} else {
+				tokeniser->context.pending +=
+					hubbub_tokeniser_scan(tokeniser,
+					tokeniser->context.pending,
+					plaintext_specials,
+					N_ELEMENTS(plaintext_specials));
+			}
+
+			hubbub_tokeniser_limit_chars(tokeniser, model);
+
+			/* Let the run yield part way through long text */
+			if (hubbub_tokeniser_budget_spent(tokeniser) ||
+					tokeniser->content_model != model)
+				break;
 		}
 	}
 
@@ -816,6 +2972,47 @@ hubbub_error hubbub_tokeniser_handle_data(hubbub_tokeniser *tokeniser)
 	}
 }
 
+hubbub_error hubbub_tokeniser_handle_data_pcdata(hubbub_tokeniser *tokeniser)
+{
+	return hubbub_tokeniser_data_in(tokeniser,
+			HUBBUB_CONTENT_MODEL_PCDATA);
+}
+
+hubbub_error hubbub_tokeniser_handle_data_rcdata(hubbub_tokeniser *tokeniser)
+{
+	return hubbub_tokeniser_data_in(tokeniser,
+			HUBBUB_CONTENT_MODEL_RCDATA);
+}
+
+hubbub_error hubbub_tokeniser_handle_data_cdata(hubbub_tokeniser *tokeniser)
+{
+	return hubbub_tokeniser_data_in(tokeniser,
+			HUBBUB_CONTENT_MODEL_CDATA);
+}
+
+hubbub_error hubbub_tokeniser_handle_data_plaintext(
+		hubbub_tokeniser *tokeniser)
+{
+	return hubbub_tokeniser_data_in(tokeniser,
+			HUBBUB_CONTENT_MODEL_PLAINTEXT);
+}
+
+/* this should always be called with an empty "chars" buffer */
+hubbub_error hubbub_tokeniser_handle_data(hubbub_tokeniser *tokeniser)
+{
+	switch (tokeniser->content_model) {
+	case HUBBUB_CONTENT_MODEL_RCDATA:
+		return hubbub_tokeniser_handle_data_rcdata(tokeniser);
+	case HUBBUB_CONTENT_MODEL_CDATA:
+		return hubbub_tokeniser_handle_data_cdata(tokeniser);
+	case HUBBUB_CONTENT_MODEL_PLAINTEXT:
+		return hubbub_tokeniser_handle_data_plaintext(tokeniser);
+	case HUBBUB_CONTENT_MODEL_PCDATA:
+	default:
+		return hubbub_tokeniser_handle_data_pcdata(tokeniser);
+	}
+}
+
 /* emit any pending tokens before calling */
 hubbub_error hubbub_tokeniser_handle_character_reference_data(
 		hubbub_tokeniser *tokeniser)
@@ -842,18 +3039,20 @@ hubbub_error hubbub_tokeniser_handle_character_reference_data(
 			token.data.character.ptr = utf8;
 			token.data.character.len = sizeof(utf8) - len;
 
+			tokeniser->counts.char_refs++;
+
 			hubbub_tokeniser_emit_token(tokeniser, &token);
 
 			/* +1 for ampersand */
-			parserutils_inputstream_advance(tokeniser->input,
+			hubbub_tokeniser_advance(tokeniser,
 					tokeniser->context.match_entity.length
 							+ 1);
 		} else {
 			parserutils_error error;
 			const uint8_t *cptr = NULL;
 
-			error = parserutils_inputstream_peek(
-					tokeniser->input,
+			error = hubbub_tokeniser_peek(
+					tokeniser,
 					tokeniser->context.pending,
 					&cptr,
 					&len);
@@ -866,7 +3065,7 @@ hubbub_error hubbub_tokeniser_handle_character_reference_data(
 			token.data.character.len = len;
 
 			hubbub_tokeniser_emit_token(tokeniser, &token);
-			parserutils_inputstream_advance(tokeniser->input, len);
+			hubbub_tokeniser_advance(tokeniser, len);
 		}
 
 		/* Reset for next time */
@@ -892,7 +3091,7 @@ hubbub_error hubbub_tokeniser_handle_tag_open(hubbub_tokeniser *tokeniser)
 	assert(tokeniser->context.pending == 1);
 /*	assert(tokeniser->context.chars.ptr[0] == '<'); */
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	error = hubbub_tokeniser_peek(tokeniser, 
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -921,7 +3120,7 @@ hubbub_error hubbub_tokeniser_handle_tag_open(hubbub_tokeniser *tokeniser)
 		tokeniser->state = STATE_DATA;
 	} else if (tokeniser->content_model == HUBBUB_CONTENT_MODEL_PCDATA) {
 		if (c == '!') {
-			parserutils_inputstream_advance(tokeniser->input,
+			hubbub_tokeniser_advance(tokeniser,
 					SLEN("<!"));
 
 			tokeniser->context.pending = 0;
@@ -929,7 +3128,9 @@ hubbub_error hubbub_tokeniser_handle_tag_open(hubbub_tokeniser *tokeniser)
 		} else if ('A' <= c && c <= 'Z') {
 			uint8_t lc = (c + 0x20);
 
-			START_BUF(ctag->name, &lc, len);
+			START_SPAN(ctag->name,
+					tokeniser->context.current_tag_name,
+					&lc, len);
 			ctag->n_attributes = 0;
 			tokeniser->context.current_tag_type =
 					HUBBUB_TOKEN_START_TAG;
@@ -938,7 +3139,9 @@ hubbub_error hubbub_tokeniser_handle_tag_open(hubbub_tokeniser *tokeniser)
 
 			tokeniser->state = STATE_TAG_NAME;
 		} else if ('a' <= c && c <= 'z') {
-			START_BUF(ctag->name, cptr, len);
+			START_SPAN(ctag->name,
+					tokeniser->context.current_tag_name,
+					cptr, len);
 			ctag->n_attributes = 0;
 			tokeniser->context.current_tag_type =
 					HUBBUB_TOKEN_START_TAG;
@@ -955,8 +3158,8 @@ hubbub_error hubbub_tokeniser_handle_tag_open(hubbub_tokeniser *tokeniser)
 			/** \todo parse error */
 
 			/* Cursor still at "<", need to advance past it */
-			parserutils_inputstream_advance(
-					tokeniser->input, SLEN("<"));
+			hubbub_tokeniser_advance(
+					tokeniser, SLEN("<"));
 			tokeniser->context.pending = 0;
 
 			tokeniser->state = STATE_BOGUS_COMMENT;
@@ -994,7 +3197,7 @@ hubbub_error hubbub_tokeniser_handle_close_tag_open(hubbub_tokeniser *tokeniser)
 		size_t start_tag_len =
 			tokeniser->context.last_start_tag_len;
 
-		while ((error = parserutils_inputstream_peek(tokeniser->input,
+		while ((error = hubbub_tokeniser_peek(tokeniser,
 					ctx->pending +
 						ctx->close_tag_match.count,
 					&cptr,
@@ -1019,8 +3222,8 @@ hubbub_error hubbub_tokeniser_handle_close_tag_open(hubbub_tokeniser *tokeniser)
 		}
 
 		if (ctx->close_tag_match.match == true) {
-			error = parserutils_inputstream_peek(
-			 		tokeniser->input,
+			error = hubbub_tokeniser_peek(
+			 		tokeniser,
 			 		ctx->pending +
 				 		ctx->close_tag_match.count,
 					&cptr,
@@ -1050,7 +3253,7 @@ hubbub_error hubbub_tokeniser_handle_close_tag_open(hubbub_tokeniser *tokeniser)
 		 * following it */
 		tokeniser->state = STATE_DATA;
 	} else {
-		error = parserutils_inputstream_peek(tokeniser->input,
+		error = hubbub_tokeniser_peek(tokeniser,
 				tokeniser->context.pending, &cptr, &len);
 
 		if (error == PARSERUTILS_EOF) {
@@ -1067,7 +3270,8 @@ hubbub_error hubbub_tokeniser_handle_close_tag_open(hubbub_tokeniser *tokeniser)
 
 		if ('A' <= c && c <= 'Z') {
 			uint8_t lc = (c + 0x20);
-			START_BUF(tokeniser->context.current_tag.name,
+			START_SPAN(tokeniser->context.current_tag.name,
+					tokeniser->context.current_tag_name,
 					&lc, len);
 			tokeniser->context.current_tag.n_attributes = 0;
 
@@ -1078,7 +3282,8 @@ hubbub_error hubbub_tokeniser_handle_close_tag_open(hubbub_tokeniser *tokeniser)
 
 			tokeniser->state = STATE_TAG_NAME;
 		} else if ('a' <= c && c <= 'z') {
-			START_BUF(tokeniser->context.current_tag.name,
+			START_SPAN(tokeniser->context.current_tag.name,
+					tokeniser->context.current_tag_name,
 					cptr, len);
 			tokeniser->context.current_tag.n_attributes = 0;
 
@@ -1093,7 +3298,7 @@ hubbub_error hubbub_tokeniser_handle_close_tag_open(hubbub_tokeniser *tokeniser)
 			tokeniser->context.pending += len;
 
 			/* Now need to advance past "</>" */
-			parserutils_inputstream_advance(tokeniser->input,
+			hubbub_tokeniser_advance(tokeniser,
 					tokeniser->context.pending);
 			tokeniser->context.pending = 0;
 
@@ -1103,7 +3308,7 @@ hubbub_error hubbub_tokeniser_handle_close_tag_open(hubbub_tokeniser *tokeniser)
 			/** \todo parse error */
 
 			/* Cursor still at "</", need to advance past it */
-			parserutils_inputstream_advance(tokeniser->input,
+			hubbub_tokeniser_advance(tokeniser,
 					tokeniser->context.pending);
 			tokeniser->context.pending = 0;
 
@@ -1130,7 +3335,7 @@ hubbub_error hubbub_tokeniser_handle_tag_name(hubbub_tokeniser *tokeniser)
 	assert(ctag->name.len > 0);
 /*	assert(ctag->name.ptr); */
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	error = hubbub_tokeniser_peek(tokeniser, 
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -1146,23 +3351,26 @@ hubbub_error hubbub_tokeniser_handle_tag_name(hubbub_tokeniser *tokeniser)
 
 	if (c == '\t' || c == '\n' || c == '\f' || c == ' ' || c == '\r') {
 		tokeniser->context.pending += len;
+		tokeniser->context.pending += hubbub_tokeniser_scan_space(
+				tokeniser, tokeniser->context.pending);
 		tokeniser->state = STATE_BEFORE_ATTRIBUTE_NAME;
 	} else if (c == '>') {
 		tokeniser->context.pending += len;
 		tokeniser->state = STATE_DATA;
 		return emit_current_tag(tokeniser);
 	} else if (c == '\0') {
-		COLLECT(ctag->name, u_fffd, sizeof(u_fffd));
+		COLLECT_SPAN(ctag->name, tokeniser->context.current_tag_name,
+				u_fffd, sizeof(u_fffd));
 		tokeniser->context.pending += len;
 	} else if (c == '/') {
 		tokeniser->context.pending += len;
 		tokeniser->state = STATE_SELF_CLOSING_START_TAG;
-	} else if ('A' <= c && c <= 'Z') {
-		uint8_t lc = (c + 0x20);
-		COLLECT(ctag->name, &lc, len);
-		tokeniser->context.pending += len;
 	} else {
-		COLLECT(ctag->name, cptr, len);
+		/* Take in the rest of the name held, up to its end */
+		len = hubbub_tokeniser_scan_name(tokeniser,
+				tokeniser->context.pending, TAG_NAME_ENDS);
+		COLLECT_FOLDED(ctag->name, tokeniser->context.current_tag_name,
+				cptr, len);
 		tokeniser->context.pending += len;
 	}
 
@@ -1179,7 +3387,7 @@ hubbub_error hubbub_tokeniser_handle_before_attribute_name(
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	error = hubbub_tokeniser_peek(tokeniser, 
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -1196,6 +3404,8 @@ hubbub_error hubbub_tokeniser_handle_before_attribute_name(
 	if (c == '\t' || c == '\n' || c == '\f' || c == ' ' || c == '\r') {
 		/* pass over in silence */
 		tokeniser->context.pending += len;
+		tokeniser->context.pending += hubbub_tokeniser_scan_space(
+				tokeniser, tokeniser->context.pending);
 	} else if (c == '>') {
 		tokeniser->context.pending += len;
 		tokeniser->state = STATE_DATA;
@@ -1205,27 +3415,39 @@ hubbub_error hubbub_tokeniser_handle_before_attribute_name(
 		tokeniser->state = STATE_SELF_CLOSING_START_TAG;
 	} else {
 		hubbub_attribute *attr;
+		hubbub_tokeniser_attr_span *spans;
+		hubbub_error err;
 
 		if (c == '"' || c == '\'' || c == '=') {
 			/** \todo parse error */
 		}
 
-		attr = realloc(ctag->attributes,
-				(ctag->n_attributes + 1) *
-					sizeof(hubbub_attribute));
-		if (attr == NULL)
-			return HUBBUB_NOMEM;
+		err = hubbub_tokeniser_grow_attributes(tokeniser);
+		if (err != HUBBUB_OK)
+			return err;
+
+		attr = ctag->attributes;
+		spans = tokeniser->context.current_attr_spans;
 
-		ctag->attributes = attr;
+		spans[ctag->n_attributes].name.skip = false;
+		spans[ctag->n_attributes].value.offset = 0;
+		spans[ctag->n_attributes].value.direct = false;
+		spans[ctag->n_attributes].value.skip = false;
+		spans[ctag->n_attributes].filtered = false;
 
 		if ('A' <= c && c <= 'Z') {
 			uint8_t lc = (c + 0x20);
-			START_BUF(attr[ctag->n_attributes].name, &lc, len);
+			START_SPAN(attr[ctag->n_attributes].name,
+					spans[ctag->n_attributes].name,
+					&lc, len);
 		} else if (c == '\0') {
-			START_BUF(attr[ctag->n_attributes].name,
+			START_SPAN(attr[ctag->n_attributes].name,
+					spans[ctag->n_attributes].name,
 					u_fffd, sizeof(u_fffd));
 		} else {
-			START_BUF(attr[ctag->n_attributes].name, cptr, len);
+			START_SPAN(attr[ctag->n_attributes].name,
+					spans[ctag->n_attributes].name,
+					cptr, len);
 		}
 
 		attr[ctag->n_attributes].ns = HUBBUB_NS_NULL;
@@ -1252,7 +3474,7 @@ hubbub_error hubbub_tokeniser_handle_attribute_name(hubbub_tokeniser *tokeniser)
 
 	assert(ctag->attributes[ctag->n_attributes - 1].name.len > 0);
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	error = hubbub_tokeniser_peek(tokeniser, 
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -1272,6 +3494,7 @@ hubbub_error hubbub_tokeniser_handle_attribute_name(hubbub_tokeniser *tokeniser)
 	} else if (c == '=') {
 		tokeniser->context.pending += len;
 		tokeniser->state = STATE_BEFORE_ATTRIBUTE_VALUE;
+		hubbub_tokeniser_filter_attribute(tokeniser);
 	} else if (c == '>') {
 		tokeniser->context.pending += len;
 		tokeniser->state = STATE_DATA;
@@ -1280,16 +3503,18 @@ hubbub_error hubbub_tokeniser_handle_attribute_name(hubbub_tokeniser *tokeniser)
 		tokeniser->context.pending += len;
 		tokeniser->state = STATE_SELF_CLOSING_START_TAG;
 	} else if (c == '\0') {
-		COLLECT(ctag->attributes[ctag->n_attributes - 1].name,
+		COLLECT_SPAN(ctag->attributes[ctag->n_attributes - 1].name,
+				tokeniser->context.current_attr_spans[
+					ctag->n_attributes - 1].name,
 				u_fffd, sizeof(u_fffd));
 		tokeniser->context.pending += len;
-	} else if ('A' <= c && c <= 'Z') {
-		uint8_t lc = (c + 0x20);
-		COLLECT(ctag->attributes[ctag->n_attributes - 1].name,
-				&lc, len);
-		tokeniser->context.pending += len;
 	} else {
-		COLLECT(ctag->attributes[ctag->n_attributes - 1].name,
+		len = hubbub_tokeniser_scan_name(tokeniser,
+				tokeniser->context.pending,
+				ATTRIBUTE_NAME_ENDS);
+		COLLECT_FOLDED(ctag->attributes[ctag->n_attributes - 1].name,
+				tokeniser->context.current_attr_spans[
+					ctag->n_attributes - 1].name,
 				cptr, len);
 		tokeniser->context.pending += len;
 	}
@@ -1307,7 +3532,7 @@ hubbub_error hubbub_tokeniser_handle_after_attribute_name(
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	error = hubbub_tokeniser_peek(tokeniser, 
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -1323,9 +3548,12 @@ hubbub_error hubbub_tokeniser_handle_after_attribute_name(
 
 	if (c == '\t' || c == '\n' || c == '\f' || c == ' ' || c == '\r') {
 		tokeniser->context.pending += len;
+		tokeniser->context.pending += hubbub_tokeniser_scan_space(
+				tokeniser, tokeniser->context.pending);
 	} else if (c == '=') {
 		tokeniser->context.pending += len;
 		tokeniser->state = STATE_BEFORE_ATTRIBUTE_VALUE;
+		hubbub_tokeniser_filter_attribute(tokeniser);
 	} else if (c == '>') {
 		tokeniser->context.pending += len;
 
@@ -1336,27 +3564,39 @@ hubbub_error hubbub_tokeniser_handle_after_attribute_name(
 		tokeniser->state = STATE_SELF_CLOSING_START_TAG;
 	} else {
 		hubbub_attribute *attr;
+		hubbub_tokeniser_attr_span *spans;
+		hubbub_error err;
 
 		if (c == '"' || c == '\'') {
 			/** \todo parse error */
 		}
 
-		attr = realloc(ctag->attributes,
-				(ctag->n_attributes + 1) *
-					sizeof(hubbub_attribute));
-		if (attr == NULL)
-			return HUBBUB_NOMEM;
+		err = hubbub_tokeniser_grow_attributes(tokeniser);
+		if (err != HUBBUB_OK)
+			return err;
 
-		ctag->attributes = attr;
+		attr = ctag->attributes;
+		spans = tokeniser->context.current_attr_spans;
+
+		spans[ctag->n_attributes].name.skip = false;
+		spans[ctag->n_attributes].value.offset = 0;
+		spans[ctag->n_attributes].value.direct = false;
+		spans[ctag->n_attributes].value.skip = false;
+		spans[ctag->n_attributes].filtered = false;
 
 		if ('A' <= c && c <= 'Z') {
 			uint8_t lc = (c + 0x20);
-			START_BUF(attr[ctag->n_attributes].name, &lc, len);
+			START_SPAN(attr[ctag->n_attributes].name,
+					spans[ctag->n_attributes].name,
+					&lc, len);
 		} else if (c == '\0') {
-			START_BUF(attr[ctag->n_attributes].name,
+			START_SPAN(attr[ctag->n_attributes].name,
+					spans[ctag->n_attributes].name,
 					u_fffd, sizeof(u_fffd));
 		} else {
-			START_BUF(attr[ctag->n_attributes].name, cptr, len);
+			START_SPAN(attr[ctag->n_attributes].name,
+					spans[ctag->n_attributes].name,
+					cptr, len);
 		}
 
 		attr[ctag->n_attributes].ns = HUBBUB_NS_NULL;
@@ -1383,7 +3623,7 @@ hubbub_error hubbub_tokeniser_handle_before_attribute_value(
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	error = hubbub_tokeniser_peek(tokeniser, 
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -1400,6 +3640,8 @@ hubbub_error hubbub_tokeniser_handle_before_attribute_value(
 
 	if (c == '\t' || c == '\n' || c == '\f' || c == ' ' || c == '\r') {
 		tokeniser->context.pending += len;
+		tokeniser->context.pending += hubbub_tokeniser_scan_space(
+				tokeniser, tokeniser->context.pending);
 	} else if (c == '"') {
 		tokeniser->context.pending += len;
 		tokeniser->state = STATE_ATTRIBUTE_VALUE_DQ;
@@ -1416,7 +3658,9 @@ hubbub_error hubbub_tokeniser_handle_before_attribute_value(
 		tokeniser->state = STATE_DATA;
 		return emit_current_tag(tokeniser);
 	} else if (c == '\0') {
-		START_BUF(ctag->attributes[ctag->n_attributes - 1].value,
+		START_SPAN(ctag->attributes[ctag->n_attributes - 1].value,
+				tokeniser->context.current_attr_spans[
+					ctag->n_attributes - 1].value,
 				u_fffd, sizeof(u_fffd));
 		tokeniser->context.pending += len;
 		tokeniser->state = STATE_ATTRIBUTE_VALUE_UQ;
@@ -1425,7 +3669,9 @@ hubbub_error hubbub_tokeniser_handle_before_attribute_value(
 			/** \todo parse error */
 		}
 
-		START_BUF(ctag->attributes[ctag->n_attributes - 1].value,
+		START_SPAN(ctag->attributes[ctag->n_attributes - 1].value,
+				tokeniser->context.current_attr_spans[
+					ctag->n_attributes - 1].value,
 				cptr, len);
 
 		tokeniser->context.pending += len;
@@ -1445,7 +3691,7 @@ hubbub_error hubbub_tokeniser_handle_attribute_value_dq(
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	error = hubbub_tokeniser_peek(tokeniser, 
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -1468,12 +3714,14 @@ hubbub_error hubbub_tokeniser_handle_attribute_value_dq(
 		tokeniser->context.allowed_char = '"';
 		/* Don't eat the '&'; it'll be handled by entity consumption */
 	} else if (c == '\0') {
-		COLLECT_MS(ctag->attributes[ctag->n_attributes - 1].value,
+		COLLECT_SPAN(ctag->attributes[ctag->n_attributes - 1].value,
+				tokeniser->context.current_attr_spans[
+					ctag->n_attributes - 1].value,
 				u_fffd, sizeof(u_fffd));
 		tokeniser->context.pending += len;
 	} else if (c == '\r') {
-		error = parserutils_inputstream_peek(
-				tokeniser->input,
+		error = hubbub_tokeniser_peek(
+				tokeniser,
 				tokeniser->context.pending + len,
 				&cptr,
 				&len);
@@ -1481,7 +3729,9 @@ hubbub_error hubbub_tokeniser_handle_attribute_value_dq(
 		if (error != PARSERUTILS_OK && error != PARSERUTILS_EOF) {
 			return hubbub_error_from_parserutils_error(error);
 		} else if (error == PARSERUTILS_EOF || *cptr != '\n') {
-			COLLECT_MS(ctag->attributes[
+			COLLECT_SPAN(ctag->attributes[
+					ctag->n_attributes - 1].value,
+					tokeniser->context.current_attr_spans[
 					ctag->n_attributes - 1].value,
 					&lf, sizeof(lf));
 		}
@@ -1489,7 +3739,15 @@ hubbub_error hubbub_tokeniser_handle_attribute_value_dq(
 		/* Consume '\r' */
 		tokeniser->context.pending += 1;
 	} else {
-		COLLECT_MS(ctag->attributes[ctag->n_attributes - 1].value,
+		/* Collect this character and the run that follows it */
+		len += hubbub_tokeniser_scan(tokeniser,
+				tokeniser->context.pending + len,
+				attribute_value_dq_specials,
+				N_ELEMENTS(attribute_value_dq_specials));
+
+		COLLECT_SPAN(ctag->attributes[ctag->n_attributes - 1].value,
+				tokeniser->context.current_attr_spans[
+					ctag->n_attributes - 1].value,
 				cptr, len);
 		tokeniser->context.pending += len;
 	}
@@ -1507,7 +3765,7 @@ hubbub_error hubbub_tokeniser_handle_attribute_value_sq(
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	error = hubbub_tokeniser_peek(tokeniser, 
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -1530,12 +3788,14 @@ hubbub_error hubbub_tokeniser_handle_attribute_value_sq(
 		tokeniser->context.allowed_char = '\'';
 		/* Don't eat the '&'; it'll be handled by entity consumption */
 	} else if (c == '\0') {
-		COLLECT_MS(ctag->attributes[ctag->n_attributes - 1].value,
+		COLLECT_SPAN(ctag->attributes[ctag->n_attributes - 1].value,
+				tokeniser->context.current_attr_spans[
+					ctag->n_attributes - 1].value,
 				u_fffd, sizeof(u_fffd));
 		tokeniser->context.pending += len;
 	} else if (c == '\r') {
-		error = parserutils_inputstream_peek(
-				tokeniser->input,
+		error = hubbub_tokeniser_peek(
+				tokeniser,
 				tokeniser->context.pending + len,
 				&cptr,
 				&len);
@@ -1543,7 +3803,9 @@ hubbub_error hubbub_tokeniser_handle_attribute_value_sq(
 		if (error != PARSERUTILS_OK && error != PARSERUTILS_EOF) {
 			return hubbub_error_from_parserutils_error(error);
 		} else if (error == PARSERUTILS_EOF || *cptr != '\n') {
-			COLLECT_MS(ctag->attributes[
+			COLLECT_SPAN(ctag->attributes[
+					ctag->n_attributes - 1].value,
+					tokeniser->context.current_attr_spans[
 					ctag->n_attributes - 1].value,
 					&lf, sizeof(lf));
 		}
@@ -1551,7 +3813,15 @@ hubbub_error hubbub_tokeniser_handle_attribute_value_sq(
 		/* Consume \r */
 		tokeniser->context.pending += 1;
 	} else {
-		COLLECT_MS(ctag->attributes[ctag->n_attributes - 1].value,
+		/* Collect this character and the run that follows it */
+		len += hubbub_tokeniser_scan(tokeniser,
+				tokeniser->context.pending + len,
+				attribute_value_sq_specials,
+				N_ELEMENTS(attribute_value_sq_specials));
+
+		COLLECT_SPAN(ctag->attributes[ctag->n_attributes - 1].value,
+				tokeniser->context.current_attr_spans[
+					ctag->n_attributes - 1].value,
 				cptr, len);
 		tokeniser->context.pending += len;
 	}
@@ -1569,7 +3839,7 @@ hubbub_error hubbub_tokeniser_handle_attribute_value_uq(
 	const uint8_t *cptr;
 	parserutils_error error;
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	error = hubbub_tokeniser_peek(tokeniser, 
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -1598,7 +3868,9 @@ hubbub_error hubbub_tokeniser_handle_attribute_value_uq(
 		tokeniser->state = STATE_DATA;
 		return emit_current_tag(tokeniser);
 	} else if (c == '\0') {
-		COLLECT(ctag->attributes[ctag->n_attributes - 1].value,
+		COLLECT_SPAN(ctag->attributes[ctag->n_attributes - 1].value,
+				tokeniser->context.current_attr_spans[
+					ctag->n_attributes - 1].value,
 				u_fffd, sizeof(u_fffd));
 		tokeniser->context.pending += len;
 	} else {
@@ -1606,7 +3878,15 @@ hubbub_error hubbub_tokeniser_handle_attribute_value_uq(
 			/** \todo parse error */
 		}
 
-		COLLECT(ctag->attributes[ctag->n_attributes - 1].value,
+		/* Collect this character and the run that follows it */
+		len += hubbub_tokeniser_scan(tokeniser,
+				tokeniser->context.pending + len,
+				attribute_value_uq_specials,
+				N_ELEMENTS(attribute_value_uq_specials));
+
+		COLLECT_SPAN(ctag->attributes[ctag->n_attributes - 1].value,
+				tokeniser->context.current_attr_spans[
+					ctag->n_attributes - 1].value,
 				cptr, len);
 		tokeniser->context.pending += len;
 	}
@@ -1624,6 +3904,9 @@ hubbub_error hubbub_tokeniser_handle_character_reference_in_attribute_value(
 		hubbub_tag *ctag = &tokeniser->context.current_tag;
 		hubbub_attribute *attr = &ctag->attributes[
 				ctag->n_attributes - 1];
+		hubbub_tokeniser_span *span =
+				&tokeniser->context.current_attr_spans[
+				ctag->n_attributes - 1].value;
 
 		uint8_t utf8[6];
 		uint8_t *utf8ptr = utf8;
@@ -1634,7 +3917,10 @@ hubbub_error hubbub_tokeniser_handle_character_reference_in_attribute_value(
 				tokeniser->context.match_entity.codepoint,
 				&utf8ptr, &len);
 
-			COLLECT_MS(attr->value, utf8, sizeof(utf8) - len);
+			COLLECT_SPAN(attr->value, *span,
+					utf8, sizeof(utf8) - len);
+
+			tokeniser->counts.char_refs++;
 
 			/* +1 for the ampersand */
 			tokeniser->context.pending +=
@@ -1645,8 +3931,8 @@ hubbub_error hubbub_tokeniser_handle_character_reference_in_attribute_value(
 			const uint8_t *cptr = NULL;
 			parserutils_error error;
 
-			error = parserutils_inputstream_peek(
-					tokeniser->input,
+			error = hubbub_tokeniser_peek(
+					tokeniser,
 					tokeniser->context.pending, 
 					&cptr,
 					&len);
@@ -1656,7 +3942,7 @@ hubbub_error hubbub_tokeniser_handle_character_reference_in_attribute_value(
 			}
 
 			/* Insert the ampersand */
-			COLLECT_MS(attr->value, cptr, len);
+			COLLECT_SPAN(attr->value, *span, cptr, len);
 			tokeniser->context.pending += len;
 		}
 
@@ -1679,7 +3965,7 @@ hubbub_error hubbub_tokeniser_handle_after_attribute_value_q(
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	error = hubbub_tokeniser_peek(tokeniser, 
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -1721,7 +4007,7 @@ hubbub_error hubbub_tokeniser_handle_self_closing_start_tag(
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -1757,7 +4043,7 @@ hubbub_error hubbub_tokeniser_handle_bogus_comment(hubbub_tokeniser *tokeniser)
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -1783,8 +4069,8 @@ hubbub_error hubbub_tokeniser_handle_bogus_comment(hubbub_tokeniser *tokeniser)
 
 		tokeniser->context.pending += len;
 	} else if (c == '\r') {
-		error = parserutils_inputstream_peek(
-				tokeniser->input,
+		error = hubbub_tokeniser_peek(
+				tokeniser,
 				tokeniser->context.pending,
 				&cptr,
 				&len);
@@ -1801,6 +4087,12 @@ hubbub_error hubbub_tokeniser_handle_bogus_comment(hubbub_tokeniser *tokeniser)
 		}
 		tokeniser->context.pending += len;
 	} else {
+		/* Collect this character and the run that follows it */
+		len += hubbub_tokeniser_scan(tokeniser,
+				tokeniser->context.pending + len,
+				bogus_comment_specials,
+				N_ELEMENTS(bogus_comment_specials));
+
 		error = parserutils_buffer_append(tokeniser->buffer,
 				(uint8_t *) cptr, len);
 		if (error != PARSERUTILS_OK)
@@ -1823,7 +4115,7 @@ hubbub_error hubbub_tokeniser_handle_markup_declaration_open(
 
 	assert(tokeniser->context.pending == 0);
 
-	error = parserutils_inputstream_peek(tokeniser->input, 0, &cptr, &len);
+	error = hubbub_tokeniser_peek(tokeniser, 0, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
 		if (error == PARSERUTILS_EOF) {
@@ -1861,7 +4153,7 @@ hubbub_error hubbub_tokeniser_handle_match_comment(hubbub_tokeniser *tokeniser)
 	const uint8_t *cptr;
 	parserutils_error error;
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	error = hubbub_tokeniser_peek(tokeniser, 
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -1878,7 +4170,7 @@ hubbub_error hubbub_tokeniser_handle_match_comment(hubbub_tokeniser *tokeniser)
 	tokeniser->context.pending = tokeniser->context.current_comment.len = 0;
 
 	if (*cptr == '-') {
-		parserutils_inputstream_advance(tokeniser->input, SLEN("--"));
+		hubbub_tokeniser_advance(tokeniser, SLEN("--"));
 		tokeniser->state = STATE_COMMENT_START;
 	} else {
 		tokeniser->state = STATE_BOGUS_COMMENT;
@@ -1895,7 +4187,7 @@ hubbub_error hubbub_tokeniser_handle_comment(hubbub_tokeniser *tokeniser)
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	error = hubbub_tokeniser_peek(tokeniser, 
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -1963,8 +4255,8 @@ hubbub_error hubbub_tokeniser_handle_comment(hubbub_tokeniser *tokeniser)
 			}
 		} else if (c == '\r') {
 			size_t next_len;
-			error = parserutils_inputstream_peek(
-					tokeniser->input,
+			error = hubbub_tokeniser_peek(
+					tokeniser,
 					tokeniser->context.pending + len,
 					&cptr,
 					&next_len);
@@ -1982,6 +4274,14 @@ hubbub_error hubbub_tokeniser_handle_comment(hubbub_tokeniser *tokeniser)
 				}
 			}
 		} else {
+			/* Collect this character and the run that follows
+			 * it; none of the rest of the run can end the
+			 * comment, as we're about to be in STATE_COMMENT */
+			len += hubbub_tokeniser_scan(tokeniser,
+					tokeniser->context.pending + len,
+					comment_specials,
+					N_ELEMENTS(comment_specials));
+
 			error = parserutils_buffer_append(tokeniser->buffer, 
 					cptr, len);
 			if (error != PARSERUTILS_OK) {
@@ -1992,6 +4292,12 @@ hubbub_error hubbub_tokeniser_handle_comment(hubbub_tokeniser *tokeniser)
 
 		tokeniser->context.pending += len;
 		tokeniser->state = STATE_COMMENT;
+
+		/* Emit a long comment in pieces, so that the input it
+		 * occupies may be released */
+		if (tokeniser->text_limit != 0 && tokeniser->buffer->length >=
+				tokeniser->text_limit)
+			return emit_current_comment(tokeniser);
 	}
 
 	return HUBBUB_OK;
@@ -2010,7 +4316,7 @@ hubbub_error hubbub_tokeniser_handle_match_doctype(hubbub_tokeniser *tokeniser)
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.match_doctype.count, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2039,7 +4345,7 @@ hubbub_error hubbub_tokeniser_handle_match_doctype(hubbub_tokeniser *tokeniser)
 
 	if (tokeniser->context.match_doctype.count == DOCTYPE_LEN) {
 		/* Skip over the DOCTYPE bit */
-		parserutils_inputstream_advance(tokeniser->input,
+		hubbub_tokeniser_advance(tokeniser,
 				tokeniser->context.pending);
 
 		memset(&tokeniser->context.current_doctype, 0,
@@ -2066,7 +4372,7 @@ hubbub_error hubbub_tokeniser_handle_doctype(hubbub_tokeniser *tokeniser)
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2098,7 +4404,7 @@ hubbub_error hubbub_tokeniser_handle_before_doctype_name(
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2148,7 +4454,7 @@ hubbub_error hubbub_tokeniser_handle_doctype_name(hubbub_tokeniser *tokeniser)
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2192,7 +4498,7 @@ hubbub_error hubbub_tokeniser_handle_after_doctype_name(
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2236,7 +4542,7 @@ hubbub_error hubbub_tokeniser_handle_match_public(hubbub_tokeniser *tokeniser)
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2282,7 +4588,7 @@ hubbub_error hubbub_tokeniser_handle_before_doctype_public(
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2327,7 +4633,7 @@ hubbub_error hubbub_tokeniser_handle_doctype_public_dq(
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2352,8 +4658,8 @@ hubbub_error hubbub_tokeniser_handle_doctype_public_dq(
 		COLLECT_MS(cdoc->public_id, u_fffd, sizeof(u_fffd));
 		tokeniser->context.pending += len;
 	} else if (c == '\r') {
-		error = parserutils_inputstream_peek(
-				tokeniser->input,
+		error = hubbub_tokeniser_peek(
+				tokeniser,
 				tokeniser->context.pending,
 				&cptr,
 				&len);
@@ -2384,7 +4690,7 @@ hubbub_error hubbub_tokeniser_handle_doctype_public_sq(
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2409,8 +4715,8 @@ hubbub_error hubbub_tokeniser_handle_doctype_public_sq(
 		COLLECT_MS(cdoc->public_id, u_fffd, sizeof(u_fffd));
 		tokeniser->context.pending += len;
 	} else if (c == '\r') {
-		error = parserutils_inputstream_peek(
-				tokeniser->input,
+		error = hubbub_tokeniser_peek(
+				tokeniser,
 				tokeniser->context.pending,
 				&cptr,
 				&len);
@@ -2441,7 +4747,7 @@ hubbub_error hubbub_tokeniser_handle_after_doctype_public(
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2491,7 +4797,7 @@ hubbub_error hubbub_tokeniser_handle_match_system(hubbub_tokeniser *tokeniser)
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK){
@@ -2537,7 +4843,7 @@ hubbub_error hubbub_tokeniser_handle_before_doctype_system(
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2584,7 +4890,7 @@ hubbub_error hubbub_tokeniser_handle_doctype_system_dq(
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2609,8 +4915,8 @@ hubbub_error hubbub_tokeniser_handle_doctype_system_dq(
 		COLLECT_MS(cdoc->system_id, u_fffd, sizeof(u_fffd));
 		tokeniser->context.pending += len;
 	} else if (c == '\r') {
-		error = parserutils_inputstream_peek(
-				tokeniser->input,
+		error = hubbub_tokeniser_peek(
+				tokeniser,
 				tokeniser->context.pending,
 				&cptr,
 				&len);
@@ -2640,7 +4946,7 @@ hubbub_error hubbub_tokeniser_handle_doctype_system_sq(
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2665,8 +4971,8 @@ hubbub_error hubbub_tokeniser_handle_doctype_system_sq(
 		COLLECT_MS(cdoc->system_id, u_fffd, sizeof(u_fffd));
 		tokeniser->context.pending += len;
 	} else if (c == '\r') {
-		error = parserutils_inputstream_peek(
-				tokeniser->input,
+		error = hubbub_tokeniser_peek(
+				tokeniser,
 				tokeniser->context.pending,
 				&cptr,
 				&len);
@@ -2695,7 +5001,7 @@ hubbub_error hubbub_tokeniser_handle_after_doctype_system(
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2730,7 +5036,7 @@ hubbub_error hubbub_tokeniser_handle_bogus_doctype(hubbub_tokeniser *tokeniser)
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2765,7 +5071,7 @@ hubbub_error hubbub_tokeniser_handle_match_cdata(hubbub_tokeniser *tokeniser)
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2794,7 +5100,7 @@ hubbub_error hubbub_tokeniser_handle_match_cdata(hubbub_tokeniser *tokeniser)
 	tokeniser->context.pending += len;
 
 	if (tokeniser->context.match_cdata.count == CDATA_LEN) {
-		parserutils_inputstream_advance(tokeniser->input,
+		hubbub_tokeniser_advance(tokeniser,
 				tokeniser->context.match_cdata.count + len);
 		tokeniser->context.pending = 0;
 		tokeniser->context.match_cdata.end = 0;
@@ -2817,7 +5123,7 @@ hubbub_error hubbub_tokeniser_handle_cdata_block(hubbub_tokeniser *tokeniser)
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2843,7 +5149,7 @@ hubbub_error hubbub_tokeniser_handle_cdata_block(hubbub_tokeniser *tokeniser)
 		emit_current_chars(tokeniser);
 
 		/* Now move past the "]]>" bit */
-		parserutils_inputstream_advance(tokeniser->input, SLEN("]]>"));
+		hubbub_tokeniser_advance(tokeniser, SLEN("]]>"));
 
 		tokeniser->state = STATE_DATA;
 	} else if (c == '\0') {
@@ -2855,11 +5161,11 @@ hubbub_error hubbub_tokeniser_handle_cdata_block(hubbub_tokeniser *tokeniser)
 		/* Perform NUL-byte replacement */
 		emit_character_token(tokeniser, &u_fffd_str);
 
-		parserutils_inputstream_advance(tokeniser->input, len);
+		hubbub_tokeniser_advance(tokeniser, len);
 		tokeniser->context.match_cdata.end = 0;
 	} else if (c == '\r') {
-		error = parserutils_inputstream_peek(
-				tokeniser->input,
+		error = hubbub_tokeniser_peek(
+				tokeniser,
 				tokeniser->context.pending + len,
 				&cptr,
 				&len);
@@ -2879,10 +5185,14 @@ hubbub_error hubbub_tokeniser_handle_cdata_block(hubbub_tokeniser *tokeniser)
 		}
 
 		/* Advance over \r */
-		parserutils_inputstream_advance(tokeniser->input, 1);
+		hubbub_tokeniser_advance(tokeniser, 1);
 		tokeniser->context.match_cdata.end = 0;
 	} else {
 		tokeniser->context.pending += len;
+		tokeniser->context.pending += hubbub_tokeniser_scan(tokeniser,
+				tokeniser->context.pending,
+				cdata_block_specials,
+				N_ELEMENTS(cdata_block_specials));
 		tokeniser->context.match_cdata.end = 0;
 	}
 
@@ -2890,6 +5200,68 @@ hubbub_error hubbub_tokeniser_handle_cdata_block(hubbub_tokeniser *tokeniser)
 }
 
 
+/**
+ * Character references common enough to be worth recognising directly
+ *
+ * Each is complete (ends in a semicolon), so the general matcher could
+ * consume no more than it and would produce the same result.
+ */
+static const struct {
+	const char *name;	/**< Reference, following the ampersand */
+	uint8_t len;		/**< Length of name, in bytes */
+	uint32_t codepoint;	/**< Character it represents */
+} common_entities[] = {
+	{ "amp;", SLEN("amp;"), 0x26 },
+	{ "nbsp;", SLEN("nbsp;"), 0xA0 },
+	{ "lt;", SLEN("lt;"), 0x3C },
+	{ "gt;", SLEN("gt;"), 0x3E },
+	{ "quot;", SLEN("quot;"), 0x22 },
+	{ "#39;", SLEN("#39;"), 0x27 }
+};
+
+/**
+ * Attempt to recognise a common character reference in one step
+ *
+ * This only succeeds if the whole reference is already in the input
+ * stream's UTF-8 buffer; otherwise the general matchers are left to
+ * it, as they can wait for more data.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param off        Offset from current input position of the character
+ *                   following the ampersand
+ * \return True if a reference was recognised and match_entity completed
+ */
+static bool hubbub_tokeniser_match_common_entity(hubbub_tokeniser *tokeniser,
+		size_t off)
+{
+	const uint8_t *data;
+	size_t avail, i;
+
+	data = hubbub_tokeniser_window(tokeniser, off, &avail);
+	if (avail == 0)
+		return false;
+
+	for (i = 0; i < N_ELEMENTS(common_entities); i++) {
+		if (common_entities[i].name[0] != data[0] ||
+				common_entities[i].len > avail)
+			continue;
+
+		if (memcmp(data, common_entities[i].name,
+				common_entities[i].len) != 0)
+			continue;
+
+		tokeniser->context.match_entity.length =
+				common_entities[i].len;
+		tokeniser->context.match_entity.codepoint =
+				common_entities[i].codepoint;
+		tokeniser->context.match_entity.complete = true;
+
+		return true;
+	}
+
+	return false;
+}
+
 hubbub_error hubbub_tokeniser_consume_character_reference(
 		hubbub_tokeniser *tokeniser, size_t pos)
 {
@@ -2901,7 +5273,7 @@ hubbub_error hubbub_tokeniser_consume_character_reference(
 	uint8_t c;
 	size_t off;
 
-	error = parserutils_inputstream_peek(tokeniser->input, pos, 
+	error = hubbub_tokeniser_peek(tokeniser, pos, 
 			&cptr, &len);
 
 	/* We should always start on an ampersand */
@@ -2911,7 +5283,7 @@ hubbub_error hubbub_tokeniser_consume_character_reference(
 	off = pos + len;
 
 	/* Look at the character after the ampersand */
-	error = parserutils_inputstream_peek(tokeniser->input, off, 
+	error = hubbub_tokeniser_peek(tokeniser, off, 
 			&cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2947,6 +5319,8 @@ hubbub_error hubbub_tokeniser_consume_character_reference(
 			(allowed_char && c == allowed_char)) {
 		tokeniser->context.match_entity.complete = true;
 		tokeniser->context.match_entity.codepoint = 0;
+	} else if (hubbub_tokeniser_match_common_entity(tokeniser, off)) {
+		/* Complete; the calling state will pick it up */
 	} else if (c == '#') {
 		tokeniser->context.match_entity.length += len;
 		tokeniser->state = STATE_NUMBERED_ENTITY;
@@ -2967,7 +5341,7 @@ hubbub_error hubbub_tokeniser_handle_numbered_entity(
 	const uint8_t *cptr;
 	parserutils_error error;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	error = hubbub_tokeniser_peek(tokeniser,
 			ctx->match_entity.offset + ctx->match_entity.length,
 			&cptr, &len);
 
@@ -2985,7 +5359,7 @@ hubbub_error hubbub_tokeniser_handle_numbered_entity(
 		}
 	}
 
-	while ((error = parserutils_inputstream_peek(tokeniser->input,
+	while ((error = hubbub_tokeniser_peek(tokeniser,
 			ctx->match_entity.offset + ctx->match_entity.length,
 			&cptr, &len)) == PARSERUTILS_OK) {
 		uint8_t c = *cptr;
@@ -3070,7 +5444,7 @@ hubbub_error hubbub_tokeniser_handle_named_entity(hubbub_tokeniser *tokeniser)
 	const uint8_t *cptr;
 	parserutils_error error;
 
-	while ((error = parserutils_inputstream_peek(tokeniser->input,
+	while ((error = hubbub_tokeniser_peek(tokeniser,
 			ctx->match_entity.offset +
 					ctx->match_entity.poss_length,
 			&cptr, &len)) == PARSERUTILS_OK) {
@@ -3109,7 +5483,7 @@ hubbub_error hubbub_tokeniser_handle_named_entity(hubbub_tokeniser *tokeniser)
 
 	if (ctx->match_entity.length > 0) {
 		uint8_t c;
-		error = parserutils_inputstream_peek(tokeniser->input,
+		error = hubbub_tokeniser_peek(tokeniser,
 				ctx->match_entity.offset + 
 					ctx->match_entity.length - 1,
 				&cptr, &len);
@@ -3123,7 +5497,7 @@ hubbub_error hubbub_tokeniser_handle_named_entity(hubbub_tokeniser *tokeniser)
 		if ((tokeniser->context.match_entity.return_state ==
 				STATE_CHARACTER_REFERENCE_IN_ATTRIBUTE_VALUE) &&
 				c != ';') {
-			error = parserutils_inputstream_peek(tokeniser->input,
+			error = hubbub_tokeniser_peek(tokeniser,
 					ctx->match_entity.offset +
 						ctx->match_entity.length,
 					&cptr, &len);
@@ -3196,7 +5570,7 @@ hubbub_error emit_current_chars(hubbub_tokeniser *tokeniser)
 	/* Calling this with nothing to output is a probable bug */
 	assert(tokeniser->context.pending > 0);
 
-	error = parserutils_inputstream_peek(tokeniser->input, 0, &cptr, &len);
+	error = hubbub_tokeniser_peek(tokeniser, 0, &cptr, &len);
 	if (error != PARSERUTILS_OK)
 		return hubbub_error_from_parserutils_error(error);
 
@@ -3207,6 +5581,240 @@ hubbub_error emit_current_chars(hubbub_tokeniser *tokeniser)
 	return hubbub_tokeniser_emit_token(tokeniser, &token);
 }
 
+/**
+ * Hold a character token back, to be merged with any that follow it
+ *
+ * The characters are copied, as the input they lie in may be discarded
+ * by the stream as soon as it has been advanced past them.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param chars      Characters to hold
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_tokeniser_hold_chars(hubbub_tokeniser *tokeniser,
+		const hubbub_string *chars)
+{
+	parserutils_error perror;
+
+	perror = parserutils_buffer_append(tokeniser->chars_buf,
+			chars->ptr, chars->len);
+	if (perror != PARSERUTILS_OK)
+		return hubbub_error_from_parserutils_error(perror);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Emit any held characters as a single character token
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_tokeniser_flush_chars(hubbub_tokeniser *tokeniser)
+{
+	hubbub_error err = HUBBUB_OK;
+	hubbub_token token;
+
+	if (tokeniser->chars_buf->length == 0)
+		return HUBBUB_OK;
+
+	token.type = HUBBUB_TOKEN_CHARACTER;
+	token.data.character.ptr = tokeniser->chars_buf->data;
+	token.data.character.len = tokeniser->chars_buf->length;
+
+	tokeniser->counts.tokens[HUBBUB_TOKEN_CHARACTER]++;
+
+	if (tokeniser->trace_handler != NULL) {
+		hubbub_tokeniser_trace(tokeniser, HUBBUB_TRACE_TOKEN,
+				HUBBUB_TOKEN_CHARACTER,
+				token_names[HUBBUB_TOKEN_CHARACTER]);
+	}
+
+	if (tokeniser->token_handler)
+		err = tokeniser->token_handler(&token, tokeniser->token_pw);
+
+	parserutils_buffer_discard(tokeniser->chars_buf, 0,
+			tokeniser->chars_buf->length);
+
+	if (err == HUBBUB_PAUSED)
+		tokeniser->paused = true;
+	else if (err == HUBBUB_STOPPED)
+		tokeniser->stopped = true;
+
+	return err;
+}
+
+/**
+ * Pass an event to the trace handler
+ *
+ * \param tokeniser  Tokeniser instance, which has a trace handler
+ * \param type       Type of event
+ * \param value      State or token type
+ * \param name       Name of \p value
+ */
+void hubbub_tokeniser_trace(hubbub_tokeniser *tokeniser,
+		hubbub_trace_type type, uint32_t value, const char *name)
+{
+	hubbub_trace_event event;
+
+	event.type = type;
+	event.value = value;
+	event.name = name;
+	event.offset = tokeniser->consumed + tokeniser->context.pending;
+
+	tokeniser->trace_handler(&event, tokeniser->trace_pw);
+}
+
+/**
+ * Consult the attribute filter on the name of the current attribute
+ *
+ * This is done as the name is followed by a value, so that the value of
+ * an attribute which is not wanted is never copied into the buffer.
+ *
+ * \param tokeniser  Tokeniser instance
+ */
+void hubbub_tokeniser_filter_attribute(hubbub_tokeniser *tokeniser)
+{
+	hubbub_tag *ctag = &tokeniser->context.current_tag;
+	hubbub_tokeniser_attr_span *span;
+	const hubbub_string *name;
+	const uint8_t *ptr;
+	size_t avail;
+
+	if (tokeniser->attr_filter == NULL)
+		return;
+
+	span = &tokeniser->context.current_attr_spans[ctag->n_attributes - 1];
+	name = &ctag->attributes[ctag->n_attributes - 1].name;
+
+	/* The name is the last string collected */
+	if (span->name.direct) {
+		ptr = hubbub_tokeniser_window(tokeniser, 0, &avail) +
+				span->name.offset;
+	} else {
+		ptr = tokeniser->buffer->data + tokeniser->buffer->length -
+				name->len;
+	}
+
+	span->filtered = true;
+
+	if (hubbub_tokeniser_attr_wanted(tokeniser->attr_filter,
+			ptr, name->len) == false) {
+		/* A dropped value is treated as a span of the input, so that
+		 * none of it is looked for in the buffer */
+		span->value.direct = true;
+		span->value.skip = true;
+		tokeniser->context.values_skipped = true;
+	}
+}
+
+/**
+ * Remove the attributes which the attribute filter does not pass
+ *
+ * The remaining attributes keep their order.
+ *
+ * \param tokeniser     Tokeniser instance
+ * \param attrs         Attributes of current tag
+ * \param n_attributes  Number of attributes
+ * \return Number of attributes remaining
+ */
+uint32_t hubbub_tokeniser_remove_filtered(hubbub_tokeniser *tokeniser,
+		hubbub_attribute *attrs, uint32_t n_attributes)
+{
+	const hubbub_tokeniser_attr_span *spans =
+			tokeniser->context.current_attr_spans;
+	const hubbub_tokeniser_attr_filter *filter = tokeniser->attr_filter;
+	uint32_t i, kept = 0;
+
+	for (i = 0; i < n_attributes; i++) {
+		bool wanted;
+
+		/* Attributes without a value are yet to be considered */
+		if (spans[i].filtered)
+			wanted = (spans[i].value.skip == false);
+		else
+			wanted = (filter == NULL ||
+					hubbub_tokeniser_attr_wanted(filter,
+						attrs[i].name.ptr,
+						attrs[i].name.len));
+
+		if (wanted == false)
+			continue;
+
+		if (kept != i)
+			attrs[kept] = attrs[i];
+
+		kept++;
+	}
+
+	tokeniser->counts.attributes_dropped += n_attributes - kept;
+
+	return kept;
+}
+
+/**
+ * Remove all but the first of each set of attributes with the same name
+ *
+ * The remaining attributes keep their order. Names are found in an open
+ * addressing hash table, so this takes time linear in the number of
+ * attributes; slots are stamped with a per-tag value, so the table need
+ * not be cleared between tags.
+ *
+ * \param tokeniser     Tokeniser instance
+ * \param attrs         Attributes of current tag
+ * \param n_attributes  Number of attributes
+ * \return Number of attributes remaining
+ */
+static uint32_t hubbub_tokeniser_remove_duplicates(hubbub_tokeniser *tokeniser,
+		hubbub_attribute *attrs, uint32_t n_attributes)
+{
+	hubbub_tokeniser_attr_slot *table = tokeniser->context.attr_table;
+	uint32_t mask = 2 * tokeniser->context.attr_alloc - 1;
+	uint32_t stamp = ++tokeniser->context.attr_stamp;
+	uint32_t i, kept = 0;
+
+	assert(n_attributes <= tokeniser->context.attr_alloc);
+
+	if (stamp == 0) {
+		/* Stamp wrapped: forget everything and start again */
+		memset(table, 0,
+			(mask + 1) * sizeof(hubbub_tokeniser_attr_slot));
+		stamp = tokeniser->context.attr_stamp = 1;
+	}
+
+	for (i = 0; i < n_attributes; i++) {
+		const hubbub_string *name = &attrs[i].name;
+		uint32_t hash = hubbub_tokeniser_hash_name(name->ptr,
+				name->len);
+
+		for (hash &= mask; table[hash].stamp == stamp;
+				hash = (hash + 1) & mask) {
+			const hubbub_string *other =
+					&attrs[table[hash].index].name;
+
+			if (other->len == name->len &&
+					memcmp(other->ptr, name->ptr,
+						name->len) == 0)
+				break;
+		}
+
+		if (table[hash].stamp == stamp) {
+			/* Duplicate of an earlier attribute */
+			continue;
+		}
+
+		table[hash].stamp = stamp;
+		table[hash].index = kept;
+
+		if (kept != i)
+			attrs[kept] = attrs[i];
+
+		kept++;
+	}
+
+	return kept;
+}
+
 /**
  * Emit the current tag token being stored in the tokeniser context.
  *
@@ -3219,8 +5827,11 @@ hubbub_error emit_current_tag(hubbub_tokeniser *tokeniser)
 	hubbub_token token;
 	uint32_t n_attributes;
 	hubbub_attribute *attrs;
-	uint8_t *ptr;
-	uint32_t i, j;
+	hubbub_tokeniser_attr_span *spans;
+	const uint8_t *data;
+	const uint8_t *ptr;
+	size_t avail;
+	uint32_t i;
 
 	/* Emit current tag */
 	token.type = tokeniser->context.current_tag_type;
@@ -3230,72 +5841,60 @@ hubbub_error emit_current_tag(hubbub_tokeniser *tokeniser)
 
 	n_attributes = token.data.tag.n_attributes;
 	attrs = token.data.tag.attributes;
+	spans = tokeniser->context.current_attr_spans;
 
-	/* Set pointers correctly... */
+	/* Set pointers correctly: strings that are spans of the input point
+	 * at it directly, the rest are in the buffer, in order */
+	data = hubbub_tokeniser_window(tokeniser, 0, &avail);
 	ptr = tokeniser->buffer->data;
-	token.data.tag.name.ptr = tokeniser->buffer->data;
-	ptr += token.data.tag.name.len;
 
-	for (i = 0; i < n_attributes; i++) {
-		attrs[i].name.ptr = ptr;
-		ptr += attrs[i].name.len;
-		attrs[i].value.ptr = ptr;
-		ptr += attrs[i].value.len;
-	}
+#define SET_PTR(str, span) \
+	do { \
+		if ((span).direct) { \
+			(str).ptr = data + (span).offset; \
+		} else { \
+			(str).ptr = ptr; \
+			ptr += (str).len; \
+		} \
+	} while (0)
 
+	SET_PTR(token.data.tag.name, tokeniser->context.current_tag_name);
 
-	/* Discard duplicate attributes */
 	for (i = 0; i < n_attributes; i++) {
-		for (j = 0; j < n_attributes; j++) {
-			uint32_t move;
-
-			if (j == i ||
-				attrs[i].name.len !=
-						attrs[j].name.len ||
-				strncmp((char *) attrs[i].name.ptr,
-					(char *) attrs[j].name.ptr,
-					attrs[i].name.len) != 0) {
-				/* Attributes don't match */
-				continue;
-			}
+		SET_PTR(attrs[i].name, spans[i].name);
+		SET_PTR(attrs[i].value, spans[i].value);
+	}
 
-			assert(i < j);
+#undef SET_PTR
 
-			/* Calculate amount to move */
-			move = (n_attributes - 1 - j) *
-					sizeof(hubbub_attribute);
+	/* Intern the name, so later stages needn't look it up again */
+	token.data.tag.atom = hubbub_atom_from_name(token.data.tag.name.ptr,
+			token.data.tag.name.len);
 
-			if (move > 0) {
-				memmove(&attrs[j],&attrs[j+1], move);
-			}
 
-			/* We've deleted an item, so we need to 
-			 * reprocess this index */
-			j--;
+	/* Discard unwanted attributes, including any whose values were
+	 * dropped before the filter was removed */
+	if (n_attributes > 0 && (tokeniser->attr_filter != NULL ||
+			tokeniser->context.values_skipped))
+		n_attributes = hubbub_tokeniser_remove_filtered(tokeniser,
+				attrs, n_attributes);
+	tokeniser->context.values_skipped = false;
 
-			/* And reduce the number of attributes */
-			n_attributes--;
-		}
-	}
+	/* Discard duplicate attributes */
+	if (n_attributes > 1 && tokeniser->keep_duplicates == false)
+		n_attributes = hubbub_tokeniser_remove_duplicates(tokeniser,
+				attrs, n_attributes);
 
 	token.data.tag.n_attributes = n_attributes;
 
+	/* This must happen before the token is emitted, as the name may
+	 * point into the input, which emission advances past */
+	if (token.type == HUBBUB_TOKEN_START_TAG)
+		save_start_tag_name(tokeniser, &token.data.tag.name);
+
 	err = hubbub_tokeniser_emit_token(tokeniser, &token);
 
-	if (token.type == HUBBUB_TOKEN_START_TAG) {
-		/* Save start tag name for R?CDATA */
-		if (token.data.tag.name.len <
-			sizeof(tokeniser->context.last_start_tag_name)) {
-			strncpy((char *) tokeniser->context.last_start_tag_name,
-				(const char *) token.data.tag.name.ptr,
-				token.data.tag.name.len);
-			tokeniser->context.last_start_tag_len =
-					token.data.tag.name.len;
-		} else {
-			tokeniser->context.last_start_tag_name[0] = '\0';
-			tokeniser->context.last_start_tag_len = 0;
-		}
-	} else /* if (token->type == HUBBUB_TOKEN_END_TAG) */ {
+	if (token.type == HUBBUB_TOKEN_END_TAG) {
 		/* Reset content model after R?CDATA elements */
 		tokeniser->content_model = HUBBUB_CONTENT_MODEL_PCDATA;
 	}
@@ -3306,6 +5905,25 @@ hubbub_error emit_current_tag(hubbub_tokeniser *tokeniser)
 	return err;
 }
 
+/**
+ * Save the name of a start tag, for matching end tags in R?CDATA
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param name       Name of the start tag
+ */
+void save_start_tag_name(hubbub_tokeniser *tokeniser,
+		const hubbub_string *name)
+{
+	if (name->len < sizeof(tokeniser->context.last_start_tag_name)) {
+		strncpy((char *) tokeniser->context.last_start_tag_name,
+				(const char *) name->ptr, name->len);
+		tokeniser->context.last_start_tag_len = name->len;
+	} else {
+		tokeniser->context.last_start_tag_name[0] = '\0';
+		tokeniser->context.last_start_tag_len = 0;
+	}
+}
+
 /**
  * Emit the current comment token being stored in the tokeniser context.
  *
@@ -3415,9 +6033,38 @@ hubbub_error hubbub_tokeniser_emit_token(hubbub_tokeniser *tokeniser,
 	}
 #endif
 
-	/* Emit the token */
-	if (tokeniser->token_handler) {
-		err = tokeniser->token_handler(token, tokeniser->token_pw);
+	/* Emit the token, merging character tokens if requested */
+	if (tokeniser->coalesce_chars &&
+			token->type == HUBBUB_TOKEN_CHARACTER) {
+		err = hubbub_tokeniser_hold_chars(tokeniser,
+				&token->data.character);
+
+		if (err == HUBBUB_OK && tokeniser->text_limit != 0 &&
+				tokeniser->chars_buf->length >=
+						tokeniser->text_limit)
+			err = hubbub_tokeniser_flush_chars(tokeniser);
+	} else {
+		if (tokeniser->chars_buf->length > 0)
+			err = hubbub_tokeniser_flush_chars(tokeniser);
+
+		tokeniser->counts.tokens[token->type]++;
+		if (token->type == HUBBUB_TOKEN_START_TAG ||
+				token->type == HUBBUB_TOKEN_END_TAG) {
+			tokeniser->counts.attributes +=
+					token->data.tag.n_attributes;
+		}
+
+		if (tokeniser->trace_handler != NULL) {
+			hubbub_tokeniser_trace(tokeniser, HUBBUB_TRACE_TOKEN,
+					token->type, token_names[token->type]);
+		}
+
+		if (tokeniser->token_handler) {
+			hubbub_error e = tokeniser->token_handler(token,
+					tokeniser->token_pw);
+			if (err == HUBBUB_OK)
+				err = e;
+		}
 	}
 
 	/* Discard current buffer */
@@ -3428,22 +6075,22 @@ hubbub_error hubbub_tokeniser_emit_token(hubbub_tokeniser *tokeniser,
 
 	/* Advance the pointer */
 	if (tokeniser->context.pending) {
-		parserutils_inputstream_advance(tokeniser->input,
+		hubbub_tokeniser_advance(tokeniser,
 				tokeniser->context.pending);
 		tokeniser->context.pending = 0;
 	}
 
 	if (tokeniser->insert_buf->length > 0) {
-		parserutils_inputstream_insert(tokeniser->input,
-				tokeniser->insert_buf->data,
-				tokeniser->insert_buf->length);
-		parserutils_buffer_discard(tokeniser->insert_buf, 0,
-				tokeniser->insert_buf->length);
+		hubbub_error e = hubbub_tokeniser_read_inserted(tokeniser);
+		if (err == HUBBUB_OK)
+			err = e;
 	}
 
-	/* Ensure callback can pause the tokenise */
+	/* Ensure callback can pause or stop the tokeniser */
 	if (err == HUBBUB_PAUSED) {
 		tokeniser->paused = true;
+	} else if (err == HUBBUB_STOPPED) {
+		tokeniser->stopped = true;
 	}
 
 	return err;
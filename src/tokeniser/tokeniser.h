@@ -19,6 +19,32 @@
 
 typedef struct hubbub_tokeniser hubbub_tokeniser;
 
+/**
+ * Token read ahead of the tokeniser, to be replayed
+ */
+typedef struct hubbub_replay_token {
+	hubbub_token token;		/**< Token to emit */
+	size_t end;			/**< Offset of the end of the token's
+					 * input, from the start of the
+					 * input it was read from */
+	hubbub_content_model model;	/**< Content model in which the
+					 * token was read */
+} hubbub_replay_token;
+
+/**
+ * State of a tokeniser between tokens, once it has read all its input
+ */
+typedef struct hubbub_tokeniser_snapshot {
+	hubbub_content_model content_model;	/**< Current content model */
+	bool escape_flag;			/**< Escape flag */
+	bool process_cdata;			/**< Whether to process CDATA
+						 * sections */
+	uint8_t last_start_tag_name[10];	/**< Name of the last start tag
+						 * emitted */
+	size_t last_start_tag_len;		/**< Length of that name */
+	size_t consumed;			/**< Bytes of input consumed */
+} hubbub_tokeniser_snapshot;
+
 /**
  * Hubbub tokeniser option types
  */
@@ -27,7 +53,15 @@ typedef enum hubbub_tokeniser_opttype {
 	HUBBUB_TOKENISER_ERROR_HANDLER,
 	HUBBUB_TOKENISER_CONTENT_MODEL,
 	HUBBUB_TOKENISER_PROCESS_CDATA,
-	HUBBUB_TOKENISER_PAUSE
+	HUBBUB_TOKENISER_PAUSE,
+	HUBBUB_TOKENISER_COALESCE_CHARACTERS,
+	HUBBUB_TOKENISER_TEXT_LIMIT,
+	HUBBUB_TOKENISER_WORK_BUDGET,
+	HUBBUB_TOKENISER_BUFFER_SIZE,
+	HUBBUB_TOKENISER_TRACE_HANDLER,
+	HUBBUB_TOKENISER_MEASURE_TIME,
+	HUBBUB_TOKENISER_KEEP_DUPLICATES,
+	HUBBUB_TOKENISER_ATTRIBUTE_FILTER
 } hubbub_tokeniser_opttype;
 
 /**
@@ -51,14 +85,47 @@ typedef union hubbub_tokeniser_optparams {
 	bool process_cdata;		/**< Whether to process CDATA sections*/
 
 	bool pause_parse;		/**< Pause parsing */
+
+	bool coalesce_characters;	/**< Merge adjacent character tokens */
+
+	uint32_t text_limit;		/**< Bytes of text or comment held
+					 * before it is emitted in pieces,
+					 * or 0 for no limit */
+
+	uint32_t work_budget;		/**< Bytes of input read per run
+					 * before yielding, or 0 for no
+					 * limit */
+
+	uint32_t buffer_size;		/**< Bytes of token text to make
+					 * room for ahead of need */
+
+	struct {
+		hubbub_trace_handler handler;
+		void *pw;
+	} trace_handler;		/**< Trace handling callback */
+
+	bool measure_time;		/**< Measure the time spent in runs */
+
+	bool keep_duplicates;		/**< Keep duplicate attributes */
+
+	struct {
+		const char *const *names;
+		uint32_t n_names;
+	} attribute_filter;		/**< Names of the only attributes to
+					 * emit, or NULL to emit all */
 } hubbub_tokeniser_optparams;
 
 /* Create a hubbub tokeniser */
 hubbub_error hubbub_tokeniser_create(parserutils_inputstream *input,
+		hubbub_allocator_fn alloc, void *pw,
 		hubbub_tokeniser **tokeniser);
 /* Destroy a hubbub tokeniser */
 hubbub_error hubbub_tokeniser_destroy(hubbub_tokeniser *tokeniser);
 
+/* Reset a hubbub tokeniser for a new document */
+hubbub_error hubbub_tokeniser_reset(hubbub_tokeniser *tokeniser,
+		parserutils_inputstream *input);
+
 /* Configure a hubbub tokeniser */
 hubbub_error hubbub_tokeniser_setopt(hubbub_tokeniser *tokeniser,
 		hubbub_tokeniser_opttype type,
@@ -68,8 +135,52 @@ hubbub_error hubbub_tokeniser_setopt(hubbub_tokeniser *tokeniser,
 hubbub_error hubbub_tokeniser_insert_chunk(hubbub_tokeniser *tokeniser,
 		const uint8_t *data, size_t len);
 
+/* Supply a chunk of UTF-8 input to be read in place */
+hubbub_error hubbub_tokeniser_borrow_chunk(hubbub_tokeniser *tokeniser,
+		const uint8_t *data, size_t len);
+
+/* Read the number of bytes of input consumed */
+size_t hubbub_tokeniser_read_offset(hubbub_tokeniser *tokeniser);
+
+/* Find where a string lies in the input lent by the client */
+bool hubbub_tokeniser_source_offset(hubbub_tokeniser *tokeniser,
+		const hubbub_string *str, size_t *offset);
+
+/* Read the work done on the current document */
+void hubbub_tokeniser_read_stats(hubbub_tokeniser *tokeniser,
+		hubbub_parser_stats *stats);
+
+/* Read the room the tokeniser holds for token text */
+size_t hubbub_tokeniser_read_buffer_size(hubbub_tokeniser *tokeniser);
+
+/* Read the memory held in the tokeniser's libparserutils buffers */
+size_t hubbub_tokeniser_read_buffer_memory(hubbub_tokeniser *tokeniser);
+
+/* Read the offset of the end of the token being emitted */
+size_t hubbub_tokeniser_read_token_end(hubbub_tokeniser *tokeniser);
+
+/* Continue tokenising from a different input stream */
+hubbub_error hubbub_tokeniser_switch_input(hubbub_tokeniser *tokeniser,
+		parserutils_inputstream *input);
+
+/* Record the state of a tokeniser between tokens */
+hubbub_error hubbub_tokeniser_checkpoint(hubbub_tokeniser *tokeniser,
+		hubbub_tokeniser_snapshot *checkpoint);
+
+/* Return a freshly reset tokeniser to a recorded state */
+hubbub_error hubbub_tokeniser_restore(hubbub_tokeniser *tokeniser,
+		const hubbub_tokeniser_snapshot *checkpoint);
+
+/* Determine whether a comment token is to be continued */
+bool hubbub_tokeniser_in_comment(hubbub_tokeniser *tokeniser);
+
 /* Process remaining data in the input stream */
 hubbub_error hubbub_tokeniser_run(hubbub_tokeniser *tokeniser);
 
+/* Emit tokens which were read ahead of the tokeniser */
+hubbub_error hubbub_tokeniser_replay(hubbub_tokeniser *tokeniser,
+		const uint8_t *data, const hubbub_replay_token *tokens,
+		size_t n_tokens);
+
 #endif
 
@@ -12,6 +12,7 @@
 #include "treebuilder/internal.h"
 #include "treebuilder/treebuilder.h"
 #include "utils/utils.h"
+#include "utils/string.h"
 
 
 /**
@@ -32,14 +33,7 @@ hubbub_error handle_after_body(hubbub_treebuilder *treebuilder,
 		/* mostly cribbed from process_characters_expect_whitespace */
 		const uint8_t *data = token->data.character.ptr;
 		size_t len = token->data.character.len;
-		size_t c;
-
-		/* Scan for whitespace */
-		for (c = 0; c < len; c++) {
-			if (data[c] != 0x09 && data[c] != 0x0A &&
-					data[c] != 0x0C && data[c] != 0x20)
-				break;
-		}
+		size_t c = hubbub_string_space_span(data, len);
 
 		/* Whitespace characters in token, so handle as in body */
 		if (c > 0) {
@@ -72,8 +66,8 @@ hubbub_error handle_after_body(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(treebuilder,
+				&token->data.tag);
 
 		if (type == HTML) {
 			/* Process as if "in body" */
@@ -87,13 +81,14 @@ hubbub_error handle_after_body(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(treebuilder,
+				&token->data.tag);
 
 		if (type == HTML) {
-			/** \todo fragment case */
 			/** \todo parse error */
-			treebuilder->context.mode = AFTER_AFTER_BODY;
+			/* In a fragment, the token is ignored */
+			if (treebuilder->context.fragment.active == false)
+				treebuilder->context.mode = AFTER_AFTER_BODY;
 		} else {
 			/** \todo parse error */
 			treebuilder->context.mode = IN_BODY;
@@ -42,8 +42,8 @@ hubbub_error handle_before_head(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(treebuilder,
+				&token->data.tag);
 
 		if (type == HTML) {
 			/* Process as if "in body" */
@@ -57,8 +57,8 @@ hubbub_error handle_before_head(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(treebuilder,
+				&token->data.tag);
 
 		if (type == HTML || type == BODY ||
 				type == HEAD || type == BR) {
@@ -82,6 +82,7 @@ hubbub_error handle_before_head(hubbub_treebuilder *treebuilder,
 			tag.ns = HUBBUB_NS_HTML;
 			tag.name.ptr = (const uint8_t *) "head";
 			tag.name.len = SLEN("head");
+			tag.atom = element_type_to_atom(HEAD);
 
 			tag.n_attributes = 0;
 			tag.attributes = NULL;
@@ -93,8 +94,7 @@ hubbub_error handle_before_head(hubbub_treebuilder *treebuilder,
 		if (e != HUBBUB_OK)
 			return e;
 
-		treebuilder->tree_handler->ref_node(
-				treebuilder->tree_handler->ctx,
+		treebuilder_ref_node(treebuilder,
 				treebuilder->context.element_stack[
 				treebuilder->context.current_node].node);
 
@@ -41,8 +41,8 @@ hubbub_error handle_before_html(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(treebuilder,
+				&token->data.tag);
 
 		if (type == HTML) {
 			handled = true;
@@ -60,12 +60,6 @@ hubbub_error handle_before_html(hubbub_treebuilder *treebuilder,
 
 	if (handled || err == HUBBUB_REPROCESS) {
 		hubbub_error e;
-		void *html, *appended;
-
-		/* We can't use insert_element() here, as it assumes
-		 * that we're inserting into current_node. There is
-		 * no current_node to insert into at this point so
-		 * we get to do it manually. */
 
 		if (err == HUBBUB_REPROCESS) {
 			/* Need to manufacture html element */
@@ -74,43 +68,20 @@ hubbub_error handle_before_html(hubbub_treebuilder *treebuilder,
 			tag.ns = HUBBUB_NS_HTML;
 			tag.name.ptr = (const uint8_t *) "html";
 			tag.name.len = SLEN("html");
+			tag.atom = element_type_to_atom(HTML);
 
 			tag.n_attributes = 0;
 			tag.attributes = NULL;
 
-			e = treebuilder->tree_handler->create_element(
-					treebuilder->tree_handler->ctx,
-					&tag, &html);
+			e = insert_root_element(treebuilder, &tag);
 		} else {
-			e = treebuilder->tree_handler->create_element(
-					treebuilder->tree_handler->ctx,
-					&token->data.tag, &html);
+			e = insert_root_element(treebuilder,
+					&token->data.tag);
 		}
 
 		if (e != HUBBUB_OK)
 			return e;
 
-		e = treebuilder->tree_handler->append_child(
-				treebuilder->tree_handler->ctx,
-				treebuilder->context.document,
-				html, &appended);
-
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,
-				html);
-
-		if (e != HUBBUB_OK)
-			return e;
-
-		/* We can't use element_stack_push() here, as it 
-		 * assumes that current_node is pointing at the index 
-		 * before the one to insert at. For the first entry in 
-		 * the stack, this does not hold so we must insert
-		 * manually. */
-		treebuilder->context.element_stack[0].type = HTML;
-		treebuilder->context.element_stack[0].node = appended;
-		treebuilder->context.current_node = 0;
-
 		/** \todo cache selection algorithm */
 
 		treebuilder->context.mode = BEFORE_HEAD;
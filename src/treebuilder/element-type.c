@@ -5,6 +5,8 @@
  * Copyright 2021 Michael Drake <tlsa@netsurf-browser.org>
  */
 
+#include <hubbub/atom.h>
+
 #include "treebuilder/element-type.h"
 
 /* Auto-generated by `gperf`. */
@@ -47,3 +49,38 @@ const char *element_type_to_name(element_type type)
 
 	return "UNKNOWN";
 }
+
+/* Exported function, documented in hubbub/atom.h */
+hubbub_atom hubbub_atom_from_name(const uint8_t *name, size_t len)
+{
+	const struct element_type_map *value;
+
+	if (name == NULL)
+		return HUBBUB_ATOM_UNKNOWN;
+
+	value = hubbub_element_type_generated_lookup((const char *) name, len);
+	if (value == NULL) {
+		return HUBBUB_ATOM_UNKNOWN;
+	}
+
+	return element_type_to_atom(value->type);
+}
+
+/* Exported function, documented in hubbub/atom.h */
+const char *hubbub_atom_to_name(hubbub_atom atom)
+{
+	element_type type = element_type_from_atom(atom);
+	size_t i;
+
+	if (type == UNKNOWN)
+		return NULL;
+
+	for (i = 0; i < sizeof(wordlist) / sizeof(wordlist[0]); i++) {
+		/* Skip empty slots in the generated table */
+		if (wordlist[i].name[0] != '\0' && wordlist[i].type == type) {
+			return wordlist[i].name;
+		}
+	}
+
+	return NULL;
+}
@@ -61,5 +61,48 @@ element_type element_type_from_name(
  */
 const char *element_type_to_name(element_type type);
 
+/**
+ * Convert an element type to the corresponding atom
+ *
+ * \param type  The element type
+ * \return The atom for the type
+ */
+static inline hubbub_atom element_type_to_atom(element_type type)
+{
+	return (type == UNKNOWN) ? HUBBUB_ATOM_UNKNOWN : (hubbub_atom) type + 1;
+}
+
+/**
+ * Convert an atom to the corresponding element type
+ *
+ * \param atom  The atom
+ * \return The element type for the atom
+ */
+static inline element_type element_type_from_atom(hubbub_atom atom)
+{
+	if (atom == HUBBUB_ATOM_UNKNOWN || atom > (hubbub_atom) UNKNOWN)
+		return UNKNOWN;
+
+	return (element_type) (atom - 1);
+}
+
+/**
+ * Find the element type of a tag
+ *
+ * This uses the atom the tokeniser interned the tag's name as, rather than
+ * looking the name up again.
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param tag          The tag to consider
+ * \return The corresponding element type
+ */
+static inline element_type element_type_from_tag(
+		hubbub_treebuilder *treebuilder, const hubbub_tag *tag)
+{
+	UNUSED(treebuilder);
+
+	return element_type_from_atom(tag->atom);
+}
+
 #endif
 
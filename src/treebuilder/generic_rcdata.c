@@ -55,8 +55,8 @@ hubbub_error handle_generic_rcdata(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(treebuilder,
+				&token->data.tag);
 
 		if (type != treebuilder->context.collect.type) {
 			/** \todo parse error */
@@ -93,9 +93,7 @@ hubbub_error handle_generic_rcdata(hubbub_treebuilder *treebuilder,
 		/* Pop the current node from the stack */
 		element_stack_pop(treebuilder, &ns, &otype, &node);
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,
-				node);
+		treebuilder_unref_node(treebuilder, node);
 
 		/* Return to previous insertion mode */
 		treebuilder->context.mode = treebuilder->context.collect.mode;
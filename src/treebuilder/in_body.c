@@ -12,17 +12,262 @@
 #include "treebuilder/internal.h"
 #include "treebuilder/treebuilder.h"
 #include "utils/utils.h"
+#include "utils/string.h"
 
 #undef DEBUG_IN_BODY
 
+/** Most passes the adoption agency's outer loop makes for one end tag */
+#define AA_OUTER_LOOP_LIMIT 8
+
+/** Passes of the inner loop after which formatting elements are dropped */
+#define AA_INNER_LOOP_LIMIT 3
+
 /**
  * Bookmark for formatting list. Used in adoption agency
  */
 typedef struct bookmark {
-	formatting_list_entry *prev;	/**< Previous entry */
-	formatting_list_entry *next;	/**< Next entry */
+	uint32_t prev;			/**< Previous entry */
+	uint32_t next;			/**< Next entry */
 } bookmark;
 
+/** Ways in which "in body" handles start tags */
+typedef enum start_tag_class {
+	START_PHRASING,
+	START_HTML,
+	START_IN_HEAD,
+	START_BODY,
+	START_FRAMESET,
+	START_CONTAINER,
+	START_HEADING,
+	START_PRE,
+	START_FORM,
+	START_DD_DT_LI,
+	START_PLAINTEXT,
+	START_A,
+	START_PRESENTATIONAL,
+	START_NOBR,
+	START_BUTTON,
+	START_APPLET_MARQUEE_OBJECT,
+	START_XMP,
+	START_TABLE,
+	START_VOID,
+	START_HR,
+	START_IMAGE,
+	START_ISINDEX,
+	START_TEXTAREA,
+	START_RAWTEXT,
+	START_NOSCRIPT,
+	START_SELECT,
+	START_OPT,
+	START_RUBY,
+	START_FOREIGN,
+	START_IGNORED
+} start_tag_class;
+
+/** Ways in which "in body" handles end tags */
+typedef enum end_tag_class {
+	END_GENERIC,
+	END_BODY,
+	END_HTML,
+	END_CONTAINER,
+	END_FORM,
+	END_P,
+	END_DD_DT_LI,
+	END_HEADING,
+	END_FORMATTING,
+	END_APPLET_BUTTON_MARQUEE_OBJECT,
+	END_BR,
+	END_IGNORED,
+	END_NOSCRIPT
+} end_tag_class;
+
+/** Handling of start tags, indexed by element type */
+static const uint8_t start_tag_classes[UNKNOWN + 1] = {
+	[HTML] = START_HTML,
+	[BASE] = START_IN_HEAD,
+	[COMMAND] = START_IN_HEAD,
+	[LINK] = START_IN_HEAD,
+	[META] = START_IN_HEAD,
+	[NOFRAMES] = START_IN_HEAD,
+	[SCRIPT] = START_IN_HEAD,
+	[STYLE] = START_IN_HEAD,
+	[TITLE] = START_IN_HEAD,
+	[BODY] = START_BODY,
+	[FRAMESET] = START_FRAMESET,
+	[ADDRESS] = START_CONTAINER,
+	[ARTICLE] = START_CONTAINER,
+	[ASIDE] = START_CONTAINER,
+	[BLOCKQUOTE] = START_CONTAINER,
+	[CENTER] = START_CONTAINER,
+	[DATAGRID] = START_CONTAINER,
+	[DETAILS] = START_CONTAINER,
+	[DIALOG] = START_CONTAINER,
+	[DIR] = START_CONTAINER,
+	[DIV] = START_CONTAINER,
+	[DL] = START_CONTAINER,
+	[FIELDSET] = START_CONTAINER,
+	[FIGCAPTION] = START_CONTAINER,
+	[FIGURE] = START_CONTAINER,
+	[FOOTER] = START_CONTAINER,
+	[HEADER] = START_CONTAINER,
+	[MAIN] = START_CONTAINER,
+	[MENU] = START_CONTAINER,
+	[NAV] = START_CONTAINER,
+	[OL] = START_CONTAINER,
+	[P] = START_CONTAINER,
+	[SECTION] = START_CONTAINER,
+	[SUMMARY] = START_CONTAINER,
+	[UL] = START_CONTAINER,
+	[H1] = START_HEADING,
+	[H2] = START_HEADING,
+	[H3] = START_HEADING,
+	[H4] = START_HEADING,
+	[H5] = START_HEADING,
+	[H6] = START_HEADING,
+	[PRE] = START_PRE,
+	[LISTING] = START_PRE,
+	[FORM] = START_FORM,
+	[DD] = START_DD_DT_LI,
+	[DT] = START_DD_DT_LI,
+	[LI] = START_DD_DT_LI,
+	[PLAINTEXT] = START_PLAINTEXT,
+	[A] = START_A,
+	[B] = START_PRESENTATIONAL,
+	[BIG] = START_PRESENTATIONAL,
+	[CODE] = START_PRESENTATIONAL,
+	[EM] = START_PRESENTATIONAL,
+	[FONT] = START_PRESENTATIONAL,
+	[I] = START_PRESENTATIONAL,
+	[S] = START_PRESENTATIONAL,
+	[SMALL] = START_PRESENTATIONAL,
+	[STRIKE] = START_PRESENTATIONAL,
+	[STRONG] = START_PRESENTATIONAL,
+	[TT] = START_PRESENTATIONAL,
+	[U] = START_PRESENTATIONAL,
+	[NOBR] = START_NOBR,
+	[BUTTON] = START_BUTTON,
+	[APPLET] = START_APPLET_MARQUEE_OBJECT,
+	[MARQUEE] = START_APPLET_MARQUEE_OBJECT,
+	[OBJECT] = START_APPLET_MARQUEE_OBJECT,
+	[XMP] = START_XMP,
+	[TABLE] = START_TABLE,
+	[AREA] = START_VOID,
+	[BASEFONT] = START_VOID,
+	[BGSOUND] = START_VOID,
+	[BR] = START_VOID,
+	[EMBED] = START_VOID,
+	[IMG] = START_VOID,
+	[INPUT] = START_VOID,
+	[PARAM] = START_VOID,
+	[SPACER] = START_VOID,
+	[WBR] = START_VOID,
+	[HR] = START_HR,
+	[IMAGE] = START_IMAGE,
+	[ISINDEX] = START_ISINDEX,
+	[TEXTAREA] = START_TEXTAREA,
+	[IFRAME] = START_RAWTEXT,
+	[NOEMBED] = START_RAWTEXT,
+	[NOSCRIPT] = START_NOSCRIPT,
+	[SELECT] = START_SELECT,
+	[OPTGROUP] = START_OPT,
+	[OPTION] = START_OPT,
+	[RP] = START_RUBY,
+	[RT] = START_RUBY,
+	[MATH] = START_FOREIGN,
+	[SVG] = START_FOREIGN,
+	[CAPTION] = START_IGNORED,
+	[COL] = START_IGNORED,
+	[COLGROUP] = START_IGNORED,
+	[FRAME] = START_IGNORED,
+	[HEAD] = START_IGNORED,
+	[TBODY] = START_IGNORED,
+	[TD] = START_IGNORED,
+	[TFOOT] = START_IGNORED,
+	[TH] = START_IGNORED,
+	[THEAD] = START_IGNORED,
+	[TR] = START_IGNORED
+};
+
+/** Handling of end tags, indexed by element type */
+static const uint8_t end_tag_classes[UNKNOWN + 1] = {
+	[BODY] = END_BODY,
+	[HTML] = END_HTML,
+	[ADDRESS] = END_CONTAINER,
+	[ARTICLE] = END_CONTAINER,
+	[ASIDE] = END_CONTAINER,
+	[BLOCKQUOTE] = END_CONTAINER,
+	[CENTER] = END_CONTAINER,
+	[DETAILS] = END_CONTAINER,
+	[DIALOG] = END_CONTAINER,
+	[DIR] = END_CONTAINER,
+	[DATAGRID] = END_CONTAINER,
+	[DIV] = END_CONTAINER,
+	[DL] = END_CONTAINER,
+	[FIELDSET] = END_CONTAINER,
+	[FIGCAPTION] = END_CONTAINER,
+	[FIGURE] = END_CONTAINER,
+	[FOOTER] = END_CONTAINER,
+	[HEADER] = END_CONTAINER,
+	[LISTING] = END_CONTAINER,
+	[MAIN] = END_CONTAINER,
+	[MENU] = END_CONTAINER,
+	[NAV] = END_CONTAINER,
+	[OL] = END_CONTAINER,
+	[PRE] = END_CONTAINER,
+	[SECTION] = END_CONTAINER,
+	[SUMMARY] = END_CONTAINER,
+	[UL] = END_CONTAINER,
+	[FORM] = END_FORM,
+	[P] = END_P,
+	[DD] = END_DD_DT_LI,
+	[DT] = END_DD_DT_LI,
+	[LI] = END_DD_DT_LI,
+	[H1] = END_HEADING,
+	[H2] = END_HEADING,
+	[H3] = END_HEADING,
+	[H4] = END_HEADING,
+	[H5] = END_HEADING,
+	[H6] = END_HEADING,
+	[A] = END_FORMATTING,
+	[B] = END_FORMATTING,
+	[BIG] = END_FORMATTING,
+	[CODE] = END_FORMATTING,
+	[EM] = END_FORMATTING,
+	[FONT] = END_FORMATTING,
+	[I] = END_FORMATTING,
+	[NOBR] = END_FORMATTING,
+	[S] = END_FORMATTING,
+	[SMALL] = END_FORMATTING,
+	[STRIKE] = END_FORMATTING,
+	[STRONG] = END_FORMATTING,
+	[TT] = END_FORMATTING,
+	[U] = END_FORMATTING,
+	[APPLET] = END_APPLET_BUTTON_MARQUEE_OBJECT,
+	[BUTTON] = END_APPLET_BUTTON_MARQUEE_OBJECT,
+	[MARQUEE] = END_APPLET_BUTTON_MARQUEE_OBJECT,
+	[OBJECT] = END_APPLET_BUTTON_MARQUEE_OBJECT,
+	[BR] = END_BR,
+	[AREA] = END_IGNORED,
+	[BASEFONT] = END_IGNORED,
+	[BGSOUND] = END_IGNORED,
+	[EMBED] = END_IGNORED,
+	[HR] = END_IGNORED,
+	[IFRAME] = END_IGNORED,
+	[IMAGE] = END_IGNORED,
+	[IMG] = END_IGNORED,
+	[INPUT] = END_IGNORED,
+	[ISINDEX] = END_IGNORED,
+	[NOEMBED] = END_IGNORED,
+	[NOFRAMES] = END_IGNORED,
+	[PARAM] = END_IGNORED,
+	[SELECT] = END_IGNORED,
+	[SPACER] = END_IGNORED,
+	[TABLE] = END_IGNORED,
+	[TEXTAREA] = END_IGNORED,
+	[WBR] = END_IGNORED,
+	[NOSCRIPT] = END_NOSCRIPT
+};
+
 static hubbub_error process_character(hubbub_treebuilder *treebuilder,
 		const hubbub_token *token);
 static hubbub_error process_start_tag(hubbub_treebuilder *treebuilder,
@@ -64,6 +309,7 @@ static hubbub_error process_image_in_body(hubbub_treebuilder *treebuilder,
 		const hubbub_token *token);
 static hubbub_error process_isindex_in_body(hubbub_treebuilder *treebuilder,
 		const hubbub_token *token);
+static bool isindex_inherits(const hubbub_attribute *attr);
 static hubbub_error process_textarea_in_body(hubbub_treebuilder *treebuilder,
 		const hubbub_token *token);
 static hubbub_error process_select_in_body(hubbub_treebuilder *treebuilder,
@@ -93,11 +339,13 @@ static hubbub_error process_0generic_in_body(hubbub_treebuilder *treebuilder,
 
 static hubbub_error aa_find_and_validate_formatting_element(
 		hubbub_treebuilder *treebuilder, element_type type,
-		formatting_list_entry **element);
-static formatting_list_entry *aa_find_formatting_element(
+		uint32_t *element);
+static uint32_t aa_find_formatting_element(
 		hubbub_treebuilder *treebuilder, element_type type);
+static void aa_pop_formatting_element(hubbub_treebuilder *treebuilder,
+		uint32_t formatting_element);
 static hubbub_error aa_find_furthest_block(hubbub_treebuilder *treebuilder,
-		formatting_list_entry *formatting_element, 
+		uint32_t formatting_element, 
 		uint32_t *furthest_block);
 static hubbub_error aa_reparent_node(hubbub_treebuilder *treebuilder, 
 		void *node, void *new_parent, void **reparented);
@@ -105,12 +353,14 @@ static hubbub_error aa_find_bookmark_location_reparenting_misnested(
 		hubbub_treebuilder *treebuilder, 
 		uint32_t formatting_element, uint32_t *furthest_block,
 		bookmark *bookmark, uint32_t *last_node);
+static void aa_forget_entry(hubbub_treebuilder *treebuilder,
+		uint32_t entry, bookmark *bookmark);
 static hubbub_error aa_remove_element_stack_item(
 		hubbub_treebuilder *treebuilder, 
 		uint32_t index, uint32_t limit);
 static hubbub_error aa_clone_and_replace_entries(
 		hubbub_treebuilder *treebuilder,
-		formatting_list_entry *element);
+		uint32_t element);
 
 
 /**
@@ -195,7 +445,6 @@ hubbub_error process_character(hubbub_treebuilder *treebuilder,
 	hubbub_error err = HUBBUB_OK;
 	hubbub_string dummy = token->data.character;
 	bool lr_flag = treebuilder->context.strip_leading_lr;
-	const uint8_t *p;
 
 	err = reconstruct_active_formatting_list(treebuilder);
 	if (err != HUBBUB_OK)
@@ -222,15 +471,10 @@ hubbub_error process_character(hubbub_treebuilder *treebuilder,
 		}
 	}
 
-	if (treebuilder->context.frameset_ok) {
-		for (p = dummy.ptr; p < dummy.ptr + dummy.len; p++) {
-			if (*p != 0x0009 && *p != 0x000a &&
-					*p != 0x000c && *p != 0x0020) {
-				treebuilder->context.frameset_ok = false;
-				break;
-			}
-		}
-	}
+	if (treebuilder->context.frameset_ok &&
+			hubbub_string_space_span(dummy.ptr, dummy.len) !=
+					dummy.len)
+		treebuilder->context.frameset_ok = false;
 
 	return HUBBUB_OK;
 }
@@ -248,64 +492,64 @@ hubbub_error process_start_tag(hubbub_treebuilder *treebuilder,
 		const hubbub_token *token)
 {
 	hubbub_error err = HUBBUB_OK;
-	element_type type = element_type_from_name(treebuilder,
-			&token->data.tag.name);
+	element_type type = element_type_from_tag(treebuilder,
+			&token->data.tag);
 
-	if (type == HTML) {
+	switch (start_tag_classes[type]) {
+	case START_HTML:
 		err = process_html_in_body(treebuilder, token);
-	} else if (type == BASE || type == COMMAND || type == LINK ||
-			type == META || type == NOFRAMES || type == SCRIPT ||
-			type == STYLE || type == TITLE) {
+		break;
+	case START_IN_HEAD:
 		/* Process as "in head" */
 		err = handle_in_head(treebuilder, token);
-	} else if (type == BODY) {
+		break;
+	case START_BODY:
 		err = process_body_in_body(treebuilder, token);
-	} else if (type == FRAMESET) {
+		break;
+	case START_FRAMESET:
 		err = process_frameset_in_body(treebuilder, token);
-	} else if (type == ADDRESS || type == ARTICLE || type == ASIDE ||
-			type == BLOCKQUOTE || type == CENTER ||
-			type == DATAGRID || type == DETAILS ||
-			type == DIALOG || type == DIR ||
-			type == DIV || type == DL || type == FIELDSET ||
-			type == FIGCAPTION || type == FIGURE ||
-			type == FOOTER || type == HEADER || type == MAIN ||
-			type == MENU || type == NAV || type == OL ||
-			type == P || type == SECTION || type == SUMMARY ||
-			type == UL) {
+		break;
+	case START_CONTAINER:
 		err = process_container_in_body(treebuilder, token);
-	} else if (type == H1 || type == H2 || type == H3 ||
-			type == H4 || type == H5 || type == H6) {
+		break;
+	case START_HEADING:
 		err = process_hN_in_body(treebuilder, token);
-	} else if (type == PRE || type == LISTING) {
+		break;
+	case START_PRE:
 		err = process_container_in_body(treebuilder, token);
 
 		if (err == HUBBUB_OK) {
 			treebuilder->context.strip_leading_lr = true;
 			treebuilder->context.frameset_ok = false;
 		}
-	} else if (type == FORM) {
+		break;
+	case START_FORM:
 		err = process_form_in_body(treebuilder, token);
-	} else if (type == DD || type == DT || type == LI) {
+		break;
+	case START_DD_DT_LI:
 		err = process_dd_dt_li_in_body(treebuilder, token, type);
-	} else if (type == PLAINTEXT) {
+		break;
+	case START_PLAINTEXT:
 		err = process_plaintext_in_body(treebuilder, token);
-	} else if (type == A) {
+		break;
+	case START_A:
 		err = process_a_in_body(treebuilder, token);
-	} else if (type == B || type == BIG || type == CODE || type == EM || 
-			type == FONT || type == I || type == S || 
-			type == SMALL || type == STRIKE || 
-			type == STRONG || type == TT || type == U) {
+		break;
+	case START_PRESENTATIONAL:
 		err = process_presentational_in_body(treebuilder, 
 				token, type);
-	} else if (type == NOBR) {
+		break;
+	case START_NOBR:
 		err = process_nobr_in_body(treebuilder, token);
-	} else if (type == BUTTON) {
+		break;
+	case START_BUTTON:
 		err = process_button_in_body(treebuilder, token);
-	} else if (type == APPLET || type == MARQUEE || 
-			type == OBJECT) {
+		break;
+	case START_APPLET_MARQUEE_OBJECT:
 		err = process_applet_marquee_object_in_body(treebuilder,
 				token, type);
-	} else if (type == XMP) {
+		break;
+	case START_XMP:
 		err = reconstruct_active_formatting_list(treebuilder);
 		if (err != HUBBUB_OK)
 			return err;
@@ -313,7 +557,8 @@ hubbub_error process_start_tag(hubbub_treebuilder *treebuilder,
 		treebuilder->context.frameset_ok = false;
 
 		err = parse_generic_rcdata(treebuilder, token, false);
-	} else if (type == TABLE) {
+		break;
+	case START_TABLE:
 		err = process_container_in_body(treebuilder, token);
 		if (err == HUBBUB_OK) {
 			treebuilder->context.frameset_ok = false;
@@ -322,10 +567,8 @@ hubbub_error process_start_tag(hubbub_treebuilder *treebuilder,
 				current_table(treebuilder)].tainted = false;
 			treebuilder->context.mode = IN_TABLE;
 		}
-	} else if (type == AREA || type == BASEFONT || 
-			type == BGSOUND || type == BR || 
-			type == EMBED || type == IMG || type == INPUT ||
-			type == PARAM || type == SPACER || type == WBR) {
+		break;
+	case START_VOID:
 		err = reconstruct_active_formatting_list(treebuilder);
 		if (err != HUBBUB_OK)
 			return err;
@@ -333,22 +576,31 @@ hubbub_error process_start_tag(hubbub_treebuilder *treebuilder,
 		err = insert_element(treebuilder, &token->data.tag, false);
 		if (err == HUBBUB_OK)
 			treebuilder->context.frameset_ok = false;
-	} else if (type == HR) {
+		break;
+	case START_HR:
 		err = process_hr_in_body(treebuilder, token);
-	} else if (type == IMAGE) {
+		break;
+	case START_IMAGE:
 		err = process_image_in_body(treebuilder, token);
-	} else if (type == ISINDEX) {
+		break;
+	case START_ISINDEX:
 		err = process_isindex_in_body(treebuilder, token);
-	} else if (type == TEXTAREA) {
+		break;
+	case START_TEXTAREA:
 		err = process_textarea_in_body(treebuilder, token);
-	} else if (type == IFRAME || type == NOEMBED || 
-			type == NOFRAMES || 
-			(treebuilder->context.enable_scripting && 
-			type == NOSCRIPT)) {
+		break;
+	case START_NOSCRIPT:
+		if (treebuilder->context.enable_scripting == false) {
+			err = process_phrasing_in_body(treebuilder, token);
+			break;
+		}
+		/* Fall through */
+	case START_RAWTEXT:
 		if (type == IFRAME)
 			treebuilder->context.frameset_ok = false;
 		err = parse_generic_rcdata(treebuilder, token, false);
-	} else if (type == SELECT) {
+		break;
+	case START_SELECT:
 		err = process_select_in_body(treebuilder, token);
 		if (err != HUBBUB_OK)
 			return err;
@@ -363,11 +615,15 @@ hubbub_error process_start_tag(hubbub_treebuilder *treebuilder,
 				treebuilder->context.mode == IN_CELL) {
 			treebuilder->context.mode = IN_SELECT_IN_TABLE;
 		}
-	} else if (type == OPTGROUP || type == OPTION) {
+		break;
+	case START_OPT:
 		err = process_opt_in_body(treebuilder, token);
-	} else if (type == RP || type == RT) {
+		break;
+	case START_RUBY:
 		/** \todo ruby */
-	} else if (type == MATH || type == SVG) {
+		break;
+	case START_FOREIGN:
+	{
 		hubbub_tag tag = token->data.tag;
 
 		err = reconstruct_active_formatting_list(treebuilder);
@@ -395,13 +651,14 @@ hubbub_error process_start_tag(hubbub_treebuilder *treebuilder,
 				treebuilder->context.mode = IN_FOREIGN_CONTENT;
 			}
 		}
-	} else if (type == CAPTION || type == COL || type == COLGROUP ||
-			type == FRAME || type == HEAD || type == TBODY ||
-			type == TD || type == TFOOT || type == TH ||
-			type == THEAD || type == TR) {
+	}
+		break;
+	case START_IGNORED:
 		/** \todo parse error */
-	} else {
+		break;
+	case START_PHRASING:
 		err = process_phrasing_in_body(treebuilder, token);
+		break;
 	}
 
 	return err;
@@ -418,63 +675,58 @@ hubbub_error process_end_tag(hubbub_treebuilder *treebuilder,
 		const hubbub_token *token)
 {
 	hubbub_error err = HUBBUB_OK;
-	element_type type = element_type_from_name(treebuilder,
-			&token->data.tag.name);
+	element_type type = element_type_from_tag(treebuilder,
+			&token->data.tag);
 
-	if (type == BODY) {
+	switch (end_tag_classes[type]) {
+	case END_BODY:
 		err = process_0body_in_body(treebuilder);
 		/* Never reprocess */
 		if (err == HUBBUB_REPROCESS)
 			err = HUBBUB_OK;
-	} else if (type == HTML) {
+		break;
+	case END_HTML:
 		/* Act as if </body> has been seen then, if
 		 * that wasn't ignored, reprocess this token */
 		err = process_0body_in_body(treebuilder);
-	} else if (type == ADDRESS || type == ARTICLE || type == ASIDE ||
-			type == BLOCKQUOTE || type == CENTER ||
-			type == DETAILS || type == DIALOG || type == DIR ||
-			type == DATAGRID || type == DIV || type == DL ||
-			type == FIELDSET || type == FIGCAPTION ||
-			type == FIGURE || type == FOOTER || type == HEADER ||
-			type == LISTING || type == MAIN|| type == MENU ||
-			type == NAV || type == OL || type == PRE ||
-			type == SECTION || type == SUMMARY || type == UL) {
+		break;
+	case END_CONTAINER:
 		err = process_0container_in_body(treebuilder, type);
-	} else if (type == FORM) {
+		break;
+	case END_FORM:
 		err = process_0form_in_body(treebuilder);
-	} else if (type == P) {
+		break;
+	case END_P:
 		err = process_0p_in_body(treebuilder);
-	} else if (type == DD || type == DT || type == LI) {
+		break;
+	case END_DD_DT_LI:
 		err = process_0dd_dt_li_in_body(treebuilder, type);
-	} else if (type == H1 || type == H2 || type == H3 || 
-			type == H4 || type == H5 || type == H6) {
+		break;
+	case END_HEADING:
 		err = process_0h_in_body(treebuilder, type);
-	} else if (type == A || type == B || type == BIG || type == CODE ||
-			type == EM || type == FONT || type == I ||
-			type == NOBR || type == S || type == SMALL ||
-			type == STRIKE || type == STRONG ||
-			type == TT || type == U) {
+		break;
+	case END_FORMATTING:
 		err = process_0presentational_in_body(treebuilder, type);
-	} else if (type == APPLET || type == BUTTON ||
-			type == MARQUEE || type == OBJECT) {
+		break;
+	case END_APPLET_BUTTON_MARQUEE_OBJECT:
 		err = process_0applet_button_marquee_object_in_body(
 				treebuilder, type);
-	} else if (type == BR) {
+		break;
+	case END_BR:
 		err = process_0br_in_body(treebuilder);
-	} else if (type == AREA || type == BASEFONT || 
-			type == BGSOUND || type == EMBED || 
-			type == HR || type == IFRAME ||
-			type == IMAGE || type == IMG ||
-			type == INPUT || type == ISINDEX ||
-			type == NOEMBED || type == NOFRAMES ||
-			type == PARAM || type == SELECT ||
-			type == SPACER || type == TABLE ||
-			type == TEXTAREA || type == WBR ||
-			(treebuilder->context.enable_scripting && 
-					type == NOSCRIPT)) {
+		break;
+	case END_NOSCRIPT:
+		if (treebuilder->context.enable_scripting == false) {
+			err = process_0generic_in_body(treebuilder, type);
+			break;
+		}
+		/* Fall through */
+	case END_IGNORED:
 		/** \todo parse error */
-	} else {
+		break;
+	case END_GENERIC:
 		err = process_0generic_in_body(treebuilder, type);
+		break;
 	}
 
 	return err;
@@ -607,9 +859,7 @@ hubbub_error process_hN_in_body(hubbub_treebuilder *treebuilder,
 		err = element_stack_pop(treebuilder, &ns, &otype, &node);
 		assert(err == HUBBUB_OK);
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,
-				node);
+		treebuilder_unref_node(treebuilder, node);
 	}
 
 	return insert_element(treebuilder, &token->data.tag, true);
@@ -641,10 +891,9 @@ hubbub_error process_form_in_body(hubbub_treebuilder *treebuilder,
 
 		/* Claim a reference on the node and 
 		 * use it as the current form element */
-		treebuilder->tree_handler->ref_node(
-			treebuilder->tree_handler->ctx,
-			treebuilder->context.element_stack[
-			treebuilder->context.current_node].node);
+		treebuilder_ref_node(treebuilder,
+				treebuilder->context.element_stack[
+				treebuilder->context.current_node].node);
 
 		treebuilder->context.form_element =
 			treebuilder->context.element_stack[
@@ -712,9 +961,7 @@ hubbub_error process_dd_dt_li_in_body(hubbub_treebuilder *treebuilder,
 					&otype, &node);
 			assert(err == HUBBUB_OK);
 
-			treebuilder->tree_handler->unref_node(
-					treebuilder->tree_handler->ctx,
-					node);
+			treebuilder_unref_node(treebuilder, node);
 		} while (treebuilder->context.current_node >= node);
 	}
 
@@ -763,13 +1010,14 @@ hubbub_error process_a_in_body(hubbub_treebuilder *treebuilder,
 		const hubbub_token *token)
 {
 	hubbub_error err;
-	formatting_list_entry *entry = 
-			aa_find_formatting_element(treebuilder, A);
+	uint32_t entry = aa_find_formatting_element(treebuilder, A);
 
-	if (entry != NULL) {
-		uint32_t index = entry->stack_index;
-		void *node = entry->details.node;
-		formatting_list_entry *entry2;
+	if (entry != 0) {
+		formatting_list_entry *list =
+				treebuilder->context.formatting_entries;
+		uint32_t index = list[entry].stack_index;
+		void *node = list[entry].details.node;
+		uint32_t entry2;
 
 		/** \todo parse error */
 
@@ -779,9 +1027,10 @@ hubbub_error process_a_in_body(hubbub_treebuilder *treebuilder,
 			return err;
 
 		entry2 = aa_find_formatting_element(treebuilder, A);
+		list = treebuilder->context.formatting_entries;
 
 		/* Remove from formatting list, if it's still there */
-		if (entry2 == entry && entry2->details.node == node) {
+		if (entry2 == entry && list[entry2].details.node == node) {
 			hubbub_ns ons;
 			element_type otype;
 			void *onode;
@@ -791,8 +1040,7 @@ hubbub_error process_a_in_body(hubbub_treebuilder *treebuilder,
 					&ons, &otype, &onode, &oindex);
 			assert(err == HUBBUB_OK);
 
-			treebuilder->tree_handler->unref_node(
-					treebuilder->tree_handler->ctx, onode);
+			treebuilder_unref_node(treebuilder, onode);
 				
 		}
 
@@ -808,8 +1056,7 @@ hubbub_error process_a_in_body(hubbub_treebuilder *treebuilder,
 					&otype,	&onode);
 			assert(err == HUBBUB_OK);
 
-			treebuilder->tree_handler->unref_node(
-					treebuilder->tree_handler->ctx, onode);
+			treebuilder_unref_node(treebuilder, onode);
 		}
 	}
 
@@ -821,9 +1068,9 @@ hubbub_error process_a_in_body(hubbub_treebuilder *treebuilder,
 	if (err != HUBBUB_OK)
 		return err;
 
-	treebuilder->tree_handler->ref_node(treebuilder->tree_handler->ctx,
-		treebuilder->context.element_stack[
-		treebuilder->context.current_node].node);
+	treebuilder_ref_node(treebuilder,
+			treebuilder->context.element_stack[
+			treebuilder->context.current_node].node);
 
 	err = formatting_list_append(treebuilder, token->data.tag.ns, A, 
 		treebuilder->context.element_stack[
@@ -841,11 +1088,9 @@ hubbub_error process_a_in_body(hubbub_treebuilder *treebuilder,
 		element_stack_pop(treebuilder, &ns, &type, &node);
 
 		/* Unref twice (once for stack, once for formatting list) */
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx, node);
+		treebuilder_unref_node(treebuilder, node);
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx, node);
+		treebuilder_unref_node(treebuilder, node);
 
 		return err;
 	}
@@ -874,9 +1119,9 @@ hubbub_error process_presentational_in_body(hubbub_treebuilder *treebuilder,
 	if (err != HUBBUB_OK)
 		return err;
 
-	treebuilder->tree_handler->ref_node(treebuilder->tree_handler->ctx,
-		treebuilder->context.element_stack[
-		treebuilder->context.current_node].node);
+	treebuilder_ref_node(treebuilder,
+			treebuilder->context.element_stack[
+			treebuilder->context.current_node].node);
 
 	err = formatting_list_append(treebuilder, token->data.tag.ns, type, 
 		treebuilder->context.element_stack[
@@ -894,11 +1139,9 @@ hubbub_error process_presentational_in_body(hubbub_treebuilder *treebuilder,
 		element_stack_pop(treebuilder, &ns, &type, &node);
 
 		/* Unref twice (once for stack, once for formatting list) */
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx, node);
+		treebuilder_unref_node(treebuilder, node);
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx, node);
+		treebuilder_unref_node(treebuilder, node);
 
 		return err;
 	}
@@ -939,10 +1182,9 @@ hubbub_error process_nobr_in_body(hubbub_treebuilder *treebuilder,
 	if (err != HUBBUB_OK)
 		return err;
 
-	treebuilder->tree_handler->ref_node(
-		treebuilder->tree_handler->ctx,
-		treebuilder->context.element_stack[
-		treebuilder->context.current_node].node);
+	treebuilder_ref_node(treebuilder,
+			treebuilder->context.element_stack[
+			treebuilder->context.current_node].node);
 
 	err = formatting_list_append(treebuilder, token->data.tag.ns, NOBR, 
 		treebuilder->context.element_stack[
@@ -960,11 +1202,9 @@ hubbub_error process_nobr_in_body(hubbub_treebuilder *treebuilder,
 		element_stack_pop(treebuilder, &ns, &type, &node);
 
 		/* Unref twice (once for stack, once for formatting list) */
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx, node);
+		treebuilder_unref_node(treebuilder, node);
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx, node);
+		treebuilder_unref_node(treebuilder, node);
 
 		return err;
 	}
@@ -1000,10 +1240,9 @@ hubbub_error process_button_in_body(hubbub_treebuilder *treebuilder,
 	if (err != HUBBUB_OK)
 		return err;
 
-	treebuilder->tree_handler->ref_node(
-		treebuilder->tree_handler->ctx,
-		treebuilder->context.element_stack[
-		treebuilder->context.current_node].node);
+	treebuilder_ref_node(treebuilder,
+			treebuilder->context.element_stack[
+			treebuilder->context.current_node].node);
 
 	err = formatting_list_append(treebuilder, token->data.tag.ns, BUTTON, 
 		treebuilder->context.element_stack[
@@ -1021,11 +1260,9 @@ hubbub_error process_button_in_body(hubbub_treebuilder *treebuilder,
 		element_stack_pop(treebuilder, &ns, &type, &node);
 
 		/* Unref twice (once for stack, once for formatting list) */
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx, node);
+		treebuilder_unref_node(treebuilder, node);
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx, node);
+		treebuilder_unref_node(treebuilder, node);
 
 		return err;
 	}
@@ -1056,10 +1293,9 @@ hubbub_error process_applet_marquee_object_in_body(
 	if (err != HUBBUB_OK)
 		return err;
 
-	treebuilder->tree_handler->ref_node(
-		treebuilder->tree_handler->ctx,
-		treebuilder->context.element_stack[
-		treebuilder->context.current_node].node);
+	treebuilder_ref_node(treebuilder,
+			treebuilder->context.element_stack[
+			treebuilder->context.current_node].node);
 
 	err = formatting_list_append(treebuilder, token->data.tag.ns, type, 
 		treebuilder->context.element_stack[
@@ -1077,11 +1313,9 @@ hubbub_error process_applet_marquee_object_in_body(
 		element_stack_pop(treebuilder, &ns, &type, &node);
 
 		/* Unref twice (once for stack, once for formatting list) */
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx, node);
+		treebuilder_unref_node(treebuilder, node);
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx, node);
+		treebuilder_unref_node(treebuilder, node);
 
 		return err;
 	}
@@ -1130,6 +1364,7 @@ hubbub_error process_image_in_body(hubbub_treebuilder *treebuilder,
 	tag.ns = HUBBUB_NS_HTML;
 	tag.name.ptr = (const uint8_t *) "img";
 	tag.name.len = SLEN("img");
+	tag.atom = element_type_to_atom(IMG);
 
 	tag.n_attributes = token->data.tag.n_attributes;
 	tag.attributes = token->data.tag.attributes;
@@ -1141,58 +1376,75 @@ hubbub_error process_image_in_body(hubbub_treebuilder *treebuilder,
 	return insert_element(treebuilder, &tag, false);
 }
 
+/**
+ * Determine whether the input made for an isindex has one of its attributes
+ *
+ * \param attr  The isindex attribute to consider
+ * \return True unless the attribute is action, prompt or name
+ */
+bool isindex_inherits(const hubbub_attribute *attr)
+{
+	static const struct {
+		const char *name;
+		size_t len;
+	} excluded[] = {
+		{ "action", SLEN("action") },
+		{ "prompt", SLEN("prompt") },
+		{ "name", SLEN("name") }
+	};
+	size_t i;
+
+	for (i = 0; i < N_ELEMENTS(excluded); i++) {
+		if (attr->name.len == excluded[i].len &&
+				memcmp(attr->name.ptr, excluded[i].name,
+						excluded[i].len) == 0)
+			return false;
+	}
+
+	return true;
+}
+
 /**
  * Process an isindex start tag as if in "in body"
  *
  * \param treebuilder  The treebuilder instance
  * \param token        The token to process
+ *
+ * The attributes of the input are handed to the client straight from the
+ * token, a run at a time, so that none need be copied.
  */
 hubbub_error process_isindex_in_body(hubbub_treebuilder *treebuilder,
 		const hubbub_token *token)
 {
+	static const hubbub_attribute isindex_name = {
+		HUBBUB_NS_HTML,
+		{ (const uint8_t *) "name", SLEN("name") },
+		{ (const uint8_t *) "isindex", SLEN("isindex") }
+	};
+	const hubbub_tag *tag = &token->data.tag;
 	hubbub_error err;
 	hubbub_token dummy;
 	hubbub_attribute *action = NULL;
 	hubbub_attribute *prompt = NULL;
-	hubbub_attribute *attrs = NULL;
-	size_t n_attrs = 0;
+	uint32_t i, end;
+	void *input;
 
 	/** \todo parse error */
 
 	if (treebuilder->context.form_element != NULL)
 		return HUBBUB_OK;
 
-	/* First up, clone the token's attributes */
-	if (token->data.tag.n_attributes > 0) {
-		uint32_t i;
-		attrs = malloc((token->data.tag.n_attributes + 1) *
-						sizeof(hubbub_attribute));
-		if (attrs == NULL)
-			return HUBBUB_NOMEM;
-
-		for (i = 0; i < token->data.tag.n_attributes; i++) {
-			hubbub_attribute *attr = &token->data.tag.attributes[i];
-			const uint8_t *name = attr->name.ptr;
-
-			if (strncmp((const char *) name, "action",
-					attr->name.len) == 0) {
-				action = attr;
-			} else if (strncmp((const char *) name, "prompt",
-					attr->name.len) == 0) {
-				prompt = attr;
-			} else if (strncmp((const char *) name, "name",
-					attr->name.len) == 0) {
-			} else {
-				attrs[n_attrs++] = *attr;
-			}
-		}
+	for (i = 0; i < tag->n_attributes; i++) {
+		hubbub_attribute *attr = &tag->attributes[i];
+
+		/* Those not inherited are action, prompt and name */
+		if (isindex_inherits(attr))
+			continue;
 
-		attrs[n_attrs].ns = HUBBUB_NS_HTML;
-		attrs[n_attrs].name.ptr = (const uint8_t *) "name";
-		attrs[n_attrs].name.len = SLEN("name");
-		attrs[n_attrs].value.ptr = (const uint8_t *) "isindex";
-		attrs[n_attrs].value.len = SLEN("isindex");
-		n_attrs++;
+		if (attr->name.ptr[0] == 'a')
+			action = attr;
+		else if (attr->name.ptr[0] == 'p')
+			prompt = attr;
 	}
 
 	/* isindex algorithm */
@@ -1204,51 +1456,47 @@ hubbub_error process_isindex_in_body(hubbub_treebuilder *treebuilder,
 	/* Act as if <form> were seen */
 	dummy.data.tag.name.ptr = (const uint8_t *) "form";
 	dummy.data.tag.name.len = SLEN("form");
+	dummy.data.tag.atom = element_type_to_atom(FORM);
 
 	dummy.data.tag.n_attributes = action != NULL ? 1 : 0;
 	dummy.data.tag.attributes = action;
 
 	err = process_form_in_body(treebuilder, &dummy);
-	if (err != HUBBUB_OK) {
-		free(attrs);
+	if (err != HUBBUB_OK)
 		return err;
-	}
 
 	/* Act as if <hr> were seen */
 	dummy.data.tag.name.ptr = (const uint8_t *) "hr";
 	dummy.data.tag.name.len = SLEN("hr");
+	dummy.data.tag.atom = element_type_to_atom(HR);
 	dummy.data.tag.n_attributes = 0;
 	dummy.data.tag.attributes = NULL;
 
 	err = process_hr_in_body(treebuilder, &dummy);
-	if (err != HUBBUB_OK) {
-		free(attrs);
+	if (err != HUBBUB_OK)
 		return err;
-	}
 
 	/* Act as if <p> were seen */
 	dummy.data.tag.name.ptr = (const uint8_t *) "p";
 	dummy.data.tag.name.len = SLEN("p");
+	dummy.data.tag.atom = element_type_to_atom(P);
 	dummy.data.tag.n_attributes = 0;
 	dummy.data.tag.attributes = NULL;
 
 	err = process_container_in_body(treebuilder, &dummy);
-	if (err != HUBBUB_OK) {
-		free(attrs);
+	if (err != HUBBUB_OK)
 		return err;
-	}
 
 	/* Act as if <label> were seen */
 	dummy.data.tag.name.ptr = (const uint8_t *) "label";
 	dummy.data.tag.name.len = SLEN("label");
+	dummy.data.tag.atom = element_type_to_atom(LABEL);
 	dummy.data.tag.n_attributes = 0;
 	dummy.data.tag.attributes = NULL;
 
 	err = process_phrasing_in_body(treebuilder, &dummy);
-	if (err != HUBBUB_OK) {
-		free(attrs);
+	if (err != HUBBUB_OK)
 		return err;
-	}
 
 	/* Act as if a stream of characters were seen */
 	dummy.type = HUBBUB_TOKEN_CHARACTER;
@@ -1263,34 +1511,66 @@ hubbub_error process_isindex_in_body(hubbub_treebuilder *treebuilder,
 	}
 	
 	err = process_character(treebuilder, &dummy);
-	if (err != HUBBUB_OK) {
-		free(attrs);
+	if (err != HUBBUB_OK)
 		return err;
-	}
 
 	/* Act as if <input> was seen */
 	dummy.type = HUBBUB_TOKEN_START_TAG;
 	dummy.data.tag.ns = HUBBUB_NS_HTML;
 	dummy.data.tag.name.ptr = (const uint8_t *) "input";
 	dummy.data.tag.name.len = SLEN("input");
-
-	dummy.data.tag.n_attributes = n_attrs;
-	dummy.data.tag.attributes = attrs;
+	dummy.data.tag.atom = element_type_to_atom(INPUT);
 
 	err = reconstruct_active_formatting_list(treebuilder);
-	if (err != HUBBUB_OK) {
-		free(attrs);
+	if (err != HUBBUB_OK)
 		return err;
+
+	/* The element is created with the leading run of attributes that
+	 * it inherits, then given any later runs, and then its name */
+	for (end = 0; end < tag->n_attributes &&
+			isindex_inherits(&tag->attributes[end]); end++)
+		continue;
+
+	dummy.data.tag.n_attributes = end;
+	dummy.data.tag.attributes = end > 0 ? tag->attributes : NULL;
+
+	err = treebuilder->tree_handler->create_element(
+			treebuilder->tree_handler->ctx, &dummy.data.tag,
+			&input);
+	if (err != HUBBUB_OK)
+		return err;
+
+	for (i = end; err == HUBBUB_OK && i < tag->n_attributes; i = end) {
+		while (i < tag->n_attributes &&
+				!isindex_inherits(&tag->attributes[i]))
+			i++;
+
+		for (end = i; end < tag->n_attributes &&
+				isindex_inherits(&tag->attributes[end]); end++)
+			continue;
+
+		if (end > i) {
+			err = treebuilder->tree_handler->add_attributes(
+					treebuilder->tree_handler->ctx, input,
+					&tag->attributes[i], end - i);
+		}
+	}
+
+	if (err == HUBBUB_OK) {
+		err = treebuilder->tree_handler->add_attributes(
+				treebuilder->tree_handler->ctx, input,
+				&isindex_name, 1);
 	}
 
-	err = insert_element(treebuilder, &dummy.data.tag, false);
 	if (err != HUBBUB_OK) {
-		free(attrs);
+		treebuilder_unref_node(treebuilder, input);
 		return err;
 	}
 
-	/* No longer need attrs */
-	free(attrs);
+	err = insert_created_element(treebuilder, HUBBUB_NS_HTML, INPUT,
+			input, false);
+	if (err != HUBBUB_OK)
+		return err;
 
 	treebuilder->context.frameset_ok = false;
 
@@ -1306,6 +1586,7 @@ hubbub_error process_isindex_in_body(hubbub_treebuilder *treebuilder,
 	/* Act as if <hr> was seen */
 	dummy.data.tag.name.ptr = (const uint8_t *) "hr";
 	dummy.data.tag.name.len = SLEN("hr");
+	dummy.data.tag.atom = element_type_to_atom(HR);
 	dummy.data.tag.n_attributes = 0;
 	dummy.data.tag.attributes = NULL;
 
@@ -1458,9 +1739,7 @@ hubbub_error process_0container_in_body(hubbub_treebuilder *treebuilder,
 
 			element_stack_pop(treebuilder, &ns, &otype, &node);
 
-			treebuilder->tree_handler->unref_node(
-					treebuilder->tree_handler->ctx,
-					node);
+			treebuilder_unref_node(treebuilder, node);
 
 			popped++;
 		} while (otype != type);
@@ -1484,8 +1763,7 @@ hubbub_error process_0form_in_body(hubbub_treebuilder *treebuilder)
 	uint32_t idx = 0;
 
 	if (treebuilder->context.form_element != NULL)
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,
+		treebuilder_unref_node(treebuilder,
 				treebuilder->context.form_element);
 	treebuilder->context.form_element = NULL;
 
@@ -1510,9 +1788,7 @@ hubbub_error process_0form_in_body(hubbub_treebuilder *treebuilder)
 		element_stack_remove(treebuilder, idx, 
 				&ns, &otype, &onode);
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,
-				onode);
+		treebuilder_unref_node(treebuilder, onode);
 	}
 
 	return HUBBUB_OK;
@@ -1542,8 +1818,7 @@ hubbub_error process_0p_in_body(hubbub_treebuilder *treebuilder)
 		err = element_stack_pop(treebuilder, &ns, &type, &node);
 		assert(err == HUBBUB_OK);
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx, node);
+		treebuilder_unref_node(treebuilder, node);
 
 		popped++;
 	}
@@ -1555,6 +1830,7 @@ hubbub_error process_0p_in_body(hubbub_treebuilder *treebuilder)
 		dummy.data.tag.ns = HUBBUB_NS_HTML;
 		dummy.data.tag.name.ptr = (const uint8_t *) "p";
 		dummy.data.tag.name.len = SLEN("p");
+		dummy.data.tag.atom = element_type_to_atom(P);
 		dummy.data.tag.n_attributes = 0;
 		dummy.data.tag.attributes = NULL;
 
@@ -1596,9 +1872,7 @@ hubbub_error process_0dd_dt_li_in_body(hubbub_treebuilder *treebuilder,
 			element_stack_pop(treebuilder, 
 					&ns, &otype, &node);
 
-			treebuilder->tree_handler->unref_node(
-					treebuilder->tree_handler->ctx,
-					node);
+			treebuilder_unref_node(treebuilder, node);
 
 			popped++;
 		} while (otype != type);
@@ -1640,9 +1914,7 @@ hubbub_error process_0h_in_body(hubbub_treebuilder *treebuilder,
 
 			element_stack_pop(treebuilder, &ns, &otype, &node);
 
-			treebuilder->tree_handler->unref_node(
-					treebuilder->tree_handler->ctx,
-					node);
+			treebuilder_unref_node(treebuilder, node);
 
 			popped++;
 		} while (otype != H1 && otype != H2 &&
@@ -1669,13 +1941,17 @@ hubbub_error process_0presentational_in_body(hubbub_treebuilder *treebuilder,
 		element_type type)
 {
 	hubbub_error err;
+	uint32_t outer;
 
 	/* Welcome to the adoption agency */
+	treebuilder->context.aa_counts.runs++;
 
-	while (true) {
+	for (outer = 0; outer < AA_OUTER_LOOP_LIMIT; outer++) {
 		element_context *stack = treebuilder->context.element_stack;
 
+		formatting_list_entry *list;
 		formatting_list_entry *entry;
+		uint32_t entry_index;
 		uint32_t formatting_element;
 		uint32_t common_ancestor;
 		uint32_t furthest_block;
@@ -1691,20 +1967,37 @@ hubbub_error process_0presentational_in_body(hubbub_treebuilder *treebuilder,
 
 		/* 1 */
 		err = aa_find_and_validate_formatting_element(treebuilder,
-				type, &entry);
+				type, &entry_index);
 		assert(err == HUBBUB_OK || err == HUBBUB_REPROCESS);
 		if (err == HUBBUB_OK)
 			return err;
 
+		/* Nothing below adds to the formatting list until step 11,
+		 * so the entry will not move until then */
+		list = treebuilder->context.formatting_entries;
+		entry = &list[entry_index];
+
 		assert(entry->details.type == type);
 
+		treebuilder->context.aa_counts.iterations++;
+
+		/* Once the document has used up its clone budget, act as
+		 * if there were no furthest block, which clones nothing */
+		if (treebuilder->aa_clone_limit != 0 &&
+				treebuilder->context.aa_counts.clones >=
+				treebuilder->aa_clone_limit) {
+			treebuilder->context.aa_counts.limited = true;
+			aa_pop_formatting_element(treebuilder, entry_index);
+			return HUBBUB_OK;
+		}
+
 		/* Take a copy of the stack index for use
 		 * during stack manipulation */
 		formatting_element = entry->stack_index;
 
 		/* 2 & 3 */
 		err = aa_find_furthest_block(treebuilder,
-				entry, &furthest_block);
+				entry_index, &furthest_block);
 		assert(err == HUBBUB_OK || err == HUBBUB_REPROCESS);
 		if (err == HUBBUB_OK)
 			return err;
@@ -1723,14 +2016,24 @@ hubbub_error process_0presentational_in_body(hubbub_treebuilder *treebuilder,
 		if (err != HUBBUB_OK)
 			return err;
 
+		/* Steps 6, 7 and 9 may each move the current table, as the
+		 * furthest block or a child of it */
+		forget_foster_parent(treebuilder);
+
 		/* 7 */
 		if (stack[common_ancestor].type == TABLE ||
 				stack[common_ancestor].type == TBODY ||
 				stack[common_ancestor].type == TFOOT ||
 				stack[common_ancestor].type == THEAD ||
 				stack[common_ancestor].type == TR) {
-			err = aa_insert_into_foster_parent(treebuilder,
-					stack[last_node].node, &reparented);
+			err = remove_node_from_dom(treebuilder,
+					stack[last_node].node);
+			if (err == HUBBUB_OK) {
+				err = aa_insert_into_foster_parent(
+						treebuilder,
+						stack[last_node].node,
+						&reparented);
+			}
 		} else {
 			err = aa_reparent_node(treebuilder, 
 					stack[last_node].node,
@@ -1740,26 +2043,21 @@ hubbub_error process_0presentational_in_body(hubbub_treebuilder *treebuilder,
 		if (err != HUBBUB_OK)
 			return err;
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,
-				stack[last_node].node);
+		treebuilder_unref_node(treebuilder, stack[last_node].node);
 
 		/* If the reparented node is not the same as the one we were
 		 * previously using, then have it take the place of the other
 		 * one in the formatting list and stack. */
 		if (reparented != stack[last_node].node) {
-			struct formatting_list_entry *node_entry;
-			for (node_entry = treebuilder->context.formatting_list_end;
-					node_entry != NULL; 
-					node_entry = node_entry->prev) {
-				if (node_entry->stack_index == last_node) {
-					treebuilder->tree_handler->ref_node(
-						treebuilder->tree_handler->ctx,
-						reparented);
-					node_entry->details.node = reparented;
-					treebuilder->tree_handler->unref_node(
-						treebuilder->tree_handler->ctx,
-						stack[last_node].node);
+			uint32_t n;
+			for (n = treebuilder->context.formatting_list_end;
+					n != 0; n = list[n].prev) {
+				if (list[n].stack_index == last_node) {
+					treebuilder_ref_node(treebuilder,
+							reparented);
+					list[n].details.node = reparented;
+					treebuilder_unref_node(treebuilder,
+							stack[last_node].node);
 					break;
 				}
 			}
@@ -1775,14 +2073,15 @@ hubbub_error process_0presentational_in_body(hubbub_treebuilder *treebuilder,
 		if (err != HUBBUB_OK)
 			return err;
 
+		treebuilder->context.aa_counts.clones++;
+
 		/* 9 */
 		err = treebuilder->tree_handler->reparent_children(
 				treebuilder->tree_handler->ctx,
 				stack[furthest_block].node, fe_clone);
+		forget_foster_parent(treebuilder);
 		if (err != HUBBUB_OK) {
-			treebuilder->tree_handler->unref_node(
-					treebuilder->tree_handler->ctx,
-					fe_clone);
+			treebuilder_unref_node(treebuilder, fe_clone);
 			return err;
 		}
 
@@ -1792,22 +2091,16 @@ hubbub_error process_0presentational_in_body(hubbub_treebuilder *treebuilder,
 				stack[furthest_block].node, fe_clone,
 				&clone_appended);
 		if (err != HUBBUB_OK) {
-			treebuilder->tree_handler->unref_node(
-					treebuilder->tree_handler->ctx,
-					fe_clone);
+			treebuilder_unref_node(treebuilder, fe_clone);
 			return err;
 		}
 
 		if (clone_appended != fe_clone) {
 			/* No longer interested in fe_clone */
-			treebuilder->tree_handler->unref_node(
-					treebuilder->tree_handler->ctx, 
-					fe_clone);
+			treebuilder_unref_node(treebuilder, fe_clone);
 			/* Need an extra reference, as we'll insert into the 
 			 * formatting list and element stack */
-			treebuilder->tree_handler->ref_node(
-					treebuilder->tree_handler->ctx,
-					clone_appended);
+			treebuilder_ref_node(treebuilder, clone_appended);
 		}
 
 		/* 11 and 12 are reversed here so that we know the correct
@@ -1825,27 +2118,27 @@ hubbub_error process_0presentational_in_body(hubbub_treebuilder *treebuilder,
 		 * we insert an entry for clone */
 		stack[furthest_block + 1].type = entry->details.type;
 		stack[furthest_block + 1].node = clone_appended;
+		treebuilder->context.type_count[entry->details.type]++;
 
 		/* 11 */
-		err = formatting_list_remove(treebuilder, entry,
+		err = formatting_list_remove(treebuilder, entry_index,
 				&ons, &otype, &onode, &oindex);
 		assert(err == HUBBUB_OK);
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,	onode);
+		treebuilder_unref_node(treebuilder, onode);
 
 		err = formatting_list_insert(treebuilder,
 				bookmark.prev, bookmark.next,
 				ons, otype, clone_appended, furthest_block + 1);
 		if (err != HUBBUB_OK) {
-			treebuilder->tree_handler->unref_node(
-					treebuilder->tree_handler->ctx,
-					clone_appended);
+			treebuilder_unref_node(treebuilder, clone_appended);
 			return err;
 		}
 
 		/* 13 */
 	}
+
+	return HUBBUB_OK;
 }
 
 /**
@@ -1859,15 +2152,22 @@ hubbub_error process_0presentational_in_body(hubbub_treebuilder *treebuilder,
  */
 hubbub_error aa_find_and_validate_formatting_element(
 		hubbub_treebuilder *treebuilder,
-		element_type type, formatting_list_entry **element)
+		element_type type, uint32_t *element)
 {
 	formatting_list_entry *entry;
+	uint32_t index;
+
+	index = aa_find_formatting_element(treebuilder, type);
+	if (index == 0) {
+		/** \todo parse error */
+		return HUBBUB_OK;
+	}
 
-	entry = aa_find_formatting_element(treebuilder, type);
+	entry = &treebuilder->context.formatting_entries[index];
 
-	if (entry == NULL || (entry->stack_index != 0 &&
+	if (entry->stack_index != 0 &&
 			element_in_scope(treebuilder, entry->details.type,
-					false) != entry->stack_index)) {
+					false) != entry->stack_index) {
 		/** \todo parse error */
 		return HUBBUB_OK;
 	}
@@ -1877,15 +2177,14 @@ hubbub_error aa_find_and_validate_formatting_element(
 		hubbub_ns ns;
 		element_type type;
 		void *node;
-		uint32_t index;
+		uint32_t stack_index;
 
 		/** \todo parse error */
 
-		formatting_list_remove(treebuilder, entry,
-				&ns, &type, &node, &index);
+		formatting_list_remove(treebuilder, index,
+				&ns, &type, &node, &stack_index);
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx, node);
+		treebuilder_unref_node(treebuilder, node);
 
 		return HUBBUB_OK;
 	}
@@ -1894,7 +2193,7 @@ hubbub_error aa_find_and_validate_formatting_element(
 		/** \todo parse error */
 	}
 
-	*element = entry;
+	*element = index;
 
 	return HUBBUB_REPROCESS;
 }
@@ -1904,25 +2203,26 @@ hubbub_error aa_find_and_validate_formatting_element(
  *
  * \param treebuilder  The treebuilder instance
  * \param type         Type of element to search for
- * \return Pointer to formatting element, or NULL if none found
+ * \return Index of formatting element, or 0 if none found
  */
-formatting_list_entry *aa_find_formatting_element(
+uint32_t aa_find_formatting_element(
 		hubbub_treebuilder *treebuilder, element_type type)
 {
-	formatting_list_entry *entry;
+	formatting_list_entry *list = treebuilder->context.formatting_entries;
+	uint32_t entry;
 
 	for (entry = treebuilder->context.formatting_list_end;
-			entry != NULL; entry = entry->prev) {
+			entry != 0; entry = list[entry].prev) {
 
 		/* Assumption: HTML and TABLE elements are not in the list */
-		if (is_scoping_element(entry->details.type) ||
-				entry->details.type == type)
+		if (is_scoping_element(list[entry].details.type) ||
+				list[entry].details.type == type)
 			break;
 	}
 
 	/* Check if we stopped on a marker, rather than a formatting element */
-	if (entry != NULL && is_scoping_element(entry->details.type))
-		entry = NULL;
+	if (entry != 0 && is_scoping_element(list[entry].details.type))
+		entry = 0;
 
 	return entry;
 }
@@ -1931,16 +2231,17 @@ formatting_list_entry *aa_find_formatting_element(
  * Adoption agency: find furthest block
  *
  * \param treebuilder         The treebuilder instance
- * \param formatting_element  The formatting element
+ * \param formatting_element  Index of the formatting element in the list
  * \param furthest_block      Pointer to location to receive furthest block
  * \return HUBBUB_REPROCESS to continue processing (::furthest_block filled in),
  *         HUBBUB_OK to stop.
  */
 hubbub_error aa_find_furthest_block(hubbub_treebuilder *treebuilder,
-		formatting_list_entry *formatting_element,
+		uint32_t formatting_element,
 		uint32_t *furthest_block)
 {
-	uint32_t fe_index = formatting_element->stack_index;
+	uint32_t fe_index = treebuilder->context.formatting_entries[
+			formatting_element].stack_index;
 	uint32_t fb;
 
 	for (fb = fe_index + 1; fb <= treebuilder->context.current_node; fb++) {
@@ -1951,34 +2252,44 @@ hubbub_error aa_find_furthest_block(hubbub_treebuilder *treebuilder,
 	}
 
 	if (fb > treebuilder->context.current_node) {
-		hubbub_ns ns;
-		element_type type;
-		void *node;
-		uint32_t index;
+		aa_pop_formatting_element(treebuilder, formatting_element);
+		return HUBBUB_OK;
+	}
 
-		/* Pop all elements off the stack up to,
-		 * and including, the formatting element */
-		do {
-			element_stack_pop(treebuilder, &ns, &type, &node);
+	*furthest_block = fb;
 
-			treebuilder->tree_handler->unref_node(
-					treebuilder->tree_handler->ctx,
-					node);
-		} while (treebuilder->context.current_node >= fe_index);
+	return HUBBUB_REPROCESS;
+}
 
-		/* Remove the formatting element from the list */
-		formatting_list_remove(treebuilder, formatting_element,
-				&ns, &type, &node, &index);
+/**
+ * Adoption agency: close the formatting element, with no furthest block
+ *
+ * Pops all elements off the stack up to, and including, the formatting
+ * element, then removes the formatting element from the list.
+ *
+ * \param treebuilder         The treebuilder instance
+ * \param formatting_element  Index of the formatting element in the list
+ */
+void aa_pop_formatting_element(hubbub_treebuilder *treebuilder,
+		uint32_t formatting_element)
+{
+	uint32_t fe_index = treebuilder->context.formatting_entries[
+			formatting_element].stack_index;
+	hubbub_ns ns;
+	element_type type;
+	void *node;
+	uint32_t index;
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx, node);
+	do {
+		element_stack_pop(treebuilder, &ns, &type, &node);
 
-		return HUBBUB_OK;
-	}
+		treebuilder_unref_node(treebuilder, node);
+	} while (treebuilder->context.current_node >= fe_index);
 
-	*furthest_block = fb;
+	formatting_list_remove(treebuilder, formatting_element,
+			&ns, &type, &node, &index);
 
-	return HUBBUB_REPROCESS;
+	treebuilder_unref_node(treebuilder, node);
 }
 
 /**
@@ -2021,8 +2332,10 @@ hubbub_error aa_find_bookmark_location_reparenting_misnested(
 {
 	hubbub_error err;
 	element_context *stack = treebuilder->context.element_stack;
+	formatting_list_entry *list = treebuilder->context.formatting_entries;
 	uint32_t node, last, fb;
-	formatting_list_entry *node_entry;
+	uint32_t node_entry;
+	uint32_t inner = 0;
 
 	node = last = fb = *furthest_block;
 
@@ -2031,17 +2344,27 @@ hubbub_error aa_find_bookmark_location_reparenting_misnested(
 
 		/* i */
 		node--;
+		inner++;
 
 		/* ii */
 		for (node_entry = treebuilder->context.formatting_list_end;
-				node_entry != NULL;
-				node_entry = node_entry->prev) {
-			if (node_entry->stack_index == node)
+				node_entry != 0;
+				node_entry = list[node_entry].prev) {
+			if (list[node_entry].stack_index == node)
 				break;
 		}
 
+		/* After the third pass, drop formatting elements from the
+		 * list rather than cloning them, as the spec requires. This
+		 * bounds the work done for deeply misnested formatting. */
+		if (inner > AA_INNER_LOOP_LIMIT && node_entry != 0 &&
+				node != formatting_element) {
+			aa_forget_entry(treebuilder, node_entry, bookmark);
+			node_entry = 0;
+		}
+
 		/* Node is not in list of active formatting elements */
-		if (node_entry == NULL) {
+		if (node_entry == 0) {
 			err = aa_remove_element_stack_item(treebuilder,
 				node, treebuilder->context.current_node);
 			assert(err == HUBBUB_OK);
@@ -2065,7 +2388,7 @@ hubbub_error aa_find_bookmark_location_reparenting_misnested(
 		/* iv */
 		if (last == fb) {
 			bookmark->prev = node_entry;
-			bookmark->next = node_entry->next;
+			bookmark->next = list[node_entry].next;
 		}
 
 		/* v */
@@ -2079,9 +2402,7 @@ hubbub_error aa_find_bookmark_location_reparenting_misnested(
 		if (err != HUBBUB_OK)
 			return err;
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,
-				stack[last].node);
+		treebuilder_unref_node(treebuilder, stack[last].node);
 
 		/* If the reparented node is not the same as the one we were
 		 * previously using, then have it take the place of the other
@@ -2089,16 +2410,15 @@ hubbub_error aa_find_bookmark_location_reparenting_misnested(
 		if (reparented != stack[last].node) {
 			for (node_entry = 
 				treebuilder->context.formatting_list_end;
-					node_entry != NULL; 
-					node_entry = node_entry->prev) {
-				if (node_entry->stack_index == last) {
-					treebuilder->tree_handler->ref_node(
-						treebuilder->tree_handler->ctx,
-						reparented);
-					node_entry->details.node = reparented;
-					treebuilder->tree_handler->unref_node(
-						treebuilder->tree_handler->ctx,
-						stack[last].node);
+					node_entry != 0; 
+					node_entry = list[node_entry].prev) {
+				if (list[node_entry].stack_index == last) {
+					treebuilder_ref_node(treebuilder,
+							reparented);
+					list[node_entry].details.node =
+							reparented;
+					treebuilder_unref_node(treebuilder,
+							stack[last].node);
 					break;
 				}
 			}
@@ -2119,6 +2439,33 @@ hubbub_error aa_find_bookmark_location_reparenting_misnested(
 	return HUBBUB_OK;
 }
 
+/**
+ * Adoption agency: remove an entry from the list of active formatting
+ * elements without disturbing the bookmark
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param entry        Index of the entry to remove
+ * \param bookmark     Bookmark to keep in place
+ */
+void aa_forget_entry(hubbub_treebuilder *treebuilder, uint32_t entry,
+		bookmark *bookmark)
+{
+	formatting_list_entry *list = treebuilder->context.formatting_entries;
+	hubbub_ns ns;
+	element_type type;
+	void *node;
+	uint32_t index;
+
+	if (bookmark->prev == entry)
+		bookmark->prev = list[entry].prev;
+	if (bookmark->next == entry)
+		bookmark->next = list[entry].next;
+
+	formatting_list_remove(treebuilder, entry, &ns, &type, &node, &index);
+
+	treebuilder_unref_node(treebuilder, node);
+}
+
 /**
  * Adoption agency: remove an entry from the stack at the given index
  *
@@ -2148,24 +2495,29 @@ hubbub_error aa_remove_element_stack_item(hubbub_treebuilder *treebuilder,
 				(is_scoping_element(stack[n].type) &&
 				stack[n].type != HTML &&
 				stack[n].type != TABLE)) {
-			formatting_list_entry *e;
+			formatting_list_entry *list =
+				treebuilder->context.formatting_entries;
+			uint32_t e;
 
 			for (e = treebuilder->context.formatting_list_end;
-					e != NULL; e = e->prev) {
-				if (e->stack_index == n)
-					e->stack_index--;
+					e != 0; e = list[e].prev) {
+				if (list[e].stack_index == n)
+					list[e].stack_index--;
 			}
 		}
 	}
 
 	/* Reduce node's reference count */
-	treebuilder->tree_handler->unref_node(treebuilder->tree_handler->ctx,
-					stack[index].node);
+	treebuilder_unref_node(treebuilder, stack[index].node);
+
+	treebuilder->context.type_count[stack[index].type]--;
 
 	/* Now, shuffle the stack up one, removing node in the process */
 	memmove(&stack[index], &stack[index + 1],
 			(limit - index) * sizeof(element_context));
 
+	element_stack_removed(treebuilder, index, limit);
+
 	return HUBBUB_OK;
 }
 
@@ -2174,11 +2526,13 @@ hubbub_error aa_remove_element_stack_item(hubbub_treebuilder *treebuilder,
  * and element stack entries
  *
  * \param treebuilder  The treebuilder instance
- * \param element      The item in the formatting list containing the node
+ * \param index        The item in the formatting list containing the node
  */
 hubbub_error aa_clone_and_replace_entries(hubbub_treebuilder *treebuilder,
-		formatting_list_entry *element)
+		uint32_t index)
 {
+	formatting_list_entry *element =
+			&treebuilder->context.formatting_entries[index];
 	hubbub_error err;
 	hubbub_ns ons;
 	element_type otype;
@@ -2192,24 +2546,23 @@ hubbub_error aa_clone_and_replace_entries(hubbub_treebuilder *treebuilder,
 	if (err != HUBBUB_OK)
 		return err;
 
+	treebuilder->context.aa_counts.clones++;
+
 	/* Replace formatting list entry for node with clone */
-	err = formatting_list_replace(treebuilder, element,
+	err = formatting_list_replace(treebuilder, index,
 			element->details.ns, element->details.type, 
 			clone, element->stack_index,
 			&ons, &otype, &onode, &oindex);
 	assert(err == HUBBUB_OK);
 
-	treebuilder->tree_handler->unref_node(treebuilder->tree_handler->ctx,
-			onode);
+	treebuilder_unref_node(treebuilder, onode);
 
-	treebuilder->tree_handler->ref_node(treebuilder->tree_handler->ctx,
-			clone);
+	treebuilder_ref_node(treebuilder, clone);
 
 	/* Replace node's stack entry with clone */
 	treebuilder->context.element_stack[element->stack_index].node = clone;
 
-	treebuilder->tree_handler->unref_node(treebuilder->tree_handler->ctx,
-			onode);
+	treebuilder_unref_node(treebuilder, onode);
 
 	return HUBBUB_OK;
 }
@@ -2218,7 +2571,7 @@ hubbub_error aa_clone_and_replace_entries(hubbub_treebuilder *treebuilder,
  * Adoption agency: locate foster parent and insert node into it
  *
  * \param treebuilder  The treebuilder instance
- * \param node         The node to insert
+ * \param node         The node to insert, which must have no parent
  * \param inserted     Pointer to location to receive inserted node
  * \return HUBBUB_OK on success, appropriate error otherwise
  */
@@ -2227,46 +2580,45 @@ hubbub_error aa_insert_into_foster_parent(hubbub_treebuilder *treebuilder,
 {
 	hubbub_error err;
 	element_context *stack = treebuilder->context.element_stack;
-	void *foster_parent = NULL;
-	bool insert = false;
+	void *foster_parent;
+	bool insert;
 
 	uint32_t cur_table = current_table(treebuilder);
 
 	stack[cur_table].tainted = true;
 
-	if (cur_table == 0) {
-		treebuilder->tree_handler->ref_node(
-				treebuilder->tree_handler->ctx,
-				stack[0].node);
+	/* The foster parent is kept, with a reference, until the table's
+	 * parent may change, so that runs of misplaced content need not
+	 * ask the client for it each time */
+	if (treebuilder->context.foster.node == NULL) {
+		void *t_parent = NULL;
 
 		foster_parent = stack[0].node;
-	} else {
-		void *t_parent = NULL;
+		insert = false;
 
-		treebuilder->tree_handler->get_parent(
-			treebuilder->tree_handler->ctx,
-			stack[cur_table].node,
-			true, &t_parent);
+		if (cur_table != 0) {
+			treebuilder->tree_handler->get_parent(
+				treebuilder->tree_handler->ctx,
+				stack[cur_table].node,
+				true, &t_parent);
+
+			foster_parent = stack[cur_table - 1].node;
+		}
 
 		if (t_parent != NULL) {
 			foster_parent = t_parent;
 			insert = true;
 		} else {
-			treebuilder->tree_handler->ref_node(
-					treebuilder->tree_handler->ctx,
-					stack[cur_table - 1].node);
-			foster_parent = stack[cur_table - 1].node;
+			treebuilder_ref_node(treebuilder, foster_parent);
 		}
-	}
 
-	err = remove_node_from_dom(treebuilder, node);
-	if (err != HUBBUB_OK) {
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,
-				foster_parent);
-		return err;
+		treebuilder->context.foster.node = foster_parent;
+		treebuilder->context.foster.insert = insert;
 	}
 
+	foster_parent = treebuilder->context.foster.node;
+	insert = treebuilder->context.foster.insert;
+
 	if (insert) {
 		err = treebuilder->tree_handler->insert_before(
 				treebuilder->tree_handler->ctx,
@@ -2279,17 +2631,8 @@ hubbub_error aa_insert_into_foster_parent(hubbub_treebuilder *treebuilder,
 				foster_parent, node,
 				inserted);
 	}
-	if (err != HUBBUB_OK) {
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,
-				foster_parent);
-		return err;
-	}
 
-	treebuilder->tree_handler->unref_node(treebuilder->tree_handler->ctx,
-			foster_parent);
-
-	return HUBBUB_OK;
+	return err;
 }
 
 
@@ -2316,9 +2659,7 @@ hubbub_error process_0applet_button_marquee_object_in_body(
 
 			element_stack_pop(treebuilder, &ns, &otype, &node);
 
-			treebuilder->tree_handler->unref_node(
-					treebuilder->tree_handler->ctx,
-					node);
+			treebuilder_unref_node(treebuilder, node);
 
 			popped++;
 		} while (otype != type);
@@ -2350,6 +2691,7 @@ hubbub_error process_0br_in_body(hubbub_treebuilder *treebuilder)
 	tag.ns = HUBBUB_NS_HTML;
 	tag.name.ptr = (const uint8_t *) "br";
 	tag.name.len = SLEN("br");
+	tag.atom = element_type_to_atom(BR);
 
 	tag.n_attributes = 0;
 	tag.attributes = NULL;
@@ -2387,9 +2729,7 @@ hubbub_error process_0generic_in_body(hubbub_treebuilder *treebuilder,
 				element_stack_pop(treebuilder,
 						&ns, &otype, &node);
 
-				treebuilder->tree_handler->unref_node(
-						treebuilder->tree_handler->ctx,
-						node);
+				treebuilder_unref_node(treebuilder, node);
 
 				popped++;
 
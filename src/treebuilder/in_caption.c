@@ -30,8 +30,8 @@ hubbub_error handle_in_caption(hubbub_treebuilder *treebuilder,
 	switch (token->type) {
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(treebuilder,
+				&token->data.tag);
 
 		if (type == CAPTION || type == COL || type == COLGROUP ||
 				type == TBODY || type == TD || type == TFOOT ||
@@ -46,8 +46,8 @@ hubbub_error handle_in_caption(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(treebuilder,
+				&token->data.tag);
 
 		if (type == CAPTION) {
 			handled = true;
@@ -80,7 +80,11 @@ hubbub_error handle_in_caption(hubbub_treebuilder *treebuilder,
 		element_type otype = UNKNOWN;
 		void *node;
 
-		/** \todo fragment case */
+		if (!element_in_scope(treebuilder, CAPTION, true)) {
+			/** \todo parse error */
+			/* Fragment case: ignore the token */
+			return HUBBUB_OK;
+		}
 
 		close_implied_end_tags(treebuilder, UNKNOWN);
 
@@ -89,9 +93,7 @@ hubbub_error handle_in_caption(hubbub_treebuilder *treebuilder,
 
 			element_stack_pop(treebuilder, &ns, &otype,	&node);
 
-			treebuilder->tree_handler->unref_node(
-					treebuilder->tree_handler->ctx,
-					node);
+			treebuilder_unref_node(treebuilder, node);
 		}
 
 		clear_active_formatting_list_to_marker(treebuilder);
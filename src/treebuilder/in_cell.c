@@ -14,6 +14,18 @@
 #include "utils/utils.h"
 
 
+/**
+ * Determine if a cell is open, which it may not be in the fragment case
+ *
+ * \param treebuilder	The treebuilder instance
+ * \return True if a td or th element is in table scope
+ */
+static inline bool cell_in_scope(hubbub_treebuilder *treebuilder)
+{
+	return element_in_scope(treebuilder, TD, true) ||
+			element_in_scope(treebuilder, TH, true);
+}
+
 /**
  * Clear the stack back to a table row context.
  *
@@ -41,9 +53,7 @@ static inline void close_cell(hubbub_treebuilder *treebuilder)
 	while (otype != type) {
 		element_stack_pop(treebuilder, &ns, &otype, &node);
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,
-				node);
+		treebuilder_unref_node(treebuilder, node);
 	}
 
 	clear_active_formatting_list_to_marker(treebuilder);
@@ -68,16 +78,20 @@ hubbub_error handle_in_cell(hubbub_treebuilder *treebuilder,
 	switch (token->type) {
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(treebuilder,
+				&token->data.tag);
 
 		if (type == CAPTION || type == COL ||
 				type == COLGROUP || type == TBODY || 
 				type == TD || type == TFOOT || type == TH || 
 				type == THEAD || type == TR) {
-			/** \todo fragment case */
-			close_cell(treebuilder);
-			err = HUBBUB_REPROCESS;
+			if (cell_in_scope(treebuilder)) {
+				close_cell(treebuilder);
+				err = HUBBUB_REPROCESS;
+			} else {
+				/** \todo parse error */
+				/* Fragment case: ignore the token */
+			}
 		} else {
 			err = handle_in_body(treebuilder, token);
 		}
@@ -85,8 +99,8 @@ hubbub_error handle_in_cell(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(treebuilder,
+				&token->data.tag);
 
 		if (type == TH || type == TD) {
 			if (element_in_scope(treebuilder, type, true)) {
@@ -101,9 +115,8 @@ hubbub_error handle_in_cell(hubbub_treebuilder *treebuilder,
 					element_stack_pop(treebuilder,
 							&ns, &otype, &node);
 
-					treebuilder->tree_handler->unref_node(
-						treebuilder->tree_handler->ctx,
-						node);
+					treebuilder_unref_node(treebuilder,
+							node);
 				}
 
 				clear_active_formatting_list_to_marker(
@@ -42,8 +42,8 @@ hubbub_error handle_in_column_group(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(treebuilder,
+				&token->data.tag);
 
 		if (type == HTML) {
 			/* Process as if "in body" */
@@ -60,11 +60,10 @@ hubbub_error handle_in_column_group(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(treebuilder,
+				&token->data.tag);
 
 		if (type == COLGROUP) {
-			/** \todo fragment case */
 			handled = true;
 		} else if (type == COL) {
 			/** \todo parse error */
@@ -74,11 +73,18 @@ hubbub_error handle_in_column_group(hubbub_treebuilder *treebuilder,
 	}
 		break;
 	case HUBBUB_TOKEN_EOF:
-		/** \todo fragment case */
 		err = HUBBUB_REPROCESS;
 		break;
 	}
 
+	if ((handled || err == HUBBUB_REPROCESS) &&
+			treebuilder->context.current_node == 0) {
+		/* Fragment case: the current node is the root, so the token
+		 * is ignored, and parsing stops at the end of the input */
+		/** \todo parse error */
+		return HUBBUB_OK;
+	}
+
 	if (handled || err == HUBBUB_REPROCESS) {
 		hubbub_ns ns;
 		element_type otype;
@@ -87,9 +93,7 @@ hubbub_error handle_in_column_group(hubbub_treebuilder *treebuilder,
 		/* Pop the current node (which will be a colgroup) */
 		element_stack_pop(treebuilder, &ns, &otype, &node);
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,
-				node);
+		treebuilder_unref_node(treebuilder, node);
 
 		treebuilder->context.mode = IN_TABLE;
 	}
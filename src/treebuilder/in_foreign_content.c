@@ -17,123 +17,29 @@
 
 /*** Attribute-correction stuff ***/
 
-#define S(s)		s, SLEN(s)
+/* Auto-generated by `gperf`. */
+#include "treebuilder/autogenerated-foreign-names.c"
 
 /**
- * Mapping table for case changes
+ * Look up a name which may need adjusting in foreign content
+ *
+ * \param name   The name to look up
+ * \param kinds  The kinds of adjustment of interest
+ * \return Pointer to the mapping for the name, or NULL if it needs no
+ *         adjustment of the given kinds
  */
-typedef struct
+static inline const struct foreign_name_map *foreign_name_lookup(
+		const hubbub_string *name, int kinds)
 {
-	const char *attr;	/**< Lower case attribute name */
-	size_t len;		/**< Length of name in bytes */
-	const char *proper;	/**< Correctly cased version */
-} case_changes;
-
-static const case_changes svg_attributes[] = {
-	{ S("attributename"),		"attributeName" },
-	{ S("attributetype"),		"attributeType" },
-	{ S("basefrequency"),		"baseFrequency" },
-	{ S("baseprofile"),		"baseProfile" },
-	{ S("calcmode"),		"calcMode" },
-	{ S("clippathunits"),		"clipPathUnits" },
-	{ S("contentscripttype"),	"contentScriptType" },
-	{ S("contentstyletype"),	"contentStyleType" },
-	{ S("diffuseconstant"),		"diffuseConstant" },
-	{ S("edgemode"),		"edgeMode" },
-	{ S("externalresourcesrequired"),	"externalResourcesRequired" },
-	{ S("filterres"),		"filterRes" },
-	{ S("filterunits"),		"filterUnits" },
-	{ S("glyphref"),		"glyphRef" },
-	{ S("gradienttransform"),	"gradientTransform" },
-	{ S("gradientunits"),		"gradientUnits" },
-	{ S("kernelmatrix"),		"kernelMatrix" },
-	{ S("kernelunitlength"),	"kernelUnitLength" },
-	{ S("keypoints"),		"keyPoints" },
-	{ S("keysplines"),		"keySplines" },
-	{ S("keytimes"),		"keyTimes" },
-	{ S("lengthadjust"),		"lengthAdjust" },
-	{ S("limitingconeangle"),	"limitingConeAngle" },
-	{ S("markerheight"),		"markerHeight" },
-	{ S("markerunits"),		"markerUnits" },
-	{ S("markerwidth"),		"markerWidth" },
-	{ S("maskcontentunits"),	"maskContentUnits" },
-	{ S("maskunits"),		"maskUnits" },
-	{ S("numoctaves"),		"numOctaves" },
-	{ S("pathlength"),		"pathLength" },
-	{ S("patterncontentunits"),	"patternContentUnits" },
-	{ S("patterntransform"),	"patternTransform" },
-	{ S("patternunits"),		"patternUnits" },
-	{ S("pointsatx"),		"pointsAtX" },
-	{ S("pointsaty"),		"pointsAtY" },
-	{ S("pointsatz"),		"pointsAtZ" },
-	{ S("preservealpha"),		"preserveAlpha" },
-	{ S("preserveaspectratio"),	"preserveAspectRatio" },
-	{ S("primitiveunits"),		"primitiveUnits" },
-	{ S("refx"),			"refX" },
-	{ S("refy"),			"refY" },
-	{ S("repeatcount"),		"repeatCount" },
-	{ S("repeatdur"),		"repeatDur" },
-	{ S("requiredextensions"),	"requiredExtensions" },
-	{ S("requiredfeatures"),	"requiredFeatures" },
-	{ S("specularconstant"),	"specularConstant" },
-	{ S("specularexponent"),	"specularExponent" },
-	{ S("spreadmethod"),		"spreadMethod" },
-	{ S("startoffset"),		"startOffset" },
-	{ S("stddeviation"),		"stdDeviation" },
-	{ S("stitchtiles"),		"stitchTiles" },
-	{ S("surfacescale"),		"surfaceScale" },
-	{ S("systemlanguage"),		"systemLanguage" },
-	{ S("tablevalues"),		"tableValues" },
-	{ S("targetx"),			"targetX" },
-	{ S("targety"),			"targetY" },
-	{ S("textlength"),		"textLength" },
-	{ S("viewbox"),			"viewBox" },
-	{ S("viewtarget"),		"viewTarget" },
-	{ S("xchannelselector"),	"xChannelSelector" },
-	{ S("ychannelselector"),	"yChannelSelector" },
-	{ S("zoomandpan"),		"zoomAndPan" },
-};
-
-static const case_changes svg_tagnames[] = {
-	{ S("altglyph"),		"altGlyph" },
-	{ S("altglyphdef"),		"altGlyphDef" },
-	{ S("altglyphitem"),		"altGlyphItem" },
-	{ S("animatecolor"),		"animateColor" },
-	{ S("animatemotion"),		"animateMotion" },
-	{ S("animatetransform"),	"animateTransform" },
-	{ S("clippath"),		"clipPath" },
-	{ S("feblend"),			"feBlend" },
-	{ S("fecolormatrix"),		"feColorMatrix" },
-	{ S("fecomponenttransfer"),	"feComponentTransfer" },
-	{ S("fecomposite"),		"feComposite" },
-	{ S("feconvolvematrix"),	"feConvolveMatrix" },
-	{ S("fediffuselighting"),	"feDiffuseLighting" },
-	{ S("fedisplacementmap"),	"feDisplacementMap" },
-	{ S("fedistantlight"),		"feDistantLight" },
-	{ S("feflood"),			"feFlood" },
-	{ S("fefunca"),			"feFuncA" },
-	{ S("fefuncb"),			"feFuncB" },
-	{ S("fefuncg"),			"feFuncG" },
-	{ S("fefuncr"),			"feFuncR" },
-	{ S("fegaussianblur"),		"feGaussianBlur" },
-	{ S("feimage"),			"feImage" },
-	{ S("femerge"),			"feMerge" },
-	{ S("femergenode"),		"feMergeNode" },
-	{ S("femorphology"),		"feMorphology" },
-	{ S("feoffset"),		"feOffset" },
-	{ S("fepointlight"),		"fePointLight" },
-	{ S("fespecularlighting"),	"feSpecularLighting" },
-	{ S("fespotlight"),		"feSpotLight" },
-	{ S("fetile"),			"feTile" },
-	{ S("feturbulence"),		"feTurbulence" },
-	{ S("foreignobject"),		"foreignObject" },
-	{ S("glyphref"),		"glyphRef" },
-	{ S("lineargradient"),		"linearGradient" },
-	{ S("radialgradient"),		"radialGradient" },
-	{ S("textpath"),		"textPath" },
-};
-
-#undef S
+	const struct foreign_name_map *map;
+
+	map = hubbub_foreign_name_generated_lookup(
+			(const char *) name->ptr, name->len);
+	if (map == NULL || (map->kinds & kinds) == 0)
+		return NULL;
+
+	return map;
+}
 
 /**
  * Adjust MathML attributes
@@ -149,14 +55,11 @@ void adjust_mathml_attributes(hubbub_treebuilder *treebuilder,
 
 	for (i = 0; i < tag->n_attributes; i++) {
 		hubbub_attribute *attr = &tag->attributes[i];
-		const uint8_t *name = attr->name.ptr;
-		size_t len = attr->name.len;
+		const struct foreign_name_map *map;
 
-		if (hubbub_string_match(name, len, 
-				(const uint8_t *) "definitionurl", 
-				SLEN("definitionurl"))) {
-			attr->name.ptr = (uint8_t *) "definitionURL";
-		}
+		map = foreign_name_lookup(&attr->name, MATHML_ATTR);
+		if (map != NULL)
+			attr->name.ptr = (const uint8_t *) map->proper;
 	}
 }
 
@@ -174,19 +77,11 @@ void adjust_svg_attributes(hubbub_treebuilder *treebuilder,
 
 	for (i = 0; i < tag->n_attributes; i++) {
 		hubbub_attribute *attr = &tag->attributes[i];
+		const struct foreign_name_map *map;
 
-		const uint8_t *name = attr->name.ptr;
-		size_t len = attr->name.len;
-		size_t j;
-
-		for (j = 0; j < N_ELEMENTS(svg_attributes); j++) {
-			if (hubbub_string_match(name, len,
-					(uint8_t *) svg_attributes[j].attr,
-					svg_attributes[j].len)) {
-				attr->name.ptr =
-					(uint8_t *) svg_attributes[j].proper;
-			}
-		}
+		map = foreign_name_lookup(&attr->name, SVG_ATTR);
+		if (map != NULL)
+			attr->name.ptr = (const uint8_t *) map->proper;
 	}
 }
 
@@ -199,25 +94,15 @@ void adjust_svg_attributes(hubbub_treebuilder *treebuilder,
 void adjust_svg_tagname(hubbub_treebuilder *treebuilder,
 		hubbub_tag *tag)
 {
-	const uint8_t *name = tag->name.ptr;
-	size_t len = tag->name.len;
-	size_t i;
+	const struct foreign_name_map *map;
 
 	UNUSED(treebuilder);
 
-	for (i = 0; i < N_ELEMENTS(svg_tagnames); i++) {
-		if (hubbub_string_match(name, len,
-				(uint8_t *) svg_tagnames[i].attr,
-				svg_tagnames[i].len)) {
-			tag->name.ptr =	(uint8_t *) svg_tagnames[i].proper;
-		}
-	}
+	map = foreign_name_lookup(&tag->name, SVG_TAG);
+	if (map != NULL)
+		tag->name.ptr = (const uint8_t *) map->proper;
 }
 
-
-
-#define S(s)		(uint8_t *) s, SLEN(s)
-
 /**
  * Adjust foreign attributes.
  *
@@ -232,63 +117,17 @@ void adjust_foreign_attributes(hubbub_treebuilder *treebuilder,
 
 	for (i = 0; i < tag->n_attributes; i++) {
 		hubbub_attribute *attr = &tag->attributes[i];
-		const uint8_t *name = attr->name.ptr;
-
-		/* 10 == strlen("xlink:href") */
-		if (attr->name.len >= 10 &&
-				strncmp((char *) name, "xlink:", 
-						SLEN("xlink:")) == 0) {
-			size_t len = attr->name.len - 6;
-			name += 6;
-
-			if (hubbub_string_match(name, len, S("actuate")) ||
-					hubbub_string_match(name, len,
-							S("arcrole")) ||
-					hubbub_string_match(name, len,
-							S("href")) ||
-					hubbub_string_match(name, len,
-							S("role")) ||
-					hubbub_string_match(name, len,
-							S("show")) ||
-					hubbub_string_match(name, len,
-							S("title")) ||
-					hubbub_string_match(name, len,
-							S("type"))) {
-				attr->ns = HUBBUB_NS_XLINK;
-				attr->name.ptr += 6;
-				attr->name.len -= 6;
-			}
-		/* 8 == strlen("xml:base") */
-		} else if (attr->name.len >= 8 &&
-				strncmp((char *) name, "xml:", 
-						SLEN("xml:")) == 0) {
-			size_t len = attr->name.len - 4;
-			name += 4;
-
-			if (hubbub_string_match(name, len, S("base")) ||
-					hubbub_string_match(name, len,
-							S("lang")) ||
-					hubbub_string_match(name, len,
-							S("space"))) {
-				attr->ns = HUBBUB_NS_XML;
-				attr->name.ptr += 4;
-				attr->name.len -= 4;
-			}
-		} else if (hubbub_string_match(name, attr->name.len,
-						S("xmlns"))) {
-			attr->ns = HUBBUB_NS_XMLNS;
-		} else if (hubbub_string_match(name, attr->name.len,
-						S("xmlns:xlink"))) {
-			attr->ns = HUBBUB_NS_XMLNS;
-			attr->name.ptr += 6;
-			attr->name.len -= 6;
-		}
+		const struct foreign_name_map *map;
 
+		map = foreign_name_lookup(&attr->name, XML_ATTR);
+		if (map != NULL) {
+			attr->ns = map->ns;
+			attr->name.ptr += map->prefix;
+			attr->name.len -= map->prefix;
+		}
 	}
 }
 
-#undef S
-
 
 
 /*** Foreign content insertion mode ***/
@@ -372,9 +211,7 @@ static void foreign_break_out(hubbub_treebuilder *treebuilder)
 
 		element_stack_pop(treebuilder, &ns, &type, &node);
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,
-				node);
+		treebuilder_unref_node(treebuilder, node);
 	}
 
 	treebuilder->context.mode = treebuilder->context.second_mode;
@@ -410,8 +247,8 @@ hubbub_error handle_in_foreign_content(hubbub_treebuilder *treebuilder,
 				treebuilder->context.current_node].ns;
 
 		element_type cur_node = current_node(treebuilder);
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(treebuilder,
+				&token->data.tag);
 
 		if (cur_node_ns == HUBBUB_NS_HTML ||
 			(cur_node_ns == HUBBUB_NS_MATHML &&
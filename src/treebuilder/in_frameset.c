@@ -28,13 +28,8 @@ hubbub_error handle_in_frameset(hubbub_treebuilder *treebuilder,
 
 	switch (token->type) {
 	case HUBBUB_TOKEN_CHARACTER:
-		err = process_characters_expect_whitespace(treebuilder,
-				token, true);
-		if (err == HUBBUB_REPROCESS) {
-			/** \todo parse error */
-			/* Ignore the token */
-			err = HUBBUB_OK;
-		}
+		err = process_characters_keep_whitespace(treebuilder,
+				token);
 		break;
 	case HUBBUB_TOKEN_COMMENT:
 		err = process_comment_append(treebuilder, token,
@@ -46,8 +41,8 @@ hubbub_error handle_in_frameset(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(treebuilder,
+				&token->data.tag);
 
 		if (type == HTML) {
 			err = handle_in_body(treebuilder, token);
@@ -67,8 +62,8 @@ hubbub_error handle_in_frameset(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(treebuilder,
+				&token->data.tag);
 
 		if (type == FRAMESET) {
 			hubbub_ns ns;
@@ -82,9 +77,7 @@ hubbub_error handle_in_frameset(hubbub_treebuilder *treebuilder,
 
 			element_stack_pop(treebuilder, &ns, &type, &node);
 
-			treebuilder->tree_handler->unref_node(
-					treebuilder->tree_handler->ctx,
-					node);
+			treebuilder_unref_node(treebuilder, node);
 
 			if (current_node(treebuilder) != FRAMESET) {
 				treebuilder->context.mode = AFTER_FRAMESET;
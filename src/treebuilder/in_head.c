@@ -29,7 +29,6 @@
 static hubbub_error process_meta_in_head(hubbub_treebuilder *treebuilder,
 		const hubbub_token *token)
 {
-	static uint16_t utf16, utf16be, utf16le;
 	uint16_t charset_enc = 0;
 	uint16_t content_type_enc = 0;
 	size_t i;
@@ -44,17 +43,6 @@ static hubbub_error process_meta_in_head(hubbub_treebuilder *treebuilder,
 	if (treebuilder->tree_handler->encoding_change == NULL)
 		return err;
 
-	/* Grab UTF-16 MIBenums */
-	if (utf16 == 0) {
-		utf16 = parserutils_charset_mibenum_from_name(
-				"utf-16", SLEN("utf-16"));
-		utf16be = parserutils_charset_mibenum_from_name(
-				"utf-16be", SLEN("utf-16be"));
-		utf16le = parserutils_charset_mibenum_from_name(
-				"utf-16le", SLEN("utf-16le"));
-		assert(utf16 != 0 && utf16be != 0 && utf16le != 0);
-	}
-
 	for (i = 0; i < token->data.tag.n_attributes; i++) {
 		hubbub_attribute *attr = &token->data.tag.attributes[i];
 
@@ -79,8 +67,18 @@ static hubbub_error process_meta_in_head(hubbub_treebuilder *treebuilder,
 		charset_enc = content_type_enc;
 
 	if (charset_enc != 0) {
+		uint16_t utf16, utf16be, utf16le;
 		const char *name;
 
+		/* Looked up each time, as parsers may run on many threads */
+		utf16 = parserutils_charset_mibenum_from_name(
+				"utf-16", SLEN("utf-16"));
+		utf16be = parserutils_charset_mibenum_from_name(
+				"utf-16be", SLEN("utf-16be"));
+		utf16le = parserutils_charset_mibenum_from_name(
+				"utf-16le", SLEN("utf-16le"));
+		assert(utf16 != 0 && utf16be != 0 && utf16le != 0);
+
 		hubbub_charset_fix_charset(&charset_enc);
 
 		/* Change UTF-16 to UTF-8 */
@@ -92,6 +90,8 @@ static hubbub_error process_meta_in_head(hubbub_treebuilder *treebuilder,
 
 		name = parserutils_charset_mibenum_to_name(charset_enc);
 
+		treebuilder->context.requested_charset = name;
+
 		err = treebuilder->tree_handler->encoding_change(
 				treebuilder->tree_handler->ctx,	name);
 	}
@@ -127,8 +127,8 @@ hubbub_error handle_in_head(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(treebuilder,
+				&token->data.tag);
 
 		if (type == HTML) {
 			/* Process as if "in body" */
@@ -170,8 +170,8 @@ hubbub_error handle_in_head(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(treebuilder,
+				&token->data.tag);
 
 		if (type == HEAD) {
 			handled = true;
@@ -192,9 +192,7 @@ hubbub_error handle_in_head(hubbub_treebuilder *treebuilder,
 
 		element_stack_pop(treebuilder, &ns, &otype, &node);
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,
-				node);
+		treebuilder_unref_node(treebuilder, node);
 
 		treebuilder->context.mode = AFTER_HEAD;
 	}
@@ -40,8 +40,8 @@ hubbub_error handle_in_head_noscript(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(treebuilder,
+				&token->data.tag);
 
 		if (type == HTML) {
 			/* Process as "in body" */
@@ -62,8 +62,8 @@ hubbub_error handle_in_head_noscript(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(treebuilder,
+				&token->data.tag);
 
 		if (type == NOSCRIPT) {
 			handled = true;
@@ -88,9 +88,7 @@ hubbub_error handle_in_head_noscript(hubbub_treebuilder *treebuilder,
 
 		element_stack_pop(treebuilder, &ns, &otype, &node);
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,
-				node);
+		treebuilder_unref_node(treebuilder, node);
 
 		treebuilder->context.mode = IN_HEAD;
 	}
@@ -30,9 +30,7 @@ static void table_clear_stack(hubbub_treebuilder *treebuilder)
 
 		element_stack_pop(treebuilder, &ns, &type, &node);
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,
-				node);
+		treebuilder_unref_node(treebuilder, node);
 
 		cur_node = current_node(treebuilder);
 	}
@@ -53,14 +51,17 @@ static hubbub_error act_as_if_end_tag_tr(hubbub_treebuilder *treebuilder)
 	element_type otype;
 	void *node;
 
-	/** \todo fragment case */
+	if (!element_in_scope(treebuilder, TR, true)) {
+		/** \todo parse error */
+		/* Fragment case: ignore the token */
+		return HUBBUB_OK;
+	}
 
 	table_clear_stack(treebuilder);
 
 	element_stack_pop(treebuilder, &ns, &otype, &node);
 
-	treebuilder->tree_handler->unref_node(treebuilder->tree_handler->ctx,
-			node);
+	treebuilder_unref_node(treebuilder, node);
 
 	treebuilder->context.mode = IN_TABLE_BODY;
 
@@ -83,8 +84,8 @@ hubbub_error handle_in_row(hubbub_treebuilder *treebuilder,
 	switch (token->type) {
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(treebuilder,
+				&token->data.tag);
 
 		if (type == TH || type == TD) {
 			table_clear_stack(treebuilder);
@@ -97,8 +98,7 @@ hubbub_error handle_in_row(hubbub_treebuilder *treebuilder,
 			treebuilder->context.mode = IN_CELL;
 
 			/* ref node for formatting list */
-			treebuilder->tree_handler->ref_node(
-				treebuilder->tree_handler->ctx, 
+			treebuilder_ref_node(treebuilder,
 				treebuilder->context.element_stack[
 				treebuilder->context.current_node].node);
 
@@ -133,8 +133,8 @@ hubbub_error handle_in_row(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(treebuilder,
+				&token->data.tag);
 
 		if (type == TR) {
 			/* We're done with this token, but act_as_if_end_tag_tr 
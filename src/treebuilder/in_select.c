@@ -44,8 +44,8 @@ hubbub_error handle_in_select(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(treebuilder,
+				&token->data.tag);
 
 		if (type == HTML) {
 			/* Process as if "in body" */
@@ -55,9 +55,7 @@ hubbub_error handle_in_select(hubbub_treebuilder *treebuilder,
 				element_stack_pop(treebuilder, &ns, &otype,
 						&node);
 
-				treebuilder->tree_handler->unref_node(
-						treebuilder->tree_handler->ctx,
-						node);
+				treebuilder_unref_node(treebuilder, node);
 			}
 
 			err = insert_element(treebuilder, &token->data.tag, 
@@ -67,18 +65,14 @@ hubbub_error handle_in_select(hubbub_treebuilder *treebuilder,
 				element_stack_pop(treebuilder, &ns, &otype,
 						&node);
 
-				treebuilder->tree_handler->unref_node(
-						treebuilder->tree_handler->ctx,
-						node);
+				treebuilder_unref_node(treebuilder, node);
 			}
 
 			if (current_node(treebuilder) == OPTGROUP) {
 				element_stack_pop(treebuilder, &ns, &otype,
 						&node);
 
-				treebuilder->tree_handler->unref_node(
-						treebuilder->tree_handler->ctx,
-						node);
+				treebuilder_unref_node(treebuilder, node);
 			}
 
 			err = insert_element(treebuilder, &token->data.tag, 
@@ -106,8 +100,8 @@ hubbub_error handle_in_select(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(treebuilder,
+				&token->data.tag);
 
 		if (type == OPTGROUP) {
 			if (current_node(treebuilder) == OPTION &&
@@ -115,18 +109,14 @@ hubbub_error handle_in_select(hubbub_treebuilder *treebuilder,
 				element_stack_pop(treebuilder, &ns, &otype,
 						&node);
 
-				treebuilder->tree_handler->unref_node(
-						treebuilder->tree_handler->ctx,
-						node);
+				treebuilder_unref_node(treebuilder, node);
 			}
 
 			if (current_node(treebuilder) == OPTGROUP) {
 				element_stack_pop(treebuilder, &ns, &otype,
 						&node);
 
-				treebuilder->tree_handler->unref_node(
-						treebuilder->tree_handler->ctx,
-						node);
+				treebuilder_unref_node(treebuilder, node);
 			} else {
 				/** \todo parse error */
 			}
@@ -135,9 +125,7 @@ hubbub_error handle_in_select(hubbub_treebuilder *treebuilder,
 				element_stack_pop(treebuilder, &ns, &otype,
 						&node);
 
-				treebuilder->tree_handler->unref_node(
-						treebuilder->tree_handler->ctx,
-						node);
+				treebuilder_unref_node(treebuilder, node);
 			} else {
 				/** \todo parse error */
 			}
@@ -29,9 +29,7 @@ static inline void clear_stack_table_context(hubbub_treebuilder *treebuilder)
 	while (type != TABLE && type != HTML) {
 		element_stack_pop(treebuilder, &ns, &type, &node);
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,
-				node);
+		treebuilder_unref_node(treebuilder, node);
 
 		type = current_node(treebuilder);
 	}
@@ -99,8 +97,8 @@ hubbub_error handle_in_table(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(treebuilder,
+				&token->data.tag);
 		bool tainted = treebuilder->context.element_stack[
 					current_table(treebuilder)
 					].tainted;
@@ -108,8 +106,7 @@ hubbub_error handle_in_table(hubbub_treebuilder *treebuilder,
 		if (type == CAPTION) {
 			clear_stack_table_context(treebuilder);
 
-			treebuilder->tree_handler->ref_node(
-				treebuilder->tree_handler->ctx,
+			treebuilder_ref_node(treebuilder,
 				treebuilder->context.element_stack[
 				treebuilder->context.current_node].node);
 
@@ -119,8 +116,7 @@ hubbub_error handle_in_table(hubbub_treebuilder *treebuilder,
 					treebuilder->context.current_node].node,
 					treebuilder->context.current_node);
 			if (err != HUBBUB_OK) {
-				treebuilder->tree_handler->unref_node(
-					treebuilder->tree_handler->ctx,
+				treebuilder_unref_node(treebuilder,
 					treebuilder->context.element_stack[
 					treebuilder->context.current_node].node);
 
@@ -139,9 +135,7 @@ hubbub_error handle_in_table(hubbub_treebuilder *treebuilder,
 					treebuilder->context.formatting_list_end,
 					&ns, &type, &node, &index);
 
-				treebuilder->tree_handler->unref_node(
-					treebuilder->tree_handler->ctx,
-					node);
+				treebuilder_unref_node(treebuilder, node);
 
 				return err;
 			}
@@ -155,6 +149,7 @@ hubbub_error handle_in_table(hubbub_treebuilder *treebuilder,
 				/* Insert colgroup and reprocess */
 				tag.name.ptr = (const uint8_t *) "colgroup";
 				tag.name.len = SLEN("colgroup");
+				tag.atom = element_type_to_atom(COLGROUP);
 				tag.n_attributes = 0;
 				tag.attributes = NULL;
 
@@ -177,6 +172,7 @@ hubbub_error handle_in_table(hubbub_treebuilder *treebuilder,
 				/* Insert tbody and reprocess */
 				tag.name.ptr = (const uint8_t *) "tbody";
 				tag.name.len = SLEN("tbody");
+				tag.atom = element_type_to_atom(TBODY);
 				tag.n_attributes = 0;
 				tag.attributes = NULL;
 
@@ -194,11 +190,13 @@ hubbub_error handle_in_table(hubbub_treebuilder *treebuilder,
 			/** \todo parse error */
 
 			/* This should match "</table>" handling */
-			element_stack_pop_until(treebuilder, TABLE);
+			if (element_in_scope(treebuilder, TABLE, true)) {
+				element_stack_pop_until(treebuilder, TABLE);
 
-			reset_insertion_mode(treebuilder);
+				reset_insertion_mode(treebuilder);
 
-			err = HUBBUB_REPROCESS;
+				err = HUBBUB_REPROCESS;
+			}
 		} else if (!tainted && (type == STYLE || type == SCRIPT)) {
 			err = handle_in_head(treebuilder, token);
 		} else if (!tainted && type == INPUT) {
@@ -211,15 +209,18 @@ hubbub_error handle_in_table(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(treebuilder,
+				&token->data.tag);
 
 		if (type == TABLE) {
-			/** \todo fragment case */
+			if (element_in_scope(treebuilder, TABLE, true)) {
+				element_stack_pop_until(treebuilder, TABLE);
 
-			element_stack_pop_until(treebuilder, TABLE);
-
-			reset_insertion_mode(treebuilder);
+				reset_insertion_mode(treebuilder);
+			} else {
+				/** \todo parse error */
+				/* Fragment case: ignore the token */
+			}
 		} else if (type == BODY || type == CAPTION || type == COL ||
 				type == COLGROUP || type == HTML ||
 				type == TBODY || type == TD || type == TFOOT ||
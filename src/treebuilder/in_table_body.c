@@ -31,9 +31,7 @@ static void table_clear_stack(hubbub_treebuilder *treebuilder)
 
 		element_stack_pop(treebuilder, &ns, &type, &node);
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,
-				node);
+		treebuilder_unref_node(treebuilder, node);
 
 		cur_node = current_node(treebuilder);
 	}
@@ -64,9 +62,7 @@ static hubbub_error table_sub_start_or_table_end(hubbub_treebuilder *treebuilder
 		 * to handling for (tbody/tfoot/thead) end tags in this mode */
 		element_stack_pop(treebuilder, &ns, &otype, &node);
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,
-				node);
+		treebuilder_unref_node(treebuilder, node);
 
 		treebuilder->context.mode = IN_TABLE;
 
@@ -94,8 +90,8 @@ hubbub_error handle_in_table_body(hubbub_treebuilder *treebuilder,
 	switch (token->type) {
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(treebuilder,
+				&token->data.tag);
 
 		if (type == TR) {
 			table_clear_stack(treebuilder);
@@ -113,6 +109,7 @@ hubbub_error handle_in_table_body(hubbub_treebuilder *treebuilder,
 			tag.ns = HUBBUB_NS_HTML;
 			tag.name.ptr = (const uint8_t *) "tr";
 			tag.name.len = SLEN("tr");
+			tag.atom = element_type_to_atom(TR);
 
 			tag.n_attributes = 0;
 			tag.attributes = NULL;
@@ -136,8 +133,8 @@ hubbub_error handle_in_table_body(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(treebuilder,
+				&token->data.tag);
 
 		if (type == TBODY || type == TFOOT || type == THEAD) {
 			if (!element_in_scope(treebuilder, type, true)) {
@@ -153,9 +150,7 @@ hubbub_error handle_in_table_body(hubbub_treebuilder *treebuilder,
 				element_stack_pop(treebuilder, &ns,
 						&otype, &node);
 
-				treebuilder->tree_handler->unref_node(
-						treebuilder->tree_handler->ctx,
-						node);
+				treebuilder_unref_node(treebuilder, node);
 
 				treebuilder->context.mode = IN_TABLE;
 			}
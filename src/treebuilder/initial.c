@@ -16,191 +16,102 @@
 #include "utils/string.h"
 
 
-#define S(s)	{ s, sizeof s - 1 }
-
-struct {
-	const char *name;
-	size_t len;
-} public_doctypes[] = {
-	S("+//Silmaril//dtd html Pro v0r11 19970101//"),
-	S("-//AdvaSoft Ltd//DTD HTML 3.0 asWedit + extensions//"),
-	S("-//AS//DTD HTML 3.0 asWedit + extensions//"),
-	S("-//IETF//DTD HTML 2.0 Level 1//"),
-	S("-//IETF//DTD HTML 2.0 Level 2//"),
-	S("-//IETF//DTD HTML 2.0 Strict Level 1//"),
-	S("-//IETF//DTD HTML 2.0 Strict Level 2//"),
-	S("-//IETF//DTD HTML 2.0 Strict//"),
-	S("-//IETF//DTD HTML 2.0//"),
-	S("-//IETF//DTD HTML 2.1E//"),
-	S("-//IETF//DTD HTML 3.0//"),
-	S("-//IETF//DTD HTML 3.2 Final//"),
-	S("-//IETF//DTD HTML 3.2//"),
-	S("-//IETF//DTD HTML 3//"),
-	S("-//IETF//DTD HTML Level 0//"),
-	S("-//IETF//DTD HTML Level 1//"),
-	S("-//IETF//DTD HTML Level 2//"),
-	S("-//IETF//DTD HTML Level 3//"),
-	S("-//IETF//DTD HTML Strict Level 0//"),
-	S("-//IETF//DTD HTML Strict Level 1//"),
-	S("-//IETF//DTD HTML Strict Level 2//"),
-	S("-//IETF//DTD HTML Strict Level 3//"),
-	S("-//IETF//DTD HTML Strict//"),
-	S("-//IETF//DTD HTML//"),
-	S("-//Metrius//DTD Metrius Presentational//"),
-	S("-//Microsoft//DTD Internet Explorer 2.0 HTML Strict//"),
-	S("-//Microsoft//DTD Internet Explorer 2.0 HTML//"),
-	S("-//Microsoft//DTD Internet Explorer 2.0 Tables//"),
-	S("-//Microsoft//DTD Internet Explorer 3.0 HTML Strict//"),
-	S("-//Microsoft//DTD Internet Explorer 3.0 HTML//"),
-	S("-//Microsoft//DTD Internet Explorer 3.0 Tables//"),
-	S("-//Netscape Comm. Corp.//DTD HTML//"),
-	S("-//Netscape Comm. Corp.//DTD Strict HTML//"),
-	S("-//O'Reilly and Associates//DTD HTML 2.0//"),
-	S("-//O'Reilly and Associates//DTD HTML Extended 1.0//"),
-	S("-//O'Reilly and Associates//DTD HTML Extended Relaxed 1.0//"),
-	S("-//SoftQuad Software//DTD HoTMetaL PRO 6.0::19990601::extensions to HTML 4.0//"),
-	S("-//SoftQuad//DTD HoTMetaL PRO 4.0::19971010::extensions to HTML 4.0//"),
-	S("-//Spyglass//DTD HTML 2.0 Extended//"),
-	S("-//SQ//DTD HTML 2.0 HoTMetaL + extensions//"),
-	S("-//Sun Microsystems Corp.//DTD HotJava HTML//"),
-	S("-//Sun Microsystems Corp.//DTD HotJava Strict HTML//"),
-	S("-//W3C//DTD HTML 3 1995-03-24//"),
-	S("-//W3C//DTD HTML 3.2 Draft//"),
-	S("-//W3C//DTD HTML 3.2 Final//"),
-	S("-//W3C//DTD HTML 3.2//"),
-	S("-//W3C//DTD HTML 3.2S Draft//"),
-	S("-//W3C//DTD HTML 4.0 Frameset//"),
-	S("-//W3C//DTD HTML 4.0 Transitional//"),
-	S("-//W3C//DTD HTML Experimental 19960712//"),
-	S("-//W3C//DTD HTML Experimental 970421//"),
-	S("-//W3C//DTD W3 HTML//"),
-	S("-//W3O//DTD W3 HTML 3.0//"),
-};
-
-#undef S
+/* The public identifiers which select a quirks mode are held in a trie,
+ * stored as in the entity dictionary: four parallel arrays indexed by
+ * node number, with node 0 the root. The children of each node are
+ * numbered contiguously, starting at doctype_first[node], and there are
+ * doctype_count[node] of them, in ascending order of doctype_label[].
+ * Letters are in lower case. A node's doctype_flags[] are the DOCTYPE_*
+ * kinds of the identifiers ending there. */
+#include "doctypes.inc"
 
 
 /**
- * Check if one string starts with another.
+ * Find the kinds of quirky public identifier a doctype's matches
  *
- * \param a	String to compare
- * \param a_len	Length of first string
- * \param b	String to compare
- * \param b_len	Length of second string
- */
-static bool starts_with(const uint8_t *a, size_t a_len, const uint8_t *b,
-		size_t b_len)
-{
-	if (a_len < b_len)
-		return false;
-
-	/* Now perform an insensitive comparison on the prefix */
-	return hubbub_string_match_ci(a, b_len, b, b_len);
-}
-
-
-/**
- * Determine whether this doctype triggers full quirks mode
+ * The identifier is read once, ignoring the case of ASCII letters. Every
+ * prefix it starts with is found on the way, and any exact match at the
+ * end.
  *
- * \param treebuilder  Treebuilder instance
- * \param cdoc         The doctype to examine
- * \return True to trigger quirks, false otherwise
+ * \param id   The public identifier
+ * \param len  Length, in bytes, of identifier
+ * \return DOCTYPE_* flags of the identifiers matched
  */
-static bool lookup_full_quirks(hubbub_treebuilder *treebuilder,
-		const hubbub_doctype *cdoc)
+static uint8_t classify_public_id(const uint8_t *id, size_t len)
 {
-	size_t i;
-
-	const uint8_t *name = cdoc->name.ptr;
-	size_t name_len = cdoc->name.len;
+	uint8_t found = 0;
+	size_t node = 0, i;
 
-	const uint8_t *public_id = cdoc->public_id.ptr;
-	size_t public_id_len = cdoc->public_id.len;
+	for (i = 0; i < len; i++) {
+		const uint8_t *label, *end;
+		uint8_t c = id[i];
 
-	const uint8_t *system_id = cdoc->system_id.ptr;
-	size_t system_id_len = cdoc->system_id.len;
-
-	UNUSED(treebuilder);
+		if ('A' <= c && c <= 'Z')
+			c += 0x20;
 
-#define S(s)	(uint8_t *) s, sizeof s - 1
-
-	/* Check the name is "HTML" (case-insensitively) */
-	if (!hubbub_string_match_ci(name, name_len, S("HTML")))
-		return true;
-
-	/* No public id means not-quirks */
-	if (cdoc->public_missing)
-		return false;
+		/* Scan the (sorted) labels of this node's children */
+		label = doctype_label + doctype_first[node];
+		end = label + doctype_count[node];
 
-	for (i = 0; i < sizeof public_doctypes / sizeof public_doctypes[0]; i++)
-	{
-		if (starts_with(public_id, public_id_len,
-				(uint8_t *) public_doctypes[i].name,
-				public_doctypes[i].len)) {
-			return true;
-		}
-	}
+		while (label < end && *label < c)
+			label++;
 
-	if (hubbub_string_match_ci(public_id, public_id_len,
-				S("-//W3O//DTD W3 HTML Strict 3.0//EN//")) ||
-			hubbub_string_match_ci(public_id, public_id_len,
-				S("-/W3C/DTD HTML 4.0 Transitional/EN")) ||
-			hubbub_string_match_ci(public_id, public_id_len,
-				S("HTML")) ||
-			hubbub_string_match_ci(system_id, system_id_len,
-				S("http://www.ibm.com/data/dtd/v11/ibmxhtml1-transitional.dtd"))) {
-		return true;
-	}
+		if (label == end || *label != c)
+			return found;
 
-	if (cdoc->system_missing == true &&
-			(starts_with(public_id, public_id_len,
-				S("-//W3C//DTD HTML 4.01 Frameset//")) ||
-			starts_with(public_id, public_id_len,
-				S("-//W3C//DTD HTML 4.01 Transitional//")))) {
-		return true;
+		node = label - doctype_label;
+		found |= doctype_flags[node] & ~DOCTYPE_EXACT;
 	}
 
-#undef S
-
-	return false;
+	return found | doctype_flags[node];
 }
 
 
 /**
- * Determine whether this doctype triggers limited quirks mode
+ * Determine the quirks mode a doctype selects
  *
  * \param treebuilder  Treebuilder instance
  * \param cdoc         The doctype to examine
- * \return True to trigger quirks, false otherwise
+ * \return The quirks mode
  */
-static bool lookup_limited_quirks(hubbub_treebuilder *treebuilder,
+static hubbub_quirks_mode lookup_quirks(hubbub_treebuilder *treebuilder,
 		const hubbub_doctype *cdoc)
 {
-	const uint8_t *public_id = cdoc->public_id.ptr;
-	size_t public_id_len = cdoc->public_id.len;
+	uint8_t flags;
 
 	UNUSED(treebuilder);
 
-#define S(s)	(uint8_t *) s, sizeof s - 1
+#define S(s)	(const uint8_t *) s, sizeof s - 1
 
-	if (starts_with(public_id, public_id_len,
-				S("-//W3C//DTD XHTML 1.0 Frameset//")) ||
-			starts_with(public_id, public_id_len,
-				S("-//W3C//DTD XHTML 1.0 Transitional//"))) {
-		return true;
-	}
+	/* Check the name is "HTML" (case-insensitively), unless the
+	 * doctype forces quirks anyway */
+	if (cdoc->force_quirks ||
+			!hubbub_string_match_ci(cdoc->name.ptr, cdoc->name.len,
+				S("HTML")))
+		return HUBBUB_QUIRKS_MODE_FULL;
 
-	if (cdoc->system_missing == false &&
-			(starts_with(public_id, public_id_len,
-				S("-//W3C//DTD HTML 4.01 Frameset//")) ||
-			starts_with(public_id, public_id_len,
-				S("-//W3C//DTD HTML 4.01 Transitional//")))) {
-		return true;
-	}
+	/* No public id means not-quirks */
+	if (cdoc->public_missing)
+		return HUBBUB_QUIRKS_MODE_NONE;
+
+	if (hubbub_string_match_ci(cdoc->system_id.ptr, cdoc->system_id.len,
+			S("http://www.ibm.com/data/dtd/v11/"
+				"ibmxhtml1-transitional.dtd")))
+		return HUBBUB_QUIRKS_MODE_FULL;
 
 #undef S
 
-	return false;
+	flags = classify_public_id(cdoc->public_id.ptr, cdoc->public_id.len);
+
+	if ((flags & (DOCTYPE_PREFIX | DOCTYPE_EXACT)) != 0 ||
+			(cdoc->system_missing &&
+			(flags & DOCTYPE_SYSTEM) != 0))
+		return HUBBUB_QUIRKS_MODE_FULL;
+
+	if ((flags & (DOCTYPE_LIMITED | DOCTYPE_SYSTEM)) != 0)
+		return HUBBUB_QUIRKS_MODE_LIMITED;
+
+	return HUBBUB_QUIRKS_MODE_NONE;
 }
 
 
@@ -236,7 +147,7 @@ hubbub_error handle_initial(hubbub_treebuilder *treebuilder,
 	case HUBBUB_TOKEN_DOCTYPE:
 	{
 		void *doctype, *appended;
-		const hubbub_doctype *cdoc;
+		hubbub_quirks_mode quirks;
 
 		/** \todo parse error */
 
@@ -253,28 +164,19 @@ hubbub_error handle_initial(hubbub_treebuilder *treebuilder,
 				treebuilder->context.document,
 				doctype, &appended);
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,
-				doctype);
+		treebuilder_unref_node(treebuilder, doctype);
 
 		if (err != HUBBUB_OK)
 			return err;
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx, appended);
-
-		cdoc = &token->data.doctype;
+		treebuilder_unref_node(treebuilder, appended);
 
 		/* Work out whether we need quirks mode or not */
-		if (cdoc->force_quirks == true ||
-				lookup_full_quirks(treebuilder, cdoc)) {
-			treebuilder->tree_handler->set_quirks_mode(
-					treebuilder->tree_handler->ctx,
-					HUBBUB_QUIRKS_MODE_FULL);
-		} else if (lookup_limited_quirks(treebuilder, cdoc)) {
+		quirks = lookup_quirks(treebuilder, &token->data.doctype);
+		if (quirks != HUBBUB_QUIRKS_MODE_NONE) {
 			treebuilder->tree_handler->set_quirks_mode(
 					treebuilder->tree_handler->ctx,
-					HUBBUB_QUIRKS_MODE_LIMITED);
+					quirks);
 		}
 
 		treebuilder->context.mode = BEFORE_HTML;
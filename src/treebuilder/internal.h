@@ -8,8 +8,11 @@
 #ifndef hubbub_treebuilder_internal_h_
 #define hubbub_treebuilder_internal_h_
 
+#include <parserutils/utils/buffer.h>
+
 #include "treebuilder/treebuilder.h"
 #include "treebuilder/element-type.h"
+#include "treebuilder/tally.h"
 
 /**
  * Item on the element stack
@@ -31,6 +34,9 @@ typedef struct element_context
 
 /**
  * Entry in a formatting list
+ *
+ * Entries live in an array owned by the treebuilder and are linked by
+ * index. Index 0 is never used, so a link of 0 means there is no entry.
  */
 typedef struct formatting_list_entry
 {
@@ -38,8 +44,8 @@ typedef struct formatting_list_entry
 
 	uint32_t stack_index;		/**< Index into element stack */
 
-	struct formatting_list_entry *prev;	/**< Previous in list */
-	struct formatting_list_entry *next;	/**< Next in list */
+	uint32_t prev;			/**< Previous in list */
+	uint32_t next;			/**< Next in list, or next free entry */
 } formatting_list_entry;
 
 /**
@@ -54,11 +60,25 @@ typedef struct hubbub_treebuilder_context
 	element_context *element_stack;	/**< Stack of open elements */
 	uint32_t stack_alloc;		/**< Number of stack slots allocated */
 	uint32_t current_node;		/**< Index of current node in stack */
-
-	formatting_list_entry *formatting_list;	/**< List of active formatting 
-						 * elements */
-	formatting_list_entry *formatting_list_end;	/**< End of active 
-							 * formatting list */
+	uint32_t current_table;		/**< Index of the current table in
+					 * the stack, or 0 if none is open */
+	uint32_t stack_high;		/**< Most stack slots used by the
+					 * document */
+	uint32_t type_count[UNKNOWN + 1];	/**< Number of open elements
+						 * of each type, excluding
+						 * the root of the stack */
+
+#define FORMATTING_LIST_CHUNK 32
+	formatting_list_entry *formatting_entries;	/**< Storage for
+							 * formatting list
+							 * entries */
+	uint32_t formatting_alloc;	/**< Number of entries allocated */
+	uint32_t formatting_used;	/**< Number of entries ever used */
+	uint32_t formatting_free;	/**< First free entry */
+
+	uint32_t formatting_list;	/**< List of active formatting 
+					 * elements */
+	uint32_t formatting_list_end;	/**< End of active formatting list */
 
 	void *head_element;		/**< Pointer to HEAD element */
 
@@ -82,7 +102,33 @@ typedef struct hubbub_treebuilder_context
 					* inserted into the current node should
 					* be foster parented */
 
+	struct {
+		void *node;		/**< Foster parent, or NULL if it is
+					 * yet to be found */
+		bool insert;		/**< Whether nodes are inserted before
+					 * the table, rather than appended */
+	} foster;			/**< Foster parent of the current
+					 * table */
+
 	bool frameset_ok;		/**< Whether to process a frameset */
+
+	struct {
+		bool active;		/**< Whether a fragment is parsed */
+		element_type type;	/**< Type of the context element */
+	} fragment;			/**< Context of a fragment */
+
+	hubbub_aa_counts aa_counts;	/**< Adoption agency work done */
+	uint32_t reprocessed;		/**< Tokens handed on to another
+					 * insertion mode */
+	uint64_t tree_ns;		/**< Time spent in tree handler
+					 * callbacks, if measured */
+	uint64_t mode_ns[HUBBUB_INSERTION_MODES];	/**< Time spent in
+							 * each insertion
+							 * mode, apart from
+							 * callbacks */
+
+	const char *requested_charset;	/**< Charset last passed to the
+					 * encoding change handler, or NULL */
 } hubbub_treebuilder_context;
 
 /**
@@ -95,17 +141,75 @@ struct hubbub_treebuilder
 	hubbub_treebuilder_context context;	/**< Our context */
 
 	hubbub_tree_handler *tree_handler;	/**< Callback table */
+	hubbub_tree_tally *tally;	/**< Counts of the calls made to the
+					 * client's callbacks, or NULL */
+	bool count_calls;		/**< Whether the calls are counted for
+					 * the parse statistics */
+	bool measure_time;		/**< Whether the time spent in each
+					 * mode and in the calls is measured */
+
+	hubbub_trace_handler trace_handler;	/**< Trace handler, or NULL */
+	void *trace_pw;				/**< Trace handler data */
 
 	hubbub_error_handler error_handler;	/**< Error handler */
 	void *error_pw;				/**< Error handler data */
+
+	uint32_t aa_clone_limit;	/**< Adoption agency clones allowed
+					 * per document, or 0 for no limit */
+	uint32_t max_depth;		/**< Deepest stack index below which
+					 * elements nest, or 0 for no limit */
+
+	bool stop_at_body;		/**< Whether to stop at the body */
+
+	uint32_t stack_reserve;		/**< Stack slots kept when trimming */
+	uint32_t stack_high;		/**< Most stack slots used by the
+					 * documents before this one */
+
+	parserutils_buffer *comment_buf;	/**< Comment pieces seen so far,
+						 * or NULL if none */
+
+	hubbub_allocator_fn alloc;	/**< Memory (de)allocation function */
+	void *alloc_pw;			/**< Client private data */
 };
 
+/**
+ * Claim a reference on a node, unless the client does not count them
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param node         The node to reference
+ */
+static inline void treebuilder_ref_node(hubbub_treebuilder *treebuilder,
+		void *node)
+{
+	hubbub_tree_handler *handler = treebuilder->tree_handler;
+
+	if ((handler->flags & HUBBUB_TREE_NO_REFCOUNT) == 0)
+		handler->ref_node(handler->ctx, node);
+}
+
+/**
+ * Release a reference on a node, unless the client does not count them
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param node         The node to unreference
+ */
+static inline void treebuilder_unref_node(hubbub_treebuilder *treebuilder,
+		void *node)
+{
+	hubbub_tree_handler *handler = treebuilder->tree_handler;
+
+	if ((handler->flags & HUBBUB_TREE_NO_REFCOUNT) == 0)
+		handler->unref_node(handler->ctx, node);
+}
+
 hubbub_error hubbub_treebuilder_token_handler(
 		const hubbub_token *token, void *pw);
 
 hubbub_error process_characters_expect_whitespace(
 		hubbub_treebuilder *treebuilder, const hubbub_token *token,
 		bool insert_into_current_node);
+hubbub_error process_characters_keep_whitespace(
+		hubbub_treebuilder *treebuilder, const hubbub_token *token);
 hubbub_error process_comment_append(hubbub_treebuilder *treebuilder,
 		const hubbub_token *token, void *parent);
 hubbub_error parse_generic_rcdata(hubbub_treebuilder *treebuilder,
@@ -121,12 +225,18 @@ hubbub_error remove_node_from_dom(hubbub_treebuilder *treebuilder,
 		void *node);
 hubbub_error insert_element(hubbub_treebuilder *treebuilder, 
 		const hubbub_tag *tag_name, bool push);
+hubbub_error insert_created_element(hubbub_treebuilder *treebuilder,
+		hubbub_ns ns, element_type type, void *node, bool push);
 void close_implied_end_tags(hubbub_treebuilder *treebuilder, 
 		element_type except);
 void reset_insertion_mode(hubbub_treebuilder *treebuilder);
+hubbub_error insert_root_element(hubbub_treebuilder *treebuilder,
+		const hubbub_tag *tag);
 hubbub_error append_text(hubbub_treebuilder *treebuilder,
 		const hubbub_string *string);
 hubbub_error complete_script(hubbub_treebuilder *treebuilder);
+void treebuilder_trace(hubbub_treebuilder *treebuilder,
+		hubbub_trace_type type, uint32_t value, const char *name);
 
 bool is_special_element(element_type type);
 bool is_scoping_element(element_type type);
@@ -143,6 +253,9 @@ hubbub_error element_stack_remove(hubbub_treebuilder *treebuilder,
 		uint32_t index, hubbub_ns *ns, element_type *type, 
 		void **removed);
 uint32_t current_table(hubbub_treebuilder *treebuilder);
+void forget_foster_parent(hubbub_treebuilder *treebuilder);
+void element_stack_removed(hubbub_treebuilder *treebuilder,
+		uint32_t index, uint32_t limit);
 element_type current_node(hubbub_treebuilder *treebuilder);
 element_type prev_node(hubbub_treebuilder *treebuilder);
 
@@ -150,15 +263,15 @@ hubbub_error formatting_list_append(hubbub_treebuilder *treebuilder,
 		hubbub_ns ns, element_type type, void *node, 
 		uint32_t stack_index);
 hubbub_error formatting_list_insert(hubbub_treebuilder *treebuilder,
-		formatting_list_entry *prev, formatting_list_entry *next,
+		uint32_t prev, uint32_t next,
 		hubbub_ns ns, element_type type, void *node, 
 		uint32_t stack_index);
 hubbub_error formatting_list_remove(hubbub_treebuilder *treebuilder,
-		formatting_list_entry *entry,
+		uint32_t entry,
 		hubbub_ns *ns, element_type *type, void **node, 
 		uint32_t *stack_index);
 hubbub_error formatting_list_replace(hubbub_treebuilder *treebuilder,
-		formatting_list_entry *entry,
+		uint32_t entry,
 		hubbub_ns ns, element_type type, void *node, 
 		uint32_t stack_index,
 		hubbub_ns *ons, element_type *otype, void **onode, 
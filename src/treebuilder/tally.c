@@ -0,0 +1,387 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 The NetSurf Project.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "treebuilder/modes.h"
+#include "treebuilder/internal.h"
+#include "treebuilder/tally.h"
+#include "utils/clock.h"
+
+static hubbub_error tally_create_comment(void *ctx,
+		const hubbub_string *data, void **result);
+static hubbub_error tally_create_doctype(void *ctx,
+		const hubbub_doctype *doctype, void **result);
+static hubbub_error tally_create_element(void *ctx,
+		const hubbub_tag *tag, void **result);
+static hubbub_error tally_create_text(void *ctx,
+		const hubbub_string *data, void **result);
+static hubbub_error tally_ref_node(void *ctx, void *node);
+static hubbub_error tally_unref_node(void *ctx, void *node);
+static hubbub_error tally_append_child(void *ctx, void *parent,
+		void *child, void **result);
+static hubbub_error tally_insert_before(void *ctx, void *parent,
+		void *child, void *ref_child, void **result);
+static hubbub_error tally_remove_child(void *ctx, void *parent,
+		void *child, void **result);
+static hubbub_error tally_clone_node(void *ctx, void *node, bool deep,
+		void **result);
+static hubbub_error tally_reparent_children(void *ctx, void *node,
+		void *new_parent);
+static hubbub_error tally_get_parent(void *ctx, void *node,
+		bool element_only, void **result);
+static hubbub_error tally_has_children(void *ctx, void *node,
+		bool *result);
+static hubbub_error tally_form_associate(void *ctx, void *form,
+		void *node);
+static hubbub_error tally_add_attributes(void *ctx, void *node,
+		const hubbub_attribute *attributes, uint32_t n_attributes);
+static hubbub_error tally_set_quirks_mode(void *ctx,
+		hubbub_quirks_mode mode);
+static hubbub_error tally_encoding_change(void *ctx, const char *encname);
+static hubbub_error tally_complete_script(void *ctx, void *script);
+static hubbub_error tally_append_text_to(void *ctx, void *parent,
+		const hubbub_string *data, bool *result);
+
+/** Names of the callbacks, for tracing */
+static const char *const call_names[] = {
+	[HUBBUB_TREE_CREATE_COMMENT] = "create_comment",
+	[HUBBUB_TREE_CREATE_DOCTYPE] = "create_doctype",
+	[HUBBUB_TREE_CREATE_ELEMENT] = "create_element",
+	[HUBBUB_TREE_CREATE_TEXT] = "create_text",
+	[HUBBUB_TREE_REF_NODE] = "ref_node",
+	[HUBBUB_TREE_UNREF_NODE] = "unref_node",
+	[HUBBUB_TREE_APPEND_CHILD] = "append_child",
+	[HUBBUB_TREE_INSERT_BEFORE] = "insert_before",
+	[HUBBUB_TREE_REMOVE_CHILD] = "remove_child",
+	[HUBBUB_TREE_CLONE_NODE] = "clone_node",
+	[HUBBUB_TREE_REPARENT_CHILDREN] = "reparent_children",
+	[HUBBUB_TREE_GET_PARENT] = "get_parent",
+	[HUBBUB_TREE_HAS_CHILDREN] = "has_children",
+	[HUBBUB_TREE_FORM_ASSOCIATE] = "form_associate",
+	[HUBBUB_TREE_ADD_ATTRIBUTES] = "add_attributes",
+	[HUBBUB_TREE_SET_QUIRKS_MODE] = "set_quirks_mode",
+	[HUBBUB_TREE_ENCODING_CHANGE] = "encoding_change",
+	[HUBBUB_TREE_COMPLETE_SCRIPT] = "complete_script",
+	[HUBBUB_TREE_APPEND_TEXT_TO] = "append_text_to"
+};
+
+/**
+ * Count and trace a call, and find the handler it is for
+ *
+ * The client's handler is not expected to call back into the
+ * treebuilder, so calls do not nest and one start time is enough.
+ *
+ * \param ctx   The tally
+ * \param call  Callback called
+ * \return The client's handler
+ */
+static inline hubbub_tree_handler *tally_count(void *ctx,
+		hubbub_tree_call call)
+{
+	hubbub_tree_tally *tally = (hubbub_tree_tally *) ctx;
+
+	tally->calls[call]++;
+
+	if (tally->treebuilder->measure_time)
+		tally->start = hubbub_clock_ns();
+
+	if (tally->treebuilder->trace_handler != NULL) {
+		treebuilder_trace(tally->treebuilder, HUBBUB_TRACE_TREE_CALL,
+				call, call_names[call]);
+	}
+
+	return tally->client;
+}
+
+/**
+ * Account for the time a call took, if this is measured
+ *
+ * \param ctx    The tally
+ * \param error  Result of the call
+ * \return \a error
+ */
+static inline hubbub_error tally_done(void *ctx, hubbub_error error)
+{
+	hubbub_tree_tally *tally = (hubbub_tree_tally *) ctx;
+
+	if (tally->treebuilder->measure_time) {
+		tally->treebuilder->context.tree_ns +=
+				hubbub_clock_ns() - tally->start;
+	}
+
+	return error;
+}
+
+/**
+ * Count the calls made to a tree handler
+ *
+ * The client's handler is read afresh on each call, but whether it has
+ * its optional callbacks, and its flags, are copied now, so this must be
+ * called again if they change. The counts are left as they are.
+ *
+ * \param tally   Tally to set up
+ * \param client  Handler to count calls to, or NULL for none
+ */
+void hubbub_tree_tally_init(hubbub_tree_tally *tally,
+		hubbub_tree_handler *client)
+{
+	hubbub_tree_handler *h = &tally->handler;
+
+	assert(tally != NULL);
+
+	tally->client = client;
+	if (client == NULL)
+		return;
+
+	h->create_comment = tally_create_comment;
+	h->create_doctype = tally_create_doctype;
+	h->create_element = tally_create_element;
+	h->create_text = tally_create_text;
+	h->ref_node = tally_ref_node;
+	h->unref_node = tally_unref_node;
+	h->append_child = tally_append_child;
+	h->insert_before = tally_insert_before;
+	h->remove_child = tally_remove_child;
+	h->clone_node = tally_clone_node;
+	h->reparent_children = tally_reparent_children;
+	h->get_parent = tally_get_parent;
+	h->has_children = tally_has_children;
+	h->form_associate = tally_form_associate;
+	h->add_attributes = tally_add_attributes;
+	h->set_quirks_mode = tally_set_quirks_mode;
+	h->encoding_change = client->encoding_change != NULL ?
+			tally_encoding_change : NULL;
+	h->complete_script = tally_complete_script;
+	h->ctx = tally;
+	h->flags = client->flags;
+	h->append_text_to = client->append_text_to != NULL ?
+			tally_append_text_to : NULL;
+}
+
+hubbub_error tally_create_comment(void *ctx,
+		const hubbub_string *data, void **result)
+{
+	hubbub_tree_handler *client =
+			tally_count(ctx, HUBBUB_TREE_CREATE_COMMENT);
+	hubbub_error error;
+
+	error = client->create_comment(client->ctx, data, result);
+
+	return tally_done(ctx, error);
+}
+
+hubbub_error tally_create_doctype(void *ctx,
+		const hubbub_doctype *doctype, void **result)
+{
+	hubbub_tree_handler *client =
+			tally_count(ctx, HUBBUB_TREE_CREATE_DOCTYPE);
+	hubbub_error error;
+
+	error = client->create_doctype(client->ctx, doctype, result);
+
+	return tally_done(ctx, error);
+}
+
+hubbub_error tally_create_element(void *ctx,
+		const hubbub_tag *tag, void **result)
+{
+	hubbub_tree_handler *client =
+			tally_count(ctx, HUBBUB_TREE_CREATE_ELEMENT);
+	hubbub_error error;
+
+	error = client->create_element(client->ctx, tag, result);
+
+	return tally_done(ctx, error);
+}
+
+hubbub_error tally_create_text(void *ctx,
+		const hubbub_string *data, void **result)
+{
+	hubbub_tree_handler *client =
+			tally_count(ctx, HUBBUB_TREE_CREATE_TEXT);
+	hubbub_error error;
+
+	error = client->create_text(client->ctx, data, result);
+
+	return tally_done(ctx, error);
+}
+
+hubbub_error tally_ref_node(void *ctx, void *node)
+{
+	hubbub_tree_handler *client = tally_count(ctx, HUBBUB_TREE_REF_NODE);
+	hubbub_error error;
+
+	error = client->ref_node(client->ctx, node);
+
+	return tally_done(ctx, error);
+}
+
+hubbub_error tally_unref_node(void *ctx, void *node)
+{
+	hubbub_tree_handler *client = tally_count(ctx, HUBBUB_TREE_UNREF_NODE);
+	hubbub_error error;
+
+	error = client->unref_node(client->ctx, node);
+
+	return tally_done(ctx, error);
+}
+
+hubbub_error tally_append_child(void *ctx, void *parent,
+		void *child, void **result)
+{
+	hubbub_tree_handler *client =
+			tally_count(ctx, HUBBUB_TREE_APPEND_CHILD);
+	hubbub_error error;
+
+	error = client->append_child(client->ctx, parent, child, result);
+
+	return tally_done(ctx, error);
+}
+
+hubbub_error tally_insert_before(void *ctx, void *parent,
+		void *child, void *ref_child, void **result)
+{
+	hubbub_tree_handler *client =
+			tally_count(ctx, HUBBUB_TREE_INSERT_BEFORE);
+	hubbub_error error;
+
+	error = client->insert_before(client->ctx, parent, child, ref_child,
+			result);
+
+	return tally_done(ctx, error);
+}
+
+hubbub_error tally_remove_child(void *ctx, void *parent,
+		void *child, void **result)
+{
+	hubbub_tree_handler *client =
+			tally_count(ctx, HUBBUB_TREE_REMOVE_CHILD);
+	hubbub_error error;
+
+	error = client->remove_child(client->ctx, parent, child, result);
+
+	return tally_done(ctx, error);
+}
+
+hubbub_error tally_clone_node(void *ctx, void *node, bool deep,
+		void **result)
+{
+	hubbub_tree_handler *client = tally_count(ctx, HUBBUB_TREE_CLONE_NODE);
+	hubbub_error error;
+
+	error = client->clone_node(client->ctx, node, deep, result);
+
+	return tally_done(ctx, error);
+}
+
+hubbub_error tally_reparent_children(void *ctx, void *node,
+		void *new_parent)
+{
+	hubbub_tree_handler *client =
+			tally_count(ctx, HUBBUB_TREE_REPARENT_CHILDREN);
+	hubbub_error error;
+
+	error = client->reparent_children(client->ctx, node, new_parent);
+
+	return tally_done(ctx, error);
+}
+
+hubbub_error tally_get_parent(void *ctx, void *node,
+		bool element_only, void **result)
+{
+	hubbub_tree_handler *client = tally_count(ctx, HUBBUB_TREE_GET_PARENT);
+	hubbub_error error;
+
+	error = client->get_parent(client->ctx, node, element_only, result);
+
+	return tally_done(ctx, error);
+}
+
+hubbub_error tally_has_children(void *ctx, void *node,
+		bool *result)
+{
+	hubbub_tree_handler *client =
+			tally_count(ctx, HUBBUB_TREE_HAS_CHILDREN);
+	hubbub_error error;
+
+	error = client->has_children(client->ctx, node, result);
+
+	return tally_done(ctx, error);
+}
+
+hubbub_error tally_form_associate(void *ctx, void *form,
+		void *node)
+{
+	hubbub_tree_handler *client =
+			tally_count(ctx, HUBBUB_TREE_FORM_ASSOCIATE);
+	hubbub_error error;
+
+	error = client->form_associate(client->ctx, form, node);
+
+	return tally_done(ctx, error);
+}
+
+hubbub_error tally_add_attributes(void *ctx, void *node,
+		const hubbub_attribute *attributes, uint32_t n_attributes)
+{
+	hubbub_tree_handler *client =
+			tally_count(ctx, HUBBUB_TREE_ADD_ATTRIBUTES);
+	hubbub_error error;
+
+	error = client->add_attributes(client->ctx, node, attributes,
+			n_attributes);
+
+	return tally_done(ctx, error);
+}
+
+hubbub_error tally_set_quirks_mode(void *ctx,
+		hubbub_quirks_mode mode)
+{
+	hubbub_tree_handler *client =
+			tally_count(ctx, HUBBUB_TREE_SET_QUIRKS_MODE);
+	hubbub_error error;
+
+	error = client->set_quirks_mode(client->ctx, mode);
+
+	return tally_done(ctx, error);
+}
+
+hubbub_error tally_encoding_change(void *ctx, const char *encname)
+{
+	hubbub_tree_handler *client =
+			tally_count(ctx, HUBBUB_TREE_ENCODING_CHANGE);
+	hubbub_error error;
+
+	error = client->encoding_change(client->ctx, encname);
+
+	return tally_done(ctx, error);
+}
+
+hubbub_error tally_complete_script(void *ctx, void *script)
+{
+	hubbub_tree_handler *client =
+			tally_count(ctx, HUBBUB_TREE_COMPLETE_SCRIPT);
+	hubbub_error error;
+
+	error = client->complete_script(client->ctx, script);
+
+	return tally_done(ctx, error);
+}
+
+hubbub_error tally_append_text_to(void *ctx, void *parent,
+		const hubbub_string *data, bool *result)
+{
+	hubbub_tree_handler *client =
+			tally_count(ctx, HUBBUB_TREE_APPEND_TEXT_TO);
+	hubbub_error error;
+
+	error = client->append_text_to(client->ctx, parent, data, result);
+
+	return tally_done(ctx, error);
+}
@@ -0,0 +1,42 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 The NetSurf Project.
+ */
+
+#ifndef hubbub_treebuilder_tally_h_
+#define hubbub_treebuilder_tally_h_
+
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include <hubbub/errors.h>
+#include <hubbub/functypes.h>
+#include <hubbub/tree.h>
+#include <hubbub/types.h>
+
+#include "treebuilder/treebuilder.h"
+
+/**
+ * Tree handler which counts the calls made to another
+ *
+ * The treebuilder calls \a handler, which forwards each call to the
+ * client's handler. Callbacks which the client leaves NULL are NULL in
+ * \a handler too, so that the treebuilder takes the same paths as it
+ * would without counting. Each call is also traced, if the treebuilder
+ * has a trace handler, and timed, if it is measuring time.
+ */
+typedef struct hubbub_tree_tally {
+	hubbub_tree_handler handler;	/**< Handler which counts */
+	hubbub_tree_handler *client;	/**< Handler counted */
+	hubbub_treebuilder *treebuilder;	/**< Treebuilder calling */
+	uint32_t calls[HUBBUB_TREE_N_CALLS];	/**< Calls made, by type */
+	uint64_t start;			/**< When the current call began */
+} hubbub_tree_tally;
+
+/* Count the calls made to a tree handler */
+void hubbub_tree_tally_init(hubbub_tree_tally *tally,
+		hubbub_tree_handler *client);
+
+#endif
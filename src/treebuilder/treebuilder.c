@@ -11,48 +11,148 @@
 
 #include <stdio.h>
 
+#include <hubbub/parser.h>
+
 #include "treebuilder/modes.h"
 #include "treebuilder/internal.h"
 #include "treebuilder/treebuilder.h"
+#include "utils/clock.h"
+#include "utils/parserutilserror.h"
 #include "utils/utils.h"
 #include "utils/string.h"
 
+static void clear_context(hubbub_treebuilder *treebuilder);
 static bool is_form_associated(element_type type);
+static void *insertion_parent(hubbub_treebuilder *treebuilder);
+static void element_stack_trim(hubbub_treebuilder *treebuilder);
+static hubbub_error element_stack_reserve(hubbub_treebuilder *treebuilder,
+		uint32_t depth);
+static uint32_t find_table(hubbub_treebuilder *treebuilder, uint32_t index);
+static void set_current_table(hubbub_treebuilder *treebuilder,
+		uint32_t table);
+static hubbub_error formatting_list_new_entry(hubbub_treebuilder *treebuilder,
+		uint32_t *index);
+static hubbub_error collect_comment(hubbub_treebuilder *treebuilder,
+		const hubbub_token *token, hubbub_token *whole);
+static hubbub_error update_tally(hubbub_treebuilder *treebuilder);
+static void checkpoint_ref_nodes(hubbub_tree_handler *handler,
+		const hubbub_treebuilder_context *ctx, bool ref);
+static hubbub_error handle_token_timed(hubbub_treebuilder *treebuilder,
+		insertion_mode mode, const hubbub_token *token);
+
+/** Handler for a token in one insertion mode */
+typedef hubbub_error (*mode_handler)(hubbub_treebuilder *treebuilder,
+		const hubbub_token *token);
+
+/** Token handlers, indexed by insertion mode */
+static const mode_handler mode_handlers[] = {
+	[INITIAL] = handle_initial,
+	[BEFORE_HTML] = handle_before_html,
+	[BEFORE_HEAD] = handle_before_head,
+	[IN_HEAD] = handle_in_head,
+	[IN_HEAD_NOSCRIPT] = handle_in_head_noscript,
+	[AFTER_HEAD] = handle_after_head,
+	[IN_BODY] = handle_in_body,
+	[IN_TABLE] = handle_in_table,
+	[IN_CAPTION] = handle_in_caption,
+	[IN_COLUMN_GROUP] = handle_in_column_group,
+	[IN_TABLE_BODY] = handle_in_table_body,
+	[IN_ROW] = handle_in_row,
+	[IN_CELL] = handle_in_cell,
+	[IN_SELECT] = handle_in_select,
+	[IN_SELECT_IN_TABLE] = handle_in_select_in_table,
+	[IN_FOREIGN_CONTENT] = handle_in_foreign_content,
+	[AFTER_BODY] = handle_after_body,
+	[IN_FRAMESET] = handle_in_frameset,
+	[AFTER_FRAMESET] = handle_after_frameset,
+	[AFTER_AFTER_BODY] = handle_after_after_body,
+	[AFTER_AFTER_FRAMESET] = handle_after_after_frameset,
+	[GENERIC_RCDATA] = handle_generic_rcdata
+};
+
+/** Names of the insertion modes, for tracing */
+static const char *const mode_names[] = {
+	[INITIAL] = "INITIAL",
+	[BEFORE_HTML] = "BEFORE_HTML",
+	[BEFORE_HEAD] = "BEFORE_HEAD",
+	[IN_HEAD] = "IN_HEAD",
+	[IN_HEAD_NOSCRIPT] = "IN_HEAD_NOSCRIPT",
+	[AFTER_HEAD] = "AFTER_HEAD",
+	[IN_BODY] = "IN_BODY",
+	[IN_TABLE] = "IN_TABLE",
+	[IN_CAPTION] = "IN_CAPTION",
+	[IN_COLUMN_GROUP] = "IN_COLUMN_GROUP",
+	[IN_TABLE_BODY] = "IN_TABLE_BODY",
+	[IN_ROW] = "IN_ROW",
+	[IN_CELL] = "IN_CELL",
+	[IN_SELECT] = "IN_SELECT",
+	[IN_SELECT_IN_TABLE] = "IN_SELECT_IN_TABLE",
+	[IN_FOREIGN_CONTENT] = "IN_FOREIGN_CONTENT",
+	[AFTER_BODY] = "AFTER_BODY",
+	[IN_FRAMESET] = "IN_FRAMESET",
+	[AFTER_FRAMESET] = "AFTER_FRAMESET",
+	[AFTER_AFTER_BODY] = "AFTER_AFTER_BODY",
+	[AFTER_AFTER_FRAMESET] = "AFTER_AFTER_FRAMESET",
+	[GENERIC_RCDATA] = "GENERIC_RCDATA"
+};
 
 /**
  * Create a hubbub treebuilder
  *
  * \param tokeniser    Underlying tokeniser instance
+ * \param alloc        Memory (de)allocation function, or NULL for the default
+ * \param pw           Pointer to client-specific private data (may be NULL)
  * \param treebuilder  Pointer to location to receive treebuilder instance
  * \return HUBBUB_OK on success,
  *         HUBBUB_BADPARM on bad parameters
  *         HUBBUB_NOMEM on memory exhaustion
  */
 hubbub_error hubbub_treebuilder_create(hubbub_tokeniser *tokeniser,
+		hubbub_allocator_fn alloc, void *pw,
 		hubbub_treebuilder **treebuilder)
 {
 	hubbub_error error;
 	hubbub_treebuilder *tb;
 	hubbub_tokeniser_optparams tokparams;
 
+	/* The statistics have room for the time spent in each mode */
+	assert(N_ELEMENTS(mode_handlers) == HUBBUB_INSERTION_MODES);
+
 	if (tokeniser == NULL || treebuilder == NULL)
 		return HUBBUB_BADPARM;
 
-	tb = malloc(sizeof(hubbub_treebuilder));
+	if (alloc == NULL)
+		alloc = hubbub_default_alloc;
+
+	tb = alloc(NULL, sizeof(hubbub_treebuilder), pw);
 	if (tb == NULL)
 		return HUBBUB_NOMEM;
 
 	tb->tokeniser = tokeniser;
 
+	tb->alloc = alloc;
+	tb->alloc_pw = pw;
+
 	tb->tree_handler = NULL;
+	tb->tally = NULL;
+	tb->count_calls = false;
+	tb->measure_time = false;
+	tb->trace_handler = NULL;
+	tb->trace_pw = NULL;
+	tb->aa_clone_limit = 0;
+	tb->max_depth = 0;
+	tb->stop_at_body = false;
+	tb->stack_reserve = 0;
+	tb->stack_high = 0;
+	tb->comment_buf = NULL;
 
 	memset(&tb->context, 0, sizeof(hubbub_treebuilder_context));
 	tb->context.mode = INITIAL;
 
-	tb->context.element_stack = malloc(
-			ELEMENT_STACK_CHUNK * sizeof(element_context));
+	tb->context.element_stack = alloc(NULL,
+			ELEMENT_STACK_CHUNK * sizeof(element_context), pw);
 	if (tb->context.element_stack == NULL) {
-		free(tb);
+		alloc(tb, 0, pw);
 		return HUBBUB_NOMEM;
 	}
 	tb->context.stack_alloc = ELEMENT_STACK_CHUNK;
@@ -73,8 +173,8 @@ hubbub_error hubbub_treebuilder_create(hubbub_tokeniser *tokeniser,
 	error = hubbub_tokeniser_setopt(tokeniser,
 			HUBBUB_TOKENISER_TOKEN_HANDLER, &tokparams);
 	if (error != HUBBUB_OK) {
-		free(tb->context.element_stack);
-		free(tb);
+		alloc(tb->context.element_stack, 0, pw);
+		alloc(tb, 0, pw);
 		return error;
 	}
 
@@ -91,7 +191,6 @@ hubbub_error hubbub_treebuilder_create(hubbub_tokeniser *tokeniser,
  */
 hubbub_error hubbub_treebuilder_destroy(hubbub_treebuilder *treebuilder)
 {
-	formatting_list_entry *entry, *next;
 	hubbub_tokeniser_optparams tokparams;
 
 	if (treebuilder == NULL)
@@ -103,57 +202,144 @@ hubbub_error hubbub_treebuilder_destroy(hubbub_treebuilder *treebuilder)
 	hubbub_tokeniser_setopt(treebuilder->tokeniser,
 			HUBBUB_TOKENISER_TOKEN_HANDLER, &tokparams);
 
-	/* Clean up context */
+	clear_context(treebuilder);
+
+	if (treebuilder->tally != NULL) {
+		treebuilder->alloc(treebuilder->tally, 0,
+				treebuilder->alloc_pw);
+	}
+
+	if (treebuilder->comment_buf != NULL)
+		parserutils_buffer_destroy(treebuilder->comment_buf);
+
+	treebuilder->alloc(treebuilder->context.element_stack, 0,
+			treebuilder->alloc_pw);
+	treebuilder->context.element_stack = NULL;
+
+	if (treebuilder->context.formatting_entries != NULL) {
+		treebuilder->alloc(treebuilder->context.formatting_entries, 0,
+				treebuilder->alloc_pw);
+		treebuilder->context.formatting_entries = NULL;
+	}
+
+	treebuilder->alloc(treebuilder, 0, treebuilder->alloc_pw);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Release the nodes and formatting list entries held by a treebuilder
+ *
+ * \param treebuilder  The treebuilder instance to clear
+ */
+void clear_context(hubbub_treebuilder *treebuilder)
+{
+	formatting_list_entry *list = treebuilder->context.formatting_entries;
+	uint32_t entry;
+
 	if (treebuilder->tree_handler != NULL) {
 		uint32_t n;
 
 		if (treebuilder->context.head_element != NULL) {
-			treebuilder->tree_handler->unref_node(
-					treebuilder->tree_handler->ctx,
+			treebuilder_unref_node(treebuilder,
 					treebuilder->context.head_element);
 		}
 
 		if (treebuilder->context.form_element != NULL) {
-			treebuilder->tree_handler->unref_node(
-					treebuilder->tree_handler->ctx,
+			treebuilder_unref_node(treebuilder,
 					treebuilder->context.form_element);
 		}
 
 		if (treebuilder->context.document != NULL) {
-			treebuilder->tree_handler->unref_node(
-					treebuilder->tree_handler->ctx,
+			treebuilder_unref_node(treebuilder,
 					treebuilder->context.document);
 		}
 
+		forget_foster_parent(treebuilder);
+
 		for (n = treebuilder->context.current_node;
 				n > 0; n--) {
-			treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,
+			treebuilder_unref_node(treebuilder,
 				treebuilder->context.element_stack[n].node);
 		}
 		if (treebuilder->context.element_stack[0].type == HTML) {
-			treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,
+			treebuilder_unref_node(treebuilder,
 				treebuilder->context.element_stack[0].node);
 		}
 	}
-	free(treebuilder->context.element_stack);
-	treebuilder->context.element_stack = NULL;
 
-	for (entry = treebuilder->context.formatting_list; entry != NULL;
-			entry = next) {
-		next = entry->next;
-
-		if (treebuilder->tree_handler != NULL) {
-			treebuilder->tree_handler->unref_node(
-					treebuilder->tree_handler->ctx,
-					entry->details.node);
+	if (treebuilder->tree_handler != NULL) {
+		for (entry = treebuilder->context.formatting_list; entry != 0;
+				entry = list[entry].next) {
+			treebuilder_unref_node(treebuilder,
+					list[entry].details.node);
 		}
+	}
 
-		free(entry);
+	/* Keep the entry storage, but release every entry */
+	treebuilder->context.formatting_used = 0;
+	treebuilder->context.formatting_free = 0;
+	treebuilder->context.formatting_list = 0;
+	treebuilder->context.formatting_list_end = 0;
+}
+
+/**
+ * Reset a hubbub treebuilder, ready to build a new document
+ *
+ * All nodes referenced by the treebuilder are released, including the
+ * document node; the client must supply a new one before parsing. The
+ * stack of open elements is trimmed back to a couple of chunks, and
+ * callbacks and the scripting flag are preserved.
+ *
+ * \param treebuilder  The treebuilder instance to reset
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_treebuilder_reset(hubbub_treebuilder *treebuilder)
+{
+	element_context *stack;
+	uint32_t stack_alloc;
+	formatting_list_entry *entries;
+	uint32_t entries_alloc;
+	bool enable_scripting;
+
+	if (treebuilder == NULL)
+		return HUBBUB_BADPARM;
+
+	clear_context(treebuilder);
+
+	if (treebuilder->tally != NULL) {
+		memset(treebuilder->tally->calls, 0,
+				sizeof(treebuilder->tally->calls));
+	}
+
+	if (treebuilder->context.stack_high > treebuilder->stack_high)
+		treebuilder->stack_high = treebuilder->context.stack_high;
+
+	if (treebuilder->comment_buf != NULL) {
+		parserutils_buffer_discard(treebuilder->comment_buf, 0,
+				treebuilder->comment_buf->length);
 	}
 
-	free(treebuilder);
+	stack = treebuilder->context.element_stack;
+	stack_alloc = treebuilder->context.stack_alloc;
+	entries = treebuilder->context.formatting_entries;
+	entries_alloc = treebuilder->context.formatting_alloc;
+	enable_scripting = treebuilder->context.enable_scripting;
+
+	memset(&treebuilder->context, 0, sizeof(hubbub_treebuilder_context));
+	treebuilder->context.mode = INITIAL;
+
+	treebuilder->context.element_stack = stack;
+	treebuilder->context.stack_alloc = stack_alloc;
+	treebuilder->context.element_stack[0].type = (element_type) 0;
+	element_stack_trim(treebuilder);
+
+	treebuilder->context.formatting_entries = entries;
+	treebuilder->context.formatting_alloc = entries_alloc;
+
+	treebuilder->context.enable_scripting = enable_scripting;
+	treebuilder->context.strip_leading_lr = false;
+	treebuilder->context.frameset_ok = true;
 
 	return HUBBUB_OK;
 }
@@ -180,6 +366,14 @@ hubbub_error hubbub_treebuilder_setopt(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TREEBUILDER_TREE_HANDLER:
 		treebuilder->tree_handler = params->tree_handler;
+		if (treebuilder->tally != NULL) {
+			hubbub_tree_tally_init(treebuilder->tally,
+					params->tree_handler);
+			if (params->tree_handler != NULL) {
+				treebuilder->tree_handler =
+						&treebuilder->tally->handler;
+			}
+		}
 		break;
 	case HUBBUB_TREEBUILDER_DOCUMENT_NODE:
 		treebuilder->context.document = params->document_node;
@@ -188,11 +382,542 @@ hubbub_error hubbub_treebuilder_setopt(hubbub_treebuilder *treebuilder,
 		treebuilder->context.enable_scripting =
 				params->enable_scripting;
 		break;
+	case HUBBUB_TREEBUILDER_AA_CLONE_LIMIT:
+		treebuilder->aa_clone_limit = params->aa_clone_limit;
+		break;
+	case HUBBUB_TREEBUILDER_MAX_DEPTH:
+		treebuilder->max_depth = params->max_depth;
+		break;
+	case HUBBUB_TREEBUILDER_STOP_AT_BODY:
+		treebuilder->stop_at_body = params->stop_at_body;
+		break;
+	case HUBBUB_TREEBUILDER_STACK_RESERVE:
+		return element_stack_reserve(treebuilder,
+				params->stack_reserve);
+	case HUBBUB_TREEBUILDER_COUNT_CALLS:
+		if (params->count_calls && !treebuilder->count_calls &&
+				treebuilder->tally != NULL) {
+			memset(treebuilder->tally->calls, 0,
+					sizeof(treebuilder->tally->calls));
+		}
+		treebuilder->count_calls = params->count_calls;
+		return update_tally(treebuilder);
+	case HUBBUB_TREEBUILDER_TRACE_HANDLER:
+		treebuilder->trace_handler = params->trace_handler.handler;
+		treebuilder->trace_pw = params->trace_handler.pw;
+		return update_tally(treebuilder);
+	case HUBBUB_TREEBUILDER_MEASURE_TIME:
+		treebuilder->measure_time = params->measure_time;
+		return update_tally(treebuilder);
 	}
 
 	return HUBBUB_OK;
 }
 
+/**
+ * Start building the tree of a fragment
+ *
+ * This follows the HTML fragment parsing algorithm, for the content of an
+ * element in the HTML namespace. An html element is appended to the
+ * document node, to hold the fragment, and the insertion mode and the
+ * content model are set as the context element requires, skipping the
+ * modes which build the skeleton of a document. No form element is
+ * associated with the context.
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param context      Name of the context element
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_INVALID if there is no document node, or a document has
+ *                        been begun,
+ *         appropriate error if the tree handler fails
+ */
+hubbub_error hubbub_treebuilder_begin_fragment(
+		hubbub_treebuilder *treebuilder, const hubbub_string *context)
+{
+	hubbub_tokeniser_optparams tokparams;
+	hubbub_error error;
+	hubbub_tag tag;
+
+	if (treebuilder == NULL || context == NULL)
+		return HUBBUB_BADPARM;
+
+	if (treebuilder->tree_handler == NULL ||
+			treebuilder->context.document == NULL ||
+			treebuilder->context.mode != INITIAL ||
+			treebuilder->context.element_stack[0].type != 0)
+		return HUBBUB_INVALID;
+
+	tag.ns = HUBBUB_NS_HTML;
+	tag.name.ptr = (const uint8_t *) "html";
+	tag.name.len = SLEN("html");
+	tag.atom = element_type_to_atom(HTML);
+	tag.n_attributes = 0;
+	tag.attributes = NULL;
+	tag.self_closing = false;
+
+	error = insert_root_element(treebuilder, &tag);
+	if (error != HUBBUB_OK)
+		return error;
+
+	treebuilder->context.fragment.active = true;
+	treebuilder->context.fragment.type =
+			element_type_from_name(treebuilder, context);
+
+	/* A fragment is never a frameset document */
+	treebuilder->context.frameset_ok = false;
+
+	reset_insertion_mode(treebuilder);
+
+	tag.name = *context;
+	tag.atom = element_type_to_atom(treebuilder->context.fragment.type);
+
+	tokparams.content_model.model = hubbub_parser_content_model_for(&tag,
+			treebuilder->context.enable_scripting);
+
+	return hubbub_tokeniser_setopt(treebuilder->tokeniser,
+			HUBBUB_TOKENISER_CONTENT_MODEL, &tokparams);
+}
+
+/**
+ * Recorded state of a treebuilder
+ *
+ * The stack of open elements and the formatting list entries follow the
+ * structure, in the same allocation.
+ */
+struct hubbub_treebuilder_snapshot {
+	hubbub_treebuilder_context context;	/**< Context recorded */
+
+	hubbub_tree_handler *tree_handler;	/**< Handler for the nodes
+						 * referenced */
+
+	hubbub_allocator_fn alloc;	/**< Memory (de)allocation function */
+	void *alloc_pw;			/**< Client private data */
+};
+
+/**
+ * Take or release a reference on each node held in a treebuilder context
+ *
+ * These are the nodes clear_context() releases.
+ *
+ * \param handler  Tree handler for the nodes
+ * \param ctx      Context holding the nodes
+ * \param ref      Whether to take references, rather than release them
+ */
+void checkpoint_ref_nodes(hubbub_tree_handler *handler,
+		const hubbub_treebuilder_context *ctx, bool ref)
+{
+	void *nodes[4] = { ctx->head_element, ctx->form_element,
+			ctx->document, ctx->foster.node };
+	uint32_t n;
+
+	if ((handler->flags & HUBBUB_TREE_NO_REFCOUNT) != 0)
+		return;
+
+	for (n = 0; n < N_ELEMENTS(nodes); n++) {
+		if (nodes[n] == NULL)
+			continue;
+
+		if (ref)
+			handler->ref_node(handler->ctx, nodes[n]);
+		else
+			handler->unref_node(handler->ctx, nodes[n]);
+	}
+
+	for (n = 0; n <= ctx->current_node; n++) {
+		void *node = ctx->element_stack[n].node;
+
+		if (n == 0 && ctx->element_stack[0].type != HTML)
+			continue;
+
+		if (ref)
+			handler->ref_node(handler->ctx, node);
+		else
+			handler->unref_node(handler->ctx, node);
+	}
+
+	for (n = ctx->formatting_list; n != 0;
+			n = ctx->formatting_entries[n].next) {
+		void *node = ctx->formatting_entries[n].details.node;
+
+		if (ref)
+			handler->ref_node(handler->ctx, node);
+		else
+			handler->unref_node(handler->ctx, node);
+	}
+}
+
+/**
+ * Record the state of a treebuilder between tokens
+ *
+ * The nodes the treebuilder refers to are referenced by the checkpoint
+ * until it is destroyed, but the tree itself is not recorded: the client
+ * which restores the state must supply a tree in which the same node
+ * handles refer to the same nodes.
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param alloc        Memory (de)allocation function
+ * \param pw           Pointer to client-specific private data
+ * \param checkpoint   Pointer to location to receive the state
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_INVALID if there is no tree handler, or a comment is
+ *                        part way through,
+ *         HUBBUB_NOMEM on memory exhaustion
+ */
+hubbub_error hubbub_treebuilder_checkpoint(hubbub_treebuilder *treebuilder,
+		hubbub_allocator_fn alloc, void *pw,
+		hubbub_treebuilder_snapshot **checkpoint)
+{
+	const hubbub_treebuilder_context *ctx;
+	hubbub_treebuilder_snapshot *cp;
+	uint32_t depth;
+
+	if (treebuilder == NULL || alloc == NULL || checkpoint == NULL)
+		return HUBBUB_BADPARM;
+
+	if (treebuilder->tree_handler == NULL ||
+			(treebuilder->comment_buf != NULL &&
+			treebuilder->comment_buf->length != 0))
+		return HUBBUB_INVALID;
+
+	ctx = &treebuilder->context;
+	depth = ctx->current_node + 1;
+
+	cp = alloc(NULL, sizeof(hubbub_treebuilder_snapshot) +
+			depth * sizeof(element_context) +
+			ctx->formatting_used * sizeof(formatting_list_entry),
+			pw);
+	if (cp == NULL)
+		return HUBBUB_NOMEM;
+
+	cp->context = *ctx;
+	cp->context.element_stack = (element_context *) (cp + 1);
+	cp->context.stack_alloc = depth;
+	cp->context.formatting_entries = (formatting_list_entry *)
+			(cp->context.element_stack + depth);
+	cp->context.formatting_alloc = ctx->formatting_used;
+
+	memcpy(cp->context.element_stack, ctx->element_stack,
+			depth * sizeof(element_context));
+	if (ctx->formatting_used != 0) {
+		memcpy(cp->context.formatting_entries,
+				ctx->formatting_entries,
+				ctx->formatting_used *
+					sizeof(formatting_list_entry));
+	}
+
+	cp->tree_handler = treebuilder->tree_handler;
+	cp->alloc = alloc;
+	cp->alloc_pw = pw;
+
+	checkpoint_ref_nodes(cp->tree_handler, &cp->context, true);
+
+	*checkpoint = cp;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Return a freshly reset treebuilder to a recorded state
+ *
+ * The treebuilder's tree handler must by then have been given a tree in
+ * which the node handles recorded refer to the nodes they did, such as a
+ * copy of the tree which was recorded. Every node handle the treebuilder
+ * holds, the document node's included, is replaced by those recorded.
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param checkpoint   State to restore
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_INVALID if there is no tree handler, or a document has
+ *                        been begun,
+ *         HUBBUB_NOMEM on memory exhaustion
+ */
+hubbub_error hubbub_treebuilder_restore(hubbub_treebuilder *treebuilder,
+		const hubbub_treebuilder_snapshot *checkpoint)
+{
+	const hubbub_treebuilder_context *from;
+	hubbub_treebuilder_context *ctx;
+	element_context *stack;
+	formatting_list_entry *entries;
+	uint32_t stack_alloc, entries_alloc;
+	bool enable_scripting;
+
+	if (treebuilder == NULL || checkpoint == NULL)
+		return HUBBUB_BADPARM;
+
+	ctx = &treebuilder->context;
+	from = &checkpoint->context;
+
+	if (treebuilder->tree_handler == NULL || ctx->mode != INITIAL ||
+			ctx->element_stack[0].type != 0)
+		return HUBBUB_INVALID;
+
+	/* Make room first, so that failing leaves the treebuilder as it
+	 * was */
+	if (ctx->stack_alloc < from->stack_alloc) {
+		stack_alloc = from->stack_alloc + ELEMENT_STACK_CHUNK - 1;
+		stack_alloc -= stack_alloc % ELEMENT_STACK_CHUNK;
+
+		stack = treebuilder->alloc(ctx->element_stack,
+				stack_alloc * sizeof(element_context),
+				treebuilder->alloc_pw);
+		if (stack == NULL)
+			return HUBBUB_NOMEM;
+
+		ctx->element_stack = stack;
+		ctx->stack_alloc = stack_alloc;
+	}
+
+	if (ctx->formatting_alloc < from->formatting_alloc) {
+		entries_alloc = from->formatting_alloc +
+				FORMATTING_LIST_CHUNK - 1;
+		entries_alloc -= entries_alloc % FORMATTING_LIST_CHUNK;
+
+		entries = treebuilder->alloc(ctx->formatting_entries,
+				entries_alloc * sizeof(formatting_list_entry),
+				treebuilder->alloc_pw);
+		if (entries == NULL)
+			return HUBBUB_NOMEM;
+
+		ctx->formatting_entries = entries;
+		ctx->formatting_alloc = entries_alloc;
+	}
+
+	clear_context(treebuilder);
+
+	stack = ctx->element_stack;
+	stack_alloc = ctx->stack_alloc;
+	entries = ctx->formatting_entries;
+	entries_alloc = ctx->formatting_alloc;
+	enable_scripting = ctx->enable_scripting;
+
+	*ctx = *from;
+
+	ctx->element_stack = stack;
+	ctx->stack_alloc = stack_alloc;
+	ctx->formatting_entries = entries;
+	ctx->formatting_alloc = entries_alloc;
+	ctx->enable_scripting = enable_scripting;
+
+	memcpy(stack, from->element_stack,
+			from->stack_alloc * sizeof(element_context));
+	if (from->formatting_alloc != 0) {
+		memcpy(entries, from->formatting_entries,
+				from->formatting_alloc *
+					sizeof(formatting_list_entry));
+	}
+
+	checkpoint_ref_nodes(treebuilder->tree_handler, ctx, true);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Destroy a recorded treebuilder state
+ *
+ * \param checkpoint  The state to destroy
+ */
+void hubbub_treebuilder_snapshot_destroy(
+		hubbub_treebuilder_snapshot *checkpoint)
+{
+	if (checkpoint == NULL)
+		return;
+
+	checkpoint_ref_nodes(checkpoint->tree_handler, &checkpoint->context,
+			false);
+
+	checkpoint->alloc(checkpoint, 0, checkpoint->alloc_pw);
+}
+
+/**
+ * Read the deepest nesting of elements seen
+ *
+ * This is the most elements open at once in any document parsed since the
+ * treebuilder was created; it is not cleared when the treebuilder is reset.
+ *
+ * \param treebuilder  The treebuilder instance to query
+ * \return Most elements open at once
+ */
+uint32_t hubbub_treebuilder_read_max_depth(hubbub_treebuilder *treebuilder)
+{
+	assert(treebuilder != NULL);
+
+	return max(treebuilder->stack_high,
+			treebuilder->context.stack_high);
+}
+
+/**
+ * Read the memory held in the treebuilder's libparserutils buffer
+ *
+ * \param treebuilder  The treebuilder instance to query
+ * \return Bytes allocated for joining the pieces of comments
+ */
+size_t hubbub_treebuilder_read_buffer_memory(
+		hubbub_treebuilder *treebuilder)
+{
+	assert(treebuilder != NULL);
+
+	return treebuilder->comment_buf != NULL ?
+			treebuilder->comment_buf->allocated : 0;
+}
+
+/**
+ * Read the adoption agency counts for the current document
+ *
+ * The counts are cleared when the treebuilder is reset.
+ *
+ * \param treebuilder  The treebuilder instance to query
+ * \param counts       Pointer to location to receive counts
+ * \return HUBBUB_OK on success, appropriate error otherwise.
+ */
+hubbub_error hubbub_treebuilder_read_aa_counts(
+		hubbub_treebuilder *treebuilder, hubbub_aa_counts *counts)
+{
+	if (treebuilder == NULL || counts == NULL)
+		return HUBBUB_BADPARM;
+
+	*counts = treebuilder->context.aa_counts;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Read the work a treebuilder has done on the current document
+ *
+ * This fills in the tree building counts in \p stats, leaving its other
+ * members untouched. The tree handler calls are only filled in if they
+ * are being counted (see HUBBUB_TREEBUILDER_COUNT_CALLS).
+ *
+ * \param treebuilder  The treebuilder instance to query
+ * \param stats        Pointer to statistics to fill in
+ */
+void hubbub_treebuilder_read_stats(hubbub_treebuilder *treebuilder,
+		hubbub_parser_stats *stats)
+{
+	hubbub_treebuilder_context *ctx;
+
+	assert(treebuilder != NULL);
+	assert(stats != NULL);
+
+	ctx = &treebuilder->context;
+
+	stats->max_depth = ctx->stack_high;
+	/* Entries are reused once free, and entry 0 is never handed out */
+	stats->formatting_high = ctx->formatting_used > 0 ?
+			ctx->formatting_used - 1 : 0;
+	stats->aa = ctx->aa_counts;
+	stats->reprocessed = ctx->reprocessed;
+
+	stats->tree_ns = ctx->tree_ns;
+	memcpy(stats->mode_ns, ctx->mode_ns, sizeof(stats->mode_ns));
+
+	if (treebuilder->count_calls) {
+		memcpy(stats->tree_calls, treebuilder->tally->calls,
+				sizeof(stats->tree_calls));
+	}
+}
+
+/**
+ * Put a tally in front of the tree handler, or remove it, as needed
+ *
+ * The calls pass through a tally while they are to be counted, traced or
+ * timed.
+ *
+ * \param treebuilder  The treebuilder instance
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ */
+hubbub_error update_tally(hubbub_treebuilder *treebuilder)
+{
+	hubbub_tree_tally *tally = treebuilder->tally;
+	bool count = treebuilder->count_calls ||
+			treebuilder->trace_handler != NULL ||
+			treebuilder->measure_time;
+
+	if (count && tally == NULL) {
+		tally = treebuilder->alloc(NULL, sizeof(hubbub_tree_tally),
+				treebuilder->alloc_pw);
+		if (tally == NULL)
+			return HUBBUB_NOMEM;
+
+		hubbub_tree_tally_init(tally, treebuilder->tree_handler);
+		tally->treebuilder = treebuilder;
+		memset(tally->calls, 0, sizeof(tally->calls));
+
+		if (treebuilder->tree_handler != NULL)
+			treebuilder->tree_handler = &tally->handler;
+
+		treebuilder->tally = tally;
+	} else if (count == false && tally != NULL) {
+		treebuilder->tree_handler = tally->client;
+
+		treebuilder->alloc(tally, 0, treebuilder->alloc_pw);
+		treebuilder->tally = NULL;
+	}
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Read the name of an insertion mode
+ *
+ * \param mode  Insertion mode, as numbered in trace events and statistics
+ * \return Name of the mode (constant), or NULL if there is no such mode
+ */
+const char *hubbub_treebuilder_mode_name(uint32_t mode)
+{
+	if (mode >= N_ELEMENTS(mode_names))
+		return NULL;
+
+	return mode_names[mode];
+}
+
+/**
+ * Read the charset last requested by the document
+ *
+ * This is the charset most recently passed to the client's encoding change
+ * handler, as a result of a meta element in the document head.
+ *
+ * \param treebuilder  The treebuilder instance to query
+ * \return Pointer to charset name (constant; do not free), or NULL if the
+ *         document has requested none
+ */
+const char *hubbub_treebuilder_read_requested_charset(
+		hubbub_treebuilder *treebuilder)
+{
+	if (treebuilder == NULL)
+		return NULL;
+
+	return treebuilder->context.requested_charset;
+}
+
+/**
+ * Read the names of the attributes the treebuilder reads itself
+ *
+ * An attribute filter must pass these, for the tree to be built as it
+ * otherwise would be: the names are those of the attributes of an isindex
+ * element which make up its form, those of a meta element which give the
+ * charset, the type of an input element, which may keep it inside a
+ * table, and those which end foreign content at a font element.
+ *
+ * \param n_names  Pointer to location to receive number of names
+ * \return Pointer to names (constant; do not free)
+ */
+const char *const *hubbub_treebuilder_read_attribute_names(uint32_t *n_names)
+{
+	static const char *const names[] = {
+		"action", "prompt",
+		"charset", "content",
+		"type",
+		"color", "face", "size"
+	};
+
+	*n_names = N_ELEMENTS(names);
+
+	return names;
+}
+
 /**
  * Handle tokeniser emitting a token
  *
@@ -204,99 +929,112 @@ hubbub_error hubbub_treebuilder_token_handler(const hubbub_token *token,
 {
 	hubbub_treebuilder *treebuilder = (hubbub_treebuilder *) pw;
 	hubbub_error err = HUBBUB_REPROCESS;
+	hubbub_token whole;
 
 	/* Do nothing if we have no document node or there's no tree handler */
 	if (treebuilder->context.document == NULL ||
 			treebuilder->tree_handler == NULL)
 		return HUBBUB_OK;
 
-	assert((signed) treebuilder->context.current_node >= 0);
+	/* A long comment may arrive in pieces; build one node from them */
+	if (token->type == HUBBUB_TOKEN_COMMENT) {
+		err = collect_comment(treebuilder, token, &whole);
+		if (err != HUBBUB_REPROCESS)
+			return err;
 
-/* A slightly nasty debugging hook, but very useful */
-#ifdef NDEBUG
-# define mode(x) \
-		case x:
-#else
-# define mode(x) \
-		case x: \
-			printf( #x "\n");
-#endif
+		token = &whole;
+	}
+
+	assert((signed) treebuilder->context.current_node >= 0);
 
 	while (err == HUBBUB_REPROCESS) {
-		switch (treebuilder->context.mode) {
-		mode(INITIAL)
-			err = handle_initial(treebuilder, token);
-			break;
-		mode(BEFORE_HTML)
-			err = handle_before_html(treebuilder, token);
-			break;
-		mode(BEFORE_HEAD)
-			err = handle_before_head(treebuilder, token);
-			break;
-		mode(IN_HEAD)
-			err = handle_in_head(treebuilder, token);
-			break;
-		mode(IN_HEAD_NOSCRIPT)
-			err = handle_in_head_noscript(treebuilder, token);
-			break;
-		mode(AFTER_HEAD)
-			err = handle_after_head(treebuilder, token);
-			break;
-		mode(IN_BODY)
-			err = handle_in_body(treebuilder, token);
-			break;
-		mode(IN_TABLE)
-			err = handle_in_table(treebuilder, token);
-			break;
-		mode(IN_CAPTION)
-			err = handle_in_caption(treebuilder, token);
-			break;
-		mode(IN_COLUMN_GROUP)
-			err = handle_in_column_group(treebuilder, token);
-			break;
-		mode(IN_TABLE_BODY)
-			err = handle_in_table_body(treebuilder, token);
-			break;
-		mode(IN_ROW)
-			err = handle_in_row(treebuilder, token);
-			break;
-		mode(IN_CELL)
-			err = handle_in_cell(treebuilder, token);
-			break;
-		mode(IN_SELECT)
-			err = handle_in_select(treebuilder, token);
-			break;
-		mode(IN_SELECT_IN_TABLE)
-			err = handle_in_select_in_table(treebuilder, token);
-			break;
-		mode(IN_FOREIGN_CONTENT)
-			err = handle_in_foreign_content(treebuilder, token);
-			break;
-		mode(AFTER_BODY)
-			err = handle_after_body(treebuilder, token);
-			break;
-		mode(IN_FRAMESET)
-			err = handle_in_frameset(treebuilder, token);
-			break;
-		mode(AFTER_FRAMESET)
-			err = handle_after_frameset(treebuilder, token);
-			break;
-		mode(AFTER_AFTER_BODY)
-			err = handle_after_after_body(treebuilder, token);
-			break;
-		mode(AFTER_AFTER_FRAMESET)
-			err = handle_after_after_frameset(treebuilder, token);
-			break;
-		mode(GENERIC_RCDATA)
-			err = handle_generic_rcdata(treebuilder, token);
+		insertion_mode mode = treebuilder->context.mode;
+
+		assert(mode < N_ELEMENTS(mode_handlers));
+
+		/* Every mode from IN_BODY on lies beyond the head, but
+		 * GENERIC_RCDATA may be entered from within it */
+		if (treebuilder->stop_at_body && mode >= IN_BODY &&
+				mode != GENERIC_RCDATA) {
+			err = HUBBUB_STOPPED;
 			break;
 		}
+
+		if (treebuilder->trace_handler != NULL) {
+			treebuilder_trace(treebuilder, HUBBUB_TRACE_MODE,
+					mode, mode_names[mode]);
+		}
+
+		if (treebuilder->measure_time)
+			err = handle_token_timed(treebuilder, mode, token);
+		else
+			err = mode_handlers[mode](treebuilder, token);
+		if (err == HUBBUB_REPROCESS)
+			treebuilder->context.reprocessed++;
+	}
+
+	/* Nothing holds a pointer into the stack between tokens */
+	element_stack_trim(treebuilder);
+
+	/* Nor into the comment, once its node exists */
+	if (token == &whole && treebuilder->comment_buf != NULL) {
+		parserutils_buffer_discard(treebuilder->comment_buf, 0,
+				treebuilder->comment_buf->length);
 	}
 
 	return err;
 }
 
 
+/**
+ * Gather the pieces of a comment which the tokeniser emits incrementally
+ *
+ * The tree handler creates a comment in one call, so the pieces are held
+ * until the comment ends, however long it is. Only the memory limit, which
+ * counts this buffer, bounds them.
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param token        The comment token
+ * \param whole        Pointer to location to receive the complete comment
+ * \return HUBBUB_REPROCESS if \a whole should be processed,
+ *         HUBBUB_OK if more of the comment is to come,
+ *         appropriate error otherwise
+ */
+static hubbub_error collect_comment(hubbub_treebuilder *treebuilder,
+		const hubbub_token *token, hubbub_token *whole)
+{
+	parserutils_buffer *buf = treebuilder->comment_buf;
+	parserutils_error perror;
+
+	*whole = *token;
+
+	/* The common case: a comment in one piece */
+	if (hubbub_tokeniser_in_comment(treebuilder->tokeniser) == false &&
+			(buf == NULL || buf->length == 0))
+		return HUBBUB_REPROCESS;
+
+	if (buf == NULL) {
+		perror = parserutils_buffer_create(&treebuilder->comment_buf);
+		if (perror != PARSERUTILS_OK)
+			return hubbub_error_from_parserutils_error(perror);
+
+		buf = treebuilder->comment_buf;
+	}
+
+	perror = parserutils_buffer_append(buf, token->data.comment.ptr,
+			token->data.comment.len);
+	if (perror != PARSERUTILS_OK)
+		return hubbub_error_from_parserutils_error(perror);
+
+	if (hubbub_tokeniser_in_comment(treebuilder->tokeniser))
+		return HUBBUB_OK;
+
+	whole->data.comment.ptr = buf->data;
+	whole->data.comment.len = buf->length;
+
+	return HUBBUB_REPROCESS;
+}
+
 /**
  * Process a character token in cases where we expect only whitespace
  *
@@ -315,33 +1053,69 @@ hubbub_error process_characters_expect_whitespace(
 {
 	const uint8_t *data = token->data.character.ptr;
 	size_t len = token->data.character.len;
-	size_t c;
+	size_t c = hubbub_string_space_span(data, len);
 
-	for (c = 0; c < len; c++) {
-		if (data[c] != 0x09 && data[c] != 0x0A &&
-				data[c] != 0x0C && data[c] != 0x20)
-			break;
+	if (c > 0 && insert_into_current_node) {
+		hubbub_error error;
+		hubbub_string temp;
+
+		temp.ptr = data;
+		temp.len = c;
+
+		error = append_text(treebuilder, &temp);
+		if (error != HUBBUB_OK)
+			return error;
 	}
 
-	if (c > 0 && insert_into_current_node) {
+	/* Non-whitespace characters in token, so reprocess */
+	if (c != len) {
+		/* Update token data to strip leading whitespace */
+		((hubbub_token *) token)->data.character.ptr += c;
+		((hubbub_token *) token)->data.character.len -= c;
+
+		return HUBBUB_REPROCESS;
+	}
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Process a character token in cases where only whitespace is inserted
+ *
+ * Every run of whitespace in the token is inserted into the current node,
+ * and anything else is ignored, so that the result does not depend on
+ * where the tokeniser splits text between tokens.
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param token        The character token
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error process_characters_keep_whitespace(
+		hubbub_treebuilder *treebuilder, const hubbub_token *token)
+{
+	const uint8_t *data = token->data.character.ptr;
+	size_t len = token->data.character.len;
+	size_t off = 0;
+
+	while (off < len) {
 		hubbub_error error;
 		hubbub_string temp;
+		size_t c = hubbub_string_space_span(data + off, len - off);
 
-		temp.ptr = data;
+		if (c == 0) {
+			/** \todo parse error */
+			off++;
+			continue;
+		}
+
+		temp.ptr = data + off;
 		temp.len = c;
 
 		error = append_text(treebuilder, &temp);
 		if (error != HUBBUB_OK)
 			return error;
-	}
-
-	/* Non-whitespace characters in token, so reprocess */
-	if (c != len) {
-		/* Update token data to strip leading whitespace */
-		((hubbub_token *) token)->data.character.ptr += c;
-		((hubbub_token *) token)->data.character.len -= c;
 
-		return HUBBUB_REPROCESS;
+		off += c;
 	}
 
 	return HUBBUB_OK;
@@ -380,12 +1154,10 @@ hubbub_error process_comment_append(hubbub_treebuilder *treebuilder,
 	}
 
 	if (error == HUBBUB_OK) {
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx, appended);
+		treebuilder_unref_node(treebuilder, appended);
 	}
 
-	treebuilder->tree_handler->unref_node(
-			treebuilder->tree_handler->ctx, comment);
+	treebuilder_unref_node(treebuilder, comment);
 
 	return error;
 }
@@ -405,7 +1177,7 @@ hubbub_error parse_generic_rcdata(hubbub_treebuilder *treebuilder,
 	element_type type;
 	hubbub_tokeniser_optparams params;
 
-	type = element_type_from_name(treebuilder, &token->data.tag.name);
+	type = element_type_from_tag(treebuilder, &token->data.tag);
 
 	error = insert_element(treebuilder, &token->data.tag, true);
 	if (error != HUBBUB_OK)
@@ -444,6 +1216,10 @@ uint32_t element_in_scope(hubbub_treebuilder *treebuilder,
 
 	assert((signed) treebuilder->context.current_node >= 0);
 
+	/* Most of the time, no element of the type is open at all */
+	if (treebuilder->context.type_count[type] == 0)
+		return 0;
+
 	for (node = treebuilder->context.current_node; node > 0; node--) {
 		hubbub_ns node_ns =
 				treebuilder->context.element_stack[node].ns;
@@ -480,38 +1256,44 @@ uint32_t element_in_scope(hubbub_treebuilder *treebuilder,
 hubbub_error reconstruct_active_formatting_list(hubbub_treebuilder *treebuilder)
 {
 	hubbub_error error = HUBBUB_OK;
-	formatting_list_entry *entry, *initial_entry;
+	formatting_list_entry *list = treebuilder->context.formatting_entries;
+	formatting_list_entry *entry;
+	uint32_t index, initial_index;
 	uint32_t sp = treebuilder->context.current_node;
 
-	if (treebuilder->context.formatting_list == NULL)
+	if (treebuilder->context.formatting_list == 0)
 		return HUBBUB_OK;
 
-	entry = treebuilder->context.formatting_list_end;
+	index = treebuilder->context.formatting_list_end;
+	entry = &list[index];
 
 	/* Assumption: HTML and TABLE elements are not inserted into the list */
 	if (is_scoping_element(entry->details.type) || entry->stack_index != 0)
 		return HUBBUB_OK;
 
-	while (entry->prev != NULL) {
-		entry = entry->prev;
+	while (entry->prev != 0) {
+		index = entry->prev;
+		entry = &list[index];
 
 		if (is_scoping_element(entry->details.type) ||
 				entry->stack_index != 0) {
-			entry = entry->next;
+			index = entry->next;
 			break;
 		}
 	}
 
 	/* Save initial entry for later */
-	initial_entry = entry;
+	initial_index = index;
 
 	/* Process formatting list entries, cloning nodes and
 	 * inserting them into the DOM and element stack */
-	while (entry != NULL) {
+	for (; index != 0; index = list[index].next) {
 		void *clone, *appended;
 		bool foster;
 		element_type type = current_node(treebuilder);
 
+		entry = &list[index];
+
 		error = treebuilder->tree_handler->clone_node(
 				treebuilder->tree_handler->ctx,
 				entry->details.node,
@@ -531,16 +1313,13 @@ hubbub_error reconstruct_active_formatting_list(hubbub_treebuilder *treebuilder)
 		} else {
 			error = treebuilder->tree_handler->append_child(
 					treebuilder->tree_handler->ctx,
-					treebuilder->context.element_stack[
-					treebuilder->context.current_node].node,
+					insertion_parent(treebuilder),
 					clone,
 					&appended);
 		}
 
 		/* No longer interested in clone */
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,
-				clone);
+		treebuilder_unref_node(treebuilder, clone);
 
 		if (error != HUBBUB_OK)
 			goto cleanup;
@@ -550,30 +1329,26 @@ hubbub_error reconstruct_active_formatting_list(hubbub_treebuilder *treebuilder)
 		if (error != HUBBUB_OK) {
 			remove_node_from_dom(treebuilder, appended);
 
-			treebuilder->tree_handler->unref_node(
-					treebuilder->tree_handler->ctx,
-					appended);
+			treebuilder_unref_node(treebuilder, appended);
 
 			goto cleanup;
 		}
-
-		entry = entry->next;
 	}
 
 	/* Now, replace the formatting list entries */
-	for (entry = initial_entry; entry != NULL; entry = entry->next) {
+	for (index = initial_index; index != 0; index = list[index].next) {
 		void *node;
 		hubbub_ns prev_ns;
 		element_type prev_type;
 		void *prev_node;
 		uint32_t prev_stack_index;
 
+		entry = &list[index];
 		node = treebuilder->context.element_stack[++sp].node;
 
-		treebuilder->tree_handler->ref_node(
-				treebuilder->tree_handler->ctx, node);
+		treebuilder_ref_node(treebuilder, node);
 
-		error = formatting_list_replace(treebuilder, entry,
+		error = formatting_list_replace(treebuilder, index,
 				entry->details.ns, entry->details.type,
 				node, sp,
 				&prev_ns, &prev_type, &prev_node,
@@ -581,9 +1356,7 @@ hubbub_error reconstruct_active_formatting_list(hubbub_treebuilder *treebuilder)
 		/* Cannot fail. Ensure this. */
 		assert(error == HUBBUB_OK);
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,
-				prev_node);
+		treebuilder_unref_node(treebuilder, prev_node);
 	}
 
 	return HUBBUB_OK;
@@ -600,9 +1373,7 @@ cleanup:
 
 		remove_node_from_dom(treebuilder, node);
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,
-				node);
+		treebuilder_unref_node(treebuilder, node);
 	}
 
 	return error;
@@ -634,13 +1405,9 @@ hubbub_error remove_node_from_dom(hubbub_treebuilder *treebuilder, void *node)
 		if (err != HUBBUB_OK)
 			return err;
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,
-				parent);
+		treebuilder_unref_node(treebuilder, parent);
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,
-				removed);
+		treebuilder_unref_node(treebuilder, removed);
 	}
 
 	return HUBBUB_OK;
@@ -653,24 +1420,23 @@ hubbub_error remove_node_from_dom(hubbub_treebuilder *treebuilder, void *node)
  */
 void clear_active_formatting_list_to_marker(hubbub_treebuilder *treebuilder)
 {
-	formatting_list_entry *entry;
+	formatting_list_entry *list = treebuilder->context.formatting_entries;
+	uint32_t entry;
 	bool done = false;
 
-	while ((entry = treebuilder->context.formatting_list_end) != NULL) {
+	while ((entry = treebuilder->context.formatting_list_end) != 0) {
 		hubbub_ns ns;
 		element_type type;
 		void *node;
 		uint32_t stack_index;
 
-		if (is_scoping_element(entry->details.type))
+		if (is_scoping_element(list[entry].details.type))
 			done = true;
 
 		formatting_list_remove(treebuilder, entry,
 				&ns, &type, &node, &stack_index);
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,
-				node);
+		treebuilder_unref_node(treebuilder, node);
 
 		if (done)
 			break;
@@ -689,36 +1455,54 @@ void clear_active_formatting_list_to_marker(hubbub_treebuilder *treebuilder)
 hubbub_error insert_element(hubbub_treebuilder *treebuilder,
 		const hubbub_tag *tag, bool push)
 {
-	element_type type = current_node(treebuilder);
 	hubbub_error error;
-	void *node, *appended;
+	void *node;
 
 	error = treebuilder->tree_handler->create_element(
 			treebuilder->tree_handler->ctx, tag, &node);
 	if (error != HUBBUB_OK)
 		return error;
 
+	return insert_created_element(treebuilder, tag->ns,
+			element_type_from_tag(treebuilder, tag), node, push);
+}
+
+/**
+ * Insert an element which has already been created into the DOM,
+ * potentially pushing it on the stack
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param ns           Namespace of the element
+ * \param type         Type of the element
+ * \param node         The element, whose reference is given up
+ * \param push         Whether to push the element onto the stack
+ * \return HUBBUB_OK on success, appropriate error otherwise.
+ */
+hubbub_error insert_created_element(hubbub_treebuilder *treebuilder,
+		hubbub_ns ns, element_type type, void *node, bool push)
+{
+	element_type cur = current_node(treebuilder);
+	hubbub_error error;
+	void *appended;
+
 	if (treebuilder->context.in_table_foster &&
-			(type == TABLE || type == TBODY || type == TFOOT ||
-			type == THEAD || type == TR)) {
+			(cur == TABLE || cur == TBODY || cur == TFOOT ||
+			cur == THEAD || cur == TR)) {
 		error = aa_insert_into_foster_parent(treebuilder, node,
 				&appended);
 	} else {
 		error = treebuilder->tree_handler->append_child(
 				treebuilder->tree_handler->ctx,
-				treebuilder->context.element_stack[
-					treebuilder->context.current_node].node,
+				insertion_parent(treebuilder),
 				node, &appended);
 	}
 
 	/* No longer interested in node */
-	treebuilder->tree_handler->unref_node(
-			treebuilder->tree_handler->ctx, node);
+	treebuilder_unref_node(treebuilder, node);
 
 	if (error != HUBBUB_OK)
 		return error;
 
-	type = element_type_from_name(treebuilder, &tag->name);
 	if (treebuilder->context.form_element != NULL &&
 			is_form_associated(type)) {
 		/* Consideration of @form is left to the client */
@@ -729,28 +1513,22 @@ hubbub_error insert_element(hubbub_treebuilder *treebuilder,
 		if (error != HUBBUB_OK) {
 			remove_node_from_dom(treebuilder, appended);
 
-			treebuilder->tree_handler->unref_node(
-					treebuilder->tree_handler->ctx,
-					appended);
+			treebuilder_unref_node(treebuilder, appended);
 
 			return error;
 		}
 	}
 
 	if (push) {
-		error = element_stack_push(treebuilder,
-				tag->ns, type, appended);
+		error = element_stack_push(treebuilder, ns, type, appended);
 		if (error != HUBBUB_OK) {
 			remove_node_from_dom(treebuilder, appended);
 
-			treebuilder->tree_handler->unref_node(
-					treebuilder->tree_handler->ctx,
-					appended);
+			treebuilder_unref_node(treebuilder, appended);
 			return error;
 		}
 	} else {
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx, appended);
+		treebuilder_unref_node(treebuilder, appended);
 	}
 
 	return HUBBUB_OK;
@@ -783,9 +1561,7 @@ void close_implied_end_tags(hubbub_treebuilder *treebuilder,
 
 		element_stack_pop(treebuilder, &ns, &otype, &node);
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,
-				node);
+		treebuilder_unref_node(treebuilder, node);
 
 		type = treebuilder->context.element_stack[
 				treebuilder->context.current_node].type;
@@ -795,28 +1571,40 @@ void close_implied_end_tags(hubbub_treebuilder *treebuilder,
 /**
  * Reset the insertion mode
  *
+ * When a fragment is parsed, the root of the stack stands for the context
+ * element, which decides the mode if no element above it does.
+ *
  * \param treebuilder  The treebuilder to reset
  */
 void reset_insertion_mode(hubbub_treebuilder *treebuilder)
 {
 	uint32_t node;
 	element_context *stack = treebuilder->context.element_stack;
+	bool fragment = treebuilder->context.fragment.active;
 
-	/** \todo fragment parsing algorithm */
+	for (node = treebuilder->context.current_node;
+			node > 0 || fragment; node--) {
+		bool last = (node == 0);
+		element_type type = last ? treebuilder->context.fragment.type :
+				stack[node].type;
 
-	for (node = treebuilder->context.current_node; node > 0; node--) {
-		if (stack[node].ns != HUBBUB_NS_HTML) {
+		if (last == false && stack[node].ns != HUBBUB_NS_HTML) {
 			treebuilder->context.mode = IN_FOREIGN_CONTENT;
 			treebuilder->context.second_mode = IN_BODY;
 			break;
 		}
 
-		switch (stack[node].type) {
+		switch (type) {
 		case SELECT:
-			/* fragment case */
+			if (last) {
+				treebuilder->context.mode = IN_SELECT;
+				return;
+			}
 			break;
 		case TD:
 		case TH:
+			if (last)
+				break;
 			treebuilder->context.mode = IN_CELL;
 			return;
 		case TR:
@@ -831,29 +1619,95 @@ void reset_insertion_mode(hubbub_treebuilder *treebuilder)
 			treebuilder->context.mode = IN_CAPTION;
 			return;
 		case COLGROUP:
-			/* fragment case */
+			if (last) {
+				treebuilder->context.mode = IN_COLUMN_GROUP;
+				return;
+			}
 			break;
 		case TABLE:
 			treebuilder->context.mode = IN_TABLE;
 			return;
 		case HEAD:
-			/* fragment case */
+			/* As the context, this is treated as the body */
 			break;
 		case BODY:
 			treebuilder->context.mode = IN_BODY;
 			return;
 		case FRAMESET:
-			/* fragment case */
+			if (last) {
+				treebuilder->context.mode = IN_FRAMESET;
+				return;
+			}
 			break;
 		case HTML:
-			/* fragment case */
+			if (last) {
+				void *head = treebuilder->context.head_element;
+
+				treebuilder->context.mode = head == NULL ?
+						BEFORE_HEAD : AFTER_HEAD;
+				return;
+			}
 			break;
 		default:
 			break;
 		}
+
+		if (last) {
+			treebuilder->context.mode = IN_BODY;
+			return;
+		}
 	}
 }
 
+/**
+ * Handle a token in an insertion mode, timing how long this takes
+ *
+ * Time spent in tree handler callbacks is counted by the tally, which
+ * these are made through, rather than against the mode.
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param mode         The insertion mode
+ * \param token        The token to handle
+ * \return As for the mode's handler
+ */
+hubbub_error handle_token_timed(hubbub_treebuilder *treebuilder,
+		insertion_mode mode, const hubbub_token *token)
+{
+	hubbub_treebuilder_context *ctx = &treebuilder->context;
+	uint64_t tree_ns = ctx->tree_ns;
+	uint64_t start = hubbub_clock_ns();
+	hubbub_error err;
+
+	err = mode_handlers[mode](treebuilder, token);
+
+	ctx->mode_ns[mode] += hubbub_clock_ns() - start -
+			(ctx->tree_ns - tree_ns);
+
+	return err;
+}
+
+/**
+ * Pass an event to the trace handler
+ *
+ * \param treebuilder  The treebuilder instance, which has a trace handler
+ * \param type         Type of event
+ * \param value        Insertion mode or tree handler call
+ * \param name         Name of \p value
+ */
+void treebuilder_trace(hubbub_treebuilder *treebuilder,
+		hubbub_trace_type type, uint32_t value, const char *name)
+{
+	hubbub_trace_event event;
+
+	event.type = type;
+	event.value = value;
+	event.name = name;
+	event.offset = hubbub_tokeniser_read_token_end(
+			treebuilder->tokeniser);
+
+	treebuilder->trace_handler(&event, treebuilder->trace_pw);
+}
+
 /**
  * Script processing and execution
  *
@@ -867,6 +1721,10 @@ hubbub_error complete_script(hubbub_treebuilder *treebuilder)
 		treebuilder->tree_handler->ctx,
 		treebuilder->context.element_stack[
 			treebuilder->context.current_node].node);
+
+	/* The script may have moved the current table */
+	forget_foster_parent(treebuilder);
+
 	return error;
 }
 
@@ -882,17 +1740,32 @@ hubbub_error append_text(hubbub_treebuilder *treebuilder,
 		const hubbub_string *string)
 {
 	element_type type = current_node(treebuilder);
+	bool foster = treebuilder->context.in_table_foster &&
+			(type == TABLE || type == TBODY || type == TFOOT ||
+			type == THEAD || type == TR);
 	hubbub_error error = HUBBUB_OK;
 	void *text, *appended;
 
+	/* Extend any text which ends the current node in place, rather
+	 * than have the client create a node only to merge it away */
+	if (!foster && treebuilder->tree_handler->append_text_to != NULL) {
+		bool done = false;
+
+		error = treebuilder->tree_handler->append_text_to(
+				treebuilder->tree_handler->ctx,
+				treebuilder->context.element_stack[
+				treebuilder->context.current_node].node,
+				string, &done);
+		if (error != HUBBUB_OK || done)
+			return error;
+	}
+
 	error = treebuilder->tree_handler->create_text(
 			treebuilder->tree_handler->ctx, string, &text);
 	if (error != HUBBUB_OK)
 		return error;
 
-	if (treebuilder->context.in_table_foster &&
-			(type == TABLE || type == TBODY || type == TFOOT ||
-			type == THEAD || type == TR)) {
+	if (foster) {
 		error = aa_insert_into_foster_parent(treebuilder, text,
 				&appended);
 	} else {
@@ -904,12 +1777,10 @@ hubbub_error append_text(hubbub_treebuilder *treebuilder,
 	}
 
 	if (error == HUBBUB_OK) {
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx, appended);
+		treebuilder_unref_node(treebuilder, appended);
 	}
 
-	treebuilder->tree_handler->unref_node(
-			treebuilder->tree_handler->ctx, text);
+	treebuilder_unref_node(treebuilder, text);
 
 	return error;
 }
@@ -971,6 +1842,48 @@ bool is_form_associated(element_type type)
 			type == OUTPUT;
 }
 
+/**
+ * Create the root element of the tree, and make it the root of the stack
+ *
+ * insert_element() cannot be used, as it inserts into the current node, of
+ * which there is none yet; the element is appended to the document node.
+ * Nor can element_stack_push(), as current_node does not point at the slot
+ * before that of the root.
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param tag          The tag of the html element
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error insert_root_element(hubbub_treebuilder *treebuilder,
+		const hubbub_tag *tag)
+{
+	hubbub_error error;
+	void *html, *appended;
+
+	error = treebuilder->tree_handler->create_element(
+			treebuilder->tree_handler->ctx, tag, &html);
+	if (error != HUBBUB_OK)
+		return error;
+
+	error = treebuilder->tree_handler->append_child(
+			treebuilder->tree_handler->ctx,
+			treebuilder->context.document,
+			html, &appended);
+
+	treebuilder_unref_node(treebuilder, html);
+
+	if (error != HUBBUB_OK)
+		return error;
+
+	treebuilder->context.element_stack[0].ns = HUBBUB_NS_HTML;
+	treebuilder->context.element_stack[0].type = HTML;
+	treebuilder->context.element_stack[0].node = appended;
+	treebuilder->context.element_stack[0].tainted = false;
+	treebuilder->context.current_node = 0;
+
+	return HUBBUB_OK;
+}
+
 /**
  * Push an element onto the stack of open elements
  *
@@ -986,11 +1899,12 @@ hubbub_error element_stack_push(hubbub_treebuilder *treebuilder,
 	uint32_t slot = treebuilder->context.current_node + 1;
 
 	if (slot >= treebuilder->context.stack_alloc) {
-		element_context *temp = realloc(
+		element_context *temp = treebuilder->alloc(
 				treebuilder->context.element_stack,
 				(treebuilder->context.stack_alloc +
 					ELEMENT_STACK_CHUNK) *
-					sizeof(element_context));
+					sizeof(element_context),
+				treebuilder->alloc_pw);
 
 		if (temp == NULL)
 			return HUBBUB_NOMEM;
@@ -999,15 +1913,112 @@ hubbub_error element_stack_push(hubbub_treebuilder *treebuilder,
 		treebuilder->context.stack_alloc += ELEMENT_STACK_CHUNK;
 	}
 
+	if (slot >= treebuilder->context.stack_high)
+		treebuilder->context.stack_high = slot + 1;
+
 	treebuilder->context.element_stack[slot].ns = ns;
 	treebuilder->context.element_stack[slot].type = type;
 	treebuilder->context.element_stack[slot].node = node;
 
+	treebuilder->context.type_count[type]++;
 	treebuilder->context.current_node = slot;
 
+	if (type == TABLE)
+		set_current_table(treebuilder, slot);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Find the node into which a new element is inserted
+ *
+ * Normally this is the current node. Past the maximum depth, new elements
+ * are instead appended to the element at that depth, as siblings of one
+ * another, as browsers do. They are still pushed onto the stack, so end
+ * tags continue to match their start tags.
+ *
+ * \param treebuilder  The treebuilder instance
+ * \return Node to insert into
+ */
+void *insertion_parent(hubbub_treebuilder *treebuilder)
+{
+	uint32_t depth = treebuilder->context.current_node;
+
+	if (treebuilder->max_depth != 0 && depth > treebuilder->max_depth)
+		depth = treebuilder->max_depth;
+
+	return treebuilder->context.element_stack[depth].node;
+}
+
+/**
+ * Make room on the stack of open elements ahead of need
+ *
+ * The room is kept when the stack is trimmed, so that a parser reused for
+ * many documents need not grow its stack again for each.
+ *
+ * \param treebuilder  The treebuilder instance containing the stack
+ * \param depth        Open elements to make room for
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error element_stack_reserve(hubbub_treebuilder *treebuilder,
+		uint32_t depth)
+{
+	uint32_t alloc = depth + ELEMENT_STACK_CHUNK - 1;
+	element_context *temp;
+
+	/* Each open element, the root included, takes one slot */
+	alloc -= alloc % ELEMENT_STACK_CHUNK;
+	treebuilder->stack_reserve = alloc;
+
+	if (alloc <= treebuilder->context.stack_alloc)
+		return HUBBUB_OK;
+
+	temp = treebuilder->alloc(treebuilder->context.element_stack,
+			alloc * sizeof(element_context),
+			treebuilder->alloc_pw);
+	if (temp == NULL)
+		return HUBBUB_NOMEM;
+
+	treebuilder->context.element_stack = temp;
+	treebuilder->context.stack_alloc = alloc;
+
 	return HUBBUB_OK;
 }
 
+/**
+ * Release unused space at the top of the stack of open elements
+ *
+ * At least one chunk more than is in use is kept, so that a document
+ * which repeatedly opens and closes elements around a chunk boundary does
+ * not reallocate the stack each time, as is any room reserved.
+ *
+ * \param treebuilder  The treebuilder instance containing the stack
+ */
+void element_stack_trim(hubbub_treebuilder *treebuilder)
+{
+	uint32_t used = treebuilder->context.current_node + 1;
+	uint32_t alloc;
+	element_context *temp;
+
+	alloc = used + 2 * ELEMENT_STACK_CHUNK;
+	alloc -= alloc % ELEMENT_STACK_CHUNK;
+	alloc = max(alloc, treebuilder->stack_reserve);
+
+	if (treebuilder->context.stack_alloc <= alloc)
+		return;
+
+	temp = treebuilder->alloc(treebuilder->context.element_stack,
+			alloc * sizeof(element_context),
+			treebuilder->alloc_pw);
+
+	/* Failing to shrink is harmless; keep the larger stack */
+	if (temp == NULL)
+		return;
+
+	treebuilder->context.element_stack = temp;
+	treebuilder->context.stack_alloc = alloc;
+}
+
 /**
  * Pop an element off the stack of open elements
  *
@@ -1022,16 +2033,8 @@ hubbub_error element_stack_pop(hubbub_treebuilder *treebuilder,
 {
 	element_context *stack = treebuilder->context.element_stack;
 	uint32_t slot = treebuilder->context.current_node;
-	formatting_list_entry *entry;
-
-	/* We're popping a table, find previous */
-	if (stack[slot].type == TABLE) {
-		uint32_t t;
-		for (t = slot - 1; t > 0; t--) {
-			if (stack[t].type == TABLE)
-				break;
-		}
-	}
+	formatting_list_entry *list = treebuilder->context.formatting_entries;
+	uint32_t entry;
 
 	if (is_formatting_element(stack[slot].type) ||
 			(is_scoping_element(stack[slot].type) &&
@@ -1041,11 +2044,11 @@ hubbub_error element_stack_pop(hubbub_treebuilder *treebuilder,
 		 * of active formatting elements. We need to invalidate their
 		 * stack index information. */
 		for (entry = treebuilder->context.formatting_list_end;
-				entry != NULL; entry = entry->prev) {
+				entry != 0; entry = list[entry].prev) {
 			/** \todo Can we optimise this?
 			 * (i.e. by not traversing the entire list) */
-			if (entry->stack_index == slot)
-				entry->stack_index = 0;
+			if (list[entry].stack_index == slot)
+				list[entry].stack_index = 0;
 		}
 	}
 
@@ -1053,7 +2056,14 @@ hubbub_error element_stack_pop(hubbub_treebuilder *treebuilder,
 	*type = stack[slot].type;
 	*node = stack[slot].node;
 
-	/** \todo reduce allocated stack size once there's enough free */
+	treebuilder->context.type_count[stack[slot].type]--;
+
+	/* We're popping a table, find previous */
+	if (stack[slot].type == TABLE)
+		set_current_table(treebuilder, find_table(treebuilder, slot));
+
+	/* Callers may hold pointers into the stack while popping, so it
+	 * is only shrunk between tokens, by element_stack_trim() */
 
 	treebuilder->context.current_node = slot - 1;
 	assert((signed) treebuilder->context.current_node >= 0);
@@ -1076,8 +2086,7 @@ hubbub_error element_stack_pop_until(hubbub_treebuilder *treebuilder,
 	while (otype != type) {
 		element_stack_pop(treebuilder, &ns, &otype, &node);
 
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx, node);
+		treebuilder_unref_node(treebuilder, node);
 
 		assert((signed) treebuilder->context.current_node >= 0);
 	}
@@ -1114,12 +2123,14 @@ hubbub_error element_stack_remove(hubbub_treebuilder *treebuilder,
 				(is_scoping_element(stack[n].type) &&
 				stack[n].type != HTML &&
 				stack[n].type != TABLE)) {
-			formatting_list_entry *e;
+			formatting_list_entry *list =
+				treebuilder->context.formatting_entries;
+			uint32_t e;
 
 			for (e = treebuilder->context.formatting_list_end;
-					e != NULL; e = e->prev) {
-				if (e->stack_index == n)
-					e->stack_index--;
+					e != 0; e = list[e].prev) {
+				if (list[e].stack_index == n)
+					list[e].stack_index--;
 			}
 		}
 	}
@@ -1128,6 +2139,8 @@ hubbub_error element_stack_remove(hubbub_treebuilder *treebuilder,
 	*type = stack[index].type;
 	*removed = stack[index].node;
 
+	treebuilder->context.type_count[stack[index].type]--;
+
 	/* Now, shuffle the stack up one, removing node in the process */
 	if (index < treebuilder->context.current_node) {
 		memmove(&stack[index], &stack[index + 1],
@@ -1135,28 +2148,105 @@ hubbub_error element_stack_remove(hubbub_treebuilder *treebuilder,
 				sizeof(element_context));
 	}
 
+	element_stack_removed(treebuilder, index,
+			treebuilder->context.current_node);
+
 	treebuilder->context.current_node--;
 
 	return HUBBUB_OK;
 }
 
 /**
- * Find the stack index of the current table.
+ * Find the highest table in the stack below a given index
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param index        Index to search below
+ * \return Index of the table, or 0 if there is none (the fragment case)
  */
-uint32_t current_table(hubbub_treebuilder *treebuilder)
+uint32_t find_table(hubbub_treebuilder *treebuilder, uint32_t index)
 {
 	element_context *stack = treebuilder->context.element_stack;
-	size_t t;
+	uint32_t t;
+
+	/* The root of the stack is never counted, nor ever a table */
+	if (treebuilder->context.type_count[TABLE] == 0)
+		return 0;
 
-	for (t = treebuilder->context.current_node; t != 0; t--) {
+	for (t = index - 1; t > 0; t--) {
 		if (stack[t].type == TABLE)
 			return t;
 	}
 
-	/* fragment case */
 	return 0;
 }
 
+/**
+ * Record the index of the current table
+ *
+ * The foster parent found for the table at the old index is forgotten, as
+ * it may not be the foster parent of that at the new one.
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param table        Index of the current table, or 0 if none is open
+ */
+void set_current_table(hubbub_treebuilder *treebuilder, uint32_t table)
+{
+	if (table == treebuilder->context.current_table)
+		return;
+
+	treebuilder->context.current_table = table;
+
+	forget_foster_parent(treebuilder);
+}
+
+/**
+ * Update the index of the current table when removing a stack entry
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param index        Index of the entry removed
+ * \param limit        Index of the last entry moved into the gap left
+ *
+ * Each entry from index + 1 to limit was moved down one place.
+ */
+void element_stack_removed(hubbub_treebuilder *treebuilder,
+		uint32_t index, uint32_t limit)
+{
+	uint32_t table = treebuilder->context.current_table;
+
+	if (table == index) {
+		set_current_table(treebuilder,
+				find_table(treebuilder, index));
+	} else if (index < table && table <= limit) {
+		set_current_table(treebuilder, table - 1);
+	}
+}
+
+/**
+ * Find the stack index of the current table.
+ */
+uint32_t current_table(hubbub_treebuilder *treebuilder)
+{
+	return treebuilder->context.current_table;
+}
+
+/**
+ * Forget the foster parent of the current table
+ *
+ * This is done whenever the table's parent may have changed: when another
+ * table becomes current, when the adoption agency moves nodes about, and
+ * when a script, which may alter the tree, has run.
+ *
+ * \param treebuilder  The treebuilder instance
+ */
+void forget_foster_parent(hubbub_treebuilder *treebuilder)
+{
+	if (treebuilder->context.foster.node == NULL)
+		return;
+
+	treebuilder_unref_node(treebuilder, treebuilder->context.foster.node);
+	treebuilder->context.foster.node = NULL;
+}
+
 /**
  * Peek at the top element of the element stack.
  *
@@ -1186,6 +2276,50 @@ element_type prev_node(hubbub_treebuilder *treebuilder)
 
 
 
+/**
+ * Obtain an unused entry for the list of active formatting elements
+ *
+ * The entry storage may move, so pointers to entries are invalidated.
+ *
+ * \param treebuilder  Treebuilder instance containing list
+ * \param index        Pointer to location to receive index of entry
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ */
+static hubbub_error formatting_list_new_entry(hubbub_treebuilder *treebuilder,
+		uint32_t *index)
+{
+	hubbub_treebuilder_context *ctx = &treebuilder->context;
+
+	if (ctx->formatting_free != 0) {
+		*index = ctx->formatting_free;
+		ctx->formatting_free = ctx->formatting_entries[*index].next;
+		return HUBBUB_OK;
+	}
+
+	/* Entry 0 is never handed out, so that 0 can mean "no entry" */
+	if (ctx->formatting_used == 0)
+		ctx->formatting_used = 1;
+
+	if (ctx->formatting_used >= ctx->formatting_alloc) {
+		formatting_list_entry *temp = treebuilder->alloc(
+				ctx->formatting_entries,
+				(ctx->formatting_alloc +
+					FORMATTING_LIST_CHUNK) *
+					sizeof(formatting_list_entry),
+				treebuilder->alloc_pw);
+
+		if (temp == NULL)
+			return HUBBUB_NOMEM;
+
+		ctx->formatting_entries = temp;
+		ctx->formatting_alloc += FORMATTING_LIST_CHUNK;
+	}
+
+	*index = ctx->formatting_used++;
+
+	return HUBBUB_OK;
+}
+
 /**
  * Append an element to the end of the list of active formatting elements
  *
@@ -1200,28 +2334,9 @@ hubbub_error formatting_list_append(hubbub_treebuilder *treebuilder,
 		hubbub_ns ns, element_type type, void *node,
 		uint32_t stack_index)
 {
-	formatting_list_entry *entry;
-
-	entry = malloc(sizeof(formatting_list_entry));
-	if (entry == NULL)
-		return HUBBUB_NOMEM;
-
-	entry->details.ns = ns;
-	entry->details.type = type;
-	entry->details.node = node;
-	entry->stack_index = stack_index;
-
-	entry->prev = treebuilder->context.formatting_list_end;
-	entry->next = NULL;
-
-	if (entry->prev != NULL)
-		entry->prev->next = entry;
-	else
-		treebuilder->context.formatting_list = entry;
-
-	treebuilder->context.formatting_list_end = entry;
-
-	return HUBBUB_OK;
+	return formatting_list_insert(treebuilder,
+			treebuilder->context.formatting_list_end, 0,
+			ns, type, node, stack_index);
 }
 
 /**
@@ -1237,23 +2352,30 @@ hubbub_error formatting_list_append(hubbub_treebuilder *treebuilder,
  * \return HUBBUB_OK on success, appropriate error otherwise
  */
 hubbub_error formatting_list_insert(hubbub_treebuilder *treebuilder,
-		formatting_list_entry *prev, formatting_list_entry *next,
+		uint32_t prev, uint32_t next,
 		hubbub_ns ns, element_type type, void *node,
 		uint32_t stack_index)
 {
+	formatting_list_entry *list;
 	formatting_list_entry *entry;
+	hubbub_error error;
+	uint32_t index;
+
+	error = formatting_list_new_entry(treebuilder, &index);
+	if (error != HUBBUB_OK)
+		return error;
 
-	if (prev != NULL) {
-		assert(prev->next == next);
+	list = treebuilder->context.formatting_entries;
+
+	if (prev != 0) {
+		assert(list[prev].next == next);
 	}
 
-	if (next != NULL) {
-		assert(next->prev == prev);
+	if (next != 0) {
+		assert(list[next].prev == prev);
 	}
 
-	entry = malloc(sizeof(formatting_list_entry));
-	if (entry == NULL)
-		return HUBBUB_NOMEM;
+	entry = &list[index];
 
 	entry->details.ns = ns;
 	entry->details.type = type;
@@ -1263,15 +2385,15 @@ hubbub_error formatting_list_insert(hubbub_treebuilder *treebuilder,
 	entry->prev = prev;
 	entry->next = next;
 
-	if (entry->prev != NULL)
-		entry->prev->next = entry;
+	if (entry->prev != 0)
+		list[entry->prev].next = index;
 	else
-		treebuilder->context.formatting_list = entry;
+		treebuilder->context.formatting_list = index;
 
-	if (entry->next != NULL)
-		entry->next->prev = entry;
+	if (entry->next != 0)
+		list[entry->next].prev = index;
 	else
-		treebuilder->context.formatting_list_end = entry;
+		treebuilder->context.formatting_list_end = index;
 
 	return HUBBUB_OK;
 }
@@ -1281,7 +2403,7 @@ hubbub_error formatting_list_insert(hubbub_treebuilder *treebuilder,
  * Remove an element from the list of active formatting elements
  *
  * \param treebuilder  Treebuilder instance containing list
- * \param entry        The item to remove
+ * \param index        The item to remove
  * \param ns           Pointer to location to receive namespace of node
  * \param type         Pointer to location to receive type of node
  * \param node         Pointer to location to receive node
@@ -1289,32 +2411,39 @@ hubbub_error formatting_list_insert(hubbub_treebuilder *treebuilder,
  * \return HUBBUB_OK on success, appropriate error otherwise.
  */
 hubbub_error formatting_list_remove(hubbub_treebuilder *treebuilder,
-		formatting_list_entry *entry,
+		uint32_t index,
 		hubbub_ns *ns, element_type *type, void **node,
 		uint32_t *stack_index)
 {
+	formatting_list_entry *list = treebuilder->context.formatting_entries;
+	formatting_list_entry *entry = &list[index];
+
+	assert(index != 0);
+
 	*ns = entry->details.ns;
 	*type = entry->details.type;
 	*node = entry->details.node;
 	*stack_index = entry->stack_index;
 
-	if (entry->prev == NULL) {
-		assert(treebuilder->context.formatting_list == entry);
+	if (entry->prev == 0) {
+		assert(treebuilder->context.formatting_list == index);
 		treebuilder->context.formatting_list = entry->next;
 	} else {
-		assert(treebuilder->context.formatting_list != entry);
-		entry->prev->next = entry->next;
+		assert(treebuilder->context.formatting_list != index);
+		list[entry->prev].next = entry->next;
 	}
 
-	if (entry->next == NULL) {
-		assert(treebuilder->context.formatting_list_end == entry);
+	if (entry->next == 0) {
+		assert(treebuilder->context.formatting_list_end == index);
 		treebuilder->context.formatting_list_end = entry->prev;
 	} else {
-		assert(treebuilder->context.formatting_list_end != entry);
-		entry->next->prev = entry->prev;
+		assert(treebuilder->context.formatting_list_end != index);
+		list[entry->next].prev = entry->prev;
 	}
 
-	free(entry);
+	/* Put the entry on the free list */
+	entry->next = treebuilder->context.formatting_free;
+	treebuilder->context.formatting_free = index;
 
 	return HUBBUB_OK;
 }
@@ -1323,7 +2452,7 @@ hubbub_error formatting_list_remove(hubbub_treebuilder *treebuilder,
  * Remove an element from the list of active formatting elements
  *
  * \param treebuilder   Treebuilder instance containing list
- * \param entry         The item to replace
+ * \param index         The item to replace
  * \param ns            Replacement node namespace
  * \param type          Replacement node type
  * \param node          Replacement node
@@ -1335,13 +2464,16 @@ hubbub_error formatting_list_remove(hubbub_treebuilder *treebuilder,
  * \return HUBBUB_OK on success, appropriate error otherwise
  */
 hubbub_error formatting_list_replace(hubbub_treebuilder *treebuilder,
-		formatting_list_entry *entry,
+		uint32_t index,
 		hubbub_ns ns, element_type type, void *node,
 		uint32_t stack_index,
 		hubbub_ns *ons, element_type *otype, void **onode,
 		uint32_t *ostack_index)
 {
-	UNUSED(treebuilder);
+	formatting_list_entry *entry =
+			&treebuilder->context.formatting_entries[index];
+
+	assert(index != 0);
 
 	*ons = entry->details.ns;
 	*otype = entry->details.type;
@@ -1387,13 +2519,15 @@ void element_stack_dump(hubbub_treebuilder *treebuilder, FILE *fp)
  */
 void formatting_list_dump(hubbub_treebuilder *treebuilder, FILE *fp)
 {
-	formatting_list_entry *entry;
+	formatting_list_entry *list = treebuilder->context.formatting_entries;
+	uint32_t entry;
 
-	for (entry = treebuilder->context.formatting_list; entry != NULL;
-			entry = entry->next) {
+	for (entry = treebuilder->context.formatting_list; entry != 0;
+			entry = list[entry].next) {
 		fprintf(fp, "%s %p %u\n",
-				element_type_to_name(entry->details.type),
-				entry->details.node, entry->stack_index);
+				element_type_to_name(list[entry].details.type),
+				list[entry].details.node,
+				list[entry].stack_index);
 	}
 }
 
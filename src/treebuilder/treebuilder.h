@@ -20,6 +20,8 @@
 
 typedef struct hubbub_treebuilder hubbub_treebuilder;
 
+typedef struct hubbub_treebuilder_snapshot hubbub_treebuilder_snapshot;
+
 /**
  * Hubbub treebuilder option types
  */
@@ -27,7 +29,14 @@ typedef enum hubbub_treebuilder_opttype {
 	HUBBUB_TREEBUILDER_ERROR_HANDLER,
 	HUBBUB_TREEBUILDER_TREE_HANDLER,
 	HUBBUB_TREEBUILDER_DOCUMENT_NODE,
-	HUBBUB_TREEBUILDER_ENABLE_SCRIPTING
+	HUBBUB_TREEBUILDER_ENABLE_SCRIPTING,
+	HUBBUB_TREEBUILDER_AA_CLONE_LIMIT,
+	HUBBUB_TREEBUILDER_MAX_DEPTH,
+	HUBBUB_TREEBUILDER_STOP_AT_BODY,
+	HUBBUB_TREEBUILDER_STACK_RESERVE,
+	HUBBUB_TREEBUILDER_COUNT_CALLS,
+	HUBBUB_TREEBUILDER_TRACE_HANDLER,
+	HUBBUB_TREEBUILDER_MEASURE_TIME
 } hubbub_treebuilder_opttype;
 
 /**
@@ -44,19 +53,90 @@ typedef union hubbub_treebuilder_optparams {
 	void *document_node;			/**< The document node */
 
 	bool enable_scripting;			/**< Enable scripting */
+
+	uint32_t aa_clone_limit;		/**< Adoption agency clones
+						 * allowed per document, or
+						 * 0 for no limit */
+
+	uint32_t max_depth;			/**< Maximum element nesting
+						 * depth, or 0 for no limit */
+
+	bool stop_at_body;			/**< End the parse once the
+						 * head is complete */
+
+	uint32_t stack_reserve;			/**< Open elements to make
+						 * room for ahead of need */
+
+	bool count_calls;			/**< Count the calls made to
+						 * the tree handler */
+
+	struct {
+		hubbub_trace_handler handler;
+		void *pw;
+	} trace_handler;			/**< Trace handling callback */
+
+	bool measure_time;			/**< Measure the time spent
+						 * in each insertion mode and
+						 * in tree handler callbacks */
 } hubbub_treebuilder_optparams;
 
 /* Create a hubbub treebuilder */
 hubbub_error hubbub_treebuilder_create(hubbub_tokeniser *tokeniser,
+		hubbub_allocator_fn alloc, void *pw,
 		hubbub_treebuilder **treebuilder);
 
 /* Destroy a hubbub treebuilder */
 hubbub_error hubbub_treebuilder_destroy(hubbub_treebuilder *treebuilder);
 
+/* Reset a hubbub treebuilder for a new document */
+hubbub_error hubbub_treebuilder_reset(hubbub_treebuilder *treebuilder);
+
+/* Start building the tree of a fragment */
+hubbub_error hubbub_treebuilder_begin_fragment(
+		hubbub_treebuilder *treebuilder, const hubbub_string *context);
+
+/* Record the state of a treebuilder between tokens */
+hubbub_error hubbub_treebuilder_checkpoint(hubbub_treebuilder *treebuilder,
+		hubbub_allocator_fn alloc, void *pw,
+		hubbub_treebuilder_snapshot **checkpoint);
+
+/* Return a freshly reset treebuilder to a recorded state */
+hubbub_error hubbub_treebuilder_restore(hubbub_treebuilder *treebuilder,
+		const hubbub_treebuilder_snapshot *checkpoint);
+
+/* Destroy a recorded treebuilder state */
+void hubbub_treebuilder_snapshot_destroy(
+		hubbub_treebuilder_snapshot *checkpoint);
+
 /* Configure a hubbub treebuilder */
 hubbub_error hubbub_treebuilder_setopt(hubbub_treebuilder *treebuilder,
 		hubbub_treebuilder_opttype type,
 		hubbub_treebuilder_optparams *params);
 
+/* Read the deepest nesting of elements seen */
+uint32_t hubbub_treebuilder_read_max_depth(hubbub_treebuilder *treebuilder);
+
+/* Read the memory held in the treebuilder's libparserutils buffer */
+size_t hubbub_treebuilder_read_buffer_memory(
+		hubbub_treebuilder *treebuilder);
+
+/* Read the adoption agency counts for the current document */
+hubbub_error hubbub_treebuilder_read_aa_counts(
+		hubbub_treebuilder *treebuilder, hubbub_aa_counts *counts);
+
+/* Read the work done on the current document */
+void hubbub_treebuilder_read_stats(hubbub_treebuilder *treebuilder,
+		hubbub_parser_stats *stats);
+
+/* Read the name of an insertion mode */
+const char *hubbub_treebuilder_mode_name(uint32_t mode);
+
+/* Read the charset last requested by the document */
+const char *hubbub_treebuilder_read_requested_charset(
+		hubbub_treebuilder *treebuilder);
+
+/* Read the names of the attributes the treebuilder reads itself */
+const char *const *hubbub_treebuilder_read_attribute_names(uint32_t *n_names);
+
 #endif
 
@@ -0,0 +1,1006 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 The NetSurf Project.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include <hubbub/treelog.h>
+
+#include "utils/utils.h"
+
+/** Number of commands to collect before calling the handler */
+#define TREELOG_COMMANDS 256
+
+/** Granularity with which string storage is grown */
+#define TREELOG_DATA_CHUNK 4096
+
+/** Initial capacity of the node array */
+#define TREELOG_NODES 64
+
+/** Link which leads nowhere */
+#define TREELOG_NONE ((hubbub_treelog_node) UINT32_MAX)
+
+/* Nodes are handed to the treebuilder as their identifier plus one, so
+ * that no node is ever NULL */
+#define TREELOG_HANDLE(n) ((void *) (uintptr_t) ((n) + 1))
+#define TREELOG_ID(h) ((hubbub_treelog_node) ((uintptr_t) (h) - 1))
+
+/**
+ * Kind of node, as far as the treebuilder's queries are concerned
+ */
+typedef enum treelog_kind {
+	TREELOG_KIND_OTHER,
+	TREELOG_KIND_ELEMENT,
+	TREELOG_KIND_TEXT
+} treelog_kind;
+
+/**
+ * Shape of a node
+ *
+ * The treebuilder asks about the parents and children of nodes as it
+ * goes, and cannot wait for the client to apply the commands before it
+ * is answered. The log therefore keeps the shape of the tree to itself,
+ * without any of its content.
+ */
+typedef struct treelog_node {
+	treelog_kind kind;		/**< Kind of node */
+
+	hubbub_treelog_node parent;	/**< Parent node */
+	hubbub_treelog_node first_child;	/**< First child node */
+	hubbub_treelog_node last_child;	/**< Last child node */
+	hubbub_treelog_node prev;	/**< Previous sibling */
+	hubbub_treelog_node next;	/**< Next sibling */
+} treelog_node;
+
+/**
+ * Tree command log
+ *
+ * As in a token batch, the string pointers of the collected commands hold
+ * offsets into \a data and the attribute pointers hold indices into
+ * \a attrs until the commands are delivered.
+ */
+struct hubbub_treelog {
+	hubbub_treelog_command commands[TREELOG_COMMANDS];	/**< Log */
+	uint32_t n_commands;		/**< Number of commands collected */
+
+	hubbub_attribute *attrs;	/**< Attributes of commands */
+	uint32_t n_attrs;		/**< Number of attributes in use */
+	uint32_t attr_alloc;		/**< Attributes allocated */
+
+	uint8_t *data;			/**< String data of commands */
+	size_t data_len;		/**< Bytes of string data in use */
+	size_t data_alloc;		/**< Bytes of string data allocated */
+
+	treelog_node *nodes;		/**< Shape of the tree */
+	uint32_t n_nodes;		/**< Number of nodes created */
+	uint32_t nodes_alloc;		/**< Capacity of node array */
+
+	hubbub_tree_handler tree_handler;	/**< Handler for parser */
+
+	hubbub_treelog_handler handler;	/**< Command handler */
+	void *handler_pw;		/**< Command handler data */
+
+	hubbub_allocator_fn alloc;	/**< Memory (de)allocation function */
+	void *alloc_pw;			/**< Client private data */
+};
+
+static hubbub_error treelog_create_comment(void *ctx,
+		const hubbub_string *data, void **result);
+static hubbub_error treelog_create_doctype(void *ctx,
+		const hubbub_doctype *doctype, void **result);
+static hubbub_error treelog_create_element(void *ctx, const hubbub_tag *tag,
+		void **result);
+static hubbub_error treelog_create_text(void *ctx, const hubbub_string *data,
+		void **result);
+static hubbub_error treelog_append_child(void *ctx, void *parent,
+		void *child, void **result);
+static hubbub_error treelog_insert_before(void *ctx, void *parent,
+		void *child, void *ref_child, void **result);
+static hubbub_error treelog_remove_child(void *ctx, void *parent,
+		void *child, void **result);
+static hubbub_error treelog_clone_node(void *ctx, void *node, bool deep,
+		void **result);
+static hubbub_error treelog_reparent_children(void *ctx, void *node,
+		void *new_parent);
+static hubbub_error treelog_get_parent(void *ctx, void *node,
+		bool element_only, void **result);
+static hubbub_error treelog_has_children(void *ctx, void *node,
+		bool *result);
+static hubbub_error treelog_form_associate(void *ctx, void *form,
+		void *node);
+static hubbub_error treelog_add_attributes(void *ctx, void *node,
+		const hubbub_attribute *attributes, uint32_t n_attributes);
+static hubbub_error treelog_set_quirks_mode(void *ctx,
+		hubbub_quirks_mode mode);
+static hubbub_error treelog_encoding_change(void *ctx, const char *encname);
+static hubbub_error treelog_complete_script(void *ctx, void *script);
+static hubbub_error treelog_append_text_to(void *ctx, void *parent,
+		const hubbub_string *data, bool *result);
+
+static void treelog_discard(hubbub_treelog *log);
+static void treelog_fix_string(hubbub_treelog *log, hubbub_string *str);
+
+/**
+ * Create a tree command log
+ *
+ * \param alloc       Memory (de)allocation function, or NULL for the default
+ * \param pw          Pointer to client-specific private data (may be NULL)
+ * \param handler     Command handler
+ * \param handler_pw  Pointer to client data for \p handler
+ * \param log         Pointer to location to receive log instance
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_NOMEM on memory exhaustion
+ */
+hubbub_error hubbub_treelog_create(hubbub_allocator_fn alloc, void *pw,
+		hubbub_treelog_handler handler, void *handler_pw,
+		hubbub_treelog **log)
+{
+	hubbub_treelog *l;
+	treelog_node *doc;
+
+	if (handler == NULL || log == NULL)
+		return HUBBUB_BADPARM;
+
+	if (alloc == NULL)
+		alloc = hubbub_default_alloc;
+
+	l = alloc(NULL, sizeof(hubbub_treelog), pw);
+	if (l == NULL)
+		return HUBBUB_NOMEM;
+
+	memset(l, 0, sizeof(hubbub_treelog));
+
+	l->nodes = alloc(NULL, TREELOG_NODES * sizeof(treelog_node), pw);
+	if (l->nodes == NULL) {
+		alloc(l, 0, pw);
+		return HUBBUB_NOMEM;
+	}
+
+	l->nodes_alloc = TREELOG_NODES;
+	l->n_nodes = 1;
+
+	doc = &l->nodes[HUBBUB_TREELOG_DOCUMENT];
+	doc->kind = TREELOG_KIND_OTHER;
+	doc->parent = doc->first_child = doc->last_child =
+			doc->prev = doc->next = TREELOG_NONE;
+
+	l->tree_handler.create_comment = treelog_create_comment;
+	l->tree_handler.create_doctype = treelog_create_doctype;
+	l->tree_handler.create_element = treelog_create_element;
+	l->tree_handler.create_text = treelog_create_text;
+	l->tree_handler.ref_node = NULL;
+	l->tree_handler.unref_node = NULL;
+	l->tree_handler.append_child = treelog_append_child;
+	l->tree_handler.insert_before = treelog_insert_before;
+	l->tree_handler.remove_child = treelog_remove_child;
+	l->tree_handler.clone_node = treelog_clone_node;
+	l->tree_handler.reparent_children = treelog_reparent_children;
+	l->tree_handler.get_parent = treelog_get_parent;
+	l->tree_handler.has_children = treelog_has_children;
+	l->tree_handler.form_associate = treelog_form_associate;
+	l->tree_handler.add_attributes = treelog_add_attributes;
+	l->tree_handler.set_quirks_mode = treelog_set_quirks_mode;
+	l->tree_handler.encoding_change = treelog_encoding_change;
+	l->tree_handler.complete_script = treelog_complete_script;
+	l->tree_handler.ctx = l;
+	l->tree_handler.flags = HUBBUB_TREE_NO_REFCOUNT;
+	l->tree_handler.append_text_to = treelog_append_text_to;
+
+	l->handler = handler;
+	l->handler_pw = handler_pw;
+
+	l->alloc = alloc;
+	l->alloc_pw = pw;
+
+	*log = l;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Destroy a tree command log
+ *
+ * Any commands which have not been delivered are lost.
+ *
+ * \param log  The log instance to destroy
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_treelog_destroy(hubbub_treelog *log)
+{
+	if (log == NULL)
+		return HUBBUB_BADPARM;
+
+	if (log->attrs != NULL)
+		log->alloc(log->attrs, 0, log->alloc_pw);
+
+	if (log->data != NULL)
+		log->alloc(log->data, 0, log->alloc_pw);
+
+	log->alloc(log->nodes, 0, log->alloc_pw);
+
+	log->alloc(log, 0, log->alloc_pw);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Have a parser record its tree construction in a command log
+ *
+ * \param log     The log instance to record into
+ * \param parser  The parser to configure
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * This sets the parser's tree handler and document node. A log records
+ * the construction of a single document. Once the parser has completed,
+ * the client must call hubbub_treelog_flush() to receive the last of the
+ * commands.
+ */
+hubbub_error hubbub_treelog_attach(hubbub_treelog *log,
+		hubbub_parser *parser)
+{
+	hubbub_parser_optparams params;
+	hubbub_error error;
+
+	if (log == NULL || parser == NULL)
+		return HUBBUB_BADPARM;
+
+	params.tree_handler = &log->tree_handler;
+	error = hubbub_parser_setopt(parser, HUBBUB_PARSER_TREE_HANDLER,
+			&params);
+	if (error != HUBBUB_OK)
+		return error;
+
+	params.document_node = TREELOG_HANDLE(HUBBUB_TREELOG_DOCUMENT);
+	return hubbub_parser_setopt(parser, HUBBUB_PARSER_DOCUMENT_NODE,
+			&params);
+}
+
+/**
+ * Deliver the commands held by a tree command log
+ *
+ * The log is emptied whatever the handler returns.
+ *
+ * \param log  The log instance to deliver
+ * \return HUBBUB_OK on success, or the handler's result
+ */
+hubbub_error hubbub_treelog_flush(hubbub_treelog *log)
+{
+	hubbub_error error;
+	uint32_t i, j;
+
+	if (log == NULL)
+		return HUBBUB_BADPARM;
+
+	if (log->n_commands == 0)
+		return HUBBUB_OK;
+
+	for (i = 0; i < log->n_commands; i++) {
+		hubbub_treelog_command *cmd = &log->commands[i];
+
+		switch (cmd->op) {
+		case HUBBUB_TREELOG_CREATE_COMMENT:
+		case HUBBUB_TREELOG_CREATE_TEXT:
+		case HUBBUB_TREELOG_APPEND_TEXT:
+		case HUBBUB_TREELOG_ENCODING_CHANGE:
+			treelog_fix_string(log, &cmd->data.string);
+			break;
+		case HUBBUB_TREELOG_CREATE_DOCTYPE:
+			treelog_fix_string(log, &cmd->data.doctype.name);
+			treelog_fix_string(log, &cmd->data.doctype.public_id);
+			treelog_fix_string(log, &cmd->data.doctype.system_id);
+			break;
+		case HUBBUB_TREELOG_CREATE_ELEMENT:
+		case HUBBUB_TREELOG_ADD_ATTRIBUTES:
+			treelog_fix_string(log, &cmd->data.tag.name);
+
+			if (cmd->data.tag.n_attributes == 0)
+				break;
+
+			cmd->data.tag.attributes = log->attrs +
+				(uintptr_t) cmd->data.tag.attributes;
+
+			for (j = 0; j < cmd->data.tag.n_attributes; j++) {
+				hubbub_attribute *attr =
+						&cmd->data.tag.attributes[j];
+
+				treelog_fix_string(log, &attr->name);
+				treelog_fix_string(log, &attr->value);
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
+	error = log->handler(log->commands, log->n_commands,
+			log->handler_pw);
+
+	treelog_discard(log);
+
+	return error;
+}
+
+/******************************************************************************
+ * Storage                                                                    *
+ ******************************************************************************/
+
+/**
+ * Drop the commands held by a log, without delivering them
+ *
+ * \param log  The log instance to empty
+ */
+void treelog_discard(hubbub_treelog *log)
+{
+	log->n_commands = 0;
+	log->n_attrs = 0;
+	log->data_len = 0;
+}
+
+/**
+ * Claim the next command in a log, delivering the log first if it is full
+ *
+ * \param log     The log instance
+ * \param op      Operation of the command
+ * \param node    Node operated upon
+ * \param result  Pointer to location to receive command
+ * \return HUBBUB_OK on success, or the handler's result
+ */
+static hubbub_error treelog_command(hubbub_treelog *log,
+		hubbub_treelog_op op, hubbub_treelog_node node,
+		hubbub_treelog_command **result)
+{
+	hubbub_treelog_command *cmd;
+	hubbub_error error;
+
+	if (log->n_commands == TREELOG_COMMANDS) {
+		error = hubbub_treelog_flush(log);
+		if (error != HUBBUB_OK)
+			return error;
+	}
+
+	cmd = &log->commands[log->n_commands++];
+	memset(cmd, 0, sizeof(hubbub_treelog_command));
+	cmd->op = op;
+	cmd->node = node;
+	cmd->parent = cmd->other = TREELOG_NONE;
+
+	*result = cmd;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Copy a string into a log's string storage
+ *
+ * \param log  The log instance
+ * \param str  String to copy; updated to hold its offset in the storage
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ */
+static hubbub_error treelog_copy_string(hubbub_treelog *log,
+		hubbub_string *str)
+{
+	if (log->data_len + str->len > log->data_alloc) {
+		size_t alloc = log->data_len + str->len + TREELOG_DATA_CHUNK;
+		uint8_t *data;
+
+		alloc -= alloc % TREELOG_DATA_CHUNK;
+
+		data = log->alloc(log->data, alloc, log->alloc_pw);
+		if (data == NULL)
+			return HUBBUB_NOMEM;
+
+		log->data = data;
+		log->data_alloc = alloc;
+	}
+
+	if (str->len > 0)
+		memcpy(log->data + log->data_len, str->ptr, str->len);
+
+	str->ptr = (const uint8_t *) (uintptr_t) log->data_len;
+	log->data_len += str->len;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Copy attributes into a log
+ *
+ * \param log  The log instance
+ * \param tag  Tag whose attributes to copy; updated to hold the index
+ *             of its first attribute in the log
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ */
+static hubbub_error treelog_copy_attributes(hubbub_treelog *log,
+		hubbub_tag *tag)
+{
+	hubbub_attribute *attrs;
+	hubbub_error error;
+	uint32_t i;
+
+	if (tag->n_attributes == 0) {
+		tag->attributes = NULL;
+		return HUBBUB_OK;
+	}
+
+	if (log->n_attrs + tag->n_attributes > log->attr_alloc) {
+		uint32_t alloc = (log->n_attrs + tag->n_attributes) * 2;
+
+		attrs = log->alloc(log->attrs,
+				alloc * sizeof(hubbub_attribute),
+				log->alloc_pw);
+		if (attrs == NULL)
+			return HUBBUB_NOMEM;
+
+		log->attrs = attrs;
+		log->attr_alloc = alloc;
+	}
+
+	attrs = log->attrs + log->n_attrs;
+	memcpy(attrs, tag->attributes,
+			tag->n_attributes * sizeof(hubbub_attribute));
+
+	for (i = 0; i < tag->n_attributes; i++) {
+		error = treelog_copy_string(log, &attrs[i].name);
+		if (error != HUBBUB_OK)
+			return error;
+
+		error = treelog_copy_string(log, &attrs[i].value);
+		if (error != HUBBUB_OK)
+			return error;
+	}
+
+	tag->attributes = (hubbub_attribute *) (uintptr_t) log->n_attrs;
+	log->n_attrs += tag->n_attributes;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Turn a string's offset in a log's storage back into a pointer
+ *
+ * \param log  The log instance
+ * \param str  String to fix up
+ */
+void treelog_fix_string(hubbub_treelog *log, hubbub_string *str)
+{
+	str->ptr = log->data + (uintptr_t) str->ptr;
+}
+
+/**
+ * Add a node, unattached
+ *
+ * \param log     The log instance
+ * \param kind    Kind of the node
+ * \param result  Pointer to location to receive identifier of node
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ */
+static hubbub_error treelog_add_node(hubbub_treelog *log, treelog_kind kind,
+		hubbub_treelog_node *result)
+{
+	treelog_node *node;
+
+	if (log->n_nodes == TREELOG_NONE)
+		return HUBBUB_NOMEM;
+
+	if (log->n_nodes == log->nodes_alloc) {
+		uint32_t alloc = log->nodes_alloc * 2;
+
+		if (alloc < log->nodes_alloc || (size_t) alloc *
+				sizeof(treelog_node) / sizeof(treelog_node) !=
+				alloc)
+			return HUBBUB_NOMEM;
+
+		node = log->alloc(log->nodes, alloc * sizeof(treelog_node),
+				log->alloc_pw);
+		if (node == NULL)
+			return HUBBUB_NOMEM;
+
+		log->nodes = node;
+		log->nodes_alloc = alloc;
+	}
+
+	node = &log->nodes[log->n_nodes];
+	node->kind = kind;
+	node->parent = node->first_child = node->last_child =
+			node->prev = node->next = TREELOG_NONE;
+
+	*result = log->n_nodes++;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Detach a node from its parent, if it has one
+ *
+ * \param log  The log instance
+ * \param id   Node to detach
+ */
+static void treelog_unlink(hubbub_treelog *log, hubbub_treelog_node id)
+{
+	treelog_node *node = &log->nodes[id];
+	treelog_node *parent;
+
+	if (node->parent == TREELOG_NONE)
+		return;
+
+	parent = &log->nodes[node->parent];
+
+	if (node->prev != TREELOG_NONE)
+		log->nodes[node->prev].next = node->next;
+	else
+		parent->first_child = node->next;
+
+	if (node->next != TREELOG_NONE)
+		log->nodes[node->next].prev = node->prev;
+	else
+		parent->last_child = node->prev;
+
+	node->parent = node->prev = node->next = TREELOG_NONE;
+}
+
+/**
+ * Insert a detached node into a parent's child list
+ *
+ * \param log     The log instance
+ * \param parent  Parent node
+ * \param id      Node to insert
+ * \param before  Child to insert before, or TREELOG_NONE to append
+ */
+static void treelog_link(hubbub_treelog *log, hubbub_treelog_node parent,
+		hubbub_treelog_node id, hubbub_treelog_node before)
+{
+	treelog_node *p = &log->nodes[parent];
+	treelog_node *node = &log->nodes[id];
+
+	node->parent = parent;
+	node->next = before;
+
+	if (before == TREELOG_NONE) {
+		node->prev = p->last_child;
+		p->last_child = id;
+	} else {
+		node->prev = log->nodes[before].prev;
+		log->nodes[before].prev = id;
+	}
+
+	if (node->prev != TREELOG_NONE)
+		log->nodes[node->prev].next = id;
+	else
+		p->first_child = id;
+}
+
+/**
+ * Record the creation of a node
+ *
+ * \param log     The log instance
+ * \param op      Creation operation
+ * \param kind    Kind of the node
+ * \param cmd     Pointer to location to receive command
+ * \param result  Pointer to location to receive node
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static hubbub_error treelog_create(hubbub_treelog *log, hubbub_treelog_op op,
+		treelog_kind kind, hubbub_treelog_command **cmd, void **result)
+{
+	hubbub_treelog_node id;
+	hubbub_error error;
+
+	error = treelog_add_node(log, kind, &id);
+	if (error != HUBBUB_OK)
+		return error;
+
+	error = treelog_command(log, op, id, cmd);
+	if (error != HUBBUB_OK)
+		return error;
+
+	*result = TREELOG_HANDLE(id);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Record a shallow or deep copy of a node
+ *
+ * \param log     The log instance
+ * \param id      Node to copy
+ * \param deep    Whether to copy descendants
+ * \param result  Pointer to location to receive copy
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * The client is only ever asked for shallow copies; those of descendants
+ * are appended to their parents' copies as further commands.
+ */
+static hubbub_error treelog_clone(hubbub_treelog *log,
+		hubbub_treelog_node id, bool deep, hubbub_treelog_node *result)
+{
+	hubbub_treelog_command *cmd;
+	hubbub_treelog_node copy, child, child_copy;
+	hubbub_error error;
+
+	error = treelog_add_node(log, log->nodes[id].kind, &copy);
+	if (error != HUBBUB_OK)
+		return error;
+
+	error = treelog_command(log, HUBBUB_TREELOG_CLONE_NODE, copy, &cmd);
+	if (error != HUBBUB_OK)
+		return error;
+
+	cmd->other = id;
+
+	if (deep) {
+		for (child = log->nodes[id].first_child;
+				child != TREELOG_NONE;
+				child = log->nodes[child].next) {
+			error = treelog_clone(log, child, true, &child_copy);
+			if (error != HUBBUB_OK)
+				return error;
+
+			error = treelog_command(log,
+					HUBBUB_TREELOG_APPEND_CHILD,
+					child_copy, &cmd);
+			if (error != HUBBUB_OK)
+				return error;
+
+			cmd->parent = copy;
+
+			treelog_link(log, copy, child_copy, TREELOG_NONE);
+		}
+	}
+
+	*result = copy;
+
+	return HUBBUB_OK;
+}
+
+/******************************************************************************
+ * Tree handler callbacks                                                     *
+ ******************************************************************************/
+
+static hubbub_error treelog_create_comment(void *ctx,
+		const hubbub_string *data, void **result)
+{
+	hubbub_treelog *log = (hubbub_treelog *) ctx;
+	hubbub_treelog_command *cmd;
+	hubbub_error error;
+
+	error = treelog_create(log, HUBBUB_TREELOG_CREATE_COMMENT,
+			TREELOG_KIND_OTHER, &cmd, result);
+	if (error != HUBBUB_OK)
+		return error;
+
+	cmd->data.string = *data;
+
+	return treelog_copy_string(log, &cmd->data.string);
+}
+
+static hubbub_error treelog_create_doctype(void *ctx,
+		const hubbub_doctype *doctype, void **result)
+{
+	hubbub_treelog *log = (hubbub_treelog *) ctx;
+	hubbub_treelog_command *cmd;
+	hubbub_error error;
+
+	error = treelog_create(log, HUBBUB_TREELOG_CREATE_DOCTYPE,
+			TREELOG_KIND_OTHER, &cmd, result);
+	if (error != HUBBUB_OK)
+		return error;
+
+	cmd->data.doctype = *doctype;
+
+	error = treelog_copy_string(log, &cmd->data.doctype.name);
+	if (error == HUBBUB_OK)
+		error = treelog_copy_string(log,
+				&cmd->data.doctype.public_id);
+	if (error == HUBBUB_OK)
+		error = treelog_copy_string(log,
+				&cmd->data.doctype.system_id);
+
+	return error;
+}
+
+static hubbub_error treelog_create_element(void *ctx, const hubbub_tag *tag,
+		void **result)
+{
+	hubbub_treelog *log = (hubbub_treelog *) ctx;
+	hubbub_treelog_command *cmd;
+	hubbub_error error;
+
+	error = treelog_create(log, HUBBUB_TREELOG_CREATE_ELEMENT,
+			TREELOG_KIND_ELEMENT, &cmd, result);
+	if (error != HUBBUB_OK)
+		return error;
+
+	cmd->data.tag = *tag;
+
+	error = treelog_copy_string(log, &cmd->data.tag.name);
+	if (error == HUBBUB_OK)
+		error = treelog_copy_attributes(log, &cmd->data.tag);
+
+	return error;
+}
+
+static hubbub_error treelog_create_text(void *ctx, const hubbub_string *data,
+		void **result)
+{
+	hubbub_treelog *log = (hubbub_treelog *) ctx;
+	hubbub_treelog_command *cmd;
+	hubbub_error error;
+
+	error = treelog_create(log, HUBBUB_TREELOG_CREATE_TEXT,
+			TREELOG_KIND_TEXT, &cmd, result);
+	if (error != HUBBUB_OK)
+		return error;
+
+	cmd->data.string = *data;
+
+	return treelog_copy_string(log, &cmd->data.string);
+}
+
+static hubbub_error treelog_append_child(void *ctx, void *parent,
+		void *child, void **result)
+{
+	return treelog_insert_before(ctx, parent, child, NULL, result);
+}
+
+static hubbub_error treelog_insert_before(void *ctx, void *parent,
+		void *child, void *ref_child, void **result)
+{
+	hubbub_treelog *log = (hubbub_treelog *) ctx;
+	hubbub_treelog_node p = TREELOG_ID(parent), c = TREELOG_ID(child);
+	hubbub_treelog_node before = TREELOG_NONE, prev;
+	hubbub_treelog_command *cmd;
+	hubbub_error error;
+
+	if (ref_child != NULL) {
+		before = TREELOG_ID(ref_child);
+		prev = log->nodes[before].prev;
+	} else {
+		prev = log->nodes[p].last_child;
+	}
+
+	/* Text is coalesced with any text which would precede it */
+	if (log->nodes[c].kind == TREELOG_KIND_TEXT && prev != TREELOG_NONE &&
+			log->nodes[prev].kind == TREELOG_KIND_TEXT) {
+		cmd = (log->n_commands > 0)
+				? &log->commands[log->n_commands - 1] : NULL;
+
+		if (cmd != NULL && cmd->op == HUBBUB_TREELOG_CREATE_TEXT &&
+				cmd->node == c) {
+			/* The text was only just created, so the client
+			 * need never see its node */
+			cmd->op = HUBBUB_TREELOG_APPEND_TEXT;
+			cmd->node = prev;
+		} else {
+			error = treelog_command(log,
+					HUBBUB_TREELOG_MERGE_TEXT, prev,
+					&cmd);
+			if (error != HUBBUB_OK)
+				return error;
+
+			cmd->other = c;
+		}
+
+		*result = TREELOG_HANDLE(prev);
+
+		return HUBBUB_OK;
+	}
+
+	error = treelog_command(log, ref_child != NULL
+			? HUBBUB_TREELOG_INSERT_BEFORE
+			: HUBBUB_TREELOG_APPEND_CHILD, c, &cmd);
+	if (error != HUBBUB_OK)
+		return error;
+
+	cmd->parent = p;
+	cmd->other = before;
+
+	treelog_unlink(log, c);
+	treelog_link(log, p, c, before);
+
+	*result = child;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error treelog_remove_child(void *ctx, void *parent,
+		void *child, void **result)
+{
+	hubbub_treelog *log = (hubbub_treelog *) ctx;
+	hubbub_treelog_command *cmd;
+	hubbub_error error;
+
+	error = treelog_command(log, HUBBUB_TREELOG_REMOVE_CHILD,
+			TREELOG_ID(child), &cmd);
+	if (error != HUBBUB_OK)
+		return error;
+
+	cmd->parent = TREELOG_ID(parent);
+
+	treelog_unlink(log, TREELOG_ID(child));
+
+	*result = child;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error treelog_clone_node(void *ctx, void *node, bool deep,
+		void **result)
+{
+	hubbub_treelog_node copy;
+	hubbub_error error;
+
+	error = treelog_clone((hubbub_treelog *) ctx, TREELOG_ID(node), deep,
+			&copy);
+	if (error != HUBBUB_OK)
+		return error;
+
+	*result = TREELOG_HANDLE(copy);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error treelog_reparent_children(void *ctx, void *node,
+		void *new_parent)
+{
+	hubbub_treelog *log = (hubbub_treelog *) ctx;
+	hubbub_treelog_node from = TREELOG_ID(node);
+	hubbub_treelog_node to = TREELOG_ID(new_parent);
+	hubbub_treelog_node child;
+	hubbub_treelog_command *cmd;
+	hubbub_error error;
+
+	error = treelog_command(log, HUBBUB_TREELOG_REPARENT_CHILDREN, from,
+			&cmd);
+	if (error != HUBBUB_OK)
+		return error;
+
+	cmd->parent = to;
+
+	while ((child = log->nodes[from].first_child) != TREELOG_NONE) {
+		treelog_unlink(log, child);
+		treelog_link(log, to, child, TREELOG_NONE);
+	}
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error treelog_get_parent(void *ctx, void *node,
+		bool element_only, void **result)
+{
+	hubbub_treelog *log = (hubbub_treelog *) ctx;
+	hubbub_treelog_node parent = log->nodes[TREELOG_ID(node)].parent;
+
+	if (parent == TREELOG_NONE || (element_only &&
+			log->nodes[parent].kind != TREELOG_KIND_ELEMENT))
+		*result = NULL;
+	else
+		*result = TREELOG_HANDLE(parent);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error treelog_has_children(void *ctx, void *node,
+		bool *result)
+{
+	hubbub_treelog *log = (hubbub_treelog *) ctx;
+
+	*result = log->nodes[TREELOG_ID(node)].first_child != TREELOG_NONE;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error treelog_form_associate(void *ctx, void *form,
+		void *node)
+{
+	hubbub_treelog_command *cmd;
+	hubbub_error error;
+
+	error = treelog_command((hubbub_treelog *) ctx,
+			HUBBUB_TREELOG_FORM_ASSOCIATE, TREELOG_ID(node), &cmd);
+	if (error != HUBBUB_OK)
+		return error;
+
+	cmd->other = TREELOG_ID(form);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error treelog_add_attributes(void *ctx, void *node,
+		const hubbub_attribute *attributes, uint32_t n_attributes)
+{
+	hubbub_treelog *log = (hubbub_treelog *) ctx;
+	hubbub_treelog_command *cmd;
+	hubbub_error error;
+
+	error = treelog_command(log, HUBBUB_TREELOG_ADD_ATTRIBUTES,
+			TREELOG_ID(node), &cmd);
+	if (error != HUBBUB_OK)
+		return error;
+
+	cmd->data.tag.attributes = (hubbub_attribute *) attributes;
+	cmd->data.tag.n_attributes = n_attributes;
+
+	return treelog_copy_attributes(log, &cmd->data.tag);
+}
+
+static hubbub_error treelog_set_quirks_mode(void *ctx,
+		hubbub_quirks_mode mode)
+{
+	hubbub_treelog_command *cmd;
+	hubbub_error error;
+
+	error = treelog_command((hubbub_treelog *) ctx,
+			HUBBUB_TREELOG_SET_QUIRKS_MODE, TREELOG_NONE, &cmd);
+	if (error != HUBBUB_OK)
+		return error;
+
+	cmd->data.quirks_mode = mode;
+
+	return HUBBUB_OK;
+}
+
+/* The client's answer is needed at once, so the log is delivered */
+static hubbub_error treelog_encoding_change(void *ctx, const char *encname)
+{
+	hubbub_treelog *log = (hubbub_treelog *) ctx;
+	hubbub_treelog_command *cmd;
+	hubbub_error error;
+
+	error = treelog_command(log, HUBBUB_TREELOG_ENCODING_CHANGE,
+			TREELOG_NONE, &cmd);
+	if (error != HUBBUB_OK)
+		return error;
+
+	cmd->data.string.ptr = (const uint8_t *) encname;
+	cmd->data.string.len = strlen(encname);
+
+	error = treelog_copy_string(log, &cmd->data.string);
+	if (error != HUBBUB_OK)
+		return error;
+
+	return hubbub_treelog_flush(log);
+}
+
+/* The script must be complete on return, so the log is delivered */
+static hubbub_error treelog_complete_script(void *ctx, void *script)
+{
+	hubbub_treelog *log = (hubbub_treelog *) ctx;
+	hubbub_treelog_command *cmd;
+	hubbub_error error;
+
+	error = treelog_command(log, HUBBUB_TREELOG_COMPLETE_SCRIPT,
+			TREELOG_ID(script), &cmd);
+	if (error != HUBBUB_OK)
+		return error;
+
+	return hubbub_treelog_flush(log);
+}
+
+static hubbub_error treelog_append_text_to(void *ctx, void *parent,
+		const hubbub_string *data, bool *result)
+{
+	hubbub_treelog *log = (hubbub_treelog *) ctx;
+	hubbub_treelog_node last = log->nodes[TREELOG_ID(parent)].last_child;
+	hubbub_treelog_command *cmd;
+	hubbub_error error;
+
+	*result = false;
+
+	if (last == TREELOG_NONE || log->nodes[last].kind != TREELOG_KIND_TEXT)
+		return HUBBUB_OK;
+
+	error = treelog_command(log, HUBBUB_TREELOG_APPEND_TEXT, last, &cmd);
+	if (error != HUBBUB_OK)
+		return error;
+
+	cmd->data.string = *data;
+
+	*result = true;
+
+	return treelog_copy_string(log, &cmd->data.string);
+}
@@ -0,0 +1,138 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 The NetSurf Project.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+
+#include "utils/account.h"
+
+/**
+ * Header before each block, holding the size asked for
+ *
+ * The union is as strictly aligned as anything held in the block after it.
+ */
+typedef union account_header {
+	size_t len;			/**< Bytes asked for */
+	void *ptr;
+	long double ld;
+	uint64_t u64;
+} account_header;
+
+/**
+ * Set up an account of memory obtained from an allocator
+ *
+ * \param account  Account to set up
+ * \param alloc    Allocator to obtain memory from
+ * \param pw       Client data for \a alloc
+ */
+void hubbub_account_init(hubbub_account *account,
+		hubbub_allocator_fn alloc, void *pw)
+{
+	assert(account != NULL && alloc != NULL);
+
+	account->alloc = alloc;
+	account->pw = pw;
+
+	account->held = 0;
+	account->external = 0;
+	account->peak = 0;
+	account->limit = 0;
+	account->allocations = 0;
+}
+
+/**
+ * Allocate memory, counting it against an account
+ *
+ * This has the semantics of hubbub_allocator_fn. Growing a block fails, as
+ * if memory were exhausted, if the account would then hold more than its
+ * limit.
+ *
+ * \param ptr  Block to resize, or NULL for a new one
+ * \param len  Bytes wanted, or 0 to free \a ptr
+ * \param pw   The account
+ * \return Pointer to the block, or NULL on failure (or free)
+ */
+void *hubbub_account_alloc(void *ptr, size_t len, void *pw)
+{
+	hubbub_account *account = (hubbub_account *) pw;
+	account_header *block = NULL;
+	size_t old = 0;
+
+	if (ptr != NULL) {
+		block = (account_header *) ptr - 1;
+		old = block->len;
+	}
+
+	if (len == 0) {
+		if (block != NULL) {
+			account->held -= old;
+			account->alloc(block, 0, account->pw);
+		}
+		return NULL;
+	}
+
+	if (len > SIZE_MAX - sizeof(account_header))
+		return NULL;
+
+	if (account->limit != 0 && len > old) {
+		size_t total = account->held + account->external;
+
+		if (total >= account->limit ||
+				len - old > account->limit - total)
+			return NULL;
+	}
+
+	block = account->alloc(block, sizeof(account_header) + len,
+			account->pw);
+	if (block == NULL)
+		return NULL;
+
+	block->len = len;
+
+	account->held = account->held - old + len;
+	account->allocations++;
+
+	if (account->held + account->external > account->peak)
+		account->peak = account->held + account->external;
+
+	return block + 1;
+}
+
+/**
+ * Report the size of the buffers held outside the account
+ *
+ * \param account   The account
+ * \param external  Bytes now held in libparserutils buffers
+ * \return HUBBUB_OK if the account is within its limit,
+ *         HUBBUB_NOMEM if it is over it
+ */
+hubbub_error hubbub_account_external(hubbub_account *account,
+		size_t external)
+{
+	account->external = external;
+
+	if (account->held + external > account->peak)
+		account->peak = account->held + external;
+
+	if (account->limit != 0 && account->held + external > account->limit)
+		return HUBBUB_NOMEM;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Begin accounting for a new document
+ *
+ * The peak and count of allocations start again from what is held now.
+ *
+ * \param account  The account
+ */
+void hubbub_account_begin(hubbub_account *account)
+{
+	account->peak = account->held + account->external;
+	account->allocations = 0;
+}
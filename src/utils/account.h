@@ -0,0 +1,52 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 The NetSurf Project.
+ */
+
+#ifndef hubbub_utils_account_h_
+#define hubbub_utils_account_h_
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include <hubbub/errors.h>
+#include <hubbub/functypes.h>
+
+/**
+ * Account of the memory a parser holds
+ *
+ * Memory is obtained by passing hubbub_account_alloc, with the account as
+ * its private data, wherever an allocator is expected. The buffers which
+ * libparserutils allocates for itself cannot be seen as they grow, so
+ * their size is reported from time to time with hubbub_account_external.
+ */
+typedef struct hubbub_account {
+	hubbub_allocator_fn alloc;	/**< Allocator memory comes from */
+	void *pw;			/**< Client data for \a alloc */
+
+	size_t held;			/**< Bytes held through the account */
+	size_t external;		/**< Bytes held in libparserutils
+					 * buffers, when last reported */
+	size_t peak;			/**< Most bytes held at once */
+	size_t limit;			/**< Most bytes which may be held,
+					 * or 0 for no limit */
+	uint32_t allocations;		/**< Blocks obtained or resized */
+} hubbub_account;
+
+/* Set up an account of memory obtained from an allocator */
+void hubbub_account_init(hubbub_account *account,
+		hubbub_allocator_fn alloc, void *pw);
+
+/* Allocate memory, counting it against an account */
+void *hubbub_account_alloc(void *ptr, size_t len, void *pw);
+
+/* Report the size of the buffers held outside the account */
+hubbub_error hubbub_account_external(hubbub_account *account,
+		size_t external);
+
+/* Begin accounting for a new document */
+void hubbub_account_begin(hubbub_account *account);
+
+#endif
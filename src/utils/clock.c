@@ -0,0 +1,31 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 The NetSurf Project.
+ */
+
+#include <time.h>
+
+#include "utils/clock.h"
+
+/**
+ * Read a clock which counts nanoseconds, from an arbitrary start
+ *
+ * This is the monotonic clock where there is one, which on most systems is
+ * read from the processor's cycle counter without entering the kernel.
+ * Elsewhere, it is the processor time used, which is much coarser.
+ *
+ * \return Nanoseconds since the start
+ */
+uint64_t hubbub_clock_ns(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+
+	return (uint64_t) clock() * (1000000000 / CLOCKS_PER_SEC);
+}
@@ -0,0 +1,16 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 The NetSurf Project.
+ */
+
+#ifndef hubbub_utils_clock_h_
+#define hubbub_utils_clock_h_
+
+#include <inttypes.h>
+
+/* Read a clock which counts nanoseconds, from an arbitrary start */
+uint64_t hubbub_clock_ns(void);
+
+#endif
@@ -32,6 +32,9 @@ const char *hubbub_error_to_string(hubbub_error error)
 	case HUBBUB_PAUSED:
 		result = "Parser is paused";
 		break;
+	case HUBBUB_YIELDED:
+		result = "Work budget exhausted";
+		break;
 	case HUBBUB_NOMEM:
 		result = "Insufficient memory";
 		break;
@@ -53,6 +56,9 @@ const char *hubbub_error_to_string(hubbub_error error)
 	case HUBBUB_UNKNOWN:
 		result = "Unknown error";
 		break;
+	case HUBBUB_STOPPED:
+		result = "Parsing stopped early";
+		break;
 	}
 
 	return result;
@@ -9,6 +9,11 @@
 #include <inttypes.h>
 #include <stdbool.h>
 #include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "utils/string.h"
 
 
@@ -29,9 +34,58 @@ bool hubbub_string_match(const uint8_t *a, size_t a_len,
 	return memcmp((const char *) a, (const char *) b, b_len) == 0;
 }
 
+/** A byte of ones in every byte of a word */
+#define ONES ((uint64_t) 0x0101010101010101)
+
+/**
+ * Find the capital letters in a word of text
+ *
+ * \param w  Eight bytes of text
+ * \return Word with 0x80 set in each byte that is 'A' to 'Z'
+ */
+static inline uint64_t upper_mask(uint64_t w)
+{
+	/* Add to the low seven bits of each byte so that bit 7 shows
+	 * whether the byte is at least 'A', and whether it is past 'Z';
+	 * neither sum carries into the next byte */
+	uint64_t heptets = w & (0x7f * ONES);
+	uint64_t from_a = heptets + ((0x80 - 'A') * ONES);
+	uint64_t past_z = heptets + ((0x80 - 'Z' - 1) * ONES);
+
+	return (from_a ^ past_z) & ~w & (0x80 * ONES);
+}
+
+/**
+ * Fold the capital letters in a word of text to lower case
+ *
+ * \param w  Eight bytes of text
+ * \return Folded text
+ */
+static inline uint64_t lower_word(uint64_t w)
+{
+	return w | (upper_mask(w) >> 2);
+}
+
+/**
+ * Read a word of text, however it is aligned
+ *
+ * \param data  Pointer to eight bytes of text
+ * \return The text
+ */
+static inline uint64_t load_word(const uint8_t *data)
+{
+	uint64_t w;
+
+	memcpy(&w, data, sizeof(w));
+
+	return w;
+}
+
 /**
  * Check that one string is case-insensitively equal to another
  *
+ * Only ASCII letters are folded. The strings are compared a word at a time.
+ *
  * \param a	String to compare
  * \param a_len	Length of first string
  * \param b	String to compare
@@ -43,12 +97,22 @@ bool hubbub_string_match_ci(const uint8_t *a, size_t a_len,
 	if (a_len != b_len)
 		return false;
 
+	for (; b_len >= sizeof(uint64_t); b_len -= sizeof(uint64_t)) {
+		uint64_t aa = load_word(a), bb = load_word(b);
+
+		if (aa != bb && lower_word(aa) != lower_word(bb))
+			return false;
+
+		a += sizeof(uint64_t);
+		b += sizeof(uint64_t);
+	}
+
 	while (b_len-- > 0) {
 		uint8_t aa = *(a++);
 		uint8_t bb = *(b++);
 
-		aa = ('a' <= aa && aa <= 'z') ? (aa - 0x20) : aa; 
-		bb = ('a' <= bb && bb <= 'z') ? (bb - 0x20) : bb;
+		aa = ('A' <= aa && aa <= 'Z') ? (aa + 0x20) : aa;
+		bb = ('A' <= bb && bb <= 'Z') ? (bb + 0x20) : bb;
 
 		if (aa != bb)
 			return false;
@@ -56,3 +120,109 @@ bool hubbub_string_match_ci(const uint8_t *a, size_t a_len,
 
 	return true;
 }
+
+/**
+ * Find the first capital letter in some text
+ *
+ * \param data	Text to scan
+ * \param len	Length, in bytes, of text
+ * \return Offset of the first byte from 'A' to 'Z', or len if there is none
+ */
+size_t hubbub_string_find_upper(const uint8_t *data, size_t len)
+{
+	size_t off = 0;
+
+	/* The word holding the first capital is left for the byte loop */
+	while (len - off >= sizeof(uint64_t) &&
+			upper_mask(load_word(data + off)) == 0)
+		off += sizeof(uint64_t);
+
+	while (off < len && (data[off] < 'A' || 'Z' < data[off]))
+		off++;
+
+	return off;
+}
+
+/**
+ * Fold the capital letters in some text to lower case, in place
+ *
+ * Only ASCII letters are folded, so UTF-8 text remains valid.
+ *
+ * \param data	Text to fold
+ * \param len	Length, in bytes, of text
+ */
+void hubbub_string_lower(uint8_t *data, size_t len)
+{
+	for (; len >= sizeof(uint64_t); len -= sizeof(uint64_t)) {
+		uint64_t w = load_word(data);
+		uint64_t mask = upper_mask(w);
+
+		if (mask != 0) {
+			w |= mask >> 2;
+			memcpy(data, &w, sizeof(w));
+		}
+
+		data += sizeof(uint64_t);
+	}
+
+	for (; len > 0; len--, data++) {
+		if ('A' <= *data && *data <= 'Z')
+			*data += 0x20;
+	}
+}
+
+/**
+ * Find the length of the run of whitespace at the start of some text
+ *
+ * Whitespace is tab, line feed, form feed and space; carriage returns are
+ * not included, as they never reach the tree builder. Whole blocks of
+ * whitespace are passed over at once where the machine allows.
+ *
+ * \param data	Text to scan
+ * \param len	Length, in bytes, of text
+ * \return Length, in bytes, of the run
+ */
+size_t hubbub_string_space_span(const uint8_t *data, size_t len)
+{
+	size_t off = 0;
+
+#ifdef __SSE2__
+	if (len >= 16) {
+		const __m128i tab = _mm_set1_epi8('\t');
+		const __m128i lf = _mm_set1_epi8('\n');
+		const __m128i ff = _mm_set1_epi8('\f');
+		const __m128i space = _mm_set1_epi8(' ');
+
+		/* The block holding the end of the run is left for the
+		 * scalar loop to pin down */
+		while (len - off >= 16) {
+			__m128i block = _mm_loadu_si128(
+					(const __m128i *) (const void *)
+					(data + off));
+			__m128i ws = _mm_or_si128(
+					_mm_or_si128(
+						_mm_cmpeq_epi8(block, tab),
+						_mm_cmpeq_epi8(block, lf)),
+					_mm_or_si128(
+						_mm_cmpeq_epi8(block, ff),
+						_mm_cmpeq_epi8(block, space)));
+
+			if (_mm_movemask_epi8(ws) != 0xffff)
+				break;
+
+			off += 16;
+		}
+	}
+#endif
+
+	while (off < len) {
+		const uint8_t c = data[off];
+
+		if (c != '\t' && c != '\n' && c != '\f' && c != ' ')
+			break;
+
+		off++;
+	}
+
+	return off;
+}
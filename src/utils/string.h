@@ -16,4 +16,13 @@ bool hubbub_string_match(const uint8_t *a, size_t a_len,
 bool hubbub_string_match_ci(const uint8_t *a, size_t a_len,
 		const uint8_t *b, size_t b_len);
 
+/** Find the first capital letter in some text */
+size_t hubbub_string_find_upper(const uint8_t *data, size_t len);
+
+/** Fold the capital letters in some text to lower case, in place */
+void hubbub_string_lower(uint8_t *data, size_t len);
+
+/** Find the length of the run of whitespace at the start of some text */
+size_t hubbub_string_space_span(const uint8_t *data, size_t len);
+
 #endif
@@ -0,0 +1,122 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 The NetSurf Project.
+ */
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "utils/utf8.h"
+
+/**
+ * Find the length of the run of ASCII at the start of some data
+ *
+ * \param data  Data to scan
+ * \param len   Length, in bytes, of data
+ * \return Length, in bytes, of the run
+ */
+static inline size_t utf8_ascii_length(const uint8_t *data, size_t len)
+{
+	size_t off = 0;
+
+#ifdef __SSE2__
+	/* A block is all ASCII if none of its bytes has the top bit set */
+	while (len - off >= 16) {
+		__m128i block = _mm_loadu_si128(
+				(const __m128i *) (const void *) (data + off));
+
+		if (_mm_movemask_epi8(block) != 0)
+			break;
+
+		off += 16;
+	}
+#else
+	while (len - off >= sizeof(uint64_t)) {
+		uint64_t word;
+
+		memcpy(&word, data + off, sizeof(word));
+		if ((word & UINT64_C(0x8080808080808080)) != 0)
+			break;
+
+		off += sizeof(uint64_t);
+	}
+#endif
+
+	while (off < len && data[off] < 0x80)
+		off++;
+
+	return off;
+}
+
+/**
+ * Find the length of the valid UTF-8 prefix of some data
+ *
+ * Overlong forms, surrogates and characters beyond U+10FFFF are invalid.
+ * The prefix never ends part way through a character. Runs of ASCII, which
+ * make up most documents, are skipped a block at a time.
+ *
+ * \param data       Data to check
+ * \param len        Length, in bytes, of data
+ * \param truncated  Pointer to location to receive whether the prefix is
+ *                   short only because the data ends part way through a
+ *                   character which may yet be completed
+ * \return Length, in bytes, of the valid prefix
+ */
+size_t hubbub_utf8_valid_length(const uint8_t *data, size_t len,
+		bool *truncated)
+{
+	size_t off = 0;
+
+	*truncated = false;
+
+	while (off < len) {
+		uint8_t c, lo = 0x80, hi = 0xBF;
+		size_t n, i;
+
+		off += utf8_ascii_length(data + off, len - off);
+		if (off == len)
+			break;
+
+		c = data[off];
+		if (c >= 0xC2 && c <= 0xDF) {
+			n = 2;
+		} else if (c >= 0xE0 && c <= 0xEF) {
+			n = 3;
+			if (c == 0xE0)
+				lo = 0xA0;
+			else if (c == 0xED)
+				hi = 0x9F;
+		} else if (c >= 0xF0 && c <= 0xF4) {
+			n = 4;
+			if (c == 0xF0)
+				lo = 0x90;
+			else if (c == 0xF4)
+				hi = 0x8F;
+		} else {
+			break;
+		}
+
+		/* The second byte has a narrower range than the rest */
+		for (i = 1; i < n && off + i < len; i++) {
+			if (data[off + i] < lo || data[off + i] > hi)
+				return off;
+
+			lo = 0x80;
+			hi = 0xBF;
+		}
+
+		if (i < n) {
+			*truncated = true;
+			break;
+		}
+
+		off += n;
+	}
+
+	return off;
+}
@@ -0,0 +1,19 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 The NetSurf Project.
+ */
+
+#ifndef hubbub_utils_utf8_h_
+#define hubbub_utils_utf8_h_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+/** Find the length of the valid UTF-8 prefix of some data */
+size_t hubbub_utf8_valid_length(const uint8_t *data, size_t len,
+		bool *truncated);
+
+#endif
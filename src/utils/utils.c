@@ -2,6 +2,8 @@
 #include <string.h>
 #include "utils.h"
 
+/* An embedder may point these elsewhere. They are read on every allocation
+ * without a lock, so may only be changed while no parser exists. */
 custom_m_alloc my_m_alloc = malloc;
 custom_re_alloc my_re_alloc = realloc;
 custom_c_alloc my_c_alloc = calloc;
@@ -30,3 +32,15 @@ void f_ree(void *ptr)
 {
   my_f_ree(ptr);
 }
+
+void *hubbub_default_alloc(void *ptr, size_t len, void *pw)
+{
+  (void) pw;
+
+  if (len == 0) {
+    f_ree(ptr);
+    return NULL;
+  }
+
+  return re_alloc(ptr, len);
+}
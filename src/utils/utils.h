@@ -56,4 +56,7 @@ void f_ree(void *ptr);
 
 #endif
 
+/* Default allocation function, used when the client supplies none */
+void *hubbub_default_alloc(void *ptr, size_t len, void *pw);
+
 #endif
@@ -0,0 +1,207 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <hubbub/hubbub.h>
+
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+/* Summary of a token stream: its length and a hash of its content */
+typedef struct digest {
+	uint32_t tokens;
+	uint32_t hash;
+} digest;
+
+static void digest_bytes(digest *d, const uint8_t *data, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		d->hash ^= data[i];
+		d->hash *= 16777619;
+	}
+}
+
+static void digest_string(digest *d, const hubbub_string *str)
+{
+	uint8_t len = (uint8_t) str->len;
+
+	digest_bytes(d, &len, 1);
+	digest_bytes(d, str->ptr, str->len);
+}
+
+static void digest_token(digest *d, const hubbub_token *token)
+{
+	uint8_t type = (uint8_t) token->type;
+	uint32_t i;
+
+	d->tokens++;
+	digest_bytes(d, &type, 1);
+
+	switch (token->type) {
+	case HUBBUB_TOKEN_DOCTYPE:
+		digest_string(d, &token->data.doctype.name);
+		if (token->data.doctype.public_missing == false)
+			digest_string(d, &token->data.doctype.public_id);
+		if (token->data.doctype.system_missing == false)
+			digest_string(d, &token->data.doctype.system_id);
+		break;
+	case HUBBUB_TOKEN_START_TAG:
+	case HUBBUB_TOKEN_END_TAG:
+		digest_string(d, &token->data.tag.name);
+		for (i = 0; i < token->data.tag.n_attributes; i++) {
+			digest_string(d, &token->data.tag.attributes[i].name);
+			digest_string(d, &token->data.tag.attributes[i].value);
+		}
+		break;
+	case HUBBUB_TOKEN_COMMENT:
+		digest_string(d, &token->data.comment);
+		break;
+	case HUBBUB_TOKEN_CHARACTER:
+		digest_string(d, &token->data.character);
+		break;
+	case HUBBUB_TOKEN_EOF:
+		break;
+	}
+}
+
+/* Parser whose content model the handlers switch after start tags, as a
+ * treebuilder would, or NULL to leave it alone */
+static hubbub_parser *switching;
+
+static void switch_model(const hubbub_token *token)
+{
+	hubbub_parser_optparams params;
+
+	if (switching == NULL || token->type != HUBBUB_TOKEN_START_TAG)
+		return;
+
+	params.content_model.model = hubbub_parser_content_model_for(
+			&token->data.tag, false);
+	assert(hubbub_parser_setopt(switching, HUBBUB_PARSER_CONTENT_MODEL,
+			&params) == HUBBUB_OK);
+}
+
+static hubbub_error token_handler(const hubbub_token *token, void *pw)
+{
+	digest_token((digest *) pw, token);
+	switch_model(token);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error batch_handler(const hubbub_token *tokens,
+		size_t n_tokens, void *pw)
+{
+	size_t i;
+
+	assert(n_tokens > 0);
+
+	for (i = 0; i < n_tokens; i++)
+		digest_token((digest *) pw, &tokens[i]);
+
+	/* Only the last token may be one which changes the content model */
+	for (i = 0; i + 1 < n_tokens; i++) {
+		assert(tokens[i].type != HUBBUB_TOKEN_START_TAG ||
+				hubbub_parser_content_model_for(
+				&tokens[i].data.tag, true) ==
+				HUBBUB_CONTENT_MODEL_PCDATA);
+	}
+
+	switch_model(&tokens[n_tokens - 1]);
+
+	return HUBBUB_OK;
+}
+
+static void run_parse(const uint8_t *data, size_t len, size_t chunk,
+		bool batched, bool switch_models, digest *d)
+{
+	hubbub_parser *parser;
+	hubbub_parser_optparams params;
+	size_t off;
+
+	d->tokens = 0;
+	d->hash = 2166136261u;
+
+	assert(hubbub_parser_create("UTF-8", false, &parser) == HUBBUB_OK);
+	switching = switch_models ? parser : NULL;
+
+	if (batched) {
+		params.token_batch_handler.handler = batch_handler;
+		params.token_batch_handler.pw = d;
+		assert(hubbub_parser_setopt(parser,
+				HUBBUB_PARSER_TOKEN_BATCH_HANDLER,
+				&params) == HUBBUB_OK);
+	} else {
+		params.token_handler.handler = token_handler;
+		params.token_handler.pw = d;
+		assert(hubbub_parser_setopt(parser,
+				HUBBUB_PARSER_TOKEN_HANDLER,
+				&params) == HUBBUB_OK);
+	}
+
+	for (off = 0; off < len; off += chunk) {
+		assert(hubbub_parser_parse_chunk(parser, data + off,
+				min(chunk, len - off)) == HUBBUB_OK);
+	}
+
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	hubbub_parser_destroy(parser);
+}
+
+int main(int argc, char **argv)
+{
+	static const size_t chunks[] = { 1, 7, 100, 4096, 65536 };
+	FILE *fp;
+	size_t len, i, j;
+	uint8_t *buf;
+	digest expected, got;
+
+	if (argc != 2) {
+		printf("Usage: %s <filename>\n", argv[0]);
+		return 1;
+	}
+
+	fp = fopen(argv[1], "rb");
+	if (fp == NULL) {
+		printf("Failed opening %s\n", argv[1]);
+		return 1;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	buf = malloc(len);
+	assert(buf != NULL);
+	assert(fread(buf, 1, len, fp) == len);
+
+	fclose(fp);
+
+	/* Batched delivery must produce exactly the same token stream, even
+	 * when the handler switches the content model */
+	for (i = 0; i < N_ELEMENTS(chunks); i++) {
+		for (j = 0; j < 2; j++) {
+			run_parse(buf, len, chunks[i], false, j, &expected);
+			run_parse(buf, len, chunks[i], true, j, &got);
+
+			printf("%u tokens in chunks of %u%s\n", got.tokens,
+					(unsigned int) chunks[i],
+					j ? ", switching content models" : "");
+
+			assert(got.tokens == expected.tokens);
+			assert(got.hash == expected.hash);
+		}
+	}
+
+	free(buf);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,189 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+/* Summary of a token stream: its length and a hash of its content */
+typedef struct digest {
+	uint32_t tokens;
+	uint32_t hash;
+} digest;
+
+static void digest_bytes(digest *d, const uint8_t *data, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		d->hash ^= data[i];
+		d->hash *= 16777619;
+	}
+}
+
+static void digest_string(digest *d, const hubbub_string *str)
+{
+	uint8_t len = (uint8_t) str->len;
+
+	digest_bytes(d, &len, 1);
+	digest_bytes(d, str->ptr, str->len);
+}
+
+static hubbub_error token_handler(const hubbub_token *token, void *pw)
+{
+	digest *d = (digest *) pw;
+	uint8_t type = (uint8_t) token->type;
+	uint32_t i;
+
+	d->tokens++;
+	digest_bytes(d, &type, 1);
+
+	switch (token->type) {
+	case HUBBUB_TOKEN_DOCTYPE:
+		digest_string(d, &token->data.doctype.name);
+		if (token->data.doctype.public_missing == false)
+			digest_string(d, &token->data.doctype.public_id);
+		if (token->data.doctype.system_missing == false)
+			digest_string(d, &token->data.doctype.system_id);
+		break;
+	case HUBBUB_TOKEN_START_TAG:
+	case HUBBUB_TOKEN_END_TAG:
+		digest_string(d, &token->data.tag.name);
+		for (i = 0; i < token->data.tag.n_attributes; i++) {
+			digest_string(d, &token->data.tag.attributes[i].name);
+			digest_string(d, &token->data.tag.attributes[i].value);
+		}
+		break;
+	case HUBBUB_TOKEN_COMMENT:
+		digest_string(d, &token->data.comment);
+		break;
+	case HUBBUB_TOKEN_CHARACTER:
+		digest_string(d, &token->data.character);
+		break;
+	case HUBBUB_TOKEN_EOF:
+		break;
+	}
+
+	return HUBBUB_OK;
+}
+
+/* How the input is passed to the parser */
+typedef enum input_mode {
+	COPIED,		/* Copied into the input stream */
+	BORROWED,	/* Read in place */
+	SCATTERED	/* Lent, but each chunk in a buffer of its own */
+} input_mode;
+
+static void run_parse(const uint8_t *data, size_t len, size_t chunk,
+		input_mode mode, digest *d)
+{
+	hubbub_parser *parser;
+	hubbub_parser_optparams params;
+	uint8_t **copies = NULL;
+	size_t off, n = 0;
+
+	d->tokens = 0;
+	d->hash = 2166136261u;
+
+	assert(hubbub_parser_create("UTF-8", false, &parser) == HUBBUB_OK);
+
+	params.token_handler.handler = token_handler;
+	params.token_handler.pw = d;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TOKEN_HANDLER,
+			&params) == HUBBUB_OK);
+
+	params.borrow_input = (mode != COPIED);
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_BORROW_INPUT,
+			&params) == HUBBUB_OK);
+
+	if (mode == SCATTERED) {
+		copies = calloc(len / chunk + 1, sizeof(uint8_t *));
+		assert(copies != NULL);
+	}
+
+	for (off = 0; off < len; off += chunk) {
+		const uint8_t *ptr = data + off;
+		size_t clen = min(chunk, len - off);
+
+		if (mode == SCATTERED) {
+			copies[n] = malloc(clen);
+			assert(copies[n] != NULL);
+			memcpy(copies[n], ptr, clen);
+			ptr = copies[n++];
+		}
+
+		assert(hubbub_parser_parse_chunk(parser, ptr, clen) ==
+				HUBBUB_OK);
+	}
+
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	/* Borrowing cannot start part way through a document */
+	params.borrow_input = true;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_BORROW_INPUT,
+			&params) == HUBBUB_INVALID);
+
+	hubbub_parser_destroy(parser);
+
+	while (n > 0)
+		free(copies[--n]);
+	free(copies);
+}
+
+int main(int argc, char **argv)
+{
+	static const size_t chunks[] = { 1, 7, 100, 4096, 65536 };
+	FILE *fp;
+	size_t len, i;
+	uint8_t *buf;
+	digest expected, got;
+
+	if (argc != 2) {
+		printf("Usage: %s <filename>\n", argv[0]);
+		return 1;
+	}
+
+	fp = fopen(argv[1], "rb");
+	if (fp == NULL) {
+		printf("Failed opening %s\n", argv[1]);
+		return 1;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	buf = malloc(len);
+	assert(buf != NULL);
+	assert(fread(buf, 1, len, fp) == len);
+
+	fclose(fp);
+
+	/* Borrowed input must produce exactly the same token stream */
+	for (i = 0; i < N_ELEMENTS(chunks); i++) {
+		run_parse(buf, len, chunks[i], COPIED, &expected);
+
+		run_parse(buf, len, chunks[i], BORROWED, &got);
+		assert(got.tokens == expected.tokens);
+		assert(got.hash == expected.hash);
+
+		run_parse(buf, len, chunks[i], SCATTERED, &got);
+		assert(got.tokens == expected.tokens);
+		assert(got.hash == expected.hash);
+
+		printf("%u tokens in chunks of %u\n", got.tokens,
+				(unsigned int) chunks[i]);
+	}
+
+	free(buf);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,181 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <hubbub/hubbub.h>
+
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+/* Summary of a token stream: its length and a hash of its content */
+typedef struct digest {
+	uint32_t tokens;
+	uint32_t hash;
+} digest;
+
+static void digest_bytes(digest *d, const uint8_t *data, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		d->hash ^= data[i];
+		d->hash *= 16777619;
+	}
+}
+
+static void digest_string(digest *d, const hubbub_string *str)
+{
+	digest_bytes(d, str->ptr, str->len);
+}
+
+static hubbub_error token_handler(const hubbub_token *token, void *pw)
+{
+	digest *d = (digest *) pw;
+	uint8_t type = (uint8_t) token->type;
+	uint32_t i;
+
+	/* Character data may be split differently, so is digested as a
+	 * stream of bytes, and not counted as tokens */
+	if (token->type == HUBBUB_TOKEN_CHARACTER) {
+		digest_string(d, &token->data.character);
+		return HUBBUB_OK;
+	}
+
+	d->tokens++;
+	digest_bytes(d, &type, 1);
+
+	switch (token->type) {
+	case HUBBUB_TOKEN_DOCTYPE:
+		digest_string(d, &token->data.doctype.name);
+		break;
+	case HUBBUB_TOKEN_START_TAG:
+	case HUBBUB_TOKEN_END_TAG:
+		digest_string(d, &token->data.tag.name);
+		for (i = 0; i < token->data.tag.n_attributes; i++) {
+			digest_string(d, &token->data.tag.attributes[i].name);
+			digest_string(d, &token->data.tag.attributes[i].value);
+		}
+		break;
+	case HUBBUB_TOKEN_COMMENT:
+		digest_string(d, &token->data.comment);
+		break;
+	case HUBBUB_TOKEN_CHARACTER:
+	case HUBBUB_TOKEN_EOF:
+		break;
+	}
+
+	return HUBBUB_OK;
+}
+
+/* Parse a document in chunks, resuming whenever the budget runs out */
+static uint32_t run_parse(const uint8_t *data, size_t len, size_t chunk,
+		uint32_t budget, digest *d)
+{
+	hubbub_parser *parser;
+	hubbub_parser_optparams params;
+	hubbub_error error;
+	uint32_t yields = 0;
+	size_t off;
+
+	d->tokens = 0;
+	d->hash = 2166136261u;
+
+	assert(hubbub_parser_create("UTF-8", false, &parser) == HUBBUB_OK);
+
+	params.token_handler.handler = token_handler;
+	params.token_handler.pw = d;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TOKEN_HANDLER,
+			&params) == HUBBUB_OK);
+
+	params.work_budget = budget;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_WORK_BUDGET,
+			&params) == HUBBUB_OK);
+
+	for (off = 0; off < len; off += chunk) {
+		error = hubbub_parser_parse_chunk(parser, data + off,
+				min(chunk, len - off));
+
+		while (error == HUBBUB_YIELDED) {
+			yields++;
+			error = hubbub_parser_resume(parser);
+		}
+
+		assert(error == HUBBUB_OK);
+	}
+
+	error = hubbub_parser_completed(parser);
+
+	while (error == HUBBUB_YIELDED) {
+		yields++;
+		error = hubbub_parser_resume(parser);
+	}
+
+	assert(error == HUBBUB_OK);
+
+	hubbub_parser_destroy(parser);
+
+	return yields;
+}
+
+int main(int argc, char **argv)
+{
+	static const size_t chunks[] = { 1, 100, 65536 };
+	static const uint32_t budgets[] = { 1, 7, 512 };
+	FILE *fp;
+	size_t len, i, j;
+	uint8_t *buf;
+	digest expected, got;
+	uint32_t yields;
+
+	if (argc != 2) {
+		printf("Usage: %s <filename>\n", argv[0]);
+		return 1;
+	}
+
+	fp = fopen(argv[1], "rb");
+	if (fp == NULL) {
+		printf("Failed opening %s\n", argv[1]);
+		return 1;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	buf = malloc(len);
+	assert(buf != NULL);
+	assert(fread(buf, 1, len, fp) == len);
+
+	fclose(fp);
+
+	/* Yielding and resuming must not change the token stream */
+	for (i = 0; i < N_ELEMENTS(chunks); i++) {
+		assert(run_parse(buf, len, chunks[i], 0, &expected) == 0);
+
+		for (j = 0; j < N_ELEMENTS(budgets); j++) {
+			yields = run_parse(buf, len, chunks[i], budgets[j],
+					&got);
+
+			printf("%u yields with budget %u in chunks of %u\n",
+					yields, budgets[j],
+					(unsigned int) chunks[i]);
+
+			/* Each call reads at least the budget, if it can */
+			assert(yields <= len / budgets[j] + 1);
+			if (chunks[i] > budgets[j] * 4 && len > chunks[i])
+				assert(yields > 0);
+
+			assert(got.tokens == expected.tokens);
+			assert(got.hash == expected.hash);
+		}
+	}
+
+	free(buf);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,151 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+#include <hubbub/dom.h>
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+#define DEPTH 1000
+#define VALUE 20000
+
+/* Calls made to the parser's allocator */
+static int calls;
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	calls++;
+
+	if (len == 0) {
+		free(ptr);
+		return NULL;
+	}
+
+	return realloc(ptr, len);
+}
+
+static uint8_t *make_document(size_t *len)
+{
+	static const char open[] = "<div>";
+	/* The reference moves the value out of the input, into the buffer */
+	static const char attr[] = "<p title='&amp;";
+	uint8_t *doc, *p;
+	size_t i;
+
+	*len = DEPTH * SLEN(open) + SLEN(attr) + VALUE + 2;
+
+	doc = p = malloc(*len);
+	assert(doc != NULL);
+
+	for (i = 0; i < DEPTH; i++, p += SLEN(open))
+		memcpy(p, open, SLEN(open));
+
+	memcpy(p, attr, SLEN(attr));
+	p += SLEN(attr);
+	memset(p, 'x', VALUE);
+	p += VALUE;
+	memcpy(p, "'>", 2);
+
+	return doc;
+}
+
+/* Parse twice, resetting in between; return the allocator calls made */
+static int parse(hubbub_parser *parser, hubbub_dom *dom,
+		const uint8_t *doc, size_t len)
+{
+	int before = calls;
+	int pass;
+
+	for (pass = 0; pass < 2; pass++) {
+		assert(hubbub_parser_reset(parser, NULL, false) == HUBBUB_OK);
+		assert(hubbub_dom_reset(dom) == HUBBUB_OK);
+		assert(hubbub_dom_attach(dom, parser) == HUBBUB_OK);
+
+		assert(hubbub_parser_parse_chunk(parser, doc, len) ==
+				HUBBUB_OK);
+		assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+	}
+
+	return calls - before;
+}
+
+int main(int argc, char **argv)
+{
+	hubbub_parser_optparams params;
+	hubbub_parser *parser, *sized;
+	hubbub_buffer_sizes sizes;
+	int unsized_calls, sized_calls;
+	hubbub_dom *dom;
+	uint8_t *doc;
+	size_t len;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	doc = make_document(&len);
+
+	assert(hubbub_dom_create(NULL, NULL, &dom) == HUBBUB_OK);
+
+	assert(hubbub_parser_create_with_allocator(NULL, false,
+			myrealloc, NULL, &parser) == HUBBUB_OK);
+
+	assert(hubbub_parser_read_buffer_sizes(NULL, &sizes) ==
+			HUBBUB_BADPARM);
+	assert(hubbub_parser_read_buffer_sizes(parser, NULL) ==
+			HUBBUB_BADPARM);
+
+	/* Nothing is open before a document is parsed */
+	assert(hubbub_parser_read_buffer_sizes(parser, &sizes) == HUBBUB_OK);
+	assert(sizes.depth == 0);
+
+	/* The sizes needed are learnt from the document ... */
+	unsized_calls = parse(parser, dom, doc, len);
+
+	assert(hubbub_parser_read_buffer_sizes(parser, &sizes) == HUBBUB_OK);
+	assert(sizes.text >= VALUE);
+	assert(sizes.depth >= DEPTH + 2);	/* html, body and the divs */
+
+	/* ... and survive a reset */
+	assert(hubbub_parser_reset(parser, NULL, false) == HUBBUB_OK);
+	assert(hubbub_parser_read_buffer_sizes(parser, &sizes) == HUBBUB_OK);
+	assert(sizes.depth >= DEPTH + 2);
+
+	/* A parser given them up front needs fewer allocations, and keeps
+	 * the room it was given across resets */
+	assert(hubbub_parser_create_with_allocator(NULL, false,
+			myrealloc, NULL, &sized) == HUBBUB_OK);
+
+	params.buffer_sizes = sizes;
+	assert(hubbub_parser_setopt(sized, HUBBUB_PARSER_BUFFER_SIZES,
+			&params) == HUBBUB_OK);
+
+	sized_calls = parse(sized, dom, doc, len);
+	assert(sized_calls < unsized_calls);
+
+	printf("allocator calls: %d unsized, %d sized\n",
+			unsized_calls, sized_calls);
+
+	/* The room only grows */
+	params.buffer_sizes.text = 0;
+	params.buffer_sizes.depth = 0;
+	assert(hubbub_parser_setopt(sized, HUBBUB_PARSER_BUFFER_SIZES,
+			&params) == HUBBUB_OK);
+	assert(hubbub_parser_read_buffer_sizes(sized, &sizes) == HUBBUB_OK);
+	assert(sizes.text >= VALUE);
+
+	hubbub_parser_destroy(sized);
+	hubbub_parser_destroy(parser);
+	hubbub_dom_destroy(dom);
+	free(doc);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+#include <hubbub/dom.h>
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+typedef struct checkpoint_test {
+	const char *prefix;	/* Document up to the checkpoint */
+	const char *rest[4];	/* Ways the document may continue */
+} checkpoint_test;
+
+static const checkpoint_test tests[] = {
+	/* Open elements and active formatting elements */
+	{ "<!DOCTYPE html><html><head><title>T</title></head>"
+			"<body><div class=a><p>Hello <b>",
+		{ "world</b></p></div>", "a<p>b</b>c", "<i>x</p>y",
+				"" } },
+	/* A content model other than PCDATA */
+	{ "<p>a<textarea>", { "<b></textarea>c", "x", "</p>", "" } },
+	/* Text inserted in the foster parent */
+	{ "<table><tr><td>a</td></tr>", { "b<tr>", "</table>c",
+			"<b>x</table>y", "" } },
+	/* Quirks mode, set by the missing doctype */
+	{ "<p><table>", { "<p>a", "", NULL, NULL } }
+};
+
+static char got[1024];
+
+static void print(const hubbub_dom *dom, hubbub_dom_index index)
+{
+	const hubbub_dom_node *node = hubbub_dom_get_node(dom, index);
+	hubbub_dom_index child;
+	size_t len = strlen(got);
+
+	assert(len + node->data.len + 4 < sizeof(got));
+
+	if (node->type == HUBBUB_DOM_NODE_ELEMENT)
+		strcat(got, "<");
+
+	strncat(got, (const char *) hubbub_dom_get_string(dom, node->data),
+			node->data.len);
+
+	if (node->type != HUBBUB_DOM_NODE_ELEMENT &&
+			node->type != HUBBUB_DOM_NODE_DOCUMENT)
+		return;
+
+	if (node->type == HUBBUB_DOM_NODE_ELEMENT)
+		strcat(got, ">");
+
+	for (child = node->first_child; child != HUBBUB_DOM_NONE;
+			child = hubbub_dom_get_node(dom, child)->next)
+		print(dom, child);
+
+	if (node->type != HUBBUB_DOM_NODE_ELEMENT)
+		return;
+
+	len = strlen(got);
+	assert(len + node->data.len + 4 < sizeof(got));
+
+	strcat(got, "</");
+	strncat(got, (const char *) hubbub_dom_get_string(dom, node->data),
+			node->data.len);
+	strcat(got, ">");
+}
+
+static void parse(hubbub_parser *parser, const char *data)
+{
+	assert(hubbub_parser_parse_chunk(parser, (const uint8_t *) data,
+			strlen(data)) == HUBBUB_OK);
+}
+
+static void serialise(const hubbub_dom *dom)
+{
+	got[0] = '\0';
+	print(dom, HUBBUB_DOM_DOCUMENT);
+
+	/* The quirks mode is restored, too */
+	strcat(got, hubbub_dom_quirks_mode(dom) == HUBBUB_QUIRKS_MODE_NONE ?
+			"" : " (quirks)");
+}
+
+static void run_test(const checkpoint_test *test, hubbub_parser *resumed)
+{
+	char expected[sizeof(got)], document[256];
+	hubbub_dom *prefix, *dom;
+	hubbub_checkpoint *cp;
+	hubbub_parser *parser;
+	size_t i;
+
+	assert(hubbub_dom_create(NULL, NULL, &prefix) == HUBBUB_OK);
+	assert(hubbub_dom_create(NULL, NULL, &dom) == HUBBUB_OK);
+
+	assert(hubbub_parser_create("UTF-8", false, &parser) == HUBBUB_OK);
+	assert(hubbub_dom_attach(prefix, parser) == HUBBUB_OK);
+	parse(parser, test->prefix);
+	assert(hubbub_parser_checkpoint(parser, &cp) == HUBBUB_OK);
+	assert(hubbub_checkpoint_read_offset(cp) == strlen(test->prefix));
+
+	/* The state outlives the parser which recorded it */
+	hubbub_parser_destroy(parser);
+
+	for (i = 0; i < N_ELEMENTS(test->rest) && test->rest[i] != NULL;
+			i++) {
+		assert(strlen(test->prefix) + strlen(test->rest[i]) <
+				sizeof(document));
+		strcpy(document, test->prefix);
+		strcat(document, test->rest[i]);
+
+		/* Parsed whole */
+		assert(hubbub_parser_reset(resumed, "UTF-8", false) ==
+				HUBBUB_OK);
+		assert(hubbub_dom_reset(dom) == HUBBUB_OK);
+		assert(hubbub_dom_attach(dom, resumed) == HUBBUB_OK);
+		parse(resumed, document);
+		assert(hubbub_parser_completed(resumed) == HUBBUB_OK);
+		serialise(dom);
+		strcpy(expected, got);
+
+		/* Resumed from the checkpoint, in a copy of its tree */
+		assert(hubbub_parser_reset(resumed, "UTF-8", false) ==
+				HUBBUB_OK);
+		assert(hubbub_dom_copy(dom, prefix) == HUBBUB_OK);
+		assert(hubbub_dom_attach(dom, resumed) == HUBBUB_OK);
+		assert(hubbub_parser_restore(resumed, cp) == HUBBUB_OK);
+		parse(resumed, test->rest[i]);
+		assert(hubbub_parser_completed(resumed) == HUBBUB_OK);
+		serialise(dom);
+
+		printf("%s -> %s\n", document, got);
+		assert(strcmp(got, expected) == 0);
+	}
+
+	/* Restoring needs an empty parser of the same kind */
+	assert(hubbub_parser_create_for_tokens("UTF-8", false, NULL, NULL,
+			&parser) == HUBBUB_OK);
+	assert(hubbub_parser_restore(parser, cp) == HUBBUB_INVALID);
+	hubbub_parser_destroy(parser);
+
+	hubbub_checkpoint_destroy(cp);
+
+	assert(hubbub_parser_reset(resumed, "UTF-8", false) == HUBBUB_OK);
+	hubbub_dom_destroy(dom);
+	hubbub_dom_destroy(prefix);
+}
+
+static hubbub_parser *token_parser;
+
+static hubbub_error token_handler(const hubbub_token *token, void *pw)
+{
+	hubbub_parser_optparams params;
+	char *out = pw;
+
+	switch (token->type) {
+	case HUBBUB_TOKEN_START_TAG:
+		strcat(out, "S:");
+		strncat(out, (const char *) token->data.tag.name.ptr,
+				token->data.tag.name.len);
+		params.content_model.model = hubbub_parser_content_model_for(
+				&token->data.tag, true);
+		assert(hubbub_parser_setopt(token_parser,
+				HUBBUB_PARSER_CONTENT_MODEL,
+				&params) == HUBBUB_OK);
+		break;
+	case HUBBUB_TOKEN_END_TAG:
+		strcat(out, "E:");
+		strncat(out, (const char *) token->data.tag.name.ptr,
+				token->data.tag.name.len);
+		break;
+	case HUBBUB_TOKEN_CHARACTER:
+		strcat(out, "C:");
+		strncat(out, (const char *) token->data.character.ptr,
+				token->data.character.len);
+		break;
+	default:
+		break;
+	}
+
+	strcat(out, " ");
+
+	return HUBBUB_OK;
+}
+
+static hubbub_parser *create_token_parser(char *out)
+{
+	hubbub_parser_optparams params;
+
+	assert(hubbub_parser_create_for_tokens("UTF-8", false, NULL, NULL,
+			&token_parser) == HUBBUB_OK);
+
+	params.token_handler.handler = token_handler;
+	params.token_handler.pw = out;
+	assert(hubbub_parser_setopt(token_parser, HUBBUB_PARSER_TOKEN_HANDLER,
+			&params) == HUBBUB_OK);
+
+	params.coalesce_characters = true;
+	assert(hubbub_parser_setopt(token_parser,
+			HUBBUB_PARSER_COALESCE_CHARACTERS,
+			&params) == HUBBUB_OK);
+
+	out[0] = '\0';
+
+	return token_parser;
+}
+
+static void test_tokens(void)
+{
+	char expected[256], resumed[256];
+	hubbub_checkpoint *cp;
+	hubbub_parser *parser;
+
+	/* The content model selected by the client is part of the state */
+	parser = create_token_parser(expected);
+	parse(parser, "<p><title>a<b></title>c");
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+	hubbub_parser_destroy(parser);
+
+	parser = create_token_parser(resumed);
+	parse(parser, "<p><title>");
+	assert(hubbub_parser_checkpoint(parser, &cp) == HUBBUB_OK);
+	hubbub_parser_destroy(parser);
+
+	parser = create_token_parser(resumed);
+	strcpy(resumed, "S:p S:title ");
+	assert(hubbub_parser_restore(parser, cp) == HUBBUB_OK);
+	parse(parser, "a<b></title>c");
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+	hubbub_parser_destroy(parser);
+
+	printf("tokens: %s\n", resumed);
+	assert(strcmp(resumed, expected) == 0);
+
+	hubbub_checkpoint_destroy(cp);
+
+	/* No state is recorded part way through a token */
+	parser = create_token_parser(resumed);
+	parse(parser, "<p cl");
+	assert(hubbub_parser_checkpoint(parser, &cp) == HUBBUB_INVALID);
+	parse(parser, "ass=a>");
+	assert(hubbub_parser_checkpoint(parser, &cp) == HUBBUB_OK);
+	hubbub_checkpoint_destroy(cp);
+
+	/* Nor once the document is complete */
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+	assert(hubbub_parser_checkpoint(parser, &cp) == HUBBUB_INVALID);
+	hubbub_parser_destroy(parser);
+
+	/* Nor part way through a character, which would be lost on
+	 * resuming after it */
+	parser = create_token_parser(expected);
+	parse(parser, "\xc3\xa9<p>x");
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+	hubbub_parser_destroy(parser);
+
+	parser = create_token_parser(resumed);
+	parse(parser, "\xc3");
+	assert(hubbub_parser_checkpoint(parser, &cp) == HUBBUB_INVALID);
+	parse(parser, "\xa9<p>");
+	assert(hubbub_parser_checkpoint(parser, &cp) == HUBBUB_OK);
+	assert(hubbub_checkpoint_read_offset(cp) == SLEN("\xc3\xa9<p>"));
+	hubbub_parser_destroy(parser);
+
+	parser = create_token_parser(resumed);
+	strcpy(resumed, "C:\xc3\xa9 S:p ");
+	assert(hubbub_parser_restore(parser, cp) == HUBBUB_OK);
+	parse(parser, "x");
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+	hubbub_parser_destroy(parser);
+
+	printf("character: %s\n", resumed);
+	assert(strcmp(resumed, expected) == 0);
+
+	hubbub_checkpoint_destroy(cp);
+}
+
+int main(int argc, char **argv)
+{
+	hubbub_parser *parser;
+	size_t i;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	/* One parser resumes from every checkpoint in turn */
+	assert(hubbub_parser_create("UTF-8", false, &parser) == HUBBUB_OK);
+
+	for (i = 0; i < N_ELEMENTS(tests); i++)
+		run_test(&tests[i], parser);
+
+	hubbub_parser_destroy(parser);
+
+	test_tokens();
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -3,9 +3,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 #include <parserutils/charset/mibenum.h>
 
+#include <hubbub/charset.h>
 #include <hubbub/hubbub.h>
 
 #include "charset/detect.h"
@@ -24,6 +26,8 @@ typedef struct line_ctx {
 
 static bool handle_line(const char *data, size_t datalen, void *pw);
 static void run_test(const uint8_t *data, size_t len, char *expected);
+static void test_window(void);
+static void test_sniff(void);
 
 int main(int argc, char **argv)
 {
@@ -59,6 +63,9 @@ int main(int argc, char **argv)
 
 	run_test(ctx.buf, ctx.bufused, ctx.enc);
 
+	test_window();
+	test_sniff();
+
 	free(ctx.buf);
 
 	printf("PASS\n");
@@ -105,6 +112,8 @@ void run_test(const uint8_t *data, size_t len, char *expected)
 {
 	uint16_t mibenum = 0;
 	hubbub_charset_source source = HUBBUB_CHARSET_UNKNOWN;
+	hubbub_charset_source sniffed;
+	const char *charset;
 	static int testnum;
 
 	assert(hubbub_charset_extract(data, len,
@@ -120,4 +129,64 @@ void run_test(const uint8_t *data, size_t len, char *expected)
 
 	assert(mibenum == parserutils_charset_mibenum_from_name(
 			expected, strlen(expected)));
+
+	/* Sniffing without a Content-Type must agree */
+	assert(hubbub_charset_sniff(data, len, NULL, 0, false,
+			&charset, &sniffed) == HUBBUB_OK);
+	assert(parserutils_charset_mibenum_from_name(charset,
+			strlen(charset)) == mibenum);
+	assert(sniffed == source);
+}
+
+/* A meta charset is only found if it starts within the prescan window */
+void test_window(void)
+{
+	static const char meta[] = "<meta charset=\"utf-8\">";
+	uint8_t buf[1024];
+	uint16_t utf8 = parserutils_charset_mibenum_from_name("UTF-8",
+			SLEN("UTF-8"));
+
+	memset(buf, ' ', sizeof(buf));
+	memcpy(buf + 600, meta, SLEN(meta));
+
+	assert(hubbub_charset_scan_meta(buf, sizeof(buf), 512) == 0);
+	assert(hubbub_charset_scan_meta(buf, sizeof(buf), 1024) == utf8);
+}
+
+/* Sources of encoding information take precedence in the spec's order */
+void test_sniff(void)
+{
+	static const uint8_t bom[] = "\xEF\xBB\xBF<meta charset=koi8-r>";
+	static const uint8_t meta[] = "<meta charset=koi8-r>";
+	hubbub_charset_source source;
+	const char *charset;
+
+	assert(hubbub_charset_sniff(bom, SLEN(bom), "text/html; charset=gbk",
+			0, false, &charset, &source) == HUBBUB_OK);
+	assert(strcasecmp(charset, "UTF-8") == 0);
+	assert(source == HUBBUB_CHARSET_CONFIDENT);
+
+	assert(hubbub_charset_sniff(meta, SLEN(meta),
+			"text/html; charset=ISO-8859-1", 0, false,
+			&charset, &source) == HUBBUB_OK);
+	assert(strcasecmp(charset, "ISO-8859-1") == 0);
+	assert(source == HUBBUB_CHARSET_CONFIDENT);
+
+	assert(hubbub_charset_sniff(meta, SLEN(meta),
+			"text/html; charset=ISO-8859-1", 0, true,
+			&charset, &source) == HUBBUB_OK);
+	assert(strcasecmp(charset, "Windows-1252") == 0);
+
+	assert(hubbub_charset_sniff(meta, SLEN(meta), "text/html", 0, false,
+			&charset, &source) == HUBBUB_OK);
+	assert(strcasecmp(charset, "KOI8-R") == 0);
+	assert(source == HUBBUB_CHARSET_TENTATIVE);
+
+	assert(hubbub_charset_sniff(NULL, 0, NULL, 0, false,
+			&charset, &source) == HUBBUB_OK);
+	assert(strcasecmp(charset, "Windows-1252") == 0);
+	assert(source == HUBBUB_CHARSET_TENTATIVE);
+
+	assert(hubbub_charset_sniff(meta, SLEN(meta), NULL, 0, false,
+			NULL, &source) == HUBBUB_BADPARM);
 }
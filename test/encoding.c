@@ -0,0 +1,347 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <hubbub/hubbub.h>
+
+#include <hubbub/parser.h>
+#include <hubbub/tree.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+/* State shared with the tree handler */
+typedef struct context {
+	hubbub_parser *parser;
+	uintptr_t nodes;	/* Number of nodes created */
+	uint32_t changes;	/* Number of encoding changes requested */
+} context;
+
+static hubbub_error new_node(void *ctx, void **result)
+{
+	*result = (void *) ++((context *) ctx)->nodes;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error create_comment(void *ctx, const hubbub_string *data,
+		void **result)
+{
+	UNUSED(data);
+
+	return new_node(ctx, result);
+}
+
+static hubbub_error create_doctype(void *ctx, const hubbub_doctype *doctype,
+		void **result)
+{
+	UNUSED(doctype);
+
+	return new_node(ctx, result);
+}
+
+static hubbub_error create_element(void *ctx, const hubbub_tag *tag,
+		void **result)
+{
+	UNUSED(tag);
+
+	return new_node(ctx, result);
+}
+
+static hubbub_error create_text(void *ctx, const hubbub_string *data,
+		void **result)
+{
+	UNUSED(data);
+
+	return new_node(ctx, result);
+}
+
+static hubbub_error ref_node(void *ctx, void *node)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error append_child(void *ctx, void *parent, void *child,
+		void **result)
+{
+	UNUSED(ctx);
+	UNUSED(parent);
+
+	*result = child;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error insert_before(void *ctx, void *parent, void *child,
+		void *ref_child, void **result)
+{
+	UNUSED(ref_child);
+
+	return append_child(ctx, parent, child, result);
+}
+
+static hubbub_error clone_node(void *ctx, void *node, bool deep,
+		void **result)
+{
+	UNUSED(node);
+	UNUSED(deep);
+
+	return new_node(ctx, result);
+}
+
+static hubbub_error reparent_children(void *ctx, void *node,
+		void *new_parent)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+	UNUSED(new_parent);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error get_parent(void *ctx, void *node, bool element_only,
+		void **result)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+	UNUSED(element_only);
+
+	*result = NULL;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error has_children(void *ctx, void *node, bool *result)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+
+	*result = false;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error form_associate(void *ctx, void *form, void *node)
+{
+	UNUSED(ctx);
+	UNUSED(form);
+	UNUSED(node);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error add_attributes(void *ctx, void *node,
+		const hubbub_attribute *attributes, uint32_t n_attributes)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+	UNUSED(attributes);
+	UNUSED(n_attributes);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error set_quirks_mode(void *ctx, hubbub_quirks_mode mode)
+{
+	UNUSED(ctx);
+	UNUSED(mode);
+
+	return HUBBUB_OK;
+}
+
+/* Ask to start again, as a client does, if the encoding differs */
+static hubbub_error encoding_change(void *ctx, const char *encname)
+{
+	context *c = (context *) ctx;
+	hubbub_charset_source source;
+	const char *charset;
+
+	charset = hubbub_parser_read_charset(c->parser, &source);
+	if (strcasecmp(charset, encname) == 0)
+		return HUBBUB_OK;
+
+	c->changes++;
+
+	return HUBBUB_ENCODINGCHANGE;
+}
+
+static hubbub_error complete_script(void *ctx, void *script)
+{
+	UNUSED(ctx);
+	UNUSED(script);
+
+	return HUBBUB_OK;
+}
+
+static context ctx;
+
+static hubbub_tree_handler tree_handler = {
+	create_comment,
+	create_doctype,
+	create_element,
+	create_text,
+	ref_node,
+	ref_node,
+	append_child,
+	insert_before,
+	append_child,
+	clone_node,
+	reparent_children,
+	get_parent,
+	has_children,
+	form_associate,
+	add_attributes,
+	set_quirks_mode,
+	encoding_change,
+	complete_script,
+	&ctx,
+	0,
+	NULL
+};
+
+/* Parse a document in chunks, stopping if an encoding change is needed */
+static hubbub_error run_parse(const char *doc, size_t chunk, bool in_place)
+{
+	hubbub_parser_optparams params;
+	hubbub_error error = HUBBUB_OK;
+	size_t len = strlen(doc), off;
+
+	ctx.nodes = 0;
+	ctx.changes = 0;
+
+	assert(hubbub_parser_create(NULL, false, &ctx.parser) == HUBBUB_OK);
+
+	params.tree_handler = &tree_handler;
+	assert(hubbub_parser_setopt(ctx.parser, HUBBUB_PARSER_TREE_HANDLER,
+			&params) == HUBBUB_OK);
+
+	params.document_node = (void *) ++ctx.nodes;
+	assert(hubbub_parser_setopt(ctx.parser, HUBBUB_PARSER_DOCUMENT_NODE,
+			&params) == HUBBUB_OK);
+
+	params.change_encoding_in_place = in_place;
+	assert(hubbub_parser_setopt(ctx.parser,
+			HUBBUB_PARSER_CHANGE_ENCODING_IN_PLACE,
+			&params) == HUBBUB_OK);
+
+	for (off = 0; off < len && error == HUBBUB_OK; off += chunk) {
+		error = hubbub_parser_parse_chunk(ctx.parser,
+				(const uint8_t *) doc + off,
+				min(chunk, len - off));
+	}
+
+	if (error == HUBBUB_OK)
+		error = hubbub_parser_completed(ctx.parser);
+
+	return error;
+}
+
+int main(int argc, char **argv)
+{
+	static const size_t chunks[] = { 1, 7, 100, 4096 };
+	/* The meta lies beyond the prescan, so is only seen when parsing */
+	static const char padding[] = "<!--"
+	"                                                                "
+	"                                                                "
+	"                                                                "
+	"                                                                "
+	"                                                                "
+	"                                                                "
+	"                                                                "
+	"                                                                "
+	"                                                                "
+	"-->";
+	static const char ascii[] = "<html><head><title>Title</title>"
+			"<meta charset=\"windows-1251\"></head>"
+			"<body>\xcf\xf0\xe8\xe2\xe5\xf2</body></html>";
+	static const char latin[] = "<html><head><title>Caf\xe9</title>"
+			"<meta charset=\"windows-1251\"></head>"
+			"<body>\xcf\xf0\xe8\xe2\xe5\xf2</body></html>";
+	hubbub_parser_optparams params;
+	hubbub_charset_source source;
+	hubbub_parser_stats stats;
+	const char *charset;
+	char doc[1024];
+	size_t i;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	for (i = 0; i < N_ELEMENTS(chunks); i++) {
+		/* ASCII up to the meta reads the same in both encodings */
+		snprintf(doc, sizeof(doc), "%s%s", padding, ascii);
+
+		assert(run_parse(doc, chunks[i], true) == HUBBUB_OK);
+		assert(ctx.changes == 1);
+
+		assert(hubbub_parser_read_stats(ctx.parser, &stats) ==
+				HUBBUB_OK);
+		assert(stats.encoding_changes == 1);
+		assert(stats.restarts == 0);
+
+		charset = hubbub_parser_read_charset(ctx.parser, &source);
+		assert(strcasecmp(charset, "windows-1251") == 0);
+		assert(source == HUBBUB_CHARSET_CONFIDENT);
+
+		hubbub_parser_destroy(ctx.parser);
+
+		/* Otherwise, the client must start again */
+		assert(run_parse(doc, chunks[i], false) ==
+				HUBBUB_ENCODINGCHANGE);
+
+		/* Which is counted as part of the same document */
+		assert(hubbub_parser_reset(ctx.parser, "windows-1251",
+				false) == HUBBUB_OK);
+		params.document_node = (void *) ++ctx.nodes;
+		assert(hubbub_parser_setopt(ctx.parser,
+				HUBBUB_PARSER_DOCUMENT_NODE,
+				&params) == HUBBUB_OK);
+		assert(hubbub_parser_parse_chunk(ctx.parser,
+				(const uint8_t *) doc, strlen(doc)) ==
+				HUBBUB_OK);
+		assert(hubbub_parser_completed(ctx.parser) == HUBBUB_OK);
+
+		assert(hubbub_parser_read_stats(ctx.parser, &stats) ==
+				HUBBUB_OK);
+		assert(stats.encoding_changes == 0);
+		assert(stats.restarts == 1);
+
+		assert(hubbub_parser_reset(ctx.parser, NULL, false) ==
+				HUBBUB_OK);
+		assert(hubbub_parser_read_stats(ctx.parser, &stats) ==
+				HUBBUB_OK);
+		assert(stats.restarts == 0);
+
+		hubbub_parser_destroy(ctx.parser);
+
+		/* As it must if the meta follows text which may differ */
+		snprintf(doc, sizeof(doc), "%s%s", padding, latin);
+
+		assert(run_parse(doc, chunks[i], true) ==
+				HUBBUB_ENCODINGCHANGE);
+		hubbub_parser_destroy(ctx.parser);
+
+		printf("Chunks of %u: PASS\n", (unsigned int) chunks[i]);
+	}
+
+	/* The input must be followed from the start of the document */
+	assert(hubbub_parser_create(NULL, false, &ctx.parser) == HUBBUB_OK);
+	assert(hubbub_parser_parse_chunk(ctx.parser,
+			(const uint8_t *) "<html>", SLEN("<html>")) ==
+			HUBBUB_OK);
+	params.change_encoding_in_place = true;
+	assert(hubbub_parser_setopt(ctx.parser,
+			HUBBUB_PARSER_CHANGE_ENCODING_IN_PLACE,
+			&params) == HUBBUB_INVALID);
+	hubbub_parser_destroy(ctx.parser);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -31,6 +31,22 @@ int main(int argc, char **argv)
 	assert(hubbub_entities_search_step('z', &result, &context) ==
 			HUBBUB_INVALID);
 
+	/* NUL is never part of an entity name */
+	context = -1;
+
+	assert(hubbub_entities_search_step('a', &result, &context) ==
+			HUBBUB_NEEDDATA);
+
+	assert(hubbub_entities_search_step('m', &result, &context) ==
+			HUBBUB_NEEDDATA);
+
+	assert(hubbub_entities_search_step('p', &result, &context) ==
+			HUBBUB_OK);
+	assert(result == 0x26);
+
+	assert(hubbub_entities_search_step('\0', &result, &context) ==
+			HUBBUB_INVALID);
+
 	printf("PASS\n");
 
 	return 0;
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+#include <hubbub/dom.h>
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+static const char *const wanted[] = { "href", "id", "HREF", "" };
+
+/* Values which are not wanted are never collected, however they are
+ * written, and a tag may end in the middle of one */
+static const char document[] =
+	"<a HREF=\"x&amp;y\" onclick=\"f(&quot;\r\n)\" id=z data-x='1\0'"
+	" href=dup class>t</a><b title=&lt;=x><i id=\0 title=y>u<s title=";
+
+/* The attributes kept, less the duplicate */
+#define EXPECTED "href=x&y id=z id=\xef\xbf\xbd "
+
+/* Attributes seen, serialised */
+static char got[256];
+
+static hubbub_error token_handler(const hubbub_token *token, void *pw)
+{
+	const hubbub_tag *tag = &token->data.tag;
+	uint32_t i;
+
+	UNUSED(pw);
+
+	if (token->type != HUBBUB_TOKEN_START_TAG)
+		return HUBBUB_OK;
+
+	for (i = 0; i < tag->n_attributes; i++) {
+		assert(strlen(got) + tag->attributes[i].name.len +
+				tag->attributes[i].value.len + 3 <
+				sizeof(got));
+		strncat(got, (const char *) tag->attributes[i].name.ptr,
+				tag->attributes[i].name.len);
+		strcat(got, "=");
+		strncat(got, (const char *) tag->attributes[i].value.ptr,
+				tag->attributes[i].value.len);
+		strcat(got, " ");
+	}
+
+	return HUBBUB_OK;
+}
+
+static void parse_tokens(bool filter, bool borrow, size_t chunk,
+		uint32_t *dropped)
+{
+	hubbub_parser_optparams params;
+	hubbub_parser_stats stats;
+	hubbub_parser *parser;
+	size_t len = sizeof(document) - 1, off;
+
+	got[0] = '\0';
+
+	assert(hubbub_parser_create_for_tokens("UTF-8", false, NULL, NULL,
+			&parser) == HUBBUB_OK);
+
+	params.token_handler.handler = token_handler;
+	params.token_handler.pw = NULL;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TOKEN_HANDLER,
+			&params) == HUBBUB_OK);
+
+	params.borrow_input = borrow;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_BORROW_INPUT,
+			&params) == HUBBUB_OK);
+
+	params.attribute_filter.names = filter ? wanted : NULL;
+	params.attribute_filter.n_names = N_ELEMENTS(wanted);
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_ATTRIBUTE_FILTER,
+			&params) == HUBBUB_OK);
+
+	for (off = 0; off < len; off += chunk) {
+		assert(hubbub_parser_parse_chunk(parser,
+				(const uint8_t *) document + off,
+				min(chunk, len - off)) == HUBBUB_OK);
+	}
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	assert(hubbub_parser_read_stats(parser, &stats) == HUBBUB_OK);
+	*dropped = stats.attributes_dropped;
+
+	hubbub_parser_destroy(parser);
+}
+
+static void print(const hubbub_dom *dom, hubbub_dom_index index)
+{
+	const hubbub_dom_node *node = hubbub_dom_get_node(dom, index);
+	const hubbub_dom_attribute *attrs;
+	hubbub_dom_index child;
+	uint32_t i;
+
+	if (node->type != HUBBUB_DOM_NODE_ELEMENT)
+		return;
+
+	assert(strlen(got) + node->data.len + 2 < sizeof(got));
+	strcat(got, "<");
+	strncat(got, (const char *) hubbub_dom_get_string(dom, node->data),
+			node->data.len);
+
+	attrs = hubbub_dom_get_attributes(dom, node);
+	for (i = 0; i < node->u.element.n_attributes; i++) {
+		assert(strlen(got) + attrs[i].name.len + 2 < sizeof(got));
+		strcat(got, " ");
+		strncat(got, (const char *) hubbub_dom_get_string(dom,
+				attrs[i].name), attrs[i].name.len);
+	}
+
+	strcat(got, ">");
+
+	for (child = node->first_child; child != HUBBUB_DOM_NONE;
+			child = hubbub_dom_get_node(dom, child)->next)
+		print(dom, child);
+
+	assert(strlen(got) + 3 < sizeof(got));
+	strcat(got, "</>");
+}
+
+static void test_tree(void)
+{
+	static const char tree_document[] =
+		"<meta charset=utf-8 name=x>"
+		"<table><input type=hidden id=a class=b></table>"
+		"<p id=p onclick=x><svg><font color=red></font></svg>";
+	hubbub_parser_optparams params;
+	hubbub_parser *parser;
+	hubbub_dom *dom;
+
+	assert(hubbub_dom_create(NULL, NULL, &dom) == HUBBUB_OK);
+	assert(hubbub_parser_create("UTF-8", false, &parser) == HUBBUB_OK);
+	assert(hubbub_dom_attach(dom, parser) == HUBBUB_OK);
+
+	/* The attributes the tree builder reads are kept, so that the input
+	 * stays in the table, and the font ends the svg element */
+	params.attribute_filter.names = wanted;
+	params.attribute_filter.n_names = 2;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_ATTRIBUTE_FILTER,
+			&params) == HUBBUB_OK);
+
+	assert(hubbub_parser_parse_chunk(parser,
+			(const uint8_t *) tree_document,
+			SLEN(tree_document)) == HUBBUB_OK);
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	got[0] = '\0';
+	print(dom, hubbub_dom_get_node(dom, HUBBUB_DOM_DOCUMENT)->first_child);
+	printf("tree: %s\n", got);
+	assert(strcmp(got, "<html><head><meta charset></></>"
+			"<body><table><input type id></></>"
+			"<p id><svg></><font color></></></></>") == 0);
+
+	hubbub_parser_destroy(parser);
+	hubbub_dom_destroy(dom);
+}
+
+int main(int argc, char **argv)
+{
+	char all[sizeof(got)];
+	uint32_t dropped;
+	size_t chunk;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	parse_tokens(false, false, SLEN(document), &dropped);
+	strcpy(all, got);
+	printf("all: %s\n", all);
+	assert(dropped == 0);
+
+	for (chunk = 1; chunk <= SLEN(document); chunk++) {
+		parse_tokens(true, false, chunk, &dropped);
+		assert(strcmp(got, EXPECTED) == 0);
+		assert(dropped == 6);
+
+		parse_tokens(true, true, chunk, &dropped);
+		assert(strcmp(got, EXPECTED) == 0);
+		assert(dropped == 6);
+
+		parse_tokens(false, true, chunk, &dropped);
+		assert(strcmp(got, all) == 0);
+	}
+
+	test_tree();
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+#include <hubbub/dom.h>
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+typedef struct fragment_test {
+	const char *context;	/* Name of context element */
+	const char *data;	/* Content parsed */
+	const char *expected;	/* Nodes built for the content */
+} fragment_test;
+
+static const fragment_test tests[] = {
+	{ "div", "<p>a<b>b</p>c", "<p>a<b>b</b></p><b>c</b>" },
+	{ "title", "<b>&amp;</b>", "<b>&</b>" },
+	{ "script", "<b>&amp;</b>", "<b>&amp;</b>" },
+	{ "plaintext", "</plaintext><b>", "</plaintext><b>" },
+	{ "tr", "<td>a<td>b", "<td>a</td><td>b</td>" },
+	{ "select", "<option>a<p>b", "<option>ab</option>" },
+	{ "table", "</table><tr>", "<tbody><tr></tr></tbody>" },
+	{ "div", "<frameset><i>", "<i></i>" },
+	{ "html", "<p>", "<head></head><body><p></p></body>" }
+};
+
+static hubbub_dom *dom;
+
+static char got[256];
+
+static void print(hubbub_dom_index index)
+{
+	const hubbub_dom_node *node = hubbub_dom_get_node(dom, index);
+	hubbub_dom_index child;
+	size_t len = strlen(got);
+
+	assert(len + node->data.len + 4 < sizeof(got));
+
+	if (node->type == HUBBUB_DOM_NODE_ELEMENT)
+		strcat(got, "<");
+
+	strncat(got, (const char *) hubbub_dom_get_string(dom, node->data),
+			node->data.len);
+
+	if (node->type != HUBBUB_DOM_NODE_ELEMENT)
+		return;
+
+	strcat(got, ">");
+
+	for (child = node->first_child; child != HUBBUB_DOM_NONE;
+			child = hubbub_dom_get_node(dom, child)->next)
+		print(child);
+
+	len = strlen(got);
+	assert(len + node->data.len + 4 < sizeof(got));
+
+	strcat(got, "</");
+	strncat(got, (const char *) hubbub_dom_get_string(dom, node->data),
+			node->data.len);
+	strcat(got, ">");
+}
+
+static void parse(hubbub_parser *parser, const fragment_test *test)
+{
+	const hubbub_dom_node *root;
+	hubbub_dom_index child;
+	hubbub_string context;
+
+	assert(hubbub_parser_reset(parser, NULL, false) == HUBBUB_OK);
+	assert(hubbub_dom_reset(dom) == HUBBUB_OK);
+	assert(hubbub_dom_attach(dom, parser) == HUBBUB_OK);
+
+	context.ptr = (const uint8_t *) test->context;
+	context.len = strlen(test->context);
+
+	assert(hubbub_parser_begin_fragment(parser, &context) == HUBBUB_OK);
+
+	/* Only once */
+	assert(hubbub_parser_begin_fragment(parser, &context) ==
+			HUBBUB_INVALID);
+
+	assert(hubbub_parser_parse_chunk(parser, (const uint8_t *) test->data,
+			strlen(test->data)) == HUBBUB_OK);
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	/* The fragment is the content of the html element */
+	child = hubbub_dom_get_node(dom, HUBBUB_DOM_DOCUMENT)->first_child;
+	root = hubbub_dom_get_node(dom, child);
+	assert(root->type == HUBBUB_DOM_NODE_ELEMENT);
+	assert(root->next == HUBBUB_DOM_NONE);
+
+	got[0] = '\0';
+	for (child = root->first_child; child != HUBBUB_DOM_NONE;
+			child = hubbub_dom_get_node(dom, child)->next)
+		print(child);
+
+	printf("%s: %s -> %s\n", test->context, test->data, got);
+	assert(strcmp(got, test->expected) == 0);
+}
+
+int main(int argc, char **argv)
+{
+	hubbub_parser *parser;
+	hubbub_string context;
+	size_t i;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	context.ptr = (const uint8_t *) "div";
+	context.len = SLEN("div");
+
+	assert(hubbub_dom_create(NULL, NULL, &dom) == HUBBUB_OK);
+
+	/* A parser without a tree cannot parse a fragment */
+	assert(hubbub_parser_create_for_tokens(NULL, false, NULL, NULL,
+			&parser) == HUBBUB_OK);
+	assert(hubbub_parser_begin_fragment(parser, &context) ==
+			HUBBUB_INVALID);
+	hubbub_parser_destroy(parser);
+
+	assert(hubbub_parser_create(NULL, false, &parser) == HUBBUB_OK);
+
+	assert(hubbub_parser_begin_fragment(parser, NULL) == HUBBUB_BADPARM);
+
+	/* Nor one which has started on a document */
+	assert(hubbub_dom_attach(dom, parser) == HUBBUB_OK);
+	assert(hubbub_parser_parse_chunk(parser, (const uint8_t *) "<p>",
+			SLEN("<p>")) == HUBBUB_OK);
+	assert(hubbub_parser_begin_fragment(parser, &context) ==
+			HUBBUB_INVALID);
+
+	/* One parser does for every fragment, once reset */
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+		parse(parser, &tests[i]);
+
+	/* And for a document after them */
+	assert(hubbub_parser_reset(parser, NULL, false) == HUBBUB_OK);
+	assert(hubbub_dom_reset(dom) == HUBBUB_OK);
+	assert(hubbub_dom_attach(dom, parser) == HUBBUB_OK);
+	assert(hubbub_parser_parse_chunk(parser, (const uint8_t *) "<p>",
+			SLEN("<p>")) == HUBBUB_OK);
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	got[0] = '\0';
+	print(hubbub_dom_get_node(dom, HUBBUB_DOM_DOCUMENT)->first_child);
+	assert(strcmp(got, "<html><head></head><body><p></p></body></html>")
+			== 0);
+
+	hubbub_parser_destroy(parser);
+	hubbub_dom_destroy(dom);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+/* Scripts run at <x>, <i> and <y> write more markup; <z> pauses the parse,
+ * and more is written while it is paused. The tokens must be those read
+ * from the document as it would be with the writes in place. */
+static const char document[] = "<p>a<x>b<y>c</p><z>d";
+
+static const char written[] =
+		"<p>a<x><i><u>1</i><b>2b<y><em class=z><s t=c</p>"
+		"<z><w>\xc3\xa9" "d";
+
+/* Tokens seen, serialised */
+static char got[512];
+
+static hubbub_parser *parser;
+
+static void insert(const char *data)
+{
+	assert(hubbub_parser_insert_chunk(parser, (const uint8_t *) data,
+			strlen(data)) == HUBBUB_OK);
+}
+
+static void record(const char *prefix, const hubbub_string *str)
+{
+	assert(strlen(got) + strlen(prefix) + str->len + 2 < sizeof(got));
+
+	strcat(got, prefix);
+	strncat(got, (const char *) str->ptr, str->len);
+	strcat(got, " ");
+}
+
+static hubbub_error token_handler(const hubbub_token *token, void *pw)
+{
+	const hubbub_tag *tag = &token->data.tag;
+	bool scripts = (pw != NULL);
+	uint32_t i;
+
+	switch (token->type) {
+	case HUBBUB_TOKEN_START_TAG:
+		record("S:", &tag->name);
+		for (i = 0; i < tag->n_attributes; i++) {
+			record("A:", &tag->attributes[i].name);
+			record("V:", &tag->attributes[i].value);
+		}
+		break;
+	case HUBBUB_TOKEN_END_TAG:
+		record("E:", &tag->name);
+		break;
+	case HUBBUB_TOKEN_CHARACTER:
+		record("C:", &token->data.character);
+		break;
+	default:
+		break;
+	}
+
+	if (scripts == false || token->type != HUBBUB_TOKEN_START_TAG ||
+			tag->name.len != 1)
+		return HUBBUB_OK;
+
+	switch (tag->name.ptr[0]) {
+	case 'x':
+		/* The text at the end runs on into the document */
+		insert("<i>1</i><b>2");
+		break;
+	case 'i':
+		/* Written data goes before the rest of earlier writes */
+		insert("<u>");
+		break;
+	case 'y':
+		/* Writes are read as one, and a tag may run on into the
+		 * document */
+		insert("<em cla");
+		insert("ss=z><s t=");
+		break;
+	case 'z':
+		return HUBBUB_PAUSED;
+	}
+
+	return HUBBUB_OK;
+}
+
+static void parse(const char *data, bool scripts, bool borrow,
+		size_t chunk)
+{
+	hubbub_parser_optparams params;
+	size_t len = strlen(data), off;
+	hubbub_error error;
+
+	got[0] = '\0';
+
+	assert(hubbub_parser_create_for_tokens("UTF-8", false, NULL, NULL,
+			&parser) == HUBBUB_OK);
+
+	params.token_handler.handler = token_handler;
+	params.token_handler.pw = scripts ? parser : NULL;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TOKEN_HANDLER,
+			&params) == HUBBUB_OK);
+
+	params.coalesce_characters = true;
+	assert(hubbub_parser_setopt(parser,
+			HUBBUB_PARSER_COALESCE_CHARACTERS,
+			&params) == HUBBUB_OK);
+
+	params.borrow_input = borrow;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_BORROW_INPUT,
+			&params) == HUBBUB_OK);
+
+	for (off = 0; off < len; off += chunk) {
+		error = hubbub_parser_parse_chunk(parser,
+				(const uint8_t *) data + off,
+				min(chunk, len - off));
+		if (error == HUBBUB_PAUSED) {
+			/* A character may be split between writes */
+			insert("<w>\xc3");
+			insert("\xa9");
+
+			params.pause_parse = false;
+			error = hubbub_parser_setopt(parser,
+					HUBBUB_PARSER_PAUSE, &params);
+		}
+
+		assert(error == HUBBUB_OK);
+	}
+
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	hubbub_parser_destroy(parser);
+}
+
+int main(int argc, char **argv)
+{
+	char expected[sizeof(got)];
+	size_t chunk;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	parse(written, false, false, SLEN(written));
+	strcpy(expected, got);
+	printf("expected: %s\n", expected);
+
+	for (chunk = 1; chunk <= SLEN(document); chunk++) {
+		parse(document, true, false, chunk);
+		assert(strcmp(got, expected) == 0);
+
+		parse(document, true, true, chunk);
+		assert(strcmp(got, expected) == 0);
+	}
+
+	printf("PASS\n");
+
+	return 0;
+}
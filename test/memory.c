@@ -0,0 +1,185 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+#include <hubbub/dom.h>
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+#define DEPTH 500
+#define ATTRS 200
+#define TEXT 30000
+#define CHUNK 4096
+
+/* Bytes the parser's allocator holds, less its own headers */
+static size_t held;
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	size_t *block = ptr;
+
+	UNUSED(pw);
+
+	if (block != NULL) {
+		block--;
+		held -= *block;
+	}
+
+	if (len == 0) {
+		free(block);
+		return NULL;
+	}
+
+	block = realloc(block, sizeof(size_t) + len);
+	if (block == NULL)
+		return NULL;
+
+	*block = len;
+	held += len;
+
+	return block + 1;
+}
+
+/* Nesting, many attributes, misnested formatting and a long text */
+static uint8_t *make_document(size_t *len)
+{
+	static const char open[] = "<div>";
+	static const char attr[] = " a00000";
+	static const char misnested[] = "<b><i><p>x</b>y</i>";
+	uint8_t *doc, *p;
+	size_t i;
+
+	*len = DEPTH * SLEN(open) + 2 + ATTRS * SLEN(attr) + 1 +
+			DEPTH * SLEN(misnested) + TEXT;
+
+	doc = p = malloc(*len);
+	assert(doc != NULL);
+
+	for (i = 0; i < DEPTH; i++, p += SLEN(open))
+		memcpy(p, open, SLEN(open));
+
+	*p++ = '<';
+	*p++ = 'p';
+	for (i = 0; i < ATTRS; i++, p += SLEN(attr))
+		sprintf((char *) p, " a%05u", (unsigned) i);
+	*p++ = '>';
+
+	for (i = 0; i < DEPTH; i++, p += SLEN(misnested))
+		memcpy(p, misnested, SLEN(misnested));
+
+	memset(p, 'x', TEXT);
+
+	return doc;
+}
+
+/* Parse with a memory limit, returning the result */
+static hubbub_error parse(const uint8_t *doc, size_t len, size_t limit,
+		hubbub_memory_usage *usage)
+{
+	hubbub_parser_optparams params;
+	hubbub_parser *parser;
+	hubbub_error error = HUBBUB_OK;
+	hubbub_dom *dom;
+	size_t offset;
+
+	assert(hubbub_dom_create(NULL, NULL, &dom) == HUBBUB_OK);
+	assert(hubbub_parser_create_with_allocator(NULL, false,
+			myrealloc, NULL, &parser) == HUBBUB_OK);
+	assert(hubbub_dom_attach(dom, parser) == HUBBUB_OK);
+
+	params.memory_limit = limit;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_MEMORY_LIMIT,
+			&params) == HUBBUB_OK);
+
+	for (offset = 0; offset < len && error == HUBBUB_OK;
+			offset += CHUNK) {
+		error = hubbub_parser_parse_chunk(parser, doc + offset,
+				min(CHUNK, len - offset));
+	}
+
+	if (error == HUBBUB_OK)
+		error = hubbub_parser_completed(parser);
+
+	assert(hubbub_parser_read_memory_usage(parser, usage) == HUBBUB_OK);
+	assert(usage->limit == limit);
+
+	hubbub_parser_destroy(parser);
+	hubbub_dom_destroy(dom);
+
+	/* Everything is given back, whether the parse succeeded or not */
+	assert(held == 0);
+
+	return error;
+}
+
+int main(int argc, char **argv)
+{
+	hubbub_memory_usage usage, limited;
+	hubbub_parser *parser;
+	uint8_t *doc;
+	size_t len, limit;
+	int failed = 0;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	doc = make_document(&len);
+
+	assert(hubbub_parser_create_with_allocator(NULL, false,
+			myrealloc, NULL, &parser) == HUBBUB_OK);
+
+	assert(hubbub_parser_read_memory_usage(NULL, &usage) ==
+			HUBBUB_BADPARM);
+	assert(hubbub_parser_read_memory_usage(parser, NULL) ==
+			HUBBUB_BADPARM);
+
+	/* What the tokeniser and treebuilder hold is counted */
+	assert(hubbub_parser_read_memory_usage(parser, &usage) == HUBBUB_OK);
+	assert(usage.current > 0 && usage.peak >= usage.current);
+	assert(usage.limit == 0);
+	assert(usage.allocations > 0);
+
+	/* A reset starts the peak again */
+	assert(hubbub_parser_reset(parser, NULL, false) == HUBBUB_OK);
+	assert(hubbub_parser_read_memory_usage(parser, &usage) == HUBBUB_OK);
+	assert(usage.peak == usage.current);
+	assert(usage.allocations == 0);
+
+	hubbub_parser_destroy(parser);
+	assert(held == 0);
+
+	/* Without a limit, the document parses */
+	assert(parse(doc, len, 0, &usage) == HUBBUB_OK);
+	assert(usage.peak >= usage.current);
+	assert(usage.peak > DEPTH * sizeof(void *));
+
+	printf("peak %zu bytes in %" PRIu32 " allocations\n",
+			usage.peak, usage.allocations);
+
+	/* With room enough, it parses the same */
+	assert(parse(doc, len, usage.peak, &limited) == HUBBUB_OK);
+	assert(limited.peak == usage.peak);
+
+	/* With less, it fails cleanly, wherever it runs out */
+	for (limit = usage.peak / 2; limit < usage.peak; limit += 97) {
+		hubbub_error error = parse(doc, len, limit, &limited);
+
+		assert(error == HUBBUB_OK || error == HUBBUB_NOMEM);
+		if (error == HUBBUB_NOMEM)
+			failed++;
+	}
+
+	assert(failed > 0);
+	assert(parse(doc, len, usage.peak / 4, &limited) == HUBBUB_NOMEM);
+
+	free(doc);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -12,6 +12,26 @@
 
 static hubbub_error token_handler(const hubbub_token *token, void *pw);
 
+/* Number of blocks currently held by the parser */
+static int live_blocks;
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	if (len == 0) {
+		if (ptr != NULL)
+			live_blocks--;
+		free(ptr);
+		return NULL;
+	}
+
+	if (ptr == NULL)
+		live_blocks++;
+
+	return realloc(ptr, len);
+}
+
 static int run_test(int argc, char **argv, unsigned int CHUNK_SIZE)
 {
 	hubbub_parser *parser;
@@ -24,7 +44,8 @@ static int run_test(int argc, char **argv, unsigned int CHUNK_SIZE)
 
 	UNUSED(argc);
 
-	assert(hubbub_parser_create("UTF-8", false, &parser) == HUBBUB_OK);
+	assert(hubbub_parser_create_with_allocator("UTF-8", false,
+			myrealloc, NULL, &parser) == HUBBUB_OK);
 
 	params.token_handler.handler = token_handler;
 	params.token_handler.pw = NULL;
@@ -65,6 +86,8 @@ static int run_test(int argc, char **argv, unsigned int CHUNK_SIZE)
 
 	hubbub_parser_destroy(parser);
 
+	assert(live_blocks == 0);
+
 	printf("PASS\n");
 
 	return 0;
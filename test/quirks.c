@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+#include <hubbub/dom.h>
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+#define NONE HUBBUB_QUIRKS_MODE_NONE
+#define LIMITED HUBBUB_QUIRKS_MODE_LIMITED
+#define FULL HUBBUB_QUIRKS_MODE_FULL
+
+typedef struct quirks_test {
+	const char *doctype;		/* Start of document */
+	hubbub_quirks_mode expected;	/* Quirks mode selected */
+} quirks_test;
+
+static const quirks_test tests[] = {
+	{ "<!DOCTYPE html>", NONE },
+	{ "<p>", FULL },
+	{ "<!DOCTYPE svg>", FULL },
+	{ "<!DOCTYPE>", FULL },
+	{ "<!DOCTYPE HtMl>", NONE },
+
+	/* Prefixes, in any case, and followed by anything */
+	{ "<!DOCTYPE html PUBLIC \"-//IETF//DTD HTML//\">", FULL },
+	{ "<!DOCTYPE html PUBLIC \"-//ietf//dtd html//EN\">", FULL },
+	{ "<!DOCTYPE html PUBLIC \"-//IETF//DTD HTML 3.2 Final//EN\">",
+			FULL },
+	{ "<!DOCTYPE html PUBLIC \"+//Silmaril//dtd html Pro v0r11 "
+			"19970101//\">", FULL },
+	{ "<!DOCTYPE html PUBLIC \"-//W3O//DTD W3 HTML 3.0//\">", FULL },
+	/* Only the start of a prefix */
+	{ "<!DOCTYPE html PUBLIC \"-//IETF//DTD HTML\">", NONE },
+	{ "<!DOCTYPE html PUBLIC \"-//IETF//DTD HTML 3.2 Fin\">", NONE },
+	{ "<!DOCTYPE html PUBLIC \"\">", NONE },
+	{ "<!DOCTYPE html PUBLIC \"-//W3C//DTD HTML 4.01//EN\">", NONE },
+
+	/* Exact identifiers */
+	{ "<!DOCTYPE html PUBLIC \"html\">", FULL },
+	{ "<!DOCTYPE html PUBLIC \"HTML \">", NONE },
+	{ "<!DOCTYPE html PUBLIC \"-/W3C/DTD HTML 4.0 Transitional/en\">",
+			FULL },
+	{ "<!DOCTYPE html PUBLIC \"-/W3C/DTD HTML 4.0 Transitional/EN/\">",
+			NONE },
+	{ "<!DOCTYPE html PUBLIC \"-//W3O//DTD W3 HTML Strict 3.0//EN//\">",
+			FULL },
+
+	/* Prefixes which depend on the system identifier */
+	{ "<!DOCTYPE html PUBLIC \"-//W3C//DTD HTML 4.01 Transitional//EN\">",
+			FULL },
+	{ "<!DOCTYPE html PUBLIC \"-//W3C//DTD HTML 4.01 Transitional//EN\" "
+			"\"http://www.w3.org/TR/html4/loose.dtd\">", LIMITED },
+	{ "<!DOCTYPE html PUBLIC \"-//W3C//DTD HTML 4.01 Frameset//EN\" "
+			"\"\">", LIMITED },
+	{ "<!DOCTYPE html PUBLIC \"-//W3C//DTD XHTML 1.0 Transitional//EN\">",
+			LIMITED },
+	{ "<!DOCTYPE html PUBLIC \"-//W3C//DTD XHTML 1.0 Frameset//EN\" "
+			"\"x\">", LIMITED },
+	{ "<!DOCTYPE html PUBLIC \"-//W3C//DTD XHTML 1.0 Strict//EN\">",
+			NONE },
+
+	/* System identifiers */
+	{ "<!DOCTYPE html PUBLIC \"\" \"http://www.ibm.com/data/dtd/v11/"
+			"IBMXHTML1-transitional.dtd\">", FULL },
+	{ "<!DOCTYPE html SYSTEM \"about:legacy-compat\">", NONE }
+};
+
+int main(int argc, char **argv)
+{
+	hubbub_parser *parser;
+	hubbub_dom *dom;
+	size_t i;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	assert(hubbub_dom_create(NULL, NULL, &dom) == HUBBUB_OK);
+	assert(hubbub_parser_create("UTF-8", false, &parser) == HUBBUB_OK);
+
+	for (i = 0; i < N_ELEMENTS(tests); i++) {
+		hubbub_quirks_mode mode;
+
+		assert(hubbub_parser_reset(parser, "UTF-8", false) ==
+				HUBBUB_OK);
+		assert(hubbub_dom_reset(dom) == HUBBUB_OK);
+		assert(hubbub_dom_attach(dom, parser) == HUBBUB_OK);
+
+		assert(hubbub_parser_parse_chunk(parser,
+				(const uint8_t *) tests[i].doctype,
+				strlen(tests[i].doctype)) == HUBBUB_OK);
+		assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+		mode = hubbub_dom_quirks_mode(dom);
+		printf("%s: %d\n", tests[i].doctype, mode);
+		assert(mode == tests[i].expected);
+	}
+
+	hubbub_parser_destroy(parser);
+	hubbub_dom_destroy(dom);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+/* Names in upper case and character references are changed as they are
+ * read, so cannot be found in the input; a newline read for CRLF is the
+ * input's LF */
+static const char document[] =
+	"\xef\xbb\xbf<p class=a title=\"x&amp;y\" ID=b>Hello <b>bold</b>"
+	"a&lt;b<i\r\nid='c'>x\r\ny</i>";
+
+/* Strings found in the document (+), or held by the parser (-) */
+#define EXPECTED "+p +class +a +title -x&y -id +b +Hello  +b +bold +b " \
+	"+a -< +b +i +id +c +x +\ny +i "
+
+/* Strings seen, serialised */
+static char got[512];
+
+static hubbub_parser *parser;
+
+static void record(const hubbub_string *str)
+{
+	hubbub_error error;
+	size_t offset;
+
+	assert(strlen(got) + str->len + 3 < sizeof(got));
+
+	error = hubbub_parser_source_offset(parser, str, &offset);
+	if (error == HUBBUB_OK) {
+		/* The string is the input at its offset */
+		assert(offset + str->len <= SLEN(document));
+		assert(memcmp(document + offset, str->ptr, str->len) == 0);
+		strcat(got, "+");
+	} else {
+		assert(error == HUBBUB_INVALID);
+		strcat(got, "-");
+	}
+
+	strncat(got, (const char *) str->ptr, str->len);
+	strcat(got, " ");
+}
+
+static hubbub_error token_handler(const hubbub_token *token, void *pw)
+{
+	const hubbub_tag *tag = &token->data.tag;
+	uint32_t i;
+
+	UNUSED(pw);
+
+	switch (token->type) {
+	case HUBBUB_TOKEN_START_TAG:
+		record(&tag->name);
+		for (i = 0; i < tag->n_attributes; i++) {
+			record(&tag->attributes[i].name);
+			record(&tag->attributes[i].value);
+		}
+		break;
+	case HUBBUB_TOKEN_END_TAG:
+		record(&tag->name);
+		break;
+	case HUBBUB_TOKEN_CHARACTER:
+		record(&token->data.character);
+		break;
+	default:
+		break;
+	}
+
+	return HUBBUB_OK;
+}
+
+static void parse(bool borrow, size_t chunk)
+{
+	hubbub_parser_optparams params;
+	size_t len = SLEN(document), off;
+	hubbub_string str;
+
+	got[0] = '\0';
+
+	assert(hubbub_parser_create_for_tokens("UTF-8", false, NULL, NULL,
+			&parser) == HUBBUB_OK);
+
+	params.token_handler.handler = token_handler;
+	params.token_handler.pw = NULL;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TOKEN_HANDLER,
+			&params) == HUBBUB_OK);
+
+	params.borrow_input = borrow;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_BORROW_INPUT,
+			&params) == HUBBUB_OK);
+
+	for (off = 0; off < len; off += chunk) {
+		assert(hubbub_parser_parse_chunk(parser,
+				(const uint8_t *) document + off,
+				min(chunk, len - off)) == HUBBUB_OK);
+	}
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	/* Offsets are from the start of the document, byte order mark and
+	 * all, and remain valid once it has been parsed */
+	str.ptr = (const uint8_t *) document;
+	str.len = SLEN(document);
+	assert(hubbub_parser_source_offset(parser, &str, &off) ==
+			(borrow ? HUBBUB_OK : HUBBUB_INVALID));
+	assert(borrow == false || off == 0);
+
+	/* No string runs past the input */
+	str.len++;
+	assert(hubbub_parser_source_offset(parser, &str, &off) ==
+			HUBBUB_INVALID);
+
+	assert(hubbub_parser_source_offset(parser, NULL, &off) ==
+			HUBBUB_BADPARM);
+
+	hubbub_parser_destroy(parser);
+}
+
+int main(int argc, char **argv)
+{
+	size_t chunk;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	parse(true, SLEN(document));
+	printf("borrowed: %s\n", got);
+	assert(strcmp(got, EXPECTED) == 0);
+
+	/* Strings split between chunks may be copied, but those found must
+	 * still be the input */
+	for (chunk = 1; chunk <= SLEN(document); chunk++)
+		parse(true, chunk);
+
+	/* Without borrowing, every string is the parser's */
+	parse(false, SLEN(document));
+	printf("copied: %s\n", got);
+	assert(strchr(got, '+') == NULL);
+
+	printf("PASS\n");
+
+	return 0;
+}
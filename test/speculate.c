@@ -0,0 +1,360 @@
+/*
+ * Tree construction tester, parsing parts of each document speculatively.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+#include <hubbub/dom.h>
+#include <hubbub/parser.h>
+#include <hubbub/speculate.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+typedef struct buf_t {
+	char *buf;
+	size_t len;
+	size_t pos;
+} buf_t;
+
+#define NUM_NAMESPACES 7
+static const char * const ns_names[NUM_NAMESPACES] = {
+	NULL, NULL /*html*/, "math", "svg", "xlink", "xml", "xmlns"
+};
+
+static hubbub_dom *dom;
+static hubbub_speculation *spec;
+
+static void buf_addn(buf_t *buf, const char *str, size_t len)
+{
+	while (buf->pos + len + 1 > buf->len) {
+		buf->len = buf->len ? buf->len * 2 : 1024;
+		buf->buf = realloc(buf->buf, buf->len);
+		assert(buf->buf != NULL);
+	}
+
+	memcpy(buf->buf + buf->pos, str, len);
+	buf->pos += len;
+	buf->buf[buf->pos] = '\0';
+}
+
+static void buf_add(buf_t *buf, const char *str)
+{
+	buf_addn(buf, str, strlen(str));
+}
+
+static void buf_add_string(buf_t *buf, hubbub_dom_string str)
+{
+	buf_addn(buf, (const char *) hubbub_dom_get_string(dom, str), str.len);
+}
+
+static int compare_attrs(const void *a, const void *b)
+{
+	const hubbub_dom_attribute *first = a;
+	const hubbub_dom_attribute *second = b;
+	size_t len = min(first->name.len, second->name.len);
+	int cmp;
+
+	cmp = memcmp(hubbub_dom_get_string(dom, first->name),
+			hubbub_dom_get_string(dom, second->name), len);
+	if (cmp != 0)
+		return cmp;
+
+	return (int) first->name.len - (int) second->name.len;
+}
+
+static void indent(buf_t *buf, unsigned depth)
+{
+	unsigned int i;
+
+	buf_add(buf, "| ");
+
+	for (i = 0; i < depth; i++)
+		buf_add(buf, "  ");
+}
+
+static void print_ns(buf_t *buf, hubbub_ns ns)
+{
+	assert(ns < NUM_NAMESPACES);
+
+	if (ns_names[ns] != NULL) {
+		buf_add(buf, ns_names[ns]);
+		buf_add(buf, " ");
+	}
+}
+
+/* Serialise the children of a node, as the test data does */
+static void node_print(buf_t *buf, hubbub_dom_index index, unsigned depth)
+{
+	const hubbub_dom_node *node;
+	hubbub_dom_attribute *attrs;
+	uint32_t i, n;
+
+	for (index = hubbub_dom_get_node(dom, index)->first_child;
+			index != HUBBUB_DOM_NONE; index = node->next) {
+		node = hubbub_dom_get_node(dom, index);
+		assert(node != NULL);
+
+		indent(buf, depth);
+
+		switch (node->type) {
+		case HUBBUB_DOM_NODE_DOCTYPE:
+			buf_add(buf, "<!DOCTYPE ");
+			buf_add_string(buf, node->data);
+
+			if (!node->u.doctype.public_missing ||
+					!node->u.doctype.system_missing) {
+				buf_add(buf, " \"");
+				buf_add_string(buf, node->u.doctype.public_id);
+				buf_add(buf, "\" \"");
+				buf_add_string(buf, node->u.doctype.system_id);
+				buf_add(buf, "\"");
+			}
+
+			buf_add(buf, ">\n");
+			break;
+		case HUBBUB_DOM_NODE_ELEMENT:
+			buf_add(buf, "<");
+			print_ns(buf, node->u.element.ns);
+			buf_add_string(buf, node->data);
+			buf_add(buf, ">\n");
+
+			n = node->u.element.n_attributes;
+			if (n == 0)
+				break;
+
+			attrs = malloc(n * sizeof(hubbub_dom_attribute));
+			assert(attrs != NULL);
+			memcpy(attrs, hubbub_dom_get_attributes(dom, node),
+					n * sizeof(hubbub_dom_attribute));
+			qsort(attrs, n, sizeof(hubbub_dom_attribute),
+					compare_attrs);
+
+			for (i = 0; i < n; i++) {
+				indent(buf, depth + 1);
+				print_ns(buf, attrs[i].ns);
+				buf_add_string(buf, attrs[i].name);
+				buf_add(buf, "=\"");
+				buf_add_string(buf, attrs[i].value);
+				buf_add(buf, "\"\n");
+			}
+
+			free(attrs);
+			break;
+		case HUBBUB_DOM_NODE_TEXT:
+			buf_add(buf, "\"");
+			buf_add_string(buf, node->data);
+			buf_add(buf, "\"\n");
+			break;
+		case HUBBUB_DOM_NODE_COMMENT:
+			buf_add(buf, "<!-- ");
+			buf_add_string(buf, node->data);
+			buf_add(buf, " -->\n");
+			break;
+		case HUBBUB_DOM_NODE_DOCUMENT:
+			assert(0);
+		}
+
+		/* Printing does not modify the DOM, so node remains valid */
+		node_print(buf, index, depth + 1);
+	}
+}
+
+static hubbub_parser *setup_parser(void)
+{
+	hubbub_parser *parser;
+	hubbub_parser_optparams params;
+
+	assert(hubbub_parser_create("UTF-8", false, &parser) == HUBBUB_OK);
+
+	assert(hubbub_dom_attach(dom, parser) == HUBBUB_OK);
+
+	params.enable_scripting = true;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_ENABLE_SCRIPTING,
+			&params) == HUBBUB_OK);
+
+	/* Tokens read ahead are only used for input read in place */
+	params.borrow_input = true;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_BORROW_INPUT,
+			&params) == HUBBUB_OK);
+
+	return parser;
+}
+
+/* Find the next '<', which is often not a safe place to split */
+static size_t split_anywhere(const uint8_t *data, size_t len, size_t offset)
+{
+	const uint8_t *lt;
+
+	if (offset + 1 >= len)
+		return len;
+
+	lt = memchr(data + offset + 1, '<', len - offset - 1);
+
+	return lt != NULL ? (size_t) (lt - data) : len;
+}
+
+/* Parse a document in parts, each after the first speculatively */
+static void parse_document(const buf_t *input, bool anywhere)
+{
+	const uint8_t *data = (const uint8_t *) input->buf;
+	size_t len = input->pos, start, end;
+	hubbub_parser *parser;
+
+	assert(hubbub_dom_reset(dom) == HUBBUB_OK);
+	parser = setup_parser();
+
+	end = anywhere ? split_anywhere(data, len, 0) :
+			hubbub_speculation_split(data, len, 0);
+	assert(hubbub_parser_parse_chunk(parser, data, end) == HUBBUB_OK);
+
+	for (start = end; start < len; start = end) {
+		end = anywhere ? split_anywhere(data, len, start) :
+				hubbub_speculation_split(data, len, start);
+
+		assert(hubbub_speculation_run(spec, data + start,
+				end - start) == HUBBUB_OK);
+		assert(hubbub_speculation_read_length(spec) <= end - start);
+
+		assert(hubbub_parser_parse_speculation(parser, spec) ==
+				HUBBUB_OK);
+	}
+
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	hubbub_parser_destroy(parser);
+}
+
+/* Compare the tree built for a test with that expected */
+static void check_tree(buf_t *expected, buf_t *got)
+{
+	/* Trim off the blank line which separates tests */
+	while (expected->pos >= 2 &&
+			expected->buf[expected->pos - 1] == '\n' &&
+			expected->buf[expected->pos - 2] == '\n')
+		expected->buf[--expected->pos] = '\0';
+
+	got->pos = 0;
+	buf_addn(got, "", 0);
+	node_print(got, HUBBUB_DOM_DOCUMENT, 0);
+
+	if (strcmp(got->buf, expected->buf) != 0) {
+		printf("expected:\n%sgot:\n%s", expected->buf, got->buf);
+		printf("FAIL\n");
+		exit(1);
+	}
+}
+
+/* Check the trees built when a test's input is split either way */
+static void check_test(const buf_t *input, buf_t *expected, buf_t *got)
+{
+	parse_document(input, false);
+	check_tree(expected, got);
+
+	parse_document(input, true);
+	check_tree(expected, got);
+}
+
+/* States for reading in data from the tree construction file */
+enum reading_state {
+	EXPECT_DATA,
+	READING_DATA,
+	READING_DATA_AFTER_FIRST,
+	READING_ERRORS,
+	READING_TREE
+};
+
+int main(int argc, char **argv)
+{
+	enum reading_state state = EXPECT_DATA;
+	buf_t input = { NULL, 0, 0 };
+	buf_t expected = { NULL, 0, 0 }, got = { NULL, 0, 0 };
+	uint32_t trees = 0;
+	char line[2048];
+	FILE *fp;
+
+	if (argc != 2) {
+		printf("Usage: %s <filename>\n", argv[0]);
+		return 1;
+	}
+
+	fp = fopen(argv[1], "rb");
+	if (fp == NULL) {
+		printf("Failed opening %s\n", argv[1]);
+		return 1;
+	}
+
+	assert(hubbub_dom_create(NULL, NULL, &dom) == HUBBUB_OK);
+	assert(hubbub_speculation_create(NULL, NULL, &spec) == HUBBUB_OK);
+
+	/* We rely on lines not being anywhere near 2048 characters... */
+	while (fgets(line, sizeof line, fp) == line) {
+		if (strcmp(line, "#data\n") == 0) {
+			if (state == READING_TREE) {
+				check_test(&input, &expected, &got);
+				trees++;
+			}
+
+			input.pos = 0;
+			buf_addn(&input, "", 0);
+
+			expected.pos = 0;
+			buf_addn(&expected, "", 0);
+
+			state = READING_DATA;
+			continue;
+		}
+
+		switch (state) {
+		case EXPECT_DATA:
+			break;
+		case READING_DATA:
+		case READING_DATA_AFTER_FIRST:
+			if (strcmp(line, "#errors\n") == 0) {
+				state = READING_ERRORS;
+				break;
+			}
+
+			if (state == READING_DATA_AFTER_FIRST)
+				buf_add(&input, "\n");
+			state = READING_DATA_AFTER_FIRST;
+
+			buf_addn(&input, line, strlen(line) - 1);
+			break;
+		case READING_ERRORS:
+			if (strcmp(line, "#document\n") == 0)
+				state = READING_TREE;
+			else if (strcmp(line, "#document-fragment\n") == 0 ||
+					strcmp(line, "#max-depth\n") == 0)
+				state = EXPECT_DATA;
+			break;
+		case READING_TREE:
+			buf_add(&expected, line);
+			break;
+		}
+	}
+
+	if (state == READING_TREE) {
+		check_test(&input, &expected, &got);
+		trees++;
+	}
+
+	hubbub_speculation_destroy(spec);
+	hubbub_dom_destroy(dom);
+
+	fclose(fp);
+
+	free(input.buf);
+	free(got.buf);
+	free(expected.buf);
+
+	printf("%u trees\n", trees);
+	printf("PASS\n");
+
+	return 0;
+}
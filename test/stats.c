@@ -0,0 +1,159 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+#include <hubbub/dom.h>
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+static const char doc[] =
+	"<!DOCTYPE html><html><head><title>T</title></head><body>"
+	"<p class=a id=b title='&quot;x'>a &amp; b &#65;<!-- c -->"
+	"<b><i>c</b>d</i>"
+	"<table><tr><td>x</table></body></html>";
+
+static void parse(hubbub_parser *parser, hubbub_dom *dom,
+		hubbub_parser_stats *stats)
+{
+	assert(hubbub_parser_reset(parser, NULL, false) == HUBBUB_OK);
+	assert(hubbub_dom_reset(dom) == HUBBUB_OK);
+	assert(hubbub_dom_attach(dom, parser) == HUBBUB_OK);
+
+	assert(hubbub_parser_parse_chunk(parser, (const uint8_t *) doc,
+			SLEN(doc)) == HUBBUB_OK);
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	assert(hubbub_parser_read_stats(parser, stats) == HUBBUB_OK);
+}
+
+int main(int argc, char **argv)
+{
+	hubbub_parser_stats stats, again, zero;
+	hubbub_parser_optparams params;
+	hubbub_parser *parser;
+	hubbub_dom *dom;
+	uint64_t total;
+	uint32_t i;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	memset(&zero, 0, sizeof(zero));
+
+	assert(hubbub_dom_create(NULL, NULL, &dom) == HUBBUB_OK);
+	assert(hubbub_parser_create(NULL, false, &parser) == HUBBUB_OK);
+
+	assert(hubbub_parser_read_stats(NULL, &stats) == HUBBUB_BADPARM);
+	assert(hubbub_parser_read_stats(parser, NULL) == HUBBUB_BADPARM);
+
+	assert(hubbub_parser_read_stats(parser, &stats) == HUBBUB_OK);
+	assert(memcmp(&stats, &zero, sizeof(stats)) == 0);
+
+	/* Tree handler calls are not counted unless asked for */
+	parse(parser, dom, &stats);
+
+	assert(stats.bytes == SLEN(doc));
+	assert(stats.tokens[HUBBUB_TOKEN_DOCTYPE] == 1);
+	assert(stats.tokens[HUBBUB_TOKEN_START_TAG] == 10);
+	assert(stats.tokens[HUBBUB_TOKEN_END_TAG] == 7);
+	assert(stats.tokens[HUBBUB_TOKEN_COMMENT] == 1);
+	assert(stats.tokens[HUBBUB_TOKEN_CHARACTER] > 0);
+	assert(stats.tokens[HUBBUB_TOKEN_EOF] == 1);
+	assert(stats.attributes == 3);
+	assert(stats.char_refs == 3);
+
+	/* html, body, table, tbody, tr and td */
+	assert(stats.max_depth >= 6);
+	assert(stats.formatting_high >= 2);
+	assert(stats.aa.runs > 0 && stats.aa.iterations > 0);
+	/* The tr is handed back to "in table" once a tbody is opened */
+	assert(stats.reprocessed > 0);
+	assert(stats.encoding_changes == 0 && stats.restarts == 0);
+
+	for (i = 0; i < HUBBUB_TREE_N_CALLS; i++)
+		assert(stats.tree_calls[i] == 0);
+
+	/* Resetting the parser clears the counts */
+	assert(hubbub_parser_reset(parser, NULL, false) == HUBBUB_OK);
+	assert(hubbub_parser_read_stats(parser, &again) == HUBBUB_OK);
+	assert(memcmp(&again, &zero, sizeof(again)) == 0);
+
+	/* Counting calls leaves the rest as it was */
+	params.count_tree_calls = true;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_COUNT_TREE_CALLS,
+			&params) == HUBBUB_OK);
+
+	parse(parser, dom, &again);
+
+	assert(memcmp(again.tokens, stats.tokens, sizeof(stats.tokens)) == 0);
+	assert(again.max_depth == stats.max_depth);
+	assert(again.reprocessed == stats.reprocessed);
+
+	assert(again.tree_calls[HUBBUB_TREE_CREATE_DOCTYPE] == 1);
+	assert(again.tree_calls[HUBBUB_TREE_CREATE_COMMENT] == 1);
+	/* The elements in the document, and an implied tbody */
+	assert(again.tree_calls[HUBBUB_TREE_CREATE_ELEMENT] >= 11);
+	/* A standards mode document sets no quirks mode */
+	assert(again.tree_calls[HUBBUB_TREE_SET_QUIRKS_MODE] == 0);
+	assert(again.tree_calls[HUBBUB_TREE_ADD_ATTRIBUTES] == 0);
+	/* The arena DOM counts no references, so is asked for none */
+	assert(again.tree_calls[HUBBUB_TREE_REF_NODE] == 0);
+
+	/* Either way, the tree is the same */
+	i = hubbub_dom_count(dom);
+	parse(parser, dom, &stats);
+	assert(hubbub_dom_count(dom) == i);
+	assert(memcmp(&again, &stats, sizeof(stats)) == 0);
+
+	params.count_tree_calls = false;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_COUNT_TREE_CALLS,
+			&params) == HUBBUB_OK);
+
+	parse(parser, dom, &stats);
+	assert(hubbub_dom_count(dom) == i);
+	assert(stats.tree_calls[HUBBUB_TREE_CREATE_ELEMENT] == 0);
+
+	/* Nor is time measured */
+	assert(stats.parse_ns == 0 && stats.tokeniser_ns == 0);
+	assert(stats.tree_ns == 0);
+	for (i = 0; i < HUBBUB_INSERTION_MODES; i++)
+		assert(stats.mode_ns[i] == 0);
+
+	/* When it is, the parts add up to the whole */
+	params.measure_time = true;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_MEASURE_TIME,
+			&params) == HUBBUB_OK);
+
+	parse(parser, dom, &stats);
+	assert(stats.tree_calls[HUBBUB_TREE_CREATE_ELEMENT] == 0);
+
+	assert(stats.parse_ns > 0);
+	assert(stats.mode_ns[6] > 0);
+	total = stats.tokeniser_ns + stats.tree_ns;
+	for (i = 0; i < HUBBUB_INSERTION_MODES; i++)
+		total += stats.mode_ns[i];
+	assert(total == stats.parse_ns);
+
+	printf("parse %" PRIu64 "ns: tokeniser %" PRIu64 "ns, "
+			"tree handler %" PRIu64 "ns, %s %" PRIu64 "ns\n",
+			stats.parse_ns, stats.tokeniser_ns, stats.tree_ns,
+			hubbub_parser_mode_name(6), stats.mode_ns[6]);
+
+	/* Modes are numbered as in trace events */
+	assert(strcmp(hubbub_parser_mode_name(0), "INITIAL") == 0);
+	assert(strcmp(hubbub_parser_mode_name(6), "IN_BODY") == 0);
+	assert(hubbub_parser_mode_name(HUBBUB_INSERTION_MODES - 1) != NULL);
+	assert(hubbub_parser_mode_name(HUBBUB_INSERTION_MODES) == NULL);
+
+	hubbub_parser_destroy(parser);
+	hubbub_dom_destroy(dom);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,308 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+
+#include <hubbub/parser.h>
+#include <hubbub/tree.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+/* State shared with the tree handler */
+typedef struct context {
+	char names[256];	/* Names of the elements created */
+	uint32_t text;		/* Bytes of text created */
+} context;
+
+static context ctx;
+
+static hubbub_error new_node(void *ctx, void **result)
+{
+	UNUSED(ctx);
+
+	*result = (void *) 1;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error create_comment(void *ctx, const hubbub_string *data,
+		void **result)
+{
+	UNUSED(data);
+
+	return new_node(ctx, result);
+}
+
+static hubbub_error create_doctype(void *ctx, const hubbub_doctype *doctype,
+		void **result)
+{
+	UNUSED(doctype);
+
+	return new_node(ctx, result);
+}
+
+static hubbub_error create_element(void *ctx, const hubbub_tag *tag,
+		void **result)
+{
+	context *c = (context *) ctx;
+	size_t len = strlen(c->names);
+
+	assert(len + tag->name.len + 2 < sizeof(c->names));
+
+	memcpy(c->names + len, tag->name.ptr, tag->name.len);
+	c->names[len + tag->name.len] = ' ';
+	c->names[len + tag->name.len + 1] = '\0';
+
+	return new_node(ctx, result);
+}
+
+static hubbub_error create_text(void *ctx, const hubbub_string *data,
+		void **result)
+{
+	((context *) ctx)->text += data->len;
+
+	return new_node(ctx, result);
+}
+
+static hubbub_error ref_node(void *ctx, void *node)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error append_child(void *ctx, void *parent, void *child,
+		void **result)
+{
+	UNUSED(ctx);
+	UNUSED(parent);
+
+	*result = child;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error insert_before(void *ctx, void *parent, void *child,
+		void *ref_child, void **result)
+{
+	UNUSED(ref_child);
+
+	return append_child(ctx, parent, child, result);
+}
+
+static hubbub_error clone_node(void *ctx, void *node, bool deep,
+		void **result)
+{
+	UNUSED(node);
+	UNUSED(deep);
+
+	return new_node(ctx, result);
+}
+
+static hubbub_error reparent_children(void *ctx, void *node,
+		void *new_parent)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+	UNUSED(new_parent);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error get_parent(void *ctx, void *node, bool element_only,
+		void **result)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+	UNUSED(element_only);
+
+	*result = NULL;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error has_children(void *ctx, void *node, bool *result)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+
+	*result = false;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error form_associate(void *ctx, void *form, void *node)
+{
+	UNUSED(ctx);
+	UNUSED(form);
+	UNUSED(node);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error add_attributes(void *ctx, void *node,
+		const hubbub_attribute *attributes, uint32_t n_attributes)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+	UNUSED(attributes);
+	UNUSED(n_attributes);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error set_quirks_mode(void *ctx, hubbub_quirks_mode mode)
+{
+	UNUSED(ctx);
+	UNUSED(mode);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error encoding_change(void *ctx, const char *encname)
+{
+	UNUSED(ctx);
+	UNUSED(encname);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_tree_handler tree_handler = {
+	create_comment,
+	create_doctype,
+	create_element,
+	create_text,
+	ref_node,
+	ref_node,
+	append_child,
+	insert_before,
+	append_child,
+	clone_node,
+	reparent_children,
+	get_parent,
+	has_children,
+	form_associate,
+	add_attributes,
+	set_quirks_mode,
+	encoding_change,
+	NULL,
+	&ctx,
+	0,
+	NULL
+};
+
+/* Parse a document in chunks, returning the result of the last call */
+static hubbub_error run_parse(const char *doc, size_t chunk,
+		uint32_t *calls)
+{
+	hubbub_parser *parser;
+	hubbub_parser_optparams params;
+	hubbub_error error = HUBBUB_OK;
+	size_t len = strlen(doc), off;
+
+	ctx.names[0] = '\0';
+	ctx.text = 0;
+
+	assert(hubbub_parser_create("UTF-8", false, &parser) == HUBBUB_OK);
+
+	params.tree_handler = &tree_handler;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TREE_HANDLER,
+			&params) == HUBBUB_OK);
+
+	params.document_node = (void *) 1;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_DOCUMENT_NODE,
+			&params) == HUBBUB_OK);
+
+	params.stop_at_body = true;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_STOP_AT_BODY,
+			&params) == HUBBUB_OK);
+
+	*calls = 0;
+	for (off = 0; off < len && error == HUBBUB_OK; off += chunk) {
+		error = hubbub_parser_parse_chunk(parser,
+				(const uint8_t *) doc + off,
+				min(chunk, len - off));
+		(*calls)++;
+	}
+
+	if (error == HUBBUB_OK)
+		error = hubbub_parser_completed(parser);
+
+	/* Once stopped, the parser stays stopped */
+	if (error == HUBBUB_STOPPED) {
+		assert(hubbub_parser_parse_chunk(parser,
+				(const uint8_t *) "<p>", SLEN("<p>")) ==
+				HUBBUB_STOPPED);
+		assert(hubbub_parser_completed(parser) == HUBBUB_STOPPED);
+	}
+
+	hubbub_parser_destroy(parser);
+
+	return error;
+}
+
+int main(int argc, char **argv)
+{
+	static const size_t chunks[] = { 1, 7, 100, 4096 };
+	static const struct {
+		const char *doc;
+		const char *names;
+		uint32_t text;
+	} tests[] = {
+		{ "<!DOCTYPE html><html><head><title>Title</title>"
+		  "<meta charset=utf-8><link rel=canonical href=/>"
+		  "</head><body><p>Body text",
+		  "html head title meta link body ", 5 },
+		{ "<title>Title</title><meta name=a> Body text<p>",
+		  "html head title meta body ", 6 },
+		{ "<head><script>var a = '<body>';</script></head>"
+		  "<frameset><frame>",
+		  "html head script frameset ", 17 },
+		{ "<title>Only a head", "html head title body ", 11 }
+	};
+	static char doc[65536];
+	hubbub_error error;
+	uint32_t calls;
+	size_t i, j, len;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	for (i = 0; i < N_ELEMENTS(tests); i++) {
+		/* Follow each document with a long body */
+		len = strlen(tests[i].doc);
+		memcpy(doc, tests[i].doc, len);
+		while (len + SLEN("<p>text") < sizeof(doc)) {
+			memcpy(doc + len, "<p>text", SLEN("<p>text"));
+			len += SLEN("<p>text");
+		}
+		doc[len] = '\0';
+
+		/* Without a body, the head ends with the input */
+		if (i == N_ELEMENTS(tests) - 1)
+			doc[strlen(tests[i].doc)] = '\0';
+
+		for (j = 0; j < N_ELEMENTS(chunks); j++) {
+			error = run_parse(doc, chunks[j], &calls);
+
+			assert(error == HUBBUB_STOPPED);
+			assert(strcmp(ctx.names, tests[i].names) == 0);
+			assert(ctx.text == tests[i].text);
+
+			/* The body is not parsed */
+			assert(calls * chunks[j] < strlen(tests[i].doc) +
+					chunks[j] + 1);
+		}
+
+		printf("Test %u: PASS\n", (unsigned int) i);
+	}
+
+	printf("PASS\n");
+
+	return 0;
+}
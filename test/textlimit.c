@@ -0,0 +1,365 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+
+#include <hubbub/parser.h>
+#include <hubbub/tree.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+#define LIMIT 1024
+#define RUN 100000
+
+/* Growable byte string */
+typedef struct text {
+	uint8_t *data;
+	size_t len;
+	size_t alloc;
+} text;
+
+/* What a parse produced */
+typedef struct result {
+	text characters;	/* All character data, concatenated */
+	text comments;		/* All comment data, concatenated */
+	size_t longest;		/* Longest text or comment token */
+	uint32_t comment_nodes;	/* Number of comment nodes created */
+	size_t longest_node;	/* Longest comment node created */
+} result;
+
+static result res;
+
+static void text_append(text *t, const uint8_t *data, size_t len)
+{
+	if (t->len + len > t->alloc) {
+		t->alloc = (t->len + len) * 2;
+		t->data = realloc(t->data, t->alloc);
+		assert(t->data != NULL);
+	}
+
+	memcpy(t->data + t->len, data, len);
+	t->len += len;
+}
+
+static hubbub_error token_handler(const hubbub_token *token, void *pw)
+{
+	const hubbub_string *str;
+
+	UNUSED(pw);
+
+	if (token->type == HUBBUB_TOKEN_CHARACTER) {
+		str = &token->data.character;
+		text_append(&res.characters, str->ptr, str->len);
+	} else if (token->type == HUBBUB_TOKEN_COMMENT) {
+		str = &token->data.comment;
+		text_append(&res.comments, str->ptr, str->len);
+	} else {
+		return HUBBUB_OK;
+	}
+
+	if (str->len > res.longest)
+		res.longest = str->len;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error create_node(void *ctx, const void *data, void **result)
+{
+	UNUSED(ctx);
+	UNUSED(data);
+
+	*result = (void *) 1;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error create_comment(void *ctx, const hubbub_string *data,
+		void **result)
+{
+	res.comment_nodes++;
+	if (data->len > res.longest_node)
+		res.longest_node = data->len;
+
+	return create_node(ctx, data, result);
+}
+
+static hubbub_error create_doctype(void *ctx, const hubbub_doctype *doctype,
+		void **result)
+{
+	return create_node(ctx, doctype, result);
+}
+
+static hubbub_error create_element(void *ctx, const hubbub_tag *tag,
+		void **result)
+{
+	return create_node(ctx, tag, result);
+}
+
+static hubbub_error create_text(void *ctx, const hubbub_string *data,
+		void **result)
+{
+	text_append(&res.characters, data->ptr, data->len);
+
+	return create_node(ctx, data, result);
+}
+
+static hubbub_error ref_node(void *ctx, void *node)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error append_child(void *ctx, void *parent, void *child,
+		void **result)
+{
+	UNUSED(ctx);
+	UNUSED(parent);
+
+	*result = child;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error insert_before(void *ctx, void *parent, void *child,
+		void *ref_child, void **result)
+{
+	UNUSED(ref_child);
+
+	return append_child(ctx, parent, child, result);
+}
+
+static hubbub_error clone_node(void *ctx, void *node, bool deep,
+		void **result)
+{
+	UNUSED(deep);
+
+	return create_node(ctx, node, result);
+}
+
+static hubbub_error reparent_children(void *ctx, void *node,
+		void *new_parent)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+	UNUSED(new_parent);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error get_parent(void *ctx, void *node, bool element_only,
+		void **result)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+	UNUSED(element_only);
+
+	*result = NULL;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error has_children(void *ctx, void *node, bool *result)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+
+	*result = false;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error form_associate(void *ctx, void *form, void *node)
+{
+	UNUSED(ctx);
+	UNUSED(form);
+	UNUSED(node);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error add_attributes(void *ctx, void *node,
+		const hubbub_attribute *attributes, uint32_t n_attributes)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+	UNUSED(attributes);
+	UNUSED(n_attributes);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error set_quirks_mode(void *ctx, hubbub_quirks_mode mode)
+{
+	UNUSED(ctx);
+	UNUSED(mode);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error encoding_change(void *ctx, const char *encname)
+{
+	UNUSED(ctx);
+	UNUSED(encname);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_tree_handler tree_handler = {
+	create_comment,
+	create_doctype,
+	create_element,
+	create_text,
+	ref_node,
+	ref_node,
+	append_child,
+	insert_before,
+	append_child,
+	clone_node,
+	reparent_children,
+	get_parent,
+	has_children,
+	form_associate,
+	add_attributes,
+	set_quirks_mode,
+	encoding_change,
+	NULL,
+	NULL,
+	0,
+	NULL
+};
+
+/* Parse a document in chunks, optionally limiting the text held */
+static void run_parse(const uint8_t *doc, size_t len, size_t chunk,
+		uint32_t limit, bool tree)
+{
+	hubbub_parser *parser;
+	hubbub_parser_optparams params;
+	size_t off;
+
+	res.characters.len = 0;
+	res.comments.len = 0;
+	res.longest = 0;
+	res.comment_nodes = 0;
+	res.longest_node = 0;
+
+	assert(hubbub_parser_create("UTF-8", false, &parser) == HUBBUB_OK);
+
+	if (tree) {
+		params.tree_handler = &tree_handler;
+		assert(hubbub_parser_setopt(parser,
+				HUBBUB_PARSER_TREE_HANDLER,
+				&params) == HUBBUB_OK);
+
+		params.document_node = (void *) 1;
+		assert(hubbub_parser_setopt(parser,
+				HUBBUB_PARSER_DOCUMENT_NODE,
+				&params) == HUBBUB_OK);
+	} else {
+		params.token_handler.handler = token_handler;
+		params.token_handler.pw = NULL;
+		assert(hubbub_parser_setopt(parser,
+				HUBBUB_PARSER_TOKEN_HANDLER,
+				&params) == HUBBUB_OK);
+	}
+
+	params.text_limit = limit;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TEXT_LIMIT,
+			&params) == HUBBUB_OK);
+
+	for (off = 0; off < len; off += chunk) {
+		assert(hubbub_parser_parse_chunk(parser, doc + off,
+				min(chunk, len - off)) == HUBBUB_OK);
+	}
+
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	hubbub_parser_destroy(parser);
+}
+
+/* Append a long run of a pattern, broken by markup-like characters */
+static void append_run(text *doc, const char *pattern)
+{
+	size_t i;
+
+	for (i = 0; i < RUN; i += strlen(pattern))
+		text_append(doc, (const uint8_t *) pattern, strlen(pattern));
+}
+
+int main(int argc, char **argv)
+{
+	static const size_t chunks[] = { 1, 7, 100, 4096, 65536 };
+	text doc = { NULL, 0, 0 }, chars = { NULL, 0, 0 };
+	text comments = { NULL, 0, 0 };
+	size_t comment_len, i;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	text_append(&doc, (const uint8_t *) "<p>", SLEN("<p>"));
+	append_run(&doc, "Lorem ipsum &amp; dolor\r\n sit amet, ");
+	text_append(&doc, (const uint8_t *) "</p><!--", SLEN("</p><!--"));
+	comment_len = doc.len;
+	append_run(&doc, "consectetur - adipiscing -- elit ");
+	comment_len = doc.len - comment_len;
+	text_append(&doc, (const uint8_t *) "--><title>",
+			SLEN("--><title>"));
+	append_run(&doc, "sed do &lt; eiusmod <!-- tempor --> ");
+	text_append(&doc, (const uint8_t *) "</title><style>",
+			SLEN("</title><style>"));
+	append_run(&doc, "incididunt <!-- ut > labore - ");
+	text_append(&doc, (const uint8_t *) "</style>", SLEN("</style>"));
+
+	for (i = 0; i < N_ELEMENTS(chunks); i++) {
+		run_parse(doc.data, doc.len, chunks[i], 0, false);
+
+		chars.len = 0;
+		text_append(&chars, res.characters.data, res.characters.len);
+		comments.len = 0;
+		text_append(&comments, res.comments.data, res.comments.len);
+
+		/* The same content must arrive, in smaller pieces */
+		run_parse(doc.data, doc.len, chunks[i], LIMIT, false);
+
+		assert(res.characters.len == chars.len);
+		assert(memcmp(res.characters.data, chars.data,
+				chars.len) == 0);
+		assert(res.comments.len == comments.len);
+		assert(memcmp(res.comments.data, comments.data,
+				comments.len) == 0);
+		/* Dashes read at the end of a comment may exceed the limit */
+		assert(res.longest <= LIMIT + chunks[i] + SLEN("--"));
+
+		/* Likewise with the treebuilder, which switches to RCDATA
+		 * and CDATA, and reassembles the pieces of the comment */
+		run_parse(doc.data, doc.len, chunks[i], 0, true);
+
+		chars.len = 0;
+		text_append(&chars, res.characters.data, res.characters.len);
+
+		run_parse(doc.data, doc.len, chunks[i], LIMIT, true);
+
+		assert(res.characters.len == chars.len);
+		assert(memcmp(res.characters.data, chars.data,
+				chars.len) == 0);
+		assert(res.comment_nodes == 1);
+		assert(res.longest_node == comment_len);
+
+		printf("Chunks of %u: PASS\n", (unsigned int) chunks[i]);
+	}
+
+	free(comments.data);
+	free(chars.data);
+	free(doc.data);
+	free(res.comments.data);
+	free(res.characters.data);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,176 @@
+/*
+ * Many parsers at once, one on each of several threads.
+ *
+ * Each thread parses the same documents, over and over, and checks that
+ * it builds the same trees as a parse on the main thread did. Run under
+ * ThreadSanitizer, this also shows that parsers share nothing but tables
+ * which are never written.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include <hubbub/hubbub.h>
+#include <hubbub/dom.h>
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+#define N_THREADS 8
+#define N_ROUNDS 4
+
+/* Reaches the charset, doctype, entity and foreign content tables */
+static const char extra[] =
+	"<!DOCTYPE html PUBLIC \"-//W3C//DTD HTML 4.01 Transitional//EN\">"
+	"<html><head><meta charset=\"utf-16\">"
+	"<meta http-equiv=\"Content-Type\" content=\"text/html; "
+	"charset=windows-1252\"><title>&amp;&notin &#x80;&#150;</title>"
+	"</head><body><p>&nbsp;&lt;&gt;&quot;&#39;&AElig;&zwnj;&xyz;"
+	"<table><tr><td>cell<b>bold<td>next</table><isindex prompt=x>"
+	"<svg viewbox=\"0 0 1 1\"><foreignobject><p>in svg</p>"
+	"</foreignobject><clippath/></svg><math definitionurl=x><mi>x</mi>"
+	"<annotation-xml encoding=\"text/html\"><div>y</div>"
+	"</annotation-xml></math><textarea>&amp;</textarea><plaintext>&lt;";
+
+typedef struct document {
+	const uint8_t *data;
+	size_t len;
+	uint32_t nodes;		/**< Nodes built on the main thread */
+} document;
+
+typedef struct worker {
+	pthread_t thread;
+	size_t chunk;		/**< Size of the chunks fed to the parser */
+	bool failed;
+} worker;
+
+static document documents[2];
+
+static uint32_t parse(hubbub_dom *dom, const document *doc, size_t chunk)
+{
+	hubbub_parser *parser;
+	size_t offset, len;
+
+	if (hubbub_parser_create(NULL, false, &parser) != HUBBUB_OK)
+		return 0;
+
+	if (hubbub_dom_reset(dom) != HUBBUB_OK ||
+			hubbub_dom_attach(dom, parser) != HUBBUB_OK) {
+		hubbub_parser_destroy(parser);
+		return 0;
+	}
+
+	for (offset = 0; offset < doc->len; offset += len) {
+		len = min(chunk, doc->len - offset);
+
+		if (hubbub_parser_parse_chunk(parser, doc->data + offset,
+				len) != HUBBUB_OK) {
+			hubbub_parser_destroy(parser);
+			return 0;
+		}
+	}
+
+	if (hubbub_parser_completed(parser) != HUBBUB_OK) {
+		hubbub_parser_destroy(parser);
+		return 0;
+	}
+
+	hubbub_parser_destroy(parser);
+
+	return hubbub_dom_count(dom);
+}
+
+static void *run_worker(void *arg)
+{
+	worker *self = arg;
+	hubbub_dom *dom;
+	size_t round, i;
+
+	if (hubbub_dom_create(NULL, NULL, &dom) != HUBBUB_OK) {
+		self->failed = true;
+		return NULL;
+	}
+
+	for (round = 0; round < N_ROUNDS; round++) {
+		for (i = 0; i < N_ELEMENTS(documents); i++) {
+			if (parse(dom, &documents[i], self->chunk) !=
+					documents[i].nodes)
+				self->failed = true;
+		}
+	}
+
+	hubbub_dom_destroy(dom);
+
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	worker workers[N_THREADS];
+	hubbub_dom *dom;
+	uint8_t *buf;
+	size_t len, i;
+	FILE *fp;
+
+	if (argc != 2) {
+		printf("Usage: %s <filename>\n", argv[0]);
+		return 1;
+	}
+
+	fp = fopen(argv[1], "rb");
+	if (fp == NULL) {
+		printf("Failed opening %s\n", argv[1]);
+		return 1;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	buf = malloc(len);
+	assert(buf != NULL);
+	assert(fread(buf, 1, len, fp) == len);
+
+	fclose(fp);
+
+	documents[0].data = buf;
+	documents[0].len = len;
+	documents[1].data = (const uint8_t *) extra;
+	documents[1].len = SLEN(extra);
+
+	assert(hubbub_dom_create(NULL, NULL, &dom) == HUBBUB_OK);
+
+	for (i = 0; i < N_ELEMENTS(documents); i++) {
+		documents[i].nodes = parse(dom, &documents[i], SIZE_MAX);
+		assert(documents[i].nodes != 0);
+	}
+
+	hubbub_dom_destroy(dom);
+
+	/* Different chunk sizes take the tokeniser down different paths */
+	for (i = 0; i < N_THREADS; i++) {
+		workers[i].chunk = i == 0 ? SIZE_MAX : 61 * i;
+		workers[i].failed = false;
+
+		assert(pthread_create(&workers[i].thread, NULL, run_worker,
+				&workers[i]) == 0);
+	}
+
+	for (i = 0; i < N_THREADS; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	for (i = 0; i < N_THREADS; i++)
+		assert(workers[i].failed == false);
+
+	free(buf);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -31,7 +31,8 @@ int main(int argc, char **argv)
 	assert(parserutils_inputstream_create("UTF-8", 0, NULL,
 			&stream) == PARSERUTILS_OK);
 
-	assert(hubbub_tokeniser_create(stream, &tok) == HUBBUB_OK);
+	assert(hubbub_tokeniser_create(stream, NULL, NULL, &tok) ==
+			HUBBUB_OK);
 
 	params.token_handler.handler = token_handler;
 	params.token_handler.pw = NULL;
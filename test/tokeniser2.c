@@ -130,7 +130,8 @@ void run_test(context *ctx)
 		assert(parserutils_inputstream_create("UTF-8", 0, NULL,
 				&stream) == PARSERUTILS_OK);
 
-		assert(hubbub_tokeniser_create(stream, &tok) == HUBBUB_OK);
+		assert(hubbub_tokeniser_create(stream, NULL, NULL, &tok) ==
+				HUBBUB_OK);
 
 		if (ctx->last_start_tag != NULL) {
 			/* Fake up a start tag, in PCDATA state */
@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+static const char document[] =
+	"<p a=1 b=2 a=3 B=4>"
+	"<title>&lt;b&gt;</title>"
+	"<script><i></script>"
+	"<noscript><u></noscript>"
+	"<textarea><s></textarea>";
+
+/* Calls made to the parser's allocator */
+static int calls;
+
+static hubbub_parser *parser;
+static bool scripting;
+
+/* Names of the start tags seen, and the number of attributes of the first */
+static char tags[64];
+static uint32_t p_attributes;
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	calls++;
+
+	if (len == 0) {
+		free(ptr);
+		return NULL;
+	}
+
+	return realloc(ptr, len);
+}
+
+/* Drive the content model as the treebuilder would */
+static hubbub_error token_handler(const hubbub_token *token, void *pw)
+{
+	hubbub_parser_optparams params;
+	const hubbub_tag *tag = &token->data.tag;
+
+	UNUSED(pw);
+
+	if (token->type != HUBBUB_TOKEN_START_TAG)
+		return HUBBUB_OK;
+
+	if (tags[0] == '\0')
+		p_attributes = tag->n_attributes;
+
+	assert(strlen(tags) + tag->name.len + 2 < sizeof(tags));
+	strncat(tags, (const char *) tag->name.ptr, tag->name.len);
+	strcat(tags, " ");
+
+	params.content_model.model =
+			hubbub_parser_content_model_for(tag, scripting);
+
+	return hubbub_parser_setopt(parser, HUBBUB_PARSER_CONTENT_MODEL,
+			&params);
+}
+
+static void parse(bool keep_duplicates)
+{
+	hubbub_parser_optparams params;
+
+	tags[0] = '\0';
+
+	assert(hubbub_parser_create_for_tokens(NULL, false, myrealloc, NULL,
+			&parser) == HUBBUB_OK);
+
+	params.token_handler.handler = token_handler;
+	params.token_handler.pw = NULL;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TOKEN_HANDLER,
+			&params) == HUBBUB_OK);
+
+	params.keep_duplicate_attributes = keep_duplicates;
+	assert(hubbub_parser_setopt(parser,
+			HUBBUB_PARSER_KEEP_DUPLICATE_ATTRIBUTES,
+			&params) == HUBBUB_OK);
+
+	/* Tree options are ignored */
+	params.enable_scripting = true;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_ENABLE_SCRIPTING,
+			&params) == HUBBUB_OK);
+
+	assert(hubbub_parser_parse_chunk(parser, (const uint8_t *) document,
+			SLEN(document)) == HUBBUB_OK);
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	hubbub_parser_destroy(parser);
+}
+
+int main(int argc, char **argv)
+{
+	hubbub_parser_optparams params;
+	int token_calls, tree_calls;
+	hubbub_parser *tree;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	calls = 0;
+	assert(hubbub_parser_create_for_tokens(NULL, false, myrealloc, NULL,
+			&parser) == HUBBUB_OK);
+	hubbub_parser_destroy(parser);
+	token_calls = calls;
+
+	assert(hubbub_parser_create_for_tokens(NULL, false, NULL, NULL,
+			NULL) == HUBBUB_BADPARM);
+
+	/* No tag is read from the content of the elements which the
+	 * treebuilder reads as text */
+	scripting = true;
+	parse(false);
+
+	printf("tags: %s\n", tags);
+	assert(strcmp(tags, "p title script noscript textarea ") == 0);
+	assert(p_attributes == 2);
+
+	scripting = false;
+	parse(true);
+	assert(strcmp(tags, "p title script noscript u textarea ") == 0);
+	assert(p_attributes == 4);
+
+	/* A parser which builds a tree must have unique attributes ... */
+	assert(hubbub_parser_create_with_allocator(NULL, false, myrealloc,
+			NULL, &tree) == HUBBUB_OK);
+
+	params.keep_duplicate_attributes = true;
+	assert(hubbub_parser_setopt(tree,
+			HUBBUB_PARSER_KEEP_DUPLICATE_ATTRIBUTES,
+			&params) == HUBBUB_INVALID);
+
+	hubbub_parser_destroy(tree);
+
+	/* ... and costs more to create, even if it is only to tokenise */
+	calls = 0;
+	assert(hubbub_parser_create_with_allocator(NULL, false, myrealloc,
+			NULL, &tree) == HUBBUB_OK);
+
+	params.token_handler.handler = token_handler;
+	params.token_handler.pw = NULL;
+	assert(hubbub_parser_setopt(tree, HUBBUB_PARSER_TOKEN_HANDLER,
+			&params) == HUBBUB_OK);
+
+	hubbub_parser_destroy(tree);
+	tree_calls = calls;
+
+	printf("allocator calls: %d tokens only, %d to create a tree\n",
+			token_calls, tree_calls);
+	assert(tree_calls > token_calls);
+
+	printf("PASS\n");
+
+	return 0;
+}
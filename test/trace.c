@@ -0,0 +1,164 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+#include <hubbub/dom.h>
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+static const char doc[] =
+	"<!DOCTYPE html><title>T</title>"
+	"<p class=a>a &amp; b<!-- c --><b><i>c</b>d</i>"
+	"<table><tr><td>x</table>";
+
+/* What the trace handler has seen */
+static struct {
+	uint32_t events[HUBBUB_TRACE_TREE_CALL + 1];
+	uint32_t tokens[HUBBUB_TOKEN_EOF + 1];
+	uint32_t calls[HUBBUB_TREE_N_CALLS];
+	const char *first_state;
+	const char *first_mode;
+	bool in_body;
+	size_t offset;
+} seen;
+
+static void trace_handler(const hubbub_trace_event *event, void *pw)
+{
+	UNUSED(pw);
+
+	seen.events[event->type]++;
+
+	/* Events arrive in input order */
+	assert(event->offset >= seen.offset);
+	assert(event->offset <= SLEN(doc));
+	seen.offset = event->offset;
+
+	assert(event->name != NULL);
+
+	switch (event->type) {
+	case HUBBUB_TRACE_STATE:
+		if (seen.first_state == NULL)
+			seen.first_state = event->name;
+		break;
+	case HUBBUB_TRACE_TOKEN:
+		assert(event->value <= HUBBUB_TOKEN_EOF);
+		seen.tokens[event->value]++;
+		break;
+	case HUBBUB_TRACE_MODE:
+		if (seen.first_mode == NULL)
+			seen.first_mode = event->name;
+		if (strcmp(event->name, "IN_BODY") == 0)
+			seen.in_body = true;
+		break;
+	case HUBBUB_TRACE_TREE_CALL:
+		assert(event->value < HUBBUB_TREE_N_CALLS);
+		seen.calls[event->value]++;
+		break;
+	}
+}
+
+static void parse(hubbub_parser *parser, hubbub_dom *dom, size_t chunk)
+{
+	size_t offset, len;
+
+	memset(&seen, 0, sizeof(seen));
+
+	assert(hubbub_parser_reset(parser, NULL, false) == HUBBUB_OK);
+	assert(hubbub_dom_reset(dom) == HUBBUB_OK);
+	assert(hubbub_dom_attach(dom, parser) == HUBBUB_OK);
+
+	for (offset = 0; offset < SLEN(doc); offset += len) {
+		len = min(chunk, SLEN(doc) - offset);
+
+		assert(hubbub_parser_parse_chunk(parser,
+				(const uint8_t *) doc + offset, len) ==
+				HUBBUB_OK);
+	}
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+}
+
+int main(int argc, char **argv)
+{
+	static const size_t chunks[] = { 1, 7, SIZE_MAX };
+	hubbub_parser_optparams params;
+	hubbub_parser_stats stats;
+	hubbub_parser *parser;
+	hubbub_dom *dom;
+	uint32_t nodes;
+	size_t i;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	assert(hubbub_dom_create(NULL, NULL, &dom) == HUBBUB_OK);
+	assert(hubbub_parser_create(NULL, false, &parser) == HUBBUB_OK);
+
+	/* Nothing is traced by default */
+	parse(parser, dom, SIZE_MAX);
+	nodes = hubbub_dom_count(dom);
+
+	params.trace_handler.handler = trace_handler;
+	params.trace_handler.pw = NULL;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TRACE_HANDLER,
+			&params) == HUBBUB_OK);
+
+	params.count_tree_calls = true;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_COUNT_TREE_CALLS,
+			&params) == HUBBUB_OK);
+
+	for (i = 0; i < N_ELEMENTS(chunks); i++) {
+		parse(parser, dom, chunks[i]);
+		assert(hubbub_dom_count(dom) == nodes);
+
+		assert(hubbub_parser_read_stats(parser, &stats) == HUBBUB_OK);
+
+		assert(strcmp(seen.first_state, "DATA") == 0);
+		assert(strcmp(seen.first_mode, "INITIAL") == 0);
+		assert(seen.in_body);
+		assert(seen.offset == SLEN(doc));
+
+		/* Each token and each call is traced once */
+		assert(memcmp(seen.tokens, stats.tokens,
+				sizeof(seen.tokens)) == 0);
+		assert(memcmp(seen.calls, stats.tree_calls,
+				sizeof(seen.calls)) == 0);
+		assert(seen.calls[HUBBUB_TREE_CREATE_ELEMENT] > 0);
+
+		/* And each token is handled in at least one mode */
+		assert(seen.events[HUBBUB_TRACE_MODE] >=
+				seen.events[HUBBUB_TRACE_TOKEN]);
+		assert(seen.events[HUBBUB_TRACE_STATE] > 0);
+	}
+
+	/* Calls are traced, but not counted, unless asked for */
+	params.count_tree_calls = false;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_COUNT_TREE_CALLS,
+			&params) == HUBBUB_OK);
+
+	parse(parser, dom, SIZE_MAX);
+	assert(hubbub_parser_read_stats(parser, &stats) == HUBBUB_OK);
+	assert(seen.calls[HUBBUB_TREE_CREATE_ELEMENT] > 0);
+	assert(stats.tree_calls[HUBBUB_TREE_CREATE_ELEMENT] == 0);
+
+	/* Removing the handler stops tracing */
+	params.trace_handler.handler = NULL;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TRACE_HANDLER,
+			&params) == HUBBUB_OK);
+
+	parse(parser, dom, SIZE_MAX);
+	assert(hubbub_dom_count(dom) == nodes);
+	for (i = 0; i < N_ELEMENTS(seen.events); i++)
+		assert(seen.events[i] == 0);
+
+	hubbub_parser_destroy(parser);
+	hubbub_dom_destroy(dom);
+
+	printf("PASS\n");
+
+	return 0;
+}
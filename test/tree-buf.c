@@ -117,6 +117,8 @@ static hubbub_tree_handler tree_handler = {
 	set_quirks_mode,
 	NULL,
 	complete_script,
+	NULL,
+	0,
 	NULL
 };
 
@@ -124,7 +126,7 @@ static hubbub_tree_handler tree_handler = {
 /*
  * Create, initialise, and return, a parser instance.
  */
-static hubbub_parser *setup_parser(void)
+static hubbub_parser *setup_parser(bool coalesce)
 {
 	hubbub_parser *parser;
 	hubbub_parser_optparams params;
@@ -145,6 +147,10 @@ static hubbub_parser *setup_parser(void)
 			&params) == HUBBUB_OK);
 */
 
+	params.coalesce_characters = coalesce;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_COALESCE_CHARACTERS,
+			&params) == HUBBUB_OK);
+
 	return parser;
 }
 
@@ -175,16 +181,54 @@ static void buf_add(buf_t *buf, const char *str)
 }
 
 
+/*
+ * Parse the data in the given chunks, and print the tree built to a buffer
+ */
+static void parse(FILE *fp, const size_t *chunks, size_t n_chunks,
+		bool coalesce, buf_t *got)
+{
+	char buf[4096];
+	hubbub_parser *parser;
+	uint32_t i;
+
+	parser = setup_parser(coalesce);
+
+	for (i = 0; i < n_chunks; i++) {
+                ssize_t bytes_read;
+		assert(chunks[i] <= sizeof(buf));
+
+		bytes_read = fread(buf, 1, chunks[i], fp);
+                assert((size_t)(bytes_read) == chunks[i]);
+
+		assert(hubbub_parser_parse_chunk(parser, (uint8_t *) buf,
+				chunks[i]) == HUBBUB_OK);
+	}
+
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	node_print(got, Document, 0);
+
+	hubbub_parser_destroy(parser);
+	while (Document) {
+		node_t *victim = Document;
+		Document = victim->next;
+		delete_node(victim);
+	}
+	Document = NULL;
+}
+
+
 int main(int argc, char **argv)
 {
 	FILE *fp;
 	char buf[4096];
 	size_t *chunks;
 	size_t n_chunks;
-	hubbub_parser *parser;
+	long data;
 	uint32_t i;
 
 	buf_t got = { NULL, 0, 0 };
+	buf_t coalesced = { NULL, 0, 0 };
 
 	if (argc != 2) {
 		printf("Usage: %s <filename>\n", argv[0]);
@@ -219,37 +263,22 @@ int main(int argc, char **argv)
 	assert(fgets(buf, sizeof(buf), fp) != NULL);
 	assert(strcmp(buf, "#data\n") == 0);
 
-	parser = setup_parser();
-
-	for (i = 0; i < n_chunks; i++) {
-                ssize_t bytes_read;
-		assert(chunks[i] <= sizeof(buf));
-
-		bytes_read = fread(buf, 1, chunks[i], fp);
-                assert((size_t)(bytes_read) == chunks[i]);
-
-		assert(hubbub_parser_parse_chunk(parser, (uint8_t *) buf,
-				chunks[i]) == HUBBUB_OK);
-	}
-
-	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+	data = ftell(fp);
 
-	node_print(&got, Document, 0);
+	parse(fp, chunks, n_chunks, false, &got);
 	printf("%s", got.buf);
 
-	hubbub_parser_destroy(parser);
-	while (Document) {
-		node_t *victim = Document;
-		Document = victim->next;
-		delete_node(victim);
-	}
-	Document = NULL;
+	/* Merging character tokens must not change the tree */
+	assert(fseek(fp, data, SEEK_SET) == 0);
+	parse(fp, chunks, n_chunks, true, &coalesced);
+	assert(strcmp(coalesced.buf, got.buf) == 0);
 
 	printf("PASS\n");
 
 	free(chunks);
 	fclose(fp);
 
+	free(coalesced.buf);
 	free(got.buf);
 
 	return 0;
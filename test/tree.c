@@ -16,6 +16,12 @@ static uint16_t *node_ref;
 static uintptr_t node_ref_alloc;
 static uintptr_t node_counter;
 
+/* Adoption agency clones allowed per document */
+#define AA_CLONE_LIMIT 64
+
+/* Deepest nesting of elements */
+#define MAX_DEPTH 512
+
 #define GROW_REF							\
 	if (node_counter >= node_ref_alloc) {				\
 		uint16_t *temp = realloc(node_ref,			\
@@ -75,6 +81,8 @@ static hubbub_tree_handler tree_handler = {
 	set_quirks_mode,
 	NULL,
 	complete_script,
+	NULL,
+	0,
 	NULL
 };
 
@@ -87,6 +95,7 @@ static int run_test(int argc, char **argv, unsigned int CHUNK_SIZE)
 	uint8_t *buf = malloc(CHUNK_SIZE);
 	const char *charset;
 	hubbub_charset_source cssource;
+	hubbub_aa_counts counts;
 	bool passed = true;
 	uintptr_t n;
 
@@ -105,6 +114,14 @@ static int run_test(int argc, char **argv, unsigned int CHUNK_SIZE)
 	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TREE_HANDLER,
 			&params) == HUBBUB_OK);
 
+	params.aa_clone_limit = AA_CLONE_LIMIT;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_AA_CLONE_LIMIT,
+			&params) == HUBBUB_OK);
+
+	params.max_depth = MAX_DEPTH;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_MAX_DEPTH,
+			&params) == HUBBUB_OK);
+
 	params.document_node = (void *) ++node_counter;
 	ref_node(NULL, (void *) node_counter);
 	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_DOCUMENT_NODE,
@@ -116,6 +133,31 @@ static int run_test(int argc, char **argv, unsigned int CHUNK_SIZE)
 		return 1;
 	}
 
+	/* Build part of a tree, then reset the parser and ensure that it
+	 * released everything it held */
+	len = fread(buf, 1, CHUNK_SIZE, fp);
+	if (len > 0) {
+		assert(hubbub_parser_parse_chunk(parser,
+				buf, len) == HUBBUB_OK);
+	}
+
+	assert(hubbub_parser_reset(parser, "UTF-8", false) == HUBBUB_OK);
+
+	for (n = 1; n <= node_counter; n++) {
+		if (node_ref[n] != 0) {
+			printf("%" PRIuPTR " still referenced after reset "
+					"(=%u)\n", n, node_ref[n]);
+			passed = false;
+		}
+	}
+
+	params.document_node = (void *) ++node_counter;
+	GROW_REF
+	node_ref[node_counter] = 0;
+	ref_node(NULL, (void *) node_counter);
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_DOCUMENT_NODE,
+			&params) == HUBBUB_OK);
+
 	fseek(fp, 0, SEEK_END);
 	len = ftell(fp);
 	fseek(fp, 0, SEEK_SET);
@@ -142,6 +184,12 @@ static int run_test(int argc, char **argv, unsigned int CHUNK_SIZE)
 
 	printf("Charset: %s (from %d)\n", charset, cssource);
 
+	/* Each pass of the adoption agency clones at most one node for
+	 * each of its bounded inner passes, plus the furthest block */
+	assert(hubbub_parser_read_aa_counts(parser, &counts) == HUBBUB_OK);
+	assert(counts.iterations <= counts.runs * 8);
+	assert(counts.clones < AA_CLONE_LIMIT + 4);
+
 	hubbub_parser_destroy(parser);
 
 	/* Ensure that all nodes have been released by the treebuilder */
@@ -117,6 +117,8 @@ static hubbub_tree_handler tree_handler = {
 	set_quirks_mode,
 	NULL,
         complete_script,
+	NULL,
+	0,
 	NULL
 };
 
@@ -189,9 +191,48 @@ enum reading_state {
 	READING_DATA,
 	READING_DATA_AFTER_FIRST,
 	READING_ERRORS,
+	READING_CONTEXT,
+	READING_MAX_DEPTH,
 	READING_TREE
 };
 
+/*
+ * Parse the data of a test, as a document or as the content of an element
+ */
+static void parse_data(hubbub_parser *parser, const buf_t *data,
+		const char *context)
+{
+	if (context != NULL) {
+		hubbub_string name;
+
+		name.ptr = (const uint8_t *) context;
+		name.len = strlen(context);
+
+		assert(hubbub_parser_begin_fragment(parser, &name) ==
+				HUBBUB_OK);
+	}
+
+	if (data->buf != NULL) {
+		assert(hubbub_parser_parse_chunk(parser,
+				(const uint8_t *) data->buf,
+				strlen(data->buf)) == HUBBUB_OK);
+	}
+
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+}
+
+/*
+ * Find the nodes to compare: those in the document, or in the html element
+ * holding a fragment
+ */
+static node_t *test_result(bool fragment)
+{
+	if (fragment)
+		return Document != NULL ? Document->child : NULL;
+
+	return Document;
+}
+
 int main(int argc, char **argv)
 {
 	FILE *fp;
@@ -201,10 +242,15 @@ int main(int argc, char **argv)
 	bool passed = true;
 
 	hubbub_parser *parser = NULL;
+	hubbub_parser_optparams params;
 	enum reading_state state = EXPECT_DATA;
 
 	buf_t expected = { NULL, 0, 0 };
 	buf_t got = { NULL, 0, 0 };
+	buf_t data = { NULL, 0, 0 };
+
+	char context[64];
+	bool fragment = false;
 
 
 	if (argc != 2) {
@@ -227,6 +273,8 @@ int main(int argc, char **argv)
 		case ERASE_DATA:
 			buf_clear(&got);
 			buf_clear(&expected);
+			buf_clear(&data);
+			fragment = false;
 
 			if (parser != NULL) {
 				hubbub_parser_destroy(parser);
@@ -252,41 +300,56 @@ int main(int argc, char **argv)
 		case READING_DATA:
 		case READING_DATA_AFTER_FIRST:
 			if (strcmp(line, "#errors\n") == 0) {
-				assert(hubbub_parser_completed(parser) == HUBBUB_OK);
 				state = READING_ERRORS;
 			} else {
-				size_t len = strlen(line);
-
+				/* The data is parsed once its context is
+				 * known, after the errors */
 				if (state == READING_DATA_AFTER_FIRST) {
-					assert(hubbub_parser_parse_chunk(parser,
-						(uint8_t *)"\n",
-						1) == HUBBUB_OK);
+					buf_add(&data, "\n");
 				} else {
 					state = READING_DATA_AFTER_FIRST;
 				}
 
 				printf(": %s", line);
-				assert(hubbub_parser_parse_chunk(parser, (uint8_t *)line,
-						len - 1) == HUBBUB_OK);
+				line[strlen(line) - 1] = '\0';
+				buf_add(&data, line);
 			}
 			break;
 
 
 		case READING_ERRORS:
 			if (strcmp(line, "#document-fragment\n") == 0) {
-				state = ERASE_DATA;
-				reprocess = true;
-			}
-
-			if (strcmp(line, "#document\n") == 0)
+				state = READING_CONTEXT;
+			} else if (strcmp(line, "#max-depth\n") == 0) {
+				state = READING_MAX_DEPTH;
+			} else if (strcmp(line, "#document\n") == 0) {
+				parse_data(parser, &data,
+						fragment ? context : NULL);
 				state = READING_TREE;
-			else {
 			}
 			break;
 
+		case READING_CONTEXT:
+			assert(strlen(line) < sizeof(context));
+			strcpy(context, line);
+			context[strlen(context) - 1] = '\0';
+			fragment = true;
+			printf("context: %s\n", context);
+			state = READING_ERRORS;
+			break;
+
+		case READING_MAX_DEPTH:
+			params.max_depth = atoi(line);
+			assert(hubbub_parser_setopt(parser,
+					HUBBUB_PARSER_MAX_DEPTH,
+					&params) == HUBBUB_OK);
+			printf("max depth: %u\n", params.max_depth);
+			state = READING_ERRORS;
+			break;
+
 		case READING_TREE:
 			if (strcmp(line, "#data\n") == 0) {
-				node_print(&got, Document, 0);
+				node_print(&got, test_result(fragment), 0);
 
 				/* Trim off the last newline */
 				expected.buf[strlen(expected.buf) - 1] = '\0';
@@ -309,7 +372,7 @@ int main(int argc, char **argv)
 	}
 
 	if (Document != NULL) {
-		node_print(&got, Document, 0);
+		node_print(&got, test_result(fragment), 0);
 
 		passed = !strcmp(got.buf, expected.buf);
 		if (!passed) {
@@ -336,6 +399,7 @@ int main(int argc, char **argv)
 
 	free(got.buf);
 	free(expected.buf);
+	free(data.buf);
 
 	if (parser != NULL) {
 		hubbub_parser_destroy(parser);
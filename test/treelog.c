@@ -0,0 +1,582 @@
+/*
+ * Tree construction tester, applying a tree command log.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+#include <hubbub/parser.h>
+#include <hubbub/treelog.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+#define NONE UINT32_MAX
+
+typedef struct buf_t {
+	char *buf;
+	size_t len;
+	size_t pos;
+} buf_t;
+
+typedef struct attr_t {
+	hubbub_ns ns;
+	char *name;
+	char *value;
+} attr_t;
+
+typedef struct node_t {
+	enum { VACANT, DOCUMENT, DOCTYPE, COMMENT, ELEMENT, CHARACTER } type;
+
+	hubbub_ns ns;
+	char *name;		/* Element or doctype name */
+	char *content;		/* Text or comment content */
+	char *public_id;
+	char *system_id;
+	attr_t *attrs;
+	uint32_t n_attrs;
+
+	uint32_t parent;
+	uint32_t first_child;
+	uint32_t last_child;
+	uint32_t prev;
+	uint32_t next;
+} node_t;
+
+#define NUM_NAMESPACES 7
+static const char * const ns_names[NUM_NAMESPACES] = {
+	NULL, NULL /*html*/, "math", "svg", "xlink", "xml", "xmlns"
+};
+
+/* The client's tree, indexed by node identifier */
+static node_t *nodes;
+static uint32_t n_nodes;
+static uint32_t batches;
+
+static char *string_dup(const hubbub_string *str)
+{
+	char *s = malloc(str->len + 1);
+
+	assert(s != NULL);
+	memcpy(s, str->ptr, str->len);
+	s[str->len] = '\0';
+
+	return s;
+}
+
+static char *string_cat(char *s, const char *more, size_t len)
+{
+	size_t old = strlen(s);
+
+	s = realloc(s, old + len + 1);
+	assert(s != NULL);
+	memcpy(s + old, more, len);
+	s[old + len] = '\0';
+
+	return s;
+}
+
+static node_t *new_node(uint32_t id, int type)
+{
+	node_t *node;
+
+	while (id >= n_nodes) {
+		uint32_t n = n_nodes ? n_nodes * 2 : 64;
+
+		nodes = realloc(nodes, n * sizeof(node_t));
+		assert(nodes != NULL);
+		memset(nodes + n_nodes, 0, (n - n_nodes) * sizeof(node_t));
+		n_nodes = n;
+	}
+
+	node = &nodes[id];
+	assert(node->type == VACANT);
+
+	node->type = type;
+	node->parent = node->first_child = node->last_child =
+			node->prev = node->next = NONE;
+
+	return node;
+}
+
+static void add_attrs(node_t *node, const hubbub_attribute *attrs,
+		uint32_t n_attrs)
+{
+	uint32_t i, j;
+
+	node->attrs = realloc(node->attrs,
+			(node->n_attrs + n_attrs) * sizeof(attr_t));
+	assert(node->attrs != NULL || node->n_attrs + n_attrs == 0);
+
+	for (i = 0; i < n_attrs; i++) {
+		char *name = string_dup(&attrs[i].name);
+
+		for (j = 0; j < node->n_attrs; j++) {
+			if (strcmp(node->attrs[j].name, name) == 0)
+				break;
+		}
+
+		if (j < node->n_attrs) {
+			free(name);
+			continue;
+		}
+
+		node->attrs[node->n_attrs].ns = attrs[i].ns;
+		node->attrs[node->n_attrs].name = name;
+		node->attrs[node->n_attrs].value =
+				string_dup(&attrs[i].value);
+		node->n_attrs++;
+	}
+}
+
+static void unlink_node(uint32_t id)
+{
+	node_t *node = &nodes[id];
+
+	if (node->parent == NONE)
+		return;
+
+	if (node->prev != NONE)
+		nodes[node->prev].next = node->next;
+	else
+		nodes[node->parent].first_child = node->next;
+
+	if (node->next != NONE)
+		nodes[node->next].prev = node->prev;
+	else
+		nodes[node->parent].last_child = node->prev;
+
+	node->parent = node->prev = node->next = NONE;
+}
+
+static void link_node(uint32_t parent, uint32_t id, uint32_t before)
+{
+	node_t *node = &nodes[id];
+
+	assert(nodes[parent].type != VACANT);
+
+	unlink_node(id);
+
+	node->parent = parent;
+	node->next = before;
+
+	if (before == NONE) {
+		node->prev = nodes[parent].last_child;
+		nodes[parent].last_child = id;
+	} else {
+		assert(nodes[before].parent == parent);
+		node->prev = nodes[before].prev;
+		nodes[before].prev = id;
+	}
+
+	if (node->prev != NONE)
+		nodes[node->prev].next = id;
+	else
+		nodes[parent].first_child = id;
+}
+
+static char *strdup_or_null(const char *s)
+{
+	return s != NULL ? strdup(s) : NULL;
+}
+
+static void clone_node(uint32_t id, uint32_t from)
+{
+	node_t *node = new_node(id, nodes[from].type);
+	const node_t *old = &nodes[from];
+	uint32_t i;
+
+	node->ns = old->ns;
+	node->name = strdup_or_null(old->name);
+	node->content = strdup_or_null(old->content);
+	node->public_id = strdup_or_null(old->public_id);
+	node->system_id = strdup_or_null(old->system_id);
+
+	if (old->n_attrs > 0) {
+		node->attrs = malloc(old->n_attrs * sizeof(attr_t));
+		assert(node->attrs != NULL);
+	}
+
+	for (i = 0; i < old->n_attrs; i++) {
+		node->attrs[i].ns = old->attrs[i].ns;
+		node->attrs[i].name = strdup(old->attrs[i].name);
+		node->attrs[i].value = strdup(old->attrs[i].value);
+	}
+	node->n_attrs = old->n_attrs;
+}
+
+/* Apply a batch of commands to the client's tree */
+static hubbub_error apply(const hubbub_treelog_command *cmds, size_t n,
+		void *pw)
+{
+	const hubbub_string *str;
+	node_t *node;
+	size_t i;
+
+	UNUSED(pw);
+
+	batches++;
+
+	for (i = 0; i < n; i++) {
+		const hubbub_treelog_command *cmd = &cmds[i];
+
+		switch (cmd->op) {
+		case HUBBUB_TREELOG_CREATE_COMMENT:
+			node = new_node(cmd->node, COMMENT);
+			node->content = string_dup(&cmd->data.string);
+			break;
+		case HUBBUB_TREELOG_CREATE_DOCTYPE:
+			node = new_node(cmd->node, DOCTYPE);
+			node->name = string_dup(&cmd->data.doctype.name);
+			if (!cmd->data.doctype.public_missing)
+				node->public_id = string_dup(
+						&cmd->data.doctype.public_id);
+			if (!cmd->data.doctype.system_missing)
+				node->system_id = string_dup(
+						&cmd->data.doctype.system_id);
+			break;
+		case HUBBUB_TREELOG_CREATE_ELEMENT:
+			node = new_node(cmd->node, ELEMENT);
+			node->ns = cmd->data.tag.ns;
+			node->name = string_dup(&cmd->data.tag.name);
+			add_attrs(node, cmd->data.tag.attributes,
+					cmd->data.tag.n_attributes);
+			break;
+		case HUBBUB_TREELOG_CREATE_TEXT:
+			node = new_node(cmd->node, CHARACTER);
+			node->content = string_dup(&cmd->data.string);
+			break;
+		case HUBBUB_TREELOG_APPEND_CHILD:
+			link_node(cmd->parent, cmd->node, NONE);
+			break;
+		case HUBBUB_TREELOG_INSERT_BEFORE:
+			link_node(cmd->parent, cmd->node, cmd->other);
+			break;
+		case HUBBUB_TREELOG_APPEND_TEXT:
+			str = &cmd->data.string;
+			assert(nodes[cmd->node].type == CHARACTER);
+			nodes[cmd->node].content = string_cat(
+					nodes[cmd->node].content,
+					(const char *) str->ptr, str->len);
+			break;
+		case HUBBUB_TREELOG_MERGE_TEXT:
+			assert(nodes[cmd->node].type == CHARACTER);
+			assert(nodes[cmd->other].type == CHARACTER);
+			nodes[cmd->node].content = string_cat(
+					nodes[cmd->node].content,
+					nodes[cmd->other].content,
+					strlen(nodes[cmd->other].content));
+			break;
+		case HUBBUB_TREELOG_REMOVE_CHILD:
+			assert(nodes[cmd->node].parent == cmd->parent);
+			unlink_node(cmd->node);
+			break;
+		case HUBBUB_TREELOG_CLONE_NODE:
+			clone_node(cmd->node, cmd->other);
+			break;
+		case HUBBUB_TREELOG_REPARENT_CHILDREN:
+			while (nodes[cmd->node].first_child != NONE) {
+				link_node(cmd->parent,
+					nodes[cmd->node].first_child, NONE);
+			}
+			break;
+		case HUBBUB_TREELOG_FORM_ASSOCIATE:
+			assert(nodes[cmd->other].type == ELEMENT);
+			break;
+		case HUBBUB_TREELOG_ADD_ATTRIBUTES:
+			add_attrs(&nodes[cmd->node], cmd->data.tag.attributes,
+					cmd->data.tag.n_attributes);
+			break;
+		case HUBBUB_TREELOG_SET_QUIRKS_MODE:
+			break;
+		case HUBBUB_TREELOG_ENCODING_CHANGE:
+		case HUBBUB_TREELOG_COMPLETE_SCRIPT:
+			/* These end a batch */
+			assert(i == n - 1);
+			break;
+		}
+	}
+
+	return HUBBUB_OK;
+}
+
+static void free_tree(void)
+{
+	uint32_t i, j;
+
+	for (i = 0; i < n_nodes; i++) {
+		for (j = 0; j < nodes[i].n_attrs; j++) {
+			free(nodes[i].attrs[j].name);
+			free(nodes[i].attrs[j].value);
+		}
+		free(nodes[i].attrs);
+		free(nodes[i].name);
+		free(nodes[i].content);
+		free(nodes[i].public_id);
+		free(nodes[i].system_id);
+	}
+
+	free(nodes);
+	nodes = NULL;
+	n_nodes = 0;
+}
+
+/*** Serialising bits ***/
+
+static void buf_add(buf_t *buf, const char *str)
+{
+	size_t len = strlen(str);
+
+	while (buf->pos + len + 1 > buf->len) {
+		buf->len = buf->len ? buf->len * 2 : 1024;
+		buf->buf = realloc(buf->buf, buf->len);
+		assert(buf->buf != NULL);
+	}
+
+	memcpy(buf->buf + buf->pos, str, len + 1);
+	buf->pos += len;
+}
+
+static int compare_attrs(const void *a, const void *b)
+{
+	const attr_t *first = a;
+	const attr_t *second = b;
+
+	return strcmp(first->name, second->name);
+}
+
+static void indent(buf_t *buf, unsigned depth)
+{
+	unsigned int i;
+
+	buf_add(buf, "| ");
+
+	for (i = 0; i < depth; i++)
+		buf_add(buf, "  ");
+}
+
+static void print_ns(buf_t *buf, hubbub_ns ns)
+{
+	assert(ns < NUM_NAMESPACES);
+
+	if (ns_names[ns] != NULL) {
+		buf_add(buf, ns_names[ns]);
+		buf_add(buf, " ");
+	}
+}
+
+static void node_print(buf_t *buf, uint32_t id, unsigned depth)
+{
+	uint32_t i;
+
+	for (id = nodes[id].first_child; id != NONE; id = nodes[id].next) {
+		node_t *node = &nodes[id];
+
+		indent(buf, depth);
+
+		switch (node->type) {
+		case DOCTYPE:
+			buf_add(buf, "<!DOCTYPE ");
+			buf_add(buf, node->name);
+
+			if (node->public_id != NULL ||
+					node->system_id != NULL) {
+				buf_add(buf, " \"");
+				if (node->public_id != NULL)
+					buf_add(buf, node->public_id);
+				buf_add(buf, "\" \"");
+				if (node->system_id != NULL)
+					buf_add(buf, node->system_id);
+				buf_add(buf, "\"");
+			}
+
+			buf_add(buf, ">\n");
+			break;
+		case ELEMENT:
+			buf_add(buf, "<");
+			print_ns(buf, node->ns);
+			buf_add(buf, node->name);
+			buf_add(buf, ">\n");
+
+			if (node->n_attrs > 0) {
+				qsort(node->attrs, node->n_attrs,
+						sizeof(attr_t), compare_attrs);
+			}
+
+			for (i = 0; i < node->n_attrs; i++) {
+				indent(buf, depth + 1);
+				print_ns(buf, node->attrs[i].ns);
+				buf_add(buf, node->attrs[i].name);
+				buf_add(buf, "=\"");
+				buf_add(buf, node->attrs[i].value);
+				buf_add(buf, "\"\n");
+			}
+			break;
+		case CHARACTER:
+			buf_add(buf, "\"");
+			buf_add(buf, node->content);
+			buf_add(buf, "\"\n");
+			break;
+		case COMMENT:
+			buf_add(buf, "<!-- ");
+			buf_add(buf, node->content);
+			buf_add(buf, " -->\n");
+			break;
+		default:
+			assert(0);
+		}
+
+		node_print(buf, id, depth + 1);
+	}
+}
+
+/* Finish a test, and compare the tree built with that expected */
+static void check_tree(hubbub_parser *parser, hubbub_treelog *log,
+		buf_t *expected, buf_t *got)
+{
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+	assert(hubbub_treelog_flush(log) == HUBBUB_OK);
+
+	/* Trim off the blank line which separates tests */
+	while (expected->pos >= 2 &&
+			expected->buf[expected->pos - 1] == '\n' &&
+			expected->buf[expected->pos - 2] == '\n')
+		expected->buf[--expected->pos] = '\0';
+
+	got->pos = 0;
+	buf_add(got, "");
+	node_print(got, HUBBUB_TREELOG_DOCUMENT, 0);
+
+	if (strcmp(got->buf, expected->buf) != 0) {
+		printf("expected:\n%sgot:\n%s", expected->buf, got->buf);
+		printf("FAIL\n");
+		exit(1);
+	}
+}
+
+/* States for reading in data from the tree construction file */
+enum reading_state {
+	EXPECT_DATA,
+	READING_DATA,
+	READING_DATA_AFTER_FIRST,
+	READING_ERRORS,
+	READING_TREE
+};
+
+int main(int argc, char **argv)
+{
+	hubbub_parser *parser = NULL;
+	hubbub_treelog *log = NULL;
+	hubbub_parser_optparams params;
+	enum reading_state state = EXPECT_DATA;
+	buf_t expected = { NULL, 0, 0 }, got = { NULL, 0, 0 };
+	uint32_t trees = 0;
+	char line[2048];
+	FILE *fp;
+
+	if (argc != 2) {
+		printf("Usage: %s <filename>\n", argv[0]);
+		return 1;
+	}
+
+	fp = fopen(argv[1], "rb");
+	if (fp == NULL) {
+		printf("Failed opening %s\n", argv[1]);
+		return 1;
+	}
+
+	/* We rely on lines not being anywhere near 2048 characters... */
+	while (fgets(line, sizeof line, fp) == line) {
+		if (strcmp(line, "#data\n") == 0) {
+			if (state == READING_TREE) {
+				check_tree(parser, log, &expected, &got);
+				trees++;
+			}
+
+			if (parser != NULL) {
+				hubbub_parser_destroy(parser);
+				hubbub_treelog_destroy(log);
+				free_tree();
+			}
+
+			assert(hubbub_parser_create("UTF-8", false,
+					&parser) == HUBBUB_OK);
+			assert(hubbub_treelog_create(NULL, NULL, apply, NULL,
+					&log) == HUBBUB_OK);
+			assert(hubbub_treelog_attach(log, parser) ==
+					HUBBUB_OK);
+
+			params.enable_scripting = true;
+			assert(hubbub_parser_setopt(parser,
+					HUBBUB_PARSER_ENABLE_SCRIPTING,
+					&params) == HUBBUB_OK);
+
+			new_node(HUBBUB_TREELOG_DOCUMENT, DOCUMENT);
+
+			expected.pos = 0;
+			buf_add(&expected, "");
+
+			state = READING_DATA;
+			continue;
+		}
+
+		switch (state) {
+		case EXPECT_DATA:
+			break;
+		case READING_DATA:
+		case READING_DATA_AFTER_FIRST:
+			if (strcmp(line, "#errors\n") == 0) {
+				state = READING_ERRORS;
+				break;
+			}
+
+			if (state == READING_DATA_AFTER_FIRST) {
+				assert(hubbub_parser_parse_chunk(parser,
+						(const uint8_t *) "\n", 1) ==
+						HUBBUB_OK);
+			}
+			state = READING_DATA_AFTER_FIRST;
+
+			assert(hubbub_parser_parse_chunk(parser,
+					(const uint8_t *) line,
+					strlen(line) - 1) == HUBBUB_OK);
+			break;
+		case READING_ERRORS:
+			if (strcmp(line, "#document\n") == 0)
+				state = READING_TREE;
+			else if (strcmp(line, "#document-fragment\n") == 0 ||
+					strcmp(line, "#max-depth\n") == 0)
+				state = EXPECT_DATA;
+			break;
+		case READING_TREE:
+			buf_add(&expected, line);
+			break;
+		}
+	}
+
+	if (state == READING_TREE) {
+		check_tree(parser, log, &expected, &got);
+		trees++;
+	}
+
+	if (parser != NULL) {
+		hubbub_parser_destroy(parser);
+		hubbub_treelog_destroy(log);
+		free_tree();
+	}
+
+	fclose(fp);
+
+	free(got.buf);
+	free(expected.buf);
+
+	printf("%u trees in %u batches\n", trees, batches);
+	printf("PASS\n");
+
+	return 0;
+}
+
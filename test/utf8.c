@@ -0,0 +1,79 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+
+#include "utils/utf8.h"
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+typedef struct testcase {
+	const char *data;
+	size_t valid;
+	bool truncated;
+} testcase;
+
+static const testcase tests[] = {
+	{ "", 0, false },
+	{ "plain ascii", 11, false },
+	{ "caf\xC3\xA9", 5, false },
+	{ "\xE2\x82\xAC", 3, false },
+	{ "\xF0\x9F\x98\x80", 4, false },
+	{ "\xF4\x8F\xBF\xBF", 4, false },
+	{ "ab\xC3", 2, true },
+	{ "ab\xE2\x82", 2, true },
+	{ "ab\xF0\x9F\x98", 2, true },
+	{ "ab\x80", 2, false },		/* Stray continuation */
+	{ "ab\xC0\xAF", 2, false },	/* Overlong */
+	{ "ab\xE0\x80\xAF", 2, false },	/* Overlong */
+	{ "ab\xED\xA0\x80", 2, false },	/* Surrogate */
+	{ "ab\xF4\x90\x80\x80", 2, false },	/* Beyond U+10FFFF */
+	{ "ab\xF5\x80\x80\x80", 2, false },
+	{ "ab\xC3" "a", 2, false },	/* Missing continuation */
+	{ "ab\xE0\x80", 2, false },	/* Can never be completed */
+};
+
+int main(int argc, char **argv)
+{
+	uint8_t buf[256];
+	size_t i, pos;
+	bool truncated;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	for (i = 0; i < N_ELEMENTS(tests); i++) {
+		const testcase *t = &tests[i];
+
+		assert(hubbub_utf8_valid_length((const uint8_t *) t->data,
+				strlen(t->data), &truncated) == t->valid);
+		assert(truncated == t->truncated);
+	}
+
+	/* Place a bad byte at every position in a long run of ASCII, so
+	 * that it falls in each lane of a block and in the tail */
+	for (pos = 0; pos < sizeof(buf); pos++) {
+		memset(buf, 'x', sizeof(buf));
+		buf[pos] = 0xFF;
+
+		assert(hubbub_utf8_valid_length(buf, sizeof(buf),
+				&truncated) == pos);
+		assert(truncated == false);
+
+		/* And a valid character, which is skipped */
+		if (pos + 2 <= sizeof(buf)) {
+			buf[pos] = 0xC3;
+			buf[pos + 1] = 0xA9;
+
+			assert(hubbub_utf8_valid_length(buf, sizeof(buf),
+					&truncated) == sizeof(buf));
+		}
+	}
+
+	printf("PASS\n");
+
+	return 0;
+}